@@ -0,0 +1,483 @@
+/* mongo-bson-columns-kernels.c
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "mongo-bson-columns-private.h"
+
+/*
+ * The x86 kernels are compiled with per-function target attributes so
+ * that the library itself does not require AVX2, and are selected at
+ * runtime from the features of the CPU. Setting MONGO_GLIB_KERNELS to
+ * "scalar", "sse2" or "avx2" selects those kernels if they are supported.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#if defined(__clang__)
+#define HAVE_X86_KERNELS 1
+#elif defined(__GNUC__)
+#if (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9))
+#define HAVE_X86_KERNELS 1
+#endif
+#endif
+#endif
+
+#ifdef HAVE_X86_KERNELS
+#include <immintrin.h>
+#define TARGET(t) __attribute__((target(t)))
+#endif
+
+#define IS_VALID(v, i) ((v)[(i) >> 3] & (1 << ((i) & 7)))
+
+static gdouble
+sum_double_scalar (const gdouble *values,
+                   gsize          n_values)
+{
+   gdouble sum = 0.0;
+   gsize i;
+
+   for (i = 0; i < n_values; i++) {
+      sum += values[i];
+   }
+
+   return sum;
+}
+
+static gint64
+sum_int64_scalar (const gint64 *values,
+                  gsize         n_values)
+{
+   guint64 sum = 0;
+   gsize i;
+
+   /*
+    * Accumulate unsigned so that overflow wraps like the vector kernels.
+    */
+   for (i = 0; i < n_values; i++) {
+      sum += (guint64)values[i];
+   }
+
+   return (gint64)sum;
+}
+
+/*
+ * The range variants scan rows @begin to @end so that the vector kernels
+ * can finish a column without realigning the validity bitmap.
+ */
+static void
+min_max_double_range (const gdouble *values,
+                      const guint8  *validity,
+                      gsize          begin,
+                      gsize          end,
+                      gdouble       *min,
+                      gdouble       *max)
+{
+   gdouble lo = *min;
+   gdouble hi = *max;
+   gsize i;
+
+   for (i = begin; i < end; i++) {
+      if (!validity || IS_VALID(validity, i)) {
+         if (values[i] < lo) {
+            lo = values[i];
+         }
+         if (values[i] > hi) {
+            hi = values[i];
+         }
+      }
+   }
+
+   *min = lo;
+   *max = hi;
+}
+
+static void
+min_max_double_scalar (const gdouble *values,
+                       const guint8  *validity,
+                       gsize          n_values,
+                       gdouble       *min,
+                       gdouble       *max)
+{
+   min_max_double_range(values, validity, 0, n_values, min, max);
+}
+
+static void
+min_max_int64_range (const gint64 *values,
+                     const guint8 *validity,
+                     gsize         begin,
+                     gsize         end,
+                     gint64       *min,
+                     gint64       *max)
+{
+   gint64 lo = *min;
+   gint64 hi = *max;
+   gsize i;
+
+   for (i = begin; i < end; i++) {
+      if (!validity || IS_VALID(validity, i)) {
+         lo = MIN(lo, values[i]);
+         hi = MAX(hi, values[i]);
+      }
+   }
+
+   *min = lo;
+   *max = hi;
+}
+
+static void
+min_max_int64_scalar (const gint64 *values,
+                      const guint8 *validity,
+                      gsize         n_values,
+                      gint64       *min,
+                      gint64       *max)
+{
+   min_max_int64_range(values, validity, 0, n_values, min, max);
+}
+
+static const MongoBsonColumnsKernels scalar_kernels = {
+   "scalar",
+   sum_double_scalar,
+   sum_int64_scalar,
+   min_max_double_scalar,
+   min_max_int64_scalar,
+};
+
+#ifdef HAVE_X86_KERNELS
+
+/*
+ * Vector kernels process whole groups of 4 (AVX2) or 2 (SSE2) rows, which
+ * always fall within a single byte of the validity bitmap, and hand the
+ * remaining rows to the scalar kernels.
+ */
+
+static TARGET("sse2") gdouble
+sum_double_sse2 (const gdouble *values,
+                 gsize          n_values)
+{
+   gdouble lanes[2];
+   __m128d acc0 = _mm_setzero_pd();
+   __m128d acc1 = _mm_setzero_pd();
+   gsize i;
+
+   for (i = 0; (i + 4) <= n_values; i += 4) {
+      acc0 = _mm_add_pd(acc0, _mm_loadu_pd(values + i));
+      acc1 = _mm_add_pd(acc1, _mm_loadu_pd(values + i + 2));
+   }
+
+   _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+
+   return lanes[0] + lanes[1] + sum_double_scalar(values + i, n_values - i);
+}
+
+static TARGET("sse2") gint64
+sum_int64_sse2 (const gint64 *values,
+                gsize         n_values)
+{
+   guint64 lanes[2];
+   __m128i acc = _mm_setzero_si128();
+   gsize i;
+
+   for (i = 0; (i + 2) <= n_values; i += 2) {
+      acc = _mm_add_epi64(acc, _mm_loadu_si128((const __m128i *)(values + i)));
+   }
+
+   _mm_storeu_si128((__m128i *)lanes, acc);
+
+   return (gint64)(lanes[0] + lanes[1] +
+                   (guint64)sum_int64_scalar(values + i, n_values - i));
+}
+
+static TARGET("sse2") void
+min_max_double_sse2 (const gdouble *values,
+                     const guint8  *validity,
+                     gsize          n_values,
+                     gdouble       *min,
+                     gdouble       *max)
+{
+   gdouble lanes[2];
+   __m128d pinf = _mm_set1_pd(HUGE_VAL);
+   __m128d ninf = _mm_set1_pd(-HUGE_VAL);
+   __m128d vmin = pinf;
+   __m128d vmax = ninf;
+   __m128d mask;
+   __m128d lo;
+   __m128d hi;
+   __m128d v;
+   guint bits;
+   gsize i;
+
+   for (i = 0; (i + 2) <= n_values; i += 2) {
+      v = _mm_loadu_pd(values + i);
+      if (validity) {
+         bits = validity[i >> 3] >> (i & 6);
+         mask = _mm_castsi128_pd(_mm_set_epi32(-(gint)((bits >> 1) & 1),
+                                               -(gint)((bits >> 1) & 1),
+                                               -(gint)(bits & 1),
+                                               -(gint)(bits & 1)));
+         lo = _mm_or_pd(_mm_and_pd(mask, v), _mm_andnot_pd(mask, pinf));
+         hi = _mm_or_pd(_mm_and_pd(mask, v), _mm_andnot_pd(mask, ninf));
+      } else {
+         lo = hi = v;
+      }
+      /*
+       * minpd returns the second operand if either is NaN, which keeps
+       * NaN values out of the accumulators.
+       */
+      vmin = _mm_min_pd(lo, vmin);
+      vmax = _mm_max_pd(hi, vmax);
+   }
+
+   _mm_storeu_pd(lanes, vmin);
+   *min = MIN(*min, MIN(lanes[0], lanes[1]));
+   _mm_storeu_pd(lanes, vmax);
+   *max = MAX(*max, MAX(lanes[0], lanes[1]));
+
+   min_max_double_range(values, validity, i, n_values, min, max);
+}
+
+static const MongoBsonColumnsKernels sse2_kernels = {
+   "sse2",
+   sum_double_sse2,
+   sum_int64_sse2,
+   min_max_double_sse2,
+   min_max_int64_scalar, /* 64-bit compares need SSE4.2 */
+};
+
+static TARGET("avx2") __m256i
+lane_mask_avx2 (const guint8 *validity,
+                gsize         i)
+{
+   const __m256i bits = _mm256_set_epi64x(8, 4, 2, 1);
+   __m256i nibble;
+
+   nibble = _mm256_set1_epi64x((validity[i >> 3] >> (i & 4)) & 0xF);
+   return _mm256_cmpeq_epi64(_mm256_and_si256(nibble, bits), bits);
+}
+
+static TARGET("avx2") gdouble
+sum_double_avx2 (const gdouble *values,
+                 gsize          n_values)
+{
+   gdouble lanes[4];
+   __m256d acc0 = _mm256_setzero_pd();
+   __m256d acc1 = _mm256_setzero_pd();
+   gsize i;
+
+   for (i = 0; (i + 8) <= n_values; i += 8) {
+      acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(values + i));
+      acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(values + i + 4));
+   }
+
+   _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+
+   return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) +
+          sum_double_scalar(values + i, n_values - i);
+}
+
+static TARGET("avx2") gint64
+sum_int64_avx2 (const gint64 *values,
+                gsize         n_values)
+{
+   guint64 lanes[4];
+   __m256i acc = _mm256_setzero_si256();
+   gsize i;
+
+   for (i = 0; (i + 4) <= n_values; i += 4) {
+      acc = _mm256_add_epi64(acc,
+         _mm256_loadu_si256((const __m256i *)(values + i)));
+   }
+
+   _mm256_storeu_si256((__m256i *)lanes, acc);
+
+   return (gint64)(lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+                   (guint64)sum_int64_scalar(values + i, n_values - i));
+}
+
+static TARGET("avx2") void
+min_max_double_avx2 (const gdouble *values,
+                     const guint8  *validity,
+                     gsize          n_values,
+                     gdouble       *min,
+                     gdouble       *max)
+{
+   gdouble lanes[4];
+   __m256d pinf = _mm256_set1_pd(HUGE_VAL);
+   __m256d ninf = _mm256_set1_pd(-HUGE_VAL);
+   __m256d vmin = pinf;
+   __m256d vmax = ninf;
+   __m256d mask;
+   __m256d lo;
+   __m256d hi;
+   __m256d v;
+   gsize i;
+
+   for (i = 0; (i + 4) <= n_values; i += 4) {
+      v = _mm256_loadu_pd(values + i);
+      if (validity) {
+         mask = _mm256_castsi256_pd(lane_mask_avx2(validity, i));
+         lo = _mm256_blendv_pd(pinf, v, mask);
+         hi = _mm256_blendv_pd(ninf, v, mask);
+      } else {
+         lo = hi = v;
+      }
+      vmin = _mm256_min_pd(lo, vmin);
+      vmax = _mm256_max_pd(hi, vmax);
+   }
+
+   _mm256_storeu_pd(lanes, vmin);
+   *min = MIN(*min, MIN(MIN(lanes[0], lanes[1]), MIN(lanes[2], lanes[3])));
+   _mm256_storeu_pd(lanes, vmax);
+   *max = MAX(*max, MAX(MAX(lanes[0], lanes[1]), MAX(lanes[2], lanes[3])));
+
+   min_max_double_range(values, validity, i, n_values, min, max);
+}
+
+static TARGET("avx2") void
+min_max_int64_avx2 (const gint64 *values,
+                    const guint8 *validity,
+                    gsize         n_values,
+                    gint64       *min,
+                    gint64       *max)
+{
+   gint64 lanes[4];
+   __m256i imax = _mm256_set1_epi64x(G_MAXINT64);
+   __m256i imin = _mm256_set1_epi64x(G_MININT64);
+   __m256i vmin = imax;
+   __m256i vmax = imin;
+   __m256i mask;
+   __m256i lo;
+   __m256i hi;
+   __m256i v;
+   gsize i;
+   guint j;
+
+   for (i = 0; (i + 4) <= n_values; i += 4) {
+      v = _mm256_loadu_si256((const __m256i *)(values + i));
+      if (validity) {
+         mask = lane_mask_avx2(validity, i);
+         lo = _mm256_blendv_epi8(imax, v, mask);
+         hi = _mm256_blendv_epi8(imin, v, mask);
+      } else {
+         lo = hi = v;
+      }
+      vmin = _mm256_blendv_epi8(vmin, lo, _mm256_cmpgt_epi64(vmin, lo));
+      vmax = _mm256_blendv_epi8(vmax, hi, _mm256_cmpgt_epi64(hi, vmax));
+   }
+
+   _mm256_storeu_si256((__m256i *)lanes, vmin);
+   for (j = 0; j < 4; j++) {
+      *min = MIN(*min, lanes[j]);
+   }
+   _mm256_storeu_si256((__m256i *)lanes, vmax);
+   for (j = 0; j < 4; j++) {
+      *max = MAX(*max, lanes[j]);
+   }
+
+   min_max_int64_range(values, validity, i, n_values, min, max);
+}
+
+static const MongoBsonColumnsKernels avx2_kernels = {
+   "avx2",
+   sum_double_avx2,
+   sum_int64_avx2,
+   min_max_double_avx2,
+   min_max_int64_avx2,
+};
+
+#endif /* HAVE_X86_KERNELS */
+
+static const MongoBsonColumnsKernels *gKernels;
+
+/**
+ * mongo_bson_columns_lookup_kernels:
+ * @name: (in): "scalar", "sse2" or "avx2".
+ *
+ * Fetches the aggregation kernels named @name.
+ *
+ * Returns: A #MongoBsonColumnsKernels that should not be freed, or %NULL
+ *   if they are not compiled in or not supported by the CPU.
+ */
+const MongoBsonColumnsKernels *
+mongo_bson_columns_lookup_kernels (const gchar *name)
+{
+   g_return_val_if_fail(name != NULL, NULL);
+
+   if (!strcmp(name, "scalar")) {
+      return &scalar_kernels;
+   }
+
+#ifdef HAVE_X86_KERNELS
+   __builtin_cpu_init();
+   if (!strcmp(name, "sse2") && __builtin_cpu_supports("sse2")) {
+      return &sse2_kernels;
+   } else if (!strcmp(name, "avx2") && __builtin_cpu_supports("avx2")) {
+      return &avx2_kernels;
+   }
+#endif
+
+   return NULL;
+}
+
+/**
+ * mongo_bson_columns_get_kernels:
+ *
+ * Fetches the fastest aggregation kernels supported by the CPU, or those
+ * set with mongo_bson_columns_set_kernels().
+ *
+ * Returns: A #MongoBsonColumnsKernels that should not be freed.
+ */
+const MongoBsonColumnsKernels *
+mongo_bson_columns_get_kernels (void)
+{
+   static gsize initialized = FALSE;
+   const MongoBsonColumnsKernels *kernels = NULL;
+   const gchar *limit;
+
+   if (g_once_init_enter(&initialized)) {
+      if ((limit = g_getenv("MONGO_GLIB_KERNELS"))) {
+         kernels = mongo_bson_columns_lookup_kernels(limit);
+      }
+      if (!kernels && !(kernels = mongo_bson_columns_lookup_kernels("avx2"))) {
+         kernels = mongo_bson_columns_lookup_kernels("sse2");
+      }
+      if (!kernels) {
+         kernels = &scalar_kernels;
+      }
+      g_atomic_pointer_set(&gKernels, kernels);
+      g_once_init_leave(&initialized, TRUE);
+   }
+
+   return g_atomic_pointer_get(&gKernels);
+}
+
+/**
+ * mongo_bson_columns_set_kernels:
+ * @kernels: (in): A #MongoBsonColumnsKernels from
+ *   mongo_bson_columns_lookup_kernels().
+ *
+ * Replaces the kernels used by every #MongoBsonColumns. This is meant for
+ * tests that compare the implementations.
+ */
+void
+mongo_bson_columns_set_kernels (const MongoBsonColumnsKernels *kernels)
+{
+   g_return_if_fail(kernels != NULL);
+
+   mongo_bson_columns_get_kernels();
+   g_atomic_pointer_set(&gKernels, kernels);
+}
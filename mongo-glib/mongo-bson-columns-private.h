@@ -0,0 +1,57 @@
+/* mongo-bson-columns-private.h
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MONGO_BSON_COLUMNS_PRIVATE_H
+#define MONGO_BSON_COLUMNS_PRIVATE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Aggregation kernels over column arrays. Null rows hold zero, so sums do
+ * not need the validity bitmap. The min/max kernels skip null rows when
+ * @validity is not %NULL and ignore NaN values; if no value was seen,
+ * @min is left larger than @max.
+ */
+typedef struct
+{
+   const gchar *name;
+   gdouble (*sum_double)     (const gdouble *values,
+                              gsize          n_values);
+   gint64  (*sum_int64)      (const gint64  *values,
+                              gsize          n_values);
+   void    (*min_max_double) (const gdouble *values,
+                              const guint8  *validity,
+                              gsize          n_values,
+                              gdouble       *min,
+                              gdouble       *max);
+   void    (*min_max_int64)  (const gint64  *values,
+                              const guint8  *validity,
+                              gsize          n_values,
+                              gint64        *min,
+                              gint64        *max);
+} MongoBsonColumnsKernels;
+
+const MongoBsonColumnsKernels *mongo_bson_columns_get_kernels    (void);
+const MongoBsonColumnsKernels *mongo_bson_columns_lookup_kernels (const gchar                   *name);
+void                           mongo_bson_columns_set_kernels    (const MongoBsonColumnsKernels *kernels);
+
+G_END_DECLS
+
+#endif /* MONGO_BSON_COLUMNS_PRIVATE_H */
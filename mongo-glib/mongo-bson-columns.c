@@ -0,0 +1,1075 @@
+/* mongo-bson-columns.c
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "mongo-bson-columns.h"
+#include "mongo-bson-columns-private.h"
+
+/*
+ * Each column keeps its values in a contiguous array with one entry per
+ * row, including rows where the value is null, so that row i of every
+ * column is at index i. Strings are stored back to back in a single
+ * buffer, with n_rows + 1 offsets delimiting them. Validity is a bitmap
+ * with the least significant bit of the first byte for row 0, where a set
+ * bit means the value is present.
+ *
+ * The paths are compiled into a tree so that each document is walked once
+ * no matter how many columns are extracted from it.
+ */
+
+typedef struct
+{
+   gchar               *path;
+   MongoBsonColumnType  type;
+   GArray              *values;
+   GByteArray          *strings;
+   GByteArray          *validity;
+   guint                null_count;
+} MongoBsonColumn;
+
+typedef struct _MongoBsonColumnsNode MongoBsonColumnsNode;
+
+struct _MongoBsonColumnsNode
+{
+   gchar     *key;
+   GArray    *columns;  /* Indexes of the columns ending at this node */
+   GPtrArray *children; /* MongoBsonColumnsNode */
+};
+
+struct _MongoBsonColumns
+{
+   volatile gint         ref_count;
+   MongoBsonColumn      *columns;
+   guint                 n_columns;
+   guint                 n_rows;
+   MongoBsonColumnsNode *root;
+};
+
+static MongoBsonColumnsNode *
+mongo_bson_columns_node_new (const gchar *key)
+{
+   MongoBsonColumnsNode *node;
+
+   node = g_slice_new0(MongoBsonColumnsNode);
+   node->key = g_strdup(key);
+   node->columns = g_array_new(FALSE, FALSE, sizeof(guint));
+   node->children = g_ptr_array_new();
+
+   return node;
+}
+
+static void
+mongo_bson_columns_node_free (MongoBsonColumnsNode *node)
+{
+   guint i;
+
+   for (i = 0; i < node->children->len; i++) {
+      mongo_bson_columns_node_free(g_ptr_array_index(node->children, i));
+   }
+
+   g_ptr_array_free(node->children, TRUE);
+   g_array_free(node->columns, TRUE);
+   g_free(node->key);
+   g_slice_free(MongoBsonColumnsNode, node);
+}
+
+static MongoBsonColumnsNode *
+mongo_bson_columns_node_get_child (MongoBsonColumnsNode *node,
+                                   const gchar          *key)
+{
+   MongoBsonColumnsNode *child;
+   guint i;
+
+   for (i = 0; i < node->children->len; i++) {
+      child = g_ptr_array_index(node->children, i);
+      if (!strcmp(child->key, key)) {
+         return child;
+      }
+   }
+
+   child = mongo_bson_columns_node_new(key);
+   g_ptr_array_add(node->children, child);
+
+   return child;
+}
+
+/**
+ * mongo_bson_columns_new:
+ * @paths: (in) (array length=n_columns): Dotted field paths.
+ * @types: (in) (array length=n_columns): The type of each column.
+ * @n_columns: (in): The number of columns.
+ *
+ * Creates a new #MongoBsonColumns that extracts the fields at @paths from
+ * documents into typed column arrays. Array elements may be addressed by
+ * their index, such as "tags.0".
+ *
+ * Returns: (transfer full): A #MongoBsonColumns that should be freed with
+ *   mongo_bson_columns_unref().
+ */
+MongoBsonColumns *
+mongo_bson_columns_new (const gchar * const       *paths,
+                        const MongoBsonColumnType *types,
+                        guint                      n_columns)
+{
+   MongoBsonColumnsNode *node;
+   MongoBsonColumns *columns;
+   MongoBsonColumn *column;
+   gchar **parts;
+   guint i;
+   guint j;
+
+   g_return_val_if_fail(paths != NULL || !n_columns, NULL);
+   g_return_val_if_fail(types != NULL || !n_columns, NULL);
+
+   columns = g_slice_new0(MongoBsonColumns);
+   columns->ref_count = 1;
+   columns->columns = g_new0(MongoBsonColumn, n_columns);
+   columns->n_columns = n_columns;
+   columns->root = mongo_bson_columns_node_new(NULL);
+
+   for (i = 0; i < n_columns; i++) {
+      column = &columns->columns[i];
+      column->path = g_strdup(paths[i]);
+      column->type = types[i];
+      column->validity = g_byte_array_new();
+
+      switch (types[i]) {
+      case MONGO_BSON_COLUMN_INT64:
+         column->values = g_array_new(FALSE, TRUE, sizeof(gint64));
+         break;
+      case MONGO_BSON_COLUMN_DOUBLE:
+         column->values = g_array_new(FALSE, TRUE, sizeof(gdouble));
+         break;
+      case MONGO_BSON_COLUMN_STRING:
+         column->values = g_array_new(FALSE, TRUE, sizeof(guint32));
+         g_array_set_size(column->values, 1);
+         column->strings = g_byte_array_new();
+         break;
+      default:
+         g_warning("Invalid column type %d.", types[i]);
+         column->type = MONGO_BSON_COLUMN_INT64;
+         column->values = g_array_new(FALSE, TRUE, sizeof(gint64));
+         break;
+      }
+
+      node = columns->root;
+      parts = g_strsplit(paths[i], ".", 0);
+      for (j = 0; parts[j]; j++) {
+         node = mongo_bson_columns_node_get_child(node, parts[j]);
+      }
+      g_array_append_val(node->columns, i);
+      g_strfreev(parts);
+   }
+
+   return columns;
+}
+
+static void
+mongo_bson_columns_set_value (MongoBsonColumn        *column,
+                              guint                   row,
+                              const MongoBsonRawIter *iter)
+{
+   MongoDecimal128 decimal;
+   guint32 *offsets;
+   gdouble dvalue;
+   gint64 ivalue;
+   gint32 len;
+
+   switch (column->type) {
+   case MONGO_BSON_COLUMN_INT64:
+      switch ((MongoBsonType)iter->type) {
+      case MONGO_BSON_INT32:
+         ivalue = mongo_bson_raw_iter_get_value_int(iter);
+         break;
+      case MONGO_BSON_INT64:
+         ivalue = mongo_bson_raw_iter_get_value_int64(iter);
+         break;
+      case MONGO_BSON_DATE_TIME:
+         memcpy(&ivalue, iter->value1, sizeof ivalue);
+         ivalue = GINT64_FROM_LE(ivalue);
+         break;
+      case MONGO_BSON_DOUBLE:
+      case MONGO_BSON_UTF8:
+      case MONGO_BSON_DOCUMENT:
+      case MONGO_BSON_ARRAY:
+      case MONGO_BSON_BINARY:
+      case MONGO_BSON_UNDEFINED:
+      case MONGO_BSON_OBJECT_ID:
+      case MONGO_BSON_BOOLEAN:
+      case MONGO_BSON_NULL:
+      case MONGO_BSON_REGEX:
+      case MONGO_BSON_DBPOINTER:
+      case MONGO_BSON_JAVASCRIPT:
+      case MONGO_BSON_SYMBOL:
+      case MONGO_BSON_JAVASCRIPT_WITH_SCOPE:
+      case MONGO_BSON_TIMESTAMP:
+      case MONGO_BSON_DECIMAL128:
+      case MONGO_BSON_MAX_KEY:
+      case MONGO_BSON_MIN_KEY:
+      default:
+         return;
+      }
+      g_array_index(column->values, gint64, row) = ivalue;
+      break;
+   case MONGO_BSON_COLUMN_DOUBLE:
+      switch ((MongoBsonType)iter->type) {
+      case MONGO_BSON_DOUBLE:
+         dvalue = mongo_bson_raw_iter_get_value_double(iter);
+         break;
+      case MONGO_BSON_INT32:
+         dvalue = mongo_bson_raw_iter_get_value_int(iter);
+         break;
+      case MONGO_BSON_INT64:
+         dvalue = mongo_bson_raw_iter_get_value_int64(iter);
+         break;
+      case MONGO_BSON_DECIMAL128:
+         mongo_bson_raw_iter_get_value_decimal128(iter, &decimal);
+         dvalue = mongo_decimal128_to_double(&decimal);
+         break;
+      case MONGO_BSON_UTF8:
+      case MONGO_BSON_DOCUMENT:
+      case MONGO_BSON_ARRAY:
+      case MONGO_BSON_BINARY:
+      case MONGO_BSON_UNDEFINED:
+      case MONGO_BSON_OBJECT_ID:
+      case MONGO_BSON_BOOLEAN:
+      case MONGO_BSON_DATE_TIME:
+      case MONGO_BSON_NULL:
+      case MONGO_BSON_REGEX:
+      case MONGO_BSON_DBPOINTER:
+      case MONGO_BSON_JAVASCRIPT:
+      case MONGO_BSON_SYMBOL:
+      case MONGO_BSON_JAVASCRIPT_WITH_SCOPE:
+      case MONGO_BSON_TIMESTAMP:
+      case MONGO_BSON_MAX_KEY:
+      case MONGO_BSON_MIN_KEY:
+      default:
+         return;
+      }
+      g_array_index(column->values, gdouble, row) = dvalue;
+      break;
+   case MONGO_BSON_COLUMN_STRING:
+      if (iter->type != MONGO_BSON_UTF8) {
+         return;
+      }
+      /*
+       * The row is the last one, so a repeated key simply replaces the
+       * string that was stored for it.
+       */
+      offsets = (guint32 *)column->values->data;
+      memcpy(&len, iter->value1, sizeof len);
+      g_byte_array_set_size(column->strings, offsets[row]);
+      g_byte_array_append(column->strings, iter->value2,
+                          GINT32_FROM_LE(len) - 1);
+      offsets[row + 1] = column->strings->len;
+      break;
+   default:
+      g_assert_not_reached();
+      return;
+   }
+
+   if (!(column->validity->data[row / 8] & (1 << (row % 8)))) {
+      column->validity->data[row / 8] |= (1 << (row % 8));
+      column->null_count--;
+   }
+}
+
+static void
+mongo_bson_columns_walk (MongoBsonColumns     *columns,
+                         MongoBsonColumnsNode *node,
+                         const guint8         *data,
+                         gsize                 length,
+                         guint                 row)
+{
+   MongoBsonColumnsNode *child;
+   MongoBsonRawIter iter;
+   guint32 child_len;
+   guint i;
+   guint j;
+
+   mongo_bson_raw_iter_init_from_data(&iter, data, length);
+
+   while (mongo_bson_raw_iter_next(&iter)) {
+      for (i = 0; i < node->children->len; i++) {
+         child = g_ptr_array_index(node->children, i);
+         if (!strcmp(child->key, iter.key)) {
+            for (j = 0; j < child->columns->len; j++) {
+               mongo_bson_columns_set_value(
+                  &columns->columns[g_array_index(child->columns, guint, j)],
+                  row, &iter);
+            }
+            if (child->children->len &&
+                ((iter.type == MONGO_BSON_DOCUMENT) ||
+                 (iter.type == MONGO_BSON_ARRAY))) {
+               memcpy(&child_len, iter.value1, sizeof child_len);
+               mongo_bson_columns_walk(columns, child, iter.value1,
+                                       GUINT32_FROM_LE(child_len), row);
+            }
+            break;
+         }
+      }
+   }
+}
+
+/**
+ * mongo_bson_columns_append_data:
+ * @columns: (in): A #MongoBsonColumns.
+ * @data: (in) (array length=length): A buffer containing a BSON document.
+ * @length: (in): The length of @data.
+ *
+ * Appends a row to every column from the document in @data. Fields that
+ * are missing or have a type the column does not accept are null.
+ */
+void
+mongo_bson_columns_append_data (MongoBsonColumns *columns,
+                                const guint8     *data,
+                                gsize             length)
+{
+   MongoBsonColumn *column;
+   const guint8 zero = 0;
+   guint32 offset;
+   guint row;
+   guint i;
+
+   g_return_if_fail(columns != NULL);
+   g_return_if_fail(data != NULL);
+
+   row = columns->n_rows++;
+
+   for (i = 0; i < columns->n_columns; i++) {
+      column = &columns->columns[i];
+      if (!(row % 8)) {
+         g_byte_array_append(column->validity, &zero, 1);
+      }
+      column->null_count++;
+      if (column->type == MONGO_BSON_COLUMN_STRING) {
+         offset = g_array_index(column->values, guint32, row);
+         g_array_append_val(column->values, offset);
+      } else {
+         g_array_set_size(column->values, row + 1);
+      }
+   }
+
+   mongo_bson_columns_walk(columns, columns->root, data, length, row);
+}
+
+/**
+ * mongo_bson_columns_append:
+ * @columns: (in): A #MongoBsonColumns.
+ * @bson: (in): A #MongoBson.
+ *
+ * Appends a row to every column from @bson.
+ * See mongo_bson_columns_append_data().
+ */
+void
+mongo_bson_columns_append (MongoBsonColumns *columns,
+                           MongoBson        *bson)
+{
+   const guint8 *data;
+   gsize length;
+
+   g_return_if_fail(columns != NULL);
+   g_return_if_fail(bson != NULL);
+
+   data = mongo_bson_get_data(bson, &length);
+   mongo_bson_columns_append_data(columns, data, length);
+}
+
+/**
+ * mongo_bson_columns_extract:
+ * @columns: (in): A #MongoBsonColumns.
+ * @documents: (in) (array length=n_documents): An array of #MongoBson.
+ * @n_documents: (in): The number of documents.
+ *
+ * Replaces the contents of @columns with one row per document in
+ * @documents. The column arrays are reused, so extracting batches of a
+ * similar size does not allocate once the arrays have grown.
+ */
+void
+mongo_bson_columns_extract (MongoBsonColumns  *columns,
+                            MongoBson        **documents,
+                            guint              n_documents)
+{
+   guint i;
+
+   g_return_if_fail(columns != NULL);
+   g_return_if_fail(documents != NULL || !n_documents);
+
+   mongo_bson_columns_clear(columns);
+
+   for (i = 0; i < n_documents; i++) {
+      mongo_bson_columns_append(columns, documents[i]);
+   }
+}
+
+/**
+ * mongo_bson_columns_clear:
+ * @columns: (in): A #MongoBsonColumns.
+ *
+ * Removes all rows from @columns, keeping the allocated arrays.
+ */
+void
+mongo_bson_columns_clear (MongoBsonColumns *columns)
+{
+   MongoBsonColumn *column;
+   guint i;
+
+   g_return_if_fail(columns != NULL);
+
+   for (i = 0; i < columns->n_columns; i++) {
+      column = &columns->columns[i];
+      if (column->type == MONGO_BSON_COLUMN_STRING) {
+         g_array_set_size(column->values, 1);
+         g_byte_array_set_size(column->strings, 0);
+      } else {
+         g_array_set_size(column->values, 0);
+      }
+      g_byte_array_set_size(column->validity, 0);
+      column->null_count = 0;
+   }
+
+   columns->n_rows = 0;
+}
+
+/**
+ * mongo_bson_columns_get_n_columns:
+ * @columns: (in): A #MongoBsonColumns.
+ *
+ * Fetches the number of columns.
+ *
+ * Returns: A #guint.
+ */
+guint
+mongo_bson_columns_get_n_columns (MongoBsonColumns *columns)
+{
+   g_return_val_if_fail(columns != NULL, 0);
+   return columns->n_columns;
+}
+
+/**
+ * mongo_bson_columns_get_n_rows:
+ * @columns: (in): A #MongoBsonColumns.
+ *
+ * Fetches the number of rows, which is the length of every column.
+ *
+ * Returns: A #guint.
+ */
+guint
+mongo_bson_columns_get_n_rows (MongoBsonColumns *columns)
+{
+   g_return_val_if_fail(columns != NULL, 0);
+   return columns->n_rows;
+}
+
+/**
+ * mongo_bson_columns_get_path:
+ * @columns: (in): A #MongoBsonColumns.
+ * @column: (in): The index of a column.
+ *
+ * Fetches the field path that @column was created with.
+ *
+ * Returns: A string which should not be modified or freed.
+ */
+const gchar *
+mongo_bson_columns_get_path (MongoBsonColumns *columns,
+                             guint             column)
+{
+   g_return_val_if_fail(columns != NULL, NULL);
+   g_return_val_if_fail(column < columns->n_columns, NULL);
+
+   return columns->columns[column].path;
+}
+
+/**
+ * mongo_bson_columns_get_column_type:
+ * @columns: (in): A #MongoBsonColumns.
+ * @column: (in): The index of a column.
+ *
+ * Fetches the type of @column.
+ *
+ * Returns: A #MongoBsonColumnType.
+ */
+MongoBsonColumnType
+mongo_bson_columns_get_column_type (MongoBsonColumns *columns,
+                                    guint             column)
+{
+   g_return_val_if_fail(columns != NULL, 0);
+   g_return_val_if_fail(column < columns->n_columns, 0);
+
+   return columns->columns[column].type;
+}
+
+/**
+ * mongo_bson_columns_get_int64:
+ * @columns: (in): A #MongoBsonColumns.
+ * @column: (in): The index of a %MONGO_BSON_COLUMN_INT64 column.
+ *
+ * Fetches the values of @column. Null rows contain zero.
+ *
+ * Returns: (array) (transfer none): An array of mongo_bson_columns_get_n_rows()
+ *   values, valid until @columns is modified.
+ */
+const gint64 *
+mongo_bson_columns_get_int64 (MongoBsonColumns *columns,
+                              guint             column)
+{
+   g_return_val_if_fail(columns != NULL, NULL);
+   g_return_val_if_fail(column < columns->n_columns, NULL);
+   g_return_val_if_fail(columns->columns[column].type ==
+                        MONGO_BSON_COLUMN_INT64, NULL);
+
+   return (const gint64 *)columns->columns[column].values->data;
+}
+
+/**
+ * mongo_bson_columns_get_double:
+ * @columns: (in): A #MongoBsonColumns.
+ * @column: (in): The index of a %MONGO_BSON_COLUMN_DOUBLE column.
+ *
+ * Fetches the values of @column. Null rows contain zero.
+ *
+ * Returns: (array) (transfer none): An array of mongo_bson_columns_get_n_rows()
+ *   values, valid until @columns is modified.
+ */
+const gdouble *
+mongo_bson_columns_get_double (MongoBsonColumns *columns,
+                               guint             column)
+{
+   g_return_val_if_fail(columns != NULL, NULL);
+   g_return_val_if_fail(column < columns->n_columns, NULL);
+   g_return_val_if_fail(columns->columns[column].type ==
+                        MONGO_BSON_COLUMN_DOUBLE, NULL);
+
+   return (const gdouble *)columns->columns[column].values->data;
+}
+
+/**
+ * mongo_bson_columns_get_string_offsets:
+ * @columns: (in): A #MongoBsonColumns.
+ * @column: (in): The index of a %MONGO_BSON_COLUMN_STRING column.
+ *
+ * Fetches the offsets of the strings of @column within the buffer from
+ * mongo_bson_columns_get_string_data(). The string of row i spans from
+ * offset i to offset i + 1. Null rows are empty.
+ *
+ * Returns: (array) (transfer none): An array of
+ *   mongo_bson_columns_get_n_rows() + 1 offsets.
+ */
+const guint32 *
+mongo_bson_columns_get_string_offsets (MongoBsonColumns *columns,
+                                       guint             column)
+{
+   g_return_val_if_fail(columns != NULL, NULL);
+   g_return_val_if_fail(column < columns->n_columns, NULL);
+   g_return_val_if_fail(columns->columns[column].type ==
+                        MONGO_BSON_COLUMN_STRING, NULL);
+
+   return (const guint32 *)columns->columns[column].values->data;
+}
+
+/**
+ * mongo_bson_columns_get_string_data:
+ * @columns: (in): A #MongoBsonColumns.
+ * @column: (in): The index of a %MONGO_BSON_COLUMN_STRING column.
+ * @length: (out) (allow-none): A location for the length of the buffer.
+ *
+ * Fetches the buffer containing the strings of @column back to back.
+ * The strings are not nul-terminated.
+ *
+ * Returns: (transfer none): The string buffer.
+ */
+const gchar *
+mongo_bson_columns_get_string_data (MongoBsonColumns *columns,
+                                    guint             column,
+                                    gsize            *length)
+{
+   GByteArray *strings;
+
+   g_return_val_if_fail(columns != NULL, NULL);
+   g_return_val_if_fail(column < columns->n_columns, NULL);
+   g_return_val_if_fail(columns->columns[column].type ==
+                        MONGO_BSON_COLUMN_STRING, NULL);
+
+   strings = columns->columns[column].strings;
+   if (length) {
+      *length = strings->len;
+   }
+
+   return (const gchar *)strings->data;
+}
+
+/**
+ * mongo_bson_columns_get_validity:
+ * @columns: (in): A #MongoBsonColumns.
+ * @column: (in): The index of a column.
+ *
+ * Fetches the validity bitmap of @column. The value of row i is present
+ * if bit (i % 8) of byte (i / 8) is set.
+ *
+ * Returns: (transfer none): The bitmap, or %NULL if there are no rows.
+ */
+const guint8 *
+mongo_bson_columns_get_validity (MongoBsonColumns *columns,
+                                 guint             column)
+{
+   g_return_val_if_fail(columns != NULL, NULL);
+   g_return_val_if_fail(column < columns->n_columns, NULL);
+
+   /*
+    * The bitmap keeps its allocation when the columns are cleared.
+    */
+   if (!columns->n_rows) {
+      return NULL;
+   }
+
+   return columns->columns[column].validity->data;
+}
+
+/**
+ * mongo_bson_columns_get_null_count:
+ * @columns: (in): A #MongoBsonColumns.
+ * @column: (in): The index of a column.
+ *
+ * Fetches the number of rows of @column that are null, which allows
+ * skipping the validity bitmap when there are none.
+ *
+ * Returns: A #guint.
+ */
+guint
+mongo_bson_columns_get_null_count (MongoBsonColumns *columns,
+                                   guint             column)
+{
+   g_return_val_if_fail(columns != NULL, 0);
+   g_return_val_if_fail(column < columns->n_columns, 0);
+
+   return columns->columns[column].null_count;
+}
+
+/**
+ * mongo_bson_columns_is_null:
+ * @columns: (in): A #MongoBsonColumns.
+ * @column: (in): The index of a column.
+ * @row: (in): The index of a row.
+ *
+ * Checks if the value of @column at @row is null.
+ *
+ * Returns: %TRUE if the value is missing or had another type.
+ */
+gboolean
+mongo_bson_columns_is_null (MongoBsonColumns *columns,
+                            guint             column,
+                            guint             row)
+{
+   g_return_val_if_fail(columns != NULL, TRUE);
+   g_return_val_if_fail(column < columns->n_columns, TRUE);
+   g_return_val_if_fail(row < columns->n_rows, TRUE);
+
+   return !(columns->columns[column].validity->data[row / 8] &
+            (1 << (row % 8)));
+}
+
+/**
+ * mongo_bson_columns_count:
+ * @columns: (in): A #MongoBsonColumns.
+ * @column: (in): The index of a column.
+ *
+ * Counts the rows of @column that are not null.
+ *
+ * Returns: A #guint.
+ */
+guint
+mongo_bson_columns_count (MongoBsonColumns *columns,
+                          guint             column)
+{
+   g_return_val_if_fail(columns != NULL, 0);
+   g_return_val_if_fail(column < columns->n_columns, 0);
+
+   return columns->n_rows - columns->columns[column].null_count;
+}
+
+/**
+ * mongo_bson_columns_sum:
+ * @columns: (in): A #MongoBsonColumns.
+ * @column: (in): The index of a numeric column.
+ *
+ * Sums the values of @column, skipping null rows. %MONGO_BSON_COLUMN_INT64
+ * columns are summed with 64-bit integers, which wrap on overflow, and
+ * the result is converted to a double, which is only exact up to 2^53.
+ * Use mongo_bson_columns_sum_int64() for the exact sum.
+ *
+ * The sum uses SIMD instructions when the CPU supports them, so the
+ * rounding of a %MONGO_BSON_COLUMN_DOUBLE sum may differ between machines.
+ *
+ * Returns: The sum, or 0 if there are no values.
+ */
+gdouble
+mongo_bson_columns_sum (MongoBsonColumns *columns,
+                        guint             column)
+{
+   const MongoBsonColumnsKernels *kernels;
+   MongoBsonColumn *col;
+
+   g_return_val_if_fail(columns != NULL, 0.0);
+   g_return_val_if_fail(column < columns->n_columns, 0.0);
+   g_return_val_if_fail(columns->columns[column].type !=
+                        MONGO_BSON_COLUMN_STRING, 0.0);
+
+   kernels = mongo_bson_columns_get_kernels();
+   col = &columns->columns[column];
+
+   if (col->type == MONGO_BSON_COLUMN_INT64) {
+      return kernels->sum_int64((const gint64 *)col->values->data,
+                                columns->n_rows);
+   }
+
+   return kernels->sum_double((const gdouble *)col->values->data,
+                              columns->n_rows);
+}
+
+/**
+ * mongo_bson_columns_sum_int64:
+ * @columns: (in): A #MongoBsonColumns.
+ * @column: (in): The index of a %MONGO_BSON_COLUMN_INT64 column.
+ *
+ * Sums the values of @column, skipping null rows, without converting the
+ * result to a double. The sum wraps on overflow.
+ *
+ * Returns: The sum, or 0 if there are no values.
+ */
+gint64
+mongo_bson_columns_sum_int64 (MongoBsonColumns *columns,
+                              guint             column)
+{
+   MongoBsonColumn *col;
+
+   g_return_val_if_fail(columns != NULL, 0);
+   g_return_val_if_fail(column < columns->n_columns, 0);
+   g_return_val_if_fail(columns->columns[column].type ==
+                        MONGO_BSON_COLUMN_INT64, 0);
+
+   col = &columns->columns[column];
+
+   return mongo_bson_columns_get_kernels()->sum_int64(
+         (const gint64 *)col->values->data, columns->n_rows);
+}
+
+/**
+ * mongo_bson_columns_mean:
+ * @columns: (in): A #MongoBsonColumns.
+ * @column: (in): The index of a numeric column.
+ * @mean: (out): A location for the mean.
+ *
+ * Computes the arithmetic mean of the values of @column that are not
+ * null. See mongo_bson_columns_sum().
+ *
+ * Returns: %TRUE if @column has a value and @mean was set.
+ */
+gboolean
+mongo_bson_columns_mean (MongoBsonColumns *columns,
+                         guint             column,
+                         gdouble          *mean)
+{
+   guint count;
+
+   g_return_val_if_fail(columns != NULL, FALSE);
+   g_return_val_if_fail(column < columns->n_columns, FALSE);
+   g_return_val_if_fail(mean != NULL, FALSE);
+
+   if (!(count = mongo_bson_columns_count(columns, column))) {
+      return FALSE;
+   }
+
+   *mean = mongo_bson_columns_sum(columns, column) / count;
+
+   return TRUE;
+}
+
+/**
+ * mongo_bson_columns_min_max:
+ * @columns: (in): A #MongoBsonColumns.
+ * @column: (in): The index of a numeric column.
+ * @min: (out) (allow-none): A location for the smallest value.
+ * @max: (out) (allow-none): A location for the largest value.
+ *
+ * Finds the smallest and largest values of @column in a single pass,
+ * skipping null rows and NaN values. Values of a %MONGO_BSON_COLUMN_INT64
+ * column are converted to doubles, which are only exact up to 2^53. Use
+ * mongo_bson_columns_min_max_int64() for the exact values.
+ *
+ * Returns: %TRUE if @column has a value and @min and @max were set.
+ */
+gboolean
+mongo_bson_columns_min_max (MongoBsonColumns *columns,
+                            guint             column,
+                            gdouble          *min,
+                            gdouble          *max)
+{
+   const MongoBsonColumnsKernels *kernels;
+   MongoBsonColumn *col;
+   const guint8 *validity;
+   gdouble dmin = HUGE_VAL;
+   gdouble dmax = -HUGE_VAL;
+   gint64 imin = G_MAXINT64;
+   gint64 imax = G_MININT64;
+
+   g_return_val_if_fail(columns != NULL, FALSE);
+   g_return_val_if_fail(column < columns->n_columns, FALSE);
+   g_return_val_if_fail(columns->columns[column].type !=
+                        MONGO_BSON_COLUMN_STRING, FALSE);
+
+   kernels = mongo_bson_columns_get_kernels();
+   col = &columns->columns[column];
+
+   if (col->null_count == columns->n_rows) {
+      return FALSE;
+   }
+
+   validity = col->null_count ? col->validity->data : NULL;
+
+   if (col->type == MONGO_BSON_COLUMN_INT64) {
+      kernels->min_max_int64((const gint64 *)col->values->data, validity,
+                             columns->n_rows, &imin, &imax);
+      dmin = imin;
+      dmax = imax;
+   } else {
+      kernels->min_max_double((const gdouble *)col->values->data, validity,
+                              columns->n_rows, &dmin, &dmax);
+      if (dmin > dmax) {
+         return FALSE;
+      }
+   }
+
+   if (min) {
+      *min = dmin;
+   }
+
+   if (max) {
+      *max = dmax;
+   }
+
+   return TRUE;
+}
+
+/**
+ * mongo_bson_columns_min_max_int64:
+ * @columns: (in): A #MongoBsonColumns.
+ * @column: (in): The index of a %MONGO_BSON_COLUMN_INT64 column.
+ * @min: (out) (allow-none): A location for the smallest value.
+ * @max: (out) (allow-none): A location for the largest value.
+ *
+ * Finds the smallest and largest values of @column in a single pass,
+ * skipping null rows, without converting them to doubles.
+ *
+ * Returns: %TRUE if @column has a value and @min and @max were set.
+ */
+gboolean
+mongo_bson_columns_min_max_int64 (MongoBsonColumns *columns,
+                                  guint             column,
+                                  gint64           *min,
+                                  gint64           *max)
+{
+   MongoBsonColumn *col;
+   const guint8 *validity;
+   gint64 imin = G_MAXINT64;
+   gint64 imax = G_MININT64;
+
+   g_return_val_if_fail(columns != NULL, FALSE);
+   g_return_val_if_fail(column < columns->n_columns, FALSE);
+   g_return_val_if_fail(columns->columns[column].type ==
+                        MONGO_BSON_COLUMN_INT64, FALSE);
+
+   col = &columns->columns[column];
+
+   if (col->null_count == columns->n_rows) {
+      return FALSE;
+   }
+
+   validity = col->null_count ? col->validity->data : NULL;
+   mongo_bson_columns_get_kernels()->min_max_int64(
+         (const gint64 *)col->values->data, validity, columns->n_rows,
+         &imin, &imax);
+
+   if (min) {
+      *min = imin;
+   }
+
+   if (max) {
+      *max = imax;
+   }
+
+   return TRUE;
+}
+
+/**
+ * mongo_bson_columns_histogram:
+ * @columns: (in): A #MongoBsonColumns.
+ * @column: (in): The index of a numeric column.
+ * @lower: (in): The lower bound of the first bin.
+ * @upper: (in): The upper bound of the last bin.
+ * @bins: (in) (array length=n_bins): The bins to add counts to.
+ * @n_bins: (in): The number of bins.
+ *
+ * Counts the values of @column into @n_bins bins of equal width spanning
+ * [@lower, @upper). Null rows, NaN values and values outside of the range
+ * are not counted. Counts are added to @bins, so several batches may be
+ * accumulated into the same histogram.
+ */
+void
+mongo_bson_columns_histogram (MongoBsonColumns *columns,
+                              guint             column,
+                              gdouble           lower,
+                              gdouble           upper,
+                              guint64          *bins,
+                              guint             n_bins)
+{
+   MongoBsonColumn *col;
+   const guint8 *validity;
+   const gdouble *dvalues = NULL;
+   const gint64 *ivalues = NULL;
+   gdouble scale;
+   gdouble value;
+   guint bin;
+   guint i;
+
+   g_return_if_fail(columns != NULL);
+   g_return_if_fail(column < columns->n_columns);
+   g_return_if_fail(columns->columns[column].type != MONGO_BSON_COLUMN_STRING);
+   g_return_if_fail(bins != NULL);
+   g_return_if_fail(n_bins > 0);
+   g_return_if_fail(lower < upper);
+
+   col = &columns->columns[column];
+   validity = col->null_count ? col->validity->data : NULL;
+   scale = n_bins / (upper - lower);
+
+   if (col->type == MONGO_BSON_COLUMN_INT64) {
+      ivalues = (const gint64 *)col->values->data;
+   } else {
+      dvalues = (const gdouble *)col->values->data;
+   }
+
+   /*
+    * Incrementing the bins is bound by scattered memory writes, so there
+    * is no vector kernel for histograms.
+    */
+   for (i = 0; i < columns->n_rows; i++) {
+      if (validity && !(validity[i / 8] & (1 << (i % 8)))) {
+         continue;
+      }
+      value = dvalues ? dvalues[i] : (gdouble)ivalues[i];
+      if ((value >= lower) && (value < upper)) {
+         bin = (guint)((value - lower) * scale);
+         bins[MIN(bin, n_bins - 1)]++;
+      }
+   }
+}
+
+/**
+ * mongo_bson_columns_ref:
+ * @columns: (in): A #MongoBsonColumns.
+ *
+ * Increments the reference count of @columns by one.
+ *
+ * Returns: (transfer full): @columns.
+ */
+MongoBsonColumns *
+mongo_bson_columns_ref (MongoBsonColumns *columns)
+{
+   g_return_val_if_fail(columns != NULL, NULL);
+   g_return_val_if_fail(columns->ref_count > 0, NULL);
+
+   g_atomic_int_inc(&columns->ref_count);
+   return columns;
+}
+
+/**
+ * mongo_bson_columns_unref:
+ * @columns: (in): A #MongoBsonColumns.
+ *
+ * Decrements the reference count of @columns by one. When the reference
+ * count reaches zero, the structure is freed.
+ */
+void
+mongo_bson_columns_unref (MongoBsonColumns *columns)
+{
+   MongoBsonColumn *column;
+   guint i;
+
+   g_return_if_fail(columns != NULL);
+   g_return_if_fail(columns->ref_count > 0);
+
+   if (g_atomic_int_dec_and_test(&columns->ref_count)) {
+      for (i = 0; i < columns->n_columns; i++) {
+         column = &columns->columns[i];
+         g_free(column->path);
+         g_array_free(column->values, TRUE);
+         if (column->strings) {
+            g_byte_array_free(column->strings, TRUE);
+         }
+         g_byte_array_free(column->validity, TRUE);
+      }
+      mongo_bson_columns_node_free(columns->root);
+      g_free(columns->columns);
+      g_slice_free(MongoBsonColumns, columns);
+   }
+}
+
+/**
+ * mongo_bson_columns_get_type:
+ *
+ * Retrieve the #GType for the #MongoBsonColumns boxed type.
+ *
+ * Returns: A #GType.
+ */
+GType
+mongo_bson_columns_get_type (void)
+{
+   static GType type_id = 0;
+   static gsize initialized = FALSE;
+
+   if (g_once_init_enter(&initialized)) {
+      type_id = g_boxed_type_register_static("MongoBsonColumns",
+         (GBoxedCopyFunc)mongo_bson_columns_ref,
+         (GBoxedFreeFunc)mongo_bson_columns_unref);
+      g_once_init_leave(&initialized, TRUE);
+   }
+
+   return type_id;
+}
+
+GType
+mongo_bson_column_type_get_type (void)
+{
+   static GType type_id = 0;
+   static gsize initialized = FALSE;
+   static GEnumValue values[] = {
+      { MONGO_BSON_COLUMN_INT64,  "MONGO_BSON_COLUMN_INT64",  "INT64" },
+      { MONGO_BSON_COLUMN_DOUBLE, "MONGO_BSON_COLUMN_DOUBLE", "DOUBLE" },
+      { MONGO_BSON_COLUMN_STRING, "MONGO_BSON_COLUMN_STRING", "STRING" },
+      { 0 }
+   };
+
+   if (g_once_init_enter(&initialized)) {
+      type_id = g_enum_register_static("MongoBsonColumnType", values);
+      g_once_init_leave(&initialized, TRUE);
+   }
+
+   return type_id;
+}
@@ -0,0 +1,117 @@
+/* mongo-bson-columns.h
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MONGO_BSON_COLUMNS_H
+#define MONGO_BSON_COLUMNS_H
+
+#include <glib-object.h>
+
+#include "mongo-bson.h"
+
+G_BEGIN_DECLS
+
+#define MONGO_TYPE_BSON_COLUMNS     (mongo_bson_columns_get_type())
+#define MONGO_TYPE_BSON_COLUMN_TYPE (mongo_bson_column_type_get_type())
+
+typedef struct _MongoBsonColumns   MongoBsonColumns;
+typedef enum   _MongoBsonColumnType MongoBsonColumnType;
+
+/**
+ * MongoBsonColumnType:
+ * @MONGO_BSON_COLUMN_INT64: A column of #gint64. Accepts int32, int64 and
+ *   date-time values, the latter as milliseconds since the UNIX epoch.
+ * @MONGO_BSON_COLUMN_DOUBLE: A column of #gdouble. Accepts double, int32,
+ *   int64 and decimal128 values, the latter rounded to the nearest double.
+ * @MONGO_BSON_COLUMN_STRING: A column of UTF-8 strings, stored as offsets
+ *   into a single buffer.
+ *
+ * The type of a column extracted by #MongoBsonColumns. Values of other
+ * types are stored as null.
+ */
+enum _MongoBsonColumnType
+{
+   MONGO_BSON_COLUMN_INT64  = 1,
+   MONGO_BSON_COLUMN_DOUBLE = 2,
+   MONGO_BSON_COLUMN_STRING = 3,
+};
+
+void                 mongo_bson_columns_append             (MongoBsonColumns          *columns,
+                                                            MongoBson                 *bson);
+void                 mongo_bson_columns_append_data        (MongoBsonColumns          *columns,
+                                                            const guint8              *data,
+                                                            gsize                      length);
+void                 mongo_bson_columns_clear              (MongoBsonColumns          *columns);
+guint                mongo_bson_columns_count              (MongoBsonColumns          *columns,
+                                                            guint                      column);
+void                 mongo_bson_columns_extract            (MongoBsonColumns          *columns,
+                                                            MongoBson                **documents,
+                                                            guint                      n_documents);
+const gdouble       *mongo_bson_columns_get_double         (MongoBsonColumns          *columns,
+                                                            guint                      column);
+const gint64        *mongo_bson_columns_get_int64          (MongoBsonColumns          *columns,
+                                                            guint                      column);
+guint                mongo_bson_columns_get_n_columns      (MongoBsonColumns          *columns);
+guint                mongo_bson_columns_get_n_rows         (MongoBsonColumns          *columns);
+guint                mongo_bson_columns_get_null_count     (MongoBsonColumns          *columns,
+                                                            guint                      column);
+const gchar         *mongo_bson_columns_get_path           (MongoBsonColumns          *columns,
+                                                            guint                      column);
+const gchar         *mongo_bson_columns_get_string_data    (MongoBsonColumns          *columns,
+                                                            guint                      column,
+                                                            gsize                     *length);
+const guint32       *mongo_bson_columns_get_string_offsets (MongoBsonColumns          *columns,
+                                                            guint                      column);
+MongoBsonColumnType  mongo_bson_columns_get_column_type    (MongoBsonColumns          *columns,
+                                                            guint                      column);
+GType                mongo_bson_columns_get_type           (void) G_GNUC_CONST;
+const guint8        *mongo_bson_columns_get_validity       (MongoBsonColumns          *columns,
+                                                            guint                      column);
+void                 mongo_bson_columns_histogram          (MongoBsonColumns          *columns,
+                                                            guint                      column,
+                                                            gdouble                    lower,
+                                                            gdouble                    upper,
+                                                            guint64                   *bins,
+                                                            guint                      n_bins);
+gboolean             mongo_bson_columns_is_null            (MongoBsonColumns          *columns,
+                                                            guint                      column,
+                                                            guint                      row);
+gboolean             mongo_bson_columns_mean               (MongoBsonColumns          *columns,
+                                                            guint                      column,
+                                                            gdouble                   *mean);
+gboolean             mongo_bson_columns_min_max            (MongoBsonColumns          *columns,
+                                                            guint                      column,
+                                                            gdouble                   *min,
+                                                            gdouble                   *max);
+gboolean             mongo_bson_columns_min_max_int64      (MongoBsonColumns          *columns,
+                                                            guint                      column,
+                                                            gint64                    *min,
+                                                            gint64                    *max);
+MongoBsonColumns    *mongo_bson_columns_new                (const gchar * const       *paths,
+                                                            const MongoBsonColumnType *types,
+                                                            guint                      n_columns);
+MongoBsonColumns    *mongo_bson_columns_ref                (MongoBsonColumns          *columns);
+gdouble              mongo_bson_columns_sum                (MongoBsonColumns          *columns,
+                                                            guint                      column);
+gint64               mongo_bson_columns_sum_int64          (MongoBsonColumns          *columns,
+                                                            guint                      column);
+void                 mongo_bson_columns_unref              (MongoBsonColumns          *columns);
+GType                mongo_bson_column_type_get_type       (void) G_GNUC_CONST;
+
+G_END_DECLS
+
+#endif /* MONGO_BSON_COLUMNS_H */
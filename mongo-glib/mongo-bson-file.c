@@ -0,0 +1,422 @@
+/* mongo-bson-file.c
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib/gi18n.h>
+#include <string.h>
+
+#include "mongo-bson-file.h"
+
+/*
+ * Number of ranges handed to each worker when iterating in parallel.
+ * More ranges than workers keeps the workers busy when documents are not
+ * of uniform size.
+ */
+#define RANGES_PER_WORKER 4
+
+struct _MongoBsonFile
+{
+   volatile gint  ref_count;
+   GMappedFile   *mapped;
+   const guint8  *data;
+   gsize         *offsets;
+   guint          n_documents;
+};
+
+typedef struct
+{
+   MongoBsonFile     *file;
+   MongoBsonFileFunc  func;
+   gpointer           user_data;
+   volatile gint      stopped;
+} ForeachState;
+
+typedef struct
+{
+   guint begin;
+   guint end;
+} ForeachRange;
+
+/**
+ * mongo_bson_file_build_index:
+ * @file: (in): A #MongoBsonFile.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Builds the document offset table by hopping from one length prefix to
+ * the next. Only the first and last byte of each document are touched.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ */
+static gboolean
+mongo_bson_file_build_index (MongoBsonFile  *file,
+                             GError        **error)
+{
+   const guint8 *data = file->data;
+   GArray *offsets;
+   guint32 doc_len;
+   gsize length;
+   gsize offset = 0;
+
+   length = g_mapped_file_get_length(file->mapped);
+   offsets = g_array_sized_new(FALSE, FALSE, sizeof(gsize), 64);
+
+   while (offset < length) {
+      if ((length - offset) < 4) {
+         goto truncated;
+      }
+
+      memcpy(&doc_len, data + offset, sizeof doc_len);
+      doc_len = GUINT32_FROM_LE(doc_len);
+
+      if (doc_len < 5) {
+         g_set_error(error, MONGO_BSON_FILE_ERROR,
+                     MONGO_BSON_FILE_ERROR_INVALID_DOCUMENT,
+                     _("Invalid document length %u at offset %"
+                       G_GSIZE_FORMAT "."),
+                     doc_len, offset);
+         g_array_free(offsets, TRUE);
+         return FALSE;
+      }
+
+      if (doc_len > (length - offset)) {
+         goto truncated;
+      }
+
+      if (data[offset + doc_len - 1] != '\0') {
+         g_set_error(error, MONGO_BSON_FILE_ERROR,
+                     MONGO_BSON_FILE_ERROR_INVALID_DOCUMENT,
+                     _("Document at offset %" G_GSIZE_FORMAT
+                       " is missing trailing byte."),
+                     offset);
+         g_array_free(offsets, TRUE);
+         return FALSE;
+      }
+
+      g_array_append_val(offsets, offset);
+      offset += doc_len;
+   }
+
+   /*
+    * Terminate the table with the end of the file so that the length of
+    * document i is offsets[i + 1] - offsets[i].
+    */
+   g_array_append_val(offsets, offset);
+
+   file->n_documents = offsets->len - 1;
+   file->offsets = (gsize *)(gpointer)g_array_free(offsets, FALSE);
+
+   return TRUE;
+
+truncated:
+   g_set_error(error, MONGO_BSON_FILE_ERROR,
+               MONGO_BSON_FILE_ERROR_TRUNCATED,
+               _("The file ended within the document at offset %"
+                 G_GSIZE_FORMAT "."),
+               offset);
+   g_array_free(offsets, TRUE);
+   return FALSE;
+}
+
+/**
+ * mongo_bson_file_new:
+ * @filename: (in): The path to a file of concatenated BSON documents.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Maps @filename into memory and indexes the documents within it, such as
+ * a file created by mongodump. Documents are never copied out of the
+ * mapping, so the page cache is shared by all readers of the file.
+ *
+ * Returns: (transfer full): A #MongoBsonFile that should be freed with
+ *   mongo_bson_file_unref(), or %NULL if @error is set.
+ */
+MongoBsonFile *
+mongo_bson_file_new (const gchar  *filename,
+                     GError      **error)
+{
+   MongoBsonFile *file;
+   GMappedFile *mapped;
+
+   g_return_val_if_fail(filename != NULL, NULL);
+
+   if (!(mapped = g_mapped_file_new(filename, FALSE, error))) {
+      return NULL;
+   }
+
+   file = g_slice_new0(MongoBsonFile);
+   file->ref_count = 1;
+   file->mapped = mapped;
+   file->data = (const guint8 *)g_mapped_file_get_contents(mapped);
+
+   if (!mongo_bson_file_build_index(file, error)) {
+      mongo_bson_file_unref(file);
+      return NULL;
+   }
+
+   return file;
+}
+
+/**
+ * mongo_bson_file_get_n_documents:
+ * @file: (in): A #MongoBsonFile.
+ *
+ * Fetches the number of documents in @file.
+ *
+ * Returns: The number of documents.
+ */
+guint
+mongo_bson_file_get_n_documents (MongoBsonFile *file)
+{
+   g_return_val_if_fail(file != NULL, 0);
+
+   return file->n_documents;
+}
+
+/**
+ * mongo_bson_file_get_data:
+ * @file: (in): A #MongoBsonFile.
+ * @index: (in): The index of the document.
+ * @length: (out): A location for the length of the document.
+ *
+ * Fetches the raw buffer for the document at @index. The buffer points
+ * into the mapped file and is valid for the lifetime of @file.
+ *
+ * Returns: (transfer none): The document buffer.
+ */
+const guint8 *
+mongo_bson_file_get_data (MongoBsonFile *file,
+                          guint          index,
+                          gsize         *length)
+{
+   g_return_val_if_fail(file != NULL, NULL);
+   g_return_val_if_fail(index < file->n_documents, NULL);
+   g_return_val_if_fail(length != NULL, NULL);
+
+   *length = file->offsets[index + 1] - file->offsets[index];
+   return file->data + file->offsets[index];
+}
+
+/**
+ * mongo_bson_file_foreach_range:
+ * @state: (in): A #ForeachState.
+ * @begin: (in): The index of the first document.
+ * @end: (in): The index after the last document.
+ *
+ * Calls the foreach callback for documents @begin through @end - 1 until
+ * the callback requests that iteration stop.
+ */
+static void
+mongo_bson_file_foreach_range (ForeachState *state,
+                               guint         begin,
+                               guint         end)
+{
+   MongoBsonFile *file = state->file;
+   MongoBson *bson;
+   gboolean ret;
+   guint i;
+
+   for (i = begin; i < end; i++) {
+      if (g_atomic_int_get(&state->stopped)) {
+         break;
+      }
+
+      bson = mongo_bson_new_from_static_data(
+            (guint8 *)file->data + file->offsets[i],
+            file->offsets[i + 1] - file->offsets[i],
+            NULL);
+      ret = state->func(file, i, bson, state->user_data);
+      mongo_bson_unref(bson);
+
+      if (!ret) {
+         g_atomic_int_set(&state->stopped, TRUE);
+         break;
+      }
+   }
+}
+
+/**
+ * mongo_bson_file_foreach:
+ * @file: (in): A #MongoBsonFile.
+ * @func: (in) (scope call): A #MongoBsonFileFunc.
+ * @user_data: (in): User data for @func.
+ *
+ * Calls @func for each document in @file, in order, until @func returns
+ * %FALSE.
+ */
+void
+mongo_bson_file_foreach (MongoBsonFile     *file,
+                         MongoBsonFileFunc  func,
+                         gpointer           user_data)
+{
+   ForeachState state = { 0 };
+
+   g_return_if_fail(file != NULL);
+   g_return_if_fail(func != NULL);
+
+   state.file = file;
+   state.func = func;
+   state.user_data = user_data;
+
+   mongo_bson_file_foreach_range(&state, 0, file->n_documents);
+}
+
+static void
+mongo_bson_file_foreach_worker (gpointer data,
+                                gpointer user_data)
+{
+   ForeachRange *range = data;
+
+   mongo_bson_file_foreach_range(user_data, range->begin, range->end);
+}
+
+/**
+ * mongo_bson_file_foreach_parallel:
+ * @file: (in): A #MongoBsonFile.
+ * @n_workers: (in): The number of worker threads, or 0 for one per CPU.
+ * @func: (in) (scope call): A #MongoBsonFileFunc.
+ * @user_data: (in): User data for @func.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Splits the documents of @file into disjoint ranges and calls @func for
+ * each document from a pool of @n_workers threads. Each document is
+ * visited exactly once, but the order is unspecified and @func must be
+ * thread-safe. If @func returns %FALSE, the workers stop as soon as they
+ * notice.
+ *
+ * This function blocks until all of the workers have finished.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ */
+gboolean
+mongo_bson_file_foreach_parallel (MongoBsonFile      *file,
+                                  guint               n_workers,
+                                  MongoBsonFileFunc   func,
+                                  gpointer            user_data,
+                                  GError            **error)
+{
+   ForeachRange *ranges;
+   ForeachState state = { 0 };
+   GThreadPool *pool;
+   guint n_ranges;
+   guint per_range;
+   guint i;
+
+   g_return_val_if_fail(file != NULL, FALSE);
+   g_return_val_if_fail(func != NULL, FALSE);
+
+   if (!n_workers) {
+      n_workers = MAX(1, g_get_num_processors());
+   }
+
+   state.file = file;
+   state.func = func;
+   state.user_data = user_data;
+
+   n_ranges = MIN(file->n_documents, n_workers * RANGES_PER_WORKER);
+   if (n_workers == 1 || n_ranges <= 1) {
+      mongo_bson_file_foreach_range(&state, 0, file->n_documents);
+      return TRUE;
+   }
+
+   if (!(pool = g_thread_pool_new(mongo_bson_file_foreach_worker, &state,
+                                  n_workers, TRUE, error))) {
+      return FALSE;
+   }
+
+   per_range = (file->n_documents + n_ranges - 1) / n_ranges;
+   ranges = g_new0(ForeachRange, n_ranges);
+
+   for (i = 0; i < n_ranges; i++) {
+      ranges[i].begin = MIN(i * per_range, file->n_documents);
+      ranges[i].end = MIN(ranges[i].begin + per_range, file->n_documents);
+      if (ranges[i].begin < ranges[i].end) {
+         g_thread_pool_push(pool, &ranges[i], NULL);
+      }
+   }
+
+   g_thread_pool_free(pool, FALSE, TRUE);
+   g_free(ranges);
+
+   return TRUE;
+}
+
+/**
+ * mongo_bson_file_ref:
+ * @file: (in): A #MongoBsonFile.
+ *
+ * Atomically increments the reference count of @file by one.
+ *
+ * Returns: (transfer full): @file.
+ */
+MongoBsonFile *
+mongo_bson_file_ref (MongoBsonFile *file)
+{
+   g_return_val_if_fail(file != NULL, NULL);
+   g_return_val_if_fail(file->ref_count > 0, NULL);
+
+   g_atomic_int_inc(&file->ref_count);
+   return file;
+}
+
+/**
+ * mongo_bson_file_unref:
+ * @file: (in): A #MongoBsonFile.
+ *
+ * Atomically decrements the reference count of @file by one. When the
+ * reference count reaches zero, the file is unmapped and the structure
+ * is freed.
+ */
+void
+mongo_bson_file_unref (MongoBsonFile *file)
+{
+   g_return_if_fail(file != NULL);
+   g_return_if_fail(file->ref_count > 0);
+
+   if (g_atomic_int_dec_and_test(&file->ref_count)) {
+      g_mapped_file_unref(file->mapped);
+      g_free(file->offsets);
+      g_slice_free(MongoBsonFile, file);
+   }
+}
+
+/**
+ * mongo_bson_file_get_type:
+ *
+ * Retrieve the #GType for the #MongoBsonFile boxed type.
+ *
+ * Returns: A #GType.
+ */
+GType
+mongo_bson_file_get_type (void)
+{
+   static GType type_id = 0;
+   static gsize initialized = FALSE;
+
+   if (g_once_init_enter(&initialized)) {
+      type_id = g_boxed_type_register_static("MongoBsonFile",
+         (GBoxedCopyFunc)mongo_bson_file_ref,
+         (GBoxedFreeFunc)mongo_bson_file_unref);
+      g_once_init_leave(&initialized, TRUE);
+   }
+
+   return type_id;
+}
+
+GQuark
+mongo_bson_file_error_quark (void)
+{
+   return g_quark_from_static_string("mongo_bson_file_error_quark");
+}
@@ -0,0 +1,78 @@
+/* mongo-bson-file.h
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MONGO_BSON_FILE_H
+#define MONGO_BSON_FILE_H
+
+#include <glib-object.h>
+
+#include "mongo-bson.h"
+
+G_BEGIN_DECLS
+
+#define MONGO_TYPE_BSON_FILE  (mongo_bson_file_get_type())
+#define MONGO_BSON_FILE_ERROR (mongo_bson_file_error_quark())
+
+typedef struct _MongoBsonFile     MongoBsonFile;
+typedef enum   _MongoBsonFileError MongoBsonFileError;
+
+/**
+ * MongoBsonFileFunc:
+ * @file: (in): A #MongoBsonFile.
+ * @index: (in): The index of the document within @file.
+ * @bson: (in): A #MongoBson view into the mapped file.
+ * @user_data: (in): User data provided to the foreach function.
+ *
+ * Callback for each document in a #MongoBsonFile. @bson is only valid for
+ * the duration of the callback; use mongo_bson_dup() to keep it.
+ *
+ * Returns: %TRUE to continue, %FALSE to stop iterating.
+ */
+typedef gboolean (*MongoBsonFileFunc) (MongoBsonFile *file,
+                                       guint          index,
+                                       MongoBson     *bson,
+                                       gpointer       user_data);
+
+enum _MongoBsonFileError
+{
+   MONGO_BSON_FILE_ERROR_INVALID_DOCUMENT = 1,
+   MONGO_BSON_FILE_ERROR_TRUNCATED,
+};
+
+GQuark         mongo_bson_file_error_quark      (void) G_GNUC_CONST;
+void           mongo_bson_file_foreach          (MongoBsonFile      *file,
+                                                 MongoBsonFileFunc   func,
+                                                 gpointer            user_data);
+gboolean       mongo_bson_file_foreach_parallel (MongoBsonFile      *file,
+                                                 guint               n_workers,
+                                                 MongoBsonFileFunc   func,
+                                                 gpointer            user_data,
+                                                 GError            **error);
+const guint8  *mongo_bson_file_get_data         (MongoBsonFile      *file,
+                                                 guint               index,
+                                                 gsize              *length);
+guint          mongo_bson_file_get_n_documents  (MongoBsonFile      *file);
+GType          mongo_bson_file_get_type         (void) G_GNUC_CONST;
+MongoBsonFile *mongo_bson_file_new              (const gchar        *filename,
+                                                 GError            **error);
+MongoBsonFile *mongo_bson_file_ref              (MongoBsonFile      *file);
+void           mongo_bson_file_unref            (MongoBsonFile      *file);
+
+G_END_DECLS
+
+#endif /* MONGO_BSON_FILE_H */
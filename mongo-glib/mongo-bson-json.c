@@ -0,0 +1,2113 @@
+/* mongo-bson-json.c
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <glib/gi18n.h>
+#include <math.h>
+#include <string.h>
+
+#include "mongo-bson-json.h"
+
+/*
+ * When writing to a stream, the buffer is flushed once it grows beyond
+ * this many bytes.
+ */
+#define FLUSH_SIZE 65536
+
+/*
+ * The largest date, 9999-12-31T23:59:59.999Z, that relaxed mode will
+ * write as an ISO-8601 string.
+ */
+#define MAX_ISO8601_MSEC G_GINT64_CONSTANT(253402300799999)
+
+/*
+ * The maximum nesting of documents and arrays accepted by the parser.
+ */
+#define MAX_DEPTH 100
+
+typedef struct
+{
+   GString            *str;
+   MongoBsonJsonMode   mode;
+   GOutputStream      *stream;
+   GCancellable       *cancellable;
+   GError            **error;
+} JsonWriter;
+
+typedef struct
+{
+   const gchar  *begin;
+   const gchar  *p;
+   const gchar  *end;
+   GString      *key;
+   GString      *str;
+   GString      *aux;
+   GError      **error;
+} JsonParser;
+
+/*
+ * Characters that must be escaped within a JSON string. Zero means the
+ * byte is copied as is, 'u' means it is written as \u00XX and anything
+ * else is the character to write after a backslash.
+ */
+static const gchar gJsonEscape[256] = {
+   'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+   'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+   0,   0,   '"', 0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
+   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   '\\', 0,  0,   0,
+};
+
+static const gchar gHexDigits[] = "0123456789abcdef";
+
+static const gchar gDigitPairs[] =
+   "00010203040506070809"
+   "10111213141516171819"
+   "20212223242526272829"
+   "30313233343536373839"
+   "40414243444546474849"
+   "50515253545556575859"
+   "60616263646566676869"
+   "70717273747576777879"
+   "80818283848586878889"
+   "90919293949596979899";
+
+static void
+mongo_bson_json_append_string (GString     *str,
+                               const gchar *value,
+                               gsize        length)
+{
+   const guint8 *p = (const guint8 *)value;
+   const guint8 *end = p + length;
+   const guint8 *run;
+   gchar escaped[6] = { '\\', 'u', '0', '0' };
+   gchar c;
+
+   g_string_append_c(str, '"');
+
+   while (p < end) {
+      for (run = p; (p < end) && !gJsonEscape[*p]; p++) { }
+
+      if (p > run) {
+         g_string_append_len(str, (const gchar *)run, p - run);
+      }
+
+      if (p < end) {
+         if ((c = gJsonEscape[*p]) == 'u') {
+            escaped[4] = gHexDigits[*p >> 4];
+            escaped[5] = gHexDigits[*p & 0xF];
+            g_string_append_len(str, escaped, 6);
+         } else {
+            g_string_append_c(str, '\\');
+            g_string_append_c(str, c);
+         }
+         p++;
+      }
+   }
+
+   g_string_append_c(str, '"');
+}
+
+static void
+mongo_bson_json_append_int64 (GString *str,
+                              gint64   value)
+{
+   gchar buf[24];
+   gchar *p = buf + sizeof buf;
+   guint64 v;
+   guint i;
+
+   v = (value < 0) ? (G_GUINT64_CONSTANT(0) - (guint64)value) : (guint64)value;
+
+   while (v >= 100) {
+      i = (v % 100) * 2;
+      v /= 100;
+      *--p = gDigitPairs[i + 1];
+      *--p = gDigitPairs[i];
+   }
+
+   if (v < 10) {
+      *--p = '0' + (gchar)v;
+   } else {
+      *--p = gDigitPairs[v * 2 + 1];
+      *--p = gDigitPairs[v * 2];
+   }
+
+   if (value < 0) {
+      *--p = '-';
+   }
+
+   g_string_append_len(str, p, buf + sizeof buf - p);
+}
+
+/**
+ * mongo_bson_json_append_double:
+ * @str: (in): A #GString.
+ * @value: (in): A finite double.
+ *
+ * Appends the shortest of %.15g and %.17g that round-trips @value.
+ * Integral values, the common case, skip printf entirely. A ".0" suffix
+ * is added when needed so that the value is read back as a double.
+ */
+static void
+mongo_bson_json_append_double (GString *str,
+                               gdouble  value)
+{
+   gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+   if ((value >= -1e15) && (value <= 1e15) &&
+       (value == (gdouble)(gint64)value)) {
+      if ((value == 0.0) && signbit(value)) {
+         g_string_append_c(str, '-');
+      }
+      mongo_bson_json_append_int64(str, (gint64)value);
+      g_string_append_len(str, ".0", 2);
+      return;
+   }
+
+   g_ascii_formatd(buf, sizeof buf, "%.15g", value);
+   if (g_ascii_strtod(buf, NULL) != value) {
+      g_ascii_formatd(buf, sizeof buf, "%.17g", value);
+   }
+
+   g_string_append(str, buf);
+   if (!strpbrk(buf, ".e")) {
+      g_string_append_len(str, ".0", 2);
+   }
+}
+
+static void
+mongo_bson_json_append_pair (gchar *p,
+                             guint  value)
+{
+   p[0] = gDigitPairs[value * 2];
+   p[1] = gDigitPairs[value * 2 + 1];
+}
+
+/**
+ * mongo_bson_json_append_iso8601:
+ * @str: (in): A #GString.
+ * @msec: (in): Milliseconds since the UNIX epoch, within years 1970-9999.
+ *
+ * Appends @msec as a quoted ISO-8601 UTC date. The calendar conversion is
+ * done by hand since this is much cheaper than creating a #GDateTime.
+ */
+static void
+mongo_bson_json_append_iso8601 (GString *str,
+                                gint64   msec)
+{
+   gchar buf[] = "\"YYYY-MM-DDTHH:MM:SS.mmmZ\"";
+   gint64 days;
+   guint ms;
+   guint doe;
+   guint yoe;
+   guint doy;
+   guint mp;
+   guint year;
+   guint month;
+   guint day;
+
+   days = msec / 86400000;
+   ms = (guint)(msec % 86400000);
+
+   /*
+    * Convert days since the epoch to a civil date. See
+    * http://howardhinnant.github.io/date_algorithms.html
+    */
+   days += 719468;
+   doe = (guint)(days % 146097);
+   yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+   year = (guint)(days / 146097) * 400 + yoe;
+   doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+   mp = (5 * doy + 2) / 153;
+   day = doy - (153 * mp + 2) / 5 + 1;
+   month = (mp < 10) ? (mp + 3) : (mp - 9);
+   if (month <= 2) {
+      year++;
+   }
+
+   mongo_bson_json_append_pair(&buf[1], year / 100);
+   mongo_bson_json_append_pair(&buf[3], year % 100);
+   mongo_bson_json_append_pair(&buf[6], month);
+   mongo_bson_json_append_pair(&buf[9], day);
+   mongo_bson_json_append_pair(&buf[12], ms / 3600000);
+   mongo_bson_json_append_pair(&buf[15], (ms / 60000) % 60);
+   mongo_bson_json_append_pair(&buf[18], (ms / 1000) % 60);
+   buf[21] = '0' + (ms % 1000) / 100;
+   mongo_bson_json_append_pair(&buf[22], ms % 100);
+
+   g_string_append_len(str, buf, sizeof buf - 1);
+}
+
+static void
+mongo_bson_json_append_number (GString     *str,
+                               const gchar *wrapper,
+                               gint64       value)
+{
+   g_string_append(str, wrapper);
+   mongo_bson_json_append_int64(str, value);
+   g_string_append_len(str, "\"}", 2);
+}
+
+static gboolean
+mongo_bson_json_flush (JsonWriter *writer)
+{
+   if (writer->str->len) {
+      if (!g_output_stream_write_all(writer->stream,
+                                     writer->str->str,
+                                     writer->str->len,
+                                     NULL,
+                                     writer->cancellable,
+                                     writer->error)) {
+         return FALSE;
+      }
+      g_string_truncate(writer->str, 0);
+   }
+
+   return TRUE;
+}
+
+static gboolean
+mongo_bson_json_write_document (JsonWriter       *writer,
+                                MongoBsonRawIter *iter,
+                                gboolean          is_array);
+
+static gboolean
+mongo_bson_json_write_value (JsonWriter       *writer,
+                             MongoBsonRawIter *iter)
+{
+   MongoBsonBinarySubtype subtype;
+   MongoBsonRawIter child;
+   MongoDecimal128 decimal;
+   GString *str = writer->str;
+   gboolean canonical = (writer->mode == MONGO_BSON_JSON_CANONICAL);
+   const guint8 *data;
+   const gchar *value;
+   gchar *encoded;
+   gchar digits[43];
+   gchar oid[25];
+   gdouble dvalue;
+   guint32 timestamp;
+   guint32 increment;
+   gint32 code_len;
+   gint32 buflen;
+   gint64 msec;
+   gsize length;
+
+   switch (mongo_bson_raw_iter_get_value_type(iter)) {
+   case MONGO_BSON_DOUBLE:
+      dvalue = mongo_bson_raw_iter_get_value_double(iter);
+      if (isnan(dvalue)) {
+         g_string_append(str, "{\"$numberDouble\":\"NaN\"}");
+      } else if (isinf(dvalue)) {
+         g_string_append(str, (dvalue > 0) ?
+                         "{\"$numberDouble\":\"Infinity\"}" :
+                         "{\"$numberDouble\":\"-Infinity\"}");
+      } else if (canonical) {
+         g_string_append(str, "{\"$numberDouble\":\"");
+         mongo_bson_json_append_double(str, dvalue);
+         g_string_append_len(str, "\"}", 2);
+      } else {
+         mongo_bson_json_append_double(str, dvalue);
+      }
+      break;
+   case MONGO_BSON_UTF8:
+      value = mongo_bson_raw_iter_get_value_string(iter, &length);
+      mongo_bson_json_append_string(str, value, length);
+      break;
+   case MONGO_BSON_DOCUMENT:
+   case MONGO_BSON_ARRAY:
+      if (!mongo_bson_raw_iter_recurse(iter, &child)) {
+         g_string_append(str, "null");
+         break;
+      }
+      return mongo_bson_json_write_document(
+            writer, &child,
+            (mongo_bson_raw_iter_get_value_type(iter) == MONGO_BSON_ARRAY));
+   case MONGO_BSON_BINARY:
+      data = mongo_bson_raw_iter_get_value_binary(iter, &subtype, &length);
+      encoded = g_base64_encode(data, length);
+      g_string_append(str, "{\"$binary\":{\"base64\":\"");
+      g_string_append(str, encoded);
+      g_string_append(str, "\",\"subType\":\"");
+      g_string_append_c(str, gHexDigits[(subtype >> 4) & 0xF]);
+      g_string_append_c(str, gHexDigits[subtype & 0xF]);
+      g_string_append_len(str, "\"}}", 3);
+      g_free(encoded);
+      break;
+   case MONGO_BSON_UNDEFINED:
+      g_string_append(str, "{\"$undefined\":true}");
+      break;
+   case MONGO_BSON_OBJECT_ID:
+      mongo_object_id_to_string_r(
+            mongo_bson_raw_iter_get_value_object_id(iter), oid);
+      g_string_append(str, "{\"$oid\":\"");
+      g_string_append_len(str, oid, 24);
+      g_string_append_len(str, "\"}", 2);
+      break;
+   case MONGO_BSON_BOOLEAN:
+      if (mongo_bson_raw_iter_get_value_boolean(iter)) {
+         g_string_append_len(str, "true", 4);
+      } else {
+         g_string_append_len(str, "false", 5);
+      }
+      break;
+   case MONGO_BSON_DATE_TIME:
+      memcpy(&msec, iter->value1, sizeof msec);
+      msec = GINT64_FROM_LE(msec);
+      if (!canonical && (msec >= 0) && (msec <= MAX_ISO8601_MSEC)) {
+         g_string_append(str, "{\"$date\":");
+         mongo_bson_json_append_iso8601(str, msec);
+         g_string_append_c(str, '}');
+      } else {
+         mongo_bson_json_append_number(str, "{\"$date\":{\"$numberLong\":\"",
+                                       msec);
+         g_string_append_c(str, '}');
+      }
+      break;
+   case MONGO_BSON_NULL:
+      g_string_append_len(str, "null", 4);
+      break;
+   case MONGO_BSON_REGEX:
+      g_string_append(str, "{\"$regularExpression\":{\"pattern\":");
+      value = (const gchar *)iter->value1;
+      mongo_bson_json_append_string(str, value, strlen(value));
+      g_string_append(str, ",\"options\":");
+      value = (const gchar *)iter->value2;
+      mongo_bson_json_append_string(str, value, strlen(value));
+      g_string_append_len(str, "}}", 2);
+      break;
+   case MONGO_BSON_DBPOINTER:
+      g_string_append(str, "{\"$dbPointer\":{\"$ref\":");
+      value = (const gchar *)iter->value1 + 4;
+      mongo_bson_json_append_string(str, value, strlen(value));
+      mongo_object_id_to_string_r((const MongoObjectId *)iter->value2, oid);
+      g_string_append(str, ",\"$id\":{\"$oid\":\"");
+      g_string_append_len(str, oid, 24);
+      g_string_append_len(str, "\"}}}", 4);
+      break;
+   case MONGO_BSON_JAVASCRIPT:
+   case MONGO_BSON_SYMBOL:
+      memcpy(&buflen, iter->value1, sizeof buflen);
+      g_string_append(str, (iter->type == MONGO_BSON_SYMBOL) ?
+                      "{\"$symbol\":" : "{\"$code\":");
+      mongo_bson_json_append_string(str, (const gchar *)iter->value2,
+                                    GINT32_FROM_LE(buflen) - 1);
+      g_string_append_c(str, '}');
+      break;
+   case MONGO_BSON_JAVASCRIPT_WITH_SCOPE:
+      memcpy(&code_len, iter->value2, sizeof code_len);
+      code_len = GINT32_FROM_LE(code_len);
+      g_string_append(str, "{\"$code\":");
+      mongo_bson_json_append_string(str, (const gchar *)iter->value2 + 4,
+                                    code_len - 1);
+      g_string_append(str, ",\"$scope\":");
+      memset(&child, 0, sizeof child);
+      child.data = iter->value2 + 4 + code_len;
+      memcpy(&buflen, child.data, sizeof buflen);
+      child.length = GINT32_FROM_LE(buflen);
+      child.offset = 4; /* Skip document length */
+      if (!mongo_bson_json_write_document(writer, &child, FALSE)) {
+         return FALSE;
+      }
+      g_string_append_c(str, '}');
+      break;
+   case MONGO_BSON_TIMESTAMP:
+      mongo_bson_raw_iter_get_value_timestamp(iter, &timestamp, &increment);
+      g_string_append(str, "{\"$timestamp\":{\"t\":");
+      mongo_bson_json_append_int64(str, timestamp);
+      g_string_append(str, ",\"i\":");
+      mongo_bson_json_append_int64(str, increment);
+      g_string_append_len(str, "}}", 2);
+      break;
+   case MONGO_BSON_DECIMAL128:
+      mongo_bson_raw_iter_get_value_decimal128(iter, &decimal);
+      mongo_decimal128_to_string_r(&decimal, digits);
+      g_string_append(str, "{\"$numberDecimal\":\"");
+      g_string_append(str, digits);
+      g_string_append_len(str, "\"}", 2);
+      break;
+   case MONGO_BSON_MAX_KEY:
+      g_string_append(str, "{\"$maxKey\":1}");
+      break;
+   case MONGO_BSON_MIN_KEY:
+      g_string_append(str, "{\"$minKey\":1}");
+      break;
+   case MONGO_BSON_INT32:
+      if (canonical) {
+         mongo_bson_json_append_number(str, "{\"$numberInt\":\"",
+                                       mongo_bson_raw_iter_get_value_int(iter));
+      } else {
+         mongo_bson_json_append_int64(str,
+                                      mongo_bson_raw_iter_get_value_int(iter));
+      }
+      break;
+   case MONGO_BSON_INT64:
+      if (canonical) {
+         mongo_bson_json_append_number(str, "{\"$numberLong\":\"",
+                                       mongo_bson_raw_iter_get_value_int64(iter));
+      } else {
+         mongo_bson_json_append_int64(str,
+                                      mongo_bson_raw_iter_get_value_int64(iter));
+      }
+      break;
+   default:
+      g_string_append_len(str, "null", 4);
+      break;
+   }
+
+   return TRUE;
+}
+
+static gboolean
+mongo_bson_json_write_document (JsonWriter       *writer,
+                                MongoBsonRawIter *iter,
+                                gboolean          is_array)
+{
+   GString *str = writer->str;
+   const gchar *key;
+   gboolean first = TRUE;
+
+   g_string_append_c(str, is_array ? '[' : '{');
+
+   while (mongo_bson_raw_iter_next(iter)) {
+      if (!first) {
+         g_string_append_c(str, ',');
+      }
+      first = FALSE;
+
+      if (!is_array) {
+         key = mongo_bson_raw_iter_get_key(iter);
+         mongo_bson_json_append_string(str, key, strlen(key));
+         g_string_append_c(str, ':');
+      }
+
+      if (!mongo_bson_json_write_value(writer, iter)) {
+         return FALSE;
+      }
+
+      if (writer->stream && (str->len >= FLUSH_SIZE)) {
+         if (!mongo_bson_json_flush(writer)) {
+            return FALSE;
+         }
+      }
+   }
+
+   g_string_append_c(str, is_array ? ']' : '}');
+
+   return TRUE;
+}
+
+/**
+ * mongo_bson_to_json_string:
+ * @bson: (in): A #MongoBson.
+ * @mode: (in): A #MongoBsonJsonMode.
+ * @string: (in): A #GString to append to.
+ *
+ * Appends @bson to @string as Extended JSON. Reusing @string between
+ * calls avoids allocating for each document.
+ */
+void
+mongo_bson_to_json_string (MongoBson         *bson,
+                           MongoBsonJsonMode  mode,
+                           GString           *string)
+{
+   MongoBsonRawIter iter;
+   JsonWriter writer = { 0 };
+
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(string != NULL);
+
+   writer.str = string;
+   writer.mode = mode;
+
+   mongo_bson_raw_iter_init(&iter, bson);
+   mongo_bson_json_write_document(&writer, &iter, FALSE);
+}
+
+/**
+ * mongo_bson_to_json:
+ * @bson: (in): A #MongoBson.
+ * @mode: (in): A #MongoBsonJsonMode.
+ *
+ * Renders @bson as Extended JSON.
+ *
+ * Returns: (transfer full): A newly allocated string which should be freed
+ *   with g_free().
+ */
+gchar *
+mongo_bson_to_json (MongoBson         *bson,
+                    MongoBsonJsonMode  mode)
+{
+   GString *str;
+   gsize length;
+
+   g_return_val_if_fail(bson != NULL, NULL);
+
+   mongo_bson_get_data(bson, &length);
+   str = g_string_sized_new(length * 2);
+   mongo_bson_to_json_string(bson, mode, str);
+
+   return g_string_free(str, FALSE);
+}
+
+/**
+ * mongo_bson_write_json:
+ * @bson: (in): A #MongoBson.
+ * @mode: (in): A #MongoBsonJsonMode.
+ * @stream: (in): A #GOutputStream.
+ * @cancellable: (in) (allow-none): A #GCancellable, or %NULL.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Writes @bson to @stream as Extended JSON. Large documents are written
+ * incrementally so that only a bounded amount of text is buffered. When
+ * writing many small documents, wrap @stream in a #GBufferedOutputStream.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ */
+gboolean
+mongo_bson_write_json (MongoBson          *bson,
+                       MongoBsonJsonMode   mode,
+                       GOutputStream      *stream,
+                       GCancellable       *cancellable,
+                       GError            **error)
+{
+   MongoBsonRawIter iter;
+   JsonWriter writer = { 0 };
+   gboolean ret;
+   gsize length;
+
+   g_return_val_if_fail(bson != NULL, FALSE);
+   g_return_val_if_fail(G_IS_OUTPUT_STREAM(stream), FALSE);
+   g_return_val_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable), FALSE);
+
+   mongo_bson_get_data(bson, &length);
+
+   writer.str = g_string_sized_new(MIN(length * 2, FLUSH_SIZE * 2));
+   writer.mode = mode;
+   writer.stream = stream;
+   writer.cancellable = cancellable;
+   writer.error = error;
+
+   mongo_bson_raw_iter_init(&iter, bson);
+   ret = (mongo_bson_json_write_document(&writer, &iter, FALSE) &&
+          mongo_bson_json_flush(&writer));
+
+   g_string_free(writer.str, TRUE);
+
+   return ret;
+}
+
+static gboolean
+mongo_bson_json_error (JsonParser  *parser,
+                       const gchar *message)
+{
+   g_set_error(parser->error, MONGO_BSON_JSON_ERROR,
+               MONGO_BSON_JSON_ERROR_SYNTAX,
+               _("%s at offset %" G_GSIZE_FORMAT "."),
+               message, (gsize)(parser->p - parser->begin));
+   return FALSE;
+}
+
+static inline void
+mongo_bson_json_skip_space (JsonParser *parser)
+{
+   const gchar *p = parser->p;
+
+   while ((p < parser->end) &&
+          ((*p == ' ') || (*p == '\n') || (*p == '\r') || (*p == '\t'))) {
+      p++;
+   }
+
+   parser->p = p;
+}
+
+static inline gboolean
+mongo_bson_json_expect (JsonParser *parser,
+                        gchar       c)
+{
+   mongo_bson_json_skip_space(parser);
+   if ((parser->p < parser->end) && (*parser->p == c)) {
+      parser->p++;
+      return TRUE;
+   }
+   return FALSE;
+}
+
+static gint
+mongo_bson_json_hex_value (gchar c)
+{
+   if ((c >= '0') && (c <= '9')) {
+      return c - '0';
+   } else if ((c >= 'a') && (c <= 'f')) {
+      return c - 'a' + 10;
+   } else if ((c >= 'A') && (c <= 'F')) {
+      return c - 'A' + 10;
+   }
+   return -1;
+}
+
+static gboolean
+mongo_bson_json_parse_hex4 (JsonParser *parser,
+                            gunichar   *value)
+{
+   gint digit;
+   guint i;
+
+   if ((parser->end - parser->p) < 4) {
+      return mongo_bson_json_error(parser, _("Truncated unicode escape"));
+   }
+
+   *value = 0;
+   for (i = 0; i < 4; i++) {
+      if ((digit = mongo_bson_json_hex_value(parser->p[i])) < 0) {
+         return mongo_bson_json_error(parser, _("Invalid unicode escape"));
+      }
+      *value = (*value << 4) | digit;
+   }
+   parser->p += 4;
+
+   return TRUE;
+}
+
+/**
+ * mongo_bson_json_parse_string:
+ * @parser: (in): A #JsonParser positioned at the opening quote.
+ * @out: (in): A #GString to store the unescaped string.
+ *
+ * Parses a JSON string into @out. Runs of bytes that need no unescaping
+ * are copied with a single call using the same table as the writer.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and an error is set.
+ */
+static gboolean
+mongo_bson_json_parse_string (JsonParser *parser,
+                              GString    *out)
+{
+   const gchar *end = parser->end;
+   const gchar *p = parser->p + 1;
+   const gchar *run;
+   gunichar low;
+   gunichar c;
+
+   g_string_truncate(out, 0);
+
+   for (;;) {
+      for (run = p; (p < end) && !gJsonEscape[(guint8)*p]; p++) { }
+
+      if (p > run) {
+         g_string_append_len(out, run, p - run);
+      }
+
+      if (p >= end) {
+         parser->p = p;
+         return mongo_bson_json_error(parser, _("Unterminated string"));
+      }
+
+      if (*p == '"') {
+         parser->p = p + 1;
+         break;
+      }
+
+      if (*p != '\\') {
+         parser->p = p;
+         return mongo_bson_json_error(parser,
+                                      _("Control character in string"));
+      }
+
+      if (++p >= end) {
+         parser->p = p;
+         return mongo_bson_json_error(parser, _("Unterminated string"));
+      }
+
+      switch (*p++) {
+      case '"':  g_string_append_c(out, '"');  break;
+      case '\\': g_string_append_c(out, '\\'); break;
+      case '/':  g_string_append_c(out, '/');  break;
+      case 'b':  g_string_append_c(out, '\b'); break;
+      case 'f':  g_string_append_c(out, '\f'); break;
+      case 'n':  g_string_append_c(out, '\n'); break;
+      case 'r':  g_string_append_c(out, '\r'); break;
+      case 't':  g_string_append_c(out, '\t'); break;
+      case 'u':
+         parser->p = p;
+         if (!mongo_bson_json_parse_hex4(parser, &c)) {
+            return FALSE;
+         }
+         if ((c >= 0xD800) && (c <= 0xDBFF)) {
+            if (((parser->end - parser->p) < 2) ||
+                (parser->p[0] != '\\') ||
+                (parser->p[1] != 'u')) {
+               return mongo_bson_json_error(parser,
+                                            _("Unpaired surrogate"));
+            }
+            parser->p += 2;
+            if (!mongo_bson_json_parse_hex4(parser, &low)) {
+               return FALSE;
+            }
+            if ((low < 0xDC00) || (low > 0xDFFF)) {
+               return mongo_bson_json_error(parser,
+                                            _("Unpaired surrogate"));
+            }
+            c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+         } else if ((c >= 0xDC00) && (c <= 0xDFFF)) {
+            return mongo_bson_json_error(parser, _("Unpaired surrogate"));
+         } else if (!c) {
+            return mongo_bson_json_error(parser,
+                                         _("Embedded nul in string"));
+         }
+         g_string_append_unichar(out, c);
+         p = parser->p;
+         break;
+      default:
+         parser->p = p - 1;
+         return mongo_bson_json_error(parser, _("Invalid escape"));
+      }
+   }
+
+   if (!g_utf8_validate(out->str, out->len, NULL)) {
+      return mongo_bson_json_error(parser, _("Invalid UTF-8 in string"));
+   }
+
+   return TRUE;
+}
+
+/**
+ * mongo_bson_json_parse_raw_key:
+ * @parser: (in): A #JsonParser positioned at the opening quote.
+ * @key: (out): A location for the start of the key.
+ * @key_len: (out): A location for the length of the key.
+ *
+ * Parses a key without unescaping it, leaving @key pointing into the
+ * input. This is used to match the fixed keys of Extended JSON wrappers.
+ *
+ * Returns: %TRUE if the key needs no unescaping.
+ */
+static gboolean
+mongo_bson_json_parse_raw_key (JsonParser   *parser,
+                               const gchar **key,
+                               gsize        *key_len)
+{
+   const gchar *p = parser->p + 1;
+
+   while ((p < parser->end) && !gJsonEscape[(guint8)*p]) {
+      p++;
+   }
+
+   if ((p >= parser->end) || (*p != '"')) {
+      return FALSE;
+   }
+
+   *key = parser->p + 1;
+   *key_len = p - *key;
+   parser->p = p + 1;
+
+   return TRUE;
+}
+
+static inline gboolean
+mongo_bson_json_key_equal (const gchar *key,
+                           gsize        key_len,
+                           const gchar *expected)
+{
+   return ((strlen(expected) == key_len) && !memcmp(key, expected, key_len));
+}
+
+/**
+ * mongo_bson_json_expect_key:
+ * @parser: (in): A #JsonParser.
+ * @expected: (in): The key of the member.
+ *
+ * Parses the key and colon of a member that must be @expected.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and an error is set.
+ */
+static gboolean
+mongo_bson_json_expect_key (JsonParser  *parser,
+                            const gchar *expected)
+{
+   const gchar *key;
+   gsize key_len;
+
+   mongo_bson_json_skip_space(parser);
+   if ((parser->p >= parser->end) ||
+       (*parser->p != '"') ||
+       !mongo_bson_json_parse_raw_key(parser, &key, &key_len) ||
+       !mongo_bson_json_key_equal(key, key_len, expected)) {
+      return mongo_bson_json_error(parser, _("Unexpected key"));
+   }
+
+   if (!mongo_bson_json_expect(parser, ':')) {
+      return mongo_bson_json_error(parser, _("Expected ':'"));
+   }
+
+   return TRUE;
+}
+
+static gboolean
+mongo_bson_json_expect_string (JsonParser *parser,
+                               GString    *out)
+{
+   mongo_bson_json_skip_space(parser);
+   if ((parser->p >= parser->end) || (*parser->p != '"')) {
+      return mongo_bson_json_error(parser, _("Expected string"));
+   }
+   return mongo_bson_json_parse_string(parser, out);
+}
+
+static gboolean
+mongo_bson_json_parse_int64 (const gchar *str,
+                             gint64      *value)
+{
+   gchar *endptr = NULL;
+
+   if (!*str) {
+      return FALSE;
+   }
+
+   errno = 0;
+   *value = g_ascii_strtoll(str, &endptr, 10);
+   return (!errno && !*endptr);
+}
+
+static gboolean
+mongo_bson_json_parse_digits (const gchar **p,
+                              const gchar  *end,
+                              guint         n_digits,
+                              guint        *value)
+{
+   guint i;
+
+   if ((guint)(end - *p) < n_digits) {
+      return FALSE;
+   }
+
+   *value = 0;
+   for (i = 0; i < n_digits; i++) {
+      if (((*p)[i] < '0') || ((*p)[i] > '9')) {
+         return FALSE;
+      }
+      *value = (*value * 10) + ((*p)[i] - '0');
+   }
+   *p += n_digits;
+
+   return TRUE;
+}
+
+static inline gboolean
+mongo_bson_json_parse_char (const gchar **p,
+                            const gchar  *end,
+                            gchar         c)
+{
+   if ((*p < end) && (**p == c)) {
+      (*p)++;
+      return TRUE;
+   }
+   return FALSE;
+}
+
+/**
+ * mongo_bson_json_parse_iso8601:
+ * @str: (in): A string such as "2011-10-22T12:13:14.123Z".
+ * @length: (in): The length of @str.
+ * @msec: (out): A location for milliseconds since the UNIX epoch.
+ *
+ * Parses an ISO-8601 date with a "Z" or numeric UTC offset. This is the
+ * inverse of mongo_bson_json_append_iso8601().
+ *
+ * Returns: %TRUE if successful.
+ */
+static gboolean
+mongo_bson_json_parse_iso8601 (const gchar *str,
+                               gsize        length,
+                               gint64      *msec)
+{
+   const gchar *end = str + length;
+   const gchar *p = str;
+   gint64 days;
+   gint64 era;
+   gint sign;
+   guint year;
+   guint month;
+   guint day;
+   guint hour;
+   guint minute;
+   guint second;
+   guint ms = 0;
+   guint scale;
+   guint tz_hour = 0;
+   guint tz_minute = 0;
+   guint yoe;
+   guint doy;
+   guint doe;
+   gint y;
+
+   if (!mongo_bson_json_parse_digits(&p, end, 4, &year) ||
+       !mongo_bson_json_parse_char(&p, end, '-') ||
+       !mongo_bson_json_parse_digits(&p, end, 2, &month) ||
+       !mongo_bson_json_parse_char(&p, end, '-') ||
+       !mongo_bson_json_parse_digits(&p, end, 2, &day) ||
+       !mongo_bson_json_parse_char(&p, end, 'T') ||
+       !mongo_bson_json_parse_digits(&p, end, 2, &hour) ||
+       !mongo_bson_json_parse_char(&p, end, ':') ||
+       !mongo_bson_json_parse_digits(&p, end, 2, &minute) ||
+       !mongo_bson_json_parse_char(&p, end, ':') ||
+       !mongo_bson_json_parse_digits(&p, end, 2, &second)) {
+      return FALSE;
+   }
+
+   if ((month < 1) || (month > 12) || (day < 1) || (day > 31) ||
+       (hour > 23) || (minute > 59) || (second > 60)) {
+      return FALSE;
+   }
+
+   if (mongo_bson_json_parse_char(&p, end, '.')) {
+      for (scale = 100; (p < end) && (*p >= '0') && (*p <= '9'); p++) {
+         ms += (*p - '0') * scale;
+         scale /= 10;
+      }
+   }
+
+   if (mongo_bson_json_parse_char(&p, end, 'Z')) {
+      sign = 0;
+   } else if ((p < end) && ((*p == '+') || (*p == '-'))) {
+      sign = (*p++ == '-') ? -1 : 1;
+      if (!mongo_bson_json_parse_digits(&p, end, 2, &tz_hour)) {
+         return FALSE;
+      }
+      mongo_bson_json_parse_char(&p, end, ':');
+      if (!mongo_bson_json_parse_digits(&p, end, 2, &tz_minute)) {
+         return FALSE;
+      }
+   } else {
+      return FALSE;
+   }
+
+   if (p != end) {
+      return FALSE;
+   }
+
+   /*
+    * Convert the civil date to days since the epoch. See
+    * http://howardhinnant.github.io/date_algorithms.html
+    */
+   y = (gint)year - (month <= 2);
+   era = (y >= 0 ? y : y - 399) / 400;
+   yoe = (guint)(y - era * 400);
+   doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+   doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+   days = era * 146097 + (gint64)doe - 719468;
+
+   *msec = (((days * 24 + hour) * 60 + minute) * 60 + second) * 1000 + ms;
+   *msec -= sign * (gint64)(tz_hour * 60 + tz_minute) * 60000;
+
+   return TRUE;
+}
+
+static void
+mongo_bson_json_append_msec (MongoBson   *bson,
+                             const gchar *key,
+                             gint64       msec)
+{
+   GTimeVal tv;
+
+   tv.tv_sec = msec / 1000;
+   if ((msec % 1000) < 0) {
+      tv.tv_sec--;
+   }
+   tv.tv_usec = (msec - ((gint64)tv.tv_sec * 1000)) * 1000;
+
+   mongo_bson_append_timeval(bson, key, &tv);
+}
+
+static gboolean
+mongo_bson_json_parse_date (JsonParser  *parser,
+                            MongoBson   *bson,
+                            const gchar *key)
+{
+   gint64 msec;
+
+   mongo_bson_json_skip_space(parser);
+
+   if (parser->p >= parser->end) {
+      return mongo_bson_json_error(parser, _("Expected date"));
+   }
+
+   switch (*parser->p) {
+   case '"':
+      if (!mongo_bson_json_parse_string(parser, parser->str)) {
+         return FALSE;
+      }
+      if (!mongo_bson_json_parse_iso8601(parser->str->str, parser->str->len,
+                                         &msec)) {
+         return mongo_bson_json_error(parser, _("Invalid ISO-8601 date"));
+      }
+      break;
+   case '{':
+      parser->p++;
+      if (!mongo_bson_json_expect_key(parser, "$numberLong") ||
+          !mongo_bson_json_expect_string(parser, parser->str)) {
+         return FALSE;
+      }
+      if (!mongo_bson_json_parse_int64(parser->str->str, &msec)) {
+         return mongo_bson_json_error(parser, _("Invalid $numberLong"));
+      }
+      if (!mongo_bson_json_expect(parser, '}')) {
+         return mongo_bson_json_error(parser, _("Expected '}'"));
+      }
+      break;
+   default:
+      return mongo_bson_json_error(parser, _("Expected date"));
+   }
+
+   mongo_bson_json_append_msec(bson, key, msec);
+
+   return TRUE;
+}
+
+static gboolean
+mongo_bson_json_parse_regex (JsonParser  *parser,
+                             MongoBson   *bson,
+                             const gchar *key)
+{
+   GString *pattern = parser->str;
+   GString *options = parser->aux;
+   const gchar *member;
+   gsize member_len;
+   gboolean have_pattern = FALSE;
+   gboolean have_options = FALSE;
+   guint i;
+
+   if (!mongo_bson_json_expect(parser, '{')) {
+      return mongo_bson_json_error(parser, _("Expected '{'"));
+   }
+
+   for (i = 0; i < 2; i++) {
+      if (i && !mongo_bson_json_expect(parser, ',')) {
+         return mongo_bson_json_error(parser, _("Expected ','"));
+      }
+      mongo_bson_json_skip_space(parser);
+      if ((parser->p >= parser->end) ||
+          (*parser->p != '"') ||
+          !mongo_bson_json_parse_raw_key(parser, &member, &member_len)) {
+         return mongo_bson_json_error(parser, _("Unexpected key"));
+      }
+      if (!mongo_bson_json_expect(parser, ':')) {
+         return mongo_bson_json_error(parser, _("Expected ':'"));
+      }
+      if (!have_pattern &&
+          mongo_bson_json_key_equal(member, member_len, "pattern")) {
+         have_pattern = TRUE;
+         if (!mongo_bson_json_expect_string(parser, pattern)) {
+            return FALSE;
+         }
+      } else if (!have_options &&
+                 mongo_bson_json_key_equal(member, member_len, "options")) {
+         have_options = TRUE;
+         if (!mongo_bson_json_expect_string(parser, options)) {
+            return FALSE;
+         }
+      } else {
+         return mongo_bson_json_error(parser, _("Unexpected key"));
+      }
+   }
+
+   if (!mongo_bson_json_expect(parser, '}')) {
+      return mongo_bson_json_error(parser, _("Expected '}'"));
+   }
+
+   mongo_bson_append_regex(bson, key, pattern->str, options->str);
+
+   return TRUE;
+}
+
+static gboolean
+mongo_bson_json_parse_binary (JsonParser  *parser,
+                              MongoBson   *bson,
+                              const gchar *key)
+{
+   GString *encoded = parser->str;
+   GString *subtype = parser->aux;
+   const gchar *member;
+   guint8 *data;
+   gsize member_len;
+   gsize length = 0;
+   gboolean have_data = FALSE;
+   gboolean have_subtype = FALSE;
+   gint high;
+   gint low;
+   guint i;
+
+   if (!mongo_bson_json_expect(parser, '{')) {
+      return mongo_bson_json_error(parser, _("Expected '{'"));
+   }
+
+   for (i = 0; i < 2; i++) {
+      if (i && !mongo_bson_json_expect(parser, ',')) {
+         return mongo_bson_json_error(parser, _("Expected ','"));
+      }
+      mongo_bson_json_skip_space(parser);
+      if ((parser->p >= parser->end) ||
+          (*parser->p != '"') ||
+          !mongo_bson_json_parse_raw_key(parser, &member, &member_len)) {
+         return mongo_bson_json_error(parser, _("Unexpected key"));
+      }
+      if (!mongo_bson_json_expect(parser, ':')) {
+         return mongo_bson_json_error(parser, _("Expected ':'"));
+      }
+      if (!have_data &&
+          mongo_bson_json_key_equal(member, member_len, "base64")) {
+         have_data = TRUE;
+         if (!mongo_bson_json_expect_string(parser, encoded)) {
+            return FALSE;
+         }
+      } else if (!have_subtype &&
+                 mongo_bson_json_key_equal(member, member_len, "subType")) {
+         have_subtype = TRUE;
+         if (!mongo_bson_json_expect_string(parser, subtype)) {
+            return FALSE;
+         }
+      } else {
+         return mongo_bson_json_error(parser, _("Unexpected key"));
+      }
+   }
+
+   if (!mongo_bson_json_expect(parser, '}')) {
+      return mongo_bson_json_error(parser, _("Expected '}'"));
+   }
+
+   /*
+    * The subtype is one or two hex digits.
+    */
+   if (!subtype->len || (subtype->len > 2)) {
+      return mongo_bson_json_error(parser, _("Invalid $binary subType"));
+   }
+   high = (subtype->len == 2) ? g_ascii_xdigit_value(subtype->str[0]) : 0;
+   low = g_ascii_xdigit_value(subtype->str[subtype->len - 1]);
+   if ((high < 0) || (low < 0)) {
+      return mongo_bson_json_error(parser, _("Invalid $binary subType"));
+   }
+
+   if ((encoded->len % 4) ||
+       (strspn(encoded->str, "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                             "abcdefghijklmnopqrstuvwxyz"
+                             "0123456789+/=") != encoded->len)) {
+      return mongo_bson_json_error(parser, _("Invalid $binary base64"));
+   }
+
+   data = encoded->len ? g_base64_decode(encoded->str, &length) : NULL;
+   mongo_bson_append_binary(bson, key, (high << 4) | low, data, length);
+   g_free(data);
+
+   return TRUE;
+}
+
+static gboolean
+mongo_bson_json_parse_uint32 (JsonParser *parser,
+                              guint32    *value)
+{
+   guint64 v = 0;
+   const gchar *p;
+
+   mongo_bson_json_skip_space(parser);
+
+   for (p = parser->p; (p < parser->end) && g_ascii_isdigit(*p); p++) {
+      v = (v * 10) + (*p - '0');
+      if (v > G_MAXUINT32) {
+         return FALSE;
+      }
+   }
+
+   if (p == parser->p) {
+      return FALSE;
+   }
+
+   parser->p = p;
+   *value = (guint32)v;
+
+   return TRUE;
+}
+
+static gboolean
+mongo_bson_json_parse_timestamp (JsonParser  *parser,
+                                 MongoBson   *bson,
+                                 const gchar *key)
+{
+   const gchar *member;
+   gsize member_len;
+   gboolean have_t = FALSE;
+   gboolean have_i = FALSE;
+   guint32 timestamp = 0;
+   guint32 increment = 0;
+   guint i;
+
+   if (!mongo_bson_json_expect(parser, '{')) {
+      return mongo_bson_json_error(parser, _("Expected '{'"));
+   }
+
+   for (i = 0; i < 2; i++) {
+      if (i && !mongo_bson_json_expect(parser, ',')) {
+         return mongo_bson_json_error(parser, _("Expected ','"));
+      }
+      mongo_bson_json_skip_space(parser);
+      if ((parser->p >= parser->end) ||
+          (*parser->p != '"') ||
+          !mongo_bson_json_parse_raw_key(parser, &member, &member_len)) {
+         return mongo_bson_json_error(parser, _("Unexpected key"));
+      }
+      if (!mongo_bson_json_expect(parser, ':')) {
+         return mongo_bson_json_error(parser, _("Expected ':'"));
+      }
+      if (!have_t && mongo_bson_json_key_equal(member, member_len, "t")) {
+         have_t = TRUE;
+         if (!mongo_bson_json_parse_uint32(parser, &timestamp)) {
+            return mongo_bson_json_error(parser, _("Invalid $timestamp"));
+         }
+      } else if (!have_i &&
+                 mongo_bson_json_key_equal(member, member_len, "i")) {
+         have_i = TRUE;
+         if (!mongo_bson_json_parse_uint32(parser, &increment)) {
+            return mongo_bson_json_error(parser, _("Invalid $timestamp"));
+         }
+      } else {
+         return mongo_bson_json_error(parser, _("Unexpected key"));
+      }
+   }
+
+   if (!mongo_bson_json_expect(parser, '}')) {
+      return mongo_bson_json_error(parser, _("Expected '}'"));
+   }
+
+   mongo_bson_append_timestamp(bson, key, timestamp, increment);
+
+   return TRUE;
+}
+
+static gboolean
+mongo_bson_json_parse_dbpointer (JsonParser  *parser,
+                                 MongoBson   *bson,
+                                 const gchar *key)
+{
+   MongoObjectId oid;
+   GString *collection = parser->str;
+   GString *id = parser->aux;
+   const gchar *member;
+   gsize member_len;
+   gboolean have_ref = FALSE;
+   gboolean have_id = FALSE;
+   guint i;
+
+   if (!mongo_bson_json_expect(parser, '{')) {
+      return mongo_bson_json_error(parser, _("Expected '{'"));
+   }
+
+   for (i = 0; i < 2; i++) {
+      if (i && !mongo_bson_json_expect(parser, ',')) {
+         return mongo_bson_json_error(parser, _("Expected ','"));
+      }
+      mongo_bson_json_skip_space(parser);
+      if ((parser->p >= parser->end) ||
+          (*parser->p != '"') ||
+          !mongo_bson_json_parse_raw_key(parser, &member, &member_len)) {
+         return mongo_bson_json_error(parser, _("Unexpected key"));
+      }
+      if (!mongo_bson_json_expect(parser, ':')) {
+         return mongo_bson_json_error(parser, _("Expected ':'"));
+      }
+      if (!have_ref && mongo_bson_json_key_equal(member, member_len, "$ref")) {
+         have_ref = TRUE;
+         if (!mongo_bson_json_expect_string(parser, collection)) {
+            return FALSE;
+         }
+      } else if (!have_id &&
+                 mongo_bson_json_key_equal(member, member_len, "$id")) {
+         have_id = TRUE;
+         if (!mongo_bson_json_expect(parser, '{')) {
+            return mongo_bson_json_error(parser, _("Expected '{'"));
+         }
+         if (!mongo_bson_json_expect_key(parser, "$oid") ||
+             !mongo_bson_json_expect_string(parser, id)) {
+            return FALSE;
+         }
+         if (!mongo_bson_json_expect(parser, '}')) {
+            return mongo_bson_json_error(parser, _("Expected '}'"));
+         }
+      } else {
+         return mongo_bson_json_error(parser, _("Unexpected key"));
+      }
+   }
+
+   if (!mongo_bson_json_expect(parser, '}')) {
+      return mongo_bson_json_error(parser, _("Expected '}'"));
+   }
+
+   if ((id->len != 24) || !mongo_object_id_init_from_string(&oid, id->str)) {
+      return mongo_bson_json_error(parser, _("Invalid $dbPointer"));
+   }
+
+   mongo_bson_append_dbpointer(bson, key, collection->str, &oid);
+
+   return TRUE;
+}
+
+static gboolean
+mongo_bson_json_parse_members (JsonParser *parser,
+                               MongoBson  *bson,
+                               guint       depth);
+
+/**
+ * mongo_bson_json_parse_code:
+ * @parser: (in): A #JsonParser positioned after the ':' of "$code".
+ * @bson: (in): A #MongoBson.
+ * @key: (in): The key to append the value under.
+ * @depth: (in): The nesting depth of the wrapper.
+ *
+ * Parses the code of a {"$code": "..."} wrapper and the "$scope"
+ * document that may follow it.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and an error is set.
+ */
+static gboolean
+mongo_bson_json_parse_code (JsonParser  *parser,
+                            MongoBson   *bson,
+                            const gchar *key,
+                            guint        depth)
+{
+   MongoBson *scope;
+   gchar *scope_key;
+   gchar *code;
+
+   if (!mongo_bson_json_expect_string(parser, parser->str)) {
+      return FALSE;
+   }
+
+   mongo_bson_json_skip_space(parser);
+   if ((parser->p >= parser->end) || (*parser->p != ',')) {
+      mongo_bson_append_javascript(bson, key, parser->str->str);
+      return TRUE;
+   }
+   parser->p++;
+
+   /*
+    * Parsing the scope reuses the buffers of @parser, which may also hold
+    * @key.
+    */
+   scope_key = g_strdup(key);
+   code = g_strndup(parser->str->str, parser->str->len);
+   scope = mongo_bson_new();
+
+   if (!mongo_bson_json_expect_key(parser, "$scope")) {
+      goto failure;
+   }
+
+   if (!mongo_bson_json_expect(parser, '{')) {
+      mongo_bson_json_error(parser, _("Expected '{'"));
+      goto failure;
+   }
+
+   if (!mongo_bson_json_parse_members(parser, scope, depth + 1)) {
+      goto failure;
+   }
+
+   mongo_bson_append_javascript_with_scope(bson, scope_key, code, scope);
+   mongo_bson_unref(scope);
+   g_free(scope_key);
+   g_free(code);
+
+   return TRUE;
+
+failure:
+   mongo_bson_unref(scope);
+   g_free(scope_key);
+   g_free(code);
+
+   return FALSE;
+}
+
+/**
+ * mongo_bson_json_parse_wrapper:
+ * @parser: (in): A #JsonParser positioned after the ':' of the wrapper key.
+ * @bson: (in): A #MongoBson.
+ * @key: (in): The key to append the value under.
+ * @wrapper: (in): The Extended JSON wrapper key, such as "$oid".
+ * @wrapper_len: (in): The length of @wrapper.
+ * @depth: (in): The nesting depth of the wrapper.
+ *
+ * Parses the value of an Extended JSON wrapper such as {"$oid": "..."}
+ * and appends it to @bson with its original BSON type.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and an error is set.
+ */
+static gboolean
+mongo_bson_json_parse_wrapper (JsonParser  *parser,
+                               MongoBson   *bson,
+                               const gchar *key,
+                               const gchar *wrapper,
+                               gsize        wrapper_len,
+                               guint        depth)
+{
+   MongoDecimal128 decimal;
+   MongoObjectId oid;
+   gchar *endptr = NULL;
+   gdouble dvalue;
+   gint64 value;
+
+   if (mongo_bson_json_key_equal(wrapper, wrapper_len, "$oid")) {
+      if (!mongo_bson_json_expect_string(parser, parser->str)) {
+         return FALSE;
+      }
+      if ((parser->str->len != 24) ||
+          !mongo_object_id_init_from_string(&oid, parser->str->str)) {
+         return mongo_bson_json_error(parser, _("Invalid $oid"));
+      }
+      mongo_bson_append_object_id(bson, key, &oid);
+   } else if (mongo_bson_json_key_equal(wrapper, wrapper_len, "$numberInt")) {
+      if (!mongo_bson_json_expect_string(parser, parser->str)) {
+         return FALSE;
+      }
+      if (!mongo_bson_json_parse_int64(parser->str->str, &value) ||
+          (value < G_MININT32) || (value > G_MAXINT32)) {
+         return mongo_bson_json_error(parser, _("Invalid $numberInt"));
+      }
+      mongo_bson_append_int(bson, key, (gint32)value);
+   } else if (mongo_bson_json_key_equal(wrapper, wrapper_len, "$numberLong")) {
+      if (!mongo_bson_json_expect_string(parser, parser->str)) {
+         return FALSE;
+      }
+      if (!mongo_bson_json_parse_int64(parser->str->str, &value)) {
+         return mongo_bson_json_error(parser, _("Invalid $numberLong"));
+      }
+      mongo_bson_append_int64(bson, key, value);
+   } else if (mongo_bson_json_key_equal(wrapper, wrapper_len,
+                                        "$numberDouble")) {
+      if (!mongo_bson_json_expect_string(parser, parser->str)) {
+         return FALSE;
+      }
+      if (!strcmp(parser->str->str, "Infinity")) {
+         dvalue = HUGE_VAL;
+      } else if (!strcmp(parser->str->str, "-Infinity")) {
+         dvalue = -HUGE_VAL;
+      } else if (!strcmp(parser->str->str, "NaN")) {
+         dvalue = NAN;
+      } else {
+         dvalue = g_ascii_strtod(parser->str->str, &endptr);
+         if (!parser->str->len || *endptr) {
+            return mongo_bson_json_error(parser, _("Invalid $numberDouble"));
+         }
+      }
+      mongo_bson_append_double(bson, key, dvalue);
+   } else if (mongo_bson_json_key_equal(wrapper, wrapper_len, "$binary")) {
+      if (!mongo_bson_json_parse_binary(parser, bson, key)) {
+         return FALSE;
+      }
+   } else if (mongo_bson_json_key_equal(wrapper, wrapper_len, "$date")) {
+      if (!mongo_bson_json_parse_date(parser, bson, key)) {
+         return FALSE;
+      }
+   } else if (mongo_bson_json_key_equal(wrapper, wrapper_len,
+                                        "$regularExpression")) {
+      if (!mongo_bson_json_parse_regex(parser, bson, key)) {
+         return FALSE;
+      }
+   } else if (mongo_bson_json_key_equal(wrapper, wrapper_len, "$undefined")) {
+      mongo_bson_json_skip_space(parser);
+      if (((parser->end - parser->p) < 4) || memcmp(parser->p, "true", 4)) {
+         return mongo_bson_json_error(parser, _("Invalid $undefined"));
+      }
+      parser->p += 4;
+      mongo_bson_append_undefined(bson, key);
+   } else if (mongo_bson_json_key_equal(wrapper, wrapper_len,
+                                        "$numberDecimal")) {
+      if (!mongo_bson_json_expect_string(parser, parser->str)) {
+         return FALSE;
+      }
+      if (!mongo_decimal128_init_from_string(&decimal, parser->str->str)) {
+         return mongo_bson_json_error(parser, _("Invalid $numberDecimal"));
+      }
+      mongo_bson_append_decimal128(bson, key, &decimal);
+   } else if (mongo_bson_json_key_equal(wrapper, wrapper_len, "$timestamp")) {
+      if (!mongo_bson_json_parse_timestamp(parser, bson, key)) {
+         return FALSE;
+      }
+   } else if (mongo_bson_json_key_equal(wrapper, wrapper_len, "$minKey") ||
+              mongo_bson_json_key_equal(wrapper, wrapper_len, "$maxKey")) {
+      mongo_bson_json_skip_space(parser);
+      if ((parser->p >= parser->end) || (*parser->p != '1')) {
+         return mongo_bson_json_error(parser, (wrapper[2] == 'i') ?
+                                      _("Invalid $minKey") :
+                                      _("Invalid $maxKey"));
+      }
+      parser->p++;
+      if (wrapper[2] == 'i') {
+         mongo_bson_append_min_key(bson, key);
+      } else {
+         mongo_bson_append_max_key(bson, key);
+      }
+   } else if (mongo_bson_json_key_equal(wrapper, wrapper_len, "$symbol")) {
+      if (!mongo_bson_json_expect_string(parser, parser->str)) {
+         return FALSE;
+      }
+      mongo_bson_append_symbol(bson, key, parser->str->str);
+   } else if (mongo_bson_json_key_equal(wrapper, wrapper_len, "$code")) {
+      if (!mongo_bson_json_parse_code(parser, bson, key, depth)) {
+         return FALSE;
+      }
+   } else if (mongo_bson_json_key_equal(wrapper, wrapper_len, "$dbPointer")) {
+      if (!mongo_bson_json_parse_dbpointer(parser, bson, key)) {
+         return FALSE;
+      }
+   } else {
+      g_assert_not_reached();
+   }
+
+   if (!mongo_bson_json_expect(parser, '}')) {
+      return mongo_bson_json_error(parser, _("Expected '}'"));
+   }
+
+   return TRUE;
+}
+
+static gboolean
+mongo_bson_json_is_wrapper (const gchar *key,
+                            gsize        key_len)
+{
+   static const gchar *wrappers[] = {
+      "$oid",
+      "$numberInt",
+      "$numberLong",
+      "$numberDouble",
+      "$binary",
+      "$date",
+      "$regularExpression",
+      "$undefined",
+      "$numberDecimal",
+      "$timestamp",
+      "$minKey",
+      "$maxKey",
+      "$symbol",
+      "$code",
+      "$dbPointer",
+   };
+   guint i;
+
+   for (i = 0; i < G_N_ELEMENTS(wrappers); i++) {
+      if (mongo_bson_json_key_equal(key, key_len, wrappers[i])) {
+         return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
+static gboolean
+mongo_bson_json_parse_value (JsonParser  *parser,
+                             MongoBson   *bson,
+                             const gchar *key,
+                             guint        depth);
+
+static gboolean
+mongo_bson_json_parse_members (JsonParser *parser,
+                               MongoBson  *bson,
+                               guint       depth)
+{
+   mongo_bson_json_skip_space(parser);
+   if ((parser->p < parser->end) && (*parser->p == '}')) {
+      parser->p++;
+      return TRUE;
+   }
+
+   for (;;) {
+      mongo_bson_json_skip_space(parser);
+      if ((parser->p >= parser->end) || (*parser->p != '"')) {
+         return mongo_bson_json_error(parser, _("Expected key"));
+      }
+      if (!mongo_bson_json_parse_string(parser, parser->key)) {
+         return FALSE;
+      }
+      if (!mongo_bson_json_expect(parser, ':')) {
+         return mongo_bson_json_error(parser, _("Expected ':'"));
+      }
+      if (!mongo_bson_json_parse_value(parser, bson, parser->key->str,
+                                       depth)) {
+         return FALSE;
+      }
+
+      mongo_bson_json_skip_space(parser);
+      if (parser->p < parser->end) {
+         if (*parser->p == ',') {
+            parser->p++;
+            continue;
+         } else if (*parser->p == '}') {
+            parser->p++;
+            return TRUE;
+         }
+      }
+
+      return mongo_bson_json_error(parser, _("Expected ',' or '}'"));
+   }
+}
+
+static gboolean
+mongo_bson_json_parse_elements (JsonParser *parser,
+                                MongoBson  *bson,
+                                guint       depth)
+{
+   gchar key[16];
+   gchar *p;
+   guint index;
+   guint i;
+
+   mongo_bson_json_skip_space(parser);
+   if ((parser->p < parser->end) && (*parser->p == ']')) {
+      parser->p++;
+      return TRUE;
+   }
+
+   for (index = 0;; index++) {
+      p = key + sizeof key;
+      *--p = '\0';
+      i = index;
+      do {
+         *--p = '0' + (i % 10);
+         i /= 10;
+      } while (i);
+
+      if (!mongo_bson_json_parse_value(parser, bson, p, depth)) {
+         return FALSE;
+      }
+
+      mongo_bson_json_skip_space(parser);
+      if (parser->p < parser->end) {
+         if (*parser->p == ',') {
+            parser->p++;
+            continue;
+         } else if (*parser->p == ']') {
+            parser->p++;
+            return TRUE;
+         }
+      }
+
+      return mongo_bson_json_error(parser, _("Expected ',' or ']'"));
+   }
+}
+
+/**
+ * mongo_bson_json_parse_object:
+ * @parser: (in): A #JsonParser positioned at the '{'.
+ * @bson: (in): A #MongoBson.
+ * @key: (in): The key to append the value under.
+ * @depth: (in): The nesting depth of the object.
+ *
+ * Parses an object value. Extended JSON wrappers are appended with their
+ * original type, other objects are built in place as child documents.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and an error is set.
+ */
+static gboolean
+mongo_bson_json_parse_object (JsonParser  *parser,
+                              MongoBson   *bson,
+                              const gchar *key,
+                              guint        depth)
+{
+   const gchar *start;
+   const gchar *wrapper;
+   gsize wrapper_len;
+
+   parser->p++;
+   start = parser->p;
+
+   mongo_bson_json_skip_space(parser);
+   if (((parser->end - parser->p) > 1) &&
+       (parser->p[0] == '"') &&
+       (parser->p[1] == '$') &&
+       mongo_bson_json_parse_raw_key(parser, &wrapper, &wrapper_len) &&
+       mongo_bson_json_is_wrapper(wrapper, wrapper_len)) {
+      if (!mongo_bson_json_expect(parser, ':')) {
+         return mongo_bson_json_error(parser, _("Expected ':'"));
+      }
+      return mongo_bson_json_parse_wrapper(parser, bson, key,
+                                           wrapper, wrapper_len, depth);
+   }
+
+   parser->p = start;
+   mongo_bson_append_bson_begin(bson, key);
+   if (!mongo_bson_json_parse_members(parser, bson, depth + 1)) {
+      return FALSE;
+   }
+   mongo_bson_append_bson_end(bson);
+
+   return TRUE;
+}
+
+static gboolean
+mongo_bson_json_parse_number (JsonParser  *parser,
+                              MongoBson   *bson,
+                              const gchar *key)
+{
+   const gchar *start = parser->p;
+   const gchar *p = parser->p;
+   const gchar *end = parser->end;
+   gboolean negative = FALSE;
+   gboolean overflow = FALSE;
+   gboolean is_double = FALSE;
+   guint64 value = 0;
+   gchar buf[64];
+   gchar *endptr = NULL;
+
+   if (*p == '-') {
+      negative = TRUE;
+      p++;
+   }
+
+   if ((p >= end) || (*p < '0') || (*p > '9')) {
+      parser->p = p;
+      return mongo_bson_json_error(parser, _("Invalid number"));
+   }
+
+   for (; (p < end) && (*p >= '0') && (*p <= '9'); p++) {
+      if (value > ((G_MAXUINT64 - 9) / 10)) {
+         overflow = TRUE;
+      }
+      value = (value * 10) + (*p - '0');
+   }
+
+   if ((p < end) && ((*p == '.') || (*p == 'e') || (*p == 'E'))) {
+      is_double = TRUE;
+      for (; (p < end) && (((*p >= '0') && (*p <= '9')) ||
+                           (*p == '.') || (*p == 'e') || (*p == 'E') ||
+                           (*p == '+') || (*p == '-')); p++) { }
+   }
+
+   parser->p = p;
+
+   if (!is_double && !overflow) {
+      if (!negative && (value <= G_MAXINT32)) {
+         mongo_bson_append_int(bson, key, (gint32)value);
+         return TRUE;
+      } else if (negative && (value <= ((guint64)G_MAXINT32 + 1))) {
+         mongo_bson_append_int(bson, key, (gint32)(0 - (gint64)value));
+         return TRUE;
+      } else if (!negative && (value <= G_MAXINT64)) {
+         mongo_bson_append_int64(bson, key, (gint64)value);
+         return TRUE;
+      } else if (negative && (value <= ((guint64)G_MAXINT64 + 1))) {
+         mongo_bson_append_int64(bson, key,
+                                 (gint64)(G_GUINT64_CONSTANT(0) - value));
+         return TRUE;
+      }
+   }
+
+   /*
+    * The input is not necessarily nul terminated, so copy the number
+    * before handing it to strtod().
+    */
+   if ((gsize)(p - start) >= sizeof buf) {
+      parser->p = start;
+      return mongo_bson_json_error(parser, _("Invalid number"));
+   }
+   memcpy(buf, start, p - start);
+   buf[p - start] = '\0';
+
+   mongo_bson_append_double(bson, key, g_ascii_strtod(buf, &endptr));
+   if (*endptr) {
+      parser->p = start;
+      return mongo_bson_json_error(parser, _("Invalid number"));
+   }
+
+   return TRUE;
+}
+
+static gboolean
+mongo_bson_json_parse_literal (JsonParser  *parser,
+                               const gchar *literal,
+                               gsize        length)
+{
+   if (((gsize)(parser->end - parser->p) < length) ||
+       memcmp(parser->p, literal, length)) {
+      return mongo_bson_json_error(parser, _("Invalid literal"));
+   }
+   parser->p += length;
+   return TRUE;
+}
+
+static gboolean
+mongo_bson_json_parse_value (JsonParser  *parser,
+                             MongoBson   *bson,
+                             const gchar *key,
+                             guint        depth)
+{
+   mongo_bson_json_skip_space(parser);
+
+   if (parser->p >= parser->end) {
+      return mongo_bson_json_error(parser, _("Expected value"));
+   }
+
+   if (depth >= MAX_DEPTH) {
+      return mongo_bson_json_error(parser, _("Nested too deeply"));
+   }
+
+   switch (*parser->p) {
+   case '{':
+      return mongo_bson_json_parse_object(parser, bson, key, depth);
+   case '[':
+      parser->p++;
+      mongo_bson_append_array_begin(bson, key);
+      if (!mongo_bson_json_parse_elements(parser, bson, depth + 1)) {
+         return FALSE;
+      }
+      mongo_bson_append_array_end(bson);
+      return TRUE;
+   case '"':
+      if (!mongo_bson_json_parse_string(parser, parser->str)) {
+         return FALSE;
+      }
+      mongo_bson_append_string(bson, key, parser->str->str);
+      return TRUE;
+   case 't':
+      if (!mongo_bson_json_parse_literal(parser, "true", 4)) {
+         return FALSE;
+      }
+      mongo_bson_append_boolean(bson, key, TRUE);
+      return TRUE;
+   case 'f':
+      if (!mongo_bson_json_parse_literal(parser, "false", 5)) {
+         return FALSE;
+      }
+      mongo_bson_append_boolean(bson, key, FALSE);
+      return TRUE;
+   case 'n':
+      if (!mongo_bson_json_parse_literal(parser, "null", 4)) {
+         return FALSE;
+      }
+      mongo_bson_append_null(bson, key);
+      return TRUE;
+   case '-':
+   case '0': case '1': case '2': case '3': case '4':
+   case '5': case '6': case '7': case '8': case '9':
+      return mongo_bson_json_parse_number(parser, bson, key);
+   default:
+      return mongo_bson_json_error(parser, _("Unexpected character"));
+   }
+}
+
+static void
+mongo_bson_json_parser_init (JsonParser   *parser,
+                             const gchar  *json,
+                             gsize         length,
+                             GError      **error)
+{
+   parser->begin = json;
+   parser->p = json;
+   parser->end = json + length;
+   parser->key = g_string_sized_new(32);
+   parser->str = g_string_sized_new(64);
+   parser->aux = g_string_sized_new(16);
+   parser->error = error;
+}
+
+static void
+mongo_bson_json_parser_destroy (JsonParser *parser)
+{
+   g_string_free(parser->key, TRUE);
+   g_string_free(parser->str, TRUE);
+   g_string_free(parser->aux, TRUE);
+}
+
+/**
+ * mongo_bson_json_parse_document:
+ * @parser: (in): A #JsonParser.
+ * @end: (in): The end of the document text.
+ *
+ * Parses a top-level JSON object ending before @end into a new #MongoBson.
+ * Only whitespace may follow the object.
+ *
+ * Returns: A new #MongoBson, or %NULL and an error is set.
+ */
+static MongoBson *
+mongo_bson_json_parse_document (JsonParser  *parser,
+                                const gchar *end)
+{
+   MongoBson *bson;
+
+   parser->end = end;
+
+   if (!mongo_bson_json_expect(parser, '{')) {
+      mongo_bson_json_error(parser, _("Expected '{'"));
+      return NULL;
+   }
+
+   bson = mongo_bson_new();
+
+   if (!mongo_bson_json_parse_members(parser, bson, 0)) {
+      mongo_bson_unref(bson);
+      return NULL;
+   }
+
+   mongo_bson_json_skip_space(parser);
+   if (parser->p != parser->end) {
+      mongo_bson_json_error(parser, _("Trailing data after document"));
+      mongo_bson_unref(bson);
+      return NULL;
+   }
+
+   return bson;
+}
+
+/**
+ * mongo_bson_new_from_json:
+ * @json: (in): A JSON or Extended JSON object.
+ * @length: (in): The length of @json in bytes, or -1 if it is nul
+ *   terminated.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Parses @json in a single pass, appending each value to the new document
+ * as it is read. Nested objects and arrays are built in place. Both the
+ * relaxed and canonical forms of Extended JSON written by mongo_bson_to_json()
+ * are understood and restore the original BSON types.
+ *
+ * Returns: (transfer full): A new #MongoBson, or %NULL if @error is set.
+ */
+MongoBson *
+mongo_bson_new_from_json (const gchar  *json,
+                          gssize        length,
+                          GError      **error)
+{
+   JsonParser parser;
+   MongoBson *bson;
+
+   g_return_val_if_fail(json != NULL, NULL);
+
+   if (length < 0) {
+      length = strlen(json);
+   }
+
+   mongo_bson_json_parser_init(&parser, json, length, error);
+   bson = mongo_bson_json_parse_document(&parser, json + length);
+   mongo_bson_json_parser_destroy(&parser);
+
+   return bson;
+}
+
+/**
+ * mongo_bson_parse_json_lines:
+ * @data: (in): Newline-delimited JSON.
+ * @length: (in): The length of @data in bytes.
+ * @func: (in) (scope call): A #MongoBsonJsonFunc.
+ * @user_data: (in): User data for @func.
+ * @consumed: (out) (allow-none): A location for the number of bytes
+ *   consumed, or %NULL.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Parses a buffer of newline-delimited JSON, calling @func with a new
+ * document for each line. Blank lines are skipped. Iteration stops early
+ * if @func returns %FALSE.
+ *
+ * If @consumed is %NULL, @data is treated as complete and the last line
+ * does not need a trailing newline. Otherwise, only complete lines are
+ * parsed and @consumed is set to the number of bytes that were handled so
+ * that the caller can keep the remainder and append more data from a
+ * stream. On error, @consumed points to the start of the failing line.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ */
+gboolean
+mongo_bson_parse_json_lines (const gchar        *data,
+                             gsize               length,
+                             MongoBsonJsonFunc   func,
+                             gpointer            user_data,
+                             gsize              *consumed,
+                             GError            **error)
+{
+   JsonParser parser;
+   MongoBson *bson;
+   const gchar *line;
+   const gchar *end = data + length;
+   const gchar *nl;
+   gboolean ret = TRUE;
+   gboolean cont = TRUE;
+
+   g_return_val_if_fail(data != NULL || !length, FALSE);
+   g_return_val_if_fail(func != NULL, FALSE);
+
+   mongo_bson_json_parser_init(&parser, data, length, error);
+
+   for (line = data; cont && (line < end); line = nl + 1) {
+      if (!(nl = memchr(line, '\n', end - line))) {
+         if (consumed) {
+            break;
+         }
+         nl = end;
+      }
+
+      parser.p = line;
+      parser.end = nl;
+      mongo_bson_json_skip_space(&parser);
+      if (parser.p == nl) {
+         continue;
+      }
+
+      if (!(bson = mongo_bson_json_parse_document(&parser, nl))) {
+         ret = FALSE;
+         break;
+      }
+
+      cont = func(bson, user_data);
+      mongo_bson_unref(bson);
+   }
+
+   if (consumed) {
+      *consumed = MIN(line, end) - data;
+   }
+
+   mongo_bson_json_parser_destroy(&parser);
+
+   return ret;
+}
+
+/**
+ * mongo_bson_json_mode_get_type:
+ *
+ * Fetches the #GType for a #MongoBsonJsonMode.
+ *
+ * Returns: A #GType.
+ */
+GType
+mongo_bson_json_mode_get_type (void)
+{
+   static GType type_id = 0;
+   static gsize initialized = FALSE;
+   static GEnumValue values[] = {
+      { MONGO_BSON_JSON_RELAXED,   "MONGO_BSON_JSON_RELAXED",   "RELAXED" },
+      { MONGO_BSON_JSON_CANONICAL, "MONGO_BSON_JSON_CANONICAL", "CANONICAL" },
+      { 0 }
+   };
+
+   if (g_once_init_enter(&initialized)) {
+      type_id = g_enum_register_static("MongoBsonJsonMode", values);
+      g_once_init_leave(&initialized, TRUE);
+   }
+
+   return type_id;
+}
+
+GQuark
+mongo_bson_json_error_quark (void)
+{
+   return g_quark_from_static_string("mongo_bson_json_error_quark");
+}
@@ -0,0 +1,91 @@
+/* mongo-bson-json.h
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MONGO_BSON_JSON_H
+#define MONGO_BSON_JSON_H
+
+#include <gio/gio.h>
+
+#include "mongo-bson.h"
+
+G_BEGIN_DECLS
+
+#define MONGO_TYPE_BSON_JSON_MODE (mongo_bson_json_mode_get_type())
+#define MONGO_BSON_JSON_ERROR     (mongo_bson_json_error_quark())
+
+typedef enum _MongoBsonJsonError MongoBsonJsonError;
+typedef enum _MongoBsonJsonMode  MongoBsonJsonMode;
+
+/**
+ * MongoBsonJsonFunc:
+ * @bson: (in): A #MongoBson parsed from a line of input.
+ * @user_data: (in): User data provided to mongo_bson_parse_json_lines().
+ *
+ * Callback for each document parsed by mongo_bson_parse_json_lines().
+ * Use mongo_bson_ref() to keep @bson after the callback returns.
+ *
+ * Returns: %TRUE to continue, %FALSE to stop parsing.
+ */
+typedef gboolean (*MongoBsonJsonFunc) (MongoBson *bson,
+                                       gpointer   user_data);
+
+enum _MongoBsonJsonError
+{
+   MONGO_BSON_JSON_ERROR_SYNTAX = 1,
+};
+
+/**
+ * MongoBsonJsonMode:
+ * @MONGO_BSON_JSON_RELAXED: Relaxed Extended JSON. Numbers are written as
+ *   plain JSON numbers and dates within years 1970-9999 as ISO-8601 strings.
+ * @MONGO_BSON_JSON_CANONICAL: Canonical Extended JSON. Every value keeps
+ *   its exact BSON type.
+ *
+ * The flavor of Extended JSON to write.
+ */
+enum _MongoBsonJsonMode
+{
+   MONGO_BSON_JSON_RELAXED   = 0,
+   MONGO_BSON_JSON_CANONICAL = 1,
+};
+
+GQuark     mongo_bson_json_error_quark   (void) G_GNUC_CONST;
+GType      mongo_bson_json_mode_get_type (void) G_GNUC_CONST;
+MongoBson *mongo_bson_new_from_json      (const gchar        *json,
+                                          gssize              length,
+                                          GError            **error);
+gboolean   mongo_bson_parse_json_lines   (const gchar        *data,
+                                          gsize               length,
+                                          MongoBsonJsonFunc   func,
+                                          gpointer            user_data,
+                                          gsize              *consumed,
+                                          GError            **error);
+gchar     *mongo_bson_to_json            (MongoBson          *bson,
+                                          MongoBsonJsonMode   mode);
+void       mongo_bson_to_json_string     (MongoBson          *bson,
+                                          MongoBsonJsonMode   mode,
+                                          GString            *string);
+gboolean   mongo_bson_write_json         (MongoBson          *bson,
+                                          MongoBsonJsonMode   mode,
+                                          GOutputStream      *stream,
+                                          GCancellable       *cancellable,
+                                          GError            **error);
+
+G_END_DECLS
+
+#endif /* MONGO_BSON_JSON_H */
@@ -0,0 +1,830 @@
+/* mongo-bson-matcher.c
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib/gi18n.h>
+#include <string.h>
+
+#include "mongo-bson-matcher.h"
+#include "mongo-bson-private.h"
+
+/*
+ * The deepest nesting of $and, $or and $nor that is accepted. This
+ * bounds the recursion of both the compiler and the matcher.
+ */
+#define MAX_DEPTH 100
+
+/*
+ * A query is compiled into a flat array of nodes in pre-order. Each node
+ * records the index just past its subtree, so the children of a $and or
+ * $or node are found by hopping from one sibling to the next and a
+ * subtree can be skipped without visiting it.
+ */
+typedef enum
+{
+   MATCH_AND,
+   MATCH_OR,
+   MATCH_EQ,
+   MATCH_GT,
+   MATCH_GTE,
+   MATCH_LT,
+   MATCH_LTE,
+   MATCH_IN,
+   MATCH_EXISTS,
+   MATCH_REGEX,
+} MatchOp;
+
+typedef struct
+{
+   MatchOp            op;
+   gboolean           negate;
+   gboolean           matches_missing;
+   guint              end;
+   gchar            **path;
+   MongoBsonRawIter   value;
+   GArray            *values;
+   GRegex            *regex;
+} MatchNode;
+
+struct _MongoBsonMatcher
+{
+   volatile gint  ref_count;
+   MongoBson     *query;
+   MatchNode     *nodes;
+   guint          n_nodes;
+};
+
+typedef struct
+{
+   GArray  *nodes;
+   GError **error;
+} MatchCompiler;
+
+static gboolean mongo_bson_matcher_compile_document (MatchCompiler    *compiler,
+                                                     MongoBsonRawIter *iter,
+                                                     guint             depth);
+
+static inline MatchNode *
+mongo_bson_matcher_node (MatchCompiler *compiler,
+                         guint          index)
+{
+   return &g_array_index(compiler->nodes, MatchNode, index);
+}
+
+static guint
+mongo_bson_matcher_add_node (MatchCompiler *compiler,
+                             MatchOp        op,
+                             const gchar   *path)
+{
+   MatchNode node = { 0 };
+
+   node.op = op;
+   if (path) {
+      node.path = g_strsplit(path, ".", 0);
+   }
+   g_array_append_val(compiler->nodes, node);
+
+   return compiler->nodes->len - 1;
+}
+
+static inline void
+mongo_bson_matcher_end_node (MatchCompiler *compiler,
+                             guint          index)
+{
+   mongo_bson_matcher_node(compiler, index)->end = compiler->nodes->len;
+}
+
+static gint
+mongo_bson_matcher_compare_values (gconstpointer a,
+                                   gconstpointer b)
+{
+   return mongo_bson_raw_iter_compare_value(a, b);
+}
+
+static gboolean
+mongo_bson_matcher_is_true (const MongoBsonRawIter *iter)
+{
+   switch (iter->type) {
+   case MONGO_BSON_BOOLEAN:
+      return mongo_bson_raw_iter_get_value_boolean(iter);
+   case MONGO_BSON_INT32:
+      return !!mongo_bson_raw_iter_get_value_int(iter);
+   case MONGO_BSON_INT64:
+      return !!mongo_bson_raw_iter_get_value_int64(iter);
+   case MONGO_BSON_DOUBLE:
+      return (mongo_bson_raw_iter_get_value_double(iter) != 0.0);
+   case MONGO_BSON_NULL:
+   case MONGO_BSON_UNDEFINED:
+      return FALSE;
+   default:
+      return TRUE;
+   }
+}
+
+static GRegex *
+mongo_bson_matcher_compile_regex (MatchCompiler *compiler,
+                                  const gchar   *pattern,
+                                  const gchar   *options)
+{
+   GRegexCompileFlags flags = G_REGEX_OPTIMIZE;
+   GError *local_error = NULL;
+   GRegex *regex;
+
+   for (; *options; options++) {
+      switch (*options) {
+      case 'i':
+         flags |= G_REGEX_CASELESS;
+         break;
+      case 'm':
+         flags |= G_REGEX_MULTILINE;
+         break;
+      case 's':
+         flags |= G_REGEX_DOTALL;
+         break;
+      case 'x':
+         flags |= G_REGEX_EXTENDED;
+         break;
+      default:
+         g_set_error(compiler->error, MONGO_BSON_MATCHER_ERROR,
+                     MONGO_BSON_MATCHER_ERROR_INVALID_QUERY,
+                     _("Unsupported regular expression option '%c'."),
+                     *options);
+         return NULL;
+      }
+   }
+
+   if (!(regex = g_regex_new(pattern, flags, 0, &local_error))) {
+      g_set_error(compiler->error, MONGO_BSON_MATCHER_ERROR,
+                  MONGO_BSON_MATCHER_ERROR_INVALID_QUERY,
+                  _("Invalid regular expression \"%s\": %s"),
+                  pattern, local_error->message);
+      g_error_free(local_error);
+   }
+
+   return regex;
+}
+
+/**
+ * mongo_bson_matcher_compile_operator:
+ * @compiler: (in): A #MatchCompiler.
+ * @path: (in): The key path the operator applies to.
+ * @ops: (in): The document of operators containing @iter.
+ * @iter: (in): A #MongoBsonRawIter positioned on the operator.
+ *
+ * Compiles a single operator such as {"$gt": 5} into a node.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and the error is set.
+ */
+static gboolean
+mongo_bson_matcher_compile_operator (MatchCompiler          *compiler,
+                                     const gchar            *path,
+                                     const MongoBsonRawIter *ops,
+                                     MongoBsonRawIter       *iter)
+{
+   MongoBsonRawIter options;
+   MongoBsonRawIter child;
+   const gchar *pattern;
+   const gchar *flags = "";
+   MatchNode *node;
+   GArray *values;
+   guint index;
+   guint i;
+
+   static const struct {
+      const gchar *name;
+      MatchOp      op;
+      gboolean     negate;
+   } simple_ops[] = {
+      { "$eq", MATCH_EQ, FALSE },
+      { "$ne", MATCH_EQ, TRUE },
+      { "$gt", MATCH_GT, FALSE },
+      { "$gte", MATCH_GTE, FALSE },
+      { "$lt", MATCH_LT, FALSE },
+      { "$lte", MATCH_LTE, FALSE },
+   };
+
+   for (i = 0; i < G_N_ELEMENTS(simple_ops); i++) {
+      if (!strcmp(iter->key, simple_ops[i].name)) {
+         index = mongo_bson_matcher_add_node(compiler, simple_ops[i].op, path);
+         node = mongo_bson_matcher_node(compiler, index);
+         node->negate = simple_ops[i].negate;
+         node->value = *iter;
+         node->matches_missing = ((node->op == MATCH_EQ) &&
+                                  (iter->type == MONGO_BSON_NULL));
+         mongo_bson_matcher_end_node(compiler, index);
+         return TRUE;
+      }
+   }
+
+   if (!strcmp(iter->key, "$in") || !strcmp(iter->key, "$nin")) {
+      if (iter->type != MONGO_BSON_ARRAY) {
+         g_set_error(compiler->error, MONGO_BSON_MATCHER_ERROR,
+                     MONGO_BSON_MATCHER_ERROR_INVALID_QUERY,
+                     _("%s requires an array."), iter->key);
+         return FALSE;
+      }
+      values = g_array_new(FALSE, FALSE, sizeof(MongoBsonRawIter));
+      mongo_bson_raw_iter_recurse(iter, &child);
+      while (mongo_bson_raw_iter_next(&child)) {
+         g_array_append_val(values, child);
+      }
+      g_array_sort(values, mongo_bson_matcher_compare_values);
+
+      index = mongo_bson_matcher_add_node(compiler, MATCH_IN, path);
+      node = mongo_bson_matcher_node(compiler, index);
+      node->negate = !strcmp(iter->key, "$nin");
+      node->values = values;
+      for (i = 0; i < values->len; i++) {
+         if (g_array_index(values, MongoBsonRawIter, i).type == MONGO_BSON_NULL) {
+            node->matches_missing = TRUE;
+         }
+      }
+      mongo_bson_matcher_end_node(compiler, index);
+      return TRUE;
+   }
+
+   if (!strcmp(iter->key, "$exists")) {
+      index = mongo_bson_matcher_add_node(compiler, MATCH_EXISTS, path);
+      node = mongo_bson_matcher_node(compiler, index);
+      node->negate = !mongo_bson_matcher_is_true(iter);
+      mongo_bson_matcher_end_node(compiler, index);
+      return TRUE;
+   }
+
+   if (!strcmp(iter->key, "$regex")) {
+      if (iter->type == MONGO_BSON_REGEX) {
+         pattern = (const gchar *)iter->value1;
+         flags = (const gchar *)iter->value2;
+      } else if (iter->type == MONGO_BSON_UTF8) {
+         pattern = (const gchar *)iter->value2;
+      } else {
+         g_set_error(compiler->error, MONGO_BSON_MATCHER_ERROR,
+                     MONGO_BSON_MATCHER_ERROR_INVALID_QUERY,
+                     _("$regex requires a string or regular expression."));
+         return FALSE;
+      }
+
+      options = *ops;
+      if (mongo_bson_raw_iter_find(&options, "$options")) {
+         if (options.type != MONGO_BSON_UTF8) {
+            g_set_error(compiler->error, MONGO_BSON_MATCHER_ERROR,
+                        MONGO_BSON_MATCHER_ERROR_INVALID_QUERY,
+                        _("$options requires a string."));
+            return FALSE;
+         }
+         flags = (const gchar *)options.value2;
+      }
+
+      index = mongo_bson_matcher_add_node(compiler, MATCH_REGEX, path);
+      node = mongo_bson_matcher_node(compiler, index);
+      node->regex = mongo_bson_matcher_compile_regex(compiler, pattern, flags);
+      mongo_bson_matcher_end_node(compiler, index);
+      return (node->regex != NULL);
+   }
+
+   if (!strcmp(iter->key, "$options")) {
+      options = *ops;
+      if (!mongo_bson_raw_iter_find(&options, "$regex")) {
+         g_set_error(compiler->error, MONGO_BSON_MATCHER_ERROR,
+                     MONGO_BSON_MATCHER_ERROR_INVALID_QUERY,
+                     _("$options requires $regex."));
+         return FALSE;
+      }
+      return TRUE;
+   }
+
+   g_set_error(compiler->error, MONGO_BSON_MATCHER_ERROR,
+               MONGO_BSON_MATCHER_ERROR_INVALID_QUERY,
+               _("Unsupported query operator \"%s\"."), iter->key);
+   return FALSE;
+}
+
+static gboolean
+mongo_bson_matcher_compile_element (MongoBsonRawIter *iter,
+                                    MatchCompiler    *compiler,
+                                    guint             depth)
+{
+   MongoBsonRawIter child;
+   MongoBsonRawIter ops;
+   MatchNode *node;
+   guint index;
+
+   if (iter->key[0] == '$') {
+      if (strcmp(iter->key, "$and") &&
+          strcmp(iter->key, "$or") &&
+          strcmp(iter->key, "$nor")) {
+         g_set_error(compiler->error, MONGO_BSON_MATCHER_ERROR,
+                     MONGO_BSON_MATCHER_ERROR_INVALID_QUERY,
+                     _("Unsupported query operator \"%s\"."), iter->key);
+         return FALSE;
+      }
+
+      index = mongo_bson_matcher_add_node(compiler,
+                                          strcmp(iter->key, "$and") ?
+                                          MATCH_OR : MATCH_AND,
+                                          NULL);
+      mongo_bson_matcher_node(compiler, index)->negate =
+         !strcmp(iter->key, "$nor");
+
+      if (iter->type != MONGO_BSON_ARRAY) {
+         goto invalid_array;
+      }
+
+      mongo_bson_raw_iter_recurse(iter, &child);
+      while (mongo_bson_raw_iter_next(&child)) {
+         if (child.type != MONGO_BSON_DOCUMENT) {
+            goto invalid_array;
+         }
+         mongo_bson_raw_iter_recurse(&child, &ops);
+         if (!mongo_bson_matcher_compile_document(compiler, &ops, depth + 1)) {
+            return FALSE;
+         }
+      }
+
+      if ((index + 1) == compiler->nodes->len) {
+         goto invalid_array;
+      }
+
+      mongo_bson_matcher_end_node(compiler, index);
+      return TRUE;
+   }
+
+   if (iter->type == MONGO_BSON_DOCUMENT) {
+      mongo_bson_raw_iter_recurse(iter, &ops);
+      child = ops;
+      if (mongo_bson_raw_iter_next(&child) && (child.key[0] == '$')) {
+         index = mongo_bson_matcher_add_node(compiler, MATCH_AND, NULL);
+         do {
+            if (!mongo_bson_matcher_compile_operator(compiler, iter->key,
+                                                     &ops, &child)) {
+               return FALSE;
+            }
+         } while (mongo_bson_raw_iter_next(&child));
+         mongo_bson_matcher_end_node(compiler, index);
+         return TRUE;
+      }
+   }
+
+   if (iter->type == MONGO_BSON_REGEX) {
+      index = mongo_bson_matcher_add_node(compiler, MATCH_REGEX, iter->key);
+      node = mongo_bson_matcher_node(compiler, index);
+      node->regex = mongo_bson_matcher_compile_regex(
+         compiler,
+         (const gchar *)iter->value1,
+         (const gchar *)iter->value2);
+      mongo_bson_matcher_end_node(compiler, index);
+      return (node->regex != NULL);
+   }
+
+   index = mongo_bson_matcher_add_node(compiler, MATCH_EQ, iter->key);
+   node = mongo_bson_matcher_node(compiler, index);
+   node->value = *iter;
+   node->matches_missing = (iter->type == MONGO_BSON_NULL);
+   mongo_bson_matcher_end_node(compiler, index);
+
+   return TRUE;
+
+invalid_array:
+   g_set_error(compiler->error, MONGO_BSON_MATCHER_ERROR,
+               MONGO_BSON_MATCHER_ERROR_INVALID_QUERY,
+               _("%s requires a non-empty array of documents."), iter->key);
+   return FALSE;
+}
+
+static gboolean
+mongo_bson_matcher_compile_document (MatchCompiler    *compiler,
+                                     MongoBsonRawIter *iter,
+                                     guint             depth)
+{
+   guint index;
+
+   if (depth > MAX_DEPTH) {
+      g_set_error(compiler->error, MONGO_BSON_MATCHER_ERROR,
+                  MONGO_BSON_MATCHER_ERROR_INVALID_QUERY,
+                  _("The query is nested too deeply."));
+      return FALSE;
+   }
+
+   index = mongo_bson_matcher_add_node(compiler, MATCH_AND, NULL);
+
+   while (mongo_bson_raw_iter_next(iter)) {
+      if (!mongo_bson_matcher_compile_element(iter, compiler, depth)) {
+         return FALSE;
+      }
+   }
+
+   mongo_bson_matcher_end_node(compiler, index);
+
+   return TRUE;
+}
+
+static inline gint
+mongo_bson_matcher_compare (const MongoBsonRawIter *a,
+                            const MongoBsonRawIter *b,
+                            gboolean               *comparable)
+{
+   *comparable = (mongo_bson_type_bracket(a->type) ==
+                  mongo_bson_type_bracket(b->type));
+   return *comparable ? mongo_bson_raw_iter_compare_value(a, b) : 0;
+}
+
+static gboolean
+mongo_bson_matcher_in (const MatchNode        *node,
+                       const MongoBsonRawIter *iter)
+{
+   const MongoBsonRawIter *values = (const MongoBsonRawIter *)node->values->data;
+   guint lo = 0;
+   guint hi = node->values->len;
+   guint mid;
+   gint ret;
+
+   while (lo < hi) {
+      mid = lo + ((hi - lo) / 2);
+      if (!(ret = mongo_bson_raw_iter_compare_value(iter, &values[mid]))) {
+         return TRUE;
+      } else if (ret < 0) {
+         hi = mid;
+      } else {
+         lo = mid + 1;
+      }
+   }
+
+   return FALSE;
+}
+
+/**
+ * mongo_bson_matcher_match_value:
+ * @node: (in): A #MatchNode.
+ * @iter: (in): A #MongoBsonRawIter positioned on a value.
+ *
+ * Tests a single value against a predicate. Comparisons only match
+ * values in the same type bracket as the operand, so {"$gt": 5} never
+ * matches a string.
+ *
+ * Returns: %TRUE if @iter matches the predicate, ignoring negation.
+ */
+static gboolean
+mongo_bson_matcher_match_value (const MatchNode        *node,
+                                const MongoBsonRawIter *iter)
+{
+   gboolean comparable;
+   gint ret;
+
+   switch (node->op) {
+   case MATCH_EQ:
+      ret = mongo_bson_matcher_compare(iter, &node->value, &comparable);
+      return comparable && (ret == 0);
+   case MATCH_GT:
+      ret = mongo_bson_matcher_compare(iter, &node->value, &comparable);
+      return comparable && (ret > 0);
+   case MATCH_GTE:
+      ret = mongo_bson_matcher_compare(iter, &node->value, &comparable);
+      return comparable && (ret >= 0);
+   case MATCH_LT:
+      ret = mongo_bson_matcher_compare(iter, &node->value, &comparable);
+      return comparable && (ret < 0);
+   case MATCH_LTE:
+      ret = mongo_bson_matcher_compare(iter, &node->value, &comparable);
+      return comparable && (ret <= 0);
+   case MATCH_IN:
+      return mongo_bson_matcher_in(node, iter);
+   case MATCH_REGEX:
+      return ((iter->type == MONGO_BSON_UTF8) &&
+              g_regex_match(node->regex, (const gchar *)iter->value2,
+                            0, NULL));
+   case MATCH_EXISTS:
+      return TRUE;
+   case MATCH_AND:
+   case MATCH_OR:
+   default:
+      return FALSE;
+   }
+}
+
+/**
+ * mongo_bson_matcher_match_field:
+ * @node: (in): A #MatchNode.
+ * @iter: (in): A #MongoBsonRawIter positioned on the field.
+ *
+ * Tests a field against a predicate. An array matches if either the
+ * array itself or any of its elements matches.
+ *
+ * Returns: %TRUE if the field matches, ignoring negation.
+ */
+static gboolean
+mongo_bson_matcher_match_field (const MatchNode  *node,
+                                MongoBsonRawIter *iter)
+{
+   MongoBsonRawIter child;
+
+   if (mongo_bson_matcher_match_value(node, iter)) {
+      return TRUE;
+   }
+
+   if ((iter->type == MONGO_BSON_ARRAY) &&
+       mongo_bson_raw_iter_recurse(iter, &child)) {
+      while (mongo_bson_raw_iter_next(&child)) {
+         if (mongo_bson_matcher_match_value(node, &child)) {
+            return TRUE;
+         }
+      }
+   }
+
+   return FALSE;
+}
+
+/**
+ * mongo_bson_matcher_match_path:
+ * @node: (in): A #MatchNode.
+ * @iter: (in): A #MongoBsonRawIter at the start of a document.
+ * @path: (in): The remaining components of the key path.
+ *
+ * Resolves @path within the document and tests the field it names. When
+ * an intermediate field is an array, a numeric component indexes into
+ * it and any other component is resolved within each embedded document.
+ *
+ * Returns: %TRUE if the field matches, ignoring negation.
+ */
+static gboolean
+mongo_bson_matcher_match_path (const MatchNode   *node,
+                               MongoBsonRawIter  *iter,
+                               gchar            **path)
+{
+   MongoBsonRawIter child;
+   MongoBsonRawIter grandchild;
+
+   if (!mongo_bson_raw_iter_find(iter, path[0])) {
+      return node->matches_missing;
+   }
+
+   if (!path[1]) {
+      return mongo_bson_matcher_match_field(node, iter);
+   }
+
+   if (!mongo_bson_raw_iter_recurse(iter, &child)) {
+      return node->matches_missing;
+   }
+
+   if (iter->type == MONGO_BSON_DOCUMENT) {
+      return mongo_bson_matcher_match_path(node, &child, path + 1);
+   }
+
+   if (g_ascii_isdigit(path[1][0])) {
+      grandchild = child;
+      if (mongo_bson_matcher_match_path(node, &grandchild, path + 1)) {
+         return TRUE;
+      }
+   }
+
+   while (mongo_bson_raw_iter_next(&child)) {
+      if ((child.type == MONGO_BSON_DOCUMENT) &&
+          mongo_bson_raw_iter_recurse(&child, &grandchild) &&
+          mongo_bson_matcher_match_path(node, &grandchild, path + 1)) {
+         return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
+static gboolean
+mongo_bson_matcher_match_node (MongoBsonMatcher       *matcher,
+                               guint                   index,
+                               const MongoBsonRawIter *doc)
+{
+   const MatchNode *node = &matcher->nodes[index];
+   MongoBsonRawIter iter;
+   gboolean ret;
+   guint i;
+
+   switch (node->op) {
+   case MATCH_AND:
+      ret = TRUE;
+      for (i = index + 1; ret && (i < node->end); i = matcher->nodes[i].end) {
+         ret = mongo_bson_matcher_match_node(matcher, i, doc);
+      }
+      break;
+   case MATCH_OR:
+      ret = FALSE;
+      for (i = index + 1; !ret && (i < node->end); i = matcher->nodes[i].end) {
+         ret = mongo_bson_matcher_match_node(matcher, i, doc);
+      }
+      break;
+   case MATCH_EQ:
+   case MATCH_GT:
+   case MATCH_GTE:
+   case MATCH_LT:
+   case MATCH_LTE:
+   case MATCH_IN:
+   case MATCH_EXISTS:
+   case MATCH_REGEX:
+   default:
+      iter = *doc;
+      ret = mongo_bson_matcher_match_path(node, &iter, node->path);
+      break;
+   }
+
+   return node->negate ? !ret : ret;
+}
+
+/**
+ * mongo_bson_matcher_match_data:
+ * @matcher: (in): A #MongoBsonMatcher.
+ * @data: (in) (array length=length): A buffer containing a BSON document.
+ * @length: (in): The length of @data.
+ *
+ * Checks if the BSON document in @data matches the query of @matcher.
+ * The document is evaluated in place without creating a #MongoBson.
+ *
+ * Returns: %TRUE if the document matches; %FALSE if it does not or if
+ *   @data does not contain a document of @length bytes.
+ */
+gboolean
+mongo_bson_matcher_match_data (MongoBsonMatcher *matcher,
+                               const guint8     *data,
+                               gsize             length)
+{
+   MongoBsonRawIter iter;
+
+   g_return_val_if_fail(matcher != NULL, FALSE);
+   g_return_val_if_fail(data != NULL, FALSE);
+
+   if (!mongo_bson_raw_iter_init_from_data(&iter, data, length)) {
+      return FALSE;
+   }
+
+   return mongo_bson_matcher_match_node(matcher, 0, &iter);
+}
+
+/**
+ * mongo_bson_matcher_match:
+ * @matcher: (in): A #MongoBsonMatcher.
+ * @bson: (in): A #MongoBson.
+ *
+ * Checks if @bson matches the query of @matcher. The raw bytes of @bson
+ * are evaluated directly, so matching does not allocate.
+ *
+ * Returns: %TRUE if @bson matches.
+ */
+gboolean
+mongo_bson_matcher_match (MongoBsonMatcher *matcher,
+                          MongoBson        *bson)
+{
+   MongoBsonRawIter iter;
+
+   g_return_val_if_fail(matcher != NULL, FALSE);
+   g_return_val_if_fail(bson != NULL, FALSE);
+
+   mongo_bson_raw_iter_init(&iter, bson);
+   return mongo_bson_matcher_match_node(matcher, 0, &iter);
+}
+
+static void
+mongo_bson_matcher_free_nodes (MatchNode *nodes,
+                               guint      n_nodes)
+{
+   guint i;
+
+   for (i = 0; i < n_nodes; i++) {
+      g_strfreev(nodes[i].path);
+      if (nodes[i].values) {
+         g_array_unref(nodes[i].values);
+      }
+      if (nodes[i].regex) {
+         g_regex_unref(nodes[i].regex);
+      }
+   }
+
+   g_free(nodes);
+}
+
+/**
+ * mongo_bson_matcher_new:
+ * @query: (in): A #MongoBson containing a query.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Compiles a query document so that documents can be matched against it
+ * on the client. Supported are equality, $eq, $ne, $gt, $gte, $lt, $lte,
+ * $in, $nin, $exists, $regex with $options, and the logical $and, $or
+ * and $nor. Keys may be dotted paths into embedded documents and arrays.
+ *
+ * Regular expressions are compiled once. The resulting matcher is
+ * immutable and may be shared between threads.
+ *
+ * Returns: (transfer full): A #MongoBsonMatcher, or %NULL if @query is
+ *   not supported and @error is set.
+ */
+MongoBsonMatcher *
+mongo_bson_matcher_new (MongoBson  *query,
+                        GError    **error)
+{
+   MongoBsonMatcher *matcher;
+   MongoBsonRawIter iter;
+   MatchCompiler compiler;
+   guint n_nodes;
+
+   g_return_val_if_fail(query != NULL, NULL);
+
+   matcher = g_slice_new0(MongoBsonMatcher);
+   matcher->ref_count = 1;
+   matcher->query = mongo_bson_dup(query);
+
+   compiler.nodes = g_array_new(FALSE, FALSE, sizeof(MatchNode));
+   compiler.error = error;
+
+   mongo_bson_raw_iter_init(&iter, matcher->query);
+   if (!mongo_bson_matcher_compile_document(&compiler, &iter, 0)) {
+      n_nodes = compiler.nodes->len;
+      mongo_bson_matcher_free_nodes(
+         (MatchNode *)g_array_free(compiler.nodes, FALSE), n_nodes);
+      mongo_bson_unref(matcher->query);
+      g_slice_free(MongoBsonMatcher, matcher);
+      return NULL;
+   }
+
+   matcher->n_nodes = compiler.nodes->len;
+   matcher->nodes = (MatchNode *)g_array_free(compiler.nodes, FALSE);
+
+   return matcher;
+}
+
+/**
+ * mongo_bson_matcher_ref:
+ * @matcher: (in): A #MongoBsonMatcher.
+ *
+ * Increments the reference count of @matcher by one.
+ *
+ * Returns: (transfer full): @matcher.
+ */
+MongoBsonMatcher *
+mongo_bson_matcher_ref (MongoBsonMatcher *matcher)
+{
+   g_return_val_if_fail(matcher != NULL, NULL);
+   g_return_val_if_fail(matcher->ref_count > 0, NULL);
+
+   g_atomic_int_inc(&matcher->ref_count);
+   return matcher;
+}
+
+/**
+ * mongo_bson_matcher_unref:
+ * @matcher: (in): A #MongoBsonMatcher.
+ *
+ * Decrements the reference count of @matcher by one. When the reference
+ * count reaches zero, the structure is freed.
+ */
+void
+mongo_bson_matcher_unref (MongoBsonMatcher *matcher)
+{
+   g_return_if_fail(matcher != NULL);
+   g_return_if_fail(matcher->ref_count > 0);
+
+   if (g_atomic_int_dec_and_test(&matcher->ref_count)) {
+      mongo_bson_matcher_free_nodes(matcher->nodes, matcher->n_nodes);
+      mongo_bson_unref(matcher->query);
+      g_slice_free(MongoBsonMatcher, matcher);
+   }
+}
+
+/**
+ * mongo_bson_matcher_get_type:
+ *
+ * Retrieve the #GType for the #MongoBsonMatcher boxed type.
+ *
+ * Returns: A #GType.
+ */
+GType
+mongo_bson_matcher_get_type (void)
+{
+   static GType type_id = 0;
+   static gsize initialized = FALSE;
+
+   if (g_once_init_enter(&initialized)) {
+      type_id = g_boxed_type_register_static("MongoBsonMatcher",
+         (GBoxedCopyFunc)mongo_bson_matcher_ref,
+         (GBoxedFreeFunc)mongo_bson_matcher_unref);
+      g_once_init_leave(&initialized, TRUE);
+   }
+
+   return type_id;
+}
+
+GQuark
+mongo_bson_matcher_error_quark (void)
+{
+   return g_quark_from_static_string("mongo_bson_matcher_error_quark");
+}
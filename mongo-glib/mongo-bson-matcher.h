@@ -0,0 +1,53 @@
+/* mongo-bson-matcher.h
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MONGO_BSON_MATCHER_H
+#define MONGO_BSON_MATCHER_H
+
+#include <glib-object.h>
+
+#include "mongo-bson.h"
+
+G_BEGIN_DECLS
+
+#define MONGO_TYPE_BSON_MATCHER  (mongo_bson_matcher_get_type())
+#define MONGO_BSON_MATCHER_ERROR (mongo_bson_matcher_error_quark())
+
+typedef struct _MongoBsonMatcher     MongoBsonMatcher;
+typedef enum   _MongoBsonMatcherError MongoBsonMatcherError;
+
+enum _MongoBsonMatcherError
+{
+   MONGO_BSON_MATCHER_ERROR_INVALID_QUERY = 1,
+};
+
+GQuark            mongo_bson_matcher_error_quark (void) G_GNUC_CONST;
+GType             mongo_bson_matcher_get_type    (void) G_GNUC_CONST;
+gboolean          mongo_bson_matcher_match       (MongoBsonMatcher  *matcher,
+                                                  MongoBson         *bson);
+gboolean          mongo_bson_matcher_match_data  (MongoBsonMatcher  *matcher,
+                                                  const guint8      *data,
+                                                  gsize              length);
+MongoBsonMatcher *mongo_bson_matcher_new         (MongoBson         *query,
+                                                  GError           **error);
+MongoBsonMatcher *mongo_bson_matcher_ref         (MongoBsonMatcher  *matcher);
+void              mongo_bson_matcher_unref       (MongoBsonMatcher  *matcher);
+
+G_END_DECLS
+
+#endif /* MONGO_BSON_MATCHER_H */
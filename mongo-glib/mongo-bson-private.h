@@ -0,0 +1,85 @@
+/* mongo-bson-private.h
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MONGO_BSON_PRIVATE_H
+#define MONGO_BSON_PRIVATE_H
+
+#include "mongo-bson.h"
+
+G_BEGIN_DECLS
+
+/**
+ * mongo_bson_type_bracket:
+ * @type: (in): A #MongoBsonType.
+ *
+ * Fetches the position of @type in the sort order used by MongoDB. Types
+ * that compare with each other, such as the numeric types, share a
+ * bracket.
+ *
+ * Returns: The bracket of @type.
+ */
+static inline gint
+mongo_bson_type_bracket (guint8 type)
+{
+   switch ((MongoBsonType)type) {
+   case MONGO_BSON_MIN_KEY:
+      return 0;
+   case MONGO_BSON_UNDEFINED:
+      return 2;
+   case MONGO_BSON_NULL:
+      return 5;
+   case MONGO_BSON_DOUBLE:
+   case MONGO_BSON_INT32:
+   case MONGO_BSON_INT64:
+   case MONGO_BSON_DECIMAL128:
+      return 10;
+   case MONGO_BSON_UTF8:
+   case MONGO_BSON_SYMBOL:
+      return 15;
+   case MONGO_BSON_DOCUMENT:
+      return 20;
+   case MONGO_BSON_ARRAY:
+      return 25;
+   case MONGO_BSON_BINARY:
+      return 30;
+   case MONGO_BSON_OBJECT_ID:
+      return 35;
+   case MONGO_BSON_BOOLEAN:
+      return 40;
+   case MONGO_BSON_DATE_TIME:
+      return 45;
+   case MONGO_BSON_TIMESTAMP:
+      return 47;
+   case MONGO_BSON_REGEX:
+      return 50;
+   case MONGO_BSON_DBPOINTER:
+      return 55;
+   case MONGO_BSON_JAVASCRIPT:
+      return 60;
+   case MONGO_BSON_JAVASCRIPT_WITH_SCOPE:
+      return 65;
+   case MONGO_BSON_MAX_KEY:
+      return 126;
+   default:
+      return 127;
+   }
+}
+
+G_END_DECLS
+
+#endif /* MONGO_BSON_PRIVATE_H */
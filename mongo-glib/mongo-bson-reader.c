@@ -0,0 +1,638 @@
+/* mongo-bson-reader.c
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib/gi18n.h>
+#include <string.h>
+
+#include "mongo-bson-reader.h"
+
+/*
+ * The default maximum document size matches the limit of the server.
+ */
+#define DEFAULT_MAX_DOCUMENT_SIZE (16 * 1024 * 1024)
+
+/*
+ * The minimum number of bytes to request from the stream at a time.
+ */
+#define READ_SIZE 65536
+
+G_DEFINE_TYPE(MongoBsonReader, mongo_bson_reader, G_TYPE_OBJECT)
+
+struct _MongoBsonReaderPrivate
+{
+   GInputStream *stream;
+   guint8       *buffer;
+   gsize         buffer_size;
+   gsize         offset;
+   gsize         length;
+   guint         max_document_size;
+   const guint8 *current;
+   gsize         current_length;
+   gboolean      pending;
+};
+
+enum
+{
+   PROP_0,
+   PROP_MAX_DOCUMENT_SIZE,
+   PROP_STREAM,
+   LAST_PROP
+};
+
+static GParamSpec *gParamSpecs[LAST_PROP];
+
+/**
+ * mongo_bson_reader_new:
+ * @stream: (in): A #GInputStream.
+ *
+ * Creates a new #MongoBsonReader that reads concatenated BSON documents,
+ * such as those found in a mongodump file, from @stream.
+ *
+ * Returns: (transfer full): A new #MongoBsonReader.
+ */
+MongoBsonReader *
+mongo_bson_reader_new (GInputStream *stream)
+{
+   g_return_val_if_fail(G_IS_INPUT_STREAM(stream), NULL);
+
+   return g_object_new(MONGO_TYPE_BSON_READER,
+                       "stream", stream,
+                       NULL);
+}
+
+/**
+ * mongo_bson_reader_get_stream:
+ * @reader: (in): A #MongoBsonReader.
+ *
+ * Fetches the stream that documents are read from.
+ *
+ * Returns: (transfer none): A #GInputStream.
+ */
+GInputStream *
+mongo_bson_reader_get_stream (MongoBsonReader *reader)
+{
+   g_return_val_if_fail(MONGO_IS_BSON_READER(reader), NULL);
+
+   return reader->priv->stream;
+}
+
+static void
+mongo_bson_reader_set_stream (MongoBsonReader *reader,
+                              GInputStream    *stream)
+{
+   g_return_if_fail(MONGO_IS_BSON_READER(reader));
+   g_return_if_fail(G_IS_INPUT_STREAM(stream));
+   g_return_if_fail(!reader->priv->stream);
+
+   reader->priv->stream = g_object_ref(stream);
+}
+
+/**
+ * mongo_bson_reader_get_max_document_size:
+ * @reader: (in): A #MongoBsonReader.
+ *
+ * Fetches the size of the largest document that @reader will accept.
+ *
+ * Returns: The maximum document size in bytes.
+ */
+guint
+mongo_bson_reader_get_max_document_size (MongoBsonReader *reader)
+{
+   g_return_val_if_fail(MONGO_IS_BSON_READER(reader), 0);
+
+   return reader->priv->max_document_size;
+}
+
+/**
+ * mongo_bson_reader_set_max_document_size:
+ * @reader: (in): A #MongoBsonReader.
+ * @max_document_size: (in): The maximum document size in bytes.
+ *
+ * Sets the size of the largest document that @reader will accept. The
+ * buffer used by @reader never grows beyond this size, which bounds the
+ * memory used while reading untrusted input.
+ */
+void
+mongo_bson_reader_set_max_document_size (MongoBsonReader *reader,
+                                         guint            max_document_size)
+{
+   g_return_if_fail(MONGO_IS_BSON_READER(reader));
+   g_return_if_fail(max_document_size >= 5);
+
+   reader->priv->max_document_size = max_document_size;
+   g_object_notify_by_pspec(G_OBJECT(reader),
+                            gParamSpecs[PROP_MAX_DOCUMENT_SIZE]);
+}
+
+/**
+ * mongo_bson_reader_parse:
+ * @reader: (in): A #MongoBsonReader.
+ * @needed: (out): A location for the number of bytes needed.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Tries to frame the next document from the buffered data. If there is not
+ * enough data buffered, @needed is set to the number of unconsumed bytes
+ * required to make progress.
+ *
+ * Returns: %TRUE if a document is available in the current slot. %FALSE
+ *   if more data is needed or @error is set.
+ */
+static gboolean
+mongo_bson_reader_parse (MongoBsonReader  *reader,
+                         gsize            *needed,
+                         GError          **error)
+{
+   MongoBsonReaderPrivate *priv = reader->priv;
+   guint8 *data;
+   guint32 doc_len;
+   gsize avail;
+
+   data = priv->buffer + priv->offset;
+   avail = priv->length - priv->offset;
+
+   if (avail < 4) {
+      *needed = 4;
+      return FALSE;
+   }
+
+   memcpy(&doc_len, data, sizeof doc_len);
+   doc_len = GUINT32_FROM_LE(doc_len);
+
+   if ((doc_len < 5) || (doc_len > priv->max_document_size)) {
+      g_set_error(error, MONGO_BSON_READER_ERROR,
+                  MONGO_BSON_READER_ERROR_INVALID_DOCUMENT,
+                  _("Invalid document length %u."), doc_len);
+      return FALSE;
+   }
+
+   if (avail < doc_len) {
+      *needed = doc_len;
+      return FALSE;
+   }
+
+   if (data[doc_len - 1] != '\0') {
+      g_set_error(error, MONGO_BSON_READER_ERROR,
+                  MONGO_BSON_READER_ERROR_INVALID_DOCUMENT,
+                  _("Document is missing trailing byte."));
+      return FALSE;
+   }
+
+   priv->current = data;
+   priv->current_length = doc_len;
+   priv->offset += doc_len;
+
+   return TRUE;
+}
+
+/**
+ * mongo_bson_reader_prepare_read:
+ * @reader: (in): A #MongoBsonReader.
+ * @needed: (in): The number of unconsumed bytes needed.
+ * @size: (out): A location for the number of bytes that may be read.
+ *
+ * Moves the unconsumed data to the front of the buffer and grows the buffer
+ * if necessary so that at least @needed bytes fit.
+ *
+ * Returns: The location to read into.
+ */
+static guint8 *
+mongo_bson_reader_prepare_read (MongoBsonReader *reader,
+                                gsize            needed,
+                                gsize           *size)
+{
+   MongoBsonReaderPrivate *priv = reader->priv;
+
+   if (priv->offset) {
+      memmove(priv->buffer,
+              priv->buffer + priv->offset,
+              priv->length - priv->offset);
+      priv->length -= priv->offset;
+      priv->offset = 0;
+   }
+
+   if (priv->buffer_size < needed) {
+      priv->buffer_size = MAX(needed, READ_SIZE);
+      priv->buffer = g_realloc(priv->buffer, priv->buffer_size);
+   }
+
+   *size = priv->buffer_size - priv->length;
+   return priv->buffer + priv->length;
+}
+
+/**
+ * mongo_bson_reader_at_eof:
+ * @reader: (in): A #MongoBsonReader.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Handles the end of the stream.
+ *
+ * Returns: %TRUE if the stream ended on a document boundary; otherwise
+ *   %FALSE and @error is set.
+ */
+static gboolean
+mongo_bson_reader_at_eof (MongoBsonReader  *reader,
+                          GError          **error)
+{
+   MongoBsonReaderPrivate *priv = reader->priv;
+
+   if (priv->length != priv->offset) {
+      g_set_error(error, MONGO_BSON_READER_ERROR,
+                  MONGO_BSON_READER_ERROR_TRUNCATED,
+                  _("The stream ended within a document."));
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+/**
+ * mongo_bson_reader_next:
+ * @reader: (in): A #MongoBsonReader.
+ * @length: (out): A location for the length of the document.
+ * @cancellable: (in) (allow-none): A #GCancellable, or %NULL.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Reads the next document from the stream, blocking if necessary.
+ *
+ * The document is returned as a pointer into the buffer of @reader, no
+ * copy is made. It is only valid until the next read from @reader or
+ * until @reader is finalized. Read it in place with
+ * mongo_bson_raw_iter_init_from_data(), or keep a copy with
+ * mongo_bson_new_from_data().
+ *
+ * Returns: (transfer none) (array length=length): The document, or %NULL
+ *   at the end of the stream or if an error occurred. @error is set in the
+ *   latter case.
+ */
+const guint8 *
+mongo_bson_reader_next (MongoBsonReader  *reader,
+                        gsize            *length,
+                        GCancellable     *cancellable,
+                        GError          **error)
+{
+   MongoBsonReaderPrivate *priv;
+   GError *local_error = NULL;
+   guint8 *buffer;
+   gssize n_read;
+   gsize needed;
+   gsize size;
+
+   g_return_val_if_fail(MONGO_IS_BSON_READER(reader), NULL);
+   g_return_val_if_fail(length != NULL, NULL);
+   g_return_val_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable), NULL);
+
+   priv = reader->priv;
+   *length = 0;
+
+   if (priv->pending) {
+      g_set_error(error, MONGO_BSON_READER_ERROR,
+                  MONGO_BSON_READER_ERROR_PENDING,
+                  _("An asynchronous read is already pending."));
+      return NULL;
+   }
+
+   for (;;) {
+      if (mongo_bson_reader_parse(reader, &needed, &local_error)) {
+         *length = priv->current_length;
+         return priv->current;
+      } else if (local_error) {
+         g_propagate_error(error, local_error);
+         return NULL;
+      }
+
+      buffer = mongo_bson_reader_prepare_read(reader, needed, &size);
+      n_read = g_input_stream_read(priv->stream, buffer, size,
+                                   cancellable, error);
+      if (n_read < 0) {
+         return NULL;
+      } else if (n_read == 0) {
+         mongo_bson_reader_at_eof(reader, error);
+         return NULL;
+      }
+
+      priv->length += n_read;
+   }
+}
+
+static void
+mongo_bson_reader_next_step (MongoBsonReader    *reader,
+                             GSimpleAsyncResult *simple);
+
+static void
+mongo_bson_reader_read_cb (GObject      *object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+   GSimpleAsyncResult *simple = user_data;
+   MongoBsonReader *reader;
+   GInputStream *stream = (GInputStream *)object;
+   GError *error = NULL;
+   gssize n_read;
+
+   g_return_if_fail(G_IS_INPUT_STREAM(stream));
+   g_return_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple));
+
+   reader = MONGO_BSON_READER(g_async_result_get_source_object(user_data));
+   n_read = g_input_stream_read_finish(stream, result, &error);
+
+   if (n_read > 0) {
+      reader->priv->length += n_read;
+      mongo_bson_reader_next_step(reader, simple);
+   } else {
+      if ((n_read == 0) && !mongo_bson_reader_at_eof(reader, &error)) {
+         g_assert(error);
+      }
+      if (error) {
+         g_simple_async_result_take_error(simple, error);
+      }
+      reader->priv->pending = FALSE;
+      g_simple_async_result_complete(simple);
+      g_object_unref(simple);
+   }
+
+   g_object_unref(reader);
+}
+
+/**
+ * mongo_bson_reader_next_step:
+ * @reader: (in): A #MongoBsonReader.
+ * @simple: (in) (transfer full): A #GSimpleAsyncResult.
+ *
+ * Completes @simple if a document or an error is available, otherwise
+ * starts an asynchronous read from the stream.
+ */
+static void
+mongo_bson_reader_next_step (MongoBsonReader    *reader,
+                             GSimpleAsyncResult *simple)
+{
+   MongoBsonReaderPrivate *priv = reader->priv;
+   GCancellable *cancellable;
+   GError *error = NULL;
+   guint8 *buffer;
+   gsize needed;
+   gsize size;
+
+   if (mongo_bson_reader_parse(reader, &needed, &error) || error) {
+      if (error) {
+         g_simple_async_result_take_error(simple, error);
+      } else {
+         g_simple_async_result_set_op_res_gpointer(simple,
+                                                   (gpointer)priv->current,
+                                                   NULL);
+      }
+      priv->pending = FALSE;
+      g_simple_async_result_complete_in_idle(simple);
+      g_object_unref(simple);
+      return;
+   }
+
+   cancellable = g_object_get_data(G_OBJECT(simple), "cancellable");
+   buffer = mongo_bson_reader_prepare_read(reader, needed, &size);
+   g_input_stream_read_async(priv->stream,
+                             buffer,
+                             size,
+                             G_PRIORITY_DEFAULT,
+                             cancellable,
+                             mongo_bson_reader_read_cb,
+                             simple);
+}
+
+/**
+ * mongo_bson_reader_next_async:
+ * @reader: (in): A #MongoBsonReader.
+ * @cancellable: (in) (allow-none): A #GCancellable, or %NULL.
+ * @callback: (in): A callback to execute upon completion.
+ * @user_data: (in): User data for @callback.
+ *
+ * Asynchronously reads the next document from the stream. @callback
+ * should call mongo_bson_reader_next_finish() to retrieve the document.
+ * Only one read may be pending at a time.
+ */
+void
+mongo_bson_reader_next_async (MongoBsonReader     *reader,
+                              GCancellable        *cancellable,
+                              GAsyncReadyCallback  callback,
+                              gpointer             user_data)
+{
+   MongoBsonReaderPrivate *priv;
+   GSimpleAsyncResult *simple;
+
+   g_return_if_fail(MONGO_IS_BSON_READER(reader));
+   g_return_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable));
+   g_return_if_fail(callback != NULL);
+
+   priv = reader->priv;
+
+   simple = g_simple_async_result_new(G_OBJECT(reader), callback, user_data,
+                                      mongo_bson_reader_next_async);
+
+   if (priv->pending) {
+      g_simple_async_result_set_error(simple, MONGO_BSON_READER_ERROR,
+                                      MONGO_BSON_READER_ERROR_PENDING,
+                                      _("An asynchronous read is already "
+                                        "pending."));
+      g_simple_async_result_complete_in_idle(simple);
+      g_object_unref(simple);
+      return;
+   }
+
+   if (cancellable) {
+      g_object_set_data_full(G_OBJECT(simple), "cancellable",
+                             g_object_ref(cancellable),
+                             g_object_unref);
+   }
+
+   priv->pending = TRUE;
+   mongo_bson_reader_next_step(reader, simple);
+}
+
+/**
+ * mongo_bson_reader_next_finish:
+ * @reader: (in): A #MongoBsonReader.
+ * @result: (in): A #GAsyncResult.
+ * @length: (out): A location for the length of the document.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Completes an asynchronous request to read the next document. See
+ * mongo_bson_reader_next() for the lifetime of the resulting document.
+ *
+ * Returns: (transfer none) (array length=length): The document, or %NULL
+ *   at the end of the stream or if an error occurred. @error is set in the
+ *   latter case.
+ */
+const guint8 *
+mongo_bson_reader_next_finish (MongoBsonReader  *reader,
+                               GAsyncResult     *result,
+                               gsize            *length,
+                               GError          **error)
+{
+   GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
+   const guint8 *data;
+
+   g_return_val_if_fail(MONGO_IS_BSON_READER(reader), NULL);
+   g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple), NULL);
+   g_return_val_if_fail(length != NULL, NULL);
+
+   *length = 0;
+
+   if (g_simple_async_result_propagate_error(simple, error)) {
+      return NULL;
+   }
+
+   if ((data = g_simple_async_result_get_op_res_gpointer(simple))) {
+      *length = reader->priv->current_length;
+   }
+
+   return data;
+}
+
+/**
+ * mongo_bson_reader_finalize:
+ * @object: (in): A #MongoBsonReader.
+ *
+ * Finalizer for a #MongoBsonReader instance.  Frees any resources held by
+ * the instance.
+ */
+static void
+mongo_bson_reader_finalize (GObject *object)
+{
+   MongoBsonReaderPrivate *priv = MONGO_BSON_READER(object)->priv;
+
+   g_free(priv->buffer);
+   if (priv->stream) {
+      g_object_unref(priv->stream);
+   }
+
+   G_OBJECT_CLASS(mongo_bson_reader_parent_class)->finalize(object);
+}
+
+/**
+ * mongo_bson_reader_get_property:
+ * @object: (in): A #GObject.
+ * @prop_id: (in): The property identifier.
+ * @value: (out): The given property.
+ * @pspec: (in): A #ParamSpec.
+ *
+ * Get a given #GObject property.
+ */
+static void
+mongo_bson_reader_get_property (GObject    *object,
+                                guint       prop_id,
+                                GValue     *value,
+                                GParamSpec *pspec)
+{
+   MongoBsonReader *reader = MONGO_BSON_READER(object);
+
+   switch (prop_id) {
+   case PROP_MAX_DOCUMENT_SIZE:
+      g_value_set_uint(value, mongo_bson_reader_get_max_document_size(reader));
+      break;
+   case PROP_STREAM:
+      g_value_set_object(value, mongo_bson_reader_get_stream(reader));
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+/**
+ * mongo_bson_reader_set_property:
+ * @object: (in): A #GObject.
+ * @prop_id: (in): The property identifier.
+ * @value: (in): The given property.
+ * @pspec: (in): A #ParamSpec.
+ *
+ * Set a given #GObject property.
+ */
+static void
+mongo_bson_reader_set_property (GObject      *object,
+                                guint         prop_id,
+                                const GValue *value,
+                                GParamSpec   *pspec)
+{
+   MongoBsonReader *reader = MONGO_BSON_READER(object);
+
+   switch (prop_id) {
+   case PROP_MAX_DOCUMENT_SIZE:
+      mongo_bson_reader_set_max_document_size(reader, g_value_get_uint(value));
+      break;
+   case PROP_STREAM:
+      mongo_bson_reader_set_stream(reader, g_value_get_object(value));
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+/**
+ * mongo_bson_reader_class_init:
+ * @klass: (in): A #MongoBsonReaderClass.
+ *
+ * Initializes the #MongoBsonReaderClass and prepares the vtable.
+ */
+static void
+mongo_bson_reader_class_init (MongoBsonReaderClass *klass)
+{
+   GObjectClass *object_class;
+
+   object_class = G_OBJECT_CLASS(klass);
+   object_class->finalize = mongo_bson_reader_finalize;
+   object_class->get_property = mongo_bson_reader_get_property;
+   object_class->set_property = mongo_bson_reader_set_property;
+   g_type_class_add_private(object_class, sizeof(MongoBsonReaderPrivate));
+
+   gParamSpecs[PROP_MAX_DOCUMENT_SIZE] =
+      g_param_spec_uint("max-document-size",
+                        _("Max Document Size"),
+                        _("The size of the largest document to accept."),
+                        5,
+                        G_MAXINT32,
+                        DEFAULT_MAX_DOCUMENT_SIZE,
+                        G_PARAM_READWRITE);
+   g_object_class_install_property(object_class, PROP_MAX_DOCUMENT_SIZE,
+                                   gParamSpecs[PROP_MAX_DOCUMENT_SIZE]);
+
+   gParamSpecs[PROP_STREAM] =
+      g_param_spec_object("stream",
+                          _("Stream"),
+                          _("The stream to read documents from."),
+                          G_TYPE_INPUT_STREAM,
+                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+   g_object_class_install_property(object_class, PROP_STREAM,
+                                   gParamSpecs[PROP_STREAM]);
+}
+
+/**
+ * mongo_bson_reader_init:
+ * @reader: (in): A #MongoBsonReader.
+ *
+ * Initializes the newly created #MongoBsonReader instance.
+ */
+static void
+mongo_bson_reader_init (MongoBsonReader *reader)
+{
+   reader->priv = G_TYPE_INSTANCE_GET_PRIVATE(reader, MONGO_TYPE_BSON_READER,
+                                              MongoBsonReaderPrivate);
+   reader->priv->max_document_size = DEFAULT_MAX_DOCUMENT_SIZE;
+}
+
+GQuark
+mongo_bson_reader_error_quark (void)
+{
+   return g_quark_from_static_string("mongo_bson_reader_error_quark");
+}
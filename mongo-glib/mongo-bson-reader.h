@@ -0,0 +1,84 @@
+/* mongo-bson-reader.h
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MONGO_BSON_READER_H
+#define MONGO_BSON_READER_H
+
+#include <gio/gio.h>
+
+#include "mongo-bson.h"
+
+G_BEGIN_DECLS
+
+#define MONGO_TYPE_BSON_READER            (mongo_bson_reader_get_type())
+#define MONGO_BSON_READER(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), MONGO_TYPE_BSON_READER, MongoBsonReader))
+#define MONGO_BSON_READER_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), MONGO_TYPE_BSON_READER, MongoBsonReader const))
+#define MONGO_BSON_READER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  MONGO_TYPE_BSON_READER, MongoBsonReaderClass))
+#define MONGO_IS_BSON_READER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), MONGO_TYPE_BSON_READER))
+#define MONGO_IS_BSON_READER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  MONGO_TYPE_BSON_READER))
+#define MONGO_BSON_READER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  MONGO_TYPE_BSON_READER, MongoBsonReaderClass))
+#define MONGO_BSON_READER_ERROR           (mongo_bson_reader_error_quark())
+
+typedef struct _MongoBsonReader        MongoBsonReader;
+typedef struct _MongoBsonReaderClass   MongoBsonReaderClass;
+typedef struct _MongoBsonReaderPrivate MongoBsonReaderPrivate;
+typedef enum   _MongoBsonReaderError   MongoBsonReaderError;
+
+enum _MongoBsonReaderError
+{
+   MONGO_BSON_READER_ERROR_INVALID_DOCUMENT = 1,
+   MONGO_BSON_READER_ERROR_TRUNCATED,
+   MONGO_BSON_READER_ERROR_PENDING,
+};
+
+struct _MongoBsonReader
+{
+   GObject parent;
+
+   /*< private >*/
+   MongoBsonReaderPrivate *priv;
+};
+
+struct _MongoBsonReaderClass
+{
+   GObjectClass parent_class;
+};
+
+GQuark           mongo_bson_reader_error_quark           (void) G_GNUC_CONST;
+guint            mongo_bson_reader_get_max_document_size (MongoBsonReader      *reader);
+GInputStream    *mongo_bson_reader_get_stream            (MongoBsonReader      *reader);
+GType            mongo_bson_reader_get_type              (void) G_GNUC_CONST;
+MongoBsonReader *mongo_bson_reader_new                   (GInputStream         *stream);
+const guint8    *mongo_bson_reader_next                  (MongoBsonReader      *reader,
+                                                          gsize                *length,
+                                                          GCancellable         *cancellable,
+                                                          GError              **error);
+void             mongo_bson_reader_next_async            (MongoBsonReader      *reader,
+                                                          GCancellable         *cancellable,
+                                                          GAsyncReadyCallback   callback,
+                                                          gpointer              user_data);
+const guint8    *mongo_bson_reader_next_finish           (MongoBsonReader      *reader,
+                                                          GAsyncResult         *result,
+                                                          gsize                *length,
+                                                          GError              **error);
+void             mongo_bson_reader_set_max_document_size (MongoBsonReader      *reader,
+                                                          guint                 max_document_size);
+
+G_END_DECLS
+
+#endif /* MONGO_BSON_READER_H */
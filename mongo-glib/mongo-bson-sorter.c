@@ -0,0 +1,1094 @@
+/* mongo-bson-sorter.c
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mongo-bson-reader.h"
+#include "mongo-bson-sorter.h"
+
+/*
+ * The default number of bytes of documents and sort keys to buffer
+ * before spilling a sorted run to disk.
+ */
+#define DEFAULT_MEMORY_LIMIT (G_GUINT64_CONSTANT(64) * 1024 * 1024)
+
+/*
+ * The default number of runs merged at once. Each run being merged holds
+ * an open file and a read buffer.
+ */
+#define DEFAULT_FAN_IN 64
+
+/*
+ * Documents are copied into a buffer that is written once it grows
+ * beyond this many bytes.
+ */
+#define FLUSH_SIZE 65536
+
+G_DEFINE_TYPE(MongoBsonSorter, mongo_bson_sorter, G_TYPE_OBJECT)
+
+struct _MongoBsonSorterPrivate
+{
+   MongoSortSpec *spec;
+   gchar         *temp_dir;
+   guint64        memory_limit;
+   guint          fan_in;
+};
+
+/*
+ * A document buffered in memory. The first bytes of the sort key are
+ * kept inline so that most comparisons do not touch the key buffer.
+ */
+typedef struct
+{
+   guint64 prefix;
+   gsize   key_offset;
+   gsize   doc_offset;
+   guint32 key_length;
+   guint32 doc_length;
+} SortEntry;
+
+typedef struct
+{
+   MongoBsonReader *reader;
+   MongoBson       *bson;
+   GByteArray      *key;
+   guint            index;
+} MergeSource;
+
+typedef struct
+{
+   GOutputStream *stream;
+   GByteArray    *buffer;
+   GCancellable  *cancellable;
+} SortWriter;
+
+typedef struct
+{
+   MongoBsonSorterPrivate *priv;
+   GCancellable           *cancellable;
+   GByteArray             *keys;
+   GByteArray             *docs;
+   GArray                 *entries;
+   GPtrArray              *runs;
+} SortState;
+
+enum
+{
+   PROP_0,
+   PROP_FAN_IN,
+   PROP_MEMORY_LIMIT,
+   PROP_SPEC,
+   PROP_TEMP_DIR,
+   LAST_PROP
+};
+
+static GParamSpec *gParamSpecs[LAST_PROP];
+
+/**
+ * mongo_bson_sorter_new:
+ * @spec: (in): A #MongoSortSpec.
+ *
+ * Creates a new #MongoBsonSorter that sorts streams of BSON documents by
+ * @spec. Input larger than #MongoBsonSorter:memory-limit is sorted in
+ * runs that are spilled to temporary files and merged.
+ *
+ * Returns: (transfer full): A new #MongoBsonSorter.
+ */
+MongoBsonSorter *
+mongo_bson_sorter_new (MongoSortSpec *spec)
+{
+   g_return_val_if_fail(spec != NULL, NULL);
+
+   return g_object_new(MONGO_TYPE_BSON_SORTER,
+                       "spec", spec,
+                       NULL);
+}
+
+/**
+ * mongo_bson_sorter_get_spec:
+ * @sorter: (in): A #MongoBsonSorter.
+ *
+ * Fetches the sort specification used by @sorter.
+ *
+ * Returns: (transfer none): A #MongoSortSpec.
+ */
+MongoSortSpec *
+mongo_bson_sorter_get_spec (MongoBsonSorter *sorter)
+{
+   g_return_val_if_fail(MONGO_IS_BSON_SORTER(sorter), NULL);
+
+   return sorter->priv->spec;
+}
+
+static void
+mongo_bson_sorter_set_spec (MongoBsonSorter *sorter,
+                            MongoSortSpec   *spec)
+{
+   g_return_if_fail(MONGO_IS_BSON_SORTER(sorter));
+   g_return_if_fail(spec != NULL);
+   g_return_if_fail(!sorter->priv->spec);
+
+   sorter->priv->spec = mongo_sort_spec_ref(spec);
+}
+
+/**
+ * mongo_bson_sorter_get_memory_limit:
+ * @sorter: (in): A #MongoBsonSorter.
+ *
+ * Fetches the number of bytes buffered before a sorted run is spilled to
+ * disk.
+ *
+ * Returns: The memory limit in bytes.
+ */
+guint64
+mongo_bson_sorter_get_memory_limit (MongoBsonSorter *sorter)
+{
+   g_return_val_if_fail(MONGO_IS_BSON_SORTER(sorter), 0);
+
+   return sorter->priv->memory_limit;
+}
+
+/**
+ * mongo_bson_sorter_set_memory_limit:
+ * @sorter: (in): A #MongoBsonSorter.
+ * @memory_limit: (in): The memory limit in bytes.
+ *
+ * Sets the number of bytes of documents and sort keys to buffer before a
+ * sorted run is spilled to disk. Larger limits produce fewer runs to
+ * merge.
+ */
+void
+mongo_bson_sorter_set_memory_limit (MongoBsonSorter *sorter,
+                                    guint64          memory_limit)
+{
+   g_return_if_fail(MONGO_IS_BSON_SORTER(sorter));
+   g_return_if_fail(memory_limit > 0);
+
+   sorter->priv->memory_limit = memory_limit;
+   g_object_notify_by_pspec(G_OBJECT(sorter), gParamSpecs[PROP_MEMORY_LIMIT]);
+}
+
+/**
+ * mongo_bson_sorter_get_fan_in:
+ * @sorter: (in): A #MongoBsonSorter.
+ *
+ * Fetches the largest number of runs that are merged at once.
+ *
+ * Returns: The number of runs.
+ */
+guint
+mongo_bson_sorter_get_fan_in (MongoBsonSorter *sorter)
+{
+   g_return_val_if_fail(MONGO_IS_BSON_SORTER(sorter), 0);
+
+   return sorter->priv->fan_in;
+}
+
+/**
+ * mongo_bson_sorter_set_fan_in:
+ * @sorter: (in): A #MongoBsonSorter.
+ * @fan_in: (in): The number of runs.
+ *
+ * Sets the largest number of runs that are merged at once. When there
+ * are more runs, they are merged in groups of @fan_in into longer runs
+ * until few enough remain. Each run being merged holds an open file.
+ */
+void
+mongo_bson_sorter_set_fan_in (MongoBsonSorter *sorter,
+                              guint            fan_in)
+{
+   g_return_if_fail(MONGO_IS_BSON_SORTER(sorter));
+   g_return_if_fail(fan_in >= 2);
+
+   sorter->priv->fan_in = fan_in;
+   g_object_notify_by_pspec(G_OBJECT(sorter), gParamSpecs[PROP_FAN_IN]);
+}
+
+/**
+ * mongo_bson_sorter_get_temp_dir:
+ * @sorter: (in): A #MongoBsonSorter.
+ *
+ * Fetches the directory that runs are spilled to.
+ *
+ * Returns: The directory, or %NULL to use g_get_tmp_dir().
+ */
+const gchar *
+mongo_bson_sorter_get_temp_dir (MongoBsonSorter *sorter)
+{
+   g_return_val_if_fail(MONGO_IS_BSON_SORTER(sorter), NULL);
+
+   return sorter->priv->temp_dir;
+}
+
+/**
+ * mongo_bson_sorter_set_temp_dir:
+ * @sorter: (in): A #MongoBsonSorter.
+ * @temp_dir: (allow-none): A directory, or %NULL.
+ *
+ * Sets the directory that runs are spilled to. It should have room for
+ * a copy of the input. If @temp_dir is %NULL, g_get_tmp_dir() is used.
+ */
+void
+mongo_bson_sorter_set_temp_dir (MongoBsonSorter *sorter,
+                                const gchar     *temp_dir)
+{
+   g_return_if_fail(MONGO_IS_BSON_SORTER(sorter));
+
+   g_free(sorter->priv->temp_dir);
+   sorter->priv->temp_dir = g_strdup(temp_dir);
+   g_object_notify_by_pspec(G_OBJECT(sorter), gParamSpecs[PROP_TEMP_DIR]);
+}
+
+static gboolean
+mongo_bson_sorter_flush (SortWriter  *writer,
+                         GError     **error)
+{
+   gsize n_written;
+
+   if (writer->buffer->len) {
+      if (!g_output_stream_write_all(writer->stream,
+                                     writer->buffer->data,
+                                     writer->buffer->len,
+                                     &n_written,
+                                     writer->cancellable,
+                                     error)) {
+         return FALSE;
+      }
+      g_byte_array_set_size(writer->buffer, 0);
+   }
+
+   return TRUE;
+}
+
+static inline gboolean
+mongo_bson_sorter_write (SortWriter    *writer,
+                         const guint8  *data,
+                         gsize          length,
+                         GError       **error)
+{
+   g_byte_array_append(writer->buffer, data, length);
+
+   if (writer->buffer->len >= FLUSH_SIZE) {
+      return mongo_bson_sorter_flush(writer, error);
+   }
+
+   return TRUE;
+}
+
+static inline gint
+mongo_bson_sorter_compare_keys (const guint8 *a,
+                                gsize         a_length,
+                                const guint8 *b,
+                                gsize         b_length)
+{
+   gint ret;
+
+   if (!(ret = memcmp(a, b, MIN(a_length, b_length)))) {
+      ret = (a_length > b_length) - (a_length < b_length);
+   }
+
+   return ret;
+}
+
+/**
+ * mongo_bson_sorter_compare_entries:
+ * @a: (in): A #SortEntry.
+ * @b: (in): A #SortEntry.
+ * @user_data: (in): The #GByteArray containing the sort keys.
+ *
+ * Compares two buffered documents by their sort keys. Documents with
+ * equal keys keep the order they were read in.
+ *
+ * Returns: Less than, equal to or greater than zero.
+ */
+static gint
+mongo_bson_sorter_compare_entries (gconstpointer a,
+                                   gconstpointer b,
+                                   gpointer      user_data)
+{
+   const SortEntry *ea = a;
+   const SortEntry *eb = b;
+   GByteArray *keys = user_data;
+   gint ret;
+
+   if (ea->prefix != eb->prefix) {
+      return (ea->prefix > eb->prefix) ? 1 : -1;
+   }
+
+   if ((ret = mongo_bson_sorter_compare_keys(keys->data + ea->key_offset,
+                                             ea->key_length,
+                                             keys->data + eb->key_offset,
+                                             eb->key_length))) {
+      return ret;
+   }
+
+   return (ea->doc_offset > eb->doc_offset) - (ea->doc_offset < eb->doc_offset);
+}
+
+static void
+mongo_bson_sorter_add (SortState *state,
+                       MongoBson *bson)
+{
+   const guint8 *data;
+   SortEntry entry;
+   guint8 prefix[8] = { 0 };
+   gsize length;
+
+   data = mongo_bson_get_data(bson, &length);
+
+   entry.key_offset = state->keys->len;
+   entry.doc_offset = state->docs->len;
+   entry.doc_length = length;
+
+   mongo_sort_spec_encode(state->priv->spec, bson, state->keys);
+   entry.key_length = state->keys->len - entry.key_offset;
+   memcpy(prefix, state->keys->data + entry.key_offset,
+          MIN(entry.key_length, sizeof prefix));
+   memcpy(&entry.prefix, prefix, sizeof prefix);
+   entry.prefix = GUINT64_FROM_BE(entry.prefix);
+
+   g_byte_array_append(state->docs, data, length);
+   g_array_append_val(state->entries, entry);
+}
+
+/**
+ * mongo_bson_sorter_write_entries:
+ * @state: (in): A #SortState.
+ * @stream: (in): The #GOutputStream to write to.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Sorts the buffered documents, writes them to @stream and clears the
+ * buffers for the next run.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ */
+static gboolean
+mongo_bson_sorter_write_entries (SortState      *state,
+                                 GOutputStream  *stream,
+                                 GError        **error)
+{
+   const SortEntry *entry;
+   SortWriter writer;
+   gboolean ret = FALSE;
+   guint i;
+
+   g_array_sort_with_data(state->entries,
+                          mongo_bson_sorter_compare_entries,
+                          state->keys);
+
+   writer.stream = stream;
+   writer.buffer = g_byte_array_sized_new(FLUSH_SIZE * 2);
+   writer.cancellable = state->cancellable;
+
+   for (i = 0; i < state->entries->len; i++) {
+      entry = &g_array_index(state->entries, SortEntry, i);
+      if (!mongo_bson_sorter_write(&writer,
+                                   state->docs->data + entry->doc_offset,
+                                   entry->doc_length,
+                                   error)) {
+         goto cleanup;
+      }
+   }
+
+   ret = mongo_bson_sorter_flush(&writer, error);
+
+cleanup:
+   g_byte_array_unref(writer.buffer);
+   g_byte_array_set_size(state->keys, 0);
+   g_byte_array_set_size(state->docs, 0);
+   g_array_set_size(state->entries, 0);
+
+   return ret;
+}
+
+/**
+ * mongo_bson_sorter_create_run:
+ * @state: (in): A #SortState.
+ * @runs: (in): A #GPtrArray to add the path of the new run to.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Creates a temporary file for a run. The path is added to @runs before
+ * the file is opened so that it is removed even if opening fails.
+ *
+ * Returns: (transfer full): A #GOutputStream, or %NULL on failure.
+ */
+static GOutputStream *
+mongo_bson_sorter_create_run (SortState  *state,
+                              GPtrArray  *runs,
+                              GError    **error)
+{
+   GFileOutputStream *stream;
+   const gchar *dir;
+   gchar *path;
+   GFile *file;
+   gint errsv;
+   gint fd;
+
+   dir = state->priv->temp_dir ? state->priv->temp_dir : g_get_tmp_dir();
+   path = g_build_filename(dir, "mongo-bson-sorter-XXXXXX", NULL);
+
+   if ((fd = g_mkstemp(path)) == -1) {
+      errsv = errno;
+      g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                  _("Failed to create a temporary file in \"%s\": %s"),
+                  dir, g_strerror(errsv));
+      g_free(path);
+      return NULL;
+   }
+
+   close(fd);
+   g_ptr_array_add(runs, path);
+
+   file = g_file_new_for_path(path);
+   stream = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_PRIVATE,
+                           state->cancellable, error);
+   g_object_unref(file);
+
+   return (GOutputStream *)stream;
+}
+
+static void
+mongo_bson_sorter_remove_runs (GPtrArray *runs,
+                               guint      begin,
+                               guint      end)
+{
+   guint i;
+
+   for (i = begin; i < end; i++) {
+      if (g_ptr_array_index(runs, i)) {
+         g_unlink(g_ptr_array_index(runs, i));
+         g_free(g_ptr_array_index(runs, i));
+         g_ptr_array_index(runs, i) = NULL;
+      }
+   }
+}
+
+static gboolean
+mongo_bson_sorter_spill (SortState  *state,
+                         GError    **error)
+{
+   GOutputStream *stream;
+   gboolean ret;
+
+   if (!(stream = mongo_bson_sorter_create_run(state, state->runs, error))) {
+      return FALSE;
+   }
+
+   ret = (mongo_bson_sorter_write_entries(state, stream, error) &&
+          g_output_stream_close(stream, state->cancellable, error));
+   g_object_unref(stream);
+
+   return ret;
+}
+
+static gboolean
+mongo_bson_sorter_advance (SortState    *state,
+                           MergeSource  *source,
+                           GError      **error)
+{
+   const guint8 *data;
+   GError *local_error = NULL;
+   gsize length;
+
+   if (source->bson) {
+      mongo_bson_unref(source->bson);
+      source->bson = NULL;
+   }
+
+   data = mongo_bson_reader_next(source->reader, &length,
+                                 state->cancellable, &local_error);
+   if (local_error) {
+      g_propagate_error(error, local_error);
+      return FALSE;
+   }
+
+   /*
+    * The view is private to the source and released before the reader
+    * reuses its buffer.
+    */
+   if (data) {
+      source->bson = mongo_bson_new_from_static_data((guint8 *)data,
+                                                     length, NULL);
+      g_byte_array_set_size(source->key, 0);
+      mongo_sort_spec_encode(state->priv->spec, source->bson, source->key);
+   }
+
+   return TRUE;
+}
+
+static inline gboolean
+mongo_bson_sorter_source_less (const MergeSource *a,
+                               const MergeSource *b)
+{
+   gint ret;
+
+   ret = mongo_bson_sorter_compare_keys(a->key->data, a->key->len,
+                                        b->key->data, b->key->len);
+   return (ret < 0) || (!ret && (a->index < b->index));
+}
+
+static void
+mongo_bson_sorter_sift_down (MergeSource **heap,
+                             guint         n_heap,
+                             guint         i)
+{
+   MergeSource *tmp;
+   guint smallest;
+   guint child;
+
+   for (;;) {
+      smallest = i;
+      child = (i * 2) + 1;
+      if ((child < n_heap) &&
+          mongo_bson_sorter_source_less(heap[child], heap[smallest])) {
+         smallest = child;
+      }
+      child++;
+      if ((child < n_heap) &&
+          mongo_bson_sorter_source_less(heap[child], heap[smallest])) {
+         smallest = child;
+      }
+      if (smallest == i) {
+         return;
+      }
+      tmp = heap[i];
+      heap[i] = heap[smallest];
+      heap[smallest] = tmp;
+      i = smallest;
+   }
+}
+
+/**
+ * mongo_bson_sorter_merge:
+ * @state: (in): A #SortState.
+ * @paths: (in) (array length=n_paths): The paths of the runs to merge.
+ * @n_paths: (in): The number of runs.
+ * @stream: (in): The #GOutputStream to write to.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Performs a k-way merge of sorted runs using a binary heap keyed by the
+ * sort key of the current document of each run. Ties are broken by run
+ * order, which keeps the sort stable.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ */
+static gboolean
+mongo_bson_sorter_merge (SortState      *state,
+                         gchar         **paths,
+                         guint           n_paths,
+                         GOutputStream  *stream,
+                         GError        **error)
+{
+   GFileInputStream *input;
+   const guint8 *data;
+   MergeSource **heap;
+   MergeSource *sources;
+   MergeSource *top;
+   SortWriter writer;
+   gboolean ret = FALSE;
+   GFile *file;
+   gsize length;
+   guint n_heap = 0;
+   guint i;
+
+   sources = g_new0(MergeSource, n_paths);
+   heap = g_new0(MergeSource *, n_paths);
+
+   writer.stream = stream;
+   writer.buffer = g_byte_array_sized_new(FLUSH_SIZE * 2);
+   writer.cancellable = state->cancellable;
+
+   for (i = 0; i < n_paths; i++) {
+      file = g_file_new_for_path(paths[i]);
+      input = g_file_read(file, state->cancellable, error);
+      g_object_unref(file);
+      if (!input) {
+         goto cleanup;
+      }
+
+      sources[i].reader = mongo_bson_reader_new(G_INPUT_STREAM(input));
+      sources[i].key = g_byte_array_new();
+      sources[i].index = i;
+      g_object_unref(input);
+
+      if (!mongo_bson_sorter_advance(state, &sources[i], error)) {
+         goto cleanup;
+      }
+      if (sources[i].bson) {
+         heap[n_heap++] = &sources[i];
+      }
+   }
+
+   for (i = n_heap / 2; i > 0; i--) {
+      mongo_bson_sorter_sift_down(heap, n_heap, i - 1);
+   }
+
+   while (n_heap) {
+      top = heap[0];
+      data = mongo_bson_get_data(top->bson, &length);
+      if (!mongo_bson_sorter_write(&writer, data, length, error) ||
+          !mongo_bson_sorter_advance(state, top, error)) {
+         goto cleanup;
+      }
+      if (!top->bson) {
+         heap[0] = heap[--n_heap];
+      }
+      mongo_bson_sorter_sift_down(heap, n_heap, 0);
+   }
+
+   ret = mongo_bson_sorter_flush(&writer, error);
+
+cleanup:
+   for (i = 0; i < n_paths; i++) {
+      if (sources[i].bson) {
+         mongo_bson_unref(sources[i].bson);
+      }
+      if (sources[i].reader) {
+         g_object_unref(sources[i].reader);
+         g_byte_array_unref(sources[i].key);
+      }
+   }
+   g_byte_array_unref(writer.buffer);
+   g_free(sources);
+   g_free(heap);
+
+   return ret;
+}
+
+/**
+ * mongo_bson_sorter_reduce_runs:
+ * @state: (in): A #SortState.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Merges runs in groups of #MongoBsonSorter:fan-in until no more than
+ * that many remain. Groups are formed from consecutive runs so that the
+ * order of documents with equal keys is preserved.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ */
+static gboolean
+mongo_bson_sorter_reduce_runs (SortState  *state,
+                               GError    **error)
+{
+   GOutputStream *stream;
+   GPtrArray *runs;
+   gboolean ret;
+   guint fan_in = state->priv->fan_in;
+   guint n;
+   guint i;
+
+   while (state->runs->len > fan_in) {
+      runs = g_ptr_array_new_with_free_func(g_free);
+
+      for (i = 0; i < state->runs->len; i += n) {
+         n = MIN(fan_in, state->runs->len - i);
+
+         if (n == 1) {
+            g_ptr_array_add(runs, g_ptr_array_index(state->runs, i));
+            g_ptr_array_index(state->runs, i) = NULL;
+            continue;
+         }
+
+         if (!(stream = mongo_bson_sorter_create_run(state, runs, error))) {
+            goto failure;
+         }
+
+         ret = (mongo_bson_sorter_merge(state,
+                                        (gchar **)&state->runs->pdata[i],
+                                        n, stream, error) &&
+                g_output_stream_close(stream, state->cancellable, error));
+         g_object_unref(stream);
+         mongo_bson_sorter_remove_runs(state->runs, i, i + n);
+
+         if (!ret) {
+            goto failure;
+         }
+      }
+
+      g_ptr_array_unref(state->runs);
+      state->runs = runs;
+   }
+
+   return TRUE;
+
+failure:
+   mongo_bson_sorter_remove_runs(runs, 0, runs->len);
+   g_ptr_array_unref(runs);
+
+   return FALSE;
+}
+
+/**
+ * mongo_bson_sorter_sort:
+ * @sorter: (in): A #MongoBsonSorter.
+ * @input: (in): A #GInputStream of concatenated BSON documents.
+ * @output: (in): A #GOutputStream to write the sorted documents to.
+ * @cancellable: (allow-none): A #GCancellable, or %NULL.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Reads every document from @input and writes them to @output ordered by
+ * the sort specification of @sorter. Documents with equal sort keys keep
+ * their input order.
+ *
+ * Documents are buffered until #MongoBsonSorter:memory-limit is reached.
+ * Each full buffer is sorted by memcmp() of the encoded sort keys and
+ * spilled to a temporary file, and the runs are merged into @output
+ * afterwards. Input that fits within the limit never touches the disk.
+ *
+ * Neither stream is closed. This blocks until the input is exhausted;
+ * see mongo_bson_sorter_sort_async() to sort in a worker thread.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ */
+gboolean
+mongo_bson_sorter_sort (MongoBsonSorter  *sorter,
+                        GInputStream     *input,
+                        GOutputStream    *output,
+                        GCancellable     *cancellable,
+                        GError          **error)
+{
+   MongoBsonReader *reader;
+   const guint8 *data;
+   SortState state;
+   MongoBson *bson;
+   GError *local_error = NULL;
+   gboolean ret = FALSE;
+   guint64 usage;
+   gsize length;
+
+   g_return_val_if_fail(MONGO_IS_BSON_SORTER(sorter), FALSE);
+   g_return_val_if_fail(G_IS_INPUT_STREAM(input), FALSE);
+   g_return_val_if_fail(G_IS_OUTPUT_STREAM(output), FALSE);
+   g_return_val_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable), FALSE);
+
+   state.priv = sorter->priv;
+   state.cancellable = cancellable;
+   state.keys = g_byte_array_new();
+   state.docs = g_byte_array_new();
+   state.entries = g_array_new(FALSE, FALSE, sizeof(SortEntry));
+   state.runs = g_ptr_array_new_with_free_func(g_free);
+
+   reader = mongo_bson_reader_new(input);
+
+   while ((data = mongo_bson_reader_next(reader, &length, cancellable,
+                                         &local_error))) {
+      bson = mongo_bson_new_from_static_data((guint8 *)data, length, NULL);
+      mongo_bson_sorter_add(&state, bson);
+      mongo_bson_unref(bson);
+      usage = (state.keys->len + state.docs->len +
+               (state.entries->len * sizeof(SortEntry)));
+      if ((usage >= sorter->priv->memory_limit) &&
+          !mongo_bson_sorter_spill(&state, error)) {
+         goto cleanup;
+      }
+   }
+
+   if (local_error) {
+      g_propagate_error(error, local_error);
+      goto cleanup;
+   }
+
+   if (!state.runs->len) {
+      ret = (mongo_bson_sorter_write_entries(&state, output, error) &&
+             g_output_stream_flush(output, cancellable, error));
+      goto cleanup;
+   }
+
+   if (state.entries->len && !mongo_bson_sorter_spill(&state, error)) {
+      goto cleanup;
+   }
+
+   if (!mongo_bson_sorter_reduce_runs(&state, error)) {
+      goto cleanup;
+   }
+
+   ret = (mongo_bson_sorter_merge(&state,
+                                  (gchar **)state.runs->pdata,
+                                  state.runs->len,
+                                  output,
+                                  error) &&
+          g_output_stream_flush(output, cancellable, error));
+
+cleanup:
+   mongo_bson_sorter_remove_runs(state.runs, 0, state.runs->len);
+   g_ptr_array_unref(state.runs);
+   g_array_unref(state.entries);
+   g_byte_array_unref(state.docs);
+   g_byte_array_unref(state.keys);
+   g_object_unref(reader);
+
+   return ret;
+}
+
+static void
+mongo_bson_sorter_sort_thread (GSimpleAsyncResult *simple,
+                               GObject            *object,
+                               GCancellable       *cancellable)
+{
+   GOutputStream *output;
+   GInputStream *input;
+   GError *error = NULL;
+
+   input = g_object_get_data(G_OBJECT(simple), "input");
+   output = g_object_get_data(G_OBJECT(simple), "output");
+
+   if (!mongo_bson_sorter_sort(MONGO_BSON_SORTER(object), input, output,
+                               cancellable, &error)) {
+      g_simple_async_result_take_error(simple, error);
+      return;
+   }
+
+   g_simple_async_result_set_op_res_gboolean(simple, TRUE);
+}
+
+/**
+ * mongo_bson_sorter_sort_async:
+ * @sorter: (in): A #MongoBsonSorter.
+ * @input: (in): A #GInputStream of concatenated BSON documents.
+ * @output: (in): A #GOutputStream to write the sorted documents to.
+ * @cancellable: (allow-none): A #GCancellable, or %NULL.
+ * @callback: (in): A callback to execute upon completion.
+ * @user_data: (in): User data for @callback.
+ *
+ * Asynchronously performs mongo_bson_sorter_sort() in a worker thread.
+ * Neither stream may be used until @callback is executed, which should
+ * call mongo_bson_sorter_sort_finish().
+ */
+void
+mongo_bson_sorter_sort_async (MongoBsonSorter     *sorter,
+                              GInputStream        *input,
+                              GOutputStream       *output,
+                              GCancellable        *cancellable,
+                              GAsyncReadyCallback  callback,
+                              gpointer             user_data)
+{
+   GSimpleAsyncResult *simple;
+
+   g_return_if_fail(MONGO_IS_BSON_SORTER(sorter));
+   g_return_if_fail(G_IS_INPUT_STREAM(input));
+   g_return_if_fail(G_IS_OUTPUT_STREAM(output));
+   g_return_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable));
+   g_return_if_fail(callback != NULL);
+
+   simple = g_simple_async_result_new(G_OBJECT(sorter), callback, user_data,
+                                      mongo_bson_sorter_sort_async);
+   g_object_set_data_full(G_OBJECT(simple), "input",
+                          g_object_ref(input), g_object_unref);
+   g_object_set_data_full(G_OBJECT(simple), "output",
+                          g_object_ref(output), g_object_unref);
+   g_simple_async_result_run_in_thread(simple,
+                                       mongo_bson_sorter_sort_thread,
+                                       G_PRIORITY_DEFAULT,
+                                       cancellable);
+   g_object_unref(simple);
+}
+
+/**
+ * mongo_bson_sorter_sort_finish:
+ * @sorter: (in): A #MongoBsonSorter.
+ * @result: (in): A #GAsyncResult.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Completes an asynchronous request to sort a stream.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ */
+gboolean
+mongo_bson_sorter_sort_finish (MongoBsonSorter  *sorter,
+                               GAsyncResult     *result,
+                               GError          **error)
+{
+   GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
+
+   g_return_val_if_fail(MONGO_IS_BSON_SORTER(sorter), FALSE);
+   g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple), FALSE);
+
+   if (g_simple_async_result_propagate_error(simple, error)) {
+      return FALSE;
+   }
+
+   return g_simple_async_result_get_op_res_gboolean(simple);
+}
+
+/**
+ * mongo_bson_sorter_finalize:
+ * @object: (in): A #MongoBsonSorter.
+ *
+ * Finalizer for a #MongoBsonSorter instance.  Frees any resources held by
+ * the instance.
+ */
+static void
+mongo_bson_sorter_finalize (GObject *object)
+{
+   MongoBsonSorterPrivate *priv = MONGO_BSON_SORTER(object)->priv;
+
+   if (priv->spec) {
+      mongo_sort_spec_unref(priv->spec);
+   }
+   g_free(priv->temp_dir);
+
+   G_OBJECT_CLASS(mongo_bson_sorter_parent_class)->finalize(object);
+}
+
+/**
+ * mongo_bson_sorter_get_property:
+ * @object: (in): A #GObject.
+ * @prop_id: (in): The property identifier.
+ * @value: (out): The given property.
+ * @pspec: (in): A #ParamSpec.
+ *
+ * Get a given #GObject property.
+ */
+static void
+mongo_bson_sorter_get_property (GObject    *object,
+                                guint       prop_id,
+                                GValue     *value,
+                                GParamSpec *pspec)
+{
+   MongoBsonSorter *sorter = MONGO_BSON_SORTER(object);
+
+   switch (prop_id) {
+   case PROP_FAN_IN:
+      g_value_set_uint(value, mongo_bson_sorter_get_fan_in(sorter));
+      break;
+   case PROP_MEMORY_LIMIT:
+      g_value_set_uint64(value, mongo_bson_sorter_get_memory_limit(sorter));
+      break;
+   case PROP_SPEC:
+      g_value_set_boxed(value, mongo_bson_sorter_get_spec(sorter));
+      break;
+   case PROP_TEMP_DIR:
+      g_value_set_string(value, mongo_bson_sorter_get_temp_dir(sorter));
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+/**
+ * mongo_bson_sorter_set_property:
+ * @object: (in): A #GObject.
+ * @prop_id: (in): The property identifier.
+ * @value: (in): The given property.
+ * @pspec: (in): A #ParamSpec.
+ *
+ * Set a given #GObject property.
+ */
+static void
+mongo_bson_sorter_set_property (GObject      *object,
+                                guint         prop_id,
+                                const GValue *value,
+                                GParamSpec   *pspec)
+{
+   MongoBsonSorter *sorter = MONGO_BSON_SORTER(object);
+
+   switch (prop_id) {
+   case PROP_FAN_IN:
+      mongo_bson_sorter_set_fan_in(sorter, g_value_get_uint(value));
+      break;
+   case PROP_MEMORY_LIMIT:
+      mongo_bson_sorter_set_memory_limit(sorter, g_value_get_uint64(value));
+      break;
+   case PROP_SPEC:
+      mongo_bson_sorter_set_spec(sorter, g_value_get_boxed(value));
+      break;
+   case PROP_TEMP_DIR:
+      mongo_bson_sorter_set_temp_dir(sorter, g_value_get_string(value));
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+/**
+ * mongo_bson_sorter_class_init:
+ * @klass: (in): A #MongoBsonSorterClass.
+ *
+ * Initializes the #MongoBsonSorterClass and prepares the vtable.
+ */
+static void
+mongo_bson_sorter_class_init (MongoBsonSorterClass *klass)
+{
+   GObjectClass *object_class;
+
+   object_class = G_OBJECT_CLASS(klass);
+   object_class->finalize = mongo_bson_sorter_finalize;
+   object_class->get_property = mongo_bson_sorter_get_property;
+   object_class->set_property = mongo_bson_sorter_set_property;
+   g_type_class_add_private(object_class, sizeof(MongoBsonSorterPrivate));
+
+   gParamSpecs[PROP_FAN_IN] =
+      g_param_spec_uint("fan-in",
+                        _("Fan In"),
+                        _("The largest number of runs to merge at once."),
+                        2,
+                        G_MAXUINT,
+                        DEFAULT_FAN_IN,
+                        G_PARAM_READWRITE);
+   g_object_class_install_property(object_class, PROP_FAN_IN,
+                                   gParamSpecs[PROP_FAN_IN]);
+
+   gParamSpecs[PROP_MEMORY_LIMIT] =
+      g_param_spec_uint64("memory-limit",
+                          _("Memory Limit"),
+                          _("The number of bytes to buffer before spilling "
+                            "a sorted run to disk."),
+                          1,
+                          G_MAXUINT64,
+                          DEFAULT_MEMORY_LIMIT,
+                          G_PARAM_READWRITE);
+   g_object_class_install_property(object_class, PROP_MEMORY_LIMIT,
+                                   gParamSpecs[PROP_MEMORY_LIMIT]);
+
+   gParamSpecs[PROP_SPEC] =
+      g_param_spec_boxed("spec",
+                         _("Spec"),
+                         _("The sort specification."),
+                         MONGO_TYPE_SORT_SPEC,
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+   g_object_class_install_property(object_class, PROP_SPEC,
+                                   gParamSpecs[PROP_SPEC]);
+
+   gParamSpecs[PROP_TEMP_DIR] =
+      g_param_spec_string("temp-dir",
+                          _("Temp Dir"),
+                          _("The directory to spill sorted runs to."),
+                          NULL,
+                          G_PARAM_READWRITE);
+   g_object_class_install_property(object_class, PROP_TEMP_DIR,
+                                   gParamSpecs[PROP_TEMP_DIR]);
+}
+
+/**
+ * mongo_bson_sorter_init:
+ * @sorter: (in): A #MongoBsonSorter.
+ *
+ * Initializes the newly created #MongoBsonSorter instance.
+ */
+static void
+mongo_bson_sorter_init (MongoBsonSorter *sorter)
+{
+   sorter->priv = G_TYPE_INSTANCE_GET_PRIVATE(sorter, MONGO_TYPE_BSON_SORTER,
+                                              MongoBsonSorterPrivate);
+   sorter->priv->memory_limit = DEFAULT_MEMORY_LIMIT;
+   sorter->priv->fan_in = DEFAULT_FAN_IN;
+}
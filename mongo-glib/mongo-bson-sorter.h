@@ -0,0 +1,82 @@
+/* mongo-bson-sorter.h
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MONGO_BSON_SORTER_H
+#define MONGO_BSON_SORTER_H
+
+#include <gio/gio.h>
+
+#include "mongo-sort-spec.h"
+
+G_BEGIN_DECLS
+
+#define MONGO_TYPE_BSON_SORTER            (mongo_bson_sorter_get_type())
+#define MONGO_BSON_SORTER(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), MONGO_TYPE_BSON_SORTER, MongoBsonSorter))
+#define MONGO_BSON_SORTER_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), MONGO_TYPE_BSON_SORTER, MongoBsonSorter const))
+#define MONGO_BSON_SORTER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  MONGO_TYPE_BSON_SORTER, MongoBsonSorterClass))
+#define MONGO_IS_BSON_SORTER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), MONGO_TYPE_BSON_SORTER))
+#define MONGO_IS_BSON_SORTER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  MONGO_TYPE_BSON_SORTER))
+#define MONGO_BSON_SORTER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  MONGO_TYPE_BSON_SORTER, MongoBsonSorterClass))
+
+typedef struct _MongoBsonSorter        MongoBsonSorter;
+typedef struct _MongoBsonSorterClass   MongoBsonSorterClass;
+typedef struct _MongoBsonSorterPrivate MongoBsonSorterPrivate;
+
+struct _MongoBsonSorter
+{
+   GObject parent;
+
+   /*< private >*/
+   MongoBsonSorterPrivate *priv;
+};
+
+struct _MongoBsonSorterClass
+{
+   GObjectClass parent_class;
+};
+
+guint            mongo_bson_sorter_get_fan_in       (MongoBsonSorter      *sorter);
+guint64          mongo_bson_sorter_get_memory_limit (MongoBsonSorter      *sorter);
+MongoSortSpec   *mongo_bson_sorter_get_spec         (MongoBsonSorter      *sorter);
+const gchar     *mongo_bson_sorter_get_temp_dir     (MongoBsonSorter      *sorter);
+GType            mongo_bson_sorter_get_type         (void) G_GNUC_CONST;
+MongoBsonSorter *mongo_bson_sorter_new              (MongoSortSpec        *spec);
+void             mongo_bson_sorter_set_fan_in       (MongoBsonSorter      *sorter,
+                                                     guint                 fan_in);
+void             mongo_bson_sorter_set_memory_limit (MongoBsonSorter      *sorter,
+                                                     guint64               memory_limit);
+void             mongo_bson_sorter_set_temp_dir     (MongoBsonSorter      *sorter,
+                                                     const gchar          *temp_dir);
+gboolean         mongo_bson_sorter_sort             (MongoBsonSorter      *sorter,
+                                                     GInputStream         *input,
+                                                     GOutputStream        *output,
+                                                     GCancellable         *cancellable,
+                                                     GError              **error);
+void             mongo_bson_sorter_sort_async       (MongoBsonSorter      *sorter,
+                                                     GInputStream         *input,
+                                                     GOutputStream        *output,
+                                                     GCancellable         *cancellable,
+                                                     GAsyncReadyCallback   callback,
+                                                     gpointer              user_data);
+gboolean         mongo_bson_sorter_sort_finish      (MongoBsonSorter      *sorter,
+                                                     GAsyncResult         *result,
+                                                     GError              **error);
+
+G_END_DECLS
+
+#endif /* MONGO_BSON_SORTER_H */
@@ -16,16 +16,40 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <glib/gi18n.h>
 #include <string.h>
 
 #include "mongo-bson.h"
+#include "mongo-bson-private.h"
 
 struct _MongoBson
 {
    volatile gint ref_count;
    GByteArray *buf;
+
+   guint8 *static_data;
+   gsize static_len;
+   GDestroyNotify static_notify;
+
+   GArray *children; /* Offsets of open child documents */
+
+   GArray *segments; /* External values, see mongo_bson_append_external() */
+   gsize external_len;
+   guint8 *flat;     /* Contiguous copy of a segmented document for reads */
 };
 
+typedef struct
+{
+   gsize   offset; /* Offset within buf that the bytes are inserted at */
+   GBytes *bytes;
+} MongoBsonSegment;
+
+/*
+ * Values shorter than this are copied into the buffer even when they are
+ * provided as #GBytes, since a separate write costs more than the copy.
+ */
+#define MONGO_BSON_EXTERNAL_MIN 4096
+
 #define ITER_IS_TYPE(iter, type) \
    (GPOINTER_TO_INT(iter->user_data5) == type)
 
@@ -44,7 +68,190 @@ struct _MongoBson
 static void
 mongo_bson_dispose (MongoBson *bson)
 {
+   MongoBsonSegment *segment;
+   guint i;
+
+   if (bson->buf) {
+      g_byte_array_free(bson->buf, TRUE);
+   } else if (bson->static_notify) {
+      bson->static_notify(bson->static_data);
+   }
+
+   if (bson->children) {
+      g_array_free(bson->children, TRUE);
+   }
+
+   if (bson->segments) {
+      for (i = 0; i < bson->segments->len; i++) {
+         segment = &g_array_index(bson->segments, MongoBsonSegment, i);
+         g_bytes_unref(segment->bytes);
+      }
+      g_array_free(bson->segments, TRUE);
+   }
+
+   g_free(bson->flat);
+}
+
+/**
+ * mongo_bson_flatten:
+ * @bson: (in): A #MongoBson with external values.
+ *
+ * Copies the buffer and the external values of @bson into a newly
+ * allocated contiguous document. @bson itself is left untouched.
+ *
+ * Returns: The document, which should be freed with g_free().
+ */
+static guint8 *
+mongo_bson_flatten (MongoBson *bson)
+{
+   MongoBsonSegment *segment;
+   const guint8 *data;
+   guint8 *flat;
+   guint8 *p;
+   gsize offset = 0;
+   gsize length;
+   guint i;
+
+   p = flat = g_malloc(bson->buf->len + bson->external_len);
+
+   for (i = 0; i < bson->segments->len; i++) {
+      segment = &g_array_index(bson->segments, MongoBsonSegment, i);
+      memcpy(p, bson->buf->data + offset, segment->offset - offset);
+      p += segment->offset - offset;
+      data = g_bytes_get_data(segment->bytes, &length);
+      memcpy(p, data, length);
+      p += length;
+      offset = segment->offset;
+   }
+
+   memcpy(p, bson->buf->data + offset, bson->buf->len - offset);
+
+   return flat;
+}
+
+/**
+ * mongo_bson_get_buffer:
+ * @bson: (in): A #MongoBson.
+ * @length: (out): A location for the buffer length.
+ *
+ * Fetches the raw buffer for @bson, whether it owns its buffer or was
+ * created with mongo_bson_new_from_static_data().
+ *
+ * A document with external values is read from a contiguous copy that is
+ * made on first use. Reading never modifies the buffer or the segments of
+ * @bson, so a document may be read from several threads at once and while
+ * the vectors from mongo_bson_get_vectors() are being written.
+ *
+ * Returns: The document buffer.
+ */
+static inline const guint8 *
+mongo_bson_get_buffer (MongoBson *bson,
+                       gsize     *length)
+{
+   guint8 *flat;
+
+   if (G_UNLIKELY(bson->segments)) {
+      *length = bson->buf->len + bson->external_len;
+      flat = g_atomic_pointer_get(&bson->flat);
+      if (!flat) {
+         flat = mongo_bson_flatten(bson);
+         if (!g_atomic_pointer_compare_and_exchange(&bson->flat, NULL, flat)) {
+            g_free(flat);
+            flat = g_atomic_pointer_get(&bson->flat);
+         }
+      }
+      return flat;
+   }
+
+   if (G_LIKELY(bson->buf)) {
+      *length = bson->buf->len;
+      return bson->buf->data;
+   }
+
+   *length = bson->static_len;
+   return bson->static_data;
+}
+
+/**
+ * mongo_bson_make_writable:
+ * @bson: (in): A #MongoBson.
+ *
+ * Ensures that @bson owns its buffer so that it may be modified. If @bson
+ * was created with mongo_bson_new_from_static_data(), the static data is
+ * copied and released. The contiguous copy of a document with external
+ * values is dropped, since it no longer matches.
+ */
+static void
+mongo_bson_make_writable (MongoBson *bson)
+{
+   if (G_UNLIKELY(!bson->buf)) {
+      bson->buf = g_byte_array_sized_new(bson->static_len);
+      g_byte_array_append(bson->buf, bson->static_data, bson->static_len);
+      if (bson->static_notify) {
+         bson->static_notify(bson->static_data);
+      }
+      bson->static_data = NULL;
+      bson->static_len = 0;
+      bson->static_notify = NULL;
+   }
+
+   if (G_UNLIKELY(bson->flat)) {
+      g_free(bson->flat);
+      bson->flat = NULL;
+   }
+}
+
+/**
+ * mongo_bson_make_contiguous:
+ * @bson: (in): A #MongoBson.
+ *
+ * Copies the external values of @bson into its own buffer so that values
+ * can be modified in place. Like any other modification, this must not
+ * happen while the vectors from mongo_bson_get_vectors() are in use.
+ */
+static void
+mongo_bson_make_contiguous (MongoBson *bson)
+{
+   MongoBsonSegment *segment;
+   gsize *child;
+   gsize length;
+   gsize shift;
+   guint8 *flat;
+   guint i;
+   guint j;
+
+   mongo_bson_get_buffer(bson, &length);
+   flat = bson->flat;
+   bson->flat = NULL;
+
+   /*
+    * Open children now start after any values that precede them.
+    */
+   if (bson->children) {
+      for (i = 0; i < bson->children->len; i++) {
+         child = &g_array_index(bson->children, gsize, i);
+         shift = 0;
+         for (j = 0; j < bson->segments->len; j++) {
+            segment = &g_array_index(bson->segments, MongoBsonSegment, j);
+            if (segment->offset > *child) {
+               break;
+            }
+            shift += g_bytes_get_size(segment->bytes);
+         }
+         *child += shift;
+      }
+   }
+
+   for (i = 0; i < bson->segments->len; i++) {
+      segment = &g_array_index(bson->segments, MongoBsonSegment, i);
+      g_bytes_unref(segment->bytes);
+   }
+
+   g_array_free(bson->segments, TRUE);
    g_byte_array_free(bson->buf, TRUE);
+   bson->segments = NULL;
+   bson->external_len = 0;
+   bson->buf = g_byte_array_new_take(flat, length);
 }
 
 /**
@@ -83,6 +290,75 @@ mongo_bson_new_from_data (const guint8 *buffer,
    return bson;
 }
 
+/**
+ * mongo_bson_new_from_static_data:
+ * @buffer: (in) (transfer full): The buffer containing the document.
+ * @length: (in): The length of @buffer.
+ * @notify: (in) (allow-none): A function to free @buffer, or %NULL.
+ *
+ * Creates a new #MongoBson that uses @buffer directly instead of copying
+ * it. If @notify is not %NULL, it is called with @buffer once the
+ * #MongoBson is freed. If @notify is %NULL, @buffer must remain valid for
+ * the lifetime of the #MongoBson.
+ *
+ * If the document is later appended to, @buffer is copied first and
+ * released.
+ *
+ * Returns: A new #MongoBson that should be freed with mongo_bson_unref(),
+ *   or %NULL if the length of the document in @buffer does not match
+ *   @length. In that case, @notify is not called.
+ */
+MongoBson *
+mongo_bson_new_from_static_data (guint8         *buffer,
+                                 gsize           length,
+                                 GDestroyNotify  notify)
+{
+   MongoBson *bson;
+   guint32 bson_len;
+
+   g_return_val_if_fail(buffer != NULL, NULL);
+
+   if (length < 5) {
+      return NULL;
+   }
+
+   memcpy(&bson_len, buffer, sizeof bson_len);
+   bson_len = GUINT32_FROM_LE(bson_len);
+   if (bson_len != length) {
+      return NULL;
+   }
+
+   bson = g_slice_new0(MongoBson);
+   bson->ref_count = 1;
+   bson->static_data = buffer;
+   bson->static_len = length;
+   bson->static_notify = notify;
+
+   return bson;
+}
+
+/**
+ * mongo_bson_dup:
+ * @bson: (in): A #MongoBson.
+ *
+ * Creates a copy of @bson that owns its own buffer. This is useful to keep
+ * a document that was created with mongo_bson_new_from_static_data() after
+ * the underlying buffer is released or reused.
+ *
+ * Returns: (transfer full): A new #MongoBson.
+ */
+MongoBson *
+mongo_bson_dup (MongoBson *bson)
+{
+   const guint8 *data;
+   gsize length;
+
+   g_return_val_if_fail(bson != NULL, NULL);
+
+   data = mongo_bson_get_buffer(bson, &length);
+   return mongo_bson_new_from_data(data, length);
+}
+
 /**
  * mongo_bson_new:
  *
@@ -165,8 +441,66 @@ mongo_bson_get_data (MongoBson *bson,
    g_return_val_if_fail(bson != NULL, NULL);
    g_return_val_if_fail(length != NULL, NULL);
 
-   *length = bson->buf->len;
-   return bson->buf->data;
+   return mongo_bson_get_buffer(bson, length);
+}
+
+/**
+ * mongo_bson_get_vectors:
+ * @bson: (in): A #MongoBson.
+ * @n_vectors: (out): A location for the number of vectors.
+ *
+ * Fetches the document as a list of segments suitable for a vectored
+ * write such as g_socket_send_message(). Values appended with
+ * mongo_bson_append_binary_bytes() or mongo_bson_append_string_bytes()
+ * are returned as their own segments instead of being copied.
+ *
+ * The segments point into @bson and remain valid until @bson is modified
+ * or freed. Reading @bson does not invalidate them.
+ *
+ * Returns: (transfer container) (array length=n_vectors): The segments,
+ *   which should be freed with g_free().
+ */
+GOutputVector *
+mongo_bson_get_vectors (MongoBson *bson,
+                        guint     *n_vectors)
+{
+   MongoBsonSegment *segment;
+   GOutputVector *vectors;
+   gsize offset = 0;
+   guint n = 0;
+   guint i;
+
+   g_return_val_if_fail(bson != NULL, NULL);
+   g_return_val_if_fail(n_vectors != NULL, NULL);
+
+   if (!bson->segments) {
+      vectors = g_new(GOutputVector, 1);
+      vectors->buffer = mongo_bson_get_buffer(bson, &vectors->size);
+      *n_vectors = 1;
+      return vectors;
+   }
+
+   vectors = g_new(GOutputVector, (bson->segments->len * 2) + 1);
+
+   for (i = 0; i < bson->segments->len; i++) {
+      segment = &g_array_index(bson->segments, MongoBsonSegment, i);
+      if (segment->offset > offset) {
+         vectors[n].buffer = bson->buf->data + offset;
+         vectors[n].size = segment->offset - offset;
+         n++;
+      }
+      vectors[n].buffer = g_bytes_get_data(segment->bytes, &vectors[n].size);
+      n++;
+      offset = segment->offset;
+   }
+
+   vectors[n].buffer = bson->buf->data + offset;
+   vectors[n].size = bson->buf->len - offset;
+   n++;
+
+   *n_vectors = n;
+
+   return vectors;
 }
 
 /**
@@ -205,18 +539,28 @@ mongo_bson_type_get_type (void)
    static GType type_id = 0;
    static gsize initialized = FALSE;
    static GEnumValue values[] = {
-      { MONGO_BSON_DOUBLE,    "MONGO_BSON_DOUBLE",    "DOUBLE" },
-      { MONGO_BSON_UTF8,      "MONGO_BSON_UTF8",      "UTF8" },
-      { MONGO_BSON_DOCUMENT,  "MONGO_BSON_DOCUMENT",  "DOCUMENT" },
-      { MONGO_BSON_ARRAY,     "MONGO_BSON_ARRAY",     "ARRAY" },
-      { MONGO_BSON_UNDEFINED, "MONGO_BSON_UNDEFINED", "UNDEFINED" },
-      { MONGO_BSON_OBJECT_ID, "MONGO_BSON_OBJECT_ID", "OBJECT_ID" },
-      { MONGO_BSON_BOOLEAN,   "MONGO_BSON_BOOLEAN",   "BOOLEAN" },
-      { MONGO_BSON_DATE_TIME, "MONGO_BSON_DATE_TIME", "DATE_TIME" },
-      { MONGO_BSON_NULL,      "MONGO_BSON_NULL",      "NULL" },
-      { MONGO_BSON_REGEX,     "MONGO_BSON_REGEX",     "REGEX" },
-      { MONGO_BSON_INT32,     "MONGO_BSON_INT32",     "INT32" },
-      { MONGO_BSON_INT64,     "MONGO_BSON_INT64",     "INT64" },
+      { MONGO_BSON_DOUBLE,     "MONGO_BSON_DOUBLE",     "DOUBLE" },
+      { MONGO_BSON_UTF8,       "MONGO_BSON_UTF8",       "UTF8" },
+      { MONGO_BSON_DOCUMENT,   "MONGO_BSON_DOCUMENT",   "DOCUMENT" },
+      { MONGO_BSON_ARRAY,      "MONGO_BSON_ARRAY",      "ARRAY" },
+      { MONGO_BSON_BINARY,     "MONGO_BSON_BINARY",     "BINARY" },
+      { MONGO_BSON_UNDEFINED,  "MONGO_BSON_UNDEFINED",  "UNDEFINED" },
+      { MONGO_BSON_OBJECT_ID,  "MONGO_BSON_OBJECT_ID",  "OBJECT_ID" },
+      { MONGO_BSON_BOOLEAN,    "MONGO_BSON_BOOLEAN",    "BOOLEAN" },
+      { MONGO_BSON_DATE_TIME,  "MONGO_BSON_DATE_TIME",  "DATE_TIME" },
+      { MONGO_BSON_NULL,       "MONGO_BSON_NULL",       "NULL" },
+      { MONGO_BSON_REGEX,      "MONGO_BSON_REGEX",      "REGEX" },
+      { MONGO_BSON_DBPOINTER,  "MONGO_BSON_DBPOINTER",  "DBPOINTER" },
+      { MONGO_BSON_JAVASCRIPT, "MONGO_BSON_JAVASCRIPT", "JAVASCRIPT" },
+      { MONGO_BSON_SYMBOL,     "MONGO_BSON_SYMBOL",     "SYMBOL" },
+      { MONGO_BSON_JAVASCRIPT_WITH_SCOPE,
+        "MONGO_BSON_JAVASCRIPT_WITH_SCOPE", "JAVASCRIPT_WITH_SCOPE" },
+      { MONGO_BSON_INT32,      "MONGO_BSON_INT32",      "INT32" },
+      { MONGO_BSON_TIMESTAMP,  "MONGO_BSON_TIMESTAMP",  "TIMESTAMP" },
+      { MONGO_BSON_INT64,      "MONGO_BSON_INT64",      "INT64" },
+      { MONGO_BSON_DECIMAL128, "MONGO_BSON_DECIMAL128", "DECIMAL128" },
+      { MONGO_BSON_MAX_KEY,    "MONGO_BSON_MAX_KEY",    "MAX_KEY" },
+      { MONGO_BSON_MIN_KEY,    "MONGO_BSON_MIN_KEY",    "MIN_KEY" },
       { 0 }
    };
 
@@ -228,6 +572,53 @@ mongo_bson_type_get_type (void)
    return type_id;
 }
 
+/**
+ * mongo_bson_binary_subtype_get_type:
+ *
+ * Fetches the #GType for a #MongoBsonBinarySubtype.
+ *
+ * Returns: A #GType.
+ */
+GType
+mongo_bson_binary_subtype_get_type (void)
+{
+   static GType type_id = 0;
+   static gsize initialized = FALSE;
+   static GEnumValue values[] = {
+      { MONGO_BSON_BINARY_GENERIC,  "MONGO_BSON_BINARY_GENERIC",  "GENERIC" },
+      { MONGO_BSON_BINARY_FUNCTION, "MONGO_BSON_BINARY_FUNCTION", "FUNCTION" },
+      { MONGO_BSON_BINARY_OLD,      "MONGO_BSON_BINARY_OLD",      "OLD" },
+      { MONGO_BSON_BINARY_UUID_OLD, "MONGO_BSON_BINARY_UUID_OLD", "UUID_OLD" },
+      { MONGO_BSON_BINARY_UUID,     "MONGO_BSON_BINARY_UUID",     "UUID" },
+      { MONGO_BSON_BINARY_MD5,      "MONGO_BSON_BINARY_MD5",      "MD5" },
+      { MONGO_BSON_BINARY_USER,     "MONGO_BSON_BINARY_USER",     "USER" },
+      { 0 }
+   };
+
+   if (g_once_init_enter(&initialized)) {
+      type_id = g_enum_register_static("MongoBsonBinarySubtype", values);
+      g_once_init_leave(&initialized, TRUE);
+   }
+
+   return type_id;
+}
+
+/**
+ * mongo_bson_update_length:
+ * @bson: (in): A #MongoBson.
+ *
+ * Stores the length of @bson, including its external values, in the
+ * document header.
+ */
+static void
+mongo_bson_update_length (MongoBson *bson)
+{
+   gint32 doc_len;
+
+   doc_len = GINT_TO_LE(bson->buf->len + bson->external_len);
+   memcpy(bson->buf->data, &doc_len, sizeof doc_len);
+}
+
 /**
  * mongo_bson_append:
  * @bson: (in): A #MongoBson.
@@ -254,7 +645,6 @@ mongo_bson_append (MongoBson    *bson,
                    gsize         len2)
 {
    const guint8 trailing = 0;
-   gint32 doc_len;
 
    g_return_if_fail(bson != NULL);
    g_return_if_fail(type != 0);
@@ -264,6 +654,8 @@ mongo_bson_append (MongoBson    *bson,
    g_return_if_fail(data2 != NULL || len2 == 0);
    g_return_if_fail(!data2 || data1);
 
+   mongo_bson_make_writable(bson);
+
    /*
     * Overwrite our trailing byte with the type for this key.
     */
@@ -292,8 +684,33 @@ mongo_bson_append (MongoBson    *bson,
    /*
     * Update the document length of the buffer.
     */
-   doc_len = GINT_TO_LE(bson->buf->len);
-   memcpy(bson->buf->data, &doc_len, sizeof doc_len);
+   mongo_bson_update_length(bson);
+}
+
+/**
+ * mongo_bson_append_string_value:
+ * @bson: (in): A #MongoBson.
+ * @type: (in): %MONGO_BSON_UTF8 or another type stored as a BSON string.
+ * @key: (in): A string containing the key.
+ * @value: (in): A string containing the value.
+ *
+ * Appends @value with its length prefix and trailing nul byte.
+ */
+static void
+mongo_bson_append_string_value (MongoBson   *bson,
+                                guint8       type,
+                                const gchar *key,
+                                const gchar *value)
+{
+   gint32 value_len;
+   gint32 value_len_swab;
+
+   value_len = strlen(value) + 1;
+   value_len_swab = GINT_TO_LE(value_len);
+
+   mongo_bson_append(bson, type, key,
+                     (const guint8 *)&value_len_swab, sizeof value_len_swab,
+                     (const guint8 *)value, value_len);
 }
 
 /**
@@ -314,902 +731,4270 @@ mongo_bson_append_array (MongoBson   *bson,
                          const gchar *key,
                          MongoBson   *value)
 {
+   const guint8 *data;
+   gsize data_len;
+
    g_return_if_fail(bson != NULL);
    g_return_if_fail(key != NULL);
    g_return_if_fail(value != NULL);
 
-   mongo_bson_append(bson, MONGO_BSON_ARRAY, key,
-                     value->buf->data, value->buf->len,
-                     NULL, 0);
+   data = mongo_bson_get_buffer(value, &data_len);
+   mongo_bson_append(bson, MONGO_BSON_ARRAY, key, data, data_len, NULL, 0);
 }
 
 /**
- * mongo_bson_append_boolean:
+ * mongo_bson_append_binary:
  * @bson: (in): A #MongoBson.
- * @key: (in): The string containing key.
- * @value: (in): A value to store in the document.
+ * @key: (in): The field name.
+ * @subtype: (in): A #MongoBsonBinarySubtype.
+ * @data: (in) (array length=length): The bytes to store.
+ * @length: (in): The length of @data.
  *
- * Stores the value specified by @value as a boolean in the document
- * under @key.
+ * Appends @data as a %MONGO_BSON_BINARY under @key.
  */
 void
-mongo_bson_append_boolean (MongoBson   *bson,
-                           const gchar *key,
-                           gboolean     value)
+mongo_bson_append_binary (MongoBson              *bson,
+                          const gchar            *key,
+                          MongoBsonBinarySubtype  subtype,
+                          const guint8           *data,
+                          gsize                   length)
 {
-   guint8 b = !!value;
+   guint8 header[5];
+   gint32 len;
 
    g_return_if_fail(bson != NULL);
    g_return_if_fail(key != NULL);
+   g_return_if_fail(data != NULL || !length);
+   g_return_if_fail(length <= (G_MAXINT32 - 5));
 
-   mongo_bson_append(bson, MONGO_BSON_BOOLEAN, key, &b, 1, NULL, 0);
+   len = GINT32_TO_LE(length);
+   memcpy(header, &len, sizeof len);
+   header[4] = subtype;
+
+   mongo_bson_append(bson, MONGO_BSON_BINARY, key, header, sizeof header,
+                     length ? data : NULL, length);
 }
 
 /**
- * mongo_bson_append_bson:
+ * mongo_bson_append_binary_from_stream:
  * @bson: (in): A #MongoBson.
- * @key: (in): A string containing the key.
- * @value: (in): A #MongoBson to store.
+ * @key: (in): The field name.
+ * @subtype: (in): A #MongoBsonBinarySubtype.
+ * @stream: (in): A #GInputStream to read the value from.
+ * @length: (in): The number of bytes to read from @stream.
+ * @cancellable: (in) (allow-none): A #GCancellable, or %NULL.
+ * @error: (out): A location for a #GError, or %NULL.
  *
- * Stores the #MongoBson in the document under @key.
+ * Appends a %MONGO_BSON_BINARY of @length bytes read from @stream under
+ * @key. The bytes are read straight into the buffer of @bson rather than
+ * through an intermediate copy.
+ *
+ * If @stream fails or ends early, @bson is left unchanged.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
  */
-void
-mongo_bson_append_bson (MongoBson   *bson,
-                        const gchar *key,
-                        MongoBson   *value)
+gboolean
+mongo_bson_append_binary_from_stream (MongoBson               *bson,
+                                      const gchar             *key,
+                                      MongoBsonBinarySubtype   subtype,
+                                      GInputStream            *stream,
+                                      gsize                    length,
+                                      GCancellable            *cancellable,
+                                      GError                 **error)
 {
-   g_return_if_fail(bson != NULL);
-   g_return_if_fail(key != NULL);
-   g_return_if_fail(value != NULL);
+   guint8 header[5];
+   gint32 len;
+   gsize bytes_read = 0;
+   gsize old_len;
+   gsize offset;
 
-   mongo_bson_append(bson, MONGO_BSON_DOCUMENT, key,
-                     value->buf->data, value->buf->len,
+   g_return_val_if_fail(bson != NULL, FALSE);
+   g_return_val_if_fail(key != NULL, FALSE);
+   g_return_val_if_fail(G_IS_INPUT_STREAM(stream), FALSE);
+   g_return_val_if_fail(length <= (G_MAXINT32 - 5), FALSE);
+
+   mongo_bson_make_writable(bson);
+   old_len = bson->buf->len;
+
+   len = GINT32_TO_LE(length);
+   memcpy(header, &len, sizeof len);
+   header[4] = subtype;
+   mongo_bson_append(bson, MONGO_BSON_BINARY, key, header, sizeof header,
                      NULL, 0);
+
+   /*
+    * Read into the space between the header and the trailing byte.
+    */
+   offset = bson->buf->len - 1;
+   g_byte_array_set_size(bson->buf, bson->buf->len + length);
+
+   if (!g_input_stream_read_all(stream, bson->buf->data + offset, length,
+                                &bytes_read, cancellable, error)) {
+      GOTO(failure);
+   }
+
+   if (bytes_read != length) {
+      g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                  _("Expected %" G_GSIZE_FORMAT " bytes of binary data "
+                    "but the stream ended after %" G_GSIZE_FORMAT "."),
+                  length, bytes_read);
+      GOTO(failure);
+   }
+
+   bson->buf->data[bson->buf->len - 1] = 0;
+   mongo_bson_update_length(bson);
+
+   return TRUE;
+
+failure:
+   /*
+    * The type byte of the new element replaced our trailing byte.
+    */
+   g_byte_array_set_size(bson->buf, old_len);
+   bson->buf->data[old_len - 1] = 0;
+   mongo_bson_update_length(bson);
+
+   return FALSE;
 }
 
 /**
- * mongo_bson_append_date_time:
+ * mongo_bson_append_external:
  * @bson: (in): A #MongoBson.
- * @key: (in): A string containing the key.
- * @value: (in): A #GDateTime to store.
+ * @type: (in): The #MongoBsonType of the element.
+ * @key: (in): The field name.
+ * @header: (in): The bytes of the value that precede @bytes.
+ * @header_len: (in): The length of @header.
+ * @bytes: (in): The body of the value.
+ * @footer: (in) (allow-none): The bytes of the value that follow @bytes.
+ * @footer_len: (in): The length of @footer.
  *
- * Appends the #GDateTime to the #MongoBson under @key.
+ * Appends an element whose body is referenced from @bytes rather than
+ * copied. Only @header and @footer are stored in the buffer of @bson.
+ * Small bodies are copied anyway.
  */
-void
-mongo_bson_append_date_time (MongoBson   *bson,
-                             const gchar *key,
-                             GDateTime   *value)
+static void
+mongo_bson_append_external (MongoBson    *bson,
+                            guint8        type,
+                            const gchar  *key,
+                            const guint8 *header,
+                            gsize         header_len,
+                            GBytes       *bytes,
+                            const guint8 *footer,
+                            gsize         footer_len)
 {
-   GTimeVal tv;
+   MongoBsonSegment segment;
+   const guint8 trailing = 0;
+   const guint8 *data;
+   gsize length;
 
-   g_return_if_fail(bson != NULL);
-   g_return_if_fail(key != NULL);
-   g_return_if_fail(value != NULL);
+   data = g_bytes_get_data(bytes, &length);
 
-   if (!g_date_time_to_timeval(value, &tv)) {
-      g_warning("GDateTime is outside of storable range, ignoring!");
+   if (length < MONGO_BSON_EXTERNAL_MIN) {
+      mongo_bson_append(bson, type, key, header, header_len,
+                        length ? data : NULL, length);
+      g_byte_array_set_size(bson->buf, bson->buf->len - 1);
+      if (footer_len) {
+         g_byte_array_append(bson->buf, footer, footer_len);
+      }
+      g_byte_array_append(bson->buf, &trailing, 1);
+      mongo_bson_update_length(bson);
       return;
    }
 
-   mongo_bson_append_timeval(bson, key, &tv);
+   mongo_bson_append(bson, type, key, header, header_len,
+                     footer_len ? footer : NULL, footer_len);
+
+   if (!bson->segments) {
+      bson->segments = g_array_new(FALSE, FALSE, sizeof(MongoBsonSegment));
+   }
+
+   segment.offset = bson->buf->len - footer_len - 1;
+   segment.bytes = g_bytes_ref(bytes);
+   g_array_append_val(bson->segments, segment);
+   bson->external_len += length;
+
+   mongo_bson_update_length(bson);
 }
 
 /**
- * mongo_bson_append_double:
+ * mongo_bson_append_binary_bytes:
  * @bson: (in): A #MongoBson.
- * @key: (in): A string containing the key.
- * @value: (in): A #gdouble.
+ * @key: (in): The field name.
+ * @subtype: (in): A #MongoBsonBinarySubtype.
+ * @bytes: (in): A #GBytes containing the value.
  *
- * Appends the #gdouble @value to the document under @key.
+ * Appends @bytes as a %MONGO_BSON_BINARY under @key. Large values are not
+ * copied; @bson keeps a reference to @bytes and mongo_bson_get_vectors()
+ * returns them as a separate segment. They are only copied if the
+ * document is later read as a single buffer.
  */
 void
-mongo_bson_append_double (MongoBson   *bson,
-                          const gchar *key,
-                          gdouble      value)
+mongo_bson_append_binary_bytes (MongoBson              *bson,
+                                const gchar            *key,
+                                MongoBsonBinarySubtype  subtype,
+                                GBytes                 *bytes)
 {
+   guint8 header[5];
+   gint32 len;
+
    g_return_if_fail(bson != NULL);
    g_return_if_fail(key != NULL);
+   g_return_if_fail(bytes != NULL);
+   g_return_if_fail(g_bytes_get_size(bytes) <= (G_MAXINT32 - 5));
 
-   mongo_bson_append(bson, MONGO_BSON_DOUBLE, key,
-                     (const guint8 *)&value, sizeof value,
-                     NULL, 0);
+   len = GINT32_TO_LE(g_bytes_get_size(bytes));
+   memcpy(header, &len, sizeof len);
+   header[4] = subtype;
+
+   mongo_bson_append_external(bson, MONGO_BSON_BINARY, key,
+                              header, sizeof header, bytes, NULL, 0);
 }
 
 /**
- * mongo_bson_append_int:
+ * mongo_bson_append_boolean:
  * @bson: (in): A #MongoBson.
- * @key: (in): A string containing the key.
- * @value: (in): A #gint32 containing the value.
+ * @key: (in): The string containing key.
+ * @value: (in): A value to store in the document.
  *
- * Appends @value to the document under @key.
+ * Stores the value specified by @value as a boolean in the document
+ * under @key.
  */
 void
-mongo_bson_append_int (MongoBson   *bson,
-                       const gchar *key,
-                       gint32       value)
+mongo_bson_append_boolean (MongoBson   *bson,
+                           const gchar *key,
+                           gboolean     value)
 {
+   guint8 b = !!value;
+
    g_return_if_fail(bson != NULL);
    g_return_if_fail(key != NULL);
 
-   mongo_bson_append(bson, MONGO_BSON_INT32, key,
-                     (const guint8 *)&value, sizeof value,
-                     NULL, 0);
+   mongo_bson_append(bson, MONGO_BSON_BOOLEAN, key, &b, 1, NULL, 0);
 }
 
 /**
- * mongo_bson_append_int64:
+ * mongo_bson_append_bson:
  * @bson: (in): A #MongoBson.
  * @key: (in): A string containing the key.
- * @value: (in): A #gint64 containing the value.
+ * @value: (in): A #MongoBson to store.
  *
- * Appends @value to the document under @key.
+ * Stores the #MongoBson in the document under @key.
  */
 void
-mongo_bson_append_int64 (MongoBson   *bson,
-                         const gchar *key,
-                         gint64       value)
+mongo_bson_append_bson (MongoBson   *bson,
+                        const gchar *key,
+                        MongoBson   *value)
 {
+   const guint8 *data;
+   gsize data_len;
+
    g_return_if_fail(bson != NULL);
    g_return_if_fail(key != NULL);
+   g_return_if_fail(value != NULL);
 
-   mongo_bson_append(bson, MONGO_BSON_INT64, key,
-                     (const guint8 *)&value, sizeof value,
+   data = mongo_bson_get_buffer(value, &data_len);
+   mongo_bson_append(bson, MONGO_BSON_DOCUMENT, key, data, data_len, NULL, 0);
+}
+
+/**
+ * mongo_bson_append_child_begin:
+ * @bson: (in): A #MongoBson.
+ * @type: (in): Either %MONGO_BSON_DOCUMENT or %MONGO_BSON_ARRAY.
+ * @key: (in): The field name.
+ *
+ * Appends the header of a child document with a placeholder length and
+ * remembers where it starts so that mongo_bson_append_child_end() can
+ * terminate it.
+ */
+static void
+mongo_bson_append_child_begin (MongoBson     *bson,
+                               MongoBsonType  type,
+                               const gchar   *key)
+{
+   static const guint8 placeholder[4] = { 0 };
+   gsize offset;
+
+   mongo_bson_append(bson, type, key, placeholder, sizeof placeholder,
                      NULL, 0);
+
+   if (!bson->children) {
+      bson->children = g_array_new(FALSE, FALSE, sizeof(gsize));
+   }
+
+   offset = bson->buf->len - sizeof placeholder - 1;
+   g_array_append_val(bson->children, offset);
 }
 
 /**
- * mongo_bson_append_null:
+ * mongo_bson_append_child_end:
  * @bson: (in): A #MongoBson.
- * @key: (in): A string containing the key.
  *
- * Appends a %NULL value to the document under @key.
+ * Terminates the most recently opened child document. The trailing byte
+ * of @bson becomes the trailing byte of the child and a new one is added.
  */
-void
-mongo_bson_append_null (MongoBson   *bson,
-                        const gchar *key)
+static void
+mongo_bson_append_child_end (MongoBson *bson)
 {
-   g_return_if_fail(bson != NULL);
-   g_return_if_fail(key != NULL);
+   MongoBsonSegment *segment;
+   const guint8 trailing = 0;
+   gint32 doc_len;
+   gsize external_len = 0;
+   gsize offset;
+   guint i;
 
-   mongo_bson_append(bson, MONGO_BSON_NULL, key, NULL, 0, NULL, 0);
+   g_return_if_fail(bson->children != NULL);
+   g_return_if_fail(bson->children->len > 0);
+
+   offset = g_array_index(bson->children, gsize, bson->children->len - 1);
+   g_array_set_size(bson->children, bson->children->len - 1);
+
+   g_byte_array_append(bson->buf, &trailing, 1);
+
+   if (bson->segments) {
+      for (i = bson->segments->len; i > 0; i--) {
+         segment = &g_array_index(bson->segments, MongoBsonSegment, i - 1);
+         if (segment->offset <= offset) {
+            break;
+         }
+         external_len += g_bytes_get_size(segment->bytes);
+      }
+   }
+
+   doc_len = GINT_TO_LE(bson->buf->len - 1 - offset + external_len);
+   memcpy(bson->buf->data + offset, &doc_len, sizeof doc_len);
+
+   mongo_bson_update_length(bson);
 }
 
 /**
- * mongo_bson_append_object_id:
+ * mongo_bson_append_array_begin:
  * @bson: (in): A #MongoBson.
- * @key: (in): A string containing the key.
- * @object_id: (in): A #MongoObjectId.
+ * @key: (in): The field name.
  *
- * Appends @object_id to the document under @key.
+ * Starts an array under @key that is built in place. Until the matching
+ * call to mongo_bson_append_array_end(), the mongo_bson_append_*()
+ * functions append to the array rather than to @bson and the contents of
+ * @bson must not be read. The keys of the elements should be "0", "1",
+ * and so on.
+ *
+ * This avoids building a temporary #MongoBson for the array and copying
+ * it in with mongo_bson_append_array().
  */
 void
-mongo_bson_append_object_id (MongoBson     *bson,
-                             const gchar   *key,
-                             MongoObjectId *object_id)
+mongo_bson_append_array_begin (MongoBson   *bson,
+                               const gchar *key)
 {
    g_return_if_fail(bson != NULL);
    g_return_if_fail(key != NULL);
-   g_return_if_fail(object_id != NULL);
 
-   mongo_bson_append(bson, MONGO_BSON_OBJECT_ID, key,
-                     (const guint8 *)object_id, 12,
-                     NULL, 0);
+   mongo_bson_append_child_begin(bson, MONGO_BSON_ARRAY, key);
 }
 
 /**
- * mongo_bson_append_regex:
+ * mongo_bson_append_array_end:
  * @bson: (in): A #MongoBson.
- * @key: (in): A string containing the key.
- * @regex: (in): A string containing a regex.
- * @options: (in): Options for the regex.
  *
- * Appends a regex to the document under @key.
+ * Completes an array started with mongo_bson_append_array_begin().
  */
 void
-mongo_bson_append_regex (MongoBson   *bson,
-                         const gchar *key,
-                         const gchar *regex,
-                         const gchar *options)
+mongo_bson_append_array_end (MongoBson *bson)
 {
    g_return_if_fail(bson != NULL);
-   g_return_if_fail(key != NULL);
-   g_return_if_fail(regex != NULL);
 
-   if (!options) {
-      options = "";
+   mongo_bson_append_child_end(bson);
+}
+
+/*
+ * The keys "0" through "999" as consecutive nul-terminated strings, so that
+ * the typed array appends do not have to format a key for each element.
+ * See mongo_bson_index_key() for where each key starts.
+ */
+#define INDEX_KEYS_10(p) \
+   p "0\0" p "1\0" p "2\0" p "3\0" p "4\0" \
+   p "5\0" p "6\0" p "7\0" p "8\0" p "9\0"
+#define INDEX_KEYS_100(p) \
+   INDEX_KEYS_10(p "0") INDEX_KEYS_10(p "1") INDEX_KEYS_10(p "2") \
+   INDEX_KEYS_10(p "3") INDEX_KEYS_10(p "4") INDEX_KEYS_10(p "5") \
+   INDEX_KEYS_10(p "6") INDEX_KEYS_10(p "7") INDEX_KEYS_10(p "8") \
+   INDEX_KEYS_10(p "9")
+
+static const gchar gIndexKeys[] =
+   INDEX_KEYS_10("")
+   INDEX_KEYS_10("1") INDEX_KEYS_10("2") INDEX_KEYS_10("3")
+   INDEX_KEYS_10("4") INDEX_KEYS_10("5") INDEX_KEYS_10("6")
+   INDEX_KEYS_10("7") INDEX_KEYS_10("8") INDEX_KEYS_10("9")
+   INDEX_KEYS_100("1") INDEX_KEYS_100("2") INDEX_KEYS_100("3")
+   INDEX_KEYS_100("4") INDEX_KEYS_100("5") INDEX_KEYS_100("6")
+   INDEX_KEYS_100("7") INDEX_KEYS_100("8") INDEX_KEYS_100("9");
+
+#undef INDEX_KEYS_10
+#undef INDEX_KEYS_100
+
+#define N_INDEX_KEYS 1000
+
+/**
+ * mongo_bson_index_key:
+ * @index: (in): The index of the array element.
+ * @scratch: (inout): A buffer of at least 11 bytes.
+ * @length: (out): A location for the length of the key.
+ *
+ * Fetches the key for the array element at @index. Keys below
+ * %N_INDEX_KEYS come from gIndexKeys. Larger keys are built in @scratch,
+ * by incrementing the previous key when @scratch holds the key of
+ * @index - 1, which is the case when the keys are fetched in order.
+ *
+ * Returns: The key, valid until @scratch is modified.
+ */
+static inline const gchar *
+mongo_bson_index_key (guint  index,
+                      gchar *scratch,
+                      gsize *length)
+{
+   gint i;
+
+   if (index < 10) {
+      *length = 1;
+      return gIndexKeys + (index * 2);
+   } else if (index < 100) {
+      *length = 2;
+      return gIndexKeys + 20 + ((index - 10) * 3);
+   } else if (index < N_INDEX_KEYS) {
+      *length = 3;
+      return gIndexKeys + 290 + ((index - 100) * 4);
+   } else if (index == N_INDEX_KEYS) {
+      *length = g_snprintf(scratch, 11, "%u", index);
+      return scratch;
    }
 
-   mongo_bson_append(bson, MONGO_BSON_REGEX, key,
-                     (const guint8 *)regex, strlen(regex) + 1,
-                     (const guint8 *)options, strlen(options) + 1);
+   /*
+    * Increment the decimal string of the previous index.
+    */
+   *length = strlen(scratch);
+   for (i = *length - 1; i >= 0; i--) {
+      if (scratch[i] != '9') {
+         scratch[i]++;
+         return scratch;
+      }
+      scratch[i] = '0';
+   }
+
+   memmove(scratch + 1, scratch, ++*length);
+   scratch[0] = '1';
+
+   return scratch;
 }
 
 /**
- * mongo_bson_append_string:
+ * mongo_bson_index_keys_length:
+ * @n_keys: (in): The number of array elements.
+ *
+ * Computes the total length of the keys "0" through @n_keys - 1, not
+ * including their nul bytes.
+ *
+ * Returns: The length in bytes.
+ */
+static guint64
+mongo_bson_index_keys_length (guint n_keys)
+{
+   guint64 lower = 0;
+   guint64 upper = 10;
+   guint64 total = 0;
+   gsize width = 1;
+
+   while (lower < n_keys) {
+      total += (MIN(upper, n_keys) - lower) * width;
+      lower = upper;
+      upper *= 10;
+      width++;
+   }
+
+   return total;
+}
+
+/**
+ * mongo_bson_append_array_reserve:
  * @bson: (in): A #MongoBson.
- * @key: (in): A string containing the key.
- * @value: (in): A string containing the value.
+ * @key: (in): The field name.
+ * @length: (in): The length of the elements of the array.
  *
- * Stores the string @value in the document under @key.
+ * Opens an array under @key and makes room for @length bytes of elements.
+ *
+ * Returns: Where to write the elements. mongo_bson_append_child_end()
+ *   completes the array once they are written.
  */
-void
-mongo_bson_append_string (MongoBson   *bson,
-                          const gchar *key,
-                          const gchar *value)
+static guint8 *
+mongo_bson_append_array_reserve (MongoBson   *bson,
+                                 const gchar *key,
+                                 gsize        length)
 {
-   gint32 value_len;
-   gint32 value_len_swab;
+   gsize offset;
 
-   g_return_if_fail(bson != NULL);
-   g_return_if_fail(key != NULL);
-   g_return_if_fail(g_utf8_validate(value, -1, NULL));
+   mongo_bson_append_child_begin(bson, MONGO_BSON_ARRAY, key);
 
-   value = value ? value : "";
-   value_len = strlen(value) + 1;
-   value_len_swab = GINT_TO_LE(value_len);
+   /*
+    * The trailing byte of @bson is overwritten by the first element and
+    * added back after the last one.
+    */
+   offset = bson->buf->len - 1;
+   g_byte_array_set_size(bson->buf, offset + length + 1);
+   bson->buf->data[offset + length] = 0;
 
-   mongo_bson_append(bson, MONGO_BSON_UTF8, key,
-                     (const guint8 *)&value_len_swab, sizeof value_len_swab,
-                     (const guint8 *)value, value_len);
+   return bson->buf->data + offset;
 }
 
 /**
- * mongo_bson_append_timeval:
+ * mongo_bson_append_fixed_array:
  * @bson: (in): A #MongoBson.
- * @key: (in): A string containing the key.
- * @value: (in): A #GTimeVal containing the date and time.
- *
- * Appends the date and time represented by @value up to milliseconds.
- * The value is stored in the document under @key.
+ * @key: (in): The field name.
+ * @type: (in): The type of the elements.
+ * @values: (in): The values, already in little-endian byte order.
+ * @size: (in): The size of each value.
+ * @n_values: (in): The number of values.
  *
- * See also: mongo_bson_append_date_time().
+ * Appends an array of fixed-size values in a single pass over the
+ * destination buffer. Arrays too large for a document are refused.
  */
-void
-mongo_bson_append_timeval (MongoBson   *bson,
-                           const gchar *key,
-                           GTimeVal    *value)
+static void
+mongo_bson_append_fixed_array (MongoBson    *bson,
+                               const gchar  *key,
+                               guint8        type,
+                               const guint8 *values,
+                               gsize         size,
+                               guint         n_values)
 {
-   guint64 msec;
+   const gchar *index_key;
+   gchar scratch[11];
+   guint64 length;
+   guint8 *p;
+   gsize key_len;
+   guint i;
 
-   g_return_if_fail(bson != NULL);
-   g_return_if_fail(key != NULL);
-   g_return_if_fail(value != NULL);
+   length = ((guint64)n_values * (size + 2)) +
+            mongo_bson_index_keys_length(n_values);
+   if (length > (G_MAXINT32 - 5)) {
+      g_warning("Array is too large for a document.");
+      return;
+   }
 
-   msec = (value->tv_sec * 1000) + (value->tv_usec / 1000);
-   mongo_bson_append(bson, MONGO_BSON_DATE_TIME, key,
-                     (const guint8 *)&msec, sizeof msec,
-                     NULL, 0);
+   p = mongo_bson_append_array_reserve(bson, key, length);
+
+   for (i = 0; i < n_values; i++) {
+      index_key = mongo_bson_index_key(i, scratch, &key_len);
+      *p++ = type;
+      memcpy(p, index_key, key_len + 1);
+      p += key_len + 1;
+      memcpy(p, values + (i * size), size);
+      p += size;
+   }
+
+   mongo_bson_append_child_end(bson);
 }
 
 /**
- * mongo_bson_append_undefined:
+ * mongo_bson_append_double_array:
  * @bson: (in): A #MongoBson.
- * @key: (in): A string containing the key.
+ * @key: (in): The field name.
+ * @values: (in) (array length=n_values): The values to store.
+ * @n_values: (in): The number of values.
  *
- * Appends a javascript "undefined" value in the document under @key.
+ * Appends an array of %MONGO_BSON_DOUBLE under @key. This is equivalent
+ * to appending each value between mongo_bson_append_array_begin() and
+ * mongo_bson_append_array_end(), but the array is written with a single
+ * resize of the buffer and without formatting the keys. An array that
+ * would not fit in a document is not appended.
  */
 void
-mongo_bson_append_undefined (MongoBson   *bson,
-                             const gchar *key)
+mongo_bson_append_double_array (MongoBson     *bson,
+                                const gchar   *key,
+                                const gdouble *values,
+                                guint          n_values)
 {
    g_return_if_fail(bson != NULL);
    g_return_if_fail(key != NULL);
+   g_return_if_fail(values != NULL || !n_values);
+   g_return_if_fail(n_values <= G_MAXINT32 / 11);
 
-   mongo_bson_append(bson, MONGO_BSON_UNDEFINED, key,
-                     NULL, 0, NULL, 0);
+   mongo_bson_append_fixed_array(bson, key, MONGO_BSON_DOUBLE,
+                                 (const guint8 *)values, sizeof *values,
+                                 n_values);
 }
 
 /**
- * mongo_bson_iter_init:
- * @iter: an uninitialized #MongoBsonIter.
- * @bson: a #MongoBson.
+ * mongo_bson_append_int_array:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): The field name.
+ * @values: (in) (array length=n_values): The values to store.
+ * @n_values: (in): The number of values.
  *
- * Initializes a #MongoBsonIter for iterating through a #MongoBson document.
+ * Appends an array of %MONGO_BSON_INT32 under @key.
+ *
+ * See also: mongo_bson_append_double_array().
  */
 void
-mongo_bson_iter_init (MongoBsonIter *iter,
-                      MongoBson     *bson)
+mongo_bson_append_int_array (MongoBson    *bson,
+                             const gchar  *key,
+                             const gint32 *values,
+                             guint         n_values)
 {
-   g_return_if_fail(iter != NULL);
    g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+   g_return_if_fail(values != NULL || !n_values);
+   g_return_if_fail(n_values <= G_MAXINT32 / 7);
 
-   memset(iter, 0, sizeof *iter);
-   iter->user_data1 = bson->buf->data;
-   iter->user_data2 = GINT_TO_POINTER(bson->buf->len);
-   iter->user_data3 = GINT_TO_POINTER(3); /* End of size buffer */
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+   {
+      gint32 *swapped;
+      guint i;
+
+      swapped = g_new(gint32, n_values);
+      for (i = 0; i < n_values; i++) {
+         swapped[i] = GINT32_TO_LE(values[i]);
+      }
+      mongo_bson_append_fixed_array(bson, key, MONGO_BSON_INT32,
+                                    (const guint8 *)swapped, sizeof *values,
+                                    n_values);
+      g_free(swapped);
+   }
+#else
+   mongo_bson_append_fixed_array(bson, key, MONGO_BSON_INT32,
+                                 (const guint8 *)values, sizeof *values,
+                                 n_values);
+#endif
 }
 
 /**
- * mongo_bson_iter_find:
- * @iter: (in): A #MongoBsonIter.
- * @key: (in): A key to find in the BSON document.
+ * mongo_bson_append_int64_array:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): The field name.
+ * @values: (in) (array length=n_values): The values to store.
+ * @n_values: (in): The number of values.
  *
- * Iterates through all upcoming keys in a #MongoBsonIter until @key is
- * found or the end of the document has been reached.
+ * Appends an array of %MONGO_BSON_INT64 under @key.
  *
- * Returns: %TRUE if @key was found, otherwise %FALSE.
+ * See also: mongo_bson_append_double_array().
  */
-gboolean
-mongo_bson_iter_find (MongoBsonIter *iter,
-                      const gchar   *key)
+void
+mongo_bson_append_int64_array (MongoBson    *bson,
+                               const gchar  *key,
+                               const gint64 *values,
+                               guint         n_values)
 {
-   g_return_val_if_fail(iter != NULL, FALSE);
-   g_return_val_if_fail(key != NULL, FALSE);
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+   g_return_if_fail(values != NULL || !n_values);
+   g_return_if_fail(n_values <= G_MAXINT32 / 11);
 
-   while (mongo_bson_iter_next(iter)){
-      if (!g_strcmp0(key, mongo_bson_iter_get_key(iter))) {
-         return TRUE;
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+   {
+      gint64 *swapped;
+      guint i;
+
+      swapped = g_new(gint64, n_values);
+      for (i = 0; i < n_values; i++) {
+         swapped[i] = GINT64_TO_LE(values[i]);
       }
+      mongo_bson_append_fixed_array(bson, key, MONGO_BSON_INT64,
+                                    (const guint8 *)swapped, sizeof *values,
+                                    n_values);
+      g_free(swapped);
    }
-
-   return FALSE;
+#else
+   mongo_bson_append_fixed_array(bson, key, MONGO_BSON_INT64,
+                                 (const guint8 *)values, sizeof *values,
+                                 n_values);
+#endif
 }
 
 /**
- * mongo_bson_iter_get_key:
- * @iter: (in): A #MongoBsonIter.
+ * mongo_bson_append_string_array:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): The field name.
+ * @values: (in) (array length=n_values): The UTF-8 strings to store.
+ * @n_values: (in): The number of strings.
  *
- * Fetches the key currently pointed to by @iter.
+ * Appends an array of %MONGO_BSON_UTF8 under @key. %NULL strings are
+ * stored as empty strings.
  *
- * Returns: A string containing the key.
+ * See also: mongo_bson_append_double_array().
  */
-const gchar *
-mongo_bson_iter_get_key (MongoBsonIter *iter)
+void
+mongo_bson_append_string_array (MongoBson          *bson,
+                                const gchar        *key,
+                                const gchar * const *values,
+                                guint               n_values)
 {
-   g_return_val_if_fail(iter != NULL, NULL);
-   return (const gchar *)iter->user_data4;
-}
-
-static MongoBson *
-mongo_bson_iter_get_value_document (MongoBsonIter *iter,
-                                    MongoBsonType  type)
-{
-   const guint8 *buffer;
-   gpointer endbuf;
-   guint32 array_len;
+   const gchar *index_key;
+   const gchar *value;
+   gchar scratch[11];
+   gint32 value_len;
+   guint64 length;
+   guint8 *p;
+   gsize key_len;
+   gsize *lengths;
+   guint i;
 
-   g_return_val_if_fail(iter != NULL, NULL);
-   g_return_val_if_fail(iter->user_data1 != NULL, NULL);
-   g_return_val_if_fail(iter->user_data2 != NULL, NULL);
-   g_return_val_if_fail(iter->user_data6 != NULL, NULL);
-   g_return_val_if_fail((type == MONGO_BSON_ARRAY) ||
-                        (type == MONGO_BSON_DOCUMENT), NULL);
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+   g_return_if_fail(values != NULL || !n_values);
+   g_return_if_fail(n_values <= G_MAXINT32 / 8);
 
-   if (G_LIKELY(ITER_IS_TYPE(iter, type))) {
-      endbuf = GSIZE_TO_POINTER(GPOINTER_TO_SIZE(iter->user_data1) +
-                                GPOINTER_TO_SIZE(iter->user_data2));
-      if ((iter->user_data6 + 5) > endbuf) {
-         return NULL;
+   /*
+    * Every element takes at least 8 bytes, so a document can not hold
+    * more than the above. The length is summed in 64 bits so that it can
+    * not wrap before it is checked.
+    */
+   lengths = g_new(gsize, n_values);
+   length = ((guint64)n_values * 7) + mongo_bson_index_keys_length(n_values);
+
+   for (i = 0; i < n_values; i++) {
+      value = values[i] ? values[i] : "";
+      lengths[i] = strlen(value);
+      if (!g_utf8_validate(value, lengths[i], NULL)) {
+         g_warning("Array element %u is not valid UTF-8.", i);
+         g_free(lengths);
+         return;
       }
-      memcpy(&array_len, iter->user_data6, sizeof array_len);
-      array_len = GINT_FROM_LE(array_len);
-      if ((iter->user_data6 + array_len) < endbuf) {
-         return NULL;
+      length += lengths[i];
+      if (length > (G_MAXINT32 - 5)) {
+         g_warning("Array is too large for a document.");
+         g_free(lengths);
+         return;
       }
-      buffer = iter->user_data6;
-      return mongo_bson_new_from_data(buffer, array_len);
    }
 
-   if (type == MONGO_BSON_ARRAY) {
-      g_warning("Current key is not an array.");
-   } else if (type == MONGO_BSON_DOCUMENT) {
-      g_warning("Current key is not a document.");
-   } else {
-      g_assert_not_reached();
+   p = mongo_bson_append_array_reserve(bson, key, length);
+
+   for (i = 0; i < n_values; i++) {
+      index_key = mongo_bson_index_key(i, scratch, &key_len);
+      *p++ = MONGO_BSON_UTF8;
+      memcpy(p, index_key, key_len + 1);
+      p += key_len + 1;
+      value_len = GINT32_TO_LE(lengths[i] + 1);
+      memcpy(p, &value_len, sizeof value_len);
+      p += sizeof value_len;
+      memcpy(p, values[i] ? values[i] : "", lengths[i] + 1);
+      p += lengths[i] + 1;
    }
 
-   return NULL;
-}
+   mongo_bson_append_child_end(bson);
 
-/**
- * mongo_bson_iter_get_value_array:
- * @iter: (in): A #MongoBsonIter.
- *
- * Fetches the array document current pointed to by @iter. This makes a
- * copy of the document and returns a new #MongoBson instance. For more
- * optimized cases, you may want to use mongo_bson_iter_recurse() to avoid
- * copying the memory if only iteration is needed.
- *
- * Returns: (transfer full): A #MongoBson.
- */
-MongoBson *
-mongo_bson_iter_get_value_array (MongoBsonIter *iter)
-{
-   return mongo_bson_iter_get_value_document(iter, MONGO_BSON_ARRAY);
+   g_free(lengths);
 }
 
 /**
- * mongo_bson_iter_get_value_array:
- * @iter: (in): A #MongoBsonIter.
- *
- * Fetches the current value pointed to by the iterator, expecting it to
- * be a boolean.
+ * mongo_bson_append_bson_begin:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): The field name.
  *
- * Returns: The current value.
+ * Starts a document under @key that is built in place. Until the matching
+ * call to mongo_bson_append_bson_end(), the mongo_bson_append_*()
+ * functions append to the child document rather than to @bson and the
+ * contents of @bson must not be read.
  */
-gboolean
-mongo_bson_iter_get_value_boolean (MongoBsonIter *iter)
+void
+mongo_bson_append_bson_begin (MongoBson   *bson,
+                              const gchar *key)
 {
-   guint8 b;
-
-   g_return_val_if_fail(iter != NULL, 0);
-   g_return_val_if_fail(iter->user_data6 != NULL, 0);
-
-   if (ITER_IS_TYPE(iter, MONGO_BSON_BOOLEAN)) {
-      memcpy(&b, iter->user_data6, sizeof b);
-      return !!b;
-   }
-
-   g_warning("Current key is not a boolean.");
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
 
-   return FALSE;
+   mongo_bson_append_child_begin(bson, MONGO_BSON_DOCUMENT, key);
 }
 
 /**
- * mongo_bson_iter_get_value_bson:
- * @iter: (in): A #MongoBsonIter.
- *
- * Fetches the current value pointed to by @iter if it is a
- * %MONGO_BSON_DOCUMENT. The document is copied and returned as a new
- * #MongoBson instance. If you simply need to iterate the child document,
- * you may want to use mongo_bson_iter_recurse().
+ * mongo_bson_append_bson_end:
+ * @bson: (in): A #MongoBson.
  *
- * Returns: A #MongoBson if successful; otherwise %NULL.
+ * Completes a document started with mongo_bson_append_bson_begin().
  */
-MongoBson *
-mongo_bson_iter_get_value_bson (MongoBsonIter *iter)
+void
+mongo_bson_append_bson_end (MongoBson *bson)
 {
-   return mongo_bson_iter_get_value_document(iter, MONGO_BSON_DOCUMENT);
+   g_return_if_fail(bson != NULL);
+
+   mongo_bson_append_child_end(bson);
 }
 
 /**
- * mongo_bson_iter_get_value_date_time:
- * @iter: (in): A #MongoBsonIter.
- *
- * Fetches a #GDateTime for the current value pointed to by @iter.
+ * mongo_bson_append_date_time:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ * @value: (in): A #GDateTime to store.
  *
- * Returns: A new #GDateTime which should be freed with g_date_time_unref().
+ * Appends the #GDateTime to the #MongoBson under @key.
  */
-GDateTime *
-mongo_bson_iter_get_value_date_time (MongoBsonIter *iter)
+void
+mongo_bson_append_date_time (MongoBson   *bson,
+                             const gchar *key,
+                             GDateTime   *value)
 {
    GTimeVal tv;
 
-   g_return_val_if_fail(iter != NULL, NULL);
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+   g_return_if_fail(value != NULL);
 
-   mongo_bson_iter_get_value_timeval(iter, &tv);
-   return g_date_time_new_from_timeval_utc(&tv);
+   if (!g_date_time_to_timeval(value, &tv)) {
+      g_warning("GDateTime is outside of storable range, ignoring!");
+      return;
+   }
+
+   mongo_bson_append_timeval(bson, key, &tv);
 }
 
 /**
- * mongo_bson_iter_get_value_double:
- * @iter: (in): A #MongoBsonIter.
- *
- * Fetches the current value pointed to by @iter if it is a
- * %MONGO_BSON_DOUBLE.
+ * mongo_bson_append_dbpointer:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ * @collection: (in): The namespace of the referenced document.
+ * @object_id: (in): The #MongoObjectId of the referenced document.
  *
- * Returns: A #gdouble.
+ * Appends a deprecated %MONGO_BSON_DBPOINTER under @key. This exists so
+ * that documents received from the server can be written back unchanged.
  */
-gdouble
-mongo_bson_iter_get_value_double (MongoBsonIter *iter)
+void
+mongo_bson_append_dbpointer (MongoBson           *bson,
+                             const gchar         *key,
+                             const gchar         *collection,
+                             const MongoObjectId *object_id)
 {
-   gdouble value;
+   guint8 *data;
+   gint32 len;
+   gsize collection_len;
 
-   g_return_val_if_fail(iter != NULL, 0);
-   g_return_val_if_fail(iter->user_data6 != NULL, 0);
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+   g_return_if_fail(collection != NULL);
+   g_return_if_fail(g_utf8_validate(collection, -1, NULL));
+   g_return_if_fail(object_id != NULL);
 
-   if (ITER_IS_TYPE(iter, MONGO_BSON_DOUBLE)) {
-      memcpy(&value, iter->user_data6, sizeof value);
-      return value;
-   }
+   collection_len = strlen(collection) + 1;
+   data = g_malloc(4 + collection_len);
+   len = GINT_TO_LE(collection_len);
+   memcpy(data, &len, sizeof len);
+   memcpy(data + 4, collection, collection_len);
 
-   g_warning("Current value is not a double.");
+   mongo_bson_append(bson, MONGO_BSON_DBPOINTER, key,
+                     data, 4 + collection_len,
+                     object_id->data, sizeof object_id->data);
 
-   return 0.0;
+   g_free(data);
 }
 
 /**
- * mongo_bson_iter_get_value_object_id:
- * @iter: (in): A #MongoBsonIter.
- *
- * Fetches the current value pointed to by @iter if it is a
- * %MONGO_BSON_OBJECT_ID. The resulting #MongoObjectId should be freed
- * with mongo_object_id_free().
+ * mongo_bson_append_decimal128:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ * @value: (in): A #MongoDecimal128.
  *
- * Returns: (transfer full): A #MongoObjectId.
+ * Stores @value in the document under @key.
  */
-MongoObjectId *
-mongo_bson_iter_get_value_object_id (MongoBsonIter *iter)
+void
+mongo_bson_append_decimal128 (MongoBson             *bson,
+                              const gchar           *key,
+                              const MongoDecimal128 *value)
 {
-   g_return_val_if_fail(iter != NULL, NULL);
-   g_return_val_if_fail(iter->user_data6 != NULL, NULL);
+   guint64 data[2];
 
-   if (ITER_IS_TYPE(iter, MONGO_BSON_OBJECT_ID)) {
-      return mongo_object_id_new_from_data(iter->user_data6);
-   }
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+   g_return_if_fail(value != NULL);
 
-   g_warning("Current value is not an ObjectId.");
+   data[0] = GUINT64_TO_LE(value->low);
+   data[1] = GUINT64_TO_LE(value->high);
 
-   return NULL;
+   mongo_bson_append(bson, MONGO_BSON_DECIMAL128, key,
+                     (const guint8 *)data, sizeof data, NULL, 0);
 }
 
 /**
- * mongo_bson_iter_get_value_int:
- * @iter: (in): A #MongoBsonIter.
- *
- * Fetches the current value pointed to by @iter if it is a
- * %MONGO_BSON_INT32.
+ * mongo_bson_append_double:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ * @value: (in): A #gdouble.
  *
- * Returns: A #gint32 containing the value.
+ * Appends the #gdouble @value to the document under @key.
  */
-gint32
-mongo_bson_iter_get_value_int (MongoBsonIter *iter)
+void
+mongo_bson_append_double (MongoBson   *bson,
+                          const gchar *key,
+                          gdouble      value)
 {
-   gint32 value;
-
-   g_return_val_if_fail(iter != NULL, 0);
-   g_return_val_if_fail(iter->user_data6 != NULL, 0);
-
-   if (ITER_IS_TYPE(iter, MONGO_BSON_INT32)) {
-      memcpy(&value, iter->user_data6, sizeof value);
-      return GINT_FROM_LE(value);
-   }
-
-   g_warning("Current value is not an int32.");
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
 
-   return 0;
+   mongo_bson_append(bson, MONGO_BSON_DOUBLE, key,
+                     (const guint8 *)&value, sizeof value,
+                     NULL, 0);
 }
 
 /**
- * mongo_bson_iter_get_value_int64:
- * @iter: (in): A #MongoBsonIter.
- *
- * Fetches the current value pointed to by @iter if it is a
- * %MONGO_BSON_INT64.
+ * mongo_bson_append_int:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ * @value: (in): A #gint32 containing the value.
  *
- * Returns: A #gint64.
+ * Appends @value to the document under @key.
  */
-gint64
-mongo_bson_iter_get_value_int64 (MongoBsonIter *iter)
+void
+mongo_bson_append_int (MongoBson   *bson,
+                       const gchar *key,
+                       gint32       value)
 {
-   gint64 value;
-
-   g_return_val_if_fail(iter != NULL, 0L);
-   g_return_val_if_fail(iter->user_data6 != NULL, 0L);
-
-   if (ITER_IS_TYPE(iter, MONGO_BSON_INT64)) {
-      memcpy(&value, iter->user_data6, sizeof value);
-      return GINT64_FROM_LE(value);
-   }
-
-   g_warning("Current value is not an int64.");
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
 
-   return 0L;
+   mongo_bson_append(bson, MONGO_BSON_INT32, key,
+                     (const guint8 *)&value, sizeof value,
+                     NULL, 0);
 }
 
 /**
- * mongo_bson_iter_get_value_regex:
- * @iter: (in): A #MongoBsonIter.
- * @regex: (out) (allow-none) (transfer none): A location for a string containing the regex.
- * @options: (out) (allow-none) (transfer none): A location for a string containing the options.
+ * mongo_bson_append_int64:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ * @value: (in): A #gint64 containing the value.
  *
- * Fetches the current value pointed to by @iter if it is a regex. The values
- * MUST NOT be modified or freed.
+ * Appends @value to the document under @key.
  */
 void
-mongo_bson_iter_get_value_regex (MongoBsonIter  *iter,
-                                 const gchar   **regex,
-                                 const gchar   **options)
+mongo_bson_append_int64 (MongoBson   *bson,
+                         const gchar *key,
+                         gint64       value)
 {
-   g_return_if_fail(iter != NULL);
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
 
-   if (ITER_IS_TYPE(iter, MONGO_BSON_REGEX)) {
-      if (regex) {
-         *regex = iter->user_data6;
-      }
-      if (options) {
-         *options = iter->user_data7;
-      }
+   mongo_bson_append(bson, MONGO_BSON_INT64, key,
+                     (const guint8 *)&value, sizeof value,
+                     NULL, 0);
+}
+
+/**
+ * mongo_bson_append_javascript:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ * @code: (in): The JavaScript source.
+ *
+ * Stores @code as a %MONGO_BSON_JAVASCRIPT in the document under @key.
+ */
+void
+mongo_bson_append_javascript (MongoBson   *bson,
+                              const gchar *key,
+                              const gchar *code)
+{
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+   g_return_if_fail(code != NULL);
+   g_return_if_fail(g_utf8_validate(code, -1, NULL));
+
+   mongo_bson_append_string_value(bson, MONGO_BSON_JAVASCRIPT, key, code);
+}
+
+/**
+ * mongo_bson_append_javascript_with_scope:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ * @code: (in): The JavaScript source.
+ * @scope: (in): A #MongoBson containing the variables bound in @code.
+ *
+ * Stores @code along with @scope as a
+ * %MONGO_BSON_JAVASCRIPT_WITH_SCOPE in the document under @key.
+ */
+void
+mongo_bson_append_javascript_with_scope (MongoBson   *bson,
+                                         const gchar *key,
+                                         const gchar *code,
+                                         MongoBson   *scope)
+{
+   const guint8 *scope_data;
+   guint8 *data;
+   gint32 len;
+   gsize scope_len;
+   gsize code_len;
+
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+   g_return_if_fail(code != NULL);
+   g_return_if_fail(g_utf8_validate(code, -1, NULL));
+   g_return_if_fail(scope != NULL);
+
+   /*
+    * The value is the total length, the code as a string and the scope.
+    */
+   scope_data = mongo_bson_get_buffer(scope, &scope_len);
+   code_len = strlen(code) + 1;
+   data = g_malloc(8 + code_len);
+   len = GINT_TO_LE(8 + code_len + scope_len);
+   memcpy(data, &len, sizeof len);
+   len = GINT_TO_LE(code_len);
+   memcpy(data + 4, &len, sizeof len);
+   memcpy(data + 8, code, code_len);
+
+   mongo_bson_append(bson, MONGO_BSON_JAVASCRIPT_WITH_SCOPE, key,
+                     data, 8 + code_len, scope_data, scope_len);
+
+   g_free(data);
+}
+
+/**
+ * mongo_bson_append_max_key:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ *
+ * Appends a %MONGO_BSON_MAX_KEY, which sorts after every other value,
+ * under @key.
+ */
+void
+mongo_bson_append_max_key (MongoBson   *bson,
+                           const gchar *key)
+{
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+
+   mongo_bson_append(bson, MONGO_BSON_MAX_KEY, key, NULL, 0, NULL, 0);
+}
+
+/**
+ * mongo_bson_append_min_key:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ *
+ * Appends a %MONGO_BSON_MIN_KEY, which sorts before every other value,
+ * under @key.
+ */
+void
+mongo_bson_append_min_key (MongoBson   *bson,
+                           const gchar *key)
+{
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+
+   mongo_bson_append(bson, MONGO_BSON_MIN_KEY, key, NULL, 0, NULL, 0);
+}
+
+/**
+ * mongo_bson_append_null:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ *
+ * Appends a %NULL value to the document under @key.
+ */
+void
+mongo_bson_append_null (MongoBson   *bson,
+                        const gchar *key)
+{
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+
+   mongo_bson_append(bson, MONGO_BSON_NULL, key, NULL, 0, NULL, 0);
+}
+
+/**
+ * mongo_bson_append_object_id:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ * @object_id: (in): A #MongoObjectId.
+ *
+ * Appends @object_id to the document under @key.
+ */
+void
+mongo_bson_append_object_id (MongoBson     *bson,
+                             const gchar   *key,
+                             MongoObjectId *object_id)
+{
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+   g_return_if_fail(object_id != NULL);
+
+   mongo_bson_append(bson, MONGO_BSON_OBJECT_ID, key,
+                     (const guint8 *)object_id, 12,
+                     NULL, 0);
+}
+
+/**
+ * mongo_bson_append_regex:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ * @regex: (in): A string containing a regex.
+ * @options: (in): Options for the regex.
+ *
+ * Appends a regex to the document under @key.
+ */
+void
+mongo_bson_append_regex (MongoBson   *bson,
+                         const gchar *key,
+                         const gchar *regex,
+                         const gchar *options)
+{
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+   g_return_if_fail(regex != NULL);
+
+   if (!options) {
+      options = "";
+   }
+
+   mongo_bson_append(bson, MONGO_BSON_REGEX, key,
+                     (const guint8 *)regex, strlen(regex) + 1,
+                     (const guint8 *)options, strlen(options) + 1);
+}
+
+/**
+ * mongo_bson_append_string:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ * @value: (in): A string containing the value.
+ *
+ * Stores the string @value in the document under @key.
+ */
+void
+mongo_bson_append_string (MongoBson   *bson,
+                          const gchar *key,
+                          const gchar *value)
+{
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+   g_return_if_fail(g_utf8_validate(value, -1, NULL));
+
+   value = value ? value : "";
+   mongo_bson_append_string_value(bson, MONGO_BSON_UTF8, key, value);
+}
+
+/**
+ * mongo_bson_append_string_bytes:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ * @bytes: (in): A #GBytes containing UTF-8 without a trailing nul byte.
+ *
+ * Stores the string contained in @bytes in the document under @key. As
+ * with mongo_bson_append_binary_bytes(), large values are referenced
+ * rather than copied.
+ */
+void
+mongo_bson_append_string_bytes (MongoBson   *bson,
+                                const gchar *key,
+                                GBytes      *bytes)
+{
+   static const guint8 trailing = 0;
+   gconstpointer data;
+   gint32 value_len;
+   gsize length;
+
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+   g_return_if_fail(bytes != NULL);
+
+   data = g_bytes_get_data(bytes, &length);
+
+   g_return_if_fail(length < G_MAXINT32 - 5);
+   g_return_if_fail(!length || g_utf8_validate(data, length, NULL));
+
+   value_len = GINT_TO_LE(length + 1);
+
+   mongo_bson_append_external(bson, MONGO_BSON_UTF8, key,
+                              (const guint8 *)&value_len, sizeof value_len,
+                              bytes, &trailing, 1);
+}
+
+/**
+ * mongo_bson_append_symbol:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ * @value: (in): A string containing the symbol.
+ *
+ * Appends a deprecated %MONGO_BSON_SYMBOL under @key. This exists so that
+ * documents received from the server can be written back unchanged.
+ */
+void
+mongo_bson_append_symbol (MongoBson   *bson,
+                          const gchar *key,
+                          const gchar *value)
+{
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+   g_return_if_fail(value != NULL);
+   g_return_if_fail(g_utf8_validate(value, -1, NULL));
+
+   mongo_bson_append_string_value(bson, MONGO_BSON_SYMBOL, key, value);
+}
+
+/**
+ * mongo_bson_append_timestamp:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ * @timestamp: (in): Seconds since the UNIX epoch.
+ * @increment: (in): The ordinal of the operation within @timestamp.
+ *
+ * Appends a %MONGO_BSON_TIMESTAMP under @key. These are used internally
+ * by MongoDB, most notably for the "ts" field of oplog entries.
+ */
+void
+mongo_bson_append_timestamp (MongoBson   *bson,
+                             const gchar *key,
+                             guint32      timestamp,
+                             guint32      increment)
+{
+   guint64 value;
+
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+
+   value = GUINT64_TO_LE(((guint64)timestamp << 32) | increment);
+   mongo_bson_append(bson, MONGO_BSON_TIMESTAMP, key,
+                     (const guint8 *)&value, sizeof value, NULL, 0);
+}
+
+/**
+ * mongo_bson_append_timeval:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ * @value: (in): A #GTimeVal containing the date and time.
+ *
+ * Appends the date and time represented by @value up to milliseconds.
+ * The value is stored in the document under @key.
+ *
+ * See also: mongo_bson_append_date_time().
+ */
+void
+mongo_bson_append_timeval (MongoBson   *bson,
+                           const gchar *key,
+                           GTimeVal    *value)
+{
+   guint64 msec;
+
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+   g_return_if_fail(value != NULL);
+
+   msec = (value->tv_sec * 1000) + (value->tv_usec / 1000);
+   mongo_bson_append(bson, MONGO_BSON_DATE_TIME, key,
+                     (const guint8 *)&msec, sizeof msec,
+                     NULL, 0);
+}
+
+/**
+ * mongo_bson_append_undefined:
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A string containing the key.
+ *
+ * Appends a javascript "undefined" value in the document under @key.
+ */
+void
+mongo_bson_append_undefined (MongoBson   *bson,
+                             const gchar *key)
+{
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+
+   mongo_bson_append(bson, MONGO_BSON_UNDEFINED, key,
+                     NULL, 0, NULL, 0);
+}
+
+/**
+ * mongo_bson_iter_init:
+ * @iter: an uninitialized #MongoBsonIter.
+ * @bson: a #MongoBson.
+ *
+ * Initializes a #MongoBsonIter for iterating through a #MongoBson document.
+ */
+void
+mongo_bson_iter_init (MongoBsonIter *iter,
+                      MongoBson     *bson)
+{
+   const guint8 *data;
+   gsize length;
+
+   g_return_if_fail(iter != NULL);
+   g_return_if_fail(bson != NULL);
+
+   data = mongo_bson_get_buffer(bson, &length);
+
+   memset(iter, 0, sizeof *iter);
+   iter->user_data1 = (gpointer)data;
+   iter->user_data2 = GSIZE_TO_POINTER(length);
+   iter->user_data3 = GINT_TO_POINTER(4); /* Skip document length */
+}
+
+/**
+ * mongo_bson_iter_find:
+ * @iter: (in): A #MongoBsonIter.
+ * @key: (in): A key to find in the BSON document.
+ *
+ * Iterates through all upcoming keys in a #MongoBsonIter until @key is
+ * found or the end of the document has been reached.
+ *
+ * Returns: %TRUE if @key was found, otherwise %FALSE.
+ */
+gboolean
+mongo_bson_iter_find (MongoBsonIter *iter,
+                      const gchar   *key)
+{
+   g_return_val_if_fail(iter != NULL, FALSE);
+   g_return_val_if_fail(key != NULL, FALSE);
+
+   while (mongo_bson_iter_next(iter)){
+      if (!g_strcmp0(key, mongo_bson_iter_get_key(iter))) {
+         return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
+/**
+ * mongo_bson_iter_get_key:
+ * @iter: (in): A #MongoBsonIter.
+ *
+ * Fetches the key currently pointed to by @iter.
+ *
+ * Returns: A string containing the key.
+ */
+const gchar *
+mongo_bson_iter_get_key (MongoBsonIter *iter)
+{
+   g_return_val_if_fail(iter != NULL, NULL);
+   return (const gchar *)iter->user_data4;
+}
+
+static MongoBson *
+mongo_bson_iter_get_value_document (MongoBsonIter *iter,
+                                    MongoBsonType  type)
+{
+   const guint8 *buffer;
+   guint32 array_len;
+
+   g_return_val_if_fail(iter != NULL, NULL);
+   g_return_val_if_fail(iter->user_data1 != NULL, NULL);
+   g_return_val_if_fail(iter->user_data2 != NULL, NULL);
+   g_return_val_if_fail(iter->user_data6 != NULL, NULL);
+   g_return_val_if_fail((type == MONGO_BSON_ARRAY) ||
+                        (type == MONGO_BSON_DOCUMENT), NULL);
+
+   if (G_LIKELY(ITER_IS_TYPE(iter, type))) {
+      /*
+       * mongo_bson_iter_next() has already verified that the document
+       * fits within the parent buffer.
+       */
+      buffer = iter->user_data6;
+      memcpy(&array_len, buffer, sizeof array_len);
+      array_len = GINT_FROM_LE(array_len);
+      return mongo_bson_new_from_data(buffer, array_len);
+   }
+
+   if (type == MONGO_BSON_ARRAY) {
+      g_warning("Current key is not an array.");
+   } else if (type == MONGO_BSON_DOCUMENT) {
+      g_warning("Current key is not a document.");
+   } else {
+      g_assert_not_reached();
+   }
+
+   return NULL;
+}
+
+/**
+ * mongo_bson_iter_get_value_array:
+ * @iter: (in): A #MongoBsonIter.
+ *
+ * Fetches the array document current pointed to by @iter. This makes a
+ * copy of the document and returns a new #MongoBson instance. For more
+ * optimized cases, you may want to use mongo_bson_iter_recurse() to avoid
+ * copying the memory if only iteration is needed.
+ *
+ * Returns: (transfer full): A #MongoBson.
+ */
+MongoBson *
+mongo_bson_iter_get_value_array (MongoBsonIter *iter)
+{
+   return mongo_bson_iter_get_value_document(iter, MONGO_BSON_ARRAY);
+}
+
+/**
+ * mongo_bson_iter_get_value_binary:
+ * @iter: (in): A #MongoBsonIter.
+ * @subtype: (out) (allow-none): A location for the #MongoBsonBinarySubtype.
+ * @length: (out): A location for the length of the value.
+ *
+ * Fetches the current value pointed to by @iter if it is a
+ * %MONGO_BSON_BINARY. The result points into the document rather than
+ * being a copy, so it is only valid as long as the document is. Values of
+ * subtype %MONGO_BSON_BINARY_OLD are returned as stored, including their
+ * inner length prefix.
+ *
+ * Returns: (array length=length): The bytes of the value.
+ */
+const guint8 *
+mongo_bson_iter_get_value_binary (MongoBsonIter          *iter,
+                                  MongoBsonBinarySubtype *subtype,
+                                  gsize                  *length)
+{
+   gint32 real_length;
+
+   g_return_val_if_fail(iter != NULL, NULL);
+   g_return_val_if_fail(length != NULL, NULL);
+
+   *length = 0;
+
+   if (ITER_IS_TYPE(iter, MONGO_BSON_BINARY)) {
+      memcpy(&real_length, iter->user_data6, sizeof real_length);
+      *length = GINT32_FROM_LE(real_length);
+      if (subtype) {
+         *subtype = ((const guint8 *)iter->user_data6)[4];
+      }
+      return iter->user_data7;
+   }
+
+   g_warning("Current value is not a binary.");
+
+   return NULL;
+}
+
+/**
+ * mongo_bson_iter_get_value_array:
+ * @iter: (in): A #MongoBsonIter.
+ *
+ * Fetches the current value pointed to by the iterator, expecting it to
+ * be a boolean.
+ *
+ * Returns: The current value.
+ */
+gboolean
+mongo_bson_iter_get_value_boolean (MongoBsonIter *iter)
+{
+   guint8 b;
+
+   g_return_val_if_fail(iter != NULL, 0);
+   g_return_val_if_fail(iter->user_data6 != NULL, 0);
+
+   if (ITER_IS_TYPE(iter, MONGO_BSON_BOOLEAN)) {
+      memcpy(&b, iter->user_data6, sizeof b);
+      return !!b;
+   }
+
+   g_warning("Current key is not a boolean.");
+
+   return FALSE;
+}
+
+/**
+ * mongo_bson_iter_get_value_bson:
+ * @iter: (in): A #MongoBsonIter.
+ *
+ * Fetches the current value pointed to by @iter if it is a
+ * %MONGO_BSON_DOCUMENT. The document is copied and returned as a new
+ * #MongoBson instance. If you simply need to iterate the child document,
+ * you may want to use mongo_bson_iter_recurse().
+ *
+ * Returns: A #MongoBson if successful; otherwise %NULL.
+ */
+MongoBson *
+mongo_bson_iter_get_value_bson (MongoBsonIter *iter)
+{
+   return mongo_bson_iter_get_value_document(iter, MONGO_BSON_DOCUMENT);
+}
+
+/**
+ * mongo_bson_iter_get_value_date_time:
+ * @iter: (in): A #MongoBsonIter.
+ *
+ * Fetches a #GDateTime for the current value pointed to by @iter.
+ *
+ * Returns: A new #GDateTime which should be freed with g_date_time_unref().
+ */
+GDateTime *
+mongo_bson_iter_get_value_date_time (MongoBsonIter *iter)
+{
+   GTimeVal tv;
+
+   g_return_val_if_fail(iter != NULL, NULL);
+
+   mongo_bson_iter_get_value_timeval(iter, &tv);
+   return g_date_time_new_from_timeval_utc(&tv);
+}
+
+/**
+ * mongo_bson_iter_get_value_dbpointer:
+ * @iter: (in): A #MongoBsonIter.
+ * @collection: (out) (allow-none): A location for the namespace.
+ * @object_id: (out) (allow-none): A location for the #MongoObjectId.
+ *
+ * Fetches the current value pointed to by @iter if it is a
+ * %MONGO_BSON_DBPOINTER. @collection points into the document.
+ */
+void
+mongo_bson_iter_get_value_dbpointer (MongoBsonIter  *iter,
+                                     const gchar   **collection,
+                                     MongoObjectId  *object_id)
+{
+   g_return_if_fail(iter != NULL);
+
+   if (ITER_IS_TYPE(iter, MONGO_BSON_DBPOINTER)) {
+      if (collection) {
+         *collection = (const gchar *)iter->user_data6 + 4;
+      }
+      if (object_id) {
+         mongo_object_id_init_from_data(object_id, iter->user_data7);
+      }
+      return;
+   }
+
+   g_warning("Current value is not a DBPointer.");
+}
+
+/**
+ * mongo_bson_iter_get_value_decimal128:
+ * @iter: (in): A #MongoBsonIter.
+ * @value: (out): A location for a #MongoDecimal128.
+ *
+ * Fetches the current value pointed to by @iter if it is a
+ * %MONGO_BSON_DECIMAL128.
+ */
+void
+mongo_bson_iter_get_value_decimal128 (MongoBsonIter   *iter,
+                                      MongoDecimal128 *value)
+{
+   g_return_if_fail(iter != NULL);
+   g_return_if_fail(value != NULL);
+
+   if (ITER_IS_TYPE(iter, MONGO_BSON_DECIMAL128)) {
+      mongo_decimal128_init_from_data(value, iter->user_data6);
+      return;
+   }
+
+   g_warning("Current value is not a Decimal128.");
+}
+
+/**
+ * mongo_bson_iter_get_value_double:
+ * @iter: (in): A #MongoBsonIter.
+ *
+ * Fetches the current value pointed to by @iter if it is a
+ * %MONGO_BSON_DOUBLE.
+ *
+ * Returns: A #gdouble.
+ */
+gdouble
+mongo_bson_iter_get_value_double (MongoBsonIter *iter)
+{
+   gdouble value;
+
+   g_return_val_if_fail(iter != NULL, 0);
+   g_return_val_if_fail(iter->user_data6 != NULL, 0);
+
+   if (ITER_IS_TYPE(iter, MONGO_BSON_DOUBLE)) {
+      memcpy(&value, iter->user_data6, sizeof value);
+      return value;
+   }
+
+   g_warning("Current value is not a double.");
+
+   return 0.0;
+}
+
+/**
+ * mongo_bson_iter_get_value_object_id:
+ * @iter: (in): A #MongoBsonIter.
+ *
+ * Fetches the current value pointed to by @iter if it is a
+ * %MONGO_BSON_OBJECT_ID. The resulting #MongoObjectId should be freed
+ * with mongo_object_id_free().
+ *
+ * Returns: (transfer full): A #MongoObjectId.
+ */
+MongoObjectId *
+mongo_bson_iter_get_value_object_id (MongoBsonIter *iter)
+{
+   g_return_val_if_fail(iter != NULL, NULL);
+   g_return_val_if_fail(iter->user_data6 != NULL, NULL);
+
+   if (ITER_IS_TYPE(iter, MONGO_BSON_OBJECT_ID)) {
+      return mongo_object_id_new_from_data(iter->user_data6);
+   }
+
+   g_warning("Current value is not an ObjectId.");
+
+   return NULL;
+}
+
+/**
+ * mongo_bson_iter_get_value_int:
+ * @iter: (in): A #MongoBsonIter.
+ *
+ * Fetches the current value pointed to by @iter if it is a
+ * %MONGO_BSON_INT32.
+ *
+ * Returns: A #gint32 containing the value.
+ */
+gint32
+mongo_bson_iter_get_value_int (MongoBsonIter *iter)
+{
+   gint32 value;
+
+   g_return_val_if_fail(iter != NULL, 0);
+   g_return_val_if_fail(iter->user_data6 != NULL, 0);
+
+   if (ITER_IS_TYPE(iter, MONGO_BSON_INT32)) {
+      memcpy(&value, iter->user_data6, sizeof value);
+      return GINT_FROM_LE(value);
+   }
+
+   g_warning("Current value is not an int32.");
+
+   return 0;
+}
+
+/**
+ * mongo_bson_iter_get_value_int64:
+ * @iter: (in): A #MongoBsonIter.
+ *
+ * Fetches the current value pointed to by @iter if it is a
+ * %MONGO_BSON_INT64.
+ *
+ * Returns: A #gint64.
+ */
+gint64
+mongo_bson_iter_get_value_int64 (MongoBsonIter *iter)
+{
+   gint64 value;
+
+   g_return_val_if_fail(iter != NULL, 0L);
+   g_return_val_if_fail(iter->user_data6 != NULL, 0L);
+
+   if (ITER_IS_TYPE(iter, MONGO_BSON_INT64)) {
+      memcpy(&value, iter->user_data6, sizeof value);
+      return GINT64_FROM_LE(value);
+   }
+
+   g_warning("Current value is not an int64.");
+
+   return 0L;
+}
+
+/**
+ * mongo_bson_iter_get_value_javascript:
+ * @iter: (in): A #MongoBsonIter.
+ * @length: (out) (allow-none): The length of the resulting string.
+ *
+ * Fetches the code of the current value pointed to by @iter if it is a
+ * %MONGO_BSON_JAVASCRIPT or %MONGO_BSON_JAVASCRIPT_WITH_SCOPE. As with
+ * mongo_bson_iter_get_value_string(), @length includes the trailing nul
+ * byte.
+ *
+ * Returns: A string which should not be modified or freed.
+ */
+const gchar *
+mongo_bson_iter_get_value_javascript (MongoBsonIter *iter,
+                                      gsize         *length)
+{
+   const guint8 *value;
+   gint32 real_length;
+
+   g_return_val_if_fail(iter != NULL, NULL);
+
+   if (ITER_IS_TYPE(iter, MONGO_BSON_JAVASCRIPT) ||
+       ITER_IS_TYPE(iter, MONGO_BSON_JAVASCRIPT_WITH_SCOPE)) {
+      value = ITER_IS_TYPE(iter, MONGO_BSON_JAVASCRIPT) ?
+              iter->user_data6 : iter->user_data7;
+      if (length) {
+         memcpy(&real_length, value, sizeof real_length);
+         *length = GINT_FROM_LE(real_length);
+      }
+      return (const gchar *)value + 4;
+   }
+
+   g_warning("Current value is not JavaScript.");
+
+   return NULL;
+}
+
+/**
+ * mongo_bson_iter_get_value_javascript_scope:
+ * @iter: (in): A #MongoBsonIter.
+ *
+ * Fetches a copy of the scope of the current value pointed to by @iter
+ * if it is a %MONGO_BSON_JAVASCRIPT_WITH_SCOPE.
+ *
+ * Returns: A #MongoBson if successful; otherwise %NULL.
+ */
+MongoBson *
+mongo_bson_iter_get_value_javascript_scope (MongoBsonIter *iter)
+{
+   const guint8 *scope;
+   gint32 code_len;
+   gint32 scope_len;
+
+   g_return_val_if_fail(iter != NULL, NULL);
+
+   if (ITER_IS_TYPE(iter, MONGO_BSON_JAVASCRIPT_WITH_SCOPE)) {
+      memcpy(&code_len, iter->user_data7, sizeof code_len);
+      scope = (const guint8 *)iter->user_data7 + 4 + GINT32_FROM_LE(code_len);
+      memcpy(&scope_len, scope, sizeof scope_len);
+      return mongo_bson_new_from_data(scope, GINT32_FROM_LE(scope_len));
+   }
+
+   g_warning("Current value is not JavaScript with scope.");
+
+   return NULL;
+}
+
+/**
+ * mongo_bson_iter_get_value_regex:
+ * @iter: (in): A #MongoBsonIter.
+ * @regex: (out) (allow-none) (transfer none): A location for a string containing the regex.
+ * @options: (out) (allow-none) (transfer none): A location for a string containing the options.
+ *
+ * Fetches the current value pointed to by @iter if it is a regex. The values
+ * MUST NOT be modified or freed.
+ */
+void
+mongo_bson_iter_get_value_regex (MongoBsonIter  *iter,
+                                 const gchar   **regex,
+                                 const gchar   **options)
+{
+   g_return_if_fail(iter != NULL);
+
+   if (ITER_IS_TYPE(iter, MONGO_BSON_REGEX)) {
+      if (regex) {
+         *regex = iter->user_data6;
+      }
+      if (options) {
+         *options = iter->user_data7;
+      }
+      return;
+   }
+
+   g_warning("Current value is not a Regex.");
+}
+
+/**
+ * mongo_bson_iter_get_value_string:
+ * @iter: (in): A #MongoBsonIter.
+ * @length: (out) (allow-none): The length of the resulting string.
+ *
+ * Fetches the current value pointed to by @iter if it is a
+ * %MONGO_BSON_UTF8. If @length is not %NULL, then the length of the
+ * string will be stored in the location pointed to by @length.
+ *
+ * Returns: A string which should not be modified or freed.
+ */
+const gchar *
+mongo_bson_iter_get_value_string (MongoBsonIter *iter,
+                                  gsize         *length)
+{
+   gint32 real_length;
+
+   g_return_val_if_fail(iter != NULL, NULL);
+   g_return_val_if_fail(iter->user_data6 != NULL, NULL);
+   g_return_val_if_fail(iter->user_data7 != NULL, NULL);
+
+   if (ITER_IS_TYPE(iter, MONGO_BSON_UTF8)) {
+      if (length) {
+         memcpy(&real_length, iter->user_data6, sizeof real_length);
+         *length = GINT_FROM_LE(real_length);
+      }
+      return iter->user_data7;
+   }
+
+   g_warning("Current value is not a String");
+
+   return NULL;
+}
+
+/**
+ * mongo_bson_iter_get_value_symbol:
+ * @iter: (in): A #MongoBsonIter.
+ * @length: (out) (allow-none): The length of the resulting string.
+ *
+ * Fetches the current value pointed to by @iter if it is a
+ * %MONGO_BSON_SYMBOL. As with mongo_bson_iter_get_value_string(),
+ * @length includes the trailing nul byte.
+ *
+ * Returns: A string which should not be modified or freed.
+ */
+const gchar *
+mongo_bson_iter_get_value_symbol (MongoBsonIter *iter,
+                                  gsize         *length)
+{
+   gint32 real_length;
+
+   g_return_val_if_fail(iter != NULL, NULL);
+
+   if (ITER_IS_TYPE(iter, MONGO_BSON_SYMBOL)) {
+      if (length) {
+         memcpy(&real_length, iter->user_data6, sizeof real_length);
+         *length = GINT_FROM_LE(real_length);
+      }
+      return iter->user_data7;
+   }
+
+   g_warning("Current value is not a Symbol.");
+
+   return NULL;
+}
+
+/**
+ * mongo_bson_iter_get_value_timestamp:
+ * @iter: (in): A #MongoBsonIter.
+ * @timestamp: (out) (allow-none): A location for the seconds.
+ * @increment: (out) (allow-none): A location for the increment.
+ *
+ * Fetches the current value pointed to by @iter if it is a
+ * %MONGO_BSON_TIMESTAMP.
+ */
+void
+mongo_bson_iter_get_value_timestamp (MongoBsonIter *iter,
+                                     guint32       *timestamp,
+                                     guint32       *increment)
+{
+   guint64 value;
+
+   g_return_if_fail(iter != NULL);
+
+   if (ITER_IS_TYPE(iter, MONGO_BSON_TIMESTAMP)) {
+      memcpy(&value, iter->user_data6, sizeof value);
+      value = GUINT64_FROM_LE(value);
+      if (timestamp) {
+         *timestamp = (guint32)(value >> 32);
+      }
+      if (increment) {
+         *increment = (guint32)value;
+      }
+      return;
+   }
+
+   g_warning("Current value is not a Timestamp.");
+}
+
+/**
+ * mongo_bson_iter_get_value_timeval:
+ * @iter: (in): A #MongoBsonIter.
+ * @value: (out): A location for a #GTimeVal.
+ *
+ * Fetches the current value pointed to by @iter as a #GTimeVal if the type
+ * is a %MONGO_BSON_DATE_TIME.
+ */
+void
+mongo_bson_iter_get_value_timeval (MongoBsonIter *iter,
+                                   GTimeVal      *value)
+{
+   gint64 v_int64;
+
+   g_return_if_fail(iter != NULL);
+   g_return_if_fail(value != NULL);
+
+   if (ITER_IS_TYPE(iter, MONGO_BSON_DATE_TIME)) {
+      memcpy(&v_int64, iter->user_data6, sizeof v_int64);
+      v_int64 = GINT64_FROM_LE(v_int64);
+      value->tv_sec = v_int64 / 1000;
+      value->tv_usec = v_int64 % 1000;
       return;
    }
 
-   g_warning("Current value is not a Regex.");
+   g_warning("Current value is not a DateTime");
+}
+
+/**
+ * mongo_bson_iter_get_value_type:
+ * @iter: (in): A #MongoBsonIter.
+ *
+ * Fetches the #MongoBsonType currently pointed to by @iter.
+ *
+ * Returns: A #MongoBsonType.
+ */
+MongoBsonType
+mongo_bson_iter_get_value_type (MongoBsonIter *iter)
+{
+   MongoBsonType type;
+
+   g_return_val_if_fail(iter != NULL, 0);
+   g_return_val_if_fail(iter->user_data5 != NULL, 0);
+
+   type = GPOINTER_TO_INT(iter->user_data5);
+
+   switch (type) {
+   case MONGO_BSON_DOUBLE:
+   case MONGO_BSON_UTF8:
+   case MONGO_BSON_DOCUMENT:
+   case MONGO_BSON_ARRAY:
+   case MONGO_BSON_BINARY:
+   case MONGO_BSON_UNDEFINED:
+   case MONGO_BSON_OBJECT_ID:
+   case MONGO_BSON_BOOLEAN:
+   case MONGO_BSON_DATE_TIME:
+   case MONGO_BSON_NULL:
+   case MONGO_BSON_REGEX:
+   case MONGO_BSON_DBPOINTER:
+   case MONGO_BSON_JAVASCRIPT:
+   case MONGO_BSON_SYMBOL:
+   case MONGO_BSON_JAVASCRIPT_WITH_SCOPE:
+   case MONGO_BSON_INT32:
+   case MONGO_BSON_TIMESTAMP:
+   case MONGO_BSON_INT64:
+   case MONGO_BSON_DECIMAL128:
+   case MONGO_BSON_MAX_KEY:
+   case MONGO_BSON_MIN_KEY:
+      return type;
+   default:
+      g_warning("Unknown BSON type 0x%02x", type);
+      return 0;
+   }
+}
+
+/**
+ * mongo_bson_iter_recurse:
+ * @iter: (in): A #MongoBsonIter.
+ * @child: (out): A #MongoBsonIter.
+ *
+ * Recurses into the child BSON document found at the key currently observed
+ * by the #MongoBsonIter. The @child #MongoBsonIter is initialized.
+ *
+ * Returns: %TRUE if @child is initialized; otherwise %FALSE.
+ */
+gboolean
+mongo_bson_iter_recurse (MongoBsonIter *iter,
+                         MongoBsonIter *child)
+{
+   gint32 buflen;
+
+   g_return_val_if_fail(iter != NULL, FALSE);
+   g_return_val_if_fail(iter != NULL, FALSE);
+   g_return_val_if_fail(child != NULL, FALSE);
+
+   if (ITER_IS_TYPE(iter, MONGO_BSON_ARRAY) ||
+       ITER_IS_TYPE(iter, MONGO_BSON_DOCUMENT)) {
+      memset(child, 0, sizeof *child);
+      memcpy(&buflen, iter->user_data6, sizeof buflen);
+      child->user_data1 = iter->user_data6;
+      child->user_data2 = GINT_TO_POINTER(GINT_FROM_LE(buflen));
+      child->user_data3 = GINT_TO_POINTER(4); /* Skip document length */
+      return TRUE;
+   }
+
+   g_warning("Current value is not a BSON document or array.");
+
+   return FALSE;
+}
+
+/**
+ * mongo_bson_next_element:
+ * @rawbuf: (in): The raw BSON document.
+ * @rawbuf_len: (in): The length of @rawbuf.
+ * @offset: (inout): The offset of the element to read.
+ * @key: (out): A location for the key.
+ * @type: (out): A location for the element type.
+ * @value1: (out): A location for the first chunk of the value.
+ * @value2: (out): A location for the second chunk of the value.
+ *
+ * Reads the element found at @offset within @rawbuf and validates that it
+ * fits within the document. On success, @offset is advanced to the start
+ * of the following element.
+ *
+ * This is shared by #MongoBsonIter and #MongoBsonRawIter.
+ *
+ * Returns: %TRUE if an element was read; otherwise %FALSE.
+ */
+static inline gboolean
+mongo_bson_next_element (const guint8  *rawbuf,
+                         gsize          rawbuf_len,
+                         gsize         *offset,
+                         const gchar  **key,
+                         guint8        *type,
+                         const guint8 **value1,
+                         const guint8 **value2)
+{
+   const guint8 *nul;
+   gsize remaining;
+   gsize o = *offset;
+   gint32 scope_len;
+   gint32 code_len;
+   gint32 len;
+
+   /*
+    * The last byte of the document is the trailing nul, there must be at
+    * least a type byte before it.
+    */
+   if ((o + 1) >= rawbuf_len) {
+      return FALSE;
+   }
+
+   /*
+    * Get the type of the next field.
+    */
+   if (!(*type = rawbuf[o++])) {
+      return FALSE;
+   }
+
+   /*
+    * Get the key of the next field.
+    */
+   *key = (const gchar *)&rawbuf[o];
+   if (!(nul = memchr(*key, '\0', rawbuf_len - o - 1))) {
+      return FALSE;
+   }
+   if (!g_utf8_validate(*key, nul - &rawbuf[o], NULL)) {
+      return FALSE;
+   }
+   o = (nul - rawbuf) + 1;
+
+   /*
+    * Number of bytes available for the value, not including the trailing
+    * nul byte of the document.
+    */
+   if (o >= rawbuf_len) {
+      return FALSE;
+   }
+   remaining = rawbuf_len - o - 1;
+
+   switch ((MongoBsonType)*type) {
+   case MONGO_BSON_UTF8:
+   case MONGO_BSON_JAVASCRIPT:
+   case MONGO_BSON_SYMBOL:
+      if (remaining >= 5) {
+         memcpy(&len, &rawbuf[o], sizeof len);
+         len = GINT32_FROM_LE(len);
+         if ((len > 0) && ((gsize)len <= (remaining - 4))) {
+            *value1 = &rawbuf[o];
+            *value2 = &rawbuf[o + 4];
+            if (!(*value2)[len - 1] &&
+                g_utf8_validate((const gchar *)*value2, len - 1, NULL)) {
+               o += 4 + len;
+               GOTO(success);
+            }
+         }
+      }
+      GOTO(failure);
+   case MONGO_BSON_DOCUMENT:
+   case MONGO_BSON_ARRAY:
+      if (remaining >= 5) {
+         memcpy(&len, &rawbuf[o], sizeof len);
+         len = GINT32_FROM_LE(len);
+         if ((len >= 5) && ((gsize)len <= remaining) && !rawbuf[o + len - 1]) {
+            *value1 = &rawbuf[o];
+            *value2 = NULL;
+            o += len;
+            GOTO(success);
+         }
+      }
+      GOTO(failure);
+   case MONGO_BSON_BINARY:
+      if (remaining >= 5) {
+         memcpy(&len, &rawbuf[o], sizeof len);
+         len = GINT32_FROM_LE(len);
+         if ((len >= 0) && ((gsize)len <= (remaining - 5))) {
+            *value1 = &rawbuf[o];
+            *value2 = &rawbuf[o + 5];
+            o += 5 + len;
+            GOTO(success);
+         }
+      }
+      GOTO(failure);
+   case MONGO_BSON_DBPOINTER:
+      if (remaining >= 17) {
+         memcpy(&len, &rawbuf[o], sizeof len);
+         len = GINT32_FROM_LE(len);
+         if ((len > 0) && ((gsize)len <= (remaining - 16))) {
+            *value1 = &rawbuf[o];
+            *value2 = &rawbuf[o + 4 + len];
+            if (!rawbuf[o + 3 + len] &&
+                g_utf8_validate((const gchar *)&rawbuf[o + 4], len - 1, NULL)) {
+               o += 4 + len + 12;
+               GOTO(success);
+            }
+         }
+      }
+      GOTO(failure);
+   case MONGO_BSON_JAVASCRIPT_WITH_SCOPE:
+      /*
+       * The total length, the code as a string and the scope document,
+       * whose length must account for the rest of the value.
+       */
+      if (remaining >= 14) {
+         memcpy(&len, &rawbuf[o], sizeof len);
+         len = GINT32_FROM_LE(len);
+         memcpy(&code_len, &rawbuf[o + 4], sizeof code_len);
+         code_len = GINT32_FROM_LE(code_len);
+         if ((len >= 14) && ((gsize)len <= remaining) &&
+             (code_len > 0) && (code_len <= (len - 13))) {
+            *value1 = &rawbuf[o];
+            *value2 = &rawbuf[o + 4];
+            memcpy(&scope_len, &rawbuf[o + 8 + code_len], sizeof scope_len);
+            scope_len = GINT32_FROM_LE(scope_len);
+            if ((scope_len == (len - 8 - code_len)) &&
+                !rawbuf[o + len - 1] &&
+                !rawbuf[o + 7 + code_len] &&
+                g_utf8_validate((const gchar *)&rawbuf[o + 8],
+                                code_len - 1, NULL)) {
+               o += len;
+               GOTO(success);
+            }
+         }
+      }
+      GOTO(failure);
+   case MONGO_BSON_NULL:
+   case MONGO_BSON_UNDEFINED:
+   case MONGO_BSON_MAX_KEY:
+   case MONGO_BSON_MIN_KEY:
+      *value1 = NULL;
+      *value2 = NULL;
+      GOTO(success);
+   case MONGO_BSON_OBJECT_ID:
+      if (remaining >= 12) {
+         *value1 = &rawbuf[o];
+         *value2 = NULL;
+         o += 12;
+         GOTO(success);
+      }
+      GOTO(failure);
+   case MONGO_BSON_BOOLEAN:
+      if (remaining >= 1) {
+         *value1 = &rawbuf[o];
+         *value2 = NULL;
+         o += 1;
+         GOTO(success);
+      }
+      GOTO(failure);
+   case MONGO_BSON_DATE_TIME:
+   case MONGO_BSON_DOUBLE:
+   case MONGO_BSON_INT64:
+   case MONGO_BSON_TIMESTAMP:
+      if (remaining >= 8) {
+         *value1 = &rawbuf[o];
+         *value2 = NULL;
+         o += 8;
+         GOTO(success);
+      }
+      GOTO(failure);
+   case MONGO_BSON_DECIMAL128:
+      if (remaining >= 16) {
+         *value1 = &rawbuf[o];
+         *value2 = NULL;
+         o += 16;
+         GOTO(success);
+      }
+      GOTO(failure);
+   case MONGO_BSON_REGEX:
+      *value1 = &rawbuf[o];
+      if (!(nul = memchr(*value1, '\0', remaining)) ||
+          !g_utf8_validate((const gchar *)*value1, nul - *value1, NULL)) {
+         GOTO(failure);
+      }
+      o = (nul - rawbuf) + 1;
+      remaining = rawbuf_len - o - 1;
+      *value2 = &rawbuf[o];
+      if (!(nul = memchr(*value2, '\0', remaining)) ||
+          !g_utf8_validate((const gchar *)*value2, nul - *value2, NULL)) {
+         GOTO(failure);
+      }
+      o = (nul - rawbuf) + 1;
+      GOTO(success);
+   case MONGO_BSON_INT32:
+      if (remaining >= 4) {
+         *value1 = &rawbuf[o];
+         *value2 = NULL;
+         o += 4;
+         GOTO(success);
+      }
+      GOTO(failure);
+   default:
+      GOTO(failure);
+   }
+
+success:
+   *offset = o;
+   return TRUE;
+
+failure:
+   return FALSE;
+}
+
+/**
+ * mongo_bson_iter_next:
+ * @iter: (in): A #MongoBsonIter.
+ *
+ * Advances @iter to the next field in the document.
+ *
+ * Returns: %TRUE if @iter now points at a field; %FALSE at the end of the
+ *   document or if the document is malformed.
+ */
+gboolean
+mongo_bson_iter_next (MongoBsonIter *iter)
+{
+   const guint8 *value1 = NULL;
+   const guint8 *value2 = NULL;
+   const gchar *key = NULL;
+   gsize offset;
+   guint8 type = 0;
+
+   g_return_val_if_fail(iter != NULL, FALSE);
+
+   offset = GPOINTER_TO_SIZE(iter->user_data3);
+
+   if (!mongo_bson_next_element(iter->user_data1,
+                                GPOINTER_TO_SIZE(iter->user_data2),
+                                &offset, &key, &type, &value1, &value2)) {
+      memset(iter, 0, sizeof *iter);
+      return FALSE;
+   }
+
+   iter->user_data3 = GSIZE_TO_POINTER(offset);
+   iter->user_data4 = (gpointer)key;
+   iter->user_data5 = GINT_TO_POINTER(type);
+   iter->user_data6 = (gpointer)value1;
+   iter->user_data7 = (gpointer)value2;
+
+   return TRUE;
+}
+
+static inline gboolean
+mongo_bson_array_element_ok (const guint8 *p,
+                             guint8        type,
+                             guint         width)
+{
+   guint k;
+
+   if ((p[0] != type) || p[1 + width]) {
+      return FALSE;
+   }
+
+   /*
+    * The key must be exactly @width ASCII bytes so that it is valid UTF-8.
+    */
+   for (k = 1; k <= width; k++) {
+      if ((guint8)(p[k] - 1) >= 0x7F) {
+         return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+/**
+ * mongo_bson_array_stride:
+ * @data: (in): The array document.
+ * @length: (in): The length of @data.
+ * @type: (in): The expected element type.
+ * @size: (in): The size of an element value.
+ * @values: (out): The location for the values.
+ * @n_values: (in): The number of values that fit in @values.
+ * @n_decoded: (out): The number of values that were decoded.
+ *
+ * Decodes the leading elements of an array whose elements all have @type.
+ * Arrays written by the append functions have keys "0", "1", ... so every
+ * element with the same key width has the same size, and the elements can
+ * be decoded by striding over them without looking at each element first.
+ *
+ * Returns: The offset of the first element that was not decoded.
+ */
+static inline gsize
+mongo_bson_array_stride (const guint8 *data,
+                         gsize         length,
+                         guint8        type,
+                         gsize         size,
+                         guint8       *values,
+                         guint         n_values,
+                         guint        *n_decoded)
+{
+   const guint8 *end = data + length - 1;
+   const guint8 *p = data + 4;
+   guint8 *out;
+   gsize stride;
+   guint limit = 10;
+   guint width = 1;
+   guint i = 0;
+   guint n;
+   guint j;
+
+   for (;;) {
+      stride = 2 + width + size;
+      n = MIN(limit, n_values) - i;
+      n = MIN(n, (guint)((end - p) / stride));
+      out = values ? values + (i * size) : NULL;
+
+      for (j = 0; (j + 4) <= n; j += 4) {
+         if (!mongo_bson_array_element_ok(p, type, width) ||
+             !mongo_bson_array_element_ok(p + stride, type, width) ||
+             !mongo_bson_array_element_ok(p + 2 * stride, type, width) ||
+             !mongo_bson_array_element_ok(p + 3 * stride, type, width)) {
+            break;
+         }
+         memcpy(out, p + 2 + width, size);
+         memcpy(out + size, p + stride + 2 + width, size);
+         memcpy(out + 2 * size, p + 2 * stride + 2 + width, size);
+         memcpy(out + 3 * size, p + 3 * stride + 2 + width, size);
+         out += 4 * size;
+         p += 4 * stride;
+      }
+
+      for (; j < n; j++) {
+         if (!mongo_bson_array_element_ok(p, type, width)) {
+            break;
+         }
+         memcpy(out, p + 2 + width, size);
+         out += size;
+         p += stride;
+      }
+
+      i += j;
+
+      if ((i < limit) || (width == 9)) {
+         break;
+      }
+
+      width++;
+      limit *= 10;
+   }
+
+   *n_decoded = i;
+
+   return p - data;
+}
+
+/**
+ * mongo_bson_iter_get_fixed_array:
+ * @iter: (in): A #MongoBsonIter.
+ * @type: (in): %MONGO_BSON_INT32, %MONGO_BSON_INT64 or %MONGO_BSON_DOUBLE.
+ * @values: (out): The location for the values.
+ * @n_values: (in): The number of values that fit in @values.
+ * @n_elements: (out): The location for the number of elements.
+ *
+ * Shared implementation of the typed array getters. Elements are decoded
+ * by mongo_bson_array_stride() as long as the array is homogeneous and
+ * element by element from there on.
+ *
+ * Returns: %TRUE if every element was stored in @values.
+ */
+static gboolean
+mongo_bson_iter_get_fixed_array (MongoBsonIter *iter,
+                                 MongoBsonType  type,
+                                 guint8        *values,
+                                 guint          n_values,
+                                 guint         *n_elements)
+{
+   const guint8 *value1 = NULL;
+   const guint8 *value2 = NULL;
+   const guint8 *data;
+   const gchar *key = NULL;
+   gdouble dvalue = 0.0;
+   gint64 ivalue = 0;
+   gint32 v32;
+   gint32 len;
+   guint8 elem_type = 0;
+   gsize length;
+   gsize offset;
+   gsize size;
+   guint i;
+
+   g_return_val_if_fail(iter != NULL, FALSE);
+   g_return_val_if_fail(values != NULL || !n_values, FALSE);
+   g_return_val_if_fail(n_elements != NULL, FALSE);
+
+   *n_elements = 0;
+
+   if (!ITER_IS_TYPE(iter, MONGO_BSON_ARRAY)) {
+      return FALSE;
+   }
+
+   data = iter->user_data6;
+   memcpy(&len, data, sizeof len);
+   length = GINT32_FROM_LE(len);
+   size = (type == MONGO_BSON_INT32) ? 4 : 8;
+
+   offset = mongo_bson_array_stride(data, length, type, size, values,
+                                    n_values, &i);
+
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+   if (type != MONGO_BSON_DOUBLE) {
+      guint j;
+
+      for (j = 0; j < i; j++) {
+         if (size == 4) {
+            ((gint32 *)values)[j] = GINT32_FROM_LE(((gint32 *)values)[j]);
+         } else {
+            ((gint64 *)values)[j] = GINT64_FROM_LE(((gint64 *)values)[j]);
+         }
+      }
+   }
+#endif
+
+   /*
+    * Whatever is left is either a differently typed element, an element
+    * that does not fit in @values, or a key that is not the array index.
+    */
+   while (mongo_bson_next_element(data, length, &offset, &key, &elem_type,
+                                  &value1, &value2)) {
+      switch ((MongoBsonType)elem_type) {
+      case MONGO_BSON_INT32:
+         memcpy(&v32, value1, sizeof v32);
+         ivalue = GINT32_FROM_LE(v32);
+         dvalue = ivalue;
+         break;
+      case MONGO_BSON_INT64:
+         if (type == MONGO_BSON_INT32) {
+            GOTO(failure);
+         }
+         memcpy(&ivalue, value1, sizeof ivalue);
+         ivalue = GINT64_FROM_LE(ivalue);
+         dvalue = ivalue;
+         /*
+          * A #gdouble holds integers exactly only up to 2^53, refuse
+          * anything that does not survive the round trip.
+          */
+         if ((type == MONGO_BSON_DOUBLE) &&
+             ((dvalue >= 9223372036854775808.0) ||
+              ((gint64)dvalue != ivalue))) {
+            GOTO(failure);
+         }
+         break;
+      case MONGO_BSON_DOUBLE:
+         if (type != MONGO_BSON_DOUBLE) {
+            GOTO(failure);
+         }
+         memcpy(&dvalue, value1, sizeof dvalue);
+         break;
+      case MONGO_BSON_UTF8:
+      case MONGO_BSON_DOCUMENT:
+      case MONGO_BSON_ARRAY:
+      case MONGO_BSON_BINARY:
+      case MONGO_BSON_UNDEFINED:
+      case MONGO_BSON_OBJECT_ID:
+      case MONGO_BSON_BOOLEAN:
+      case MONGO_BSON_DATE_TIME:
+      case MONGO_BSON_NULL:
+      case MONGO_BSON_REGEX:
+      case MONGO_BSON_DBPOINTER:
+      case MONGO_BSON_JAVASCRIPT:
+      case MONGO_BSON_SYMBOL:
+      case MONGO_BSON_JAVASCRIPT_WITH_SCOPE:
+      case MONGO_BSON_TIMESTAMP:
+      case MONGO_BSON_DECIMAL128:
+      case MONGO_BSON_MAX_KEY:
+      case MONGO_BSON_MIN_KEY:
+      default:
+         GOTO(failure);
+      }
+
+      if (i < n_values) {
+         if (type == MONGO_BSON_DOUBLE) {
+            memcpy(values + (i * size), &dvalue, size);
+         } else if (type == MONGO_BSON_INT64) {
+            memcpy(values + (i * size), &ivalue, size);
+         } else {
+            v32 = (gint32)ivalue;
+            memcpy(values + (i * size), &v32, size);
+         }
+      }
+
+      i++;
+   }
+
+   /*
+    * Reading stops at the trailing nul of the array unless it is malformed.
+    */
+   if ((offset + 1) != length) {
+      GOTO(failure);
+   }
+
+   *n_elements = i;
+
+   return (i <= n_values);
+
+failure:
+   *n_elements = i;
+
+   return FALSE;
+}
+
+/**
+ * mongo_bson_iter_get_value_double_array:
+ * @iter: (in): A #MongoBsonIter.
+ * @values: (out) (array length=n_values): A location for the values.
+ * @n_values: (in): The number of values that fit in @values.
+ * @n_elements: (out): A location for the number of elements.
+ *
+ * Decodes the %MONGO_BSON_ARRAY pointed to by @iter into @values in a
+ * single pass. %MONGO_BSON_INT32 and %MONGO_BSON_INT64 elements are
+ * converted to #gdouble, as long as the conversion is exact.
+ *
+ * If the array has more than @n_values elements, only the first @n_values
+ * are stored and @n_elements is set to the length of the array, so the
+ * call can be repeated with a large enough buffer. If an element is not a
+ * number, or is a %MONGO_BSON_INT64 beyond the 2^53 that a #gdouble holds
+ * exactly, @n_elements is set to its index.
+ *
+ * Returns: %TRUE if every element of the array was stored in @values.
+ */
+gboolean
+mongo_bson_iter_get_value_double_array (MongoBsonIter *iter,
+                                        gdouble       *values,
+                                        guint          n_values,
+                                        guint         *n_elements)
+{
+   return mongo_bson_iter_get_fixed_array(iter, MONGO_BSON_DOUBLE,
+                                          (guint8 *)values, n_values,
+                                          n_elements);
+}
+
+/**
+ * mongo_bson_iter_get_value_int_array:
+ * @iter: (in): A #MongoBsonIter.
+ * @values: (out) (array length=n_values): A location for the values.
+ * @n_values: (in): The number of values that fit in @values.
+ * @n_elements: (out): A location for the number of elements.
+ *
+ * Decodes the %MONGO_BSON_ARRAY of %MONGO_BSON_INT32 pointed to by @iter
+ * into @values in a single pass. See
+ * mongo_bson_iter_get_value_double_array() for how @n_elements is set.
+ *
+ * Returns: %TRUE if every element of the array was stored in @values.
+ */
+gboolean
+mongo_bson_iter_get_value_int_array (MongoBsonIter *iter,
+                                     gint32        *values,
+                                     guint          n_values,
+                                     guint         *n_elements)
+{
+   return mongo_bson_iter_get_fixed_array(iter, MONGO_BSON_INT32,
+                                          (guint8 *)values, n_values,
+                                          n_elements);
+}
+
+/**
+ * mongo_bson_iter_get_value_int64_array:
+ * @iter: (in): A #MongoBsonIter.
+ * @values: (out) (array length=n_values): A location for the values.
+ * @n_values: (in): The number of values that fit in @values.
+ * @n_elements: (out): A location for the number of elements.
+ *
+ * Decodes the %MONGO_BSON_ARRAY pointed to by @iter into @values in a
+ * single pass. %MONGO_BSON_INT32 elements are widened to #gint64. See
+ * mongo_bson_iter_get_value_double_array() for how @n_elements is set.
+ *
+ * Returns: %TRUE if every element of the array was stored in @values.
+ */
+gboolean
+mongo_bson_iter_get_value_int64_array (MongoBsonIter *iter,
+                                       gint64        *values,
+                                       guint          n_values,
+                                       guint         *n_elements)
+{
+   return mongo_bson_iter_get_fixed_array(iter, MONGO_BSON_INT64,
+                                          (guint8 *)values, n_values,
+                                          n_elements);
+}
+
+/**
+ * mongo_bson_iter_make_writable:
+ * @iter: (in): A #MongoBsonIter positioned on a value.
+ * @bson: (in): The #MongoBson that @iter is iterating.
+ *
+ * Ensures that @bson owns a contiguous buffer and rebases @iter onto it,
+ * since documents created from static data or read from their contiguous
+ * copy are not modified in place.
+ *
+ * Returns: %TRUE if @iter points into @bson; otherwise %FALSE.
+ */
+static gboolean
+mongo_bson_iter_make_writable (MongoBsonIter *iter,
+                               MongoBson     *bson)
+{
+   const guint8 *data;
+   const guint8 *key;
+   gpointer *pointers[] = {
+      &iter->user_data1,
+      &iter->user_data4,
+      &iter->user_data6,
+      &iter->user_data7,
+   };
+   gsize length;
+   guint i;
+
+   data = mongo_bson_get_buffer(bson, &length);
+   key = iter->user_data4;
+
+   if (!key || (key < data) || (key >= (data + length))) {
+      g_warning("Iterator does not point into the document.");
+      return FALSE;
+   }
+
+   if (G_UNLIKELY(!bson->buf || bson->segments)) {
+      if (bson->segments) {
+         mongo_bson_make_contiguous(bson);
+      } else {
+         mongo_bson_make_writable(bson);
+      }
+      for (i = 0; i < G_N_ELEMENTS(pointers); i++) {
+         if (*pointers[i]) {
+            *pointers[i] = bson->buf->data +
+                           ((const guint8 *)*pointers[i] - data);
+         }
+      }
+   }
+
+   return TRUE;
+}
+
+static gboolean
+mongo_bson_iter_set_fixed (MongoBsonIter *iter,
+                           MongoBson     *bson,
+                           MongoBsonType  type,
+                           gconstpointer  value,
+                           gsize          length)
+{
+   if (!ITER_IS_TYPE(iter, type) ||
+       !mongo_bson_iter_make_writable(iter, bson)) {
+      return FALSE;
+   }
+
+   memcpy(iter->user_data6, value, length);
+
+   return TRUE;
+}
+
+/**
+ * mongo_bson_iter_set_value_boolean:
+ * @iter: (in): A #MongoBsonIter.
+ * @bson: (in): The #MongoBson that @iter is iterating.
+ * @value: (in): The new value.
+ *
+ * Overwrites the current value of @iter in place if it is a
+ * %MONGO_BSON_BOOLEAN. The size of @bson does not change, so @iter and
+ * other iterators on @bson remain valid.
+ *
+ * Returns: %TRUE if the value was set; %FALSE if the type differs.
+ */
+gboolean
+mongo_bson_iter_set_value_boolean (MongoBsonIter *iter,
+                                   MongoBson     *bson,
+                                   gboolean       value)
+{
+   guint8 b = !!value;
+
+   g_return_val_if_fail(iter != NULL, FALSE);
+   g_return_val_if_fail(bson != NULL, FALSE);
+
+   return mongo_bson_iter_set_fixed(iter, bson, MONGO_BSON_BOOLEAN,
+                                    &b, sizeof b);
+}
+
+/**
+ * mongo_bson_iter_set_value_date_time:
+ * @iter: (in): A #MongoBsonIter.
+ * @bson: (in): The #MongoBson that @iter is iterating.
+ * @value: (in): A #GDateTime.
+ *
+ * Overwrites the current value of @iter in place if it is a
+ * %MONGO_BSON_DATE_TIME.
+ *
+ * Returns: %TRUE if the value was set; %FALSE if the type differs.
+ */
+gboolean
+mongo_bson_iter_set_value_date_time (MongoBsonIter *iter,
+                                     MongoBson     *bson,
+                                     GDateTime     *value)
+{
+   GTimeVal tv;
+
+   g_return_val_if_fail(iter != NULL, FALSE);
+   g_return_val_if_fail(bson != NULL, FALSE);
+   g_return_val_if_fail(value != NULL, FALSE);
+
+   if (!g_date_time_to_timeval(value, &tv)) {
+      g_warning("GDateTime is outside of storable range, ignoring!");
+      return FALSE;
+   }
+
+   return mongo_bson_iter_set_value_timeval(iter, bson, &tv);
+}
+
+/**
+ * mongo_bson_iter_set_value_double:
+ * @iter: (in): A #MongoBsonIter.
+ * @bson: (in): The #MongoBson that @iter is iterating.
+ * @value: (in): The new value.
+ *
+ * Overwrites the current value of @iter in place if it is a
+ * %MONGO_BSON_DOUBLE.
+ *
+ * Returns: %TRUE if the value was set; %FALSE if the type differs.
+ */
+gboolean
+mongo_bson_iter_set_value_double (MongoBsonIter *iter,
+                                  MongoBson     *bson,
+                                  gdouble        value)
+{
+   g_return_val_if_fail(iter != NULL, FALSE);
+   g_return_val_if_fail(bson != NULL, FALSE);
+
+   return mongo_bson_iter_set_fixed(iter, bson, MONGO_BSON_DOUBLE,
+                                    &value, sizeof value);
+}
+
+/**
+ * mongo_bson_iter_set_value_int:
+ * @iter: (in): A #MongoBsonIter.
+ * @bson: (in): The #MongoBson that @iter is iterating.
+ * @value: (in): The new value.
+ *
+ * Overwrites the current value of @iter in place if it is a
+ * %MONGO_BSON_INT32.
+ *
+ * Returns: %TRUE if the value was set; %FALSE if the type differs.
+ */
+gboolean
+mongo_bson_iter_set_value_int (MongoBsonIter *iter,
+                               MongoBson     *bson,
+                               gint32         value)
+{
+   g_return_val_if_fail(iter != NULL, FALSE);
+   g_return_val_if_fail(bson != NULL, FALSE);
+
+   value = GINT32_TO_LE(value);
+   return mongo_bson_iter_set_fixed(iter, bson, MONGO_BSON_INT32,
+                                    &value, sizeof value);
+}
+
+/**
+ * mongo_bson_iter_set_value_int64:
+ * @iter: (in): A #MongoBsonIter.
+ * @bson: (in): The #MongoBson that @iter is iterating.
+ * @value: (in): The new value.
+ *
+ * Overwrites the current value of @iter in place if it is a
+ * %MONGO_BSON_INT64.
+ *
+ * Returns: %TRUE if the value was set; %FALSE if the type differs.
+ */
+gboolean
+mongo_bson_iter_set_value_int64 (MongoBsonIter *iter,
+                                 MongoBson     *bson,
+                                 gint64         value)
+{
+   g_return_val_if_fail(iter != NULL, FALSE);
+   g_return_val_if_fail(bson != NULL, FALSE);
+
+   value = GINT64_TO_LE(value);
+   return mongo_bson_iter_set_fixed(iter, bson, MONGO_BSON_INT64,
+                                    &value, sizeof value);
+}
+
+/**
+ * mongo_bson_iter_set_value_object_id:
+ * @iter: (in): A #MongoBsonIter.
+ * @bson: (in): The #MongoBson that @iter is iterating.
+ * @object_id: (in): A #MongoObjectId.
+ *
+ * Overwrites the current value of @iter in place if it is a
+ * %MONGO_BSON_OBJECT_ID.
+ *
+ * Returns: %TRUE if the value was set; %FALSE if the type differs.
+ */
+gboolean
+mongo_bson_iter_set_value_object_id (MongoBsonIter       *iter,
+                                     MongoBson           *bson,
+                                     const MongoObjectId *object_id)
+{
+   g_return_val_if_fail(iter != NULL, FALSE);
+   g_return_val_if_fail(bson != NULL, FALSE);
+   g_return_val_if_fail(object_id != NULL, FALSE);
+
+   return mongo_bson_iter_set_fixed(iter, bson, MONGO_BSON_OBJECT_ID,
+                                    object_id, 12);
+}
+
+/**
+ * mongo_bson_iter_set_value_timeval:
+ * @iter: (in): A #MongoBsonIter.
+ * @bson: (in): The #MongoBson that @iter is iterating.
+ * @value: (in): A #GTimeVal.
+ *
+ * Overwrites the current value of @iter in place if it is a
+ * %MONGO_BSON_DATE_TIME.
+ *
+ * Returns: %TRUE if the value was set; %FALSE if the type differs.
+ */
+gboolean
+mongo_bson_iter_set_value_timeval (MongoBsonIter *iter,
+                                   MongoBson     *bson,
+                                   GTimeVal      *value)
+{
+   gint64 msec;
+
+   g_return_val_if_fail(iter != NULL, FALSE);
+   g_return_val_if_fail(bson != NULL, FALSE);
+   g_return_val_if_fail(value != NULL, FALSE);
+
+   msec = (value->tv_sec * G_GINT64_CONSTANT(1000)) + (value->tv_usec / 1000);
+   msec = GINT64_TO_LE(msec);
+   return mongo_bson_iter_set_fixed(iter, bson, MONGO_BSON_DATE_TIME,
+                                    &msec, sizeof msec);
+}
+
+/**
+ * mongo_bson_iter_replace_value:
+ * @iter: (in): A #MongoBsonIter.
+ * @bson: (in): The #MongoBson that @iter is iterating.
+ * @value: (in): A #MongoBsonIter positioned on the replacement value.
+ *
+ * Replaces the current value of @iter with a copy of the value at @value,
+ * which may be of any type and may point into any document, including
+ * @bson. The key of the element is kept.
+ *
+ * If the size of the value changes, the buffer is spliced and the length
+ * prefixes of every enclosing document are adjusted. @iter is updated to
+ * point at the new value and may continue iterating, but any other
+ * iterators on @bson, including parents of @iter, are invalidated.
+ *
+ * Returns: %TRUE if the value was replaced; otherwise %FALSE.
+ */
+gboolean
+mongo_bson_iter_replace_value (MongoBsonIter *iter,
+                               MongoBson     *bson,
+                               MongoBsonIter *value)
+{
+   MongoBsonRawIter raw;
+   const guint8 *v1;
+   const guint8 *v2;
+   const gchar *key;
+   guint8 *replacement;
+   guint8 *data;
+   guint32 doc_len;
+   GArray *prefixes;
+   gssize delta;
+   gsize new_len;
+   gsize old_len;
+   gsize doc;
+   gsize ko;
+   gsize vs;
+   gsize ve;
+   gsize base;
+   gsize offset;
+   guint8 type;
+   guint i;
+
+   g_return_val_if_fail(iter != NULL, FALSE);
+   g_return_val_if_fail(bson != NULL, FALSE);
+   g_return_val_if_fail(value != NULL, FALSE);
+   g_return_val_if_fail(value->user_data4 != NULL, FALSE);
+   g_return_val_if_fail(!bson->children || !bson->children->len, FALSE);
+
+   /*
+    * Copy the replacement first, it may live within @bson.
+    */
+   key = value->user_data4;
+   v1 = (const guint8 *)key + strlen(key) + 1;
+   new_len = ((const guint8 *)value->user_data1 +
+              GPOINTER_TO_SIZE(value->user_data3)) - v1;
+   type = GPOINTER_TO_INT(value->user_data5);
+   replacement = g_memdup(v1, new_len);
+
+   if (!mongo_bson_iter_make_writable(iter, bson)) {
+      g_free(replacement);
+      return FALSE;
+   }
+
+   data = bson->buf->data;
+   base = (const guint8 *)iter->user_data1 - data;
+   ko = (const guint8 *)iter->user_data4 - data;
+   vs = ko + strlen(iter->user_data4) + 1;
+   ve = base + GPOINTER_TO_SIZE(iter->user_data3);
+   old_len = ve - vs;
+   delta = (gssize)new_len - (gssize)old_len;
+
+   /*
+    * Collect the offsets of the length prefixes of every document that
+    * encloses the element, descending from the top-level document.
+    */
+   prefixes = g_array_sized_new(FALSE, FALSE, sizeof(gsize), 4);
+   doc = 0;
+   g_array_append_val(prefixes, doc);
+   mongo_bson_raw_iter_init_from_data(&raw, data, bson->buf->len);
+   while (mongo_bson_raw_iter_next(&raw)) {
+      if ((gsize)((const guint8 *)raw.key - data) == ko) {
+         break;
+      }
+      if ((doc + raw.offset) > ko) {
+         if ((raw.type != MONGO_BSON_DOCUMENT) &&
+             (raw.type != MONGO_BSON_ARRAY)) {
+            break;
+         }
+         doc = raw.value1 - data;
+         g_array_append_val(prefixes, doc);
+         memcpy(&doc_len, raw.value1, sizeof doc_len);
+         mongo_bson_raw_iter_init_from_data(&raw, raw.value1,
+                                            GUINT32_FROM_LE(doc_len));
+      }
+   }
+
+   if (!raw.key || ((gsize)((const guint8 *)raw.key - data) != ko)) {
+      g_warning("Failed to locate the iterator within the document.");
+      g_array_free(prefixes, TRUE);
+      g_free(replacement);
+      return FALSE;
+   }
+
+   if (delta > 0) {
+      g_byte_array_set_size(bson->buf, bson->buf->len + delta);
+      data = bson->buf->data;
+      memmove(data + ve + delta, data + ve, bson->buf->len - delta - ve);
+   } else if (delta < 0) {
+      memmove(data + ve + delta, data + ve, bson->buf->len - ve);
+      g_byte_array_set_size(bson->buf, bson->buf->len + delta);
+      data = bson->buf->data;
+   }
+
+   data[ko - 1] = type;
+   if (new_len) {
+      memcpy(data + vs, replacement, new_len);
+   }
+   g_free(replacement);
+
+   for (i = 0; i < prefixes->len; i++) {
+      doc = g_array_index(prefixes, gsize, i);
+      memcpy(&doc_len, data + doc, sizeof doc_len);
+      doc_len = GUINT32_TO_LE(GUINT32_FROM_LE(doc_len) + delta);
+      memcpy(data + doc, &doc_len, sizeof doc_len);
+   }
+
+   g_array_free(prefixes, TRUE);
+
+   /*
+    * Re-read the element so that @iter points at the new value.
+    */
+   offset = ko - 1 - base;
+   iter->user_data1 = data + base;
+   iter->user_data2 =
+      GSIZE_TO_POINTER(GPOINTER_TO_SIZE(iter->user_data2) + delta);
+   if (!mongo_bson_next_element(iter->user_data1,
+                                GPOINTER_TO_SIZE(iter->user_data2),
+                                &offset, &key, &type, &v1, &v2)) {
+      g_warning("Replacement value is malformed.");
+      memset(iter, 0, sizeof *iter);
+      return FALSE;
+   }
+
+   iter->user_data3 = GSIZE_TO_POINTER(offset);
+   iter->user_data4 = (gpointer)key;
+   iter->user_data5 = GINT_TO_POINTER(type);
+   iter->user_data6 = (gpointer)v1;
+   iter->user_data7 = (gpointer)v2;
+
+   return TRUE;
+}
+
+/**
+ * mongo_bson_raw_iter_init:
+ * @iter: (out): An uninitialized #MongoBsonRawIter.
+ * @bson: (in): A #MongoBson.
+ *
+ * Initializes a #MongoBsonRawIter for iterating through @bson. The
+ * iterator is only valid as long as @bson is not modified or freed.
+ */
+void
+mongo_bson_raw_iter_init (MongoBsonRawIter *iter,
+                          MongoBson        *bson)
+{
+   g_return_if_fail(iter != NULL);
+   g_return_if_fail(bson != NULL);
+
+   memset(iter, 0, sizeof *iter);
+   iter->data = mongo_bson_get_buffer(bson, &iter->length);
+   iter->offset = 4; /* Skip document length */
+}
+
+/**
+ * mongo_bson_raw_iter_init_from_data:
+ * @iter: (out): An uninitialized #MongoBsonRawIter.
+ * @data: (in) (array length=length): A buffer containing a BSON document.
+ * @length: (in): The length of @data.
+ *
+ * Initializes a #MongoBsonRawIter for iterating through the BSON document
+ * contained in @data without creating a #MongoBson. @data must remain
+ * valid for the lifetime of the iterator.
+ *
+ * Returns: %TRUE if the document length in @data matches @length.
+ */
+gboolean
+mongo_bson_raw_iter_init_from_data (MongoBsonRawIter *iter,
+                                    const guint8     *data,
+                                    gsize             length)
+{
+   guint32 bson_len;
+
+   g_return_val_if_fail(iter != NULL, FALSE);
+   g_return_val_if_fail(data != NULL, FALSE);
+
+   memset(iter, 0, sizeof *iter);
+
+   if (length < 5) {
+      return FALSE;
+   }
+
+   memcpy(&bson_len, data, sizeof bson_len);
+   if (GUINT32_FROM_LE(bson_len) != length) {
+      return FALSE;
+   }
+
+   iter->data = data;
+   iter->length = length;
+   iter->offset = 4; /* Skip document length */
+
+   return TRUE;
+}
+
+/**
+ * mongo_bson_raw_iter_next:
+ * @iter: (in): A #MongoBsonRawIter.
+ *
+ * Advances @iter to the next field in the document.
+ *
+ * Returns: %TRUE if @iter now points at a field; %FALSE at the end of the
+ *   document or if the document is malformed.
+ */
+gboolean
+mongo_bson_raw_iter_next (MongoBsonRawIter *iter)
+{
+   g_return_val_if_fail(iter != NULL, FALSE);
+
+   if (G_LIKELY(mongo_bson_next_element(iter->data,
+                                        iter->length,
+                                        &iter->offset,
+                                        &iter->key,
+                                        &iter->type,
+                                        &iter->value1,
+                                        &iter->value2))) {
+      return TRUE;
+   }
+
+   memset(iter, 0, sizeof *iter);
+   return FALSE;
+}
+
+/**
+ * mongo_bson_raw_iter_find:
+ * @iter: (in): A #MongoBsonRawIter.
+ * @key: (in): A key to find in the BSON document.
+ *
+ * Iterates through all upcoming keys in @iter until @key is found or the
+ * end of the document has been reached.
+ *
+ * Returns: %TRUE if @key was found, otherwise %FALSE.
+ */
+gboolean
+mongo_bson_raw_iter_find (MongoBsonRawIter *iter,
+                          const gchar      *key)
+{
+   g_return_val_if_fail(iter != NULL, FALSE);
+   g_return_val_if_fail(key != NULL, FALSE);
+
+   while (mongo_bson_raw_iter_next(iter)) {
+      if (!strcmp(key, iter->key)) {
+         return TRUE;
+      }
+   }
+
+   return FALSE;
+}
+
+/**
+ * mongo_bson_raw_iter_recurse:
+ * @iter: (in): A #MongoBsonRawIter.
+ * @child: (out): A #MongoBsonRawIter.
+ *
+ * Initializes @child to iterate the document or array currently pointed
+ * to by @iter.
+ *
+ * Returns: %TRUE if @child is initialized; otherwise %FALSE.
+ */
+gboolean
+mongo_bson_raw_iter_recurse (MongoBsonRawIter *iter,
+                             MongoBsonRawIter *child)
+{
+   gint32 buflen;
+
+   g_return_val_if_fail(iter != NULL, FALSE);
+   g_return_val_if_fail(child != NULL, FALSE);
+
+   if ((iter->type == MONGO_BSON_DOCUMENT) ||
+       (iter->type == MONGO_BSON_ARRAY)) {
+      memcpy(&buflen, iter->value1, sizeof buflen);
+      memset(child, 0, sizeof *child);
+      child->data = iter->value1;
+      child->length = GINT32_FROM_LE(buflen);
+      child->offset = 4; /* Skip document length */
+      return TRUE;
+   }
+
+   return FALSE;
+}
+
+static inline gint
+mongo_bson_compare_int64 (gint64 a,
+                          gint64 b)
+{
+   return (a > b) - (a < b);
+}
+
+/**
+ * mongo_bson_compare_int64_double:
+ * @a: (in): An integer.
+ * @b: (in): A double.
+ *
+ * Compares @a and @b exactly, without rounding @a to a double. NaN sorts
+ * before every other number.
+ *
+ * Returns: Less than, equal to or greater than zero.
+ */
+static gint
+mongo_bson_compare_int64_double (gint64  a,
+                                 gdouble b)
+{
+   gint64 bi;
+   gdouble frac;
+
+   if (b != b) {
+      return 1;
+   } else if (b >= 9223372036854775808.0) {
+      return -1;
+   } else if (b < -9223372036854775808.0) {
+      return 1;
+   }
+
+   bi = (gint64)b;
+   if (a != bi) {
+      return (a > bi) ? 1 : -1;
+   }
+
+   frac = b - (gdouble)bi;
+   return (frac < 0.0) - (frac > 0.0);
+}
+
+static gint
+mongo_bson_compare_double (gdouble a,
+                           gdouble b)
+{
+   if (a < b) {
+      return -1;
+   } else if (a > b) {
+      return 1;
+   } else if (a == b) {
+      return 0;
+   }
+
+   /*
+    * At least one is NaN, which sorts before every other number.
+    */
+   return (a == a) - (b == b);
+}
+
+static inline void
+mongo_bson_raw_iter_get_number (const MongoBsonRawIter *iter,
+                                gint64                 *ivalue,
+                                gdouble                *dvalue,
+                                gboolean               *is_double)
+{
+   MongoDecimal128 decimal;
+
+   *is_double = FALSE;
+
+   switch (iter->type) {
+   case MONGO_BSON_INT32:
+      *ivalue = mongo_bson_raw_iter_get_value_int(iter);
+      break;
+   case MONGO_BSON_INT64:
+      *ivalue = mongo_bson_raw_iter_get_value_int64(iter);
+      break;
+   case MONGO_BSON_DECIMAL128:
+      /*
+       * Decimals are ordered by their nearest double.
+       */
+      mongo_bson_raw_iter_get_value_decimal128(iter, &decimal);
+      *dvalue = mongo_decimal128_to_double(&decimal);
+      *is_double = TRUE;
+      break;
+   default:
+      *dvalue = mongo_bson_raw_iter_get_value_double(iter);
+      *is_double = TRUE;
+      break;
+   }
+}
+
+/*
+ * Like mongo_bson_raw_iter_get_value_string() but for any of the types
+ * stored as a BSON string.
+ */
+static inline gsize
+mongo_bson_raw_iter_get_string_length (const MongoBsonRawIter *iter)
+{
+   gint32 length;
+
+   memcpy(&length, iter->value1, sizeof length);
+   return GINT32_FROM_LE(length) - 1;
+}
+
+static inline void
+mongo_bson_raw_iter_get_scope (const MongoBsonRawIter *iter,
+                               MongoBsonRawIter       *child)
+{
+   gint32 code_len;
+   gint32 buflen;
+
+   memcpy(&code_len, iter->value2, sizeof code_len);
+   memset(child, 0, sizeof *child);
+   child->data = iter->value2 + 4 + GINT32_FROM_LE(code_len);
+   memcpy(&buflen, child->data, sizeof buflen);
+   child->length = GINT32_FROM_LE(buflen);
+   child->offset = 4; /* Skip document length */
+}
+
+static inline void
+mongo_bson_raw_iter_get_child (const MongoBsonRawIter *iter,
+                               MongoBsonRawIter       *child)
+{
+   gint32 buflen;
+
+   memcpy(&buflen, iter->value1, sizeof buflen);
+   memset(child, 0, sizeof *child);
+   child->data = iter->value1;
+   child->length = GINT32_FROM_LE(buflen);
+   child->offset = 4; /* Skip document length */
+}
+
+static gint
+mongo_bson_compare_iters (MongoBsonRawIter *a,
+                          MongoBsonRawIter *b);
+
+static gint
+mongo_bson_compare_values (const MongoBsonRawIter *a,
+                           const MongoBsonRawIter *b)
+{
+   MongoBsonRawIter child_a;
+   MongoBsonRawIter child_b;
+   gboolean a_is_double;
+   gboolean b_is_double;
+   gdouble a_double = 0.0;
+   gdouble b_double = 0.0;
+   guint64 a_time;
+   guint64 b_time;
+   gint64 a_int = 0;
+   gint64 b_int = 0;
+   gsize a_len;
+   gsize b_len;
+   gint ret;
+
+   if ((ret = mongo_bson_type_bracket(a->type) -
+              mongo_bson_type_bracket(b->type))) {
+      return (ret > 0) ? 1 : -1;
+   }
+
+   switch ((MongoBsonType)a->type) {
+   case MONGO_BSON_DOUBLE:
+   case MONGO_BSON_INT32:
+   case MONGO_BSON_INT64:
+   case MONGO_BSON_DECIMAL128:
+      mongo_bson_raw_iter_get_number(a, &a_int, &a_double, &a_is_double);
+      mongo_bson_raw_iter_get_number(b, &b_int, &b_double, &b_is_double);
+      if (!a_is_double && !b_is_double) {
+         return mongo_bson_compare_int64(a_int, b_int);
+      } else if (a_is_double && b_is_double) {
+         return mongo_bson_compare_double(a_double, b_double);
+      } else if (a_is_double) {
+         return -mongo_bson_compare_int64_double(b_int, a_double);
+      }
+      return mongo_bson_compare_int64_double(a_int, b_double);
+   case MONGO_BSON_UTF8:
+   case MONGO_BSON_SYMBOL:
+   case MONGO_BSON_JAVASCRIPT:
+      a_len = mongo_bson_raw_iter_get_string_length(a);
+      b_len = mongo_bson_raw_iter_get_string_length(b);
+      if ((ret = memcmp(a->value2, b->value2, MIN(a_len, b_len)))) {
+         return (ret > 0) ? 1 : -1;
+      }
+      return (a_len > b_len) - (a_len < b_len);
+   case MONGO_BSON_JAVASCRIPT_WITH_SCOPE:
+      if ((ret = strcmp((const gchar *)a->value2 + 4,
+                        (const gchar *)b->value2 + 4))) {
+         return (ret > 0) ? 1 : -1;
+      }
+      mongo_bson_raw_iter_get_scope(a, &child_a);
+      mongo_bson_raw_iter_get_scope(b, &child_b);
+      return mongo_bson_compare_iters(&child_a, &child_b);
+   case MONGO_BSON_DBPOINTER:
+      if (!(ret = strcmp((const gchar *)a->value1 + 4,
+                         (const gchar *)b->value1 + 4))) {
+         ret = memcmp(a->value2, b->value2, 12);
+      }
+      return (ret > 0) - (ret < 0);
+   case MONGO_BSON_TIMESTAMP:
+      a_time = mongo_bson_raw_iter_get_value_timestamp(a, NULL, NULL);
+      b_time = mongo_bson_raw_iter_get_value_timestamp(b, NULL, NULL);
+      return (a_time > b_time) - (a_time < b_time);
+   case MONGO_BSON_DOCUMENT:
+   case MONGO_BSON_ARRAY:
+      mongo_bson_raw_iter_get_child(a, &child_a);
+      mongo_bson_raw_iter_get_child(b, &child_b);
+      return mongo_bson_compare_iters(&child_a, &child_b);
+   case MONGO_BSON_BINARY:
+      /*
+       * Like MongoDB, shorter values sort first, then by subtype and
+       * finally byte by byte.
+       */
+      mongo_bson_raw_iter_get_value_binary(a, NULL, &a_len);
+      mongo_bson_raw_iter_get_value_binary(b, NULL, &b_len);
+      if (a_len != b_len) {
+         return (a_len > b_len) ? 1 : -1;
+      }
+      ret = memcmp(a->value1 + 4, b->value1 + 4, a_len + 1);
+      return (ret > 0) - (ret < 0);
+   case MONGO_BSON_OBJECT_ID:
+      ret = memcmp(a->value1, b->value1, 12);
+      return (ret > 0) - (ret < 0);
+   case MONGO_BSON_BOOLEAN:
+      return (!!a->value1[0]) - (!!b->value1[0]);
+   case MONGO_BSON_DATE_TIME:
+      memcpy(&a_int, a->value1, sizeof a_int);
+      memcpy(&b_int, b->value1, sizeof b_int);
+      return mongo_bson_compare_int64(GINT64_FROM_LE(a_int),
+                                      GINT64_FROM_LE(b_int));
+   case MONGO_BSON_REGEX:
+      if (!(ret = strcmp((const gchar *)a->value1,
+                         (const gchar *)b->value1))) {
+         ret = strcmp((const gchar *)a->value2, (const gchar *)b->value2);
+      }
+      return (ret > 0) - (ret < 0);
+   case MONGO_BSON_NULL:
+   case MONGO_BSON_UNDEFINED:
+   case MONGO_BSON_MAX_KEY:
+   case MONGO_BSON_MIN_KEY:
+   default:
+      return 0;
+   }
+}
+
+static gint
+mongo_bson_compare_iters (MongoBsonRawIter *a,
+                          MongoBsonRawIter *b)
+{
+   gboolean a_next;
+   gboolean b_next;
+   gint ret;
+
+   for (;;) {
+      a_next = mongo_bson_raw_iter_next(a);
+      b_next = mongo_bson_raw_iter_next(b);
+
+      if (!a_next || !b_next) {
+         return a_next - b_next;
+      }
+
+      if ((ret = mongo_bson_type_bracket(a->type) -
+                 mongo_bson_type_bracket(b->type))) {
+         return (ret > 0) ? 1 : -1;
+      }
+
+      if ((ret = strcmp(a->key, b->key))) {
+         return (ret > 0) ? 1 : -1;
+      }
+
+      if ((ret = mongo_bson_compare_values(a, b))) {
+         return ret;
+      }
+   }
+}
+
+/**
+ * mongo_bson_compare:
+ * @bson: (in): A #MongoBson.
+ * @other: (in): A #MongoBson.
+ *
+ * Compares two documents using the sort order of MongoDB. Fields are
+ * compared pairwise in order, first by the bracket of their type, then by
+ * field name and then by value. Numbers of different types are compared
+ * by their numeric value, so 1, 1L and 1.0 are equal.
+ *
+ * The raw buffers are walked directly and no memory is allocated.
+ *
+ * Returns: Less than zero if @bson sorts before @other, zero if they are
+ *   equal and greater than zero if @bson sorts after @other.
+ */
+gint
+mongo_bson_compare (MongoBson *bson,
+                    MongoBson *other)
+{
+   MongoBsonRawIter a;
+   MongoBsonRawIter b;
+
+   g_return_val_if_fail(bson != NULL, 0);
+   g_return_val_if_fail(other != NULL, 0);
+
+   mongo_bson_raw_iter_init(&a, bson);
+   mongo_bson_raw_iter_init(&b, other);
+
+   return mongo_bson_compare_iters(&a, &b);
+}
+
+/**
+ * mongo_bson_raw_iter_compare_value:
+ * @iter: (in): A #MongoBsonRawIter.
+ * @other: (in): A #MongoBsonRawIter.
+ *
+ * Compares the current values of @iter and @other using the same order as
+ * mongo_bson_compare(). The keys are not compared.
+ *
+ * Returns: Less than, equal to or greater than zero.
+ */
+gint
+mongo_bson_raw_iter_compare_value (const MongoBsonRawIter *iter,
+                                   const MongoBsonRawIter *other)
+{
+   g_return_val_if_fail(iter != NULL, 0);
+   g_return_val_if_fail(other != NULL, 0);
+   g_return_val_if_fail(iter->type != 0, 0);
+   g_return_val_if_fail(other->type != 0, 0);
+
+   return mongo_bson_compare_values(iter, other);
+}
+
+static inline void
+mongo_bson_iter_to_raw (MongoBsonIter    *iter,
+                        MongoBsonRawIter *raw)
+{
+   memset(raw, 0, sizeof *raw);
+   raw->type = GPOINTER_TO_INT(iter->user_data5);
+   raw->key = iter->user_data4;
+   raw->value1 = iter->user_data6;
+   raw->value2 = iter->user_data7;
+}
+
+/**
+ * mongo_bson_iter_compare_value:
+ * @iter: (in): A #MongoBsonIter.
+ * @other: (in): A #MongoBsonIter.
+ *
+ * Compares the current values of @iter and @other using the same order as
+ * mongo_bson_compare(). The keys are not compared.
+ *
+ * Returns: Less than, equal to or greater than zero.
+ */
+gint
+mongo_bson_iter_compare_value (MongoBsonIter *iter,
+                               MongoBsonIter *other)
+{
+   MongoBsonRawIter a;
+   MongoBsonRawIter b;
+
+   g_return_val_if_fail(iter != NULL, 0);
+   g_return_val_if_fail(other != NULL, 0);
+   g_return_val_if_fail(iter->user_data5 != NULL, 0);
+   g_return_val_if_fail(other->user_data5 != NULL, 0);
+
+   mongo_bson_iter_to_raw(iter, &a);
+   mongo_bson_iter_to_raw(other, &b);
+
+   return mongo_bson_compare_values(&a, &b);
+}
+
+#define HASH_K1 G_GUINT64_CONSTANT(0x87c37b91114253d5)
+#define HASH_K2 G_GUINT64_CONSTANT(0x4cf5ad432745937f)
+
+static inline guint64
+mongo_bson_rotl64 (guint64 x,
+                   guint   r)
+{
+   return (x << r) | (x >> (64 - r));
+}
+
+static inline guint64
+mongo_bson_fmix64 (guint64 k)
+{
+   k ^= k >> 33;
+   k *= G_GUINT64_CONSTANT(0xff51afd7ed558ccd);
+   k ^= k >> 33;
+   k *= G_GUINT64_CONSTANT(0xc4ceb9fe1a85ec53);
+   k ^= k >> 33;
+   return k;
+}
+
+/**
+ * mongo_bson_hash_bytes:
+ * @data: (in): The bytes to hash.
+ * @length: (in): The length of @data.
+ * @seed: (in): The initial hash value.
+ *
+ * Hashes @data eight bytes at a time with the mixing steps of
+ * MurmurHash3.
+ *
+ * Returns: A 64-bit hash.
+ */
+static guint64
+mongo_bson_hash_bytes (const guint8 *data,
+                       gsize         length,
+                       guint64       seed)
+{
+   guint64 h = seed ^ (length * HASH_K1);
+   guint64 k;
+   gsize i;
+
+   for (i = 0; (i + 8) <= length; i += 8) {
+      memcpy(&k, data + i, sizeof k);
+      k = GUINT64_FROM_LE(k);
+      k *= HASH_K1;
+      k = mongo_bson_rotl64(k, 31);
+      k *= HASH_K2;
+      h ^= k;
+      h = mongo_bson_rotl64(h, 27) * 5 + 0x52dce729;
+   }
+
+   if (i < length) {
+      k = 0;
+      memcpy(&k, data + i, length - i);
+      k = GUINT64_FROM_LE(k);
+      k *= HASH_K1;
+      k = mongo_bson_rotl64(k, 31);
+      k *= HASH_K2;
+      h ^= k;
+   }
+
+   return mongo_bson_fmix64(h);
+}
+
+static inline guint64
+mongo_bson_hash_combine (guint64 h,
+                         guint64 v)
+{
+   return mongo_bson_fmix64(h ^ (v + G_GUINT64_CONSTANT(0x9e3779b97f4a7c15) +
+                                 (h << 6) + (h >> 2)));
+}
+
+static guint64
+mongo_bson_hash_values (const MongoBsonRawIter *iter)
+{
+   MongoBsonRawIter child;
+   gboolean is_double;
+   gdouble dvalue = 0.0;
+   gint64 ivalue = 0;
+   guint64 h;
+   gsize length;
+
+   h = mongo_bson_type_bracket(iter->type);
+
+   switch ((MongoBsonType)iter->type) {
+   case MONGO_BSON_DOUBLE:
+   case MONGO_BSON_INT32:
+   case MONGO_BSON_INT64:
+   case MONGO_BSON_DECIMAL128:
+      /*
+       * Numbers that compare equal must hash equal, so integral doubles
+       * hash as their integer value.
+       */
+      mongo_bson_raw_iter_get_number(iter, &ivalue, &dvalue, &is_double);
+      if (is_double) {
+         if ((dvalue >= -9223372036854775808.0) &&
+             (dvalue < 9223372036854775808.0) &&
+             (dvalue == (gdouble)(gint64)dvalue)) {
+            ivalue = (gint64)dvalue;
+         } else if (dvalue != dvalue) {
+            return mongo_bson_hash_combine(h, 0x7ff8);
+         } else {
+            return mongo_bson_hash_bytes((const guint8 *)&dvalue,
+                                         sizeof dvalue, h);
+         }
+      }
+      return mongo_bson_hash_combine(h, (guint64)ivalue);
+   case MONGO_BSON_UTF8:
+   case MONGO_BSON_SYMBOL:
+   case MONGO_BSON_JAVASCRIPT:
+      length = mongo_bson_raw_iter_get_string_length(iter);
+      return mongo_bson_hash_bytes(iter->value2, length, h);
+   case MONGO_BSON_JAVASCRIPT_WITH_SCOPE:
+      h = mongo_bson_hash_bytes(iter->value2 + 4,
+                                strlen((const gchar *)iter->value2 + 4), h);
+      mongo_bson_raw_iter_get_scope(iter, &child);
+      while (mongo_bson_raw_iter_next(&child)) {
+         h = mongo_bson_hash_bytes((const guint8 *)child.key,
+                                   strlen(child.key), h);
+         h = mongo_bson_hash_combine(h, mongo_bson_hash_values(&child));
+      }
+      return h;
+   case MONGO_BSON_DBPOINTER:
+      h = mongo_bson_hash_bytes(iter->value1 + 4,
+                                strlen((const gchar *)iter->value1 + 4), h);
+      return mongo_bson_hash_bytes(iter->value2, 12, h);
+   case MONGO_BSON_TIMESTAMP:
+      return mongo_bson_hash_bytes(iter->value1, 8, h);
+   case MONGO_BSON_DOCUMENT:
+   case MONGO_BSON_ARRAY:
+      mongo_bson_raw_iter_get_child(iter, &child);
+      while (mongo_bson_raw_iter_next(&child)) {
+         h = mongo_bson_hash_bytes((const guint8 *)child.key,
+                                   strlen(child.key), h);
+         h = mongo_bson_hash_combine(h, mongo_bson_hash_values(&child));
+      }
+      return h;
+   case MONGO_BSON_BINARY:
+      mongo_bson_raw_iter_get_value_binary(iter, NULL, &length);
+      return mongo_bson_hash_bytes(iter->value1, length + 5, h);
+   case MONGO_BSON_OBJECT_ID:
+      return mongo_bson_hash_bytes(iter->value1, 12, h);
+   case MONGO_BSON_BOOLEAN:
+      return mongo_bson_hash_combine(h, !!iter->value1[0]);
+   case MONGO_BSON_DATE_TIME:
+      return mongo_bson_hash_bytes(iter->value1, 8, h);
+   case MONGO_BSON_REGEX:
+      h = mongo_bson_hash_bytes(iter->value1,
+                                strlen((const gchar *)iter->value1), h);
+      return mongo_bson_hash_bytes(iter->value2,
+                                   strlen((const gchar *)iter->value2), h);
+   case MONGO_BSON_NULL:
+   case MONGO_BSON_UNDEFINED:
+   case MONGO_BSON_MAX_KEY:
+   case MONGO_BSON_MIN_KEY:
+   default:
+      return mongo_bson_hash_combine(h, 0);
+   }
+}
+
+/**
+ * mongo_bson_raw_iter_hash_value:
+ * @iter: (in): A #MongoBsonRawIter.
+ *
+ * Hashes the current value of @iter. Values that are equal according to
+ * mongo_bson_raw_iter_compare_value() have the same hash, so 1, 1L and
+ * 1.0 all hash alike.
+ *
+ * Returns: A 64-bit hash.
+ */
+guint64
+mongo_bson_raw_iter_hash_value (const MongoBsonRawIter *iter)
+{
+   g_return_val_if_fail(iter != NULL, 0);
+   g_return_val_if_fail(iter->type != 0, 0);
+
+   return mongo_bson_hash_values(iter);
+}
+
+/**
+ * mongo_bson_iter_hash_value:
+ * @iter: (in): A #MongoBsonIter.
+ *
+ * Hashes the current value of @iter. See
+ * mongo_bson_raw_iter_hash_value().
+ *
+ * Returns: A 64-bit hash.
+ */
+guint64
+mongo_bson_iter_hash_value (MongoBsonIter *iter)
+{
+   MongoBsonRawIter raw;
+
+   g_return_val_if_fail(iter != NULL, 0);
+   g_return_val_if_fail(iter->user_data5 != NULL, 0);
+
+   mongo_bson_iter_to_raw(iter, &raw);
+   return mongo_bson_hash_values(&raw);
+}
+
+/**
+ * mongo_bson_hash64:
+ * @bson: (in): A #MongoBson.
+ *
+ * Computes a 64-bit hash of the raw bytes of @bson. Documents with equal
+ * bytes, as determined by mongo_bson_equal(), have equal hashes.
+ *
+ * Returns: A 64-bit hash.
+ */
+guint64
+mongo_bson_hash64 (MongoBson *bson)
+{
+   const guint8 *data;
+   gsize length;
+
+   g_return_val_if_fail(bson != NULL, 0);
+
+   data = mongo_bson_get_buffer(bson, &length);
+   return mongo_bson_hash_bytes(data, length, 0);
+}
+
+/**
+ * mongo_bson_hash:
+ * @v: (in): A #MongoBson.
+ *
+ * Hashes the raw bytes of a #MongoBson. This is suitable for use as a
+ * #GHashFunc together with mongo_bson_equal().
+ *
+ * Returns: A hash of the document.
+ */
+guint
+mongo_bson_hash (gconstpointer v)
+{
+   guint64 h;
+
+   g_return_val_if_fail(v != NULL, 0);
+
+   h = mongo_bson_hash64((MongoBson *)v);
+   return (guint)(h ^ (h >> 32));
+}
+
+/**
+ * mongo_bson_equal:
+ * @v1: (in): A #MongoBson.
+ * @v2: (in): A #MongoBson.
+ *
+ * Checks if two documents have identical bytes. This is suitable for use
+ * as a #GEqualFunc. Unlike mongo_bson_compare(), the field types must
+ * match exactly, so {"a": 1} and {"a": 1.0} are not equal.
+ *
+ * Returns: %TRUE if @v1 and @v2 are byte-for-byte equal.
+ */
+gboolean
+mongo_bson_equal (gconstpointer v1,
+                  gconstpointer v2)
+{
+   const guint8 *data1;
+   const guint8 *data2;
+   gsize length1;
+   gsize length2;
+
+   g_return_val_if_fail(v1 != NULL, FALSE);
+   g_return_val_if_fail(v2 != NULL, FALSE);
+
+   data1 = mongo_bson_get_buffer((MongoBson *)v1, &length1);
+   data2 = mongo_bson_get_buffer((MongoBson *)v2, &length2);
+
+   return ((length1 == length2) && !memcmp(data1, data2, length1));
 }
 
 /**
- * mongo_bson_iter_get_value_string:
- * @iter: (in): A #MongoBsonIter.
- * @length: (out) (allow-none): The length of the resulting string.
+ * mongo_bson_project:
+ * @paths: (in): The split key paths.
+ * @include: (in): If the paths name fields to keep rather than remove.
+ * @data: (in): The document to project.
+ * @length: (in): The length of @data.
+ * @depth: (in): The path component matched against keys of @data.
+ * @active: (in): Indexes of the paths whose leading components matched.
+ * @n_active: (in): The number of entries in @active.
+ * @is_array: (in): If @data is an array.
+ * @out: (in): A #GByteArray to append the projected document to.
  *
- * Fetches the current value pointed to by @iter if it is a
- * %MONGO_BSON_UTF8. If @length is not %NULL, then the length of the
- * string will be stored in the location pointed to by @length.
+ * Appends a copy of @data that keeps or drops the fields named by the
+ * active paths. Runs of retained elements are copied as a single span.
+ * Only documents that a path descends into are rebuilt element by
+ * element.
  *
- * Returns: A string which should not be modified or freed.
+ * Paths do not index into arrays. Instead, they apply to each document
+ * within the array, and the retained elements are renumbered.
  */
-const gchar *
-mongo_bson_iter_get_value_string (MongoBsonIter *iter,
-                                  gsize         *length)
+static void
+mongo_bson_project (gchar        ***paths,
+                    gboolean        include,
+                    const guint8   *data,
+                    gsize           length,
+                    guint           depth,
+                    const guint    *active,
+                    guint           n_active,
+                    gboolean        is_array,
+                    GByteArray     *out)
 {
-   gint32 real_length;
+   MongoBsonRawIter iter;
+   const guint8 *value;
+   gboolean whole;
+   guint32 child_len;
+   guint8 trailing = 0;
+   gchar key[16];
+   gsize span_begin = 4;
+   gsize span_end = 4;
+   gsize begin = 4;
+   guint doc_offset;
+   guint n_sub;
+   guint index = 0;
+   guint *sub;
+   guint i;
 
-   g_return_val_if_fail(iter != NULL, NULL);
-   g_return_val_if_fail(iter->user_data6 != NULL, NULL);
-   g_return_val_if_fail(iter->user_data7 != NULL, NULL);
+   sub = g_newa(guint, MAX(n_active, 1));
+
+   doc_offset = out->len;
+   g_byte_array_set_size(out, out->len + 4);
+
+   mongo_bson_raw_iter_init_from_data(&iter, data, length);
+
+   while (mongo_bson_raw_iter_next(&iter)) {
+      if (is_array) {
+         if ((iter.type == MONGO_BSON_DOCUMENT) ||
+             (iter.type == MONGO_BSON_ARRAY) ||
+             !include) {
+            g_byte_array_append(out, &iter.type, 1);
+            g_byte_array_append(out, (const guint8 *)key,
+                                g_snprintf(key, sizeof key, "%u",
+                                           index++) + 1);
+            if ((iter.type == MONGO_BSON_DOCUMENT) ||
+                (iter.type == MONGO_BSON_ARRAY)) {
+               memcpy(&child_len, iter.value1, sizeof child_len);
+               mongo_bson_project(paths, include, iter.value1,
+                                  GUINT32_FROM_LE(child_len), depth,
+                                  active, n_active,
+                                  (iter.type == MONGO_BSON_ARRAY), out);
+            } else {
+               value = (const guint8 *)iter.key + strlen(iter.key) + 1;
+               g_byte_array_append(out, value, (data + iter.offset) - value);
+            }
+         }
+         continue;
+      }
 
-   if (ITER_IS_TYPE(iter, MONGO_BSON_UTF8)) {
-      if (length) {
-         memcpy(&real_length, iter->user_data6, sizeof real_length);
-         *length = GINT_FROM_LE(real_length);
+      whole = FALSE;
+      n_sub = 0;
+
+      for (i = 0; i < n_active; i++) {
+         if (!strcmp(paths[active[i]][depth], iter.key)) {
+            if (!paths[active[i]][depth + 1]) {
+               whole = TRUE;
+            } else {
+               sub[n_sub++] = active[i];
+            }
+         }
       }
-      return iter->user_data7;
+
+      if (!whole && n_sub &&
+          ((iter.type == MONGO_BSON_DOCUMENT) ||
+           (iter.type == MONGO_BSON_ARRAY))) {
+         g_byte_array_append(out, data + span_begin, span_end - span_begin);
+         g_byte_array_append(out, data + begin, iter.value1 - (data + begin));
+         memcpy(&child_len, iter.value1, sizeof child_len);
+         mongo_bson_project(paths, include, iter.value1,
+                            GUINT32_FROM_LE(child_len), depth + 1,
+                            sub, n_sub, (iter.type == MONGO_BSON_ARRAY),
+                            out);
+         span_begin = span_end = iter.offset;
+      } else if (whole ? include : !include) {
+         if (span_end != begin) {
+            g_byte_array_append(out, data + span_begin,
+                                span_end - span_begin);
+            span_begin = begin;
+         }
+         span_end = iter.offset;
+      }
+
+      begin = iter.offset;
    }
 
-   g_warning("Current value is not a String");
+   g_byte_array_append(out, data + span_begin, span_end - span_begin);
+   g_byte_array_append(out, &trailing, 1);
 
-   return NULL;
+   child_len = GUINT32_TO_LE(out->len - doc_offset);
+   memcpy(out->data + doc_offset, &child_len, sizeof child_len);
 }
 
-/**
- * mongo_bson_iter_get_value_timeval:
- * @iter: (in): A #MongoBsonIter.
- * @value: (out): A location for a #GTimeVal.
- *
- * Fetches the current value pointed to by @iter as a #GTimeVal if the type
- * is a %MONGO_BSON_DATE_TIME.
- */
-void
-mongo_bson_iter_get_value_timeval (MongoBsonIter *iter,
-                                   GTimeVal      *value)
+static MongoBson *
+mongo_bson_project_fields (MongoBson          *bson,
+                           const gchar * const *fields,
+                           gboolean             include)
 {
-   gint64 v_int64;
+   const guint8 *data;
+   MongoBson *ret;
+   gchar ***paths;
+   guint *active;
+   guint n_paths;
+   gsize length;
+   guint i;
 
-   g_return_if_fail(iter != NULL);
-   g_return_if_fail(value != NULL);
+   data = mongo_bson_get_buffer(bson, &length);
 
-   if (ITER_IS_TYPE(iter, MONGO_BSON_DATE_TIME)) {
-      memcpy(&v_int64, iter->user_data6, sizeof v_int64);
-      v_int64 = GINT64_FROM_LE(v_int64);
-      value->tv_sec = v_int64 / 1000;
-      value->tv_usec = v_int64 % 1000;
-      return;
+   n_paths = g_strv_length((gchar **)fields);
+   paths = g_new0(gchar **, n_paths + 1);
+   active = g_new(guint, MAX(n_paths, 1));
+   for (i = 0; i < n_paths; i++) {
+      paths[i] = g_strsplit(fields[i], ".", 0);
+      active[i] = i;
    }
 
-   g_warning("Current value is not a DateTime");
+   ret = g_slice_new0(MongoBson);
+   ret->ref_count = 1;
+   ret->buf = g_byte_array_sized_new(include ? 64 : length);
+
+   mongo_bson_project(paths, include, data, length, 0, active, n_paths,
+                      FALSE, ret->buf);
+
+   for (i = 0; i < n_paths; i++) {
+      g_strfreev(paths[i]);
+   }
+   g_free(paths);
+   g_free(active);
+
+   return ret;
 }
 
 /**
- * mongo_bson_iter_get_value_type:
- * @iter: (in): A #MongoBsonIter.
+ * mongo_bson_include_fields:
+ * @bson: (in): A #MongoBson.
+ * @fields: (in) (array zero-terminated=1): Key paths of the fields to keep.
  *
- * Fetches the #MongoBsonType currently pointed to by @iter.
+ * Creates a copy of @bson containing only the fields named in @fields,
+ * in their original order. A dotted path such as "a.b" keeps only "b"
+ * within the embedded document "a", or within each document of the
+ * array "a". Other elements of such an array are dropped.
  *
- * Returns: A #MongoBsonType.
+ * Consecutive retained fields are copied as a single span of bytes
+ * rather than being appended one at a time.
+ *
+ * Returns: (transfer full): A new #MongoBson.
  */
-MongoBsonType
-mongo_bson_iter_get_value_type (MongoBsonIter *iter)
+MongoBson *
+mongo_bson_include_fields (MongoBson          *bson,
+                           const gchar * const *fields)
 {
-   MongoBsonType type;
-
-   g_return_val_if_fail(iter != NULL, 0);
-   g_return_val_if_fail(iter->user_data5 != NULL, 0);
-
-   type = GPOINTER_TO_INT(iter->user_data5);
+   g_return_val_if_fail(bson != NULL, NULL);
+   g_return_val_if_fail(fields != NULL, NULL);
 
-   switch (type) {
-   case MONGO_BSON_DOUBLE:
-   case MONGO_BSON_UTF8:
-   case MONGO_BSON_DOCUMENT:
-   case MONGO_BSON_ARRAY:
-   case MONGO_BSON_UNDEFINED:
-   case MONGO_BSON_OBJECT_ID:
-   case MONGO_BSON_BOOLEAN:
-   case MONGO_BSON_DATE_TIME:
-   case MONGO_BSON_NULL:
-   case MONGO_BSON_REGEX:
-   case MONGO_BSON_INT32:
-   case MONGO_BSON_INT64:
-      return type;
-   default:
-      g_warning("Unknown BSON type 0x%02x", type);
-      return 0;
-   }
+   return mongo_bson_project_fields(bson, fields, TRUE);
 }
 
 /**
- * mongo_bson_iter_recurse:
- * @iter: (in): A #MongoBsonIter.
- * @child: (out): A #MongoBsonIter.
+ * mongo_bson_exclude_fields:
+ * @bson: (in): A #MongoBson.
+ * @fields: (in) (array zero-terminated=1): Key paths of the fields to remove.
  *
- * Recurses into the child BSON document found at the key currently observed
- * by the #MongoBsonIter. The @child #MongoBsonIter is initialized.
+ * Creates a copy of @bson without the fields named in @fields. A dotted
+ * path such as "a.b" removes only "b" from the embedded document "a", or
+ * from each document of the array "a".
  *
- * Returns: %TRUE if @child is initialized; otherwise %FALSE.
+ * Everything between removed fields is copied as a single span of bytes,
+ * so the cost is proportional to the number of removed fields rather
+ * than the number of fields retained.
+ *
+ * Returns: (transfer full): A new #MongoBson.
  */
-gboolean
-mongo_bson_iter_recurse (MongoBsonIter *iter,
-                         MongoBsonIter *child)
+MongoBson *
+mongo_bson_exclude_fields (MongoBson          *bson,
+                           const gchar * const *fields)
 {
-   gint32 buflen;
+   g_return_val_if_fail(bson != NULL, NULL);
+   g_return_val_if_fail(fields != NULL, NULL);
 
-   g_return_val_if_fail(iter != NULL, FALSE);
-   g_return_val_if_fail(iter != NULL, FALSE);
-   g_return_val_if_fail(child != NULL, FALSE);
+   return mongo_bson_project_fields(bson, fields, FALSE);
+}
 
-   if (ITER_IS_TYPE(iter, MONGO_BSON_ARRAY) ||
-       ITER_IS_TYPE(iter, MONGO_BSON_DOCUMENT)) {
-      memset(child, 0, sizeof *child);
-      memcpy(&buflen, iter->user_data6, sizeof buflen);
-      child->user_data1 = iter->user_data6;
-      child->user_data2 = GINT_TO_POINTER(GINT_FROM_LE(buflen));
-      child->user_data3 = GINT_TO_POINTER(3); /* End of size buffer */
+/**
+ * mongo_bson_diff_find:
+ * @data: (in): The document to search.
+ * @length: (in): The length of @data.
+ * @hint: (inout): The offset at which to look first.
+ * @key: (in): The key to find.
+ * @iter: (out): A location for the element.
+ *
+ * Finds the element named @key. Since the versions of a document usually
+ * keep their fields in the same order, the element at @hint is checked
+ * before falling back to a scan. On success, @hint is advanced past the
+ * element.
+ *
+ * Returns: %TRUE if @key was found.
+ */
+static gboolean
+mongo_bson_diff_find (const guint8     *data,
+                      gsize             length,
+                      gsize            *hint,
+                      const gchar      *key,
+                      MongoBsonRawIter *iter)
+{
+   mongo_bson_raw_iter_init_from_data(iter, data, length);
+   iter->offset = *hint;
+   if (mongo_bson_raw_iter_next(iter) && !strcmp(iter->key, key)) {
+      *hint = iter->offset;
       return TRUE;
    }
 
-   g_warning("Current value is not a BSON document or array.");
+   mongo_bson_raw_iter_init_from_data(iter, data, length);
+   while (mongo_bson_raw_iter_next(iter)) {
+      if (!strcmp(iter->key, key)) {
+         *hint = iter->offset;
+         return TRUE;
+      }
+   }
 
    return FALSE;
 }
 
-static inline guint
-first_nul (const gchar *data,
-           guint        max_bytes)
+static inline const guint8 *
+mongo_bson_diff_value_span (const MongoBsonRawIter *iter,
+                            gsize                  *length)
 {
-   guint i;
+   const guint8 *begin;
 
-   for (i = 0; i < max_bytes; i++) {
-      if (!data[i]) {
-         return i;
-      }
-   }
+   begin = (const guint8 *)iter->key + strlen(iter->key) + 1;
+   *length = (iter->data + iter->offset) - begin;
+   return begin;
+}
 
-   return 0;
+static gboolean
+mongo_bson_diff_equal (const MongoBsonRawIter *old_iter,
+                       const MongoBsonRawIter *new_iter)
+{
+   const guint8 *old_value;
+   const guint8 *new_value;
+   gsize old_span;
+   gsize new_span;
+
+   old_value = mongo_bson_diff_value_span(old_iter, &old_span);
+   new_value = mongo_bson_diff_value_span(new_iter, &new_span);
+
+   return ((old_iter->type == new_iter->type) &&
+           (old_span == new_span) &&
+           !memcmp(old_value, new_value, new_span));
 }
 
-gboolean
-mongo_bson_iter_next (MongoBsonIter *iter)
+/*
+ * Keys that would be read as a dotted path or an operator by the server.
+ */
+static inline gboolean
+mongo_bson_diff_is_path_unsafe (const gchar *key)
 {
-   const guint8 *rawbuf;
-   gsize rawbuf_len;
-   gsize offset;
-   const gchar *key;
-   MongoBsonType type;
-   const guint8 *value1;
-   const guint8 *value2;
-   const gchar *end = NULL;
-   gint32 max_len;
+   return (strchr(key, '.') || (key[0] == '$'));
+}
 
-   g_return_val_if_fail(iter != NULL, FALSE);
+static void
+mongo_bson_diff_append (GByteArray             *buf,
+                        GString                *path,
+                        const MongoBsonRawIter *iter)
+{
+   const guint8 *value;
+   gsize length;
 
-   /*
-    * Copy values onto stack from iter.
-    */
-   rawbuf = iter->user_data1;
-   rawbuf_len = GPOINTER_TO_SIZE(iter->user_data2);
-   offset = GPOINTER_TO_SIZE(iter->user_data3);
-   key = (const gchar *)iter->user_data4;
-   type = GPOINTER_TO_INT(iter->user_data5);
-   value1 = (const guint8 *)iter->user_data6;
-   value2 = (const guint8 *)iter->user_data7;
+   value = mongo_bson_diff_value_span(iter, &length);
+   g_byte_array_append(buf, &iter->type, 1);
+   g_byte_array_append(buf, (const guint8 *)path->str, path->len + 1);
+   g_byte_array_append(buf, value, length);
+}
 
-   /*
-    * Check for end of buffer.
-    */
-   if ((offset + 1) >= rawbuf_len) {
-      GOTO(failure);
-   }
+static gboolean
+mongo_bson_diff_document (const guint8 *old_data,
+                          gsize         old_len,
+                          const guint8 *new_data,
+                          gsize         new_len,
+                          gboolean      is_array,
+                          GString      *path,
+                          GByteArray   *set,
+                          GByteArray   *unset);
 
-   /*
-    * Get the type of the next field.
-    */
-   type = rawbuf[++offset];
+/**
+ * mongo_bson_diff_value:
+ * @path: (in): The dotted path of the value.
+ * @old_iter: (in): The old value.
+ * @new_iter: (in): The new value.
+ * @set: (in): The elements of the $set document.
+ * @unset: (in): The elements of the $unset document.
+ *
+ * Appends the updates that turn @old_iter into @new_iter. Documents and
+ * arrays of the same type are diffed recursively, unless setting the
+ * whole value would be smaller.
+ */
+static void
+mongo_bson_diff_value (GString                *path,
+                       const MongoBsonRawIter *old_iter,
+                       const MongoBsonRawIter *new_iter,
+                       GByteArray             *set,
+                       GByteArray             *unset)
+{
+   guint32 old_len;
+   guint32 new_len;
+   gsize new_span;
+   guint set_mark;
+   guint unset_mark;
 
-   /*
-    * Get the key of the next field.
-    */
-   key = (const gchar *)&rawbuf[++offset];
-   max_len = first_nul(key, rawbuf_len - offset - 1);
-   if (!g_utf8_validate(key, max_len, &end)) {
-      GOTO(failure);
+   if (mongo_bson_diff_equal(old_iter, new_iter)) {
+      return;
    }
-   offset += strlen(key) + 1;
 
-   switch (type) {
-   case MONGO_BSON_UTF8:
-      if ((offset + 5) < rawbuf_len) {
-         value1 = &rawbuf[offset];
-         offset += 4;
-         value2 = &rawbuf[offset];
-         max_len = first_nul((gchar *)value2, rawbuf_len - offset - 1);
-         if (!g_utf8_validate((gchar *)value2, max_len, &end)) {
-            GOTO(failure);
-         }
-         offset += strlen((gchar *)value2);
-         GOTO(success);
+   mongo_bson_diff_value_span(new_iter, &new_span);
+
+   if ((old_iter->type == new_iter->type) &&
+       ((new_iter->type == MONGO_BSON_DOCUMENT) ||
+        (new_iter->type == MONGO_BSON_ARRAY))) {
+      set_mark = set->len;
+      unset_mark = unset->len;
+      memcpy(&old_len, old_iter->value1, sizeof old_len);
+      memcpy(&new_len, new_iter->value1, sizeof new_len);
+      if (mongo_bson_diff_document(old_iter->value1,
+                                   GUINT32_FROM_LE(old_len),
+                                   new_iter->value1,
+                                   GUINT32_FROM_LE(new_len),
+                                   (new_iter->type == MONGO_BSON_ARRAY),
+                                   path, set, unset) &&
+          (((set->len - set_mark) + (unset->len - unset_mark)) <=
+           (path->len + 2 + new_span))) {
+         return;
       }
-      GOTO(failure);
-   case MONGO_BSON_DOCUMENT:
-   case MONGO_BSON_ARRAY:
-      if ((offset + 5) < rawbuf_len) {
-         value1 = &rawbuf[offset];
-         value2 = NULL;
-         memcpy(&max_len, value1, sizeof max_len);
-         max_len = GINT_FROM_LE(max_len);
-         if ((offset + max_len) < rawbuf_len) {
-            offset += max_len;
-            GOTO(success);
+      g_byte_array_set_size(set, set_mark);
+      g_byte_array_set_size(unset, unset_mark);
+   }
+
+   mongo_bson_diff_append(set, path, new_iter);
+}
+
+/**
+ * mongo_bson_diff_document:
+ * @old_data: (in): The old document.
+ * @old_len: (in): The length of @old_data.
+ * @new_data: (in): The new document.
+ * @new_len: (in): The length of @new_data.
+ * @is_array: (in): If the documents are arrays.
+ * @path: (in): The dotted path of the documents, or an empty string.
+ * @set: (in): The elements of the $set document.
+ * @unset: (in): The elements of the $unset document.
+ *
+ * Appends the updates that turn @old_data into @new_data. A changed field
+ * whose name contains '.' or starts with '$' cannot be named in a path.
+ *
+ * Returns: %FALSE if the changes cannot be expressed with dotted paths,
+ *   in which case the caller should set the whole document.
+ */
+static gboolean
+mongo_bson_diff_document (const guint8 *old_data,
+                          gsize         old_len,
+                          const guint8 *new_data,
+                          gsize         new_len,
+                          gboolean      is_array,
+                          GString      *path,
+                          GByteArray   *set,
+                          GByteArray   *unset)
+{
+   MongoBsonRawIter other;
+   MongoBsonRawIter iter;
+   static const guint8 one[4] = { 1, 0, 0, 0 };
+   const guint8 type = MONGO_BSON_INT32;
+   gsize path_len = path->len;
+   gsize hint = 4;
+   gboolean found;
+
+   mongo_bson_raw_iter_init_from_data(&iter, new_data, new_len);
+   while (mongo_bson_raw_iter_next(&iter)) {
+      found = mongo_bson_diff_find(old_data, old_len, &hint, iter.key,
+                                   &other);
+      if (mongo_bson_diff_is_path_unsafe(iter.key)) {
+         if (found && mongo_bson_diff_equal(&other, &iter)) {
+            continue;
          }
+         return FALSE;
       }
-      GOTO(failure);
-   case MONGO_BSON_NULL:
-   case MONGO_BSON_UNDEFINED:
-      value1 = NULL;
-      value2 = NULL;
-      offset--;
-      GOTO(success);
-   case MONGO_BSON_OBJECT_ID:
-      if ((offset + 12) < rawbuf_len) {
-         value1 = &rawbuf[offset];
-         value2 = NULL;
-         offset += 11;
-         GOTO(success);
-      }
-      GOTO(failure);
-   case MONGO_BSON_BOOLEAN:
-      if ((offset + 1) < rawbuf_len) {
-         value1 = &rawbuf[offset];
-         value2 = NULL;
-         GOTO(success);
-      }
-      GOTO(failure);
-   case MONGO_BSON_DATE_TIME:
-   case MONGO_BSON_DOUBLE:
-   case MONGO_BSON_INT64:
-      if ((offset + 8) < rawbuf_len) {
-         value1 = &rawbuf[offset];
-         value2 = NULL;
-         offset += 7;
-         GOTO(success);
-      }
-      GOTO(failure);
-   case MONGO_BSON_REGEX:
-      value1 = &rawbuf[offset];
-      max_len = first_nul((gchar *)value1, rawbuf_len - offset - 1);
-      if (!g_utf8_validate((gchar *)value1, max_len, &end)) {
-         GOTO(failure);
-      }
-      offset += max_len + 1;
-      if ((offset + 1) >= rawbuf_len) {
-         GOTO(failure);
+      if (path_len) {
+         g_string_append_c(path, '.');
       }
-      value2 = &rawbuf[offset];
-      max_len = first_nul((gchar *)value2, rawbuf_len - offset - 1);
-      if (!g_utf8_validate((gchar *)value2, max_len, &end)) {
-         GOTO(failure);
+      g_string_append(path, iter.key);
+      if (found) {
+         mongo_bson_diff_value(path, &other, &iter, set, unset);
+      } else {
+         mongo_bson_diff_append(set, path, &iter);
       }
-      offset += max_len + 1;
-      GOTO(success);
-   case MONGO_BSON_INT32:
-      if ((offset + 4) < rawbuf_len) {
-         value1 = &rawbuf[offset];
-         value2 = NULL;
-         offset += 3;
-         GOTO(success);
+      g_string_truncate(path, path_len);
+   }
+
+   /*
+    * Removing an array element with $unset would leave a null in its
+    * place, so shrinking arrays requires setting the whole array.
+    */
+   hint = 4;
+   mongo_bson_raw_iter_init_from_data(&iter, old_data, old_len);
+   while (mongo_bson_raw_iter_next(&iter)) {
+      if (!mongo_bson_diff_find(new_data, new_len, &hint, iter.key, &other)) {
+         if (is_array || mongo_bson_diff_is_path_unsafe(iter.key)) {
+            return FALSE;
+         }
+         if (path_len) {
+            g_string_append_c(path, '.');
+         }
+         g_string_append(path, iter.key);
+         g_byte_array_append(unset, &type, 1);
+         g_byte_array_append(unset, (const guint8 *)path->str, path->len + 1);
+         g_byte_array_append(unset, one, sizeof one);
+         g_string_truncate(path, path_len);
       }
-      GOTO(failure);
-   default:
-      GOTO(failure);
    }
 
-success:
-   iter->user_data3 = GSIZE_TO_POINTER(offset);
-   iter->user_data4 = (gpointer)key;
-   iter->user_data5 = GINT_TO_POINTER(type);
-   iter->user_data6 = (gpointer)value1;
-   iter->user_data7 = (gpointer)value2;
    return TRUE;
+}
 
-failure:
-   memset(iter, 0, sizeof *iter);
-   return FALSE;
+static void
+mongo_bson_diff_append_document (MongoBson   *bson,
+                                 const gchar *key,
+                                 GByteArray  *elements)
+{
+   const guint8 trailing = 0;
+   guint32 doc_len;
+
+   g_byte_array_append(elements, &trailing, 1);
+   doc_len = GUINT32_TO_LE(elements->len + 4);
+   mongo_bson_append(bson, MONGO_BSON_DOCUMENT, key,
+                     (const guint8 *)&doc_len, sizeof doc_len,
+                     elements->data, elements->len);
+}
+
+/**
+ * mongo_bson_diff:
+ * @old_bson: (in): The previous version of a document.
+ * @new_bson: (in): The current version of the document.
+ *
+ * Creates an update document that turns @old_bson into @new_bson using
+ * the "$set" and "$unset" operators with dotted paths. Embedded documents
+ * and arrays are compared recursively, and only the fields that changed
+ * are included. A changed embedded document is set as a whole whenever
+ * that is smaller than its individual changes, or when its changes cannot
+ * be expressed with dotted paths, such as an array that shrank.
+ *
+ * Values are compared by their encoding, so changing the numeric type of a
+ * field is considered a change. Operators that are not needed are omitted,
+ * and the result is an empty document if both versions are identical.
+ *
+ * A top-level field whose name contains '.' or starts with '$' cannot be
+ * updated this way, since the server would read its name as a path. If
+ * such a field changed, %NULL is returned and the caller must replace the
+ * whole document instead.
+ *
+ * Returns: (transfer full) (allow-none): A #MongoBson that should be freed
+ *   with mongo_bson_unref(), or %NULL if the changes cannot be expressed
+ *   as an update.
+ */
+MongoBson *
+mongo_bson_diff (MongoBson *old_bson,
+                 MongoBson *new_bson)
+{
+   const guint8 *old_data;
+   const guint8 *new_data;
+   GByteArray *unset;
+   GByteArray *set;
+   MongoBson *ret;
+   GString *path;
+   gsize old_len;
+   gsize new_len;
+
+   g_return_val_if_fail(old_bson != NULL, NULL);
+   g_return_val_if_fail(new_bson != NULL, NULL);
+
+   old_data = mongo_bson_get_buffer(old_bson, &old_len);
+   new_data = mongo_bson_get_buffer(new_bson, &new_len);
+
+   ret = mongo_bson_new();
+
+   if ((old_len == new_len) && !memcmp(old_data, new_data, new_len)) {
+      return ret;
+   }
+
+   set = g_byte_array_new();
+   unset = g_byte_array_new();
+   path = g_string_new(NULL);
+
+   if (!mongo_bson_diff_document(old_data, old_len, new_data, new_len,
+                                 FALSE, path, set, unset)) {
+      mongo_bson_unref(ret);
+      ret = NULL;
+   } else if (set->len) {
+      mongo_bson_diff_append_document(ret, "$set", set);
+   }
+
+   if (ret && unset->len) {
+      mongo_bson_diff_append_document(ret, "$unset", unset);
+   }
+
+   g_string_free(path, TRUE);
+   g_byte_array_free(unset, TRUE);
+   g_byte_array_free(set, TRUE);
+
+   return ret;
 }
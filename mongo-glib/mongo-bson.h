@@ -19,35 +19,64 @@
 #ifndef MONGO_BSON_H
 #define MONGO_BSON_H
 
-#include <glib-object.h>
+#include <gio/gio.h>
+#include <string.h>
 
+#include "mongo-decimal128.h"
 #include "mongo-object-id.h"
 
 G_BEGIN_DECLS
 
-#define MONGO_TYPE_BSON (mongo_bson_get_type())
+#define MONGO_TYPE_BSON                (mongo_bson_get_type())
+#define MONGO_TYPE_BSON_BINARY_SUBTYPE (mongo_bson_binary_subtype_get_type())
 
 typedef struct _MongoBson     MongoBson;
 typedef struct _MongoBsonIter MongoBsonIter;
+typedef struct _MongoBsonRawIter MongoBsonRawIter;
 typedef enum   _MongoBsonType MongoBsonType;
+typedef enum   _MongoBsonBinarySubtype MongoBsonBinarySubtype;
 
 enum _MongoBsonType
 {
-   MONGO_BSON_DOUBLE    = 0x01,
-   MONGO_BSON_UTF8      = 0x02,
-   MONGO_BSON_DOCUMENT  = 0x03,
-   MONGO_BSON_ARRAY     = 0x04,
+   MONGO_BSON_DOUBLE                = 0x01,
+   MONGO_BSON_UTF8                  = 0x02,
+   MONGO_BSON_DOCUMENT              = 0x03,
+   MONGO_BSON_ARRAY                 = 0x04,
+   MONGO_BSON_BINARY                = 0x05,
+   MONGO_BSON_UNDEFINED             = 0x06,
+   MONGO_BSON_OBJECT_ID             = 0x07,
+   MONGO_BSON_BOOLEAN               = 0x08,
+   MONGO_BSON_DATE_TIME             = 0x09,
+   MONGO_BSON_NULL                  = 0x0A,
+   MONGO_BSON_REGEX                 = 0x0B,
+   MONGO_BSON_DBPOINTER             = 0x0C,
+   MONGO_BSON_JAVASCRIPT            = 0x0D,
+   MONGO_BSON_SYMBOL                = 0x0E,
+   MONGO_BSON_JAVASCRIPT_WITH_SCOPE = 0x0F,
+   MONGO_BSON_INT32                 = 0x10,
+   MONGO_BSON_TIMESTAMP             = 0x11,
+   MONGO_BSON_INT64                 = 0x12,
+   MONGO_BSON_DECIMAL128            = 0x13,
 
-   MONGO_BSON_UNDEFINED = 0x06,
-   MONGO_BSON_OBJECT_ID = 0x07,
-   MONGO_BSON_BOOLEAN   = 0x08,
-   MONGO_BSON_DATE_TIME = 0x09,
-   MONGO_BSON_NULL      = 0x0A,
-   MONGO_BSON_REGEX     = 0x0B,
-
-   MONGO_BSON_INT32     = 0x10,
+   MONGO_BSON_MAX_KEY               = 0x7F,
+   MONGO_BSON_MIN_KEY               = 0xFF,
+};
 
-   MONGO_BSON_INT64     = 0x12,
+/**
+ * MongoBsonBinarySubtype:
+ *
+ * The subtype stored with a %MONGO_BSON_BINARY value. Values from
+ * %MONGO_BSON_BINARY_USER up to 0xFF are reserved for applications.
+ */
+enum _MongoBsonBinarySubtype
+{
+   MONGO_BSON_BINARY_GENERIC    = 0x00,
+   MONGO_BSON_BINARY_FUNCTION   = 0x01,
+   MONGO_BSON_BINARY_OLD        = 0x02,
+   MONGO_BSON_BINARY_UUID_OLD   = 0x03,
+   MONGO_BSON_BINARY_UUID       = 0x04,
+   MONGO_BSON_BINARY_MD5        = 0x05,
+   MONGO_BSON_BINARY_USER       = 0x80,
 };
 
 struct _MongoBsonIter
@@ -63,36 +92,128 @@ struct _MongoBsonIter
    gpointer user_data8;
 };
 
+/**
+ * MongoBsonRawIter:
+ *
+ * A lightweight iterator over the raw bytes of a BSON document. Unlike
+ * #MongoBsonIter, the fields are typed and the common accessors are
+ * inlined, so walking a document does not require a function call or
+ * precondition checks per value. The fields should be considered
+ * read-only.
+ */
+struct _MongoBsonRawIter
+{
+   /*< private >*/
+   const guint8 *data;   /* Raw data buffer */
+   gsize         length; /* Raw buffer length */
+   gsize         offset; /* Offset of the next element */
+   const gchar  *key;    /* Key of the current element */
+   const guint8 *value1; /* First chunk of the current value */
+   const guint8 *value2; /* Second chunk of the current value */
+   guint8        type;   /* MongoBsonType of the current element */
+};
+
+GType          mongo_bson_binary_subtype_get_type  (void) G_GNUC_CONST;
 GType          mongo_bson_get_type                 (void) G_GNUC_CONST;
 GType          mongo_bson_type_get_type            (void) G_GNUC_CONST;
+gint           mongo_bson_compare                  (MongoBson      *bson,
+                                                    MongoBson      *other);
+MongoBson     *mongo_bson_diff                     (MongoBson      *old_bson,
+                                                    MongoBson      *new_bson);
+gboolean       mongo_bson_equal                    (gconstpointer   v1,
+                                                    gconstpointer   v2);
+guint          mongo_bson_hash                     (gconstpointer   v);
+guint64        mongo_bson_hash64                   (MongoBson      *bson);
 const guint8  *mongo_bson_get_data                 (MongoBson      *bson,
                                                     gsize          *length);
+GOutputVector *mongo_bson_get_vectors              (MongoBson      *bson,
+                                                    guint          *n_vectors);
+MongoBson     *mongo_bson_dup                      (MongoBson      *bson);
+MongoBson     *mongo_bson_exclude_fields           (MongoBson      *bson,
+                                                    const gchar * const *fields);
+MongoBson     *mongo_bson_include_fields           (MongoBson      *bson,
+                                                    const gchar * const *fields);
 MongoBson     *mongo_bson_new                      (void);
 MongoBson     *mongo_bson_new_from_data            (const guint8   *buffer,
                                                     gsize           length);
+MongoBson     *mongo_bson_new_from_static_data     (guint8         *buffer,
+                                                    gsize           length,
+                                                    GDestroyNotify  notify);
 MongoBson     *mongo_bson_ref                      (MongoBson      *bson);
 void           mongo_bson_unref                    (MongoBson      *bson);
 void           mongo_bson_append_array             (MongoBson      *bson,
                                                     const gchar    *key,
                                                     MongoBson      *value);
+void           mongo_bson_append_array_begin       (MongoBson      *bson,
+                                                    const gchar    *key);
+void           mongo_bson_append_array_end         (MongoBson      *bson);
+void           mongo_bson_append_binary            (MongoBson      *bson,
+                                                    const gchar    *key,
+                                                    MongoBsonBinarySubtype subtype,
+                                                    const guint8   *data,
+                                                    gsize           length);
+void           mongo_bson_append_binary_bytes      (MongoBson      *bson,
+                                                    const gchar    *key,
+                                                    MongoBsonBinarySubtype subtype,
+                                                    GBytes         *bytes);
+gboolean       mongo_bson_append_binary_from_stream (MongoBson     *bson,
+                                                    const gchar    *key,
+                                                    MongoBsonBinarySubtype subtype,
+                                                    GInputStream   *stream,
+                                                    gsize           length,
+                                                    GCancellable   *cancellable,
+                                                    GError        **error);
 void           mongo_bson_append_boolean           (MongoBson      *bson,
                                                     const gchar    *key,
                                                     gboolean       value);
 void           mongo_bson_append_bson              (MongoBson      *bson,
                                                     const gchar    *key,
                                                     MongoBson      *value);
+void           mongo_bson_append_bson_begin        (MongoBson      *bson,
+                                                    const gchar    *key);
+void           mongo_bson_append_bson_end          (MongoBson      *bson);
 void           mongo_bson_append_date_time         (MongoBson      *bson,
                                                     const gchar    *key,
                                                     GDateTime      *value);
+void           mongo_bson_append_dbpointer         (MongoBson      *bson,
+                                                    const gchar    *key,
+                                                    const gchar    *collection,
+                                                    const MongoObjectId *object_id);
+void           mongo_bson_append_decimal128        (MongoBson      *bson,
+                                                    const gchar    *key,
+                                                    const MongoDecimal128 *value);
 void           mongo_bson_append_double            (MongoBson      *bson,
                                                     const gchar    *key,
                                                     gdouble         value);
+void           mongo_bson_append_double_array      (MongoBson      *bson,
+                                                    const gchar    *key,
+                                                    const gdouble  *values,
+                                                    guint           n_values);
 void           mongo_bson_append_int               (MongoBson      *bson,
                                                     const gchar    *key,
                                                     gint32          value);
+void           mongo_bson_append_int_array         (MongoBson      *bson,
+                                                    const gchar    *key,
+                                                    const gint32   *values,
+                                                    guint           n_values);
 void           mongo_bson_append_int64             (MongoBson      *bson,
                                                     const gchar    *key,
                                                     gint64          value);
+void           mongo_bson_append_int64_array       (MongoBson      *bson,
+                                                    const gchar    *key,
+                                                    const gint64   *values,
+                                                    guint           n_values);
+void           mongo_bson_append_javascript        (MongoBson      *bson,
+                                                    const gchar    *key,
+                                                    const gchar    *code);
+void           mongo_bson_append_javascript_with_scope (MongoBson  *bson,
+                                                    const gchar    *key,
+                                                    const gchar    *code,
+                                                    MongoBson      *scope);
+void           mongo_bson_append_max_key           (MongoBson      *bson,
+                                                    const gchar    *key);
+void           mongo_bson_append_min_key           (MongoBson      *bson,
+                                                    const gchar    *key);
 void           mongo_bson_append_null              (MongoBson      *bson,
                                                     const gchar    *key);
 void           mongo_bson_append_object_id         (MongoBson      *bson,
@@ -105,36 +226,270 @@ void           mongo_bson_append_regex             (MongoBson      *bson,
 void           mongo_bson_append_string            (MongoBson      *bson,
                                                     const gchar    *key,
                                                     const gchar    *value);
+void           mongo_bson_append_string_bytes      (MongoBson      *bson,
+                                                    const gchar    *key,
+                                                    GBytes         *bytes);
+void           mongo_bson_append_string_array      (MongoBson      *bson,
+                                                    const gchar    *key,
+                                                    const gchar * const *values,
+                                                    guint           n_values);
+void           mongo_bson_append_symbol            (MongoBson      *bson,
+                                                    const gchar    *key,
+                                                    const gchar    *value);
+void           mongo_bson_append_timestamp         (MongoBson      *bson,
+                                                    const gchar    *key,
+                                                    guint32         timestamp,
+                                                    guint32         increment);
 void           mongo_bson_append_timeval           (MongoBson      *bson,
                                                     const gchar    *key,
                                                     GTimeVal       *value);
 void           mongo_bson_append_undefined         (MongoBson      *bson,
                                                     const gchar    *key);
+gint           mongo_bson_iter_compare_value       (MongoBsonIter  *iter,
+                                                    MongoBsonIter  *other);
+guint64        mongo_bson_iter_hash_value          (MongoBsonIter  *iter);
 void           mongo_bson_iter_init                (MongoBsonIter  *iter,
                                                     MongoBson      *bson);
 gboolean       mongo_bson_iter_find                (MongoBsonIter  *iter,
                                                     const gchar    *key);
 const gchar   *mongo_bson_iter_get_key             (MongoBsonIter  *iter);
 MongoBson     *mongo_bson_iter_get_value_array     (MongoBsonIter  *iter);
+const guint8  *mongo_bson_iter_get_value_binary    (MongoBsonIter  *iter,
+                                                    MongoBsonBinarySubtype *subtype,
+                                                    gsize          *length);
 gboolean       mongo_bson_iter_get_value_boolean   (MongoBsonIter  *iter);
 MongoBson     *mongo_bson_iter_get_value_bson      (MongoBsonIter  *iter);
 GDateTime     *mongo_bson_iter_get_value_date_time (MongoBsonIter  *iter);
+void           mongo_bson_iter_get_value_dbpointer (MongoBsonIter  *iter,
+                                                    const gchar   **collection,
+                                                    MongoObjectId  *object_id);
+void           mongo_bson_iter_get_value_decimal128 (MongoBsonIter *iter,
+                                                    MongoDecimal128 *value);
 gdouble        mongo_bson_iter_get_value_double    (MongoBsonIter  *iter);
+gboolean       mongo_bson_iter_get_value_double_array (MongoBsonIter *iter,
+                                                    gdouble        *values,
+                                                    guint           n_values,
+                                                    guint          *n_elements);
 MongoObjectId *mongo_bson_iter_get_value_object_id (MongoBsonIter  *iter);
 gint32         mongo_bson_iter_get_value_int       (MongoBsonIter  *iter);
+gboolean       mongo_bson_iter_get_value_int_array (MongoBsonIter  *iter,
+                                                    gint32         *values,
+                                                    guint           n_values,
+                                                    guint          *n_elements);
 gint64         mongo_bson_iter_get_value_int64     (MongoBsonIter  *iter);
+const gchar   *mongo_bson_iter_get_value_javascript (MongoBsonIter *iter,
+                                                    gsize          *length);
+MongoBson     *mongo_bson_iter_get_value_javascript_scope (MongoBsonIter *iter);
+gboolean       mongo_bson_iter_get_value_int64_array (MongoBsonIter *iter,
+                                                    gint64         *values,
+                                                    guint           n_values,
+                                                    guint          *n_elements);
 void           mongo_bson_iter_get_value_regex     (MongoBsonIter  *iter,
                                                     const gchar   **regex,
                                                     const gchar   **options);
 const gchar   *mongo_bson_iter_get_value_string    (MongoBsonIter  *iter,
                                                     gsize          *length);
+const gchar   *mongo_bson_iter_get_value_symbol    (MongoBsonIter  *iter,
+                                                    gsize          *length);
+void           mongo_bson_iter_get_value_timestamp (MongoBsonIter  *iter,
+                                                    guint32        *timestamp,
+                                                    guint32        *increment);
 void           mongo_bson_iter_get_value_timeval   (MongoBsonIter  *iter,
                                                     GTimeVal       *value);
 MongoBsonType  mongo_bson_iter_get_value_type      (MongoBsonIter  *iter);
 gboolean       mongo_bson_iter_next                (MongoBsonIter  *iter);
 gboolean       mongo_bson_iter_recurse             (MongoBsonIter  *iter,
                                                     MongoBsonIter  *child);
+gboolean       mongo_bson_iter_replace_value       (MongoBsonIter  *iter,
+                                                    MongoBson      *bson,
+                                                    MongoBsonIter  *value);
+gboolean       mongo_bson_iter_set_value_boolean   (MongoBsonIter  *iter,
+                                                    MongoBson      *bson,
+                                                    gboolean        value);
+gboolean       mongo_bson_iter_set_value_date_time (MongoBsonIter  *iter,
+                                                    MongoBson      *bson,
+                                                    GDateTime      *value);
+gboolean       mongo_bson_iter_set_value_double    (MongoBsonIter  *iter,
+                                                    MongoBson      *bson,
+                                                    gdouble         value);
+gboolean       mongo_bson_iter_set_value_int       (MongoBsonIter  *iter,
+                                                    MongoBson      *bson,
+                                                    gint32          value);
+gboolean       mongo_bson_iter_set_value_int64     (MongoBsonIter  *iter,
+                                                    MongoBson      *bson,
+                                                    gint64          value);
+gboolean       mongo_bson_iter_set_value_object_id (MongoBsonIter  *iter,
+                                                    MongoBson      *bson,
+                                                    const MongoObjectId *object_id);
+gboolean       mongo_bson_iter_set_value_timeval   (MongoBsonIter  *iter,
+                                                    MongoBson      *bson,
+                                                    GTimeVal       *value);
+gint           mongo_bson_raw_iter_compare_value   (const MongoBsonRawIter *iter,
+                                                    const MongoBsonRawIter *other);
+guint64        mongo_bson_raw_iter_hash_value      (const MongoBsonRawIter *iter);
+void           mongo_bson_raw_iter_init            (MongoBsonRawIter *iter,
+                                                    MongoBson        *bson);
+gboolean       mongo_bson_raw_iter_init_from_data  (MongoBsonRawIter *iter,
+                                                    const guint8     *data,
+                                                    gsize             length);
+gboolean       mongo_bson_raw_iter_find            (MongoBsonRawIter *iter,
+                                                    const gchar      *key);
+gboolean       mongo_bson_raw_iter_next            (MongoBsonRawIter *iter);
+gboolean       mongo_bson_raw_iter_recurse         (MongoBsonRawIter *iter,
+                                                    MongoBsonRawIter *child);
+
+static inline const gchar *
+mongo_bson_raw_iter_get_key (const MongoBsonRawIter *iter)
+{
+   return iter->key;
+}
+
+static inline MongoBsonType
+mongo_bson_raw_iter_get_value_type (const MongoBsonRawIter *iter)
+{
+   return (MongoBsonType)iter->type;
+}
+
+/*
+ * Returns a pointer to the bytes within the document rather than a copy.
+ */
+static inline const guint8 *
+mongo_bson_raw_iter_get_value_binary (const MongoBsonRawIter  *iter,
+                                      MongoBsonBinarySubtype  *subtype,
+                                      gsize                   *length)
+{
+   gint32 real_length;
+
+   if (G_LIKELY(iter->type == MONGO_BSON_BINARY)) {
+      memcpy(&real_length, iter->value1, sizeof real_length);
+      if (subtype) {
+         *subtype = (MongoBsonBinarySubtype)iter->value1[4];
+      }
+      if (length) {
+         *length = GINT32_FROM_LE(real_length);
+      }
+      return iter->value2;
+   }
+   if (length) {
+      *length = 0;
+   }
+   return NULL;
+}
+
+static inline gboolean
+mongo_bson_raw_iter_get_value_boolean (const MongoBsonRawIter *iter)
+{
+   if (G_LIKELY(iter->type == MONGO_BSON_BOOLEAN)) {
+      return !!iter->value1[0];
+   }
+   return FALSE;
+}
+
+static inline void
+mongo_bson_raw_iter_get_value_decimal128 (const MongoBsonRawIter *iter,
+                                          MongoDecimal128        *value)
+{
+   if (G_LIKELY(iter->type == MONGO_BSON_DECIMAL128)) {
+      memcpy(&value->low, iter->value1, sizeof value->low);
+      memcpy(&value->high, iter->value1 + 8, sizeof value->high);
+      value->low = GUINT64_FROM_LE(value->low);
+      value->high = GUINT64_FROM_LE(value->high);
+      return;
+   }
+   memset(value, 0, sizeof *value);
+}
+
+static inline gdouble
+mongo_bson_raw_iter_get_value_double (const MongoBsonRawIter *iter)
+{
+   gdouble value;
+
+   if (G_LIKELY(iter->type == MONGO_BSON_DOUBLE)) {
+      memcpy(&value, iter->value1, sizeof value);
+      return value;
+   }
+   return 0.0;
+}
+
+static inline gint32
+mongo_bson_raw_iter_get_value_int (const MongoBsonRawIter *iter)
+{
+   gint32 value;
+
+   if (G_LIKELY(iter->type == MONGO_BSON_INT32)) {
+      memcpy(&value, iter->value1, sizeof value);
+      return GINT32_FROM_LE(value);
+   }
+   return 0;
+}
+
+static inline gint64
+mongo_bson_raw_iter_get_value_int64 (const MongoBsonRawIter *iter)
+{
+   gint64 value;
+
+   if (G_LIKELY(iter->type == MONGO_BSON_INT64)) {
+      memcpy(&value, iter->value1, sizeof value);
+      return GINT64_FROM_LE(value);
+   }
+   return 0;
+}
+
+static inline const MongoObjectId *
+mongo_bson_raw_iter_get_value_object_id (const MongoBsonRawIter *iter)
+{
+   if (G_LIKELY(iter->type == MONGO_BSON_OBJECT_ID)) {
+      return (const MongoObjectId *)iter->value1;
+   }
+   return NULL;
+}
+
+/*
+ * Unlike mongo_bson_iter_get_value_string(), @length does not include the
+ * trailing nul byte.
+ */
+static inline const gchar *
+mongo_bson_raw_iter_get_value_string (const MongoBsonRawIter *iter,
+                                      gsize                  *length)
+{
+   gint32 real_length;
+
+   if (G_LIKELY(iter->type == MONGO_BSON_UTF8)) {
+      if (length) {
+         memcpy(&real_length, iter->value1, sizeof real_length);
+         *length = GINT32_FROM_LE(real_length) - 1;
+      }
+      return (const gchar *)iter->value2;
+   }
+   if (length) {
+      *length = 0;
+   }
+   return NULL;
+}
+
+/*
+ * The increment is the low word and the seconds the high word, so the
+ * combined value orders timestamps chronologically.
+ */
+static inline guint64
+mongo_bson_raw_iter_get_value_timestamp (const MongoBsonRawIter *iter,
+                                         guint32                *timestamp,
+                                         guint32                *increment)
+{
+   guint64 value = 0;
 
+   if (G_LIKELY(iter->type == MONGO_BSON_TIMESTAMP)) {
+      memcpy(&value, iter->value1, sizeof value);
+      value = GUINT64_FROM_LE(value);
+   }
+   if (timestamp) {
+      *timestamp = (guint32)(value >> 32);
+   }
+   if (increment) {
+      *increment = (guint32)value;
+   }
+   return value;
+}
 
 G_END_DECLS
 
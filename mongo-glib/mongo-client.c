@@ -17,11 +17,30 @@
  */
 
 #include <glib/gi18n.h>
+#include <string.h>
 
 #include "mongo-client.h"
 
 G_DEFINE_TYPE(MongoClient, mongo_client, G_TYPE_OBJECT)
 
+/*
+ * The number of bytes to request from the socket at a time.
+ */
+#define MONGO_CLIENT_READ_SIZE 4096
+
+/*
+ * The largest message the server will send.
+ */
+#define MONGO_CLIENT_MAX_MESSAGE_SIZE 48000000
+
+#define MONGO_CLIENT_OP_REPLY 1
+
+/*
+ * The most segments handed to a single g_socket_send_message(), well below
+ * the IOV_MAX of any platform.
+ */
+#define MONGO_CLIENT_MAX_VECTORS 64
+
 typedef struct
 {
    gchar host[255];
@@ -36,6 +55,17 @@ typedef enum
    MONGO_CLIENT_FAILED,
 } MongoClientState;
 
+/*
+ * The I/O thread of a client connected with mongo_client_connect(). It is
+ * owned by the thread, which outlives the client when the client is
+ * finalized on the thread itself.
+ */
+typedef struct
+{
+   GMainLoop *loop;
+   guint      n_reads; /* Reads that have not called back yet */
+} MongoClientThread;
+
 struct _MongoClientPrivate
 {
    MongoClientState   state;
@@ -43,8 +73,16 @@ struct _MongoClientPrivate
    MongoClientPeer    primary;
    guint              timeout;
    GSocketConnection *connection;
+   GCancellable      *cancellable;
    gint               next_id;
-   guint8            *read_buffer;
+   GByteArray        *incoming;
+   GHashTable        *requests;
+   GQueue             outgoing;
+   GSource           *write_source;
+   GMainContext      *context;
+   GMainLoop         *loop;
+   GThread           *thread;
+   MongoClientThread *io;
 };
 
 enum
@@ -170,45 +208,541 @@ mongo_client_get_next_id (MongoClient *client)
    return g_atomic_int_add(&client->priv->next_id, 1);
 }
 
+typedef struct
+{
+   MongoClient        *client;
+   GSimpleAsyncResult *simple;
+   GByteArray         *header;
+   MongoBson          *bson;
+   MongoBson          *fields;
+   GOutputVector      *vectors;
+   guint               n_vectors;
+   guint               index;
+   gint32              request_id;
+   gboolean            want_reply;
+} MongoClientSend;
+
+typedef struct
+{
+   MongoClient       *client;
+   MongoClientThread *io;
+   guint8             buffer[MONGO_CLIENT_READ_SIZE];
+} MongoClientRead;
+
+static void mongo_client_read (MongoClient *client);
+
 static void
-mongo_client_send_write_cb (GObject      *object,
-                            GAsyncResult *result,
-                            gpointer      user_data)
+mongo_client_send_free (MongoClientSend *send)
 {
-   GSimpleAsyncResult *simple = user_data;
-   GOutputStream *output = (GOutputStream *)object;
-   gboolean want_reply;
-   GError *error = NULL;
-   gssize n_written;
+   g_object_unref(send->simple);
+   g_byte_array_free(send->header, TRUE);
+   if (send->bson) {
+      mongo_bson_unref(send->bson);
+   }
+   if (send->fields) {
+      mongo_bson_unref(send->fields);
+   }
+   g_free(send->vectors);
+   g_slice_free(MongoClientSend, send);
+}
 
-   g_return_if_fail(G_IS_OUTPUT_STREAM(output));
-   g_return_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple));
+/*
+ * Fails @send unless the reply handler owns it, in which case it is failed
+ * only if it is still waiting for its reply.
+ */
+static void
+mongo_client_send_fail (MongoClient     *client,
+                        MongoClientSend *send,
+                        const GError    *error)
+{
+   GHashTable *requests = client->priv->requests;
+   gpointer key = GINT_TO_POINTER(send->request_id);
 
-   n_written = g_output_stream_write_finish(output, result, &error);
-   if (n_written <= 0) {
-      g_simple_async_result_take_error(simple, error);
+   if (send->want_reply) {
+      if (!g_hash_table_lookup(requests, key)) {
+         return;
+      }
+      g_hash_table_remove(requests, key);
+   }
+
+   g_simple_async_result_set_from_error(send->simple, error);
+   g_simple_async_result_complete_in_idle(send->simple);
+}
+
+static void
+mongo_client_fail (MongoClient  *client,
+                   const GError *error)
+{
+   MongoClientPrivate *priv = client->priv;
+   GSimpleAsyncResult *simple;
+   GHashTableIter iter;
+
+   priv->state = MONGO_CLIENT_FAILED;
+
+   g_hash_table_iter_init(&iter, priv->requests);
+   while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&simple)) {
+      g_simple_async_result_set_from_error(simple, error);
       g_simple_async_result_complete_in_idle(simple);
-      g_object_unref(simple);
+      g_hash_table_iter_remove(&iter);
+   }
+}
+
+static gboolean mongo_client_write_cb (GSocket      *socket,
+                                       GIOCondition  condition,
+                                       gpointer      user_data);
+
+/*
+ * Writes as much of the queued messages as the socket accepts without
+ * blocking, in the order they were sent. Each g_socket_send_message()
+ * writes the remaining segments of a message in one vectored write. When
+ * the socket is full, writing continues once it is writable again.
+ */
+static void
+mongo_client_write_next (MongoClient *client)
+{
+   MongoClientPrivate *priv = client->priv;
+   MongoClientSend *send;
+   GOutputVector *vector;
+   GSocket *socket;
+   GError *error = NULL;
+   gssize n_written;
+
+   if (priv->write_source) {
       return;
    }
 
-   /*
-    * TODO: Do we need to write more data from the buffer?
-    */
+   while ((send = g_queue_peek_head(&priv->outgoing))) {
+      if (priv->state != MONGO_CLIENT_CONNECTED) {
+         error = g_error_new(MONGO_CLIENT_ERROR,
+                             MONGO_CLIENT_ERROR_NOT_CONNECTED,
+                             _("The connection to the server was closed."));
+         goto failure;
+      }
+
+      socket = g_socket_connection_get_socket(priv->connection);
+      n_written = g_socket_send_message(socket, NULL,
+                                        send->vectors + send->index,
+                                        MIN(send->n_vectors - send->index,
+                                            MONGO_CLIENT_MAX_VECTORS),
+                                        NULL, 0, 0, NULL, &error);
+      if (n_written < 0) {
+         if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
+            goto failure;
+         }
+         g_clear_error(&error);
+         priv->write_source = g_socket_create_source(socket, G_IO_OUT, NULL);
+         g_source_set_callback(priv->write_source,
+                               (GSourceFunc)mongo_client_write_cb,
+                               g_object_ref(client),
+                               g_object_unref);
+         g_source_attach(priv->write_source, priv->context);
+         return;
+      }
 
-   want_reply = GPOINTER_TO_INT(g_object_get_data(user_data, "want-reply"));
-   if (want_reply) {
-      g_debug("Waiting for reply from server!!");
       /*
-       * TODO: Register simple for reply handler.
+       * Skip past what was written, which may end inside a segment.
        */
+      while (send->index < send->n_vectors) {
+         vector = &send->vectors[send->index];
+         if ((gsize)n_written < vector->size) {
+            vector->buffer = (const guint8 *)vector->buffer + n_written;
+            vector->size -= n_written;
+            break;
+         }
+         n_written -= vector->size;
+         send->index++;
+      }
+
+      if (send->index < send->n_vectors) {
+         continue;
+      }
+
+      /*
+       * Messages with a reply are completed by the reply handler.
+       */
+      g_queue_pop_head(&priv->outgoing);
+      if (!send->want_reply) {
+         g_simple_async_result_complete_in_idle(send->simple);
+      }
+      mongo_client_send_free(send);
+      continue;
+
+   failure:
+      g_queue_pop_head(&priv->outgoing);
+      mongo_client_send_fail(client, send, error);
+      mongo_client_send_free(send);
+      g_clear_error(&error);
+   }
+}
+
+static gboolean
+mongo_client_write_cb (GSocket      *socket,
+                       GIOCondition  condition,
+                       gpointer      user_data)
+{
+   MongoClient *client = user_data;
+
+   g_return_val_if_fail(MONGO_IS_CLIENT(client), FALSE);
+
+   g_source_unref(client->priv->write_source);
+   client->priv->write_source = NULL;
+   mongo_client_write_next(client);
+
+   return FALSE;
+}
+
+/*
+ * Creates a message with a header for @operation. The message length is
+ * filled in by mongo_client_send_message().
+ */
+static GByteArray *
+mongo_client_message_new (MongoClient    *client,
+                          MongoOperation  operation,
+                          gint32         *request_id)
+{
+   GByteArray *message;
+   guint32 header[4];
+
+   *request_id = mongo_client_get_next_id(client);
+
+   header[0] = 0;
+   header[1] = GINT32_TO_LE(*request_id);
+   header[2] = 0;
+   header[3] = GUINT32_TO_LE(operation);
+
+   message = g_byte_array_sized_new(64);
+   g_byte_array_append(message, (guint8 *)header, sizeof header);
+
+   return message;
+}
+
+static void
+mongo_client_message_append_int32 (GByteArray *message,
+                                   gint32      value)
+{
+   value = GINT32_TO_LE(value);
+   g_byte_array_append(message, (guint8 *)&value, sizeof value);
+}
+
+static void
+mongo_client_message_append_int64 (GByteArray *message,
+                                   guint64     value)
+{
+   value = GUINT64_TO_LE(value);
+   g_byte_array_append(message, (guint8 *)&value, sizeof value);
+}
+
+static void
+mongo_client_message_append_cstring (GByteArray  *message,
+                                     const gchar *str)
+{
+   g_byte_array_append(message, (guint8 *)str, strlen(str) + 1);
+}
+
+static gboolean
+mongo_client_queue_cb (gpointer data)
+{
+   MongoClientSend *send = data;
+   MongoClientPrivate *priv = send->client->priv;
+
+   if (priv->state != MONGO_CLIENT_CONNECTED) {
+      g_simple_async_result_set_error(send->simple,
+                                      MONGO_CLIENT_ERROR,
+                                      MONGO_CLIENT_ERROR_NOT_CONNECTED,
+                                      _("Not connected to a server."));
+      g_simple_async_result_complete_in_idle(send->simple);
+      mongo_client_send_free(send);
+      return FALSE;
+   }
+
+   /*
+    * Register for the reply before writing, since the reply may be read
+    * before the write completes.
+    */
+   if (send->want_reply) {
+      g_hash_table_insert(priv->requests,
+                          GINT_TO_POINTER(send->request_id),
+                          g_object_ref(send->simple));
+   }
+
+   g_queue_push_tail(&priv->outgoing, send);
+   mongo_client_write_next(send->client);
+
+   return FALSE;
+}
+
+/*
+ * Queues @message followed by @bson and @fields for writing. The
+ * documents are written from their own segments after the message so
+ * that large values are not copied. If @want_reply is set, @simple is
+ * completed with the #MongoReply to the message.
+ */
+static void
+mongo_client_send_message (MongoClient        *client,
+                           GSimpleAsyncResult *simple,
+                           GByteArray         *message,
+                           gint32              request_id,
+                           MongoBson          *bson,
+                           MongoBson          *fields,
+                           gboolean            want_reply)
+{
+   MongoClientPrivate *priv = client->priv;
+   MongoClientSend *send;
+   GOutputVector *bson_vectors = NULL;
+   GOutputVector *fields_vectors = NULL;
+   guint n_bson_vectors = 0;
+   guint n_fields_vectors = 0;
+   guint32 length;
+   guint i;
+
+   length = message->len;
+   if (bson) {
+      bson_vectors = mongo_bson_get_vectors(bson, &n_bson_vectors);
+      for (i = 0; i < n_bson_vectors; i++) {
+         length += bson_vectors[i].size;
+      }
+   }
+   if (fields) {
+      fields_vectors = mongo_bson_get_vectors(fields, &n_fields_vectors);
+      for (i = 0; i < n_fields_vectors; i++) {
+         length += fields_vectors[i].size;
+      }
+   }
+
+   length = GUINT32_TO_LE(length);
+   memcpy(message->data, &length, sizeof length);
+
+   send = g_slice_new0(MongoClientSend);
+   send->client = client;
+   send->simple = simple;
+   send->header = message;
+   send->bson = bson ? mongo_bson_ref(bson) : NULL;
+   send->fields = fields ? mongo_bson_ref(fields) : NULL;
+   send->request_id = request_id;
+   send->want_reply = want_reply;
+   send->n_vectors = 1 + n_bson_vectors + n_fields_vectors;
+   send->vectors = g_new(GOutputVector, send->n_vectors);
+   send->vectors[0].buffer = message->data;
+   send->vectors[0].size = message->len;
+   if (n_bson_vectors) {
+      memcpy(send->vectors + 1, bson_vectors,
+             n_bson_vectors * sizeof *bson_vectors);
+   }
+   if (n_fields_vectors) {
+      memcpy(send->vectors + 1 + n_bson_vectors, fields_vectors,
+             n_fields_vectors * sizeof *fields_vectors);
+   }
+   g_free(bson_vectors);
+   g_free(fields_vectors);
+
+   /*
+    * The connection is only touched from the context it was created in,
+    * so messages sent from other threads are handed over to it.
+    */
+   if (priv->context) {
+      g_main_context_invoke(priv->context, mongo_client_queue_cb, send);
+   } else {
+      mongo_client_queue_cb(send);
+   }
+}
+
+/*
+ * Converts the failure flags of @reply into an error.
+ */
+static gboolean
+mongo_client_check_reply (MongoReply  *reply,
+                          GError     **error)
+{
+   MongoBsonIter iter;
+   const gchar *message = NULL;
+
+   if ((reply->flags & MONGO_REPLY_QUERY_FAILURE)) {
+      if (reply->n_documents) {
+         mongo_bson_iter_init(&iter, reply->documents[0]);
+         if (mongo_bson_iter_find(&iter, "$err") &&
+             (mongo_bson_iter_get_value_type(&iter) == MONGO_BSON_UTF8)) {
+            message = mongo_bson_iter_get_value_string(&iter, NULL);
+         }
+      }
+      g_set_error(error, MONGO_CLIENT_ERROR, MONGO_CLIENT_ERROR_QUERY_FAILURE,
+                  "%s", message ? message : _("The query failed."));
+      return FALSE;
+   }
+
+   if ((reply->flags & MONGO_REPLY_CURSOR_NOT_FOUND)) {
+      g_set_error(error, MONGO_CLIENT_ERROR,
+                  MONGO_CLIENT_ERROR_CURSOR_NOT_FOUND,
+                  _("The cursor was not found on the server."));
+      return FALSE;
+   }
+
+   return TRUE;
+}
+
+/*
+ * Dispatches the complete messages in the incoming buffer to the requests
+ * they are in response to. Returns FALSE if the stream is corrupt.
+ */
+static gboolean
+mongo_client_dispatch (MongoClient *client)
+{
+   MongoClientPrivate *priv = client->priv;
+   GSimpleAsyncResult *simple;
+   MongoReply *reply;
+   GByteArray *incoming = priv->incoming;
+   GError *error = NULL;
+   guint32 header[4];
+   gpointer key;
+
+   while (incoming->len >= sizeof header) {
+      memcpy(header, incoming->data, sizeof header);
+      header[0] = GUINT32_FROM_LE(header[0]);
+      if ((header[0] < sizeof header) ||
+          (header[0] > MONGO_CLIENT_MAX_MESSAGE_SIZE)) {
+         return FALSE;
+      }
+      if (incoming->len < header[0]) {
+         break;
+      }
+
+      key = GINT_TO_POINTER(GINT32_FROM_LE(header[2]));
+      if ((GUINT32_FROM_LE(header[3]) == MONGO_CLIENT_OP_REPLY) &&
+          (simple = g_hash_table_lookup(priv->requests, key))) {
+         g_object_ref(simple);
+         g_hash_table_remove(priv->requests, key);
+         reply = mongo_reply_new_from_data(incoming->data + sizeof header,
+                                           header[0] - sizeof header);
+         if (!reply) {
+            g_simple_async_result_set_error(simple,
+                                            MONGO_CLIENT_ERROR,
+                                            MONGO_CLIENT_ERROR_INVALID_REPLY,
+                                            _("The server sent an invalid "
+                                              "reply."));
+         } else if (!mongo_client_check_reply(reply, &error)) {
+            g_simple_async_result_take_error(simple, error);
+            mongo_reply_unref(reply);
+         } else {
+            g_simple_async_result_set_op_res_gpointer(
+                  simple, reply, (GDestroyNotify)mongo_reply_unref);
+         }
+         g_simple_async_result_complete_in_idle(simple);
+         g_object_unref(simple);
+      }
+
+      g_byte_array_remove_range(incoming, 0, header[0]);
+   }
+
+   return TRUE;
+}
+
+static void
+mongo_client_read_free (MongoClientRead *read)
+{
+   if (read->io) {
+      read->io->n_reads--;
+   }
+   g_slice_free(MongoClientRead, read);
+}
+
+static void
+mongo_client_read_cb (GObject      *object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+   MongoClientRead *read = user_data;
+   GInputStream *input = (GInputStream *)object;
+   MongoClient *client;
+   GError *error = NULL;
+   gssize n_bytes;
+
+   g_return_if_fail(G_IS_INPUT_STREAM(input));
+   g_return_if_fail(G_IS_ASYNC_RESULT(result));
+
+   n_bytes = g_input_stream_read_finish(input, result, &error);
+
+   /*
+    * The client has been finalized, there is nobody left to tell.
+    */
+   if (!(client = read->client)) {
+      g_clear_error(&error);
+      mongo_client_read_free(read);
       return;
    }
 
-   g_simple_async_result_complete_in_idle(simple);
-   g_object_unref(simple);
+   g_object_remove_weak_pointer(G_OBJECT(client), (gpointer *)&read->client);
+   g_object_ref(client);
+
+   if (n_bytes > 0) {
+      g_byte_array_append(client->priv->incoming, read->buffer, n_bytes);
+      if (mongo_client_dispatch(client)) {
+         mongo_client_read(client);
+         goto cleanup;
+      }
+      error = g_error_new(MONGO_CLIENT_ERROR,
+                          MONGO_CLIENT_ERROR_INVALID_REPLY,
+                          _("The server sent an invalid message."));
+   } else if (!error) {
+      error = g_error_new(MONGO_CLIENT_ERROR,
+                          MONGO_CLIENT_ERROR_NOT_CONNECTED,
+                          _("The connection to the server was closed."));
+   }
+
+   mongo_client_fail(client, error);
+   g_error_free(error);
+
+cleanup:
+   mongo_client_read_free(read);
+   g_object_unref(client);
+}
+
+/*
+ * The read loop does not hold a reference to the client. It is cancelled
+ * when the client is finalized and the weak pointer tells the callback
+ * that the client is gone.
+ */
+static void
+mongo_client_read (MongoClient *client)
+{
+   MongoClientPrivate *priv = client->priv;
+   MongoClientRead *read;
+   GInputStream *input;
+
+   read = g_slice_new(MongoClientRead);
+   read->client = client;
+   g_object_add_weak_pointer(G_OBJECT(client), (gpointer *)&read->client);
+   if ((read->io = priv->io)) {
+      read->io->n_reads++;
+   }
+
+   input = g_io_stream_get_input_stream(G_IO_STREAM(priv->connection));
+   g_input_stream_read_async(input,
+                             read->buffer,
+                             sizeof read->buffer,
+                             G_PRIORITY_DEFAULT,
+                             priv->cancellable,
+                             mongo_client_read_cb,
+                             read);
 }
 
+/**
+ * mongo_client_send_async:
+ * @client: (in): A #MongoClient.
+ * @collection: (in): The full name of the collection such as "db.things".
+ * @bson: (in): The document of the message.
+ * @operation: (in): The #MongoOperation to perform.
+ * @want_reply: (in): If the server replies to the message.
+ * @callback: (in): A callback to execute upon completion.
+ * @user_data: (in): User data for @callback.
+ *
+ * Sends a message with a single document to the server. Queries are sent
+ * with a limit of -1, which is how commands are run against "db.$cmd".
+ * %MONGO_OPERATION_UPDATE, %MONGO_OPERATION_GET_MORE and
+ * %MONGO_OPERATION_KILL_CURSORS are not supported.
+ *
+ * @bson is written straight from its buffer and external values, see
+ * mongo_bson_get_vectors(), so it must not be modified until @callback
+ * is executed. It may still be read.
+ */
 void
 mongo_client_send_async (MongoClient         *client,
                          const gchar         *collection,
@@ -218,89 +752,305 @@ mongo_client_send_async (MongoClient         *client,
                          GAsyncReadyCallback  callback,
                          gpointer             user_data)
 {
-   MongoClientPrivate *priv;
    GSimpleAsyncResult *simple;
-   GOutputStream *output;
-   const guint8 *buffer;
-   gsize buffer_length = 0;
-   GByteArray *packed;
+   GByteArray *message;
+   gint32 request_id;
 
    g_return_if_fail(MONGO_IS_CLIENT(client));
    g_return_if_fail(collection != NULL);
    g_return_if_fail(bson != NULL);
+   g_return_if_fail(operation == MONGO_OPERATION_INSERT ||
+                    operation == MONGO_OPERATION_QUERY ||
+                    operation == MONGO_OPERATION_DELETE);
    g_return_if_fail(callback != NULL);
 
-   priv = client->priv;
+   message = mongo_client_message_new(client, operation, &request_id);
 
-   if (!priv->connection) {
-      g_warning("Not connected, failed to send.");
-      return;
+   switch (operation) {
+   case MONGO_OPERATION_QUERY:
+      mongo_client_message_append_int32(message, 0);
+      mongo_client_message_append_cstring(message, collection);
+      mongo_client_message_append_int32(message, 0);
+      mongo_client_message_append_int32(message, -1);
+      break;
+   case MONGO_OPERATION_DELETE:
+      mongo_client_message_append_int32(message, 0);
+      mongo_client_message_append_cstring(message, collection);
+      mongo_client_message_append_int32(message, 0);
+      break;
+   case MONGO_OPERATION_INSERT:
+   case MONGO_OPERATION_UPDATE:
+   case MONGO_OPERATION_GET_MORE:
+   case MONGO_OPERATION_KILL_CURSORS:
+   default:
+      mongo_client_message_append_int32(message, 0);
+      mongo_client_message_append_cstring(message, collection);
+      break;
    }
 
-   buffer = mongo_bson_get_data(bson, &buffer_length);
-   packed = g_byte_array_sized_new(20 + buffer_length);
+   simple = g_simple_async_result_new(G_OBJECT(client), callback, user_data,
+                                      mongo_client_send_async);
+   mongo_client_send_message(client, simple, message, request_id,
+                             bson, NULL, want_reply);
+}
 
-   {
-      guint32 len;
-      guint32 id;
-      guint32 zero = 0;
-      guint32 op;
+/**
+ * mongo_client_send_finish:
+ * @client: (in): A #MongoClient.
+ * @result: (in): A #GAsyncResult.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Completes an asynchronous request to mongo_client_send_async().
+ *
+ * Returns: (transfer full): The first document of the reply if a reply
+ *   was requested and contained a document, otherwise %NULL.
+ */
+MongoBson *
+mongo_client_send_finish (MongoClient   *client,
+                          GAsyncResult  *result,
+                          GError       **error)
+{
+   GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
+   MongoReply *reply;
 
-      len = GINT_TO_LE(16 + 4 + strlen(collection) + 1 + buffer_length);
-      id = mongo_client_get_next_id(client);
-      op = GUINT_TO_LE(operation);
+   g_return_val_if_fail(MONGO_IS_CLIENT(client), NULL);
+   g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple), NULL);
 
-      // hack
-      if (operation == MONGO_OPERATION_QUERY) {
-         len += 8;
-      }
+   if (g_simple_async_result_propagate_error(simple, error)) {
+      return NULL;
+   }
 
-      /*
-       * Append header.
-       */
-      g_byte_array_append(packed, (guint8 *)&len, sizeof len);
-      g_byte_array_append(packed, (guint8 *)&id, sizeof id);
-      g_byte_array_append(packed, (guint8 *)&zero, sizeof zero);
-      g_byte_array_append(packed, (guint8 *)&op, sizeof op);
-
-      if (operation == MONGO_OPERATION_QUERY) {
-         g_byte_array_append(packed, (guint8 *)&zero, sizeof zero); // skip
-         g_byte_array_append(packed, (guint8 *)&zero, sizeof zero); // limit
-      }
+   reply = g_simple_async_result_get_op_res_gpointer(simple);
+   if (reply && reply->n_documents) {
+      return mongo_bson_ref(reply->documents[0]);
+   }
 
-      /*
-       * Append Message.
-       */
-      g_byte_array_append(packed, (guint8 *)&zero, sizeof zero); // TODO: query_opts
-      g_byte_array_append(packed, (guint8 *)collection, strlen(collection) + 1);
-      g_byte_array_append(packed, buffer, buffer_length);
+   return NULL;
+}
+
+/**
+ * mongo_client_query_async:
+ * @client: (in): A #MongoClient.
+ * @collection: (in): The full name of the collection such as "db.things".
+ * @flags: (in): The #MongoQueryFlags for the query.
+ * @skip: (in): The number of documents to skip.
+ * @limit: (in): The number of documents in the first batch, 0 for the
+ *   server default, or negative to close the cursor after one batch.
+ * @query: (in): The query document.
+ * @fields: (in) (allow-none): The fields to return, or %NULL for all.
+ * @callback: (in): A callback to execute upon completion.
+ * @user_data: (in): User data for @callback.
+ *
+ * Asynchronously runs a query and retrieves the first batch of results.
+ * Further batches are retrieved with mongo_client_get_more_async() using
+ * the cursor of the reply. As with mongo_client_send_async(), @query and
+ * @fields must not be modified until @callback is executed.
+ */
+void
+mongo_client_query_async (MongoClient         *client,
+                          const gchar         *collection,
+                          MongoQueryFlags      flags,
+                          guint32              skip,
+                          gint32               limit,
+                          MongoBson           *query,
+                          MongoBson           *fields,
+                          GAsyncReadyCallback  callback,
+                          gpointer             user_data)
+{
+   GSimpleAsyncResult *simple;
+   GByteArray *message;
+   gint32 request_id;
+
+   g_return_if_fail(MONGO_IS_CLIENT(client));
+   g_return_if_fail(collection != NULL);
+   g_return_if_fail(query != NULL);
+   g_return_if_fail(callback != NULL);
+
+   message = mongo_client_message_new(client, MONGO_OPERATION_QUERY,
+                                      &request_id);
+   mongo_client_message_append_int32(message, flags);
+   mongo_client_message_append_cstring(message, collection);
+   mongo_client_message_append_int32(message, skip);
+   mongo_client_message_append_int32(message, limit);
+
+   simple = g_simple_async_result_new(G_OBJECT(client), callback, user_data,
+                                      mongo_client_query_async);
+   mongo_client_send_message(client, simple, message, request_id,
+                             query, fields, TRUE);
+}
+
+/**
+ * mongo_client_query_finish:
+ * @client: (in): A #MongoClient.
+ * @result: (in): A #GAsyncResult.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Completes an asynchronous request to mongo_client_query_async(). A
+ * reply with the QueryFailure flag set results in
+ * %MONGO_CLIENT_ERROR_QUERY_FAILURE with the message from the server.
+ *
+ * Returns: A #MongoReply that should be freed with mongo_reply_unref(),
+ *   or %NULL upon failure.
+ */
+MongoReply *
+mongo_client_query_finish (MongoClient   *client,
+                           GAsyncResult  *result,
+                           GError       **error)
+{
+   GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
+
+   g_return_val_if_fail(MONGO_IS_CLIENT(client), NULL);
+   g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple), NULL);
+
+   if (g_simple_async_result_propagate_error(simple, error)) {
+      return NULL;
+   }
+
+   return mongo_reply_ref(g_simple_async_result_get_op_res_gpointer(simple));
+}
+
+/**
+ * mongo_client_get_more_async:
+ * @client: (in): A #MongoClient.
+ * @collection: (in): The full name of the collection of the cursor.
+ * @limit: (in): The number of documents to return, or 0 for the server
+ *   default.
+ * @cursor_id: (in): The cursor from a previous #MongoReply.
+ * @callback: (in): A callback to execute upon completion.
+ * @user_data: (in): User data for @callback.
+ *
+ * Asynchronously retrieves the next batch of results of a cursor. For a
+ * tailable cursor created with %MONGO_QUERY_AWAIT_DATA, the server waits
+ * a while for new documents before replying with an empty batch.
+ */
+void
+mongo_client_get_more_async (MongoClient         *client,
+                             const gchar         *collection,
+                             gint32               limit,
+                             guint64              cursor_id,
+                             GAsyncReadyCallback  callback,
+                             gpointer             user_data)
+{
+   GSimpleAsyncResult *simple;
+   GByteArray *message;
+   gint32 request_id;
+
+   g_return_if_fail(MONGO_IS_CLIENT(client));
+   g_return_if_fail(collection != NULL);
+   g_return_if_fail(cursor_id != 0);
+   g_return_if_fail(callback != NULL);
+
+   message = mongo_client_message_new(client, MONGO_OPERATION_GET_MORE,
+                                      &request_id);
+   mongo_client_message_append_int32(message, 0);
+   mongo_client_message_append_cstring(message, collection);
+   mongo_client_message_append_int32(message, limit);
+   mongo_client_message_append_int64(message, cursor_id);
+
+   simple = g_simple_async_result_new(G_OBJECT(client), callback, user_data,
+                                      mongo_client_get_more_async);
+   mongo_client_send_message(client, simple, message, request_id,
+                             NULL, NULL, TRUE);
+}
+
+/**
+ * mongo_client_get_more_finish:
+ * @client: (in): A #MongoClient.
+ * @result: (in): A #GAsyncResult.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Completes an asynchronous request to mongo_client_get_more_async(). If
+ * the server no longer knows the cursor, %MONGO_CLIENT_ERROR_CURSOR_NOT_FOUND
+ * is returned.
+ *
+ * Returns: A #MongoReply that should be freed with mongo_reply_unref(),
+ *   or %NULL upon failure.
+ */
+MongoReply *
+mongo_client_get_more_finish (MongoClient   *client,
+                              GAsyncResult  *result,
+                              GError       **error)
+{
+   GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
+
+   g_return_val_if_fail(MONGO_IS_CLIENT(client), NULL);
+   g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple), NULL);
+
+   if (g_simple_async_result_propagate_error(simple, error)) {
+      return NULL;
    }
 
-   /*
-    * XXX: MULTIPLE ASYNC WRITE CALLS IS INVALID API USE!!!
-    */
+   return mongo_reply_ref(g_simple_async_result_get_op_res_gpointer(simple));
+}
+
+/**
+ * mongo_client_kill_cursors_async:
+ * @client: (in): A #MongoClient.
+ * @cursor_ids: (in) (array length=n_cursor_ids): The cursors to close.
+ * @n_cursor_ids: (in): The number of cursors in @cursor_ids.
+ * @callback: (in) (allow-none): A callback to execute upon completion.
+ * @user_data: (in): User data for @callback.
+ *
+ * Asynchronously closes cursors on the server. The server does not reply,
+ * so @callback is executed once the message has been written.
+ */
+void
+mongo_client_kill_cursors_async (MongoClient         *client,
+                                 const guint64       *cursor_ids,
+                                 guint                n_cursor_ids,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data)
+{
+   GSimpleAsyncResult *simple;
+   GByteArray *message;
+   gint32 request_id;
+   guint i;
+
+   g_return_if_fail(MONGO_IS_CLIENT(client));
+   g_return_if_fail(cursor_ids != NULL);
+   g_return_if_fail(n_cursor_ids > 0);
+
+   message = mongo_client_message_new(client, MONGO_OPERATION_KILL_CURSORS,
+                                      &request_id);
+   mongo_client_message_append_int32(message, 0);
+   mongo_client_message_append_int32(message, n_cursor_ids);
+   for (i = 0; i < n_cursor_ids; i++) {
+      mongo_client_message_append_int64(message, cursor_ids[i]);
+   }
+
+   simple = g_simple_async_result_new(G_OBJECT(client), callback, user_data,
+                                      mongo_client_kill_cursors_async);
+   g_simple_async_result_set_op_res_gboolean(simple, TRUE);
+   mongo_client_send_message(client, simple, message, request_id,
+                             NULL, NULL, FALSE);
+}
+
+/**
+ * mongo_client_kill_cursors_finish:
+ * @client: (in): A #MongoClient.
+ * @result: (in): A #GAsyncResult.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Completes an asynchronous request to mongo_client_kill_cursors_async().
+ *
+ * Returns: %TRUE if the message was sent; otherwise %FALSE and @error is
+ *   set.
+ */
+gboolean
+mongo_client_kill_cursors_finish (MongoClient   *client,
+                                  GAsyncResult  *result,
+                                  GError       **error)
+{
+   GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
+
+   g_return_val_if_fail(MONGO_IS_CLIENT(client), FALSE);
+   g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple), FALSE);
 
-   simple = g_simple_async_result_new(G_OBJECT(client), callback, user_data,
-                                      mongo_client_send_async);
-   output = g_io_stream_get_output_stream(G_IO_STREAM(priv->connection));
-   g_object_set_data(G_OBJECT(simple),
-                     "want-reply", GINT_TO_POINTER(want_reply));
-   g_output_stream_write_async(output,
-                               packed->data,
-                               packed->len,
-                               G_PRIORITY_DEFAULT,
-                               NULL,
-                               mongo_client_send_write_cb,
-                               simple);
-   g_byte_array_free(packed, TRUE);
-}
+   if (g_simple_async_result_propagate_error(simple, error)) {
+      return FALSE;
+   }
 
-MongoBson *
-mongo_client_send_finish (MongoClient   *client,
-                          GAsyncResult  *result,
-                          GError       **error)
-{
-   return NULL;
+   return g_simple_async_result_get_op_res_gboolean(simple);
 }
 
 static void
@@ -309,24 +1059,24 @@ mongo_client_ismaster_cb (GObject      *object,
                           gpointer      user_data)
 {
    GSimpleAsyncResult *simple = user_data;
-#if 0
-   //MongoBsonIter iter;
+   MongoBsonIter iter;
    MongoClient *client = (MongoClient *)object;
-   MongoBson *bson;
+   MongoReply *reply;
    gboolean ret = FALSE;
    GError *error = NULL;
 
    g_return_if_fail(MONGO_IS_CLIENT(client));
    g_return_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple));
 
-   if (!(bson = mongo_client_send_finish(client, result, &error))) {
+   if (!(reply = mongo_client_query_finish(client, result, &error))) {
       goto failure;
    }
 
-   mongo_bson_iter_init(&iter, bson);
-
-   if (mongo_bson_iter_find(&iter, "ismaster")) {
-      ret = mongo_bson_iter_get_boolean(&iter);
+   if (reply->n_documents) {
+      mongo_bson_iter_init(&iter, reply->documents[0]);
+      if (mongo_bson_iter_find(&iter, "ismaster")) {
+         ret = mongo_bson_iter_get_value_boolean(&iter);
+      }
    }
 
    if (!ret) {
@@ -334,39 +1084,17 @@ mongo_client_ismaster_cb (GObject      *object,
                           _("The target host is not primary."));
    }
 
-   mongo_bson_unref(bson);
+   mongo_reply_unref(reply);
 
 failure:
    if (error) {
       g_simple_async_result_take_error(simple, error);
    }
    g_simple_async_result_set_op_res_gboolean(simple, ret);
-#endif
    g_simple_async_result_complete_in_idle(simple);
    g_object_unref(simple);
 }
 
-static void
-mongo_client_read_cb (GObject      *object,
-                      GAsyncResult *result,
-                      gpointer      user_data)
-{
-   GInputStream *input = (GInputStream *)object;
-   MongoClient *client = user_data;
-   GError *error = NULL;
-   gssize n_bytes;
-
-   g_return_if_fail(G_IS_INPUT_STREAM(input));
-   g_return_if_fail(G_IS_ASYNC_RESULT(result));
-   g_return_if_fail(MONGO_IS_CLIENT(client));
-
-   n_bytes = g_input_stream_read_finish(input, result, &error);
-   g_assert_no_error(error); // FIXME:
-   g_assert_cmpint(n_bytes, >, 0); // FIXME:
-
-   g_debug("Read %"G_GSIZE_FORMAT" bytes from server.", n_bytes);
-}
-
 static void
 mongo_client_connect_cb (GObject      *object,
                          GAsyncResult *result,
@@ -376,7 +1104,6 @@ mongo_client_connect_cb (GObject      *object,
    GSimpleAsyncResult *simple = user_data;
    GSocketConnection *connection;
    GSocketClient *connector = (GSocketClient *)object;
-   GInputStream *input;
    MongoClient *client;
    MongoBson *bson;
    GError *error = NULL;
@@ -392,40 +1119,47 @@ mongo_client_connect_cb (GObject      *object,
     * Finish connection request.
     */
    if (!(connection = g_socket_client_connect_finish(connector, result, &error))) {
+      priv->state = MONGO_CLIENT_FAILED;
       g_simple_async_result_take_error(simple, error);
       g_simple_async_result_complete_in_idle(simple);
       g_object_unref(simple);
+      g_object_unref(client);
       return;
    }
 
    /*
     * Update state.
     */
-   client->priv->state = MONGO_CLIENT_CONNECTED;
-   client->priv->connection = connection;
+   priv->state = MONGO_CLIENT_CONNECTED;
+   priv->connection = connection;
 
    /*
-    * Start receive loop.
+    * Writes must never block the context, see mongo_client_write_next().
+    * The streams of the connection manage blocking on their own.
     */
-   input = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+   g_socket_set_blocking(g_socket_connection_get_socket(connection), FALSE);
+
    /*
-    * TODO: Use cancellable, to cancel on dispose.
+    * Start receive loop.
     */
-   priv->read_buffer = g_malloc(1024);
-   g_input_stream_read_async(input, priv->read_buffer, 1024, G_PRIORITY_DEFAULT, NULL, mongo_client_read_cb, client);
+   mongo_client_read(client);
 
    /*
     * Query to check that this is the master.
     */
    bson = mongo_bson_new();
    mongo_bson_append_int(bson, "isMaster", 1);
-   mongo_client_send_async(client,
-                           "admin",
-                           bson,
-                           MONGO_OPERATION_QUERY,
-                           TRUE,
-                           mongo_client_ismaster_cb,
-                           simple);
+   mongo_client_query_async(client,
+                            "admin.$cmd",
+                            MONGO_QUERY_NONE,
+                            0,
+                            -1,
+                            bson,
+                            NULL,
+                            mongo_client_ismaster_cb,
+                            simple);
+   mongo_bson_unref(bson);
+   g_object_unref(client);
 }
 
 void
@@ -461,6 +1195,13 @@ mongo_client_connect_async (MongoClient         *client,
 
    priv->state = MONGO_CLIENT_CONNECTING;
 
+   /*
+    * The connection belongs to the context it is created in.
+    */
+   if (!priv->context) {
+      priv->context = g_main_context_ref_thread_default();
+   }
+
    g_socket_client_connect_async(connector, connectable, cancellable,
                                  mongo_client_connect_cb, simple);
 
@@ -486,6 +1227,548 @@ mongo_client_connect_finish (MongoClient   *client,
    return ret;
 }
 
+/*
+ * A synchronous request. The arguments are borrowed from the caller, which
+ * blocks until the request completes.
+ */
+typedef struct
+{
+   MongoClient     *client;
+   GMutex           mutex;
+   GCond            cond;
+   GAsyncResult    *result;
+   GCancellable    *cancellable;
+   guint            n_cancelling;
+   const gchar     *collection;
+   MongoBson       *bson;
+   MongoBson       *fields;
+   MongoOperation   operation;
+   MongoQueryFlags  flags;
+   guint32          skip;
+   gint32           limit;
+   gboolean         want_reply;
+   guint64          cursor_id;
+   const guint64   *cursor_ids;
+   guint            n_cursor_ids;
+} MongoClientCall;
+
+static void
+mongo_client_call_cb (GObject      *object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+   MongoClientCall *call = user_data;
+
+   g_mutex_lock(&call->mutex);
+   call->result = g_object_ref(result);
+   g_cond_signal(&call->cond);
+   g_mutex_unlock(&call->mutex);
+}
+
+/*
+ * Fails the request of @call with %G_IO_ERROR_CANCELLED if it is still
+ * waiting for its reply. The reply is dropped when it arrives.
+ */
+static gboolean
+mongo_client_call_cancel_dispatch (gpointer data)
+{
+   MongoClientCall *call = data;
+   GSimpleAsyncResult *simple;
+   GHashTableIter iter;
+
+   g_hash_table_iter_init(&iter, call->client->priv->requests);
+   while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&simple)) {
+      if (g_async_result_get_user_data(G_ASYNC_RESULT(simple)) == call) {
+         g_simple_async_result_set_error(simple, G_IO_ERROR,
+                                         G_IO_ERROR_CANCELLED,
+                                         _("Operation was cancelled"));
+         g_simple_async_result_complete_in_idle(simple);
+         g_hash_table_iter_remove(&iter);
+         break;
+      }
+   }
+
+   g_mutex_lock(&call->mutex);
+   call->n_cancelling--;
+   g_cond_signal(&call->cond);
+   g_mutex_unlock(&call->mutex);
+
+   return FALSE;
+}
+
+static void
+mongo_client_call_cancelled (GCancellable *cancellable,
+                             gpointer      data)
+{
+   MongoClientCall *call = data;
+
+   g_mutex_lock(&call->mutex);
+   call->n_cancelling++;
+   g_mutex_unlock(&call->mutex);
+
+   g_main_context_invoke(call->client->priv->context,
+                         mongo_client_call_cancel_dispatch,
+                         call);
+}
+
+/*
+ * Runs @func on the I/O thread, where it starts an asynchronous request
+ * completing with mongo_client_call_cb(), and waits for the result. The
+ * request is created on the I/O thread so that it also completes there.
+ *
+ * Cancelling the cancellable of @call fails the request on the I/O thread
+ * rather than abandoning it, so the result always arrives and nothing
+ * refers to @call once this returns.
+ */
+static GAsyncResult *
+mongo_client_call (MongoClient     *client,
+                   MongoClientCall *call,
+                   GSourceFunc      func)
+{
+   gulong handler = 0;
+
+   call->client = client;
+   call->result = NULL;
+   call->n_cancelling = 0;
+   g_mutex_init(&call->mutex);
+   g_cond_init(&call->cond);
+
+   g_main_context_invoke(client->priv->context, func, call);
+
+   if (call->cancellable) {
+      handler = g_cancellable_connect(call->cancellable,
+                                      G_CALLBACK(mongo_client_call_cancelled),
+                                      call, NULL);
+   }
+
+   g_mutex_lock(&call->mutex);
+   while (!call->result) {
+      g_cond_wait(&call->cond, &call->mutex);
+   }
+   g_mutex_unlock(&call->mutex);
+
+   /*
+    * Once disconnected the handler can not run again, but a cancellation
+    * it already handed to the I/O thread must finish first.
+    */
+   if (handler) {
+      g_cancellable_disconnect(call->cancellable, handler);
+   }
+
+   g_mutex_lock(&call->mutex);
+   while (call->n_cancelling) {
+      g_cond_wait(&call->cond, &call->mutex);
+   }
+   g_mutex_unlock(&call->mutex);
+
+   g_cond_clear(&call->cond);
+   g_mutex_clear(&call->mutex);
+
+   return call->result;
+}
+
+/*
+ * Checks that @client may be used synchronously from this thread.
+ */
+static gboolean
+mongo_client_check_sync (MongoClient  *client,
+                         GError      **error)
+{
+   MongoClientPrivate *priv = client->priv;
+
+   if (!priv->thread) {
+      g_set_error(error, MONGO_CLIENT_ERROR, MONGO_CLIENT_ERROR_NOT_CONNECTED,
+                  _("Not connected to a server."));
+      return FALSE;
+   }
+
+   g_return_val_if_fail(!g_main_context_is_owner(priv->context), FALSE);
+
+   return TRUE;
+}
+
+static gpointer
+mongo_client_io_thread (gpointer data)
+{
+   MongoClientThread *io = data;
+   GMainContext *context;
+
+   context = g_main_loop_get_context(io->loop);
+   g_main_context_push_thread_default(context);
+   g_main_loop_run(io->loop);
+
+   /*
+    * The read loop has been cancelled, but its callback may take more
+    * than one iteration to run. Wait for it so that it releases its state.
+    */
+   while (io->n_reads) {
+      g_main_context_iteration(context, TRUE);
+   }
+
+   g_main_context_pop_thread_default(context);
+   g_main_loop_unref(io->loop);
+   g_slice_free(MongoClientThread, io);
+
+   return NULL;
+}
+
+static gboolean
+mongo_client_connect_dispatch (gpointer data)
+{
+   MongoClientCall *call = data;
+
+   mongo_client_connect_async(call->client, call->cancellable,
+                              mongo_client_call_cb, call);
+
+   return FALSE;
+}
+
+/**
+ * mongo_client_connect:
+ * @client: (in): A #MongoClient.
+ * @cancellable: (in) (allow-none): A #GCancellable, or %NULL.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Synchronously connects to the server. The connection is serviced by a
+ * dedicated I/O thread that lives as long as @client, so no main loop is
+ * needed to use it.
+ *
+ * Only a client connected this way supports mongo_client_send(),
+ * mongo_client_query(), mongo_client_get_more() and
+ * mongo_client_kill_cursors(). They may be called from any number of
+ * threads at once, and their messages share the one connection. The
+ * asynchronous functions may be used as well, and complete in the
+ * thread-default main context of the caller.
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ */
+gboolean
+mongo_client_connect (MongoClient   *client,
+                      GCancellable  *cancellable,
+                      GError       **error)
+{
+   MongoClientPrivate *priv;
+   MongoClientCall call = { 0 };
+   GAsyncResult *result;
+   gboolean ret;
+
+   g_return_val_if_fail(MONGO_IS_CLIENT(client), FALSE);
+   g_return_val_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable), FALSE);
+
+   priv = client->priv;
+
+   if (priv->state != MONGO_CLIENT_READY) {
+      g_warning("Cannot connect client, not ready.");
+      return FALSE;
+   }
+
+   priv->context = g_main_context_new();
+   priv->loop = g_main_loop_new(priv->context, FALSE);
+   priv->io = g_slice_new0(MongoClientThread);
+   priv->io->loop = g_main_loop_ref(priv->loop);
+   priv->thread = g_thread_new("mongo-client",
+                               mongo_client_io_thread,
+                               priv->io);
+
+   call.cancellable = cancellable;
+   result = mongo_client_call(client, &call, mongo_client_connect_dispatch);
+   ret = mongo_client_connect_finish(client, result, error);
+   g_object_unref(result);
+
+   return ret;
+}
+
+static gboolean
+mongo_client_send_dispatch (gpointer data)
+{
+   MongoClientCall *call = data;
+
+   mongo_client_send_async(call->client, call->collection, call->bson,
+                           call->operation, call->want_reply,
+                           mongo_client_call_cb, call);
+
+   return FALSE;
+}
+
+/**
+ * mongo_client_send:
+ * @client: (in): A #MongoClient connected with mongo_client_connect().
+ * @collection: (in): The full name of the collection such as "db.things".
+ * @bson: (in): The document of the message.
+ * @operation: (in): The #MongoOperation to perform.
+ * @want_reply: (in): If the server replies to the message.
+ * @cancellable: (in) (allow-none): A #GCancellable, or %NULL.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Synchronous version of mongo_client_send_async(). This blocks the
+ * calling thread until the reply arrives, or until the message is written
+ * if there is no reply. It is safe to call from multiple threads.
+ *
+ * Cancelling @cancellable stops waiting for the reply and fails with
+ * %G_IO_ERROR_CANCELLED. The message may still have been sent.
+ *
+ * Returns: (transfer full): The first document of the reply if a reply
+ *   was requested and contained a document, otherwise %NULL.
+ */
+MongoBson *
+mongo_client_send (MongoClient     *client,
+                   const gchar     *collection,
+                   MongoBson       *bson,
+                   MongoOperation   operation,
+                   gboolean         want_reply,
+                   GCancellable    *cancellable,
+                   GError         **error)
+{
+   MongoClientCall call = { 0 };
+   GAsyncResult *result;
+   MongoBson *ret;
+
+   g_return_val_if_fail(MONGO_IS_CLIENT(client), NULL);
+   g_return_val_if_fail(collection != NULL, NULL);
+   g_return_val_if_fail(bson != NULL, NULL);
+   g_return_val_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable), NULL);
+
+   if (!mongo_client_check_sync(client, error)) {
+      return NULL;
+   }
+
+   call.collection = collection;
+   call.bson = bson;
+   call.operation = operation;
+   call.want_reply = want_reply;
+   call.cancellable = cancellable;
+   result = mongo_client_call(client, &call, mongo_client_send_dispatch);
+   ret = mongo_client_send_finish(client, result, error);
+   g_object_unref(result);
+
+   return ret;
+}
+
+static gboolean
+mongo_client_query_dispatch (gpointer data)
+{
+   MongoClientCall *call = data;
+
+   mongo_client_query_async(call->client, call->collection, call->flags,
+                            call->skip, call->limit, call->bson, call->fields,
+                            mongo_client_call_cb, call);
+
+   return FALSE;
+}
+
+/**
+ * mongo_client_query:
+ * @client: (in): A #MongoClient connected with mongo_client_connect().
+ * @collection: (in): The full name of the collection such as "db.things".
+ * @flags: (in): The #MongoQueryFlags for the query.
+ * @skip: (in): The number of documents to skip.
+ * @limit: (in): The number of documents in the first batch, 0 for the
+ *   server default, or negative to close the cursor after one batch.
+ * @query: (in): The query document.
+ * @fields: (in) (allow-none): The fields to return, or %NULL for all.
+ * @cancellable: (in) (allow-none): A #GCancellable, or %NULL.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Synchronous version of mongo_client_query_async(). This blocks the
+ * calling thread until the reply arrives or @cancellable is cancelled,
+ * in which case %G_IO_ERROR_CANCELLED is returned. It is safe to call
+ * from multiple threads.
+ *
+ * Returns: A #MongoReply that should be freed with mongo_reply_unref(),
+ *   or %NULL upon failure.
+ */
+MongoReply *
+mongo_client_query (MongoClient      *client,
+                    const gchar      *collection,
+                    MongoQueryFlags   flags,
+                    guint32           skip,
+                    gint32            limit,
+                    MongoBson        *query,
+                    MongoBson        *fields,
+                    GCancellable     *cancellable,
+                    GError          **error)
+{
+   MongoClientCall call = { 0 };
+   GAsyncResult *result;
+   MongoReply *ret;
+
+   g_return_val_if_fail(MONGO_IS_CLIENT(client), NULL);
+   g_return_val_if_fail(collection != NULL, NULL);
+   g_return_val_if_fail(query != NULL, NULL);
+   g_return_val_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable), NULL);
+
+   if (!mongo_client_check_sync(client, error)) {
+      return NULL;
+   }
+
+   call.collection = collection;
+   call.flags = flags;
+   call.skip = skip;
+   call.limit = limit;
+   call.bson = query;
+   call.fields = fields;
+   call.cancellable = cancellable;
+   result = mongo_client_call(client, &call, mongo_client_query_dispatch);
+   ret = mongo_client_query_finish(client, result, error);
+   g_object_unref(result);
+
+   return ret;
+}
+
+static gboolean
+mongo_client_get_more_dispatch (gpointer data)
+{
+   MongoClientCall *call = data;
+
+   mongo_client_get_more_async(call->client, call->collection, call->limit,
+                               call->cursor_id, mongo_client_call_cb, call);
+
+   return FALSE;
+}
+
+/**
+ * mongo_client_get_more:
+ * @client: (in): A #MongoClient connected with mongo_client_connect().
+ * @collection: (in): The full name of the collection of the cursor.
+ * @limit: (in): The number of documents to return, or 0 for the server
+ *   default.
+ * @cursor_id: (in): The cursor from a previous #MongoReply.
+ * @cancellable: (in) (allow-none): A #GCancellable, or %NULL.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Synchronous version of mongo_client_get_more_async(). This blocks the
+ * calling thread until the reply arrives or @cancellable is cancelled,
+ * in which case %G_IO_ERROR_CANCELLED is returned and the cursor is left
+ * open on the server. It is safe to call from multiple threads.
+ *
+ * Returns: A #MongoReply that should be freed with mongo_reply_unref(),
+ *   or %NULL upon failure.
+ */
+MongoReply *
+mongo_client_get_more (MongoClient  *client,
+                       const gchar  *collection,
+                       gint32        limit,
+                       guint64       cursor_id,
+                       GCancellable *cancellable,
+                       GError      **error)
+{
+   MongoClientCall call = { 0 };
+   GAsyncResult *result;
+   MongoReply *ret;
+
+   g_return_val_if_fail(MONGO_IS_CLIENT(client), NULL);
+   g_return_val_if_fail(collection != NULL, NULL);
+   g_return_val_if_fail(cursor_id != 0, NULL);
+   g_return_val_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable), NULL);
+
+   if (!mongo_client_check_sync(client, error)) {
+      return NULL;
+   }
+
+   call.collection = collection;
+   call.limit = limit;
+   call.cursor_id = cursor_id;
+   call.cancellable = cancellable;
+   result = mongo_client_call(client, &call, mongo_client_get_more_dispatch);
+   ret = mongo_client_get_more_finish(client, result, error);
+   g_object_unref(result);
+
+   return ret;
+}
+
+static gboolean
+mongo_client_kill_cursors_dispatch (gpointer data)
+{
+   MongoClientCall *call = data;
+
+   mongo_client_kill_cursors_async(call->client, call->cursor_ids,
+                                   call->n_cursor_ids, mongo_client_call_cb,
+                                   call);
+
+   return FALSE;
+}
+
+/**
+ * mongo_client_kill_cursors:
+ * @client: (in): A #MongoClient connected with mongo_client_connect().
+ * @cursor_ids: (in) (array length=n_cursor_ids): The cursors to close.
+ * @n_cursor_ids: (in): The number of cursors in @cursor_ids.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Synchronous version of mongo_client_kill_cursors_async(). This blocks
+ * the calling thread until the message is written. It is safe to call
+ * from multiple threads.
+ *
+ * Returns: %TRUE if the message was sent; otherwise %FALSE and @error is
+ *   set.
+ */
+gboolean
+mongo_client_kill_cursors (MongoClient    *client,
+                           const guint64  *cursor_ids,
+                           guint           n_cursor_ids,
+                           GError        **error)
+{
+   MongoClientCall call = { 0 };
+   GAsyncResult *result;
+   gboolean ret;
+
+   g_return_val_if_fail(MONGO_IS_CLIENT(client), FALSE);
+   g_return_val_if_fail(cursor_ids != NULL, FALSE);
+   g_return_val_if_fail(n_cursor_ids > 0, FALSE);
+
+   if (!mongo_client_check_sync(client, error)) {
+      return FALSE;
+   }
+
+   call.cursor_ids = cursor_ids;
+   call.n_cursor_ids = n_cursor_ids;
+   result = mongo_client_call(client, &call,
+                              mongo_client_kill_cursors_dispatch);
+   ret = mongo_client_kill_cursors_finish(client, result, error);
+   g_object_unref(result);
+
+   return ret;
+}
+
+static gboolean
+mongo_client_shutdown (gpointer data)
+{
+   MongoClientPrivate *priv = data;
+
+   g_cancellable_cancel(priv->cancellable);
+   g_main_loop_quit(priv->loop);
+
+   return FALSE;
+}
+
+/**
+ * mongo_client_dispose:
+ * @object: (in): A #MongoClient.
+ *
+ * Stops the I/O thread, if any, before the read loop loses its weak
+ * pointer to the client.
+ */
+static void
+mongo_client_dispose (GObject *object)
+{
+   MongoClientPrivate *priv = MONGO_CLIENT(object)->priv;
+   GThread *thread;
+
+   if ((thread = priv->thread)) {
+      priv->thread = NULL;
+      if (thread == g_thread_self()) {
+         mongo_client_shutdown(priv);
+         g_thread_unref(thread);
+      } else {
+         g_main_context_invoke(priv->context, mongo_client_shutdown, priv);
+         g_thread_join(thread);
+      }
+      priv->io = NULL;
+   }
+
+   G_OBJECT_CLASS(mongo_client_parent_class)->dispose(object);
+}
+
 /**
  * mongo_client_finalize:
  * @object: (in): A #MongoClient.
@@ -502,7 +1785,21 @@ mongo_client_finalize (GObject *object)
       g_array_unref(priv->peers);
    }
 
+   /*
+    * Pending requests hold a reference to the client, so only the read
+    * loop can still be running.
+    */
+   g_cancellable_cancel(priv->cancellable);
+   g_clear_object(&priv->cancellable);
    g_clear_object(&priv->connection);
+   g_hash_table_unref(priv->requests);
+   g_byte_array_free(priv->incoming, TRUE);
+   if (priv->loop) {
+      g_main_loop_unref(priv->loop);
+   }
+   if (priv->context) {
+      g_main_context_unref(priv->context);
+   }
 
    G_OBJECT_CLASS(mongo_client_parent_class)->finalize(object);
 }
@@ -583,6 +1880,7 @@ mongo_client_class_init (MongoClientClass *klass)
    GObjectClass *object_class;
 
    object_class = G_OBJECT_CLASS(klass);
+   object_class->dispose = mongo_client_dispose;
    object_class->finalize = mongo_client_finalize;
    object_class->get_property = mongo_client_get_property;
    object_class->set_property = mongo_client_set_property;
@@ -632,6 +1930,13 @@ mongo_client_init (MongoClient *client)
    client->priv = G_TYPE_INSTANCE_GET_PRIVATE(client, MONGO_TYPE_CLIENT,
                                               MongoClientPrivate);
    client->priv->state = MONGO_CLIENT_READY;
+   client->priv->cancellable = g_cancellable_new();
+   client->priv->incoming = g_byte_array_new();
+   client->priv->requests = g_hash_table_new_full(g_direct_hash,
+                                                  g_direct_equal,
+                                                  NULL,
+                                                  g_object_unref);
+   g_queue_init(&client->priv->outgoing);
    mongo_client_set_host(client, "localhost");
    mongo_client_set_port(client, 27017);
 }
@@ -664,3 +1969,36 @@ mongo_operation_get_type (void)
 
    return type_id;
 }
+
+GType
+mongo_query_flags_get_type (void)
+{
+   static GType type_id = 0;
+   static gsize initialized = FALSE;
+   static const GFlagsValue values[] = {
+      { MONGO_QUERY_NONE,
+        "MONGO_QUERY_NONE", "NONE" },
+      { MONGO_QUERY_TAILABLE_CURSOR,
+        "MONGO_QUERY_TAILABLE_CURSOR", "TAILABLE_CURSOR" },
+      { MONGO_QUERY_SLAVE_OK,
+        "MONGO_QUERY_SLAVE_OK", "SLAVE_OK" },
+      { MONGO_QUERY_OPLOG_REPLAY,
+        "MONGO_QUERY_OPLOG_REPLAY", "OPLOG_REPLAY" },
+      { MONGO_QUERY_NO_CURSOR_TIMEOUT,
+        "MONGO_QUERY_NO_CURSOR_TIMEOUT", "NO_CURSOR_TIMEOUT" },
+      { MONGO_QUERY_AWAIT_DATA,
+        "MONGO_QUERY_AWAIT_DATA", "AWAIT_DATA" },
+      { MONGO_QUERY_EXHAUST,
+        "MONGO_QUERY_EXHAUST", "EXHAUST" },
+      { MONGO_QUERY_PARTIAL,
+        "MONGO_QUERY_PARTIAL", "PARTIAL" },
+      { 0 }
+   };
+
+   if (g_once_init_enter(&initialized)) {
+      type_id = g_flags_register_static("MongoQueryFlags", values);
+      g_once_init_leave(&initialized, TRUE);
+   }
+
+   return type_id;
+}
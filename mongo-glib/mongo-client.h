@@ -22,11 +22,13 @@
 #include <gio/gio.h>
 
 #include "mongo-bson.h"
+#include "mongo-reply.h"
 
 G_BEGIN_DECLS
 
 #define MONGO_TYPE_CLIENT            (mongo_client_get_type())
 #define MONGO_TYPE_OPERATION         (mongo_operation_get_type())
+#define MONGO_TYPE_QUERY_FLAGS       (mongo_query_flags_get_type())
 #define MONGO_CLIENT(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), MONGO_TYPE_CLIENT, MongoClient))
 #define MONGO_CLIENT_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), MONGO_TYPE_CLIENT, MongoClient const))
 #define MONGO_CLIENT_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  MONGO_TYPE_CLIENT, MongoClientClass))
@@ -40,10 +42,15 @@ typedef struct _MongoClientClass   MongoClientClass;
 typedef struct _MongoClientPrivate MongoClientPrivate;
 typedef enum   _MongoClientError   MongoClientError;
 typedef enum   _MongoOperation     MongoOperation;
+typedef enum   _MongoQueryFlags    MongoQueryFlags;
 
 enum _MongoClientError
 {
    MONGO_CLIENT_ERROR_NOT_PRIMARY = 1,
+   MONGO_CLIENT_ERROR_NOT_CONNECTED,
+   MONGO_CLIENT_ERROR_INVALID_REPLY,
+   MONGO_CLIENT_ERROR_QUERY_FAILURE,
+   MONGO_CLIENT_ERROR_CURSOR_NOT_FOUND,
 };
 
 enum _MongoOperation
@@ -56,6 +63,18 @@ enum _MongoOperation
    MONGO_OPERATION_KILL_CURSORS = 2007,
 };
 
+enum _MongoQueryFlags
+{
+   MONGO_QUERY_NONE              = 0,
+   MONGO_QUERY_TAILABLE_CURSOR   = 1 << 1,
+   MONGO_QUERY_SLAVE_OK          = 1 << 2,
+   MONGO_QUERY_OPLOG_REPLAY      = 1 << 3,
+   MONGO_QUERY_NO_CURSOR_TIMEOUT = 1 << 4,
+   MONGO_QUERY_AWAIT_DATA        = 1 << 5,
+   MONGO_QUERY_EXHAUST           = 1 << 6,
+   MONGO_QUERY_PARTIAL           = 1 << 7,
+};
+
 struct _MongoClient
 {
    GObject parent;
@@ -72,6 +91,9 @@ struct _MongoClientClass
 void         mongo_client_add_peer       (MongoClient          *client,
                                           const gchar          *host,
                                           guint                 port);
+gboolean     mongo_client_connect        (MongoClient          *client,
+                                          GCancellable         *cancellable,
+                                          GError              **error);
 void         mongo_client_connect_async  (MongoClient          *client,
                                           GCancellable         *cancellable,
                                           GAsyncReadyCallback   callback,
@@ -81,10 +103,65 @@ gboolean     mongo_client_connect_finish (MongoClient          *client,
                                           GError              **error);
 GQuark       mongo_client_error_quark    (void) G_GNUC_CONST;
 const gchar *mongo_client_get_host       (MongoClient          *client);
+MongoReply  *mongo_client_get_more       (MongoClient          *client,
+                                          const gchar          *collection,
+                                          gint32                limit,
+                                          guint64               cursor_id,
+                                          GCancellable         *cancellable,
+                                          GError              **error);
+void         mongo_client_get_more_async (MongoClient          *client,
+                                          const gchar          *collection,
+                                          gint32                limit,
+                                          guint64               cursor_id,
+                                          GAsyncReadyCallback   callback,
+                                          gpointer              user_data);
+MongoReply  *mongo_client_get_more_finish (MongoClient         *client,
+                                          GAsyncResult         *result,
+                                          GError              **error);
 guint        mongo_client_get_port       (MongoClient          *client);
 guint        mongo_client_get_timeout    (MongoClient          *client);
 GType        mongo_client_get_type       (void) G_GNUC_CONST;
+gboolean     mongo_client_kill_cursors   (MongoClient          *client,
+                                          const guint64        *cursor_ids,
+                                          guint                 n_cursor_ids,
+                                          GError              **error);
+void         mongo_client_kill_cursors_async (MongoClient      *client,
+                                          const guint64        *cursor_ids,
+                                          guint                 n_cursor_ids,
+                                          GAsyncReadyCallback   callback,
+                                          gpointer              user_data);
+gboolean     mongo_client_kill_cursors_finish (MongoClient     *client,
+                                          GAsyncResult         *result,
+                                          GError              **error);
 MongoClient *mongo_client_new            (void);
+MongoReply  *mongo_client_query          (MongoClient          *client,
+                                          const gchar          *collection,
+                                          MongoQueryFlags       flags,
+                                          guint32               skip,
+                                          gint32                limit,
+                                          MongoBson            *query,
+                                          MongoBson            *fields,
+                                          GCancellable         *cancellable,
+                                          GError              **error);
+void         mongo_client_query_async    (MongoClient          *client,
+                                          const gchar          *collection,
+                                          MongoQueryFlags       flags,
+                                          guint32               skip,
+                                          gint32                limit,
+                                          MongoBson            *query,
+                                          MongoBson            *fields,
+                                          GAsyncReadyCallback   callback,
+                                          gpointer              user_data);
+MongoReply  *mongo_client_query_finish   (MongoClient          *client,
+                                          GAsyncResult         *result,
+                                          GError              **error);
+MongoBson   *mongo_client_send           (MongoClient          *client,
+                                          const gchar          *collection,
+                                          MongoBson            *bson,
+                                          MongoOperation        operation,
+                                          gboolean              want_reply,
+                                          GCancellable         *cancellable,
+                                          GError              **error);
 void         mongo_client_send_async     (MongoClient          *client,
                                           const gchar          *db,
                                           MongoBson            *bson,
@@ -102,6 +179,7 @@ void         mongo_client_set_port       (MongoClient          *client,
 void         mongo_client_set_timeout    (MongoClient          *client,
                                           guint                 timeout_msec);
 GType        mongo_operation_get_type    (void) G_GNUC_CONST;
+GType        mongo_query_flags_get_type  (void) G_GNUC_CONST;
 
 G_END_DECLS
 
@@ -0,0 +1,917 @@
+/* mongo-cursor.c
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib/gi18n.h>
+#include <string.h>
+
+#include "mongo-cursor.h"
+
+/*
+ * How long to wait before asking again after a tailable cursor returned
+ * nothing without waiting on the server, or died.
+ */
+#define RETRY_MSEC 100
+
+G_DEFINE_TYPE(MongoCursor, mongo_cursor, G_TYPE_OBJECT)
+
+struct _MongoCursorPrivate
+{
+   MongoClient        *client;
+   gchar              *collection;
+   MongoBson          *query;
+   MongoBson          *fields;
+   MongoQueryFlags     flags;
+   guint               batch_size;
+   guint64             resume_from;
+   guint64             cursor_id;
+   gboolean            exhausted;
+   GSimpleAsyncResult *simple;
+   GCancellable       *cancellable;
+   GMainContext       *context;
+   GSource            *retry;
+};
+
+enum
+{
+   PROP_0,
+   PROP_BATCH_SIZE,
+   PROP_CLIENT,
+   PROP_COLLECTION,
+   PROP_FIELDS,
+   PROP_FLAGS,
+   PROP_QUERY,
+   PROP_RESUME_FROM,
+   LAST_PROP
+};
+
+enum
+{
+   BATCH,
+   LAST_SIGNAL
+};
+
+static GParamSpec *gParamSpecs[LAST_PROP];
+static guint       gSignals[LAST_SIGNAL];
+
+static void mongo_cursor_next (MongoCursor *cursor);
+
+/**
+ * mongo_cursor_new:
+ * @client: (in): A connected #MongoClient.
+ * @collection: (in): The full name of the collection such as "db.things".
+ * @query: (in): The query document.
+ * @fields: (in) (allow-none): The fields to return, or %NULL for all.
+ * @flags: (in): The #MongoQueryFlags for the query.
+ *
+ * Creates a new #MongoCursor. Nothing is sent to the server until
+ * mongo_cursor_run_async() or mongo_cursor_next_batch() is called.
+ *
+ * To stream a capped collection such as the oplog, use
+ * %MONGO_QUERY_TAILABLE_CURSOR and usually %MONGO_QUERY_AWAIT_DATA.
+ *
+ * Returns: (transfer full): A new #MongoCursor.
+ */
+MongoCursor *
+mongo_cursor_new (MongoClient     *client,
+                  const gchar     *collection,
+                  MongoBson       *query,
+                  MongoBson       *fields,
+                  MongoQueryFlags  flags)
+{
+   g_return_val_if_fail(MONGO_IS_CLIENT(client), NULL);
+   g_return_val_if_fail(collection != NULL, NULL);
+   g_return_val_if_fail(query != NULL, NULL);
+
+   return g_object_new(MONGO_TYPE_CURSOR,
+                       "client", client,
+                       "collection", collection,
+                       "query", query,
+                       "fields", fields,
+                       "flags", flags,
+                       NULL);
+}
+
+/**
+ * mongo_cursor_get_batch_size:
+ * @cursor: (in): A #MongoCursor.
+ *
+ * Fetches the number of documents requested per batch.
+ *
+ * Returns: The batch size, or 0 for the server default.
+ */
+guint
+mongo_cursor_get_batch_size (MongoCursor *cursor)
+{
+   g_return_val_if_fail(MONGO_IS_CURSOR(cursor), 0);
+   return cursor->priv->batch_size;
+}
+
+/**
+ * mongo_cursor_set_batch_size:
+ * @cursor: (in): A #MongoCursor.
+ * @batch_size: (in): The number of documents per batch, or 0.
+ *
+ * Sets the number of documents requested per batch. 0 lets the server
+ * decide.
+ */
+void
+mongo_cursor_set_batch_size (MongoCursor *cursor,
+                             guint        batch_size)
+{
+   g_return_if_fail(MONGO_IS_CURSOR(cursor));
+   g_return_if_fail(batch_size <= G_MAXINT32);
+
+   cursor->priv->batch_size = batch_size;
+   g_object_notify_by_pspec(G_OBJECT(cursor), gParamSpecs[PROP_BATCH_SIZE]);
+}
+
+/**
+ * mongo_cursor_get_resume_from:
+ * @cursor: (in): A #MongoCursor.
+ *
+ * Fetches the timestamp the cursor resumes after. For a tailable cursor,
+ * this is updated to the "ts" field of the last document in each batch,
+ * so it can be saved and passed to mongo_cursor_set_resume_from() when
+ * the process restarts.
+ *
+ * The seconds are in the high 32 bits and the increment in the low 32 bits,
+ * as returned by mongo_bson_raw_iter_get_value_timestamp().
+ *
+ * Returns: A timestamp, or 0 if none is set.
+ */
+guint64
+mongo_cursor_get_resume_from (MongoCursor *cursor)
+{
+   g_return_val_if_fail(MONGO_IS_CURSOR(cursor), 0);
+   return cursor->priv->resume_from;
+}
+
+/**
+ * mongo_cursor_set_resume_from:
+ * @cursor: (in): A #MongoCursor.
+ * @resume_from: (in): A timestamp, or 0.
+ *
+ * Sets the timestamp to resume after. When set, the "ts" field of the
+ * query is replaced with "ts": {"$gt": @resume_from} whenever the query
+ * is sent, so only newer documents are returned. The format is described
+ * in mongo_cursor_get_resume_from().
+ */
+void
+mongo_cursor_set_resume_from (MongoCursor *cursor,
+                              guint64      resume_from)
+{
+   g_return_if_fail(MONGO_IS_CURSOR(cursor));
+
+   cursor->priv->resume_from = resume_from;
+   g_object_notify_by_pspec(G_OBJECT(cursor), gParamSpecs[PROP_RESUME_FROM]);
+}
+
+/*
+ * Builds the query to send, replacing the "ts" field of the query if
+ * there is a timestamp to resume from.
+ */
+static MongoBson *
+mongo_cursor_build_query (MongoCursor *cursor)
+{
+   MongoCursorPrivate *priv = cursor->priv;
+   MongoBsonRawIter iter;
+   const guint8 *element;
+   GByteArray *buf;
+   MongoBson *query;
+   MongoBson *gt;
+   guint32 length = 0;
+   guint8 trailing = 0;
+
+   if (!priv->resume_from) {
+      return mongo_bson_ref(priv->query);
+   }
+
+   buf = g_byte_array_new();
+   g_byte_array_append(buf, (guint8 *)&length, sizeof length);
+   mongo_bson_raw_iter_init(&iter, priv->query);
+   while (mongo_bson_raw_iter_next(&iter)) {
+      if (strcmp(mongo_bson_raw_iter_get_key(&iter), "ts") != 0) {
+         element = (const guint8 *)iter.key - 1;
+         g_byte_array_append(buf, element, iter.data + iter.offset - element);
+      }
+   }
+   g_byte_array_append(buf, &trailing, 1);
+   length = GUINT32_TO_LE(buf->len);
+   memcpy(buf->data, &length, sizeof length);
+   query = mongo_bson_new_from_data(buf->data, buf->len);
+   g_byte_array_free(buf, TRUE);
+
+   gt = mongo_bson_new();
+   mongo_bson_append_timestamp(gt, "$gt",
+                               (guint32)(priv->resume_from >> 32),
+                               (guint32)priv->resume_from);
+   mongo_bson_append_bson(query, "ts", gt);
+   mongo_bson_unref(gt);
+
+   return query;
+}
+
+/*
+ * Remembers the "ts" field of the last document in @reply that has one.
+ */
+static void
+mongo_cursor_track_timestamp (MongoCursor *cursor,
+                              MongoReply  *reply)
+{
+   MongoBsonRawIter iter;
+   guint i;
+
+   for (i = reply->n_documents; i > 0; i--) {
+      mongo_bson_raw_iter_init(&iter, reply->documents[i - 1]);
+      if (mongo_bson_raw_iter_find(&iter, "ts") &&
+          (mongo_bson_raw_iter_get_value_type(&iter) ==
+           MONGO_BSON_TIMESTAMP)) {
+         mongo_cursor_set_resume_from(
+               cursor, mongo_bson_raw_iter_get_value_timestamp(&iter,
+                                                               NULL,
+                                                               NULL));
+         break;
+      }
+   }
+}
+
+static void
+mongo_cursor_complete (MongoCursor *cursor,
+                       GError      *error)
+{
+   MongoCursorPrivate *priv = cursor->priv;
+   GSimpleAsyncResult *simple = priv->simple;
+
+   priv->simple = NULL;
+   g_clear_object(&priv->cancellable);
+
+   if (priv->retry) {
+      g_source_destroy(priv->retry);
+      g_source_unref(priv->retry);
+      priv->retry = NULL;
+   }
+   g_main_context_unref(priv->context);
+   priv->context = NULL;
+
+   if (error) {
+      g_simple_async_result_take_error(simple, error);
+   } else {
+      g_simple_async_result_set_op_res_gboolean(simple, TRUE);
+   }
+   g_simple_async_result_complete_in_idle(simple);
+   g_object_unref(simple);
+}
+
+static void
+mongo_cursor_kill_cursors_cb (GObject      *object,
+                              GAsyncResult *result,
+                              gpointer      user_data)
+{
+   MongoCursor *cursor = user_data;
+   GError *error = NULL;
+
+   g_return_if_fail(MONGO_IS_CURSOR(cursor));
+
+   /*
+    * The server closes idle cursors itself, so failing to kill the cursor
+    * is not worth reporting over the cancellation.
+    */
+   mongo_client_kill_cursors_finish(MONGO_CLIENT(object), result, NULL);
+
+   g_cancellable_set_error_if_cancelled(cursor->priv->cancellable, &error);
+   mongo_cursor_complete(cursor, error);
+   g_object_unref(cursor);
+}
+
+/*
+ * Completes the run if it has been cancelled, killing the server cursor
+ * first if there is one.
+ */
+static gboolean
+mongo_cursor_check_cancelled (MongoCursor *cursor)
+{
+   MongoCursorPrivate *priv = cursor->priv;
+   GError *error = NULL;
+   guint64 cursor_id;
+
+   if (!priv->cancellable || !g_cancellable_is_cancelled(priv->cancellable)) {
+      return FALSE;
+   }
+
+   if ((cursor_id = priv->cursor_id)) {
+      priv->cursor_id = 0;
+      mongo_client_kill_cursors_async(priv->client,
+                                      &cursor_id,
+                                      1,
+                                      mongo_cursor_kill_cursors_cb,
+                                      g_object_ref(cursor));
+      return TRUE;
+   }
+
+   g_cancellable_set_error_if_cancelled(priv->cancellable, &error);
+   mongo_cursor_complete(cursor, error);
+
+   return TRUE;
+}
+
+static gboolean
+mongo_cursor_retry_cb (gpointer data)
+{
+   MongoCursor *cursor = data;
+
+   g_return_val_if_fail(MONGO_IS_CURSOR(cursor), FALSE);
+
+   g_source_unref(cursor->priv->retry);
+   cursor->priv->retry = NULL;
+
+   if (!mongo_cursor_check_cancelled(cursor)) {
+      mongo_cursor_next(cursor);
+   }
+
+   return FALSE;
+}
+
+/*
+ * Waits a little before asking again. The timeout runs on the context
+ * that the cursor was started from, which need not be the global one.
+ */
+static void
+mongo_cursor_retry (MongoCursor *cursor)
+{
+   MongoCursorPrivate *priv = cursor->priv;
+
+   priv->retry = g_timeout_source_new(RETRY_MSEC);
+   g_source_set_callback(priv->retry,
+                         mongo_cursor_retry_cb,
+                         g_object_ref(cursor),
+                         g_object_unref);
+   g_source_attach(priv->retry, priv->context);
+}
+
+static void
+mongo_cursor_handle_reply (MongoCursor *cursor,
+                           MongoReply  *reply,
+                           GError      *error)
+{
+   MongoCursorPrivate *priv = cursor->priv;
+   gboolean tailable;
+
+   tailable = !!(priv->flags & MONGO_QUERY_TAILABLE_CURSOR);
+
+   if (!reply) {
+      priv->cursor_id = 0;
+      if (tailable &&
+          g_error_matches(error, MONGO_CLIENT_ERROR,
+                          MONGO_CLIENT_ERROR_CURSOR_NOT_FOUND)) {
+         g_error_free(error);
+         mongo_cursor_retry(cursor);
+         return;
+      }
+      mongo_cursor_complete(cursor, error);
+      return;
+   }
+
+   priv->cursor_id = reply->cursor_id;
+
+   if (mongo_cursor_check_cancelled(cursor)) {
+      return;
+   }
+
+   if (reply->n_documents) {
+      if (tailable) {
+         mongo_cursor_track_timestamp(cursor, reply);
+      }
+      g_signal_emit(cursor, gSignals[BATCH], 0, reply);
+      if (mongo_cursor_check_cancelled(cursor)) {
+         return;
+      }
+   }
+
+   /*
+    * A tailable cursor dies when the query matched nothing or the server
+    * dropped it, in which case the query is sent again from the last
+    * timestamp. Without AwaitData the server replies immediately, so wait
+    * a little before asking again.
+    */
+   if (!priv->cursor_id) {
+      if (tailable) {
+         mongo_cursor_retry(cursor);
+      } else {
+         mongo_cursor_complete(cursor, NULL);
+      }
+   } else if (!reply->n_documents &&
+              !(priv->flags & MONGO_QUERY_AWAIT_DATA)) {
+      mongo_cursor_retry(cursor);
+   } else {
+      mongo_cursor_next(cursor);
+   }
+}
+
+static void
+mongo_cursor_query_cb (GObject      *object,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+   MongoCursor *cursor = user_data;
+   MongoReply *reply;
+   GError *error = NULL;
+
+   g_return_if_fail(MONGO_IS_CURSOR(cursor));
+
+   reply = mongo_client_query_finish(MONGO_CLIENT(object), result, &error);
+   mongo_cursor_handle_reply(cursor, reply, error);
+   if (reply) {
+      mongo_reply_unref(reply);
+   }
+   g_object_unref(cursor);
+}
+
+static void
+mongo_cursor_get_more_cb (GObject      *object,
+                          GAsyncResult *result,
+                          gpointer      user_data)
+{
+   MongoCursor *cursor = user_data;
+   MongoReply *reply;
+   GError *error = NULL;
+
+   g_return_if_fail(MONGO_IS_CURSOR(cursor));
+
+   reply = mongo_client_get_more_finish(MONGO_CLIENT(object), result, &error);
+   mongo_cursor_handle_reply(cursor, reply, error);
+   if (reply) {
+      mongo_reply_unref(reply);
+   }
+   g_object_unref(cursor);
+}
+
+/*
+ * Requests the next batch, sending the query again if there is no
+ * cursor on the server.
+ */
+static void
+mongo_cursor_next (MongoCursor *cursor)
+{
+   MongoCursorPrivate *priv = cursor->priv;
+   MongoBson *query;
+
+   if (priv->cursor_id) {
+      mongo_client_get_more_async(priv->client,
+                                  priv->collection,
+                                  priv->batch_size,
+                                  priv->cursor_id,
+                                  mongo_cursor_get_more_cb,
+                                  g_object_ref(cursor));
+      return;
+   }
+
+   query = mongo_cursor_build_query(cursor);
+   mongo_client_query_async(priv->client,
+                            priv->collection,
+                            priv->flags,
+                            0,
+                            priv->batch_size,
+                            query,
+                            priv->fields,
+                            mongo_cursor_query_cb,
+                            g_object_ref(cursor));
+   mongo_bson_unref(query);
+}
+
+/**
+ * mongo_cursor_run_async:
+ * @cursor: (in): A #MongoCursor.
+ * @cancellable: (in) (allow-none): A #GCancellable, or %NULL.
+ * @callback: (in): A callback to execute upon completion.
+ * @user_data: (in): User data for @callback.
+ *
+ * Runs the query and emits #MongoCursor::batch for every batch of
+ * documents as it arrives, requesting the next batch automatically.
+ *
+ * A regular cursor completes once all results have been delivered. A
+ * tailable cursor keeps running, sending the query again from the last
+ * timestamp when the server drops the cursor, until @cancellable is
+ * cancelled or an error occurs. Cancellation is noticed when the
+ * outstanding request completes, which for %MONGO_QUERY_AWAIT_DATA may
+ * take as long as the server waits for data.
+ */
+void
+mongo_cursor_run_async (MongoCursor         *cursor,
+                        GCancellable        *cancellable,
+                        GAsyncReadyCallback  callback,
+                        gpointer             user_data)
+{
+   MongoCursorPrivate *priv;
+
+   g_return_if_fail(MONGO_IS_CURSOR(cursor));
+   g_return_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable));
+   g_return_if_fail(callback != NULL);
+
+   priv = cursor->priv;
+
+   if (priv->simple) {
+      g_warning("Cannot run cursor, it is already running.");
+      return;
+   }
+
+   priv->simple = g_simple_async_result_new(G_OBJECT(cursor),
+                                            callback,
+                                            user_data,
+                                            mongo_cursor_run_async);
+   priv->cancellable = cancellable ? g_object_ref(cancellable) : NULL;
+   priv->context = g_main_context_ref_thread_default();
+   priv->cursor_id = 0;
+
+   mongo_cursor_next(cursor);
+}
+
+/**
+ * mongo_cursor_run_finish:
+ * @cursor: (in): A #MongoCursor.
+ * @result: (in): A #GAsyncResult.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Completes an asynchronous request to mongo_cursor_run_async().
+ *
+ * Returns: %TRUE if all results were delivered; otherwise %FALSE and
+ *   @error is set.
+ */
+gboolean
+mongo_cursor_run_finish (MongoCursor   *cursor,
+                         GAsyncResult  *result,
+                         GError       **error)
+{
+   GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
+
+   g_return_val_if_fail(MONGO_IS_CURSOR(cursor), FALSE);
+   g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple), FALSE);
+
+   if (g_simple_async_result_propagate_error(simple, error)) {
+      return FALSE;
+   }
+
+   return g_simple_async_result_get_op_res_gboolean(simple);
+}
+
+/**
+ * mongo_cursor_next_batch:
+ * @cursor: (in): A #MongoCursor.
+ * @cancellable: (in) (allow-none): A #GCancellable, or %NULL.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Synchronously retrieves the next batch of documents, sending the query
+ * on the first call. This blocks the calling thread and requires a client
+ * connected with mongo_client_connect(). A cursor must only be used from
+ * one thread at a time, but any number of cursors may share the client.
+ *
+ * A tailable cursor blocks until documents arrive, sending the query
+ * again from the last timestamp when the server drops the cursor, and
+ * updates #MongoCursor:resume-from like mongo_cursor_run_async(). When
+ * @cancellable is cancelled, the server cursor is closed. Cancellation
+ * also interrupts a request that is waiting for its reply.
+ *
+ * Returns: A #MongoReply with at least one document that should be freed
+ *   with mongo_reply_unref(), or %NULL once a regular cursor is exhausted
+ *   or upon failure, in which case @error is set.
+ */
+MongoReply *
+mongo_cursor_next_batch (MongoCursor   *cursor,
+                         GCancellable  *cancellable,
+                         GError       **error)
+{
+   MongoCursorPrivate *priv;
+   MongoReply *reply;
+   MongoBson *query;
+   gboolean tailable;
+   GError *local_error = NULL;
+
+   g_return_val_if_fail(MONGO_IS_CURSOR(cursor), NULL);
+   g_return_val_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable), NULL);
+
+   priv = cursor->priv;
+
+   if (priv->simple) {
+      g_warning("Cannot iterate cursor, it is already running.");
+      return NULL;
+   }
+
+   tailable = !!(priv->flags & MONGO_QUERY_TAILABLE_CURSOR);
+
+   while (!priv->exhausted) {
+      if (g_cancellable_set_error_if_cancelled(cancellable, error)) {
+         if (priv->cursor_id) {
+            mongo_client_kill_cursors(priv->client, &priv->cursor_id, 1, NULL);
+            priv->cursor_id = 0;
+         }
+         return NULL;
+      }
+
+      if (priv->cursor_id) {
+         reply = mongo_client_get_more(priv->client,
+                                       priv->collection,
+                                       priv->batch_size,
+                                       priv->cursor_id,
+                                       cancellable,
+                                       &local_error);
+      } else {
+         query = mongo_cursor_build_query(cursor);
+         reply = mongo_client_query(priv->client,
+                                    priv->collection,
+                                    priv->flags,
+                                    0,
+                                    priv->batch_size,
+                                    query,
+                                    priv->fields,
+                                    cancellable,
+                                    &local_error);
+         mongo_bson_unref(query);
+      }
+
+      if (!reply) {
+         /*
+          * A cancelled getMore leaves the cursor open on the server.
+          */
+         if (priv->cursor_id &&
+             g_error_matches(local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            mongo_client_kill_cursors(priv->client, &priv->cursor_id, 1, NULL);
+         }
+         priv->cursor_id = 0;
+         if (tailable &&
+             g_error_matches(local_error, MONGO_CLIENT_ERROR,
+                             MONGO_CLIENT_ERROR_CURSOR_NOT_FOUND)) {
+            g_clear_error(&local_error);
+            g_usleep(RETRY_MSEC * 1000);
+            continue;
+         }
+         g_propagate_error(error, local_error);
+         return NULL;
+      }
+
+      priv->cursor_id = reply->cursor_id;
+      priv->exhausted = !priv->cursor_id && !tailable;
+
+      if (reply->n_documents) {
+         if (tailable) {
+            mongo_cursor_track_timestamp(cursor, reply);
+         }
+         return reply;
+      }
+
+      mongo_reply_unref(reply);
+
+      /*
+       * See mongo_cursor_handle_reply().
+       */
+      if (tailable &&
+          (!priv->cursor_id || !(priv->flags & MONGO_QUERY_AWAIT_DATA))) {
+         g_usleep(RETRY_MSEC * 1000);
+      }
+   }
+
+   return NULL;
+}
+
+/**
+ * mongo_cursor_finalize:
+ * @object: (in): A #MongoCursor.
+ *
+ * Finalizer for a #MongoCursor instance. Frees any resources held by
+ * the instance.
+ */
+static void
+mongo_cursor_finalize (GObject *object)
+{
+   MongoCursorPrivate *priv = MONGO_CURSOR(object)->priv;
+
+   g_clear_object(&priv->client);
+   g_free(priv->collection);
+   if (priv->query) {
+      mongo_bson_unref(priv->query);
+   }
+   if (priv->fields) {
+      mongo_bson_unref(priv->fields);
+   }
+
+   G_OBJECT_CLASS(mongo_cursor_parent_class)->finalize(object);
+}
+
+/**
+ * mongo_cursor_get_property:
+ * @object: (in): A #GObject.
+ * @prop_id: (in): The property identifier.
+ * @value: (out): The given property.
+ * @pspec: (in): A #ParamSpec.
+ *
+ * Get a given #GObject property.
+ */
+static void
+mongo_cursor_get_property (GObject    *object,
+                           guint       prop_id,
+                           GValue     *value,
+                           GParamSpec *pspec)
+{
+   MongoCursor *cursor = MONGO_CURSOR(object);
+
+   switch (prop_id) {
+   case PROP_BATCH_SIZE:
+      g_value_set_uint(value, mongo_cursor_get_batch_size(cursor));
+      break;
+   case PROP_CLIENT:
+      g_value_set_object(value, cursor->priv->client);
+      break;
+   case PROP_COLLECTION:
+      g_value_set_string(value, cursor->priv->collection);
+      break;
+   case PROP_FIELDS:
+      g_value_set_boxed(value, cursor->priv->fields);
+      break;
+   case PROP_FLAGS:
+      g_value_set_flags(value, cursor->priv->flags);
+      break;
+   case PROP_QUERY:
+      g_value_set_boxed(value, cursor->priv->query);
+      break;
+   case PROP_RESUME_FROM:
+      g_value_set_uint64(value, mongo_cursor_get_resume_from(cursor));
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+/**
+ * mongo_cursor_set_property:
+ * @object: (in): A #GObject.
+ * @prop_id: (in): The property identifier.
+ * @value: (in): The given property.
+ * @pspec: (in): A #ParamSpec.
+ *
+ * Set a given #GObject property.
+ */
+static void
+mongo_cursor_set_property (GObject      *object,
+                           guint         prop_id,
+                           const GValue *value,
+                           GParamSpec   *pspec)
+{
+   MongoCursor *cursor = MONGO_CURSOR(object);
+
+   switch (prop_id) {
+   case PROP_BATCH_SIZE:
+      mongo_cursor_set_batch_size(cursor, g_value_get_uint(value));
+      break;
+   case PROP_CLIENT:
+      cursor->priv->client = g_value_dup_object(value);
+      break;
+   case PROP_COLLECTION:
+      cursor->priv->collection = g_value_dup_string(value);
+      break;
+   case PROP_FIELDS:
+      cursor->priv->fields = g_value_dup_boxed(value);
+      break;
+   case PROP_FLAGS:
+      cursor->priv->flags = g_value_get_flags(value);
+      break;
+   case PROP_QUERY:
+      cursor->priv->query = g_value_dup_boxed(value);
+      break;
+   case PROP_RESUME_FROM:
+      mongo_cursor_set_resume_from(cursor, g_value_get_uint64(value));
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+/**
+ * mongo_cursor_class_init:
+ * @klass: (in): A #MongoCursorClass.
+ *
+ * Initializes the #MongoCursorClass and prepares the vtable.
+ */
+static void
+mongo_cursor_class_init (MongoCursorClass *klass)
+{
+   GObjectClass *object_class;
+
+   object_class = G_OBJECT_CLASS(klass);
+   object_class->finalize = mongo_cursor_finalize;
+   object_class->get_property = mongo_cursor_get_property;
+   object_class->set_property = mongo_cursor_set_property;
+   g_type_class_add_private(object_class, sizeof(MongoCursorPrivate));
+
+   gParamSpecs[PROP_BATCH_SIZE] =
+      g_param_spec_uint("batch-size",
+                        _("Batch Size"),
+                        _("The number of documents per batch."),
+                        0,
+                        G_MAXINT32,
+                        0,
+                        G_PARAM_READWRITE);
+   g_object_class_install_property(object_class, PROP_BATCH_SIZE,
+                                   gParamSpecs[PROP_BATCH_SIZE]);
+
+   gParamSpecs[PROP_CLIENT] =
+      g_param_spec_object("client",
+                          _("Client"),
+                          _("The client to query with."),
+                          MONGO_TYPE_CLIENT,
+                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+   g_object_class_install_property(object_class, PROP_CLIENT,
+                                   gParamSpecs[PROP_CLIENT]);
+
+   gParamSpecs[PROP_COLLECTION] =
+      g_param_spec_string("collection",
+                          _("Collection"),
+                          _("The full name of the collection to query."),
+                          NULL,
+                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+   g_object_class_install_property(object_class, PROP_COLLECTION,
+                                   gParamSpecs[PROP_COLLECTION]);
+
+   gParamSpecs[PROP_FIELDS] =
+      g_param_spec_boxed("fields",
+                         _("Fields"),
+                         _("The fields to return."),
+                         MONGO_TYPE_BSON,
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+   g_object_class_install_property(object_class, PROP_FIELDS,
+                                   gParamSpecs[PROP_FIELDS]);
+
+   gParamSpecs[PROP_FLAGS] =
+      g_param_spec_flags("flags",
+                         _("Flags"),
+                         _("The flags for the query."),
+                         MONGO_TYPE_QUERY_FLAGS,
+                         MONGO_QUERY_NONE,
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+   g_object_class_install_property(object_class, PROP_FLAGS,
+                                   gParamSpecs[PROP_FLAGS]);
+
+   gParamSpecs[PROP_QUERY] =
+      g_param_spec_boxed("query",
+                         _("Query"),
+                         _("The query document."),
+                         MONGO_TYPE_BSON,
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+   g_object_class_install_property(object_class, PROP_QUERY,
+                                   gParamSpecs[PROP_QUERY]);
+
+   gParamSpecs[PROP_RESUME_FROM] =
+      g_param_spec_uint64("resume-from",
+                          _("Resume From"),
+                          _("The timestamp to resume after."),
+                          0,
+                          G_MAXUINT64,
+                          0,
+                          G_PARAM_READWRITE);
+   g_object_class_install_property(object_class, PROP_RESUME_FROM,
+                                   gParamSpecs[PROP_RESUME_FROM]);
+
+   /**
+    * MongoCursor::batch:
+    * @cursor: The #MongoCursor.
+    * @reply: The #MongoReply containing the batch.
+    *
+    * Emitted for every batch of documents received from the server.
+    * Empty batches are not emitted.
+    */
+   gSignals[BATCH] = g_signal_new("batch",
+                                  MONGO_TYPE_CURSOR,
+                                  G_SIGNAL_RUN_LAST,
+                                  0,
+                                  NULL,
+                                  NULL,
+                                  g_cclosure_marshal_VOID__BOXED,
+                                  G_TYPE_NONE,
+                                  1,
+                                  MONGO_TYPE_REPLY);
+}
+
+/**
+ * mongo_cursor_init:
+ * @cursor: (in): A #MongoCursor.
+ *
+ * Initializes the newly created #MongoCursor instance.
+ */
+static void
+mongo_cursor_init (MongoCursor *cursor)
+{
+   cursor->priv = G_TYPE_INSTANCE_GET_PRIVATE(cursor, MONGO_TYPE_CURSOR,
+                                              MongoCursorPrivate);
+}
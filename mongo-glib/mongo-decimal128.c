@@ -0,0 +1,421 @@
+/* mongo-decimal128.c
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "mongo-decimal128.h"
+
+#define EXPONENT_BIAS 6176
+#define EXPONENT_MAX  6111
+#define EXPONENT_MIN  (-6176)
+#define MAX_DIGITS    34
+
+#define SIGN_BIT         G_GUINT64_CONSTANT(0x8000000000000000)
+#define COMBINATION_MASK G_GUINT64_CONSTANT(0x6000000000000000)
+#define INFINITY_MASK    G_GUINT64_CONSTANT(0x7800000000000000)
+#define NAN_MASK         G_GUINT64_CONSTANT(0x7C00000000000000)
+
+/**
+ * mongo_decimal128_init_from_data:
+ * @decimal: (out): A #MongoDecimal128.
+ * @bytes: (in): The 16 little-endian bytes of a BSON Decimal128.
+ *
+ * Initializes @decimal from the bytes of a BSON Decimal128 value.
+ */
+void
+mongo_decimal128_init_from_data (MongoDecimal128 *decimal,
+                                 const guint8    *bytes)
+{
+   g_return_if_fail(decimal != NULL);
+   g_return_if_fail(bytes != NULL);
+
+   memcpy(&decimal->low, bytes, sizeof decimal->low);
+   memcpy(&decimal->high, bytes + 8, sizeof decimal->high);
+   decimal->low = GUINT64_FROM_LE(decimal->low);
+   decimal->high = GUINT64_FROM_LE(decimal->high);
+}
+
+/**
+ * mongo_decimal128_init_from_string:
+ * @decimal: (out): A #MongoDecimal128.
+ * @string: (in): A decimal number such as "1.50", "-2E+10" or "NaN".
+ *
+ * Parses @string into @decimal. Trailing zeros are kept, so "1.50" and
+ * "1.5" have different representations, as in MongoDB. Values that would
+ * need rounding to fit in 34 digits are rejected.
+ *
+ * Returns: %TRUE if @string was valid; otherwise %FALSE.
+ */
+gboolean
+mongo_decimal128_init_from_string (MongoDecimal128 *decimal,
+                                   const gchar     *string)
+{
+   const gchar *p = string;
+   gboolean negative = FALSE;
+   gboolean exp_negative = FALSE;
+   gboolean saw_digit = FALSE;
+   gboolean saw_point = FALSE;
+   guint64 high = 0;
+   guint64 low = 0;
+   guint64 lo_lo;
+   guint64 lo_hi;
+   guint8 digits[MAX_DIGITS];
+   gint64 exp_value = 0;
+   gint64 exponent = 0;
+   guint n_digits = 0;
+   guint i;
+
+   g_return_val_if_fail(decimal != NULL, FALSE);
+   g_return_val_if_fail(string != NULL, FALSE);
+
+   if ((*p == '-') || (*p == '+')) {
+      negative = (*p++ == '-');
+   }
+
+   if (!g_ascii_strcasecmp(p, "Infinity") || !g_ascii_strcasecmp(p, "Inf")) {
+      decimal->high = INFINITY_MASK | (negative ? SIGN_BIT : 0);
+      decimal->low = 0;
+      return TRUE;
+   } else if (!g_ascii_strcasecmp(p, "NaN")) {
+      decimal->high = NAN_MASK;
+      decimal->low = 0;
+      return TRUE;
+   }
+
+   for (; *p; p++) {
+      if (*p == '.') {
+         if (saw_point) {
+            return FALSE;
+         }
+         saw_point = TRUE;
+         continue;
+      }
+      if (!g_ascii_isdigit(*p)) {
+         break;
+      }
+      saw_digit = TRUE;
+      if (saw_point) {
+         exponent--;
+      }
+      if (!n_digits && (*p == '0')) {
+         continue;
+      }
+      if (n_digits < MAX_DIGITS) {
+         digits[n_digits++] = *p - '0';
+      } else if (*p == '0') {
+         /*
+          * Zeros beyond the precision are dropped by raising the exponent.
+          */
+         exponent++;
+      } else {
+         return FALSE;
+      }
+   }
+
+   if (!saw_digit) {
+      return FALSE;
+   }
+
+   if ((*p == 'e') || (*p == 'E')) {
+      p++;
+      if ((*p == '-') || (*p == '+')) {
+         exp_negative = (*p++ == '-');
+      }
+      if (!g_ascii_isdigit(*p)) {
+         return FALSE;
+      }
+      for (; g_ascii_isdigit(*p); p++) {
+         exp_value = (exp_value * 10) + (*p - '0');
+         if (exp_value > 100000) {
+            return FALSE;
+         }
+      }
+      exponent += exp_negative ? -exp_value : exp_value;
+   }
+
+   if (*p) {
+      return FALSE;
+   }
+
+   /*
+    * Bring the exponent into range without changing the value, either by
+    * padding the coefficient with zeros or by removing trailing zeros.
+    */
+   if (!n_digits) {
+      exponent = CLAMP(exponent, EXPONENT_MIN, EXPONENT_MAX);
+   }
+   while ((exponent > EXPONENT_MAX) && (n_digits < MAX_DIGITS)) {
+      digits[n_digits++] = 0;
+      exponent--;
+   }
+   while ((exponent < EXPONENT_MIN) && n_digits && !digits[n_digits - 1]) {
+      n_digits--;
+      exponent++;
+   }
+   if ((exponent > EXPONENT_MAX) || (exponent < EXPONENT_MIN)) {
+      return FALSE;
+   }
+
+   for (i = 0; i < n_digits; i++) {
+      lo_lo = ((low & 0xFFFFFFFF) * 10) + digits[i];
+      lo_hi = ((low >> 32) * 10) + (lo_lo >> 32);
+      low = (lo_hi << 32) | (lo_lo & 0xFFFFFFFF);
+      high = (high * 10) + (lo_hi >> 32);
+   }
+
+   decimal->high = (negative ? SIGN_BIT : 0) |
+                   ((guint64)(exponent + EXPONENT_BIAS) << 49) |
+                   high;
+   decimal->low = low;
+
+   return TRUE;
+}
+
+/**
+ * mongo_decimal128_new_from_string:
+ * @string: (in): A decimal number.
+ *
+ * Creates a new #MongoDecimal128 from @string. See
+ * mongo_decimal128_init_from_string().
+ *
+ * Returns: (transfer full): A #MongoDecimal128 if @string was valid;
+ *   otherwise %NULL.
+ */
+MongoDecimal128 *
+mongo_decimal128_new_from_string (const gchar *string)
+{
+   MongoDecimal128 decimal;
+
+   g_return_val_if_fail(string != NULL, NULL);
+
+   if (mongo_decimal128_init_from_string(&decimal, string)) {
+      return mongo_decimal128_copy(&decimal);
+   }
+
+   return NULL;
+}
+
+/**
+ * mongo_decimal128_divide:
+ * @limbs: (inout): A 128-bit integer as 32-bit limbs, most significant
+ *   first.
+ *
+ * Divides @limbs by 10^9 in place.
+ *
+ * Returns: The remainder.
+ */
+static guint32
+mongo_decimal128_divide (guint32 limbs[4])
+{
+   guint64 rem = 0;
+   guint i;
+
+   for (i = 0; i < 4; i++) {
+      rem = (rem << 32) + limbs[i];
+      limbs[i] = (guint32)(rem / 1000000000);
+      rem %= 1000000000;
+   }
+
+   return (guint32)rem;
+}
+
+/**
+ * mongo_decimal128_to_string_r:
+ * @decimal: (in): A #MongoDecimal128.
+ * @string: (out): A location for 43 characters.
+ *
+ * Formats @decimal into @string, including a trailing nul byte, using the
+ * same notation as MongoDB. Unlike mongo_decimal128_to_string(), this
+ * does not allocate memory.
+ */
+void
+mongo_decimal128_to_string_r (const MongoDecimal128 *decimal,
+                              gchar                  string[43])
+{
+   guint32 limbs[4] = { 0 };
+   guint32 rem;
+   guint8 digits[36];
+   gchar *p = string;
+   gint exponent;
+   gint sci_exp;
+   gint radix;
+   guint n_digits = 0;
+   guint i;
+
+   g_return_if_fail(decimal != NULL);
+   g_return_if_fail(string != NULL);
+
+   if ((decimal->high & NAN_MASK) == NAN_MASK) {
+      strcpy(string, "NaN");
+      return;
+   }
+
+   if (decimal->high & SIGN_BIT) {
+      *p++ = '-';
+   }
+
+   if ((decimal->high & INFINITY_MASK) == INFINITY_MASK) {
+      strcpy(p, "Infinity");
+      return;
+   }
+
+   /*
+    * Coefficients with the implicit 100 prefix exceed 10^34 - 1 and are
+    * read as zero, as are larger explicit ones.
+    */
+   if ((decimal->high & COMBINATION_MASK) == COMBINATION_MASK) {
+      exponent = (gint)((decimal->high >> 47) & 0x3FFF) - EXPONENT_BIAS;
+   } else {
+      exponent = (gint)((decimal->high >> 49) & 0x3FFF) - EXPONENT_BIAS;
+      limbs[0] = (decimal->high >> 32) & 0x1FFFF;
+      limbs[1] = decimal->high & 0xFFFFFFFF;
+      limbs[2] = decimal->low >> 32;
+      limbs[3] = decimal->low & 0xFFFFFFFF;
+      if ((limbs[0] > 0x1ED09) ||
+          ((limbs[0] == 0x1ED09) &&
+           ((limbs[1] > 0xBEAD87C0) ||
+            ((limbs[1] == 0xBEAD87C0) && (limbs[2] >= 0x378D8E64))))) {
+         memset(limbs, 0, sizeof limbs);
+      }
+   }
+
+   while (limbs[0] || limbs[1] || limbs[2] || limbs[3]) {
+      rem = mongo_decimal128_divide(limbs);
+      for (i = 0; i < 9; i++) {
+         digits[n_digits++] = rem % 10;
+         rem /= 10;
+      }
+   }
+
+   while ((n_digits > 1) && !digits[n_digits - 1]) {
+      n_digits--;
+   }
+
+   if (!n_digits) {
+      digits[n_digits++] = 0;
+   }
+
+   sci_exp = exponent + (gint)n_digits - 1;
+
+   if ((exponent > 0) || (sci_exp < -6)) {
+      *p++ = '0' + digits[n_digits - 1];
+      if (n_digits > 1) {
+         *p++ = '.';
+         for (i = n_digits - 1; i > 0; i--) {
+            *p++ = '0' + digits[i - 1];
+         }
+      }
+      g_snprintf(p, 8, "E%+d", sci_exp);
+      return;
+   }
+
+   radix = (gint)n_digits + exponent;
+
+   if (radix <= 0) {
+      *p++ = '0';
+      *p++ = '.';
+      for (; radix < 0; radix++) {
+         *p++ = '0';
+      }
+   }
+
+   for (i = n_digits; i > 0; i--) {
+      if (exponent && radix && ((gint)(n_digits - i) == radix)) {
+         *p++ = '.';
+      }
+      *p++ = '0' + digits[i - 1];
+   }
+
+   *p = '\0';
+}
+
+/**
+ * mongo_decimal128_to_string:
+ * @decimal: (in): A #MongoDecimal128.
+ *
+ * Formats @decimal as a string. See mongo_decimal128_to_string_r().
+ *
+ * Returns: (transfer full): A newly allocated string.
+ */
+gchar *
+mongo_decimal128_to_string (const MongoDecimal128 *decimal)
+{
+   gchar str[43];
+
+   g_return_val_if_fail(decimal != NULL, NULL);
+
+   mongo_decimal128_to_string_r(decimal, str);
+   return g_strdup(str);
+}
+
+/**
+ * mongo_decimal128_to_double:
+ * @decimal: (in): A #MongoDecimal128.
+ *
+ * Converts @decimal to the nearest double.
+ *
+ * Returns: A #gdouble.
+ */
+gdouble
+mongo_decimal128_to_double (const MongoDecimal128 *decimal)
+{
+   gchar str[43];
+
+   g_return_val_if_fail(decimal != NULL, 0.0);
+
+   mongo_decimal128_to_string_r(decimal, str);
+   return g_ascii_strtod(str, NULL);
+}
+
+MongoDecimal128 *
+mongo_decimal128_copy (const MongoDecimal128 *decimal)
+{
+   MongoDecimal128 *copy;
+
+   g_return_val_if_fail(decimal != NULL, NULL);
+
+   copy = g_slice_new(MongoDecimal128);
+   memcpy(copy, decimal, sizeof *decimal);
+
+   return copy;
+}
+
+void
+mongo_decimal128_free (MongoDecimal128 *decimal)
+{
+   if (decimal) {
+      g_slice_free(MongoDecimal128, decimal);
+   }
+}
+
+GType
+mongo_decimal128_get_type (void)
+{
+   static GType type_id = 0;
+   static gsize initialized = FALSE;
+
+   if (g_once_init_enter(&initialized)) {
+      type_id = g_boxed_type_register_static(
+         "MongoDecimal128",
+         (GBoxedCopyFunc)mongo_decimal128_copy,
+         (GBoxedFreeFunc)mongo_decimal128_free);
+      g_once_init_leave(&initialized, TRUE);
+   }
+
+   return type_id;
+}
@@ -0,0 +1,60 @@
+/* mongo-decimal128.h
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MONGO_DECIMAL128_H
+#define MONGO_DECIMAL128_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define MONGO_TYPE_DECIMAL128 (mongo_decimal128_get_type())
+
+typedef struct _MongoDecimal128 MongoDecimal128;
+
+/**
+ * MongoDecimal128:
+ *
+ * A 128-bit IEEE 754-2008 decimal floating point number as stored by the
+ * BSON Decimal128 type, using the binary integer decimal encoding. The
+ * structure is public so that it may be stored inline; the contents
+ * should be considered opaque.
+ */
+struct _MongoDecimal128
+{
+   /*< private >*/
+   guint64 low;
+   guint64 high;
+};
+
+MongoDecimal128 *mongo_decimal128_copy             (const MongoDecimal128 *decimal);
+void             mongo_decimal128_free             (MongoDecimal128       *decimal);
+GType            mongo_decimal128_get_type         (void) G_GNUC_CONST;
+void             mongo_decimal128_init_from_data   (MongoDecimal128       *decimal,
+                                                    const guint8          *bytes);
+gboolean         mongo_decimal128_init_from_string (MongoDecimal128       *decimal,
+                                                    const gchar           *string);
+MongoDecimal128 *mongo_decimal128_new_from_string  (const gchar           *string);
+gdouble          mongo_decimal128_to_double        (const MongoDecimal128 *decimal);
+gchar           *mongo_decimal128_to_string        (const MongoDecimal128 *decimal);
+void             mongo_decimal128_to_string_r      (const MongoDecimal128 *decimal,
+                                                    gchar                  string[43]);
+
+G_END_DECLS
+
+#endif /* MONGO_DECIMAL128_H */
@@ -26,8 +26,20 @@ G_BEGIN_DECLS
 #define MONGO_INSIDE
 
 #include "mongo-bson.h"
+#include "mongo-bson-columns.h"
+#include "mongo-bson-file.h"
+#include "mongo-bson-json.h"
+#include "mongo-bson-matcher.h"
+#include "mongo-bson-reader.h"
+#include "mongo-bson-sorter.h"
 #include "mongo-client.h"
+#include "mongo-cursor.h"
+#include "mongo-decimal128.h"
 #include "mongo-object-id.h"
+#include "mongo-oplog-reader.h"
+#include "mongo-pipeline.h"
+#include "mongo-reply.h"
+#include "mongo-sort-spec.h"
 
 #undef MONGO_INSIDE
 
@@ -16,29 +16,466 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <pthread.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "mongo-object-id.h"
 
-struct _MongoObjectId
+/*
+ * Bytes 4 through 8 of every ObjectId generated by this process. They
+ * contain the machine identifier followed by the process identifier.
+ */
+static guint8 gMachineAndPid[5];
+
+/*
+ * The 24-bit counter portion of generated ObjectIds. It is seeded with a
+ * random value and incremented atomically so that generating ids never
+ * requires a lock, even when done from many threads at once.
+ */
+static volatile gint gCounter;
+
+/**
+ * mongo_object_id_update_pid:
+ *
+ * Stores the process identifier into the cached bytes. This also runs in
+ * the child after fork(), where only the forking thread exists, so that
+ * the child does not generate the same ids as its parent.
+ */
+static void
+mongo_object_id_update_pid (void)
 {
-   guint8 data[12];
-};
+   guint16 pid;
+
+   pid = GUINT16_TO_BE(getpid());
+   memcpy(&gMachineAndPid[3], &pid, sizeof pid);
+}
 
+/**
+ * mongo_object_id_init_process:
+ *
+ * Computes the machine and process identifiers and seeds the counter. This
+ * is performed once per process.
+ */
+static void
+mongo_object_id_init_process (void)
+{
+   static gsize initialized = FALSE;
+   GChecksum *checksum;
+   guint8 digest[16];
+   gsize digest_len = sizeof digest;
+
+   if (g_once_init_enter(&initialized)) {
+      checksum = g_checksum_new(G_CHECKSUM_MD5);
+      g_checksum_update(checksum, (const guchar *)g_get_host_name(), -1);
+      g_checksum_get_digest(checksum, digest, &digest_len);
+      g_checksum_free(checksum);
+
+      memcpy(&gMachineAndPid[0], digest, 3);
+      mongo_object_id_update_pid();
+      pthread_atfork(NULL, NULL, mongo_object_id_update_pid);
+
+      gCounter = g_random_int_range(0, 0xFFFFFF);
+
+      g_once_init_leave(&initialized, TRUE);
+   }
+}
+
+/**
+ * mongo_object_id_fill:
+ * @object_id: (out): A #MongoObjectId.
+ * @timestamp: (in): The big-endian timestamp in seconds.
+ * @counter: (in): The counter value for this id.
+ *
+ * Fills @object_id using the process wide machine and process identifiers.
+ */
+static inline void
+mongo_object_id_fill (MongoObjectId *object_id,
+                      guint32        timestamp,
+                      guint32        counter)
+{
+   memcpy(&object_id->data[0], &timestamp, sizeof timestamp);
+   memcpy(&object_id->data[4], gMachineAndPid, sizeof gMachineAndPid);
+   object_id->data[9] = (counter >> 16) & 0xFF;
+   object_id->data[10] = (counter >> 8) & 0xFF;
+   object_id->data[11] = counter & 0xFF;
+}
+
+/**
+ * mongo_object_id_init:
+ * @object_id: (out): A location for a #MongoObjectId.
+ *
+ * Generates a new ObjectId in place. The id is composed of the current
+ * time in seconds, a machine identifier, the process identifier and a
+ * counter that is atomically incremented for each id.
+ */
+void
+mongo_object_id_init (MongoObjectId *object_id)
+{
+   GTimeVal tv;
+
+   g_return_if_fail(object_id != NULL);
+
+   mongo_object_id_init_process();
+   g_get_current_time(&tv);
+   mongo_object_id_fill(object_id,
+                        GUINT32_TO_BE((guint32)tv.tv_sec),
+                        g_atomic_int_add(&gCounter, 1));
+}
+
+/**
+ * mongo_object_id_init_array:
+ * @object_ids: (out) (array length=n_object_ids): An array of #MongoObjectId.
+ * @n_object_ids: (in): The number of elements in @object_ids.
+ *
+ * Generates @n_object_ids new ObjectIds into the contiguous array
+ * @object_ids. This is equivalent to calling mongo_object_id_init() for each
+ * element, but the counter range for the entire array is reserved with a
+ * single atomic operation and the clock is only read once. This is useful
+ * when generating the _id field for a batch of inserts.
+ */
+void
+mongo_object_id_init_array (MongoObjectId *object_ids,
+                            guint          n_object_ids)
+{
+   GTimeVal tv;
+   guint32 timestamp;
+   guint32 counter;
+   guint i;
+
+   g_return_if_fail(object_ids != NULL || n_object_ids == 0);
+
+   if (!n_object_ids) {
+      return;
+   }
+
+   mongo_object_id_init_process();
+   g_get_current_time(&tv);
+   timestamp = GUINT32_TO_BE((guint32)tv.tv_sec);
+   counter = g_atomic_int_add(&gCounter, n_object_ids);
+
+   for (i = 0; i < n_object_ids; i++) {
+      mongo_object_id_fill(&object_ids[i], timestamp, counter + i);
+   }
+}
+
+/**
+ * mongo_object_id_new:
+ *
+ * Generates a new #MongoObjectId. See mongo_object_id_init().
+ *
+ * Returns: (transfer full): A #MongoObjectId that should be freed with
+ *   mongo_object_id_free().
+ */
 MongoObjectId *
-mongo_object_id_new_from_data (const guint8 *bytes)
+mongo_object_id_new (void)
 {
    MongoObjectId *object_id;
 
-   object_id = g_slice_new0(MongoObjectId);
+   object_id = g_slice_new(MongoObjectId);
+   mongo_object_id_init(object_id);
+
+   return object_id;
+}
+
+/*
+ * Two hex characters for every possible byte value, used to encode a byte
+ * with a single lookup.
+ */
+static const gchar gHexPairs[] =
+   "000102030405060708090a0b0c0d0e0f"
+   "101112131415161718191a1b1c1d1e1f"
+   "202122232425262728292a2b2c2d2e2f"
+   "303132333435363738393a3b3c3d3e3f"
+   "404142434445464748494a4b4c4d4e4f"
+   "505152535455565758595a5b5c5d5e5f"
+   "606162636465666768696a6b6c6d6e6f"
+   "707172737475767778797a7b7c7d7e7f"
+   "808182838485868788898a8b8c8d8e8f"
+   "909192939495969798999a9b9c9d9e9f"
+   "a0a1a2a3a4a5a6a7a8a9aaabacadaeaf"
+   "b0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+   "c0c1c2c3c4c5c6c7c8c9cacbcccdcecf"
+   "d0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+   "e0e1e2e3e4e5e6e7e8e9eaebecedeeef"
+   "f0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+/*
+ * The value of every hex character. Anything else, including the trailing
+ * nul byte of a short string, maps to 0x10.
+ */
+static const guint8 gHexValues[256] = {
+#define XX 0x10
+   XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+   XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+   XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9, XX, XX, XX, XX, XX, XX,
+   XX, 10, 11, 12, 13, 14, 15, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+   XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+   XX, 10, 11, 12, 13, 14, 15, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+   XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+   XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+   XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+   XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+   XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+   XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+   XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+   XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+   XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+#undef XX
+};
+
+/**
+ * mongo_object_id_init_from_data:
+ * @object_id: (out): A location for a #MongoObjectId.
+ * @bytes: (in) (allow-none): The 12 bytes of the ObjectId.
+ *
+ * Initializes @object_id from @bytes. If @bytes is %NULL, @object_id is
+ * zeroed. This allows a #MongoObjectId to be embedded within another
+ * structure instead of being allocated separately.
+ */
+void
+mongo_object_id_init_from_data (MongoObjectId *object_id,
+                                const guint8  *bytes)
+{
+   g_return_if_fail(object_id != NULL);
 
    if (bytes) {
       memcpy(object_id, bytes, sizeof *object_id);
+   } else {
+      memset(object_id, 0, sizeof *object_id);
+   }
+}
+
+/**
+ * mongo_object_id_init_from_string:
+ * @object_id: (out): A location for a #MongoObjectId.
+ * @string: (in): A 24 character hex encoded ObjectId.
+ *
+ * Initializes @object_id from the hex encoded @string. Both upper and lower
+ * case hex characters are accepted.
+ *
+ * Returns: %TRUE if @string was a valid ObjectId; otherwise %FALSE and
+ *   @object_id is left untouched.
+ */
+gboolean
+mongo_object_id_init_from_string (MongoObjectId *object_id,
+                                  const gchar   *string)
+{
+   const guint8 *str = (const guint8 *)string;
+   guint8 data[12];
+   guint8 hi;
+   guint8 lo;
+   guint i;
+
+   g_return_val_if_fail(object_id != NULL, FALSE);
+   g_return_val_if_fail(string != NULL, FALSE);
+
+   /*
+    * Decode a byte per iteration. Each character is checked before the
+    * next is read so that we never read past the end of a short string.
+    */
+   for (i = 0; i < 12; i++) {
+      if ((hi = gHexValues[str[i * 2]]) == 0x10) {
+         return FALSE;
+      }
+      if ((lo = gHexValues[str[i * 2 + 1]]) == 0x10) {
+         return FALSE;
+      }
+      data[i] = (hi << 4) | lo;
+   }
+
+   if (str[24]) {
+      return FALSE;
    }
 
+   memcpy(object_id->data, data, sizeof data);
+
+   return TRUE;
+}
+
+MongoObjectId *
+mongo_object_id_new_from_data (const guint8 *bytes)
+{
+   MongoObjectId *object_id;
+
+   object_id = g_slice_new(MongoObjectId);
+   mongo_object_id_init_from_data(object_id, bytes);
+
    return object_id;
 }
 
+/**
+ * mongo_object_id_new_from_string:
+ * @string: (in): A 24 character hex encoded ObjectId.
+ *
+ * Creates a new #MongoObjectId from the hex encoded @string.
+ *
+ * Returns: (transfer full): A #MongoObjectId if @string was valid;
+ *   otherwise %NULL.
+ */
+MongoObjectId *
+mongo_object_id_new_from_string (const gchar *string)
+{
+   MongoObjectId object_id;
+
+   g_return_val_if_fail(string != NULL, NULL);
+
+   if (mongo_object_id_init_from_string(&object_id, string)) {
+      return mongo_object_id_copy(&object_id);
+   }
+
+   return NULL;
+}
+
+/**
+ * mongo_object_id_to_string_r:
+ * @object_id: (in): A #MongoObjectId.
+ * @string: (out): A location for 25 characters.
+ *
+ * Hex encodes @object_id into @string, including a trailing nul byte.
+ * Unlike mongo_object_id_to_string(), this does not allocate memory.
+ */
+void
+mongo_object_id_to_string_r (const MongoObjectId *object_id,
+                             gchar                string[25])
+{
+   guint i;
+
+   g_return_if_fail(object_id != NULL);
+   g_return_if_fail(string != NULL);
+
+   for (i = 0; i < 12; i++) {
+      memcpy(&string[i * 2], &gHexPairs[object_id->data[i] * 2], 2);
+   }
+   string[24] = '\0';
+}
+
+/**
+ * mongo_object_id_to_string:
+ * @object_id: (in): A #MongoObjectId.
+ *
+ * Hex encodes @object_id.
+ *
+ * Returns: (transfer full): A newly allocated string that should be freed
+ *   with g_free().
+ */
+gchar *
+mongo_object_id_to_string (const MongoObjectId *object_id)
+{
+   gchar *string;
+
+   g_return_val_if_fail(object_id != NULL, NULL);
+
+   string = g_malloc(25);
+   mongo_object_id_to_string_r(object_id, string);
+
+   return string;
+}
+
+/**
+ * mongo_object_id_compare:
+ * @object_id: (in): A #MongoObjectId.
+ * @other: (in): A #MongoObjectId.
+ *
+ * Compares two ObjectIds byte by byte, which is the order used by
+ * MongoDB. Since the timestamp is stored first, this roughly sorts ids
+ * by their creation time.
+ *
+ * Returns: Less than zero, zero, or greater than zero if @object_id is
+ *   less than, equal to, or greater than @other.
+ */
+gint
+mongo_object_id_compare (const MongoObjectId *object_id,
+                         const MongoObjectId *other)
+{
+   g_return_val_if_fail(object_id != NULL, 0);
+   g_return_val_if_fail(other != NULL, 0);
+
+   return memcmp(object_id, other, sizeof *object_id);
+}
+
+/**
+ * mongo_object_id_equal:
+ * @v1: (in): A #MongoObjectId.
+ * @v2: (in): A #MongoObjectId.
+ *
+ * Checks if two ObjectIds are equal. This is a #GEqualFunc suitable for
+ * use with #GHashTable along with mongo_object_id_hash().
+ *
+ * Returns: %TRUE if @v1 and @v2 are equal.
+ */
+gboolean
+mongo_object_id_equal (gconstpointer v1,
+                       gconstpointer v2)
+{
+   return !memcmp(v1, v2, sizeof(MongoObjectId));
+}
+
+/**
+ * mongo_object_id_hash:
+ * @v: (in): A #MongoObjectId.
+ *
+ * Hashes an ObjectId. This is a #GHashFunc suitable for use with
+ * #GHashTable along with mongo_object_id_equal().
+ *
+ * Returns: A hash value for @v.
+ */
+guint
+mongo_object_id_hash (gconstpointer v)
+{
+   guint32 words[3];
+
+   memcpy(words, v, sizeof words);
+
+   /*
+    * The counter in the last word changes the most between ids, mix the
+    * timestamp and machine identifier into it.
+    */
+   return words[2] ^ (words[1] * 0x9E3779B1U) ^ (words[0] * 0x85EBCA77U);
+}
+
+/**
+ * mongo_object_id_get_timeval:
+ * @object_id: (in): A #MongoObjectId.
+ * @value: (out): A location for a #GTimeVal.
+ *
+ * Fetches the time at which @object_id was generated, which is stored
+ * with a precision of seconds.
+ */
+void
+mongo_object_id_get_timeval (const MongoObjectId *object_id,
+                             GTimeVal            *value)
+{
+   guint32 t;
+
+   g_return_if_fail(object_id != NULL);
+   g_return_if_fail(value != NULL);
+
+   memcpy(&t, object_id, sizeof t);
+   value->tv_sec = GUINT32_FROM_BE(t);
+   value->tv_usec = 0;
+}
+
+/**
+ * mongo_object_id_get_date_time:
+ * @object_id: (in): A #MongoObjectId.
+ *
+ * Fetches the time at which @object_id was generated as a #GDateTime.
+ *
+ * Returns: A new #GDateTime which should be freed with g_date_time_unref().
+ */
+GDateTime *
+mongo_object_id_get_date_time (const MongoObjectId *object_id)
+{
+   GTimeVal tv;
+
+   g_return_val_if_fail(object_id != NULL, NULL);
+
+   mongo_object_id_get_timeval(object_id, &tv);
+   return g_date_time_new_from_timeval_utc(&tv);
+}
+
 MongoObjectId *
 mongo_object_id_copy (const MongoObjectId *object_id)
 {
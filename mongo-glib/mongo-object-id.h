@@ -25,11 +25,42 @@ G_BEGIN_DECLS
 
 typedef struct _MongoObjectId MongoObjectId;
 
-MongoObjectId *mongo_object_id_new           (void);
-MongoObjectId *mongo_object_id_new_from_data (const guint8        *bytes);
-MongoObjectId *mongo_object_id_copy          (const MongoObjectId *object_id);
-void           mongo_object_id_free          (MongoObjectId       *object_id);
-GType          mongo_object_id_get_type      (void) G_GNUC_CONST;
+/**
+ * MongoObjectId:
+ *
+ * A 12-byte BSON ObjectId. The structure is public so that ids may be
+ * stored in contiguous arrays; the contents should be considered opaque.
+ */
+struct _MongoObjectId
+{
+   /*< private >*/
+   guint8 data[12];
+};
+
+MongoObjectId *mongo_object_id_new                (void);
+MongoObjectId *mongo_object_id_new_from_data      (const guint8        *bytes);
+MongoObjectId *mongo_object_id_new_from_string    (const gchar         *string);
+MongoObjectId *mongo_object_id_copy               (const MongoObjectId *object_id);
+gint           mongo_object_id_compare            (const MongoObjectId *object_id,
+                                                   const MongoObjectId *other);
+gboolean       mongo_object_id_equal              (gconstpointer        v1,
+                                                   gconstpointer        v2);
+void           mongo_object_id_free               (MongoObjectId       *object_id);
+GDateTime     *mongo_object_id_get_date_time      (const MongoObjectId *object_id);
+void           mongo_object_id_get_timeval        (const MongoObjectId *object_id,
+                                                   GTimeVal            *value);
+GType          mongo_object_id_get_type           (void) G_GNUC_CONST;
+guint          mongo_object_id_hash               (gconstpointer        v);
+void           mongo_object_id_init               (MongoObjectId       *object_id);
+void           mongo_object_id_init_array         (MongoObjectId       *object_ids,
+                                                   guint                n_object_ids);
+void           mongo_object_id_init_from_data     (MongoObjectId       *object_id,
+                                                   const guint8        *bytes);
+gboolean       mongo_object_id_init_from_string   (MongoObjectId       *object_id,
+                                                   const gchar         *string);
+gchar         *mongo_object_id_to_string          (const MongoObjectId *object_id);
+void           mongo_object_id_to_string_r        (const MongoObjectId *object_id,
+                                                   gchar                string[25]);
 
 G_END_DECLS
 
@@ -0,0 +1,909 @@
+/* mongo-oplog-reader.c
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib/gi18n.h>
+
+#include "mongo-cursor.h"
+#include "mongo-oplog-reader.h"
+
+#define DEFAULT_COLLECTION      "local.oplog.rs"
+#define DEFAULT_MAX_BATCH_DELAY 100
+#define DEFAULT_MAX_BATCH_SIZE  1000
+
+G_DEFINE_TYPE(MongoOplogReader, mongo_oplog_reader, G_TYPE_OBJECT)
+
+struct _MongoOplogReaderPrivate
+{
+   MongoClient         *client;
+   MongoBson           *query;
+   gchar               *checkpoint_file;
+   guint64              checkpoint;
+   guint                max_batch_delay;
+   guint                max_batch_size;
+
+   MongoOplogApplyFunc  apply;
+   gpointer             apply_data;
+   GDestroyNotify       apply_notify;
+
+   GSimpleAsyncResult  *simple;
+   MongoCursor         *cursor;
+   GCancellable        *cancellable;
+   GCancellable        *user_cancellable;
+   gulong               cancelled_handler;
+   GPtrArray           *pending;
+   GMainContext        *context;
+   GSource             *flush;
+   GError              *error;
+};
+
+enum
+{
+   PROP_0,
+   PROP_CHECKPOINT,
+   PROP_CHECKPOINT_FILE,
+   PROP_CLIENT,
+   PROP_MAX_BATCH_DELAY,
+   PROP_MAX_BATCH_SIZE,
+   PROP_QUERY,
+   LAST_PROP
+};
+
+static GParamSpec *gParamSpecs[LAST_PROP];
+
+/**
+ * mongo_oplog_reader_new:
+ * @client: (in): A connected #MongoClient.
+ *
+ * Creates a new #MongoOplogReader that tails the oplog of @client. Set the
+ * apply function with mongo_oplog_reader_set_apply_func() before running
+ * the reader.
+ *
+ * Returns: (transfer full): A new #MongoOplogReader.
+ */
+MongoOplogReader *
+mongo_oplog_reader_new (MongoClient *client)
+{
+   g_return_val_if_fail(MONGO_IS_CLIENT(client), NULL);
+
+   return g_object_new(MONGO_TYPE_OPLOG_READER,
+                       "client", client,
+                       NULL);
+}
+
+/**
+ * mongo_oplog_reader_set_apply_func:
+ * @reader: (in): A #MongoOplogReader.
+ * @func: (in) (scope notified): A #MongoOplogApplyFunc.
+ * @user_data: (in): User data for @func.
+ * @notify: (in) (allow-none): A #GDestroyNotify for @user_data, or %NULL.
+ *
+ * Sets the function that applies each batch of oplog entries.
+ */
+void
+mongo_oplog_reader_set_apply_func (MongoOplogReader    *reader,
+                                   MongoOplogApplyFunc  func,
+                                   gpointer             user_data,
+                                   GDestroyNotify       notify)
+{
+   MongoOplogReaderPrivate *priv;
+
+   g_return_if_fail(MONGO_IS_OPLOG_READER(reader));
+
+   priv = reader->priv;
+
+   if (priv->apply_notify) {
+      priv->apply_notify(priv->apply_data);
+   }
+
+   priv->apply = func;
+   priv->apply_data = user_data;
+   priv->apply_notify = notify;
+}
+
+/**
+ * mongo_oplog_reader_get_checkpoint:
+ * @reader: (in): A #MongoOplogReader.
+ *
+ * Fetches the timestamp of the last entry that was applied. The seconds
+ * are in the high 32 bits and the increment in the low 32 bits.
+ *
+ * Returns: A timestamp, or 0 if nothing has been applied.
+ */
+guint64
+mongo_oplog_reader_get_checkpoint (MongoOplogReader *reader)
+{
+   g_return_val_if_fail(MONGO_IS_OPLOG_READER(reader), 0);
+   return reader->priv->checkpoint;
+}
+
+/**
+ * mongo_oplog_reader_set_checkpoint:
+ * @reader: (in): A #MongoOplogReader.
+ * @checkpoint: (in): A timestamp, or 0 to read the whole oplog.
+ *
+ * Sets the timestamp to resume after when the reader is run. If a
+ * checkpoint file exists, its timestamp is used instead.
+ */
+void
+mongo_oplog_reader_set_checkpoint (MongoOplogReader *reader,
+                                   guint64           checkpoint)
+{
+   g_return_if_fail(MONGO_IS_OPLOG_READER(reader));
+
+   reader->priv->checkpoint = checkpoint;
+   g_object_notify_by_pspec(G_OBJECT(reader), gParamSpecs[PROP_CHECKPOINT]);
+}
+
+/**
+ * mongo_oplog_reader_get_checkpoint_file:
+ * @reader: (in): A #MongoOplogReader.
+ *
+ * Fetches the file the checkpoint is persisted to.
+ *
+ * Returns: A filename, or %NULL.
+ */
+const gchar *
+mongo_oplog_reader_get_checkpoint_file (MongoOplogReader *reader)
+{
+   g_return_val_if_fail(MONGO_IS_OPLOG_READER(reader), NULL);
+   return reader->priv->checkpoint_file;
+}
+
+/**
+ * mongo_oplog_reader_set_checkpoint_file:
+ * @reader: (in): A #MongoOplogReader.
+ * @checkpoint_file: (in) (allow-none): A filename, or %NULL.
+ *
+ * Sets the file the checkpoint is persisted to. The checkpoint is read
+ * from the file when the reader is run, and the file is replaced
+ * atomically after each batch is applied, so a restarted process resumes
+ * where it left off. The file contains a single BSON document of the form
+ * {"ts": Timestamp}.
+ */
+void
+mongo_oplog_reader_set_checkpoint_file (MongoOplogReader *reader,
+                                        const gchar      *checkpoint_file)
+{
+   g_return_if_fail(MONGO_IS_OPLOG_READER(reader));
+
+   g_free(reader->priv->checkpoint_file);
+   reader->priv->checkpoint_file = g_strdup(checkpoint_file);
+   g_object_notify_by_pspec(G_OBJECT(reader),
+                            gParamSpecs[PROP_CHECKPOINT_FILE]);
+}
+
+/**
+ * mongo_oplog_reader_get_max_batch_delay:
+ * @reader: (in): A #MongoOplogReader.
+ *
+ * Fetches how long an entry may wait for its batch to fill up.
+ *
+ * Returns: The delay in milliseconds.
+ */
+guint
+mongo_oplog_reader_get_max_batch_delay (MongoOplogReader *reader)
+{
+   g_return_val_if_fail(MONGO_IS_OPLOG_READER(reader), 0);
+   return reader->priv->max_batch_delay;
+}
+
+/**
+ * mongo_oplog_reader_set_max_batch_delay:
+ * @reader: (in): A #MongoOplogReader.
+ * @max_batch_delay: (in): The delay in milliseconds.
+ *
+ * Sets how long an entry may wait for its batch to fill up before the
+ * batch is applied anyway. With 0, entries are applied as soon as they
+ * are received.
+ */
+void
+mongo_oplog_reader_set_max_batch_delay (MongoOplogReader *reader,
+                                        guint             max_batch_delay)
+{
+   g_return_if_fail(MONGO_IS_OPLOG_READER(reader));
+
+   reader->priv->max_batch_delay = max_batch_delay;
+   g_object_notify_by_pspec(G_OBJECT(reader),
+                            gParamSpecs[PROP_MAX_BATCH_DELAY]);
+}
+
+/**
+ * mongo_oplog_reader_get_max_batch_size:
+ * @reader: (in): A #MongoOplogReader.
+ *
+ * Fetches the largest number of entries applied at once.
+ *
+ * Returns: The number of entries.
+ */
+guint
+mongo_oplog_reader_get_max_batch_size (MongoOplogReader *reader)
+{
+   g_return_val_if_fail(MONGO_IS_OPLOG_READER(reader), 0);
+   return reader->priv->max_batch_size;
+}
+
+/**
+ * mongo_oplog_reader_set_max_batch_size:
+ * @reader: (in): A #MongoOplogReader.
+ * @max_batch_size: (in): The number of entries.
+ *
+ * Sets the largest number of entries applied at once. A batch is applied
+ * as soon as it is full.
+ */
+void
+mongo_oplog_reader_set_max_batch_size (MongoOplogReader *reader,
+                                       guint             max_batch_size)
+{
+   g_return_if_fail(MONGO_IS_OPLOG_READER(reader));
+   g_return_if_fail(max_batch_size > 0);
+
+   reader->priv->max_batch_size = max_batch_size;
+   g_object_notify_by_pspec(G_OBJECT(reader),
+                            gParamSpecs[PROP_MAX_BATCH_SIZE]);
+}
+
+/**
+ * mongo_oplog_reader_get_query:
+ * @reader: (in): A #MongoOplogReader.
+ *
+ * Fetches the query that selects the entries to read.
+ *
+ * Returns: (transfer none): A #MongoBson, or %NULL.
+ */
+MongoBson *
+mongo_oplog_reader_get_query (MongoOplogReader *reader)
+{
+   g_return_val_if_fail(MONGO_IS_OPLOG_READER(reader), NULL);
+   return reader->priv->query;
+}
+
+/**
+ * mongo_oplog_reader_set_query:
+ * @reader: (in): A #MongoOplogReader.
+ * @query: (in) (allow-none): A #MongoBson, or %NULL for all entries.
+ *
+ * Sets a query to select the entries to read, such as {"ns": "db.things"}.
+ * The "ts" field of the query is replaced with the checkpoint.
+ */
+void
+mongo_oplog_reader_set_query (MongoOplogReader *reader,
+                              MongoBson        *query)
+{
+   MongoOplogReaderPrivate *priv;
+
+   g_return_if_fail(MONGO_IS_OPLOG_READER(reader));
+
+   priv = reader->priv;
+
+   if (priv->query) {
+      mongo_bson_unref(priv->query);
+   }
+   priv->query = query ? mongo_bson_ref(query) : NULL;
+   g_object_notify_by_pspec(G_OBJECT(reader), gParamSpecs[PROP_QUERY]);
+}
+
+static gboolean
+mongo_oplog_reader_load_checkpoint (MongoOplogReader  *reader,
+                                    GError           **error)
+{
+   MongoOplogReaderPrivate *priv = reader->priv;
+   MongoBsonRawIter iter;
+   gboolean ret = FALSE;
+   GError *local_error = NULL;
+   gchar *contents;
+   gsize length;
+
+   if (!g_file_get_contents(priv->checkpoint_file,
+                            &contents,
+                            &length,
+                            &local_error)) {
+      if (g_error_matches(local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+         g_error_free(local_error);
+         return TRUE;
+      }
+      g_propagate_error(error, local_error);
+      return FALSE;
+   }
+
+   if (mongo_bson_raw_iter_init_from_data(&iter,
+                                          (const guint8 *)contents,
+                                          length) &&
+       mongo_bson_raw_iter_find(&iter, "ts") &&
+       (mongo_bson_raw_iter_get_value_type(&iter) == MONGO_BSON_TIMESTAMP)) {
+      mongo_oplog_reader_set_checkpoint(
+            reader, mongo_bson_raw_iter_get_value_timestamp(&iter,
+                                                            NULL,
+                                                            NULL));
+      ret = TRUE;
+   } else {
+      g_set_error(error, MONGO_OPLOG_READER_ERROR,
+                  MONGO_OPLOG_READER_ERROR_INVALID_CHECKPOINT,
+                  _("The checkpoint file \"%s\" is invalid."),
+                  priv->checkpoint_file);
+   }
+
+   g_free(contents);
+
+   return ret;
+}
+
+static gboolean
+mongo_oplog_reader_save_checkpoint (MongoOplogReader  *reader,
+                                    GError           **error)
+{
+   MongoOplogReaderPrivate *priv = reader->priv;
+   const guint8 *data;
+   MongoBson *bson;
+   gboolean ret;
+   gsize length;
+
+   bson = mongo_bson_new();
+   mongo_bson_append_timestamp(bson, "ts",
+                               (guint32)(priv->checkpoint >> 32),
+                               (guint32)priv->checkpoint);
+   data = mongo_bson_get_data(bson, &length);
+   ret = g_file_set_contents(priv->checkpoint_file,
+                             (const gchar *)data,
+                             length,
+                             error);
+   mongo_bson_unref(bson);
+
+   return ret;
+}
+
+static void
+mongo_oplog_reader_fail (MongoOplogReader *reader,
+                         GError           *error)
+{
+   MongoOplogReaderPrivate *priv = reader->priv;
+
+   if (!priv->error) {
+      priv->error = error;
+      g_cancellable_cancel(priv->cancellable);
+   } else {
+      g_error_free(error);
+   }
+}
+
+/*
+ * Applies the oldest pending entries, at most one batch, and advances the
+ * checkpoint past them.
+ */
+static gboolean
+mongo_oplog_reader_apply (MongoOplogReader *reader)
+{
+   MongoOplogReaderPrivate *priv = reader->priv;
+   MongoBsonRawIter iter;
+   GError *error = NULL;
+   guint64 checkpoint = 0;
+   guint n_entries;
+   guint i;
+
+   n_entries = MIN(priv->pending->len, priv->max_batch_size);
+
+   if (!priv->apply(reader,
+                    (MongoBson **)priv->pending->pdata,
+                    n_entries,
+                    priv->apply_data,
+                    &error)) {
+      g_ptr_array_set_size(priv->pending, 0);
+      mongo_oplog_reader_fail(reader, error);
+      return FALSE;
+   }
+
+   for (i = n_entries; !checkpoint && i > 0; i--) {
+      mongo_bson_raw_iter_init(&iter, g_ptr_array_index(priv->pending, i - 1));
+      if (mongo_bson_raw_iter_find(&iter, "ts")) {
+         checkpoint = mongo_bson_raw_iter_get_value_timestamp(&iter,
+                                                              NULL,
+                                                              NULL);
+      }
+   }
+
+   g_ptr_array_remove_range(priv->pending, 0, n_entries);
+
+   if (checkpoint) {
+      mongo_oplog_reader_set_checkpoint(reader, checkpoint);
+      if (priv->checkpoint_file &&
+          !mongo_oplog_reader_save_checkpoint(reader, &error)) {
+         g_ptr_array_set_size(priv->pending, 0);
+         mongo_oplog_reader_fail(reader, error);
+         return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+static void
+mongo_oplog_reader_cancel_flush (MongoOplogReader *reader)
+{
+   MongoOplogReaderPrivate *priv = reader->priv;
+
+   if (priv->flush) {
+      g_source_destroy(priv->flush);
+      g_source_unref(priv->flush);
+      priv->flush = NULL;
+   }
+}
+
+static gboolean
+mongo_oplog_reader_flush_cb (gpointer data)
+{
+   MongoOplogReader *reader = data;
+   MongoOplogReaderPrivate *priv;
+
+   g_return_val_if_fail(MONGO_IS_OPLOG_READER(reader), FALSE);
+
+   priv = reader->priv;
+   mongo_oplog_reader_cancel_flush(reader);
+
+   while (priv->pending->len) {
+      if (!mongo_oplog_reader_apply(reader)) {
+         break;
+      }
+   }
+
+   return FALSE;
+}
+
+static void
+mongo_oplog_reader_batch_cb (MongoCursor *cursor,
+                             MongoReply  *reply,
+                             gpointer     user_data)
+{
+   MongoOplogReader *reader = user_data;
+   MongoOplogReaderPrivate *priv;
+   guint i;
+
+   g_return_if_fail(MONGO_IS_OPLOG_READER(reader));
+
+   priv = reader->priv;
+
+   if (priv->error) {
+      return;
+   }
+
+   for (i = 0; i < reply->n_documents; i++) {
+      g_ptr_array_add(priv->pending, mongo_bson_ref(reply->documents[i]));
+   }
+
+   /*
+    * Apply full batches right away. The rest waits for more entries until
+    * the oldest of them has waited max_batch_delay.
+    */
+   while (priv->pending->len >= priv->max_batch_size) {
+      if (!mongo_oplog_reader_apply(reader)) {
+         break;
+      }
+   }
+
+   if (!priv->pending->len) {
+      mongo_oplog_reader_cancel_flush(reader);
+   } else if (!priv->max_batch_delay) {
+      mongo_oplog_reader_flush_cb(reader);
+   } else if (!priv->flush) {
+      priv->flush = g_timeout_source_new(priv->max_batch_delay);
+      g_source_set_callback(priv->flush,
+                            mongo_oplog_reader_flush_cb,
+                            g_object_ref(reader),
+                            g_object_unref);
+      g_source_attach(priv->flush, priv->context);
+   }
+}
+
+static void
+mongo_oplog_reader_cancelled_cb (GCancellable *cancellable,
+                                 gpointer      user_data)
+{
+   g_cancellable_cancel(user_data);
+}
+
+static void
+mongo_oplog_reader_complete (MongoOplogReader *reader,
+                             GError           *error)
+{
+   MongoOplogReaderPrivate *priv = reader->priv;
+   GSimpleAsyncResult *simple = priv->simple;
+
+   priv->simple = NULL;
+
+   mongo_oplog_reader_cancel_flush(reader);
+   g_main_context_unref(priv->context);
+   priv->context = NULL;
+   if (priv->user_cancellable) {
+      g_cancellable_disconnect(priv->user_cancellable,
+                               priv->cancelled_handler);
+      priv->cancelled_handler = 0;
+      g_clear_object(&priv->user_cancellable);
+   }
+   g_clear_object(&priv->cancellable);
+   g_clear_object(&priv->cursor);
+   g_ptr_array_set_size(priv->pending, 0);
+
+   /*
+    * A failure to apply or save a batch takes precedence over the
+    * cancellation it caused.
+    */
+   if (priv->error) {
+      g_clear_error(&error);
+      error = priv->error;
+      priv->error = NULL;
+   }
+
+   if (error) {
+      g_simple_async_result_take_error(simple, error);
+   } else {
+      g_simple_async_result_set_op_res_gboolean(simple, TRUE);
+   }
+   g_simple_async_result_complete_in_idle(simple);
+   g_object_unref(simple);
+}
+
+static void
+mongo_oplog_reader_run_cb (GObject      *object,
+                           GAsyncResult *result,
+                           gpointer      user_data)
+{
+   MongoOplogReader *reader = user_data;
+   GError *error = NULL;
+
+   g_return_if_fail(MONGO_IS_OPLOG_READER(reader));
+
+   mongo_cursor_run_finish(MONGO_CURSOR(object), result, &error);
+   mongo_oplog_reader_complete(reader, error);
+   g_object_unref(reader);
+}
+
+/**
+ * mongo_oplog_reader_run_async:
+ * @reader: (in): A #MongoOplogReader.
+ * @cancellable: (in) (allow-none): A #GCancellable, or %NULL.
+ * @callback: (in): A callback to execute upon completion.
+ * @user_data: (in): User data for @callback.
+ *
+ * Tails the oplog from the checkpoint, applying the entries in batches
+ * with the apply function and advancing the checkpoint after each batch.
+ *
+ * The reader runs until @cancellable is cancelled or an error occurs,
+ * including a failure of the apply function. Entries that were received
+ * but not yet applied are dropped, and are read again when the reader is
+ * run from the checkpoint.
+ */
+void
+mongo_oplog_reader_run_async (MongoOplogReader    *reader,
+                              GCancellable        *cancellable,
+                              GAsyncReadyCallback  callback,
+                              gpointer             user_data)
+{
+   MongoOplogReaderPrivate *priv;
+   MongoBsonIter iter;
+   MongoBson *query;
+   MongoBson *gte;
+   GError *error = NULL;
+
+   g_return_if_fail(MONGO_IS_OPLOG_READER(reader));
+   g_return_if_fail(!cancellable || G_IS_CANCELLABLE(cancellable));
+   g_return_if_fail(callback != NULL);
+
+   priv = reader->priv;
+
+   g_return_if_fail(priv->apply != NULL);
+
+   if (priv->simple) {
+      g_warning("Cannot run oplog reader, it is already running.");
+      return;
+   }
+
+   priv->simple = g_simple_async_result_new(G_OBJECT(reader),
+                                            callback,
+                                            user_data,
+                                            mongo_oplog_reader_run_async);
+
+   /*
+    * The flush timer runs on the context the reader was started from.
+    */
+   priv->context = g_main_context_ref_thread_default();
+
+   if (priv->checkpoint_file &&
+       !mongo_oplog_reader_load_checkpoint(reader, &error)) {
+      mongo_oplog_reader_complete(reader, error);
+      return;
+   }
+
+   /*
+    * OplogReplay requires a condition on "ts". When resuming, the cursor
+    * replaces it with the checkpoint.
+    */
+   query = priv->query ? mongo_bson_dup(priv->query) : mongo_bson_new();
+   mongo_bson_iter_init(&iter, query);
+   if (!mongo_bson_iter_find(&iter, "ts")) {
+      gte = mongo_bson_new();
+      mongo_bson_append_timestamp(gte, "$gte", 0, 0);
+      mongo_bson_append_bson(query, "ts", gte);
+      mongo_bson_unref(gte);
+   }
+
+   priv->cursor = mongo_cursor_new(priv->client,
+                                   DEFAULT_COLLECTION,
+                                   query,
+                                   NULL,
+                                   (MONGO_QUERY_TAILABLE_CURSOR |
+                                    MONGO_QUERY_AWAIT_DATA |
+                                    MONGO_QUERY_OPLOG_REPLAY));
+   mongo_cursor_set_resume_from(priv->cursor, priv->checkpoint);
+   g_signal_connect(priv->cursor, "batch",
+                    G_CALLBACK(mongo_oplog_reader_batch_cb), reader);
+   mongo_bson_unref(query);
+
+   priv->cancellable = g_cancellable_new();
+   if (cancellable) {
+      priv->user_cancellable = g_object_ref(cancellable);
+      priv->cancelled_handler =
+         g_cancellable_connect(cancellable,
+                               G_CALLBACK(mongo_oplog_reader_cancelled_cb),
+                               priv->cancellable,
+                               NULL);
+   }
+
+   mongo_cursor_run_async(priv->cursor,
+                          priv->cancellable,
+                          mongo_oplog_reader_run_cb,
+                          g_object_ref(reader));
+}
+
+/**
+ * mongo_oplog_reader_run_finish:
+ * @reader: (in): A #MongoOplogReader.
+ * @result: (in): A #GAsyncResult.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Completes an asynchronous request to mongo_oplog_reader_run_async().
+ * Since the reader only stops on error or cancellation, this always
+ * returns %FALSE with @error set.
+ *
+ * Returns: %FALSE and @error is set.
+ */
+gboolean
+mongo_oplog_reader_run_finish (MongoOplogReader  *reader,
+                               GAsyncResult      *result,
+                               GError           **error)
+{
+   GSimpleAsyncResult *simple = (GSimpleAsyncResult *)result;
+
+   g_return_val_if_fail(MONGO_IS_OPLOG_READER(reader), FALSE);
+   g_return_val_if_fail(G_IS_SIMPLE_ASYNC_RESULT(simple), FALSE);
+
+   if (g_simple_async_result_propagate_error(simple, error)) {
+      return FALSE;
+   }
+
+   return g_simple_async_result_get_op_res_gboolean(simple);
+}
+
+/**
+ * mongo_oplog_reader_finalize:
+ * @object: (in): A #MongoOplogReader.
+ *
+ * Finalizer for a #MongoOplogReader instance. Frees any resources held by
+ * the instance.
+ */
+static void
+mongo_oplog_reader_finalize (GObject *object)
+{
+   MongoOplogReaderPrivate *priv = MONGO_OPLOG_READER(object)->priv;
+
+   if (priv->apply_notify) {
+      priv->apply_notify(priv->apply_data);
+   }
+   g_clear_object(&priv->client);
+   if (priv->query) {
+      mongo_bson_unref(priv->query);
+   }
+   g_free(priv->checkpoint_file);
+   g_ptr_array_unref(priv->pending);
+
+   G_OBJECT_CLASS(mongo_oplog_reader_parent_class)->finalize(object);
+}
+
+/**
+ * mongo_oplog_reader_get_property:
+ * @object: (in): A #GObject.
+ * @prop_id: (in): The property identifier.
+ * @value: (out): The given property.
+ * @pspec: (in): A #ParamSpec.
+ *
+ * Get a given #GObject property.
+ */
+static void
+mongo_oplog_reader_get_property (GObject    *object,
+                                 guint       prop_id,
+                                 GValue     *value,
+                                 GParamSpec *pspec)
+{
+   MongoOplogReader *reader = MONGO_OPLOG_READER(object);
+
+   switch (prop_id) {
+   case PROP_CHECKPOINT:
+      g_value_set_uint64(value, mongo_oplog_reader_get_checkpoint(reader));
+      break;
+   case PROP_CHECKPOINT_FILE:
+      g_value_set_string(value,
+                         mongo_oplog_reader_get_checkpoint_file(reader));
+      break;
+   case PROP_CLIENT:
+      g_value_set_object(value, reader->priv->client);
+      break;
+   case PROP_MAX_BATCH_DELAY:
+      g_value_set_uint(value, mongo_oplog_reader_get_max_batch_delay(reader));
+      break;
+   case PROP_MAX_BATCH_SIZE:
+      g_value_set_uint(value, mongo_oplog_reader_get_max_batch_size(reader));
+      break;
+   case PROP_QUERY:
+      g_value_set_boxed(value, mongo_oplog_reader_get_query(reader));
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+/**
+ * mongo_oplog_reader_set_property:
+ * @object: (in): A #GObject.
+ * @prop_id: (in): The property identifier.
+ * @value: (in): The given property.
+ * @pspec: (in): A #ParamSpec.
+ *
+ * Set a given #GObject property.
+ */
+static void
+mongo_oplog_reader_set_property (GObject      *object,
+                                 guint         prop_id,
+                                 const GValue *value,
+                                 GParamSpec   *pspec)
+{
+   MongoOplogReader *reader = MONGO_OPLOG_READER(object);
+
+   switch (prop_id) {
+   case PROP_CHECKPOINT:
+      mongo_oplog_reader_set_checkpoint(reader, g_value_get_uint64(value));
+      break;
+   case PROP_CHECKPOINT_FILE:
+      mongo_oplog_reader_set_checkpoint_file(reader,
+                                             g_value_get_string(value));
+      break;
+   case PROP_CLIENT:
+      reader->priv->client = g_value_dup_object(value);
+      break;
+   case PROP_MAX_BATCH_DELAY:
+      mongo_oplog_reader_set_max_batch_delay(reader, g_value_get_uint(value));
+      break;
+   case PROP_MAX_BATCH_SIZE:
+      mongo_oplog_reader_set_max_batch_size(reader, g_value_get_uint(value));
+      break;
+   case PROP_QUERY:
+      mongo_oplog_reader_set_query(reader, g_value_get_boxed(value));
+      break;
+   default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+   }
+}
+
+/**
+ * mongo_oplog_reader_class_init:
+ * @klass: (in): A #MongoOplogReaderClass.
+ *
+ * Initializes the #MongoOplogReaderClass and prepares the vtable.
+ */
+static void
+mongo_oplog_reader_class_init (MongoOplogReaderClass *klass)
+{
+   GObjectClass *object_class;
+
+   object_class = G_OBJECT_CLASS(klass);
+   object_class->finalize = mongo_oplog_reader_finalize;
+   object_class->get_property = mongo_oplog_reader_get_property;
+   object_class->set_property = mongo_oplog_reader_set_property;
+   g_type_class_add_private(object_class, sizeof(MongoOplogReaderPrivate));
+
+   gParamSpecs[PROP_CHECKPOINT] =
+      g_param_spec_uint64("checkpoint",
+                          _("Checkpoint"),
+                          _("The timestamp of the last applied entry."),
+                          0,
+                          G_MAXUINT64,
+                          0,
+                          G_PARAM_READWRITE);
+   g_object_class_install_property(object_class, PROP_CHECKPOINT,
+                                   gParamSpecs[PROP_CHECKPOINT]);
+
+   gParamSpecs[PROP_CHECKPOINT_FILE] =
+      g_param_spec_string("checkpoint-file",
+                          _("Checkpoint File"),
+                          _("The file the checkpoint is persisted to."),
+                          NULL,
+                          G_PARAM_READWRITE);
+   g_object_class_install_property(object_class, PROP_CHECKPOINT_FILE,
+                                   gParamSpecs[PROP_CHECKPOINT_FILE]);
+
+   gParamSpecs[PROP_CLIENT] =
+      g_param_spec_object("client",
+                          _("Client"),
+                          _("The client to read the oplog from."),
+                          MONGO_TYPE_CLIENT,
+                          G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+   g_object_class_install_property(object_class, PROP_CLIENT,
+                                   gParamSpecs[PROP_CLIENT]);
+
+   gParamSpecs[PROP_MAX_BATCH_DELAY] =
+      g_param_spec_uint("max-batch-delay",
+                        _("Max Batch Delay"),
+                        _("How long an entry may wait for its batch in "
+                          "milliseconds."),
+                        0,
+                        G_MAXUINT,
+                        DEFAULT_MAX_BATCH_DELAY,
+                        G_PARAM_READWRITE);
+   g_object_class_install_property(object_class, PROP_MAX_BATCH_DELAY,
+                                   gParamSpecs[PROP_MAX_BATCH_DELAY]);
+
+   gParamSpecs[PROP_MAX_BATCH_SIZE] =
+      g_param_spec_uint("max-batch-size",
+                        _("Max Batch Size"),
+                        _("The largest number of entries applied at once."),
+                        1,
+                        G_MAXUINT,
+                        DEFAULT_MAX_BATCH_SIZE,
+                        G_PARAM_READWRITE);
+   g_object_class_install_property(object_class, PROP_MAX_BATCH_SIZE,
+                                   gParamSpecs[PROP_MAX_BATCH_SIZE]);
+
+   gParamSpecs[PROP_QUERY] =
+      g_param_spec_boxed("query",
+                         _("Query"),
+                         _("The query that selects the entries to read."),
+                         MONGO_TYPE_BSON,
+                         G_PARAM_READWRITE);
+   g_object_class_install_property(object_class, PROP_QUERY,
+                                   gParamSpecs[PROP_QUERY]);
+}
+
+/**
+ * mongo_oplog_reader_init:
+ * @reader: (in): A #MongoOplogReader.
+ *
+ * Initializes the newly created #MongoOplogReader instance.
+ */
+static void
+mongo_oplog_reader_init (MongoOplogReader *reader)
+{
+   reader->priv = G_TYPE_INSTANCE_GET_PRIVATE(reader,
+                                              MONGO_TYPE_OPLOG_READER,
+                                              MongoOplogReaderPrivate);
+   reader->priv->max_batch_delay = DEFAULT_MAX_BATCH_DELAY;
+   reader->priv->max_batch_size = DEFAULT_MAX_BATCH_SIZE;
+   reader->priv->pending =
+      g_ptr_array_new_with_free_func((GDestroyNotify)mongo_bson_unref);
+}
+
+GQuark
+mongo_oplog_reader_error_quark (void)
+{
+   return g_quark_from_static_string("mongo_oplog_reader_error_quark");
+}
@@ -0,0 +1,113 @@
+/* mongo-oplog-reader.h
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MONGO_OPLOG_READER_H
+#define MONGO_OPLOG_READER_H
+
+#include <gio/gio.h>
+
+#include "mongo-bson.h"
+#include "mongo-client.h"
+
+G_BEGIN_DECLS
+
+#define MONGO_TYPE_OPLOG_READER            (mongo_oplog_reader_get_type())
+#define MONGO_OPLOG_READER(obj)            (G_TYPE_CHECK_INSTANCE_CAST ((obj), MONGO_TYPE_OPLOG_READER, MongoOplogReader))
+#define MONGO_OPLOG_READER_CONST(obj)      (G_TYPE_CHECK_INSTANCE_CAST ((obj), MONGO_TYPE_OPLOG_READER, MongoOplogReader const))
+#define MONGO_OPLOG_READER_CLASS(klass)    (G_TYPE_CHECK_CLASS_CAST ((klass),  MONGO_TYPE_OPLOG_READER, MongoOplogReaderClass))
+#define MONGO_IS_OPLOG_READER(obj)         (G_TYPE_CHECK_INSTANCE_TYPE ((obj), MONGO_TYPE_OPLOG_READER))
+#define MONGO_IS_OPLOG_READER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass),  MONGO_TYPE_OPLOG_READER))
+#define MONGO_OPLOG_READER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj),  MONGO_TYPE_OPLOG_READER, MongoOplogReaderClass))
+#define MONGO_OPLOG_READER_ERROR           (mongo_oplog_reader_error_quark())
+
+typedef struct _MongoOplogReader        MongoOplogReader;
+typedef struct _MongoOplogReaderClass   MongoOplogReaderClass;
+typedef struct _MongoOplogReaderPrivate MongoOplogReaderPrivate;
+typedef enum   _MongoOplogReaderError   MongoOplogReaderError;
+
+/**
+ * MongoOplogApplyFunc:
+ * @reader: (in): A #MongoOplogReader.
+ * @entries: (in) (array length=n_entries): The oplog entries, oldest first.
+ * @n_entries: (in): The number of entries in @entries.
+ * @user_data: (in): User data provided to mongo_oplog_reader_set_apply_func().
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Callback to apply a batch of oplog entries. The checkpoint is advanced
+ * past the batch only if it returns %TRUE.
+ *
+ * Returns: %TRUE if the batch was applied; otherwise %FALSE and @error is
+ *   set, which stops the reader.
+ */
+typedef gboolean (*MongoOplogApplyFunc) (MongoOplogReader  *reader,
+                                         MongoBson        **entries,
+                                         guint              n_entries,
+                                         gpointer           user_data,
+                                         GError           **error);
+
+enum _MongoOplogReaderError
+{
+   MONGO_OPLOG_READER_ERROR_INVALID_CHECKPOINT = 1,
+};
+
+struct _MongoOplogReader
+{
+   GObject parent;
+
+   /*< private >*/
+   MongoOplogReaderPrivate *priv;
+};
+
+struct _MongoOplogReaderClass
+{
+   GObjectClass parent_class;
+};
+
+GQuark            mongo_oplog_reader_error_quark          (void) G_GNUC_CONST;
+guint64           mongo_oplog_reader_get_checkpoint       (MongoOplogReader     *reader);
+const gchar      *mongo_oplog_reader_get_checkpoint_file  (MongoOplogReader     *reader);
+guint             mongo_oplog_reader_get_max_batch_delay  (MongoOplogReader     *reader);
+guint             mongo_oplog_reader_get_max_batch_size   (MongoOplogReader     *reader);
+MongoBson        *mongo_oplog_reader_get_query            (MongoOplogReader     *reader);
+GType             mongo_oplog_reader_get_type             (void) G_GNUC_CONST;
+MongoOplogReader *mongo_oplog_reader_new                  (MongoClient          *client);
+void              mongo_oplog_reader_run_async            (MongoOplogReader     *reader,
+                                                           GCancellable         *cancellable,
+                                                           GAsyncReadyCallback   callback,
+                                                           gpointer              user_data);
+gboolean          mongo_oplog_reader_run_finish           (MongoOplogReader     *reader,
+                                                           GAsyncResult         *result,
+                                                           GError              **error);
+void              mongo_oplog_reader_set_apply_func       (MongoOplogReader     *reader,
+                                                           MongoOplogApplyFunc   func,
+                                                           gpointer              user_data,
+                                                           GDestroyNotify        notify);
+void              mongo_oplog_reader_set_checkpoint       (MongoOplogReader     *reader,
+                                                           guint64               checkpoint);
+void              mongo_oplog_reader_set_checkpoint_file  (MongoOplogReader     *reader,
+                                                           const gchar          *checkpoint_file);
+void              mongo_oplog_reader_set_max_batch_delay  (MongoOplogReader     *reader,
+                                                           guint                 max_batch_delay);
+void              mongo_oplog_reader_set_max_batch_size   (MongoOplogReader     *reader,
+                                                           guint                 max_batch_size);
+void              mongo_oplog_reader_set_query            (MongoOplogReader     *reader,
+                                                           MongoBson            *query);
+
+G_END_DECLS
+
+#endif /* MONGO_OPLOG_READER_H */
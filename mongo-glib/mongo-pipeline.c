@@ -0,0 +1,1487 @@
+/* mongo-pipeline.c
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib/gi18n.h>
+#include <string.h>
+
+#include "mongo-bson-matcher.h"
+#include "mongo-pipeline.h"
+#include "mongo-sort-spec.h"
+
+/*
+ * Documents are pushed through the stages one at a time. $match, $project,
+ * $skip and $limit pass documents straight on to the next stage, while
+ * $group and $sort hold them until mongo_pipeline_finish() flushes the
+ * stages in order.
+ *
+ * Group keys and accumulator values are kept as raw BSON elements. Groups
+ * are hashed with mongo_bson_raw_iter_hash_value() and compared with
+ * mongo_bson_raw_iter_compare_value(), so 1 and 1.0 fall in the same
+ * group just as they would on the server.
+ */
+
+typedef enum
+{
+   STAGE_MATCH,
+   STAGE_PROJECT,
+   STAGE_GROUP,
+   STAGE_SORT,
+   STAGE_SKIP,
+   STAGE_LIMIT,
+} StageType;
+
+typedef enum
+{
+   ACC_SUM,
+   ACC_AVG,
+   ACC_MIN,
+   ACC_MAX,
+   ACC_COUNT,
+} AccOp;
+
+typedef struct
+{
+   gchar            **path;     /* A field path, or NULL for a constant */
+   MongoBsonRawIter   constant;
+} Expr;
+
+typedef struct
+{
+   gchar *name;
+   AccOp  op;
+   Expr   expr;
+} Accumulator;
+
+typedef struct
+{
+   gint64      isum;
+   gdouble     dsum;
+   guint64     count;
+   gboolean    is_double;
+   gboolean    is_int64;
+   GByteArray *value; /* A document holding the current $min or $max */
+} AccState;
+
+typedef struct
+{
+   GByteArray       *key;      /* {"_id": value} */
+   MongoBsonRawIter  key_iter;
+   guint             hash;
+   AccState         *states;
+} Group;
+
+typedef struct
+{
+   MongoBson  *bson;
+   GByteArray *key;
+   guint       index;
+} SortEntry;
+
+typedef struct
+{
+   StageType          type;
+
+   /* $match */
+   MongoBsonMatcher  *matcher;
+
+   /* $project */
+   gchar            **fields;
+   gboolean           include;
+
+   /* $group */
+   Expr               id;
+   gchar            **id_names;
+   Expr              *id_exprs;
+   Accumulator       *accs;
+   guint              n_accs;
+   GHashTable        *groups;
+   GPtrArray         *group_list;
+
+   /* $sort */
+   MongoSortSpec     *spec;
+   GPtrArray         *entries;
+   guint              n_sorted;
+   guint              top_k;
+
+   /* $skip and $limit */
+   gint64             n;
+   gint64             seen;
+} Stage;
+
+struct _MongoPipeline
+{
+   volatile gint  ref_count;
+   MongoBson     *stages_bson;
+   Stage         *stages;
+   guint          n_stages;
+   guint          first_blocking;
+   gboolean       exhausted;
+   gboolean       finished;
+   GQueue        *output;
+   GByteArray    *scratch;
+};
+
+static void mongo_pipeline_feed (MongoPipeline *pipeline,
+                                 guint          index,
+                                 MongoBson     *bson);
+
+static inline const guint8 *
+mongo_pipeline_value (const MongoBsonRawIter *iter,
+                      gsize                  *length)
+{
+   const guint8 *begin;
+
+   begin = (const guint8 *)iter->key + strlen(iter->key) + 1;
+   *length = (iter->data + iter->offset) - begin;
+   return begin;
+}
+
+static gsize
+mongo_pipeline_begin_document (GByteArray *buf)
+{
+   static const guint8 header[4] = { 0 };
+   gsize offset = buf->len;
+
+   g_byte_array_append(buf, header, sizeof header);
+   return offset;
+}
+
+static void
+mongo_pipeline_end_document (GByteArray *buf,
+                             gsize       offset)
+{
+   const guint8 trailing = 0;
+   guint32 doc_len;
+
+   g_byte_array_append(buf, &trailing, 1);
+   doc_len = GUINT32_TO_LE(buf->len - offset);
+   memcpy(buf->data + offset, &doc_len, sizeof doc_len);
+}
+
+static void
+mongo_pipeline_append_element (GByteArray   *buf,
+                               const gchar  *key,
+                               guint8        type,
+                               const guint8 *value,
+                               gsize         length)
+{
+   g_byte_array_append(buf, &type, 1);
+   g_byte_array_append(buf, (const guint8 *)key, strlen(key) + 1);
+   g_byte_array_append(buf, value, length);
+}
+
+static void
+mongo_pipeline_append_iter (GByteArray             *buf,
+                            const gchar            *key,
+                            const MongoBsonRawIter *iter)
+{
+   const guint8 *value;
+   gsize length;
+
+   value = mongo_pipeline_value(iter, &length);
+   mongo_pipeline_append_element(buf, key, iter->type, value, length);
+}
+
+static void
+mongo_pipeline_append_int64 (GByteArray  *buf,
+                             const gchar *key,
+                             gint64       value,
+                             gboolean     is_int64)
+{
+   gint32 v32;
+
+   if (!is_int64 && (value >= G_MININT32) && (value <= G_MAXINT32)) {
+      v32 = GINT32_TO_LE((gint32)value);
+      mongo_pipeline_append_element(buf, key, MONGO_BSON_INT32,
+                                    (const guint8 *)&v32, sizeof v32);
+   } else {
+      value = GINT64_TO_LE(value);
+      mongo_pipeline_append_element(buf, key, MONGO_BSON_INT64,
+                                    (const guint8 *)&value, sizeof value);
+   }
+}
+
+static void
+mongo_pipeline_append_double (GByteArray  *buf,
+                              const gchar *key,
+                              gdouble      value)
+{
+   mongo_pipeline_append_element(buf, key, MONGO_BSON_DOUBLE,
+                                 (const guint8 *)&value, sizeof value);
+}
+
+static void
+mongo_pipeline_append_null (GByteArray  *buf,
+                            const gchar *key)
+{
+   mongo_pipeline_append_element(buf, key, MONGO_BSON_NULL, NULL, 0);
+}
+
+/*
+ * Follows a dotted path one field at a time. An array is treated like a
+ * document keyed by index, so "a.0.b" works, but unlike the server a path
+ * does not fan out over the elements of an array: "a.b" where "a" is an
+ * array of documents is missing.
+ */
+static gboolean
+mongo_pipeline_lookup (const guint8      *data,
+                       gsize              length,
+                       gchar            **path,
+                       MongoBsonRawIter  *iter)
+{
+   MongoBsonRawIter child;
+
+   mongo_bson_raw_iter_init_from_data(iter, data, length);
+
+   for (;;) {
+      if (!mongo_bson_raw_iter_find(iter, *path)) {
+         return FALSE;
+      }
+      if (!*++path) {
+         return TRUE;
+      }
+      if (!mongo_bson_raw_iter_recurse(iter, &child)) {
+         return FALSE;
+      }
+      *iter = child;
+   }
+}
+
+/**
+ * mongo_pipeline_eval:
+ * @expr: (in): An #Expr.
+ * @data: (in): The current document.
+ * @length: (in): The length of @data.
+ * @iter: (out): A location for the value.
+ *
+ * Evaluates @expr against a document.
+ *
+ * Returns: %FALSE if @expr names a field that is missing.
+ */
+static gboolean
+mongo_pipeline_eval (const Expr       *expr,
+                     const guint8     *data,
+                     gsize             length,
+                     MongoBsonRawIter *iter)
+{
+   if (expr->path) {
+      return mongo_pipeline_lookup(data, length, expr->path, iter);
+   }
+
+   *iter = expr->constant;
+   return TRUE;
+}
+
+static gboolean
+mongo_pipeline_parse_expr (Expr                   *expr,
+                           const MongoBsonRawIter *iter,
+                           GError                **error)
+{
+   const gchar *str;
+
+   memset(expr, 0, sizeof *expr);
+
+   if (iter->type == MONGO_BSON_UTF8) {
+      str = (const gchar *)iter->value2;
+      if (str[0] == '$') {
+         if (!str[1] || (str[1] == '$')) {
+            g_set_error(error, MONGO_PIPELINE_ERROR,
+                        MONGO_PIPELINE_ERROR_INVALID_STAGE,
+                        _("Invalid field path \"%s\"."), str);
+            return FALSE;
+         }
+         expr->path = g_strsplit(str + 1, ".", 0);
+         return TRUE;
+      }
+   } else if ((iter->type == MONGO_BSON_DOCUMENT) ||
+              (iter->type == MONGO_BSON_ARRAY)) {
+      g_set_error(error, MONGO_PIPELINE_ERROR,
+                  MONGO_PIPELINE_ERROR_INVALID_STAGE,
+                  _("Unsupported expression for \"%s\"."), iter->key);
+      return FALSE;
+   }
+
+   expr->constant = *iter;
+
+   return TRUE;
+}
+
+static gboolean
+mongo_pipeline_get_count (const MongoBsonRawIter *iter,
+                          gint64                 *count)
+{
+   gdouble dvalue;
+
+   switch ((MongoBsonType)iter->type) {
+   case MONGO_BSON_INT32:
+      *count = mongo_bson_raw_iter_get_value_int(iter);
+      break;
+   case MONGO_BSON_INT64:
+      *count = mongo_bson_raw_iter_get_value_int64(iter);
+      break;
+   case MONGO_BSON_DOUBLE:
+      dvalue = mongo_bson_raw_iter_get_value_double(iter);
+      /*
+       * Check the range first, casting NaN or an out of range value to an
+       * integer is undefined.
+       */
+      if (!((dvalue > -9.2e18) && (dvalue < 9.2e18)) ||
+          (dvalue != (gdouble)(gint64)dvalue)) {
+         return FALSE;
+      }
+      *count = (gint64)dvalue;
+      break;
+   case MONGO_BSON_UTF8:
+   case MONGO_BSON_DOCUMENT:
+   case MONGO_BSON_ARRAY:
+   case MONGO_BSON_BINARY:
+   case MONGO_BSON_UNDEFINED:
+   case MONGO_BSON_OBJECT_ID:
+   case MONGO_BSON_BOOLEAN:
+   case MONGO_BSON_DATE_TIME:
+   case MONGO_BSON_NULL:
+   case MONGO_BSON_REGEX:
+   case MONGO_BSON_DBPOINTER:
+   case MONGO_BSON_JAVASCRIPT:
+   case MONGO_BSON_SYMBOL:
+   case MONGO_BSON_JAVASCRIPT_WITH_SCOPE:
+   case MONGO_BSON_TIMESTAMP:
+   case MONGO_BSON_DECIMAL128:
+   case MONGO_BSON_MAX_KEY:
+   case MONGO_BSON_MIN_KEY:
+   default:
+      return FALSE;
+   }
+
+   return (*count >= 0);
+}
+
+static gboolean
+mongo_pipeline_is_truthy (const MongoBsonRawIter *iter,
+                          gboolean               *truthy)
+{
+   switch ((MongoBsonType)iter->type) {
+   case MONGO_BSON_INT32:
+      *truthy = !!mongo_bson_raw_iter_get_value_int(iter);
+      return TRUE;
+   case MONGO_BSON_INT64:
+      *truthy = !!mongo_bson_raw_iter_get_value_int64(iter);
+      return TRUE;
+   case MONGO_BSON_DOUBLE:
+      *truthy = (mongo_bson_raw_iter_get_value_double(iter) != 0.0);
+      return TRUE;
+   case MONGO_BSON_BOOLEAN:
+      *truthy = mongo_bson_raw_iter_get_value_boolean(iter);
+      return TRUE;
+   case MONGO_BSON_UTF8:
+   case MONGO_BSON_DOCUMENT:
+   case MONGO_BSON_ARRAY:
+   case MONGO_BSON_BINARY:
+   case MONGO_BSON_UNDEFINED:
+   case MONGO_BSON_OBJECT_ID:
+   case MONGO_BSON_DATE_TIME:
+   case MONGO_BSON_NULL:
+   case MONGO_BSON_REGEX:
+   case MONGO_BSON_DBPOINTER:
+   case MONGO_BSON_JAVASCRIPT:
+   case MONGO_BSON_SYMBOL:
+   case MONGO_BSON_JAVASCRIPT_WITH_SCOPE:
+   case MONGO_BSON_TIMESTAMP:
+   case MONGO_BSON_DECIMAL128:
+   case MONGO_BSON_MAX_KEY:
+   case MONGO_BSON_MIN_KEY:
+   default:
+      return FALSE;
+   }
+}
+
+static MongoBson *
+mongo_pipeline_get_child (const MongoBsonRawIter *iter)
+{
+   guint32 length;
+
+   memcpy(&length, iter->value1, sizeof length);
+   return mongo_bson_new_from_data(iter->value1, GUINT32_FROM_LE(length));
+}
+
+static gboolean
+mongo_pipeline_parse_project (Stage                  *stage,
+                              const MongoBsonRawIter *iter,
+                              GError                **error)
+{
+   MongoBsonRawIter child;
+   GPtrArray *included;
+   GPtrArray *excluded;
+   gboolean include_id = FALSE;
+   gboolean exclude_id = FALSE;
+   gboolean truthy;
+
+   included = g_ptr_array_new();
+   excluded = g_ptr_array_new();
+
+   mongo_bson_raw_iter_recurse((MongoBsonRawIter *)iter, &child);
+   while (mongo_bson_raw_iter_next(&child)) {
+      if (!mongo_pipeline_is_truthy(&child, &truthy)) {
+         g_set_error(error, MONGO_PIPELINE_ERROR,
+                     MONGO_PIPELINE_ERROR_INVALID_STAGE,
+                     _("$project only supports including or excluding "
+                       "fields, not \"%s\"."), child.key);
+         goto failure;
+      }
+      if (!strcmp(child.key, "_id")) {
+         include_id = truthy;
+         exclude_id = !truthy;
+      } else {
+         g_ptr_array_add(truthy ? included : excluded, (gpointer)child.key);
+      }
+   }
+
+   if (included->len && excluded->len) {
+      g_set_error(error, MONGO_PIPELINE_ERROR,
+                  MONGO_PIPELINE_ERROR_INVALID_STAGE,
+                  _("$project cannot both include and exclude fields."));
+      goto failure;
+   }
+
+   /*
+    * The _id field is kept unless it is excluded explicitly.
+    */
+   stage->include = (included->len > 0) || (include_id && !excluded->len);
+   if (stage->include) {
+      if (!exclude_id) {
+         g_ptr_array_add(included, (gpointer)"_id");
+      }
+      g_ptr_array_add(included, NULL);
+      stage->fields = g_strdupv((gchar **)included->pdata);
+   } else {
+      if (exclude_id) {
+         g_ptr_array_add(excluded, (gpointer)"_id");
+      }
+      g_ptr_array_add(excluded, NULL);
+      stage->fields = g_strdupv((gchar **)excluded->pdata);
+   }
+
+   g_ptr_array_free(included, TRUE);
+   g_ptr_array_free(excluded, TRUE);
+
+   return TRUE;
+
+failure:
+   g_ptr_array_free(included, TRUE);
+   g_ptr_array_free(excluded, TRUE);
+
+   return FALSE;
+}
+
+static gboolean
+mongo_pipeline_parse_accumulator (Accumulator            *acc,
+                                  const MongoBsonRawIter *iter,
+                                  GError                **error)
+{
+   MongoBsonRawIter child;
+   MongoBsonRawIter extra;
+   static const struct {
+      const gchar *name;
+      AccOp        op;
+   } ops[] = {
+      { "$sum",   ACC_SUM },
+      { "$avg",   ACC_AVG },
+      { "$min",   ACC_MIN },
+      { "$max",   ACC_MAX },
+      { "$count", ACC_COUNT },
+   };
+   guint i;
+
+   acc->name = g_strdup(iter->key);
+
+   if ((iter->type != MONGO_BSON_DOCUMENT) ||
+       !mongo_bson_raw_iter_recurse((MongoBsonRawIter *)iter, &child) ||
+       !mongo_bson_raw_iter_next(&child)) {
+      goto invalid;
+   }
+
+   extra = child;
+   if (mongo_bson_raw_iter_next(&extra)) {
+      goto invalid;
+   }
+
+   for (i = 0; i < G_N_ELEMENTS(ops); i++) {
+      if (!strcmp(child.key, ops[i].name)) {
+         acc->op = ops[i].op;
+         if (acc->op == ACC_COUNT) {
+            return TRUE;
+         }
+         return mongo_pipeline_parse_expr(&acc->expr, &child, error);
+      }
+   }
+
+invalid:
+   g_set_error(error, MONGO_PIPELINE_ERROR,
+               MONGO_PIPELINE_ERROR_INVALID_STAGE,
+               _("Unsupported accumulator for \"%s\"."), iter->key);
+
+   return FALSE;
+}
+
+static guint
+mongo_pipeline_group_hash (gconstpointer v)
+{
+   return ((const Group *)v)->hash;
+}
+
+static gboolean
+mongo_pipeline_group_equal (gconstpointer v1,
+                            gconstpointer v2)
+{
+   const Group *a = v1;
+   const Group *b = v2;
+
+   return !mongo_bson_raw_iter_compare_value(&a->key_iter, &b->key_iter);
+}
+
+static void
+mongo_pipeline_group_free (Group *group,
+                           guint  n_accs)
+{
+   guint i;
+
+   for (i = 0; i < n_accs; i++) {
+      if (group->states[i].value) {
+         g_byte_array_free(group->states[i].value, TRUE);
+      }
+   }
+
+   g_byte_array_free(group->key, TRUE);
+   g_free(group->states);
+   g_slice_free(Group, group);
+}
+
+static void
+mongo_pipeline_expr_clear (Expr *expr)
+{
+   g_strfreev(expr->path);
+   expr->path = NULL;
+}
+
+static gboolean
+mongo_pipeline_parse_group (Stage                  *stage,
+                            const MongoBsonRawIter *iter,
+                            GError                **error)
+{
+   MongoBsonRawIter child;
+   MongoBsonRawIter field;
+   GPtrArray *names;
+   GArray *exprs;
+   GArray *accs;
+   Accumulator acc;
+   gboolean have_id = FALSE;
+   Expr expr;
+   guint i;
+
+   accs = g_array_new(FALSE, TRUE, sizeof(Accumulator));
+
+   mongo_bson_raw_iter_recurse((MongoBsonRawIter *)iter, &child);
+   while (mongo_bson_raw_iter_next(&child)) {
+      if (!strcmp(child.key, "_id")) {
+         if (have_id) {
+            g_set_error(error, MONGO_PIPELINE_ERROR,
+                        MONGO_PIPELINE_ERROR_INVALID_STAGE,
+                        _("$group has more than one _id."));
+            goto failure;
+         }
+         have_id = TRUE;
+         if (child.type != MONGO_BSON_DOCUMENT) {
+            if (!mongo_pipeline_parse_expr(&stage->id, &child, error)) {
+               goto failure;
+            }
+            continue;
+         }
+         /*
+          * A document of expressions groups on several fields at once.
+          */
+         names = g_ptr_array_new_with_free_func(g_free);
+         exprs = g_array_new(FALSE, FALSE, sizeof(Expr));
+         mongo_bson_raw_iter_recurse(&child, &field);
+         while (mongo_bson_raw_iter_next(&field)) {
+            if (!mongo_pipeline_parse_expr(&expr, &field, error)) {
+               for (i = 0; i < exprs->len; i++) {
+                  mongo_pipeline_expr_clear(&g_array_index(exprs, Expr, i));
+               }
+               g_ptr_array_free(names, TRUE);
+               g_array_free(exprs, TRUE);
+               goto failure;
+            }
+            g_ptr_array_add(names, g_strdup(field.key));
+            g_array_append_val(exprs, expr);
+         }
+         g_ptr_array_add(names, NULL);
+         g_ptr_array_set_free_func(names, NULL);
+         stage->id_names = (gchar **)g_ptr_array_free(names, FALSE);
+         stage->id_exprs = (Expr *)g_array_free(exprs, FALSE);
+      } else {
+         memset(&acc, 0, sizeof acc);
+         if (!mongo_pipeline_parse_accumulator(&acc, &child, error)) {
+            g_free(acc.name);
+            goto failure;
+         }
+         g_array_append_val(accs, acc);
+      }
+   }
+
+   if (!have_id) {
+      g_set_error(error, MONGO_PIPELINE_ERROR,
+                  MONGO_PIPELINE_ERROR_INVALID_STAGE,
+                  _("$group requires an _id."));
+      goto failure;
+   }
+
+   stage->n_accs = accs->len;
+   stage->accs = (Accumulator *)g_array_free(accs, FALSE);
+   stage->groups = g_hash_table_new(mongo_pipeline_group_hash,
+                                    mongo_pipeline_group_equal);
+   stage->group_list = g_ptr_array_new();
+
+   return TRUE;
+
+failure:
+   stage->n_accs = accs->len;
+   stage->accs = (Accumulator *)g_array_free(accs, FALSE);
+
+   return FALSE;
+}
+
+static gboolean
+mongo_pipeline_parse_stage (Stage                  *stage,
+                            const MongoBsonRawIter *iter,
+                            GError                **error)
+{
+   MongoBsonRawIter child;
+   MongoBsonRawIter extra;
+   MongoBson *bson;
+
+   if ((iter->type != MONGO_BSON_DOCUMENT) ||
+       !mongo_bson_raw_iter_recurse((MongoBsonRawIter *)iter, &child) ||
+       !mongo_bson_raw_iter_next(&child)) {
+      g_set_error(error, MONGO_PIPELINE_ERROR,
+                  MONGO_PIPELINE_ERROR_INVALID_STAGE,
+                  _("Stage %s is not a document with one field."), iter->key);
+      return FALSE;
+   }
+
+   extra = child;
+   if (mongo_bson_raw_iter_next(&extra)) {
+      g_set_error(error, MONGO_PIPELINE_ERROR,
+                  MONGO_PIPELINE_ERROR_INVALID_STAGE,
+                  _("Stage %s has more than one field."), iter->key);
+      return FALSE;
+   }
+
+   if (!strcmp(child.key, "$match") && (child.type == MONGO_BSON_DOCUMENT)) {
+      stage->type = STAGE_MATCH;
+      bson = mongo_pipeline_get_child(&child);
+      stage->matcher = mongo_bson_matcher_new(bson, error);
+      mongo_bson_unref(bson);
+      return (stage->matcher != NULL);
+   } else if (!strcmp(child.key, "$project") &&
+              (child.type == MONGO_BSON_DOCUMENT)) {
+      stage->type = STAGE_PROJECT;
+      return mongo_pipeline_parse_project(stage, &child, error);
+   } else if (!strcmp(child.key, "$group") &&
+              (child.type == MONGO_BSON_DOCUMENT)) {
+      stage->type = STAGE_GROUP;
+      return mongo_pipeline_parse_group(stage, &child, error);
+   } else if (!strcmp(child.key, "$sort") &&
+              (child.type == MONGO_BSON_DOCUMENT)) {
+      stage->type = STAGE_SORT;
+      bson = mongo_pipeline_get_child(&child);
+      stage->spec = mongo_sort_spec_new(bson, error);
+      mongo_bson_unref(bson);
+      stage->entries = g_ptr_array_new();
+      return (stage->spec != NULL);
+   } else if (!strcmp(child.key, "$skip") || !strcmp(child.key, "$limit")) {
+      stage->type = strcmp(child.key, "$skip") ? STAGE_LIMIT : STAGE_SKIP;
+      if (mongo_pipeline_get_count(&child, &stage->n) &&
+          ((stage->type == STAGE_SKIP) || (stage->n > 0))) {
+         return TRUE;
+      }
+      g_set_error(error, MONGO_PIPELINE_ERROR,
+                  MONGO_PIPELINE_ERROR_INVALID_STAGE,
+                  _("%s requires a positive integer."), child.key);
+      return FALSE;
+   }
+
+   g_set_error(error, MONGO_PIPELINE_ERROR,
+               MONGO_PIPELINE_ERROR_INVALID_STAGE,
+               _("Unsupported stage \"%s\"."), child.key);
+
+   return FALSE;
+}
+
+static void
+mongo_pipeline_stage_clear (Stage *stage)
+{
+   SortEntry *entry;
+   guint i;
+
+   if (stage->matcher) {
+      mongo_bson_matcher_unref(stage->matcher);
+   }
+
+   g_strfreev(stage->fields);
+
+   mongo_pipeline_expr_clear(&stage->id);
+   if (stage->id_names) {
+      for (i = 0; stage->id_names[i]; i++) {
+         mongo_pipeline_expr_clear(&stage->id_exprs[i]);
+      }
+      g_strfreev(stage->id_names);
+      g_free(stage->id_exprs);
+   }
+
+   if (stage->group_list) {
+      for (i = 0; i < stage->group_list->len; i++) {
+         mongo_pipeline_group_free(g_ptr_array_index(stage->group_list, i),
+                                   stage->n_accs);
+      }
+      g_ptr_array_free(stage->group_list, TRUE);
+      g_hash_table_destroy(stage->groups);
+   }
+
+   for (i = 0; i < stage->n_accs; i++) {
+      g_free(stage->accs[i].name);
+      mongo_pipeline_expr_clear(&stage->accs[i].expr);
+   }
+   g_free(stage->accs);
+
+   if (stage->spec) {
+      mongo_sort_spec_unref(stage->spec);
+   }
+
+   if (stage->entries) {
+      for (i = 0; i < stage->entries->len; i++) {
+         entry = g_ptr_array_index(stage->entries, i);
+         mongo_bson_unref(entry->bson);
+         g_byte_array_free(entry->key, TRUE);
+         g_slice_free(SortEntry, entry);
+      }
+      g_ptr_array_free(stage->entries, TRUE);
+   }
+}
+
+/**
+ * mongo_pipeline_build_key:
+ * @stage: (in): A $group stage.
+ * @data: (in): The current document.
+ * @length: (in): The length of @data.
+ * @buf: (in): A #GByteArray to build the key in.
+ *
+ * Builds the {"_id": value} document of the group that the document
+ * belongs to. A missing field groups as null.
+ */
+static void
+mongo_pipeline_build_key (Stage        *stage,
+                          const guint8 *data,
+                          gsize         length,
+                          GByteArray   *buf)
+{
+   MongoBsonRawIter value;
+   gsize offset;
+   gsize child;
+   guint i;
+
+   g_byte_array_set_size(buf, 0);
+   offset = mongo_pipeline_begin_document(buf);
+
+   if (stage->id_names) {
+      g_byte_array_append(buf, (const guint8 *)"\x03_id", 5);
+      child = mongo_pipeline_begin_document(buf);
+      for (i = 0; stage->id_names[i]; i++) {
+         if (mongo_pipeline_eval(&stage->id_exprs[i], data, length, &value)) {
+            mongo_pipeline_append_iter(buf, stage->id_names[i], &value);
+         }
+      }
+      mongo_pipeline_end_document(buf, child);
+   } else if (mongo_pipeline_eval(&stage->id, data, length, &value)) {
+      mongo_pipeline_append_iter(buf, "_id", &value);
+   } else {
+      mongo_pipeline_append_null(buf, "_id");
+   }
+
+   mongo_pipeline_end_document(buf, offset);
+}
+
+static void
+mongo_pipeline_accumulate (Accumulator  *acc,
+                           AccState     *state,
+                           const guint8 *data,
+                           gsize         length)
+{
+   MongoBsonRawIter current;
+   MongoBsonRawIter value;
+   gdouble dvalue;
+   gint64 ivalue;
+   gsize offset;
+   gint cmp;
+
+   if (acc->op == ACC_COUNT) {
+      state->count++;
+      return;
+   }
+
+   if (!mongo_pipeline_eval(&acc->expr, data, length, &value)) {
+      return;
+   }
+
+   switch (acc->op) {
+   case ACC_SUM:
+   case ACC_AVG:
+      switch ((MongoBsonType)value.type) {
+      case MONGO_BSON_INT32:
+      case MONGO_BSON_INT64:
+         ivalue = (value.type == MONGO_BSON_INT32) ?
+                  mongo_bson_raw_iter_get_value_int(&value) :
+                  mongo_bson_raw_iter_get_value_int64(&value);
+         state->is_int64 |= (value.type == MONGO_BSON_INT64);
+         /*
+          * Integers are summed exactly until they overflow, at which point
+          * the sum continues as a double like on the server.
+          */
+         if (((ivalue > 0) && (state->isum > (G_MAXINT64 - ivalue))) ||
+             ((ivalue < 0) && (state->isum < (G_MININT64 - ivalue)))) {
+            state->dsum += (gdouble)state->isum + (gdouble)ivalue;
+            state->isum = 0;
+            state->is_double = TRUE;
+         } else {
+            state->isum += ivalue;
+         }
+         break;
+      case MONGO_BSON_DOUBLE:
+         dvalue = mongo_bson_raw_iter_get_value_double(&value);
+         state->dsum += dvalue;
+         state->is_double = TRUE;
+         break;
+      case MONGO_BSON_UTF8:
+      case MONGO_BSON_DOCUMENT:
+      case MONGO_BSON_ARRAY:
+      case MONGO_BSON_BINARY:
+      case MONGO_BSON_UNDEFINED:
+      case MONGO_BSON_OBJECT_ID:
+      case MONGO_BSON_BOOLEAN:
+      case MONGO_BSON_DATE_TIME:
+      case MONGO_BSON_NULL:
+      case MONGO_BSON_REGEX:
+      case MONGO_BSON_DBPOINTER:
+      case MONGO_BSON_JAVASCRIPT:
+      case MONGO_BSON_SYMBOL:
+      case MONGO_BSON_JAVASCRIPT_WITH_SCOPE:
+      case MONGO_BSON_TIMESTAMP:
+      case MONGO_BSON_DECIMAL128:
+      case MONGO_BSON_MAX_KEY:
+      case MONGO_BSON_MIN_KEY:
+      default:
+         return;
+      }
+      state->count++;
+      break;
+   case ACC_MIN:
+   case ACC_MAX:
+      if ((value.type == MONGO_BSON_NULL) ||
+          (value.type == MONGO_BSON_UNDEFINED)) {
+         return;
+      }
+      if (state->value) {
+         mongo_bson_raw_iter_init_from_data(&current, state->value->data,
+                                            state->value->len);
+         mongo_bson_raw_iter_next(&current);
+         cmp = mongo_bson_raw_iter_compare_value(&value, &current);
+         if ((acc->op == ACC_MIN) ? (cmp >= 0) : (cmp <= 0)) {
+            return;
+         }
+      } else {
+         state->value = g_byte_array_new();
+      }
+      g_byte_array_set_size(state->value, 0);
+      offset = mongo_pipeline_begin_document(state->value);
+      mongo_pipeline_append_iter(state->value, "", &value);
+      mongo_pipeline_end_document(state->value, offset);
+      break;
+   case ACC_COUNT:
+   default:
+      g_assert_not_reached();
+      break;
+   }
+}
+
+static void
+mongo_pipeline_group (MongoPipeline *pipeline,
+                      Stage         *stage,
+                      MongoBson     *bson)
+{
+   const guint8 *data;
+   Group lookup;
+   Group *group;
+   gsize length;
+   guint i;
+
+   data = mongo_bson_get_data(bson, &length);
+
+   mongo_pipeline_build_key(stage, data, length, pipeline->scratch);
+   mongo_bson_raw_iter_init_from_data(&lookup.key_iter,
+                                      pipeline->scratch->data,
+                                      pipeline->scratch->len);
+   mongo_bson_raw_iter_next(&lookup.key_iter);
+   lookup.hash = (guint)mongo_bson_raw_iter_hash_value(&lookup.key_iter);
+
+   if (!(group = g_hash_table_lookup(stage->groups, &lookup))) {
+      group = g_slice_new0(Group);
+      group->key = g_byte_array_sized_new(pipeline->scratch->len);
+      g_byte_array_append(group->key, pipeline->scratch->data,
+                          pipeline->scratch->len);
+      mongo_bson_raw_iter_init_from_data(&group->key_iter, group->key->data,
+                                         group->key->len);
+      mongo_bson_raw_iter_next(&group->key_iter);
+      group->hash = lookup.hash;
+      group->states = g_new0(AccState, stage->n_accs);
+      g_hash_table_insert(stage->groups, group, group);
+      g_ptr_array_add(stage->group_list, group);
+   }
+
+   for (i = 0; i < stage->n_accs; i++) {
+      mongo_pipeline_accumulate(&stage->accs[i], &group->states[i],
+                                data, length);
+   }
+}
+
+static void
+mongo_pipeline_flush_group (MongoPipeline *pipeline,
+                            Stage         *stage,
+                            guint          index)
+{
+   MongoBsonRawIter value;
+   Accumulator *acc;
+   GByteArray *buf;
+   MongoBson *bson;
+   AccState *state;
+   Group *group;
+   gsize offset;
+   guint i;
+   guint j;
+
+   buf = g_byte_array_new();
+
+   for (i = 0; i < stage->group_list->len; i++) {
+      group = g_ptr_array_index(stage->group_list, i);
+
+      g_byte_array_set_size(buf, 0);
+      offset = mongo_pipeline_begin_document(buf);
+      mongo_pipeline_append_iter(buf, "_id", &group->key_iter);
+
+      for (j = 0; j < stage->n_accs; j++) {
+         acc = &stage->accs[j];
+         state = &group->states[j];
+         switch (acc->op) {
+         case ACC_SUM:
+            if (state->is_double) {
+               mongo_pipeline_append_double(buf, acc->name,
+                                            state->dsum + state->isum);
+            } else {
+               mongo_pipeline_append_int64(buf, acc->name, state->isum,
+                                           state->is_int64);
+            }
+            break;
+         case ACC_AVG:
+            if (state->count) {
+               mongo_pipeline_append_double(buf, acc->name,
+                  (state->dsum + state->isum) / state->count);
+            } else {
+               mongo_pipeline_append_null(buf, acc->name);
+            }
+            break;
+         case ACC_MIN:
+         case ACC_MAX:
+            if (state->value) {
+               mongo_bson_raw_iter_init_from_data(&value, state->value->data,
+                                                  state->value->len);
+               mongo_bson_raw_iter_next(&value);
+               mongo_pipeline_append_iter(buf, acc->name, &value);
+            } else {
+               mongo_pipeline_append_null(buf, acc->name);
+            }
+            break;
+         case ACC_COUNT:
+            mongo_pipeline_append_int64(buf, acc->name, state->count, FALSE);
+            break;
+         default:
+            g_assert_not_reached();
+            break;
+         }
+      }
+
+      mongo_pipeline_end_document(buf, offset);
+      bson = mongo_bson_new_from_data(buf->data, buf->len);
+      mongo_pipeline_feed(pipeline, index + 1, bson);
+      mongo_bson_unref(bson);
+      mongo_pipeline_group_free(group, stage->n_accs);
+   }
+
+   g_ptr_array_set_size(stage->group_list, 0);
+   g_hash_table_remove_all(stage->groups);
+   g_byte_array_free(buf, TRUE);
+}
+
+static gint
+mongo_pipeline_sort_entry_compare (gconstpointer a,
+                                   gconstpointer b)
+{
+   const SortEntry *ea = *(const SortEntry **)a;
+   const SortEntry *eb = *(const SortEntry **)b;
+   gint ret;
+
+   ret = memcmp(ea->key->data, eb->key->data, MIN(ea->key->len, eb->key->len));
+   if (!ret) {
+      ret = (ea->key->len > eb->key->len) - (ea->key->len < eb->key->len);
+   }
+   if (!ret) {
+      ret = (ea->index > eb->index) - (ea->index < eb->index);
+   }
+
+   return ret;
+}
+
+/**
+ * mongo_pipeline_sort_truncate:
+ * @stage: (in): A $sort stage.
+ *
+ * Sorts the buffered entries and, if only the first entries will be
+ * used by a following $limit, drops the others.
+ */
+static void
+mongo_pipeline_sort_truncate (Stage *stage)
+{
+   SortEntry *entry;
+   guint i;
+
+   g_ptr_array_sort(stage->entries, mongo_pipeline_sort_entry_compare);
+
+   if (stage->top_k) {
+      for (i = stage->top_k; i < stage->entries->len; i++) {
+         entry = g_ptr_array_index(stage->entries, i);
+         mongo_bson_unref(entry->bson);
+         g_byte_array_free(entry->key, TRUE);
+         g_slice_free(SortEntry, entry);
+      }
+      if (stage->entries->len > stage->top_k) {
+         g_ptr_array_set_size(stage->entries, stage->top_k);
+      }
+   }
+}
+
+static void
+mongo_pipeline_sort (Stage     *stage,
+                     MongoBson *bson)
+{
+   SortEntry *entry;
+
+   entry = g_slice_new0(SortEntry);
+   entry->bson = mongo_bson_dup(bson);
+   entry->key = g_byte_array_new();
+   entry->index = stage->n_sorted++;
+   mongo_sort_spec_encode(stage->spec, bson, entry->key);
+   g_ptr_array_add(stage->entries, entry);
+
+   /*
+    * With a $limit following, memory stays bounded by regularly sorting
+    * and keeping only the entries that can still be returned.
+    */
+   if (stage->top_k && (stage->entries->len >= (2 * stage->top_k))) {
+      mongo_pipeline_sort_truncate(stage);
+   }
+}
+
+static void
+mongo_pipeline_flush_sort (MongoPipeline *pipeline,
+                           Stage         *stage,
+                           guint          index)
+{
+   SortEntry *entry;
+   guint i;
+
+   mongo_pipeline_sort_truncate(stage);
+
+   for (i = 0; i < stage->entries->len; i++) {
+      entry = g_ptr_array_index(stage->entries, i);
+      mongo_pipeline_feed(pipeline, index + 1, entry->bson);
+      mongo_bson_unref(entry->bson);
+      g_byte_array_free(entry->key, TRUE);
+      g_slice_free(SortEntry, entry);
+   }
+
+   g_ptr_array_set_size(stage->entries, 0);
+}
+
+static void
+mongo_pipeline_feed (MongoPipeline *pipeline,
+                     guint          index,
+                     MongoBson     *bson)
+{
+   MongoBson *projected;
+   Stage *stage;
+
+   if (index == pipeline->n_stages) {
+      g_queue_push_tail(pipeline->output, mongo_bson_dup(bson));
+      return;
+   }
+
+   stage = &pipeline->stages[index];
+
+   switch (stage->type) {
+   case STAGE_MATCH:
+      if (mongo_bson_matcher_match(stage->matcher, bson)) {
+         mongo_pipeline_feed(pipeline, index + 1, bson);
+      }
+      break;
+   case STAGE_PROJECT:
+      if (stage->include) {
+         projected = mongo_bson_include_fields(bson,
+            (const gchar * const *)stage->fields);
+      } else {
+         projected = mongo_bson_exclude_fields(bson,
+            (const gchar * const *)stage->fields);
+      }
+      mongo_pipeline_feed(pipeline, index + 1, projected);
+      mongo_bson_unref(projected);
+      break;
+   case STAGE_GROUP:
+      mongo_pipeline_group(pipeline, stage, bson);
+      break;
+   case STAGE_SORT:
+      mongo_pipeline_sort(stage, bson);
+      break;
+   case STAGE_SKIP:
+      if (stage->seen < stage->n) {
+         stage->seen++;
+      } else {
+         mongo_pipeline_feed(pipeline, index + 1, bson);
+      }
+      break;
+   case STAGE_LIMIT:
+      if (stage->seen < stage->n) {
+         stage->seen++;
+         mongo_pipeline_feed(pipeline, index + 1, bson);
+      }
+      if ((stage->seen >= stage->n) && (index < pipeline->first_blocking)) {
+         pipeline->exhausted = TRUE;
+      }
+      break;
+   default:
+      g_assert_not_reached();
+      break;
+   }
+}
+
+/**
+ * mongo_pipeline_new:
+ * @stages: (in): A #MongoBson whose values are the stages, in order.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Creates a new #MongoPipeline that runs an aggregation pipeline over
+ * documents on the client. @stages is typically an array, such as the
+ * value of "pipeline" in an aggregate command. The supported stages are:
+ *
+ * $match with any query supported by #MongoBsonMatcher.
+ *
+ * $project including or excluding fields, but without computed fields.
+ *
+ * $group with an _id that is a constant, a "$field" path or a document
+ * of those, and accumulators $sum, $avg, $min, $max and $count whose
+ * argument is a constant or a "$field" path. A dotted path does not
+ * descend into the elements of an array, so "$a.b" is missing when "a" is
+ * an array; name the element instead, as in "$a.0.b".
+ *
+ * $sort, $skip and $limit. A $sort followed by $limit only keeps the
+ * documents that can still be returned.
+ *
+ * Returns: (transfer full): A #MongoPipeline that should be freed with
+ *   mongo_pipeline_unref(), or %NULL if @stages is invalid, in which
+ *   case @error is set.
+ */
+MongoPipeline *
+mongo_pipeline_new (MongoBson  *stages,
+                    GError    **error)
+{
+   MongoPipeline *pipeline;
+   MongoBsonRawIter iter;
+   GArray *array;
+   Stage stage;
+   gint64 skipped;
+   guint i;
+   guint j;
+
+   g_return_val_if_fail(stages != NULL, NULL);
+
+   pipeline = g_slice_new0(MongoPipeline);
+   pipeline->ref_count = 1;
+   pipeline->stages_bson = mongo_bson_dup(stages);
+   pipeline->output = g_queue_new();
+   pipeline->scratch = g_byte_array_new();
+
+   array = g_array_new(FALSE, FALSE, sizeof(Stage));
+
+   mongo_bson_raw_iter_init(&iter, pipeline->stages_bson);
+   while (mongo_bson_raw_iter_next(&iter)) {
+      memset(&stage, 0, sizeof stage);
+      if (!mongo_pipeline_parse_stage(&stage, &iter, error)) {
+         mongo_pipeline_stage_clear(&stage);
+         pipeline->n_stages = array->len;
+         pipeline->stages = (Stage *)g_array_free(array, FALSE);
+         mongo_pipeline_unref(pipeline);
+         return NULL;
+      }
+      g_array_append_val(array, stage);
+   }
+
+   pipeline->n_stages = array->len;
+   pipeline->stages = (Stage *)g_array_free(array, FALSE);
+   pipeline->first_blocking = pipeline->n_stages;
+
+   for (i = 0; i < pipeline->n_stages; i++) {
+      if ((pipeline->stages[i].type == STAGE_GROUP) ||
+          (pipeline->stages[i].type == STAGE_SORT)) {
+         pipeline->first_blocking = MIN(pipeline->first_blocking, i);
+      }
+      if (pipeline->stages[i].type == STAGE_SORT) {
+         skipped = 0;
+         for (j = i + 1; j < pipeline->n_stages; j++) {
+            if (pipeline->stages[j].type == STAGE_SKIP) {
+               skipped += pipeline->stages[j].n;
+            } else if (pipeline->stages[j].type == STAGE_LIMIT) {
+               if ((skipped + pipeline->stages[j].n) <= G_MAXUINT / 2) {
+                  pipeline->stages[i].top_k = skipped + pipeline->stages[j].n;
+               }
+               break;
+            } else {
+               break;
+            }
+         }
+      }
+   }
+
+   return pipeline;
+}
+
+/**
+ * mongo_pipeline_push:
+ * @pipeline: (in): A #MongoPipeline.
+ * @bson: (in): A #MongoBson.
+ *
+ * Runs @bson through the stages of @pipeline. Documents that reach the end
+ * of the pipeline can be retrieved with mongo_pipeline_pop(). @bson is
+ * copied if it needs to be kept, so it may be a view that is only valid
+ * during this call.
+ *
+ * Returns: %FALSE if a $limit was reached and no further input can change
+ *   the results, in which case the caller may stop reading documents.
+ */
+gboolean
+mongo_pipeline_push (MongoPipeline *pipeline,
+                     MongoBson     *bson)
+{
+   g_return_val_if_fail(pipeline != NULL, FALSE);
+   g_return_val_if_fail(bson != NULL, FALSE);
+   g_return_val_if_fail(!pipeline->finished, FALSE);
+
+   if (!pipeline->exhausted) {
+      mongo_pipeline_feed(pipeline, 0, bson);
+   }
+
+   return !pipeline->exhausted;
+}
+
+/**
+ * mongo_pipeline_finish:
+ * @pipeline: (in): A #MongoPipeline.
+ *
+ * Signals the end of the input. The documents held by $group and $sort
+ * stages are released to the following stages, after which all results
+ * are available from mongo_pipeline_pop().
+ */
+void
+mongo_pipeline_finish (MongoPipeline *pipeline)
+{
+   Stage *stage;
+   guint i;
+
+   g_return_if_fail(pipeline != NULL);
+
+   if (pipeline->finished) {
+      return;
+   }
+
+   pipeline->finished = TRUE;
+
+   for (i = 0; i < pipeline->n_stages; i++) {
+      stage = &pipeline->stages[i];
+      if (stage->type == STAGE_GROUP) {
+         mongo_pipeline_flush_group(pipeline, stage, i);
+      } else if (stage->type == STAGE_SORT) {
+         mongo_pipeline_flush_sort(pipeline, stage, i);
+      }
+   }
+}
+
+/**
+ * mongo_pipeline_pop:
+ * @pipeline: (in): A #MongoPipeline.
+ *
+ * Fetches the next document that came out of @pipeline.
+ *
+ * Returns: (transfer full): A #MongoBson, or %NULL if no result is
+ *   currently available.
+ */
+MongoBson *
+mongo_pipeline_pop (MongoPipeline *pipeline)
+{
+   g_return_val_if_fail(pipeline != NULL, NULL);
+   return g_queue_pop_head(pipeline->output);
+}
+
+/**
+ * mongo_pipeline_run:
+ * @pipeline: (in): A #MongoPipeline.
+ * @reader: (in): A #MongoBsonReader.
+ * @cancellable: (in) (allow-none): A #GCancellable, or %NULL.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Pushes the documents read from @reader through @pipeline until the end
+ * of the stream, or until a $limit makes further input unnecessary, and
+ * then calls mongo_pipeline_finish().
+ *
+ * Returns: %TRUE if successful; otherwise %FALSE and @error is set.
+ */
+gboolean
+mongo_pipeline_run (MongoPipeline    *pipeline,
+                    MongoBsonReader  *reader,
+                    GCancellable     *cancellable,
+                    GError          **error)
+{
+   const guint8 *data;
+   GError *local_error = NULL;
+   MongoBson *bson;
+   gboolean more;
+   gsize length;
+
+   g_return_val_if_fail(pipeline != NULL, FALSE);
+   g_return_val_if_fail(MONGO_IS_BSON_READER(reader), FALSE);
+
+   while ((data = mongo_bson_reader_next(reader, &length, cancellable,
+                                         &local_error))) {
+      bson = mongo_bson_new_from_static_data((guint8 *)data, length, NULL);
+      more = mongo_pipeline_push(pipeline, bson);
+      mongo_bson_unref(bson);
+      if (!more) {
+         break;
+      }
+   }
+
+   if (local_error) {
+      g_propagate_error(error, local_error);
+      return FALSE;
+   }
+
+   mongo_pipeline_finish(pipeline);
+
+   return TRUE;
+}
+
+/**
+ * mongo_pipeline_ref:
+ * @pipeline: (in): A #MongoPipeline.
+ *
+ * Increments the reference count of @pipeline by one.
+ *
+ * Returns: (transfer full): @pipeline.
+ */
+MongoPipeline *
+mongo_pipeline_ref (MongoPipeline *pipeline)
+{
+   g_return_val_if_fail(pipeline != NULL, NULL);
+   g_return_val_if_fail(pipeline->ref_count > 0, NULL);
+
+   g_atomic_int_inc(&pipeline->ref_count);
+   return pipeline;
+}
+
+/**
+ * mongo_pipeline_unref:
+ * @pipeline: (in): A #MongoPipeline.
+ *
+ * Decrements the reference count of @pipeline by one. When the reference
+ * count reaches zero, the structure is freed.
+ */
+void
+mongo_pipeline_unref (MongoPipeline *pipeline)
+{
+   MongoBson *bson;
+   guint i;
+
+   g_return_if_fail(pipeline != NULL);
+   g_return_if_fail(pipeline->ref_count > 0);
+
+   if (g_atomic_int_dec_and_test(&pipeline->ref_count)) {
+      for (i = 0; i < pipeline->n_stages; i++) {
+         mongo_pipeline_stage_clear(&pipeline->stages[i]);
+      }
+      g_free(pipeline->stages);
+      while ((bson = g_queue_pop_head(pipeline->output))) {
+         mongo_bson_unref(bson);
+      }
+      g_queue_free(pipeline->output);
+      g_byte_array_free(pipeline->scratch, TRUE);
+      mongo_bson_unref(pipeline->stages_bson);
+      g_slice_free(MongoPipeline, pipeline);
+   }
+}
+
+/**
+ * mongo_pipeline_get_type:
+ *
+ * Retrieve the #GType for the #MongoPipeline boxed type.
+ *
+ * Returns: A #GType.
+ */
+GType
+mongo_pipeline_get_type (void)
+{
+   static GType type_id = 0;
+   static gsize initialized = FALSE;
+
+   if (g_once_init_enter(&initialized)) {
+      type_id = g_boxed_type_register_static("MongoPipeline",
+         (GBoxedCopyFunc)mongo_pipeline_ref,
+         (GBoxedFreeFunc)mongo_pipeline_unref);
+      g_once_init_leave(&initialized, TRUE);
+   }
+
+   return type_id;
+}
+
+GQuark
+mongo_pipeline_error_quark (void)
+{
+   return g_quark_from_static_string("mongo_pipeline_error_quark");
+}
@@ -0,0 +1,57 @@
+/* mongo-pipeline.h
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MONGO_PIPELINE_H
+#define MONGO_PIPELINE_H
+
+#include <gio/gio.h>
+
+#include "mongo-bson.h"
+#include "mongo-bson-reader.h"
+
+G_BEGIN_DECLS
+
+#define MONGO_TYPE_PIPELINE  (mongo_pipeline_get_type())
+#define MONGO_PIPELINE_ERROR (mongo_pipeline_error_quark())
+
+typedef struct _MongoPipeline     MongoPipeline;
+typedef enum   _MongoPipelineError MongoPipelineError;
+
+enum _MongoPipelineError
+{
+   MONGO_PIPELINE_ERROR_INVALID_STAGE = 1,
+};
+
+GQuark         mongo_pipeline_error_quark (void) G_GNUC_CONST;
+void           mongo_pipeline_finish      (MongoPipeline    *pipeline);
+GType          mongo_pipeline_get_type    (void) G_GNUC_CONST;
+MongoPipeline *mongo_pipeline_new         (MongoBson        *stages,
+                                           GError          **error);
+MongoBson     *mongo_pipeline_pop         (MongoPipeline    *pipeline);
+gboolean       mongo_pipeline_push        (MongoPipeline    *pipeline,
+                                           MongoBson        *bson);
+MongoPipeline *mongo_pipeline_ref         (MongoPipeline    *pipeline);
+gboolean       mongo_pipeline_run         (MongoPipeline    *pipeline,
+                                           MongoBsonReader  *reader,
+                                           GCancellable     *cancellable,
+                                           GError          **error);
+void           mongo_pipeline_unref       (MongoPipeline    *pipeline);
+
+G_END_DECLS
+
+#endif /* MONGO_PIPELINE_H */
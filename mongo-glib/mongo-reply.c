@@ -0,0 +1,196 @@
+/* mongo-reply.c
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "mongo-reply.h"
+
+/*
+ * responseFlags, cursorID, startingFrom and numberReturned.
+ */
+#define REPLY_HEADER_SIZE 20
+
+/**
+ * mongo_reply_new_from_data:
+ * @data: (in): The body of an OP_REPLY message, after the message header.
+ * @length: (in): The length of @data.
+ *
+ * Parses the body of an OP_REPLY message. Each document is copied out of
+ * @data, so @data does not need to outlive the result.
+ *
+ * Returns: A new #MongoReply that should be freed with mongo_reply_unref(),
+ *   or %NULL if @data is not a valid reply.
+ */
+MongoReply *
+mongo_reply_new_from_data (const guint8 *data,
+                           gsize         length)
+{
+   MongoReply *reply;
+   guint32 flags;
+   guint32 n_returned;
+   guint32 doc_len;
+   guint64 cursor_id;
+   gsize offset;
+   guint i;
+
+   g_return_val_if_fail(data != NULL || !length, NULL);
+
+   if (length < REPLY_HEADER_SIZE) {
+      return NULL;
+   }
+
+   memcpy(&n_returned, data + 16, sizeof n_returned);
+   n_returned = GUINT32_FROM_LE(n_returned);
+
+   /*
+    * Every document is at least 5 bytes, which also bounds the allocation
+    * below by the size of the message.
+    */
+   if (n_returned > ((length - REPLY_HEADER_SIZE) / 5)) {
+      return NULL;
+   }
+
+   memcpy(&flags, data, sizeof flags);
+   memcpy(&cursor_id, data + 4, sizeof cursor_id);
+
+   reply = g_slice_new0(MongoReply);
+   reply->ref_count = 1;
+   reply->flags = GUINT32_FROM_LE(flags);
+   reply->cursor_id = GUINT64_FROM_LE(cursor_id);
+   memcpy(&reply->starting_from, data + 12, sizeof reply->starting_from);
+   reply->starting_from = GUINT32_FROM_LE(reply->starting_from);
+   reply->documents = g_new0(MongoBson *, n_returned + 1);
+
+   for (i = 0, offset = REPLY_HEADER_SIZE; i < n_returned; i++) {
+      if ((length - offset) < 5) {
+         goto failure;
+      }
+      memcpy(&doc_len, data + offset, sizeof doc_len);
+      doc_len = GUINT32_FROM_LE(doc_len);
+      if ((doc_len < 5) || (doc_len > (length - offset)) ||
+          data[offset + doc_len - 1]) {
+         goto failure;
+      }
+      reply->documents[i] = mongo_bson_new_from_data(data + offset, doc_len);
+      reply->n_documents++;
+      offset += doc_len;
+   }
+
+   if (offset != length) {
+      goto failure;
+   }
+
+   return reply;
+
+failure:
+   mongo_reply_unref(reply);
+
+   return NULL;
+}
+
+/**
+ * mongo_reply_ref:
+ * @reply: (in): A #MongoReply.
+ *
+ * Increments the reference count of @reply by one.
+ *
+ * Returns: (transfer full): @reply.
+ */
+MongoReply *
+mongo_reply_ref (MongoReply *reply)
+{
+   g_return_val_if_fail(reply != NULL, NULL);
+   g_return_val_if_fail(reply->ref_count > 0, NULL);
+
+   g_atomic_int_inc(&reply->ref_count);
+   return reply;
+}
+
+/**
+ * mongo_reply_unref:
+ * @reply: (in): A #MongoReply.
+ *
+ * Decrements the reference count of @reply by one. When the reference
+ * count reaches zero, the structure and its documents are released.
+ */
+void
+mongo_reply_unref (MongoReply *reply)
+{
+   guint i;
+
+   g_return_if_fail(reply != NULL);
+   g_return_if_fail(reply->ref_count > 0);
+
+   if (g_atomic_int_dec_and_test(&reply->ref_count)) {
+      for (i = 0; i < reply->n_documents; i++) {
+         mongo_bson_unref(reply->documents[i]);
+      }
+      g_free(reply->documents);
+      g_slice_free(MongoReply, reply);
+   }
+}
+
+/**
+ * mongo_reply_get_type:
+ *
+ * Retrieve the #GType for the #MongoReply boxed type.
+ *
+ * Returns: A #GType.
+ */
+GType
+mongo_reply_get_type (void)
+{
+   static GType type_id = 0;
+   static gsize initialized = FALSE;
+
+   if (g_once_init_enter(&initialized)) {
+      type_id = g_boxed_type_register_static("MongoReply",
+         (GBoxedCopyFunc)mongo_reply_ref,
+         (GBoxedFreeFunc)mongo_reply_unref);
+      g_once_init_leave(&initialized, TRUE);
+   }
+
+   return type_id;
+}
+
+GType
+mongo_reply_flags_get_type (void)
+{
+   static GType type_id = 0;
+   static gsize initialized = FALSE;
+   static const GFlagsValue values[] = {
+      { MONGO_REPLY_NONE,
+        "MONGO_REPLY_NONE", "NONE" },
+      { MONGO_REPLY_CURSOR_NOT_FOUND,
+        "MONGO_REPLY_CURSOR_NOT_FOUND", "CURSOR_NOT_FOUND" },
+      { MONGO_REPLY_QUERY_FAILURE,
+        "MONGO_REPLY_QUERY_FAILURE", "QUERY_FAILURE" },
+      { MONGO_REPLY_SHARD_CONFIG_STALE,
+        "MONGO_REPLY_SHARD_CONFIG_STALE", "SHARD_CONFIG_STALE" },
+      { MONGO_REPLY_AWAIT_CAPABLE,
+        "MONGO_REPLY_AWAIT_CAPABLE", "AWAIT_CAPABLE" },
+      { 0 }
+   };
+
+   if (g_once_init_enter(&initialized)) {
+      type_id = g_flags_register_static("MongoReplyFlags", values);
+      g_once_init_leave(&initialized, TRUE);
+   }
+
+   return type_id;
+}
@@ -0,0 +1,76 @@
+/* mongo-reply.h
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MONGO_REPLY_H
+#define MONGO_REPLY_H
+
+#include <glib-object.h>
+
+#include "mongo-bson.h"
+
+G_BEGIN_DECLS
+
+#define MONGO_TYPE_REPLY       (mongo_reply_get_type())
+#define MONGO_TYPE_REPLY_FLAGS (mongo_reply_flags_get_type())
+
+typedef struct _MongoReply     MongoReply;
+typedef enum   _MongoReplyFlags MongoReplyFlags;
+
+enum _MongoReplyFlags
+{
+   MONGO_REPLY_NONE               = 0,
+   MONGO_REPLY_CURSOR_NOT_FOUND   = 1 << 0,
+   MONGO_REPLY_QUERY_FAILURE      = 1 << 1,
+   MONGO_REPLY_SHARD_CONFIG_STALE = 1 << 2,
+   MONGO_REPLY_AWAIT_CAPABLE      = 1 << 3,
+};
+
+/**
+ * MongoReply:
+ * @flags: The #MongoReplyFlags set by the server.
+ * @cursor_id: The cursor to use with %MONGO_OPERATION_GET_MORE, or 0 if
+ *   the cursor is exhausted.
+ * @starting_from: The position of the first document in the cursor.
+ * @n_documents: The number of documents in @documents.
+ * @documents: (array length=n_documents): The documents of the reply.
+ *
+ * An OP_REPLY message received from the server. The fields should be
+ * considered read-only.
+ */
+struct _MongoReply
+{
+   MongoReplyFlags   flags;
+   guint64           cursor_id;
+   guint32           starting_from;
+   guint             n_documents;
+   MongoBson       **documents;
+
+   /*< private >*/
+   volatile gint     ref_count;
+};
+
+GType       mongo_reply_flags_get_type (void) G_GNUC_CONST;
+GType       mongo_reply_get_type       (void) G_GNUC_CONST;
+MongoReply *mongo_reply_new_from_data  (const guint8 *data,
+                                        gsize         length);
+MongoReply *mongo_reply_ref            (MongoReply   *reply);
+void        mongo_reply_unref          (MongoReply   *reply);
+
+G_END_DECLS
+
+#endif /* MONGO_REPLY_H */
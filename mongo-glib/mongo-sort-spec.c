@@ -0,0 +1,577 @@
+/* mongo-sort-spec.c
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <glib/gi18n.h>
+#include <string.h>
+
+#include "mongo-bson-private.h"
+#include "mongo-sort-spec.h"
+
+/*
+ * Sort keys are built so that memcmp() of two keys orders them the same
+ * way mongo_bson_raw_iter_compare_value() orders the fields they were
+ * built from. Every value starts with the bracket of its type, followed
+ * by a body that is prefix-free so that keys for several fields can be
+ * concatenated:
+ *
+ *   numbers     ordered double (16 bytes, see below)
+ *   strings     bytes, then 0x00 (strings never contain 0x00)
+ *   documents   per element: bracket + 1, key, 0x00, value; then 0x00
+ *   object ids  12 raw bytes
+ *   booleans    0x00 or 0x01
+ *   dates       big-endian int64 with the sign bit flipped
+ *   timestamps  big-endian uint64
+ *   regexes     pattern, 0x00, options, 0x00
+ *   dbpointers  collection, 0x00, 12 raw bytes
+ *   javascript  code, 0x00, then the scope as a document if any
+ *   min/max key nothing
+ *
+ * The bytes of descending fields are inverted, which reverses their order
+ * since no encoding is a prefix of another.
+ */
+
+#define SIGN_BIT G_GUINT64_CONSTANT(0x8000000000000000)
+
+typedef struct
+{
+   gchar    **path;
+   gboolean   descending;
+} MongoSortField;
+
+struct _MongoSortSpec
+{
+   volatile gint   ref_count;
+   MongoSortField *fields;
+   guint           n_fields;
+};
+
+static inline void
+mongo_sort_spec_append_uint64 (GByteArray *key,
+                               guint64     value)
+{
+   value = GUINT64_TO_BE(value);
+   g_byte_array_append(key, (const guint8 *)&value, sizeof value);
+}
+
+static inline void
+mongo_sort_spec_append_int64 (GByteArray *key,
+                              gint64      value)
+{
+   mongo_sort_spec_append_uint64(key, ((guint64)value) ^ SIGN_BIT);
+}
+
+/**
+ * mongo_sort_spec_append_double:
+ * @key: (in): A #GByteArray.
+ * @value: (in): A double that is not NaN.
+ *
+ * Appends @value so that its bytes sort in numeric order. Negative
+ * numbers have all of their bits flipped and positive numbers only the
+ * sign bit.
+ */
+static inline void
+mongo_sort_spec_append_double (GByteArray *key,
+                               gdouble     value)
+{
+   guint64 bits;
+
+   if (value == 0.0) {
+      value = 0.0; /* Fold -0.0 into 0.0 */
+   }
+
+   memcpy(&bits, &value, sizeof bits);
+   bits = (bits & SIGN_BIT) ? ~bits : (bits | SIGN_BIT);
+   mongo_sort_spec_append_uint64(key, bits);
+}
+
+/**
+ * mongo_sort_spec_append_number:
+ * @key: (in): A #GByteArray.
+ * @iter: (in): A #MongoBsonRawIter positioned on a number.
+ *
+ * Appends a number as the closest double followed by the exact distance
+ * of the value from that double. Integers that do not fit in a double
+ * keep their precision in the second part and every double has a
+ * distance of zero, so 1, 1L and 1.0 encode alike. NaN is encoded as zero
+ * bytes, which sort before negative infinity.
+ */
+static void
+mongo_sort_spec_append_number (GByteArray             *key,
+                               const MongoBsonRawIter *iter)
+{
+   MongoDecimal128 decimal;
+   gdouble dvalue;
+   gint64 ivalue;
+
+   switch (iter->type) {
+   case MONGO_BSON_INT32:
+      mongo_sort_spec_append_double(key, mongo_bson_raw_iter_get_value_int(iter));
+      mongo_sort_spec_append_int64(key, 0);
+      break;
+   case MONGO_BSON_INT64:
+      ivalue = mongo_bson_raw_iter_get_value_int64(iter);
+      dvalue = (gdouble)ivalue;
+      mongo_sort_spec_append_double(key, dvalue);
+      if (dvalue >= 9223372036854775808.0) {
+         mongo_sort_spec_append_int64(key, (gint64)((guint64)ivalue - SIGN_BIT));
+      } else {
+         mongo_sort_spec_append_int64(key, ivalue - (gint64)dvalue);
+      }
+      break;
+   case MONGO_BSON_DECIMAL128:
+      mongo_bson_raw_iter_get_value_decimal128(iter, &decimal);
+      dvalue = mongo_decimal128_to_double(&decimal);
+      if (dvalue != dvalue) {
+         mongo_sort_spec_append_uint64(key, 0);
+      } else {
+         mongo_sort_spec_append_double(key, dvalue);
+      }
+      mongo_sort_spec_append_int64(key, 0);
+      break;
+   default:
+      dvalue = mongo_bson_raw_iter_get_value_double(iter);
+      if (dvalue != dvalue) {
+         mongo_sort_spec_append_uint64(key, 0);
+      } else {
+         mongo_sort_spec_append_double(key, dvalue);
+      }
+      mongo_sort_spec_append_int64(key, 0);
+      break;
+   }
+}
+
+static inline void
+mongo_sort_spec_append_cstring (GByteArray  *key,
+                                const gchar *str)
+{
+   g_byte_array_append(key, (const guint8 *)str, strlen(str) + 1);
+}
+
+static void
+mongo_sort_spec_append_value (GByteArray       *key,
+                              MongoBsonRawIter *iter);
+
+static void
+mongo_sort_spec_append_children (GByteArray       *key,
+                                 MongoBsonRawIter *child)
+{
+   guint8 byte;
+
+   /*
+    * The value appended for each child starts with its bracket, so the
+    * marker only needs to be distinct from the terminating zero.
+    */
+   while (mongo_bson_raw_iter_next(child)) {
+      byte = mongo_bson_type_bracket(child->type) + 1;
+      g_byte_array_append(key, &byte, 1);
+      mongo_sort_spec_append_cstring(key, child->key);
+      mongo_sort_spec_append_value(key, child);
+   }
+   byte = 0;
+   g_byte_array_append(key, &byte, 1);
+}
+
+static void
+mongo_sort_spec_append_value (GByteArray       *key,
+                              MongoBsonRawIter *iter)
+{
+   MongoBsonRawIter child;
+   guint32 be32;
+   guint8 byte;
+   gint32 code_len;
+   gint32 buflen;
+   gint64 msec;
+   gsize length;
+
+   byte = mongo_bson_type_bracket(iter->type);
+   g_byte_array_append(key, &byte, 1);
+
+   switch ((MongoBsonType)iter->type) {
+   case MONGO_BSON_DOUBLE:
+   case MONGO_BSON_INT32:
+   case MONGO_BSON_INT64:
+   case MONGO_BSON_DECIMAL128:
+      mongo_sort_spec_append_number(key, iter);
+      break;
+   case MONGO_BSON_UTF8:
+   case MONGO_BSON_SYMBOL:
+   case MONGO_BSON_JAVASCRIPT:
+      mongo_sort_spec_append_cstring(key, (const gchar *)iter->value2);
+      break;
+   case MONGO_BSON_JAVASCRIPT_WITH_SCOPE:
+      mongo_sort_spec_append_cstring(key, (const gchar *)iter->value2 + 4);
+      memcpy(&code_len, iter->value2, sizeof code_len);
+      memset(&child, 0, sizeof child);
+      child.data = iter->value2 + 4 + GINT32_FROM_LE(code_len);
+      memcpy(&buflen, child.data, sizeof buflen);
+      child.length = GINT32_FROM_LE(buflen);
+      child.offset = 4; /* Skip document length */
+      mongo_sort_spec_append_children(key, &child);
+      break;
+   case MONGO_BSON_DOCUMENT:
+   case MONGO_BSON_ARRAY:
+      mongo_bson_raw_iter_recurse(iter, &child);
+      mongo_sort_spec_append_children(key, &child);
+      break;
+   case MONGO_BSON_BINARY:
+      /*
+       * Binary values sort by length first, so the length is written
+       * big-endian ahead of the subtype and the bytes.
+       */
+      mongo_bson_raw_iter_get_value_binary(iter, NULL, &length);
+      be32 = GUINT32_TO_BE(length);
+      g_byte_array_append(key, (const guint8 *)&be32, sizeof be32);
+      g_byte_array_append(key, iter->value1 + 4, length + 1);
+      break;
+   case MONGO_BSON_OBJECT_ID:
+      g_byte_array_append(key, iter->value1, 12);
+      break;
+   case MONGO_BSON_BOOLEAN:
+      byte = !!iter->value1[0];
+      g_byte_array_append(key, &byte, 1);
+      break;
+   case MONGO_BSON_DATE_TIME:
+      memcpy(&msec, iter->value1, sizeof msec);
+      mongo_sort_spec_append_int64(key, GINT64_FROM_LE(msec));
+      break;
+   case MONGO_BSON_TIMESTAMP:
+      mongo_sort_spec_append_uint64(
+         key, mongo_bson_raw_iter_get_value_timestamp(iter, NULL, NULL));
+      break;
+   case MONGO_BSON_DBPOINTER:
+      mongo_sort_spec_append_cstring(key, (const gchar *)iter->value1 + 4);
+      g_byte_array_append(key, iter->value2, 12);
+      break;
+   case MONGO_BSON_REGEX:
+      mongo_sort_spec_append_cstring(key, (const gchar *)iter->value1);
+      mongo_sort_spec_append_cstring(key, (const gchar *)iter->value2);
+      break;
+   case MONGO_BSON_NULL:
+   case MONGO_BSON_UNDEFINED:
+   case MONGO_BSON_MAX_KEY:
+   case MONGO_BSON_MIN_KEY:
+   default:
+      break;
+   }
+}
+
+/**
+ * mongo_sort_spec_lookup:
+ * @bson: (in): A #MongoBson.
+ * @path: (in): The components of a dotted key path.
+ * @iter: (out): A location for a #MongoBsonRawIter.
+ *
+ * Walks @bson along @path, descending into documents and arrays for each
+ * component but the last.
+ *
+ * Returns: %TRUE if the field exists and @iter is positioned on it.
+ */
+static gboolean
+mongo_sort_spec_lookup (MongoBson         *bson,
+                        gchar            **path,
+                        MongoBsonRawIter  *iter)
+{
+   MongoBsonRawIter child;
+
+   mongo_bson_raw_iter_init(iter, bson);
+
+   for (;;) {
+      if (!mongo_bson_raw_iter_find(iter, *path)) {
+         return FALSE;
+      }
+      if (!*++path) {
+         return TRUE;
+      }
+      if (!mongo_bson_raw_iter_recurse(iter, &child)) {
+         return FALSE;
+      }
+      *iter = child;
+   }
+}
+
+/**
+ * mongo_sort_spec_encode:
+ * @spec: (in): A #MongoSortSpec.
+ * @bson: (in): A #MongoBson.
+ * @key: (in): A #GByteArray to append the sort key to.
+ *
+ * Appends the sort key of @bson to @key. Comparing two keys with memcmp()
+ * over their common length, and then by length, orders the documents as
+ * mongo_sort_spec_compare() does. This allows sorting large batches with
+ * plain byte comparisons instead of walking both documents for every
+ * comparison.
+ *
+ * Missing fields sort as %NULL. Fields are compared with
+ * mongo_bson_raw_iter_compare_value(), so arrays are compared as a whole
+ * rather than by their smallest or largest element.
+ */
+void
+mongo_sort_spec_encode (MongoSortSpec *spec,
+                        MongoBson     *bson,
+                        GByteArray    *key)
+{
+   MongoBsonRawIter iter;
+   guint8 byte;
+   guint begin;
+   guint i;
+   guint j;
+
+   g_return_if_fail(spec != NULL);
+   g_return_if_fail(bson != NULL);
+   g_return_if_fail(key != NULL);
+
+   for (i = 0; i < spec->n_fields; i++) {
+      begin = key->len;
+
+      if (mongo_sort_spec_lookup(bson, spec->fields[i].path, &iter)) {
+         mongo_sort_spec_append_value(key, &iter);
+      } else {
+         byte = mongo_bson_type_bracket(MONGO_BSON_NULL);
+         g_byte_array_append(key, &byte, 1);
+      }
+
+      if (spec->fields[i].descending) {
+         for (j = begin; j < key->len; j++) {
+            key->data[j] = ~key->data[j];
+         }
+      }
+   }
+}
+
+/**
+ * mongo_sort_spec_compare:
+ * @spec: (in): A #MongoSortSpec.
+ * @bson: (in): A #MongoBson.
+ * @other: (in): A #MongoBson.
+ *
+ * Compares two documents by the fields of @spec. Use
+ * mongo_sort_spec_encode() when the same documents are compared many
+ * times.
+ *
+ * Returns: Less than zero if @bson sorts before @other, zero if they are
+ *   equal and greater than zero if @bson sorts after @other.
+ */
+gint
+mongo_sort_spec_compare (MongoSortSpec *spec,
+                         MongoBson     *bson,
+                         MongoBson     *other)
+{
+   MongoBsonRawIter null_iter;
+   MongoBsonRawIter a;
+   MongoBsonRawIter b;
+   gint ret;
+   guint i;
+
+   g_return_val_if_fail(spec != NULL, 0);
+   g_return_val_if_fail(bson != NULL, 0);
+   g_return_val_if_fail(other != NULL, 0);
+
+   memset(&null_iter, 0, sizeof null_iter);
+   null_iter.type = MONGO_BSON_NULL;
+
+   for (i = 0; i < spec->n_fields; i++) {
+      if (!mongo_sort_spec_lookup(bson, spec->fields[i].path, &a)) {
+         a = null_iter;
+      }
+      if (!mongo_sort_spec_lookup(other, spec->fields[i].path, &b)) {
+         b = null_iter;
+      }
+      if ((ret = mongo_bson_raw_iter_compare_value(&a, &b))) {
+         return spec->fields[i].descending ? -ret : ret;
+      }
+   }
+
+   return 0;
+}
+
+/**
+ * mongo_sort_spec_get_n_fields:
+ * @spec: (in): A #MongoSortSpec.
+ *
+ * Fetches the number of fields in the sort specification.
+ *
+ * Returns: The number of fields.
+ */
+guint
+mongo_sort_spec_get_n_fields (MongoSortSpec *spec)
+{
+   g_return_val_if_fail(spec != NULL, 0);
+   return spec->n_fields;
+}
+
+/**
+ * mongo_sort_spec_new:
+ * @spec: (in): A #MongoBson such as {"a": 1, "b.c": -1}.
+ * @error: (out): A location for a #GError, or %NULL.
+ *
+ * Compiles a sort specification. Each field of @spec names a key path
+ * to sort by, with dots separating the keys of nested documents. A
+ * positive number sorts the field in ascending order and a negative
+ * number in descending order.
+ *
+ * Returns: (transfer full): A #MongoSortSpec, or %NULL if @spec is not a
+ *   valid sort specification and @error is set.
+ */
+MongoSortSpec *
+mongo_sort_spec_new (MongoBson  *spec,
+                     GError    **error)
+{
+   MongoBsonRawIter iter;
+   MongoSortSpec *ret;
+   gdouble direction;
+   GArray *fields;
+   MongoSortField field;
+
+   g_return_val_if_fail(spec != NULL, NULL);
+
+   fields = g_array_new(FALSE, FALSE, sizeof(MongoSortField));
+
+   mongo_bson_raw_iter_init(&iter, spec);
+   while (mongo_bson_raw_iter_next(&iter)) {
+      switch (iter.type) {
+      case MONGO_BSON_INT32:
+         direction = mongo_bson_raw_iter_get_value_int(&iter);
+         break;
+      case MONGO_BSON_INT64:
+         direction = mongo_bson_raw_iter_get_value_int64(&iter);
+         break;
+      case MONGO_BSON_DOUBLE:
+         direction = mongo_bson_raw_iter_get_value_double(&iter);
+         break;
+      default:
+         direction = 0.0;
+         break;
+      }
+
+      if (!(direction < 0.0) && !(direction > 0.0)) {
+         g_set_error(error, MONGO_SORT_SPEC_ERROR,
+                     MONGO_SORT_SPEC_ERROR_INVALID_SPEC,
+                     _("The sort direction of \"%s\" must be a non-zero "
+                       "number."), iter.key);
+         goto failure;
+      }
+
+      if (!*iter.key ||
+          g_str_has_prefix(iter.key, ".") ||
+          g_str_has_suffix(iter.key, ".") ||
+          strstr(iter.key, "..")) {
+         g_set_error(error, MONGO_SORT_SPEC_ERROR,
+                     MONGO_SORT_SPEC_ERROR_INVALID_SPEC,
+                     _("\"%s\" is not a valid key path."), iter.key);
+         goto failure;
+      }
+
+      field.path = g_strsplit(iter.key, ".", 0);
+      field.descending = (direction < 0.0);
+      g_array_append_val(fields, field);
+   }
+
+   if (!fields->len) {
+      g_set_error(error, MONGO_SORT_SPEC_ERROR,
+                  MONGO_SORT_SPEC_ERROR_INVALID_SPEC,
+                  _("The sort specification is empty."));
+      goto failure;
+   }
+
+   ret = g_slice_new0(MongoSortSpec);
+   ret->ref_count = 1;
+   ret->n_fields = fields->len;
+   ret->fields = (MongoSortField *)g_array_free(fields, FALSE);
+
+   return ret;
+
+failure:
+   while (fields->len) {
+      g_strfreev(g_array_index(fields, MongoSortField, fields->len - 1).path);
+      g_array_remove_index(fields, fields->len - 1);
+   }
+   g_array_free(fields, TRUE);
+
+   return NULL;
+}
+
+/**
+ * mongo_sort_spec_ref:
+ * @spec: (in): A #MongoSortSpec.
+ *
+ * Increments the reference count of @spec by one.
+ *
+ * Returns: (transfer full): @spec.
+ */
+MongoSortSpec *
+mongo_sort_spec_ref (MongoSortSpec *spec)
+{
+   g_return_val_if_fail(spec != NULL, NULL);
+   g_return_val_if_fail(spec->ref_count > 0, NULL);
+
+   g_atomic_int_inc(&spec->ref_count);
+   return spec;
+}
+
+/**
+ * mongo_sort_spec_unref:
+ * @spec: (in): A #MongoSortSpec.
+ *
+ * Decrements the reference count of @spec by one. When the reference
+ * count reaches zero, the structure is freed.
+ */
+void
+mongo_sort_spec_unref (MongoSortSpec *spec)
+{
+   guint i;
+
+   g_return_if_fail(spec != NULL);
+   g_return_if_fail(spec->ref_count > 0);
+
+   if (g_atomic_int_dec_and_test(&spec->ref_count)) {
+      for (i = 0; i < spec->n_fields; i++) {
+         g_strfreev(spec->fields[i].path);
+      }
+      g_free(spec->fields);
+      g_slice_free(MongoSortSpec, spec);
+   }
+}
+
+/**
+ * mongo_sort_spec_get_type:
+ *
+ * Retrieve the #GType for the #MongoSortSpec boxed type.
+ *
+ * Returns: A #GType.
+ */
+GType
+mongo_sort_spec_get_type (void)
+{
+   static GType type_id = 0;
+   static gsize initialized = FALSE;
+
+   if (g_once_init_enter(&initialized)) {
+      type_id = g_boxed_type_register_static("MongoSortSpec",
+         (GBoxedCopyFunc)mongo_sort_spec_ref,
+         (GBoxedFreeFunc)mongo_sort_spec_unref);
+      g_once_init_leave(&initialized, TRUE);
+   }
+
+   return type_id;
+}
+
+GQuark
+mongo_sort_spec_error_quark (void)
+{
+   return g_quark_from_static_string("mongo_sort_spec_error_quark");
+}
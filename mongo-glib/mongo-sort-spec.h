@@ -0,0 +1,55 @@
+/* mongo-sort-spec.h
+ *
+ * Copyright (C) 2011 Christian Hergert <christian@catch.com>
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MONGO_SORT_SPEC_H
+#define MONGO_SORT_SPEC_H
+
+#include <glib-object.h>
+
+#include "mongo-bson.h"
+
+G_BEGIN_DECLS
+
+#define MONGO_TYPE_SORT_SPEC  (mongo_sort_spec_get_type())
+#define MONGO_SORT_SPEC_ERROR (mongo_sort_spec_error_quark())
+
+typedef struct _MongoSortSpec     MongoSortSpec;
+typedef enum   _MongoSortSpecError MongoSortSpecError;
+
+enum _MongoSortSpecError
+{
+   MONGO_SORT_SPEC_ERROR_INVALID_SPEC = 1,
+};
+
+gint           mongo_sort_spec_compare         (MongoSortSpec  *spec,
+                                                MongoBson      *bson,
+                                                MongoBson      *other);
+void           mongo_sort_spec_encode          (MongoSortSpec  *spec,
+                                                MongoBson      *bson,
+                                                GByteArray     *key);
+GQuark         mongo_sort_spec_error_quark     (void) G_GNUC_CONST;
+guint          mongo_sort_spec_get_n_fields    (MongoSortSpec  *spec);
+GType          mongo_sort_spec_get_type        (void) G_GNUC_CONST;
+MongoSortSpec *mongo_sort_spec_new             (MongoBson      *spec,
+                                                GError        **error);
+MongoSortSpec *mongo_sort_spec_ref             (MongoSortSpec  *spec);
+void           mongo_sort_spec_unref           (MongoSortSpec  *spec);
+
+G_END_DECLS
+
+#endif /* MONGO_SORT_SPEC_H */
@@ -0,0 +1,164 @@
+#include <string.h>
+
+#include "mock-server.h"
+
+/*
+ * A minimal server for testing the client without mongod. It accepts one
+ * connection and answers each message with the reply from its handler.
+ */
+
+static gpointer
+mock_server_thread (gpointer data)
+{
+   GSocketConnection *connection;
+   GOutputStream *output;
+   GInputStream *input;
+   MockServer *server = data;
+   GByteArray *reply;
+   guint32 header[4];
+   guint8 *body;
+   GError *error = NULL;
+   gsize length;
+
+   connection = g_socket_listener_accept(server->listener, NULL, NULL, &error);
+   g_assert_no_error(error);
+   input = g_io_stream_get_input_stream(G_IO_STREAM(connection));
+   output = g_io_stream_get_output_stream(G_IO_STREAM(connection));
+
+   while (!server->done) {
+      g_assert(g_input_stream_read_all(input, header, sizeof header, NULL,
+                                       NULL, &error));
+      g_assert_no_error(error);
+      length = GUINT32_FROM_LE(header[0]) - sizeof header;
+      body = g_malloc(length);
+      g_assert(g_input_stream_read_all(input, body, length, NULL,
+                                       NULL, &error));
+      g_assert_no_error(error);
+
+      reply = server->handler(server, server->n_messages++,
+                              GUINT32_FROM_LE(header[3]), body, length);
+      if (reply) {
+         header[0] = GUINT32_TO_LE(sizeof header + reply->len);
+         header[2] = header[1];
+         header[1] = 0;
+         header[3] = GUINT32_TO_LE(1);
+         g_assert(g_output_stream_write_all(output, header, sizeof header,
+                                            NULL, NULL, &error));
+         g_assert(g_output_stream_write_all(output, reply->data, reply->len,
+                                            NULL, NULL, &error));
+         g_assert_no_error(error);
+         g_byte_array_free(reply, TRUE);
+      }
+
+      g_free(body);
+   }
+
+   g_io_stream_close(G_IO_STREAM(connection), NULL, NULL);
+   g_object_unref(connection);
+
+   return NULL;
+}
+
+void
+mock_server_start (MockServer  *server,
+                   MockHandler  handler)
+{
+   GError *error = NULL;
+
+   memset(server, 0, sizeof *server);
+   server->handler = handler;
+   server->listener = g_socket_listener_new();
+   server->port = g_socket_listener_add_any_inet_port(server->listener,
+                                                      NULL, &error);
+   g_assert_no_error(error);
+   server->thread = g_thread_new("mock-server", mock_server_thread, server);
+}
+
+void
+mock_server_stop (MockServer *server)
+{
+   g_thread_join(server->thread);
+   g_socket_listener_close(server->listener);
+   g_object_unref(server->listener);
+}
+
+GByteArray *
+mock_reply (MongoReplyFlags  flags,
+            guint64          cursor_id,
+            const gchar     *json[],
+            guint            n_json)
+{
+   GByteArray *reply;
+   MongoBson *bson;
+   const guint8 *data;
+   GError *error = NULL;
+   guint32 header[5];
+   gsize length;
+   guint i;
+
+   header[0] = GUINT32_TO_LE(flags);
+   cursor_id = GUINT64_TO_LE(cursor_id);
+   memcpy(&header[1], &cursor_id, sizeof cursor_id);
+   header[3] = 0;
+   header[4] = GUINT32_TO_LE(n_json);
+
+   reply = g_byte_array_new();
+   g_byte_array_append(reply, (guint8 *)header, sizeof header);
+   for (i = 0; i < n_json; i++) {
+      bson = mongo_bson_new_from_json(json[i], -1, &error);
+      g_assert_no_error(error);
+      data = mongo_bson_get_data(bson, &length);
+      g_byte_array_append(reply, data, length);
+      mongo_bson_unref(bson);
+   }
+
+   return reply;
+}
+
+GByteArray *
+mock_ismaster (guint32       op,
+               const guint8 *body)
+{
+   static const gchar *ismaster[] = { "{\"ismaster\": true, \"ok\": 1}" };
+
+   g_assert_cmpint(op, ==, MONGO_OPERATION_QUERY);
+   g_assert_cmpstr((const gchar *)body + 4, ==, "admin.$cmd");
+
+   return mock_reply(MONGO_REPLY_NONE, 0, ismaster, 1);
+}
+
+/*
+ * Returns the query of an OP_QUERY body and checks that it is for the
+ * oplog, which is the collection all of the tests use.
+ */
+MongoBson *
+mock_parse_query (const guint8 *body,
+                  gsize         length,
+                  guint32      *flags,
+                  gint32       *limit)
+{
+   const gchar *collection = (const gchar *)body + 4;
+   const guint8 *data;
+
+   g_assert_cmpstr(collection, ==, "local.oplog.rs");
+   memcpy(flags, body, sizeof *flags);
+   data = body + 4 + strlen(collection) + 1;
+   memcpy(limit, data + 4, sizeof *limit);
+   data += 8;
+   return mongo_bson_new_from_data(data, length - (data - body));
+}
+
+guint64
+mock_parse_get_more (const guint8 *body,
+                     gint32       *limit)
+{
+   const gchar *collection = (const gchar *)body + 4;
+   const guint8 *data;
+   guint64 cursor_id;
+
+   g_assert_cmpstr(collection, ==, "local.oplog.rs");
+   data = body + 4 + strlen(collection) + 1;
+   memcpy(limit, data, sizeof *limit);
+   memcpy(&cursor_id, data + 4, sizeof cursor_id);
+   return cursor_id;
+}
@@ -0,0 +1,48 @@
+#ifndef MOCK_SERVER_H
+#define MOCK_SERVER_H
+
+#include <mongo-glib/mongo-glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _MockServer MockServer;
+
+/*
+ * Handles message @index received by the mock server and returns the body
+ * of the reply, or NULL if the message has no reply.
+ */
+typedef GByteArray *(*MockHandler) (MockServer   *server,
+                                    guint         index,
+                                    guint32       op,
+                                    const guint8 *body,
+                                    gsize         length);
+
+struct _MockServer
+{
+   GSocketListener *listener;
+   GThread         *thread;
+   MockHandler      handler;
+   guint16          port;
+   guint            n_messages;
+   gboolean         done;
+};
+
+void        mock_server_start   (MockServer      *server,
+                                 MockHandler      handler);
+void        mock_server_stop    (MockServer      *server);
+GByteArray *mock_reply          (MongoReplyFlags  flags,
+                                 guint64          cursor_id,
+                                 const gchar     *json[],
+                                 guint            n_json);
+GByteArray *mock_ismaster       (guint32          op,
+                                 const guint8    *body);
+MongoBson  *mock_parse_query    (const guint8    *body,
+                                 gsize            length,
+                                 guint32         *flags,
+                                 gint32          *limit);
+guint64     mock_parse_get_more (const guint8    *body,
+                                 gint32          *limit);
+
+G_END_DECLS
+
+#endif /* MOCK_SERVER_H */
@@ -0,0 +1,292 @@
+#include <mongo-glib/mongo-glib.h>
+#include <mongo-glib/mongo-bson-columns-private.h>
+#include <math.h>
+#include <string.h>
+
+static GPtrArray *
+get_documents (void)
+{
+   static const gchar *json[] = {
+      "{\"n\": 1, \"x\": 1.5, \"name\": \"alpha\", \"m\": {\"t\": [7, 8]}}",
+      "{\"n\": {\"$numberLong\": \"2\"}, \"x\": 2, \"m\": {\"t\": [9]}}",
+      "{\"x\": \"nan\", \"name\": \"\", \"n\": true}",
+      "{\"name\": \"gamma\", \"n\": {\"$date\": {\"$numberLong\": \"4\"}}, "
+      "\"x\": {\"$numberLong\": \"-3\"}, \"name\": \"delta\"}",
+   };
+   GPtrArray *documents;
+   MongoBson *bson;
+   GError *error = NULL;
+   guint i;
+
+   documents = g_ptr_array_new_with_free_func((GDestroyNotify)mongo_bson_unref);
+   for (i = 0; i < G_N_ELEMENTS(json); i++) {
+      bson = mongo_bson_new_from_json(json[i], -1, &error);
+      g_assert_no_error(error);
+      g_ptr_array_add(documents, bson);
+   }
+
+   return documents;
+}
+
+static void
+extract_tests (void)
+{
+   static const gchar *paths[] = { "n", "x", "name", "m.t.0", "m.t" };
+   static const MongoBsonColumnType types[] = {
+      MONGO_BSON_COLUMN_INT64,
+      MONGO_BSON_COLUMN_DOUBLE,
+      MONGO_BSON_COLUMN_STRING,
+      MONGO_BSON_COLUMN_INT64,
+      MONGO_BSON_COLUMN_DOUBLE,
+   };
+   MongoBsonColumns *columns;
+   const guint32 *offsets;
+   const gdouble *doubles;
+   const gint64 *ints;
+   const gchar *strings;
+   GPtrArray *documents;
+   gsize length;
+   guint pass;
+
+   documents = get_documents();
+   columns = mongo_bson_columns_new(paths, types, G_N_ELEMENTS(paths));
+   g_assert_cmpint(mongo_bson_columns_get_n_columns(columns), ==, 5);
+   g_assert_cmpstr(mongo_bson_columns_get_path(columns, 3), ==, "m.t.0");
+
+   /*
+    * The second pass checks that extracting again starts over.
+    */
+   for (pass = 0; pass < 2; pass++) {
+      mongo_bson_columns_extract(columns, (MongoBson **)documents->pdata,
+                                 documents->len);
+      g_assert_cmpint(mongo_bson_columns_get_n_rows(columns), ==, 4);
+
+      ints = mongo_bson_columns_get_int64(columns, 0);
+      g_assert_cmpint(ints[0], ==, 1);
+      g_assert_cmpint(ints[1], ==, 2);
+      g_assert_cmpint(ints[3], ==, 4);
+      g_assert(mongo_bson_columns_is_null(columns, 0, 2));
+      g_assert_cmpint(mongo_bson_columns_get_null_count(columns, 0), ==, 1);
+      g_assert_cmpint(mongo_bson_columns_get_validity(columns, 0)[0], ==, 0xB);
+
+      doubles = mongo_bson_columns_get_double(columns, 1);
+      g_assert_cmpfloat(doubles[0], ==, 1.5);
+      g_assert_cmpfloat(doubles[1], ==, 2.0);
+      g_assert_cmpfloat(doubles[3], ==, -3.0);
+      g_assert(mongo_bson_columns_is_null(columns, 1, 2));
+
+      offsets = mongo_bson_columns_get_string_offsets(columns, 2);
+      strings = mongo_bson_columns_get_string_data(columns, 2, &length);
+      g_assert_cmpint(length, ==, 10);
+      g_assert_cmpint(offsets[0], ==, 0);
+      g_assert_cmpint(offsets[1], ==, 5);
+      g_assert_cmpint(offsets[2], ==, 5);
+      g_assert_cmpint(offsets[3], ==, 5);
+      g_assert_cmpint(offsets[4], ==, 10);
+      g_assert(!memcmp(strings, "alphadelta", 10));
+      g_assert(!mongo_bson_columns_is_null(columns, 2, 0));
+      g_assert(mongo_bson_columns_is_null(columns, 2, 1));
+      g_assert(!mongo_bson_columns_is_null(columns, 2, 2));
+
+      ints = mongo_bson_columns_get_int64(columns, 3);
+      g_assert_cmpint(ints[0], ==, 7);
+      g_assert_cmpint(ints[1], ==, 9);
+      g_assert_cmpint(mongo_bson_columns_get_null_count(columns, 3), ==, 2);
+
+      g_assert_cmpint(mongo_bson_columns_get_null_count(columns, 4), ==, 4);
+   }
+
+   mongo_bson_columns_clear(columns);
+   g_assert_cmpint(mongo_bson_columns_get_n_rows(columns), ==, 0);
+   g_assert(!mongo_bson_columns_get_validity(columns, 0));
+
+   mongo_bson_columns_unref(columns);
+   g_ptr_array_unref(documents);
+}
+
+static void
+many_rows_tests (void)
+{
+   static const gchar *paths[] = { "i" };
+   static const MongoBsonColumnType types[] = { MONGO_BSON_COLUMN_INT64 };
+   MongoBsonColumns *columns;
+   const gint64 *ints;
+   MongoBson *bson;
+   guint i;
+
+   columns = mongo_bson_columns_new(paths, types, 1);
+
+   for (i = 0; i < 1000; i++) {
+      bson = mongo_bson_new();
+      if (i % 3) {
+         mongo_bson_append_int(bson, "i", i);
+      }
+      mongo_bson_columns_append(columns, bson);
+      mongo_bson_unref(bson);
+   }
+
+   g_assert_cmpint(mongo_bson_columns_get_n_rows(columns), ==, 1000);
+   g_assert_cmpint(mongo_bson_columns_get_null_count(columns, 0), ==, 334);
+
+   ints = mongo_bson_columns_get_int64(columns, 0);
+   for (i = 0; i < 1000; i++) {
+      g_assert_cmpint(mongo_bson_columns_is_null(columns, 0, i), ==, !(i % 3));
+      g_assert_cmpint(ints[i], ==, (i % 3) ? i : 0);
+   }
+
+   mongo_bson_columns_unref(columns);
+}
+
+static void
+aggregate_tests (gconstpointer data)
+{
+   static const gchar *paths[] = { "d", "i" };
+   static const MongoBsonColumnType types[] = {
+      MONGO_BSON_COLUMN_DOUBLE,
+      MONGO_BSON_COLUMN_INT64,
+   };
+   MongoBsonColumns *columns;
+   MongoBson *bson;
+   guint64 bins[4];
+   gdouble expected_min;
+   gdouble expected_max;
+   gdouble expected_sum;
+   gint64 expected_isum;
+   gint64 expected_imin;
+   gint64 expected_imax;
+   gint64 ivalue;
+   gdouble value;
+   gdouble mean;
+   gdouble min;
+   gdouble max;
+   gint64 imin;
+   gint64 imax;
+   guint n_rows;
+   guint count;
+   guint i;
+
+   /*
+    * Every kernel the CPU supports is checked against the same results.
+    */
+   if (!mongo_bson_columns_lookup_kernels(data)) {
+      g_test_message("%s kernels are not supported", (const gchar *)data);
+      return;
+   }
+   mongo_bson_columns_set_kernels(mongo_bson_columns_lookup_kernels(data));
+
+   columns = mongo_bson_columns_new(paths, types, 2);
+
+   /*
+    * Exercise every alignment of the vector loops and their tails.
+    */
+   for (n_rows = 0; n_rows < 40; n_rows++) {
+      mongo_bson_columns_clear(columns);
+      expected_min = G_MAXDOUBLE;
+      expected_max = -G_MAXDOUBLE;
+      expected_sum = 0.0;
+      expected_isum = 0;
+      expected_imin = G_MAXINT64;
+      expected_imax = G_MININT64;
+      count = 0;
+
+      for (i = 0; i < n_rows; i++) {
+         bson = mongo_bson_new();
+         if ((i % 5) != 3) {
+            value = (gdouble)((gint)(i * 7) % 23) - 11.0;
+            ivalue = ((gint64)i - 20) * G_GINT64_CONSTANT(10000000000);
+            mongo_bson_append_double(bson, "d", value);
+            mongo_bson_append_int64(bson, "i", ivalue);
+            expected_min = MIN(expected_min, value);
+            expected_max = MAX(expected_max, value);
+            expected_sum += value;
+            expected_isum += ivalue;
+            expected_imin = MIN(expected_imin, ivalue);
+            expected_imax = MAX(expected_imax, ivalue);
+            count++;
+         }
+         mongo_bson_columns_append(columns, bson);
+         mongo_bson_unref(bson);
+      }
+
+      g_assert_cmpint(mongo_bson_columns_count(columns, 0), ==, count);
+      g_assert_cmpfloat(mongo_bson_columns_sum(columns, 0), ==, expected_sum);
+      g_assert_cmpfloat(mongo_bson_columns_sum(columns, 1), ==,
+                        (gdouble)expected_isum);
+      g_assert_cmpint(mongo_bson_columns_sum_int64(columns, 1), ==,
+                      expected_isum);
+
+      if (!count) {
+         g_assert(!mongo_bson_columns_min_max(columns, 0, &min, &max));
+         g_assert(!mongo_bson_columns_mean(columns, 0, &mean));
+         continue;
+      }
+
+      g_assert(mongo_bson_columns_min_max(columns, 0, &min, &max));
+      g_assert_cmpfloat(min, ==, expected_min);
+      g_assert_cmpfloat(max, ==, expected_max);
+      g_assert(mongo_bson_columns_mean(columns, 0, &mean));
+      g_assert_cmpfloat(mean, ==, expected_sum / count);
+
+      g_assert(mongo_bson_columns_min_max(columns, 1, &min, &max));
+      g_assert_cmpfloat(min, ==, (gdouble)expected_imin);
+      g_assert_cmpfloat(max, ==, (gdouble)expected_imax);
+      g_assert(mongo_bson_columns_min_max_int64(columns, 1, &imin, &imax));
+      g_assert_cmpint(imin, ==, expected_imin);
+      g_assert_cmpint(imax, ==, expected_imax);
+   }
+
+   /*
+    * Integers above 2^53 are only exact in the int64 variants.
+    */
+   mongo_bson_columns_clear(columns);
+   for (i = 0; i < 9; i++) {
+      bson = mongo_bson_new();
+      mongo_bson_append_int64(bson, "i", (G_GINT64_CONSTANT(1) << 53) + i);
+      mongo_bson_columns_append(columns, bson);
+      mongo_bson_unref(bson);
+   }
+   g_assert_cmpint(mongo_bson_columns_sum_int64(columns, 1), ==,
+                   (G_GINT64_CONSTANT(9) << 53) + 36);
+   g_assert(mongo_bson_columns_min_max_int64(columns, 1, &imin, &imax));
+   g_assert_cmpint(imin, ==, G_GINT64_CONSTANT(1) << 53);
+   g_assert_cmpint(imax, ==, (G_GINT64_CONSTANT(1) << 53) + 8);
+
+   mongo_bson_columns_unref(columns);
+
+   columns = mongo_bson_columns_new(paths, types, 1);
+   for (i = 0; i < 10; i++) {
+      bson = mongo_bson_new();
+      mongo_bson_append_double(bson, "d", (i == 4) ? NAN : i);
+      mongo_bson_columns_append(columns, bson);
+      mongo_bson_unref(bson);
+   }
+
+   g_assert(mongo_bson_columns_min_max(columns, 0, &min, &max));
+   g_assert_cmpfloat(min, ==, 0.0);
+   g_assert_cmpfloat(max, ==, 9.0);
+
+   memset(bins, 0, sizeof bins);
+   mongo_bson_columns_histogram(columns, 0, 1.0, 9.0, bins, 4);
+   g_assert_cmpint(bins[0], ==, 2);
+   g_assert_cmpint(bins[1], ==, 1);
+   g_assert_cmpint(bins[2], ==, 2);
+   g_assert_cmpint(bins[3], ==, 2);
+
+   mongo_bson_columns_unref(columns);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_test_init(&argc, &argv, NULL);
+   g_test_add_func("/MongoBsonColumns/extract", extract_tests);
+   g_test_add_func("/MongoBsonColumns/many_rows", many_rows_tests);
+   g_test_add_data_func("/MongoBsonColumns/aggregate/scalar", "scalar",
+                        aggregate_tests);
+   g_test_add_data_func("/MongoBsonColumns/aggregate/sse2", "sse2",
+                        aggregate_tests);
+   g_test_add_data_func("/MongoBsonColumns/aggregate/avx2", "avx2",
+                        aggregate_tests);
+   return g_test_run();
+}
@@ -0,0 +1,200 @@
+#include <mongo-glib/mongo-glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define N_FILES 16
+
+static GByteArray *
+get_all_bson (void)
+{
+   GByteArray *bytes;
+   gchar *filename;
+   gchar *name;
+   gchar *buffer;
+   GError *error = NULL;
+   gsize length;
+   guint i;
+
+   bytes = g_byte_array_new();
+
+   for (i = 1; i <= N_FILES; i++) {
+      name = g_strdup_printf("test%u.bson", i);
+      filename = g_build_filename("tests", "bson", name, NULL);
+      if (!g_file_get_contents(filename, &buffer, &length, &error)) {
+         g_assert_no_error(error);
+         g_assert(FALSE);
+      }
+      g_byte_array_append(bytes, (guint8 *)buffer, length);
+      g_free(buffer);
+      g_free(filename);
+      g_free(name);
+   }
+
+   return bytes;
+}
+
+static gchar *
+write_tmp_file (const guint8 *data,
+                gsize         length)
+{
+   GError *error = NULL;
+   gchar *filename = NULL;
+   gint fd;
+
+   fd = g_file_open_tmp("test-mongo-bson-file-XXXXXX", &filename, &error);
+   g_assert_no_error(error);
+   close(fd);
+
+   g_file_set_contents(filename, (const gchar *)data, length, &error);
+   g_assert_no_error(error);
+
+   return filename;
+}
+
+static gboolean
+count_cb (MongoBsonFile *file,
+          guint          index,
+          MongoBson     *bson,
+          gpointer       user_data)
+{
+   const guint8 *data;
+   const guint8 *expected;
+   gsize expected_length;
+   gsize length;
+   gint *count = user_data;
+
+   data = mongo_bson_get_data(bson, &length);
+   expected = mongo_bson_file_get_data(file, index, &expected_length);
+   g_assert(data == expected);
+   g_assert_cmpint(length, ==, expected_length);
+   g_atomic_int_inc(count);
+
+   return TRUE;
+}
+
+static gboolean
+stop_cb (MongoBsonFile *file,
+         guint          index,
+         MongoBson     *bson,
+         gpointer       user_data)
+{
+   gint *count = user_data;
+
+   g_atomic_int_inc(count);
+   return (index < 2);
+}
+
+static void
+foreach_tests (void)
+{
+   MongoBsonFile *file;
+   GByteArray *bytes;
+   const guint8 *data;
+   GError *error = NULL;
+   gchar *filename;
+   gsize offset = 0;
+   gsize length;
+   gint count = 0;
+   guint i;
+
+   bytes = get_all_bson();
+   filename = write_tmp_file(bytes->data, bytes->len);
+
+   file = mongo_bson_file_new(filename, &error);
+   g_assert_no_error(error);
+   g_assert(file);
+   g_assert_cmpint(mongo_bson_file_get_n_documents(file), ==, N_FILES);
+
+   for (i = 0; i < N_FILES; i++) {
+      data = mongo_bson_file_get_data(file, i, &length);
+      g_assert(!memcmp(data, bytes->data + offset, length));
+      offset += length;
+   }
+   g_assert_cmpint(offset, ==, bytes->len);
+
+   mongo_bson_file_foreach(file, count_cb, &count);
+   g_assert_cmpint(count, ==, N_FILES);
+
+   count = 0;
+   mongo_bson_file_foreach(file, stop_cb, &count);
+   g_assert_cmpint(count, ==, 3);
+
+   mongo_bson_file_unref(file);
+   g_unlink(filename);
+   g_free(filename);
+   g_byte_array_free(bytes, TRUE);
+}
+
+static void
+foreach_parallel_tests (void)
+{
+   MongoBsonFile *file;
+   GByteArray *bytes;
+   GByteArray *single;
+   GError *error = NULL;
+   gchar *filename;
+   gint count = 0;
+   guint i;
+
+   single = get_all_bson();
+   bytes = g_byte_array_new();
+   for (i = 0; i < 64; i++) {
+      g_byte_array_append(bytes, single->data, single->len);
+   }
+   g_byte_array_free(single, TRUE);
+   filename = write_tmp_file(bytes->data, bytes->len);
+
+   file = mongo_bson_file_new(filename, &error);
+   g_assert_no_error(error);
+   g_assert_cmpint(mongo_bson_file_get_n_documents(file), ==, N_FILES * 64);
+
+   g_assert(mongo_bson_file_foreach_parallel(file, 4, count_cb, &count,
+                                             &error));
+   g_assert_no_error(error);
+   g_assert_cmpint(count, ==, N_FILES * 64);
+
+   count = 0;
+   g_assert(mongo_bson_file_foreach_parallel(file, 0, count_cb, &count,
+                                             &error));
+   g_assert_no_error(error);
+   g_assert_cmpint(count, ==, N_FILES * 64);
+
+   mongo_bson_file_unref(file);
+   g_unlink(filename);
+   g_free(filename);
+   g_byte_array_free(bytes, TRUE);
+}
+
+static void
+truncated_tests (void)
+{
+   MongoBsonFile *file;
+   GByteArray *bytes;
+   GError *error = NULL;
+   gchar *filename;
+
+   bytes = get_all_bson();
+   filename = write_tmp_file(bytes->data, bytes->len - 1);
+
+   file = mongo_bson_file_new(filename, &error);
+   g_assert_error(error, MONGO_BSON_FILE_ERROR,
+                  MONGO_BSON_FILE_ERROR_TRUNCATED);
+   g_assert(!file);
+   g_clear_error(&error);
+
+   g_unlink(filename);
+   g_free(filename);
+   g_byte_array_free(bytes, TRUE);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_test_init(&argc, &argv, NULL);
+   g_test_add_func("/MongoBsonFile/foreach", foreach_tests);
+   g_test_add_func("/MongoBsonFile/foreach_parallel", foreach_parallel_tests);
+   g_test_add_func("/MongoBsonFile/truncated", truncated_tests);
+   return g_test_run();
+}
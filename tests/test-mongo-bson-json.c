@@ -0,0 +1,458 @@
+#include <mongo-glib/mongo-glib.h>
+#include <string.h>
+
+static MongoBson *
+get_bson (const gchar *name)
+{
+   MongoBson *bson;
+   gchar *filename;
+   gchar *buffer;
+   GError *error = NULL;
+   gsize length;
+
+   filename = g_build_filename("tests", "bson", name, NULL);
+   if (!g_file_get_contents(filename, &buffer, &length, &error)) {
+      g_assert_no_error(error);
+      g_assert(FALSE);
+   }
+   bson = mongo_bson_new_from_data((const guint8 *)buffer, length);
+   g_free(buffer);
+   g_free(filename);
+
+   return bson;
+}
+
+static void
+assert_json (const gchar       *name,
+             MongoBsonJsonMode  mode,
+             const gchar       *expected)
+{
+   MongoBson *bson;
+   gchar *json;
+
+   bson = get_bson(name);
+   json = mongo_bson_to_json(bson, mode);
+   g_assert_cmpstr(json, ==, expected);
+   g_free(json);
+   mongo_bson_unref(bson);
+}
+
+static void
+relaxed_tests (void)
+{
+   assert_json("test1.bson", MONGO_BSON_JSON_RELAXED, "{\"int\":1}");
+   assert_json("test2.bson", MONGO_BSON_JSON_RELAXED, "{\"int64\":1}");
+   assert_json("test3.bson", MONGO_BSON_JSON_RELAXED, "{\"double\":1.123}");
+   assert_json("test4.bson", MONGO_BSON_JSON_RELAXED,
+               "{\"utc\":{\"$date\":\"2011-10-22T12:13:14.123Z\"}}");
+   assert_json("test5.bson", MONGO_BSON_JSON_RELAXED,
+               "{\"string\":\"some string\"}");
+   assert_json("test6.bson", MONGO_BSON_JSON_RELAXED,
+               "{\"array[int]\":[1,2,3,4,5,6]}");
+   assert_json("test7.bson", MONGO_BSON_JSON_RELAXED,
+               "{\"array[double]\":[1.123,2.123]}");
+   assert_json("test8.bson", MONGO_BSON_JSON_RELAXED,
+               "{\"document\":{\"int\":1}}");
+   assert_json("test9.bson", MONGO_BSON_JSON_RELAXED, "{\"null\":null}");
+   assert_json("test10.bson", MONGO_BSON_JSON_RELAXED,
+               "{\"regex\":{\"$regularExpression\":"
+               "{\"pattern\":\"1234\",\"options\":\"i\"}}}");
+   assert_json("test12.bson", MONGO_BSON_JSON_RELAXED,
+               "{\"BSON\":[\"awesome\",5.05,1986]}");
+   assert_json("test13.bson", MONGO_BSON_JSON_RELAXED,
+               "{\"array[bool]\":[true,false,true]}");
+   assert_json("test15.bson", MONGO_BSON_JSON_RELAXED,
+               "{\"array[datetime]\":["
+               "{\"$date\":\"1970-01-01T00:00:00.000Z\"},"
+               "{\"$date\":\"2011-10-22T12:13:14.123Z\"}]}");
+}
+
+static void
+canonical_tests (void)
+{
+   assert_json("test1.bson", MONGO_BSON_JSON_CANONICAL,
+               "{\"int\":{\"$numberInt\":\"1\"}}");
+   assert_json("test2.bson", MONGO_BSON_JSON_CANONICAL,
+               "{\"int64\":{\"$numberLong\":\"1\"}}");
+   assert_json("test3.bson", MONGO_BSON_JSON_CANONICAL,
+               "{\"double\":{\"$numberDouble\":\"1.123\"}}");
+   assert_json("test4.bson", MONGO_BSON_JSON_CANONICAL,
+               "{\"utc\":{\"$date\":{\"$numberLong\":\"1319285594123\"}}}");
+}
+
+static void
+escape_tests (void)
+{
+   MongoBson *bson;
+   gchar *json;
+
+   bson = mongo_bson_new();
+   mongo_bson_append_string(bson, "quote\"", "a\"b\\c\n\t\x01\xc3\xa9");
+   mongo_bson_append_double(bson, "three", 3.0);
+   mongo_bson_append_double(bson, "zero", -0.0);
+   mongo_bson_append_double(bson, "big", 1e300);
+   mongo_bson_append_double(bson, "inf", 1.0 / 0.0);
+   mongo_bson_append_int64(bson, "min", G_MININT64);
+   mongo_bson_append_undefined(bson, "undefined");
+
+   json = mongo_bson_to_json(bson, MONGO_BSON_JSON_RELAXED);
+   g_assert_cmpstr(json, ==,
+                   "{\"quote\\\"\":\"a\\\"b\\\\c\\n\\t\\u0001\xc3\xa9\","
+                   "\"three\":3.0,"
+                   "\"zero\":-0.0,"
+                   "\"big\":1e+300,"
+                   "\"inf\":{\"$numberDouble\":\"Infinity\"},"
+                   "\"min\":-9223372036854775808,"
+                   "\"undefined\":{\"$undefined\":true}}");
+   g_free(json);
+
+   mongo_bson_unref(bson);
+}
+
+static void
+stream_tests (void)
+{
+   GOutputStream *stream;
+   MongoBson *bson;
+   MongoBson *array;
+   GString *str;
+   GError *error = NULL;
+   gchar *expected;
+   gchar key[16];
+   guint i;
+
+   array = mongo_bson_new();
+   for (i = 0; i < 20000; i++) {
+      g_snprintf(key, sizeof key, "%u", i);
+      mongo_bson_append_int(array, key, i);
+   }
+   bson = mongo_bson_new();
+   mongo_bson_append_array(bson, "values", array);
+
+   stream = g_memory_output_stream_new(NULL, 0, g_realloc, g_free);
+   g_assert(mongo_bson_write_json(bson, MONGO_BSON_JSON_RELAXED, stream,
+                                  NULL, &error));
+   g_assert_no_error(error);
+   g_output_stream_write(stream, "", 1, NULL, &error);
+   g_assert_no_error(error);
+
+   str = g_string_new(NULL);
+   mongo_bson_to_json_string(bson, MONGO_BSON_JSON_RELAXED, str);
+   expected = g_string_free(str, FALSE);
+
+   g_assert_cmpstr(g_memory_output_stream_get_data(
+         G_MEMORY_OUTPUT_STREAM(stream)), ==, expected);
+
+   g_free(expected);
+   g_object_unref(stream);
+   mongo_bson_unref(array);
+   mongo_bson_unref(bson);
+}
+
+static void
+assert_round_trip (const gchar       *name,
+                   MongoBsonJsonMode  mode)
+{
+   MongoBson *bson;
+   MongoBson *parsed;
+   const guint8 *data;
+   const guint8 *parsed_data;
+   GError *error = NULL;
+   gsize length;
+   gsize parsed_length;
+   gchar *json;
+
+   bson = get_bson(name);
+   json = mongo_bson_to_json(bson, mode);
+   parsed = mongo_bson_new_from_json(json, -1, &error);
+   g_assert_no_error(error);
+   g_assert(parsed);
+
+   data = mongo_bson_get_data(bson, &length);
+   parsed_data = mongo_bson_get_data(parsed, &parsed_length);
+   g_assert_cmpint(length, ==, parsed_length);
+   g_assert(!memcmp(data, parsed_data, length));
+
+   mongo_bson_unref(parsed);
+   mongo_bson_unref(bson);
+   g_free(json);
+}
+
+static void
+parse_tests (void)
+{
+   MongoBsonIter iter;
+   MongoBsonIter child;
+   MongoBson *bson;
+   GError *error = NULL;
+   gchar *name;
+   guint i;
+
+   for (i = 1; i <= 16; i++) {
+      name = g_strdup_printf("test%u.bson", i);
+      assert_round_trip(name, MONGO_BSON_JSON_CANONICAL);
+      if (i != 2) {
+         assert_round_trip(name, MONGO_BSON_JSON_RELAXED);
+      }
+      g_free(name);
+   }
+
+   bson = mongo_bson_new_from_json(
+         " { \"a\\u00e9\" : [ 5000000000 , -2147483648, 1.5e3, "
+         "\"x\\ud83d\\ude00\" ], \"$set\": {\"b\": null},"
+         "\"oid\": {\"$oid\": \"4e9e9a2c27c1a8a3ac000001\"},"
+         "\"d\": {\"$date\": \"2011-10-22T14:13:14.123+02:00\"} } ",
+         -1, &error);
+   g_assert_no_error(error);
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpstr(mongo_bson_iter_get_key(&iter), ==, "a\xc3\xa9");
+   g_assert(mongo_bson_iter_recurse(&iter, &child));
+   g_assert(mongo_bson_iter_next(&child));
+   g_assert_cmpint(mongo_bson_iter_get_value_type(&child), ==, MONGO_BSON_INT64);
+   g_assert_cmpint(mongo_bson_iter_get_value_int64(&child), ==, G_GINT64_CONSTANT(5000000000));
+   g_assert(mongo_bson_iter_next(&child));
+   g_assert_cmpint(mongo_bson_iter_get_value_type(&child), ==, MONGO_BSON_INT32);
+   g_assert_cmpint(mongo_bson_iter_get_value_int(&child), ==, G_MININT32);
+   g_assert(mongo_bson_iter_next(&child));
+   g_assert_cmpfloat(mongo_bson_iter_get_value_double(&child), ==, 1500.0);
+   g_assert(mongo_bson_iter_next(&child));
+   g_assert_cmpstr(mongo_bson_iter_get_value_string(&child, NULL), ==, "x\xf0\x9f\x98\x80");
+   g_assert(!mongo_bson_iter_next(&child));
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpstr(mongo_bson_iter_get_key(&iter), ==, "$set");
+   g_assert_cmpint(mongo_bson_iter_get_value_type(&iter), ==, MONGO_BSON_DOCUMENT);
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpint(mongo_bson_iter_get_value_type(&iter), ==, MONGO_BSON_OBJECT_ID);
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpint(mongo_bson_iter_get_value_type(&iter), ==, MONGO_BSON_DATE_TIME);
+   g_assert(!mongo_bson_iter_next(&iter));
+   mongo_bson_unref(bson);
+}
+
+static void
+binary_tests (void)
+{
+   static const gchar *expected =
+      "{\"a\":{\"$binary\":{\"base64\":\"AAF+/w==\",\"subType\":\"00\"}},"
+      "\"b\":{\"$binary\":{\"base64\":\"\",\"subType\":\"80\"}}}";
+   static const guint8 data[] = { 0x00, 0x01, 0x7e, 0xff };
+   MongoBson *parsed;
+   MongoBson *bson;
+   GError *error = NULL;
+   gchar *json;
+
+   bson = mongo_bson_new();
+   mongo_bson_append_binary(bson, "a", MONGO_BSON_BINARY_GENERIC,
+                            data, sizeof data);
+   mongo_bson_append_binary(bson, "b", MONGO_BSON_BINARY_USER, NULL, 0);
+
+   json = mongo_bson_to_json(bson, MONGO_BSON_JSON_CANONICAL);
+   g_assert_cmpstr(json, ==, expected);
+   g_free(json);
+   json = mongo_bson_to_json(bson, MONGO_BSON_JSON_RELAXED);
+   g_assert_cmpstr(json, ==, expected);
+
+   parsed = mongo_bson_new_from_json(json, -1, &error);
+   g_assert_no_error(error);
+   g_assert(mongo_bson_equal(parsed, bson));
+   mongo_bson_unref(parsed);
+   g_free(json);
+
+   /*
+    * The members may come in either order and the subtype may be short.
+    */
+   parsed = mongo_bson_new_from_json("{\"a\": {\"$binary\": {\"subType\": \"0\", "
+                                     "\"base64\": \"AAF+/w==\"}}, "
+                                     "\"b\": {\"$binary\": {\"base64\": \"\", "
+                                     "\"subType\": \"80\"}}}",
+                                     -1, &error);
+   g_assert_no_error(error);
+   g_assert(mongo_bson_equal(parsed, bson));
+   mongo_bson_unref(parsed);
+
+   mongo_bson_unref(bson);
+}
+
+static void
+server_types_tests (void)
+{
+   static const gchar *expected =
+      "{\"ts\":{\"$timestamp\":{\"t\":4294967295,\"i\":1}},"
+      "\"dec\":{\"$numberDecimal\":\"1.50\"},"
+      "\"min\":{\"$minKey\":1},\"max\":{\"$maxKey\":1},"
+      "\"js\":{\"$code\":\"f()\"},"
+      "\"jss\":{\"$code\":\"g(\\\"x\\\")\",\"$scope\":{\"x\":1}},"
+      "\"sym\":{\"$symbol\":\"s\"},"
+      "\"ptr\":{\"$dbPointer\":{\"$ref\":\"db.c\","
+      "\"$id\":{\"$oid\":\"4e9e9a2c27c1a8a3ac000001\"}}}}";
+   MongoDecimal128 decimal;
+   MongoObjectId oid;
+   MongoBson *parsed;
+   MongoBson *scope;
+   MongoBson *bson;
+   GError *error = NULL;
+   gchar *json;
+
+   mongo_decimal128_init_from_string(&decimal, "1.50");
+   mongo_object_id_init_from_string(&oid, "4e9e9a2c27c1a8a3ac000001");
+   scope = mongo_bson_new();
+   mongo_bson_append_int(scope, "x", 1);
+
+   bson = mongo_bson_new();
+   mongo_bson_append_timestamp(bson, "ts", G_MAXUINT32, 1);
+   mongo_bson_append_decimal128(bson, "dec", &decimal);
+   mongo_bson_append_min_key(bson, "min");
+   mongo_bson_append_max_key(bson, "max");
+   mongo_bson_append_javascript(bson, "js", "f()");
+   mongo_bson_append_javascript_with_scope(bson, "jss", "g(\"x\")", scope);
+   mongo_bson_append_symbol(bson, "sym", "s");
+   mongo_bson_append_dbpointer(bson, "ptr", "db.c", &oid);
+
+   json = mongo_bson_to_json(bson, MONGO_BSON_JSON_RELAXED);
+   g_assert_cmpstr(json, ==, expected);
+   parsed = mongo_bson_new_from_json(json, -1, &error);
+   g_assert_no_error(error);
+   g_assert(mongo_bson_equal(parsed, bson));
+   mongo_bson_unref(parsed);
+   g_free(json);
+
+   /*
+    * Timestamp members may come in either order.
+    */
+   parsed = mongo_bson_new_from_json("{\"ts\": {\"$timestamp\": "
+                                     "{\"i\": 1, \"t\": 4294967295}}}",
+                                     -1, &error);
+   g_assert_no_error(error);
+   json = mongo_bson_to_json(parsed, MONGO_BSON_JSON_CANONICAL);
+   g_assert_cmpstr(json, ==,
+                   "{\"ts\":{\"$timestamp\":{\"t\":4294967295,\"i\":1}}}");
+   mongo_bson_unref(parsed);
+   g_free(json);
+
+   mongo_bson_unref(scope);
+   mongo_bson_unref(bson);
+}
+
+static void
+parse_error_tests (void)
+{
+   static const gchar *invalid[] = {
+      "",
+      "[]",
+      "{",
+      "{\"a\"}",
+      "{\"a\":}",
+      "{\"a\":1,}",
+      "{\"a\":tru}",
+      "{\"a\":\"\\x\"}",
+      "{\"a\":\"\\ud800\"}",
+      "{\"a\":{\"$oid\":\"1234\"}}",
+      "{\"a\":{\"$binary\":{\"base64\":\"YQ\",\"subType\":\"00\"}}}",
+      "{\"a\":{\"$binary\":{\"base64\":\"YQ==\",\"subType\":\"0g\"}}}",
+      "{\"a\":{\"$binary\":{\"base64\":\"YQ==\"}}}",
+      "{\"a\":{\"$timestamp\":{\"t\":4294967296,\"i\":0}}}",
+      "{\"a\":{\"$timestamp\":{\"t\":1}}}",
+      "{\"a\":{\"$numberDecimal\":\"1.2.3\"}}",
+      "{\"a\":{\"$minKey\":0}}",
+      "{\"a\":{\"$code\":\"f()\",\"$scope\":1}}",
+      "{\"a\":{\"$dbPointer\":{\"$ref\":\"c\",\"$id\":{\"$oid\":\"1\"}}}}",
+      "{\"a\":1} x",
+   };
+   MongoBson *bson;
+   GError *error = NULL;
+   GString *str;
+   guint i;
+
+   for (i = 0; i < G_N_ELEMENTS(invalid); i++) {
+      bson = mongo_bson_new_from_json(invalid[i], -1, &error);
+      g_assert(!bson);
+      g_assert_error(error, MONGO_BSON_JSON_ERROR,
+                     MONGO_BSON_JSON_ERROR_SYNTAX);
+      g_clear_error(&error);
+   }
+
+   str = g_string_new(NULL);
+   for (i = 0; i < 200; i++) {
+      g_string_append(str, "{\"a\":");
+   }
+   bson = mongo_bson_new_from_json(str->str, str->len, &error);
+   g_assert(!bson);
+   g_assert_error(error, MONGO_BSON_JSON_ERROR,
+                  MONGO_BSON_JSON_ERROR_SYNTAX);
+   g_clear_error(&error);
+   g_string_free(str, TRUE);
+}
+
+static gboolean
+count_line_cb (MongoBson *bson,
+               gpointer   user_data)
+{
+   MongoBsonIter iter;
+   guint *count = user_data;
+
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_find(&iter, "n"));
+   g_assert_cmpint(mongo_bson_iter_get_value_int(&iter), ==, *count);
+   (*count)++;
+
+   return TRUE;
+}
+
+static void
+lines_tests (void)
+{
+   static const gchar lines[] =
+      "{\"n\": 0}\n"
+      "\n"
+      "{\"n\": 1}\r\n"
+      "{\"n\": 2}\n"
+      "{\"n\": 3}";
+   static const gchar invalid[] =
+      "{\"n\": 0}\n"
+      "{\"n\"\n";
+   GError *error = NULL;
+   gsize consumed = 0;
+   guint count = 0;
+
+   g_assert(mongo_bson_parse_json_lines(lines, sizeof lines - 1,
+                                        count_line_cb, &count,
+                                        &consumed, &error));
+   g_assert_no_error(error);
+   g_assert_cmpint(count, ==, 3);
+   g_assert_cmpstr(lines + consumed, ==, "{\"n\": 3}");
+
+   g_assert(mongo_bson_parse_json_lines(lines + consumed,
+                                        sizeof lines - 1 - consumed,
+                                        count_line_cb, &count,
+                                        NULL, &error));
+   g_assert_no_error(error);
+   g_assert_cmpint(count, ==, 4);
+
+   count = 0;
+   g_assert(!mongo_bson_parse_json_lines(invalid, sizeof invalid - 1,
+                                         count_line_cb, &count,
+                                         &consumed, &error));
+   g_assert_error(error, MONGO_BSON_JSON_ERROR,
+                  MONGO_BSON_JSON_ERROR_SYNTAX);
+   g_assert_cmpint(consumed, ==, 9);
+   g_assert_cmpint(count, ==, 1);
+   g_clear_error(&error);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_test_init(&argc, &argv, NULL);
+   g_test_add_func("/MongoBson/Json/relaxed", relaxed_tests);
+   g_test_add_func("/MongoBson/Json/canonical", canonical_tests);
+   g_test_add_func("/MongoBson/Json/escape", escape_tests);
+   g_test_add_func("/MongoBson/Json/stream", stream_tests);
+   g_test_add_func("/MongoBson/Json/parse", parse_tests);
+   g_test_add_func("/MongoBson/Json/parse_error", parse_error_tests);
+   g_test_add_func("/MongoBson/Json/binary", binary_tests);
+   g_test_add_func("/MongoBson/Json/server_types", server_types_tests);
+   g_test_add_func("/MongoBson/Json/lines", lines_tests);
+   return g_test_run();
+}
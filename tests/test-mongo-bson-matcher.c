@@ -0,0 +1,159 @@
+#include <mongo-glib/mongo-glib.h>
+
+typedef struct
+{
+   const gchar *query;
+   const gchar *document;
+   gboolean     matches;
+} MatchTest;
+
+static MongoBson *
+get_json (const gchar *json)
+{
+   MongoBson *bson;
+   GError *error = NULL;
+
+   bson = mongo_bson_new_from_json(json, -1, &error);
+   g_assert_no_error(error);
+   g_assert(bson);
+
+   return bson;
+}
+
+static void
+match_tests (void)
+{
+   static const MatchTest tests[] = {
+      { "{}", "{\"a\": 1}", TRUE },
+      { "{\"a\": 1}", "{\"a\": 1}", TRUE },
+      { "{\"a\": 1}", "{\"a\": 1.0}", TRUE },
+      { "{\"a\": 1}", "{\"a\": {\"$numberLong\": \"1\"}}", TRUE },
+      { "{\"a\": 1}", "{\"a\": 2}", FALSE },
+      { "{\"a\": 1}", "{\"b\": 1}", FALSE },
+      { "{\"a\": 1}", "{\"a\": [3, 1]}", TRUE },
+      { "{\"a\": [3, 1]}", "{\"a\": [3, 1]}", TRUE },
+      { "{\"a\": null}", "{\"b\": 1}", TRUE },
+      { "{\"a\": null}", "{\"a\": 0}", FALSE },
+      { "{\"a\": 1, \"b\": \"x\"}", "{\"b\": \"x\", \"a\": 1}", TRUE },
+      { "{\"a\": 1, \"b\": \"x\"}", "{\"b\": \"y\", \"a\": 1}", FALSE },
+      { "{\"a\": {\"$eq\": \"x\"}}", "{\"a\": \"x\"}", TRUE },
+      { "{\"a\": {\"$ne\": \"x\"}}", "{\"a\": \"x\"}", FALSE },
+      { "{\"a\": {\"$ne\": \"x\"}}", "{\"b\": \"x\"}", TRUE },
+      { "{\"a\": {\"$ne\": 2}}", "{\"a\": [1, 2]}", FALSE },
+      { "{\"a\": {\"$gt\": 5}}", "{\"a\": 6}", TRUE },
+      { "{\"a\": {\"$gt\": 5}}", "{\"a\": 5}", FALSE },
+      { "{\"a\": {\"$gt\": 5}}", "{\"a\": \"6\"}", FALSE },
+      { "{\"a\": {\"$gte\": 5}}", "{\"a\": 5.0}", TRUE },
+      { "{\"a\": {\"$lt\": 5}}", "{\"a\": -1.5}", TRUE },
+      { "{\"a\": {\"$lte\": 5}}", "{\"a\": 5.5}", FALSE },
+      { "{\"a\": {\"$gt\": 1, \"$lt\": 3}}", "{\"a\": 2}", TRUE },
+      { "{\"a\": {\"$gt\": 1, \"$lt\": 3}}", "{\"a\": 3}", FALSE },
+      { "{\"a\": {\"$gt\": 1, \"$lt\": 3}}", "{\"a\": [0, 4]}", TRUE },
+      { "{\"a\": {\"$gt\": \"b\"}}", "{\"a\": \"c\"}", TRUE },
+      { "{\"a\": {\"$in\": [1, \"x\", null]}}", "{\"a\": \"x\"}", TRUE },
+      { "{\"a\": {\"$in\": [1, \"x\", null]}}", "{\"a\": 1.0}", TRUE },
+      { "{\"a\": {\"$in\": [1, \"x\", null]}}", "{\"b\": 1}", TRUE },
+      { "{\"a\": {\"$in\": [1, \"x\"]}}", "{\"a\": 2}", FALSE },
+      { "{\"a\": {\"$in\": [1, \"x\"]}}", "{\"a\": [2, \"x\"]}", TRUE },
+      { "{\"a\": {\"$nin\": [1, 2]}}", "{\"a\": 3}", TRUE },
+      { "{\"a\": {\"$nin\": [1, 2]}}", "{\"a\": 2}", FALSE },
+      { "{\"a\": {\"$exists\": true}}", "{\"a\": null}", TRUE },
+      { "{\"a\": {\"$exists\": true}}", "{\"b\": 1}", FALSE },
+      { "{\"a\": {\"$exists\": false}}", "{\"b\": 1}", TRUE },
+      { "{\"a\": {\"$exists\": 0}}", "{\"a\": 1}", FALSE },
+      { "{\"a\": {\"$regex\": \"^ab\"}}", "{\"a\": \"abc\"}", TRUE },
+      { "{\"a\": {\"$regex\": \"^ab\"}}", "{\"a\": \"ABC\"}", FALSE },
+      { "{\"a\": {\"$regex\": \"^ab\", \"$options\": \"i\"}}", "{\"a\": \"ABC\"}", TRUE },
+      { "{\"a\": {\"$regularExpression\": {\"pattern\": \"c$\", \"options\": \"\"}}}", "{\"a\": [\"x\", \"abc\"]}", TRUE },
+      { "{\"a\": {\"$regex\": \"^ab\"}}", "{\"a\": 1}", FALSE },
+      { "{\"a.b\": 1}", "{\"a\": {\"b\": 1}}", TRUE },
+      { "{\"a.b\": 1}", "{\"a\": {\"c\": 1}}", FALSE },
+      { "{\"a.b\": 1}", "{\"a\": 1}", FALSE },
+      { "{\"a.b.c\": {\"$gt\": 1}}", "{\"a\": {\"b\": {\"c\": 2}}}", TRUE },
+      { "{\"a.b\": 1}", "{\"a\": [{\"b\": 2}, {\"b\": 1}]}", TRUE },
+      { "{\"a.1\": 5}", "{\"a\": [4, 5]}", TRUE },
+      { "{\"a.1\": 4}", "{\"a\": [4, 5]}", FALSE },
+      { "{\"a.1.b\": 2}", "{\"a\": [{\"b\": 1}, {\"b\": 2}]}", TRUE },
+      { "{\"$or\": [{\"a\": 1}, {\"b\": 2}]}", "{\"b\": 2}", TRUE },
+      { "{\"$or\": [{\"a\": 1}, {\"b\": 2}]}", "{\"b\": 3}", FALSE },
+      { "{\"$and\": [{\"a\": 1}, {\"b\": 2}]}", "{\"a\": 1, \"b\": 2}", TRUE },
+      { "{\"$and\": [{\"a\": 1}, {\"b\": 2}]}", "{\"a\": 1}", FALSE },
+      { "{\"$nor\": [{\"a\": 1}, {\"b\": 2}]}", "{\"a\": 2}", TRUE },
+      { "{\"$nor\": [{\"a\": 1}, {\"b\": 2}]}", "{\"a\": 1}", FALSE },
+      { "{\"c\": 3, \"$or\": [{\"a\": {\"$in\": [1, 2]}}, {\"$and\": [{\"b\": {\"$exists\": true}}, {\"b\": {\"$ne\": null}}]}]}",
+        "{\"c\": 3, \"b\": false}", TRUE },
+      { "{\"c\": 3, \"$or\": [{\"a\": {\"$in\": [1, 2]}}, {\"$and\": [{\"b\": {\"$exists\": true}}, {\"b\": {\"$ne\": null}}]}]}",
+        "{\"c\": 3, \"b\": null}", FALSE },
+      { "{\"d\": {\"$date\": \"2012-01-01T00:00:00Z\"}}", "{\"d\": {\"$date\": \"2012-01-01T00:00:00Z\"}}", TRUE },
+      { "{\"d\": {\"$lt\": {\"$date\": \"2012-01-01T00:00:00Z\"}}}", "{\"d\": {\"$date\": \"2011-01-01T00:00:00Z\"}}", TRUE },
+      { "{\"o\": {\"$oid\": \"4f1e2d3c4b5a69788796a5b4\"}}", "{\"o\": {\"$oid\": \"4f1e2d3c4b5a69788796a5b4\"}}", TRUE },
+      { "{\"e\": {\"x\": 1}}", "{\"e\": {\"x\": 1}}", TRUE },
+      { "{\"e\": {\"x\": 1}}", "{\"e\": {\"x\": 1, \"y\": 2}}", FALSE },
+   };
+   MongoBsonMatcher *matcher;
+   const guint8 *data;
+   MongoBson *query;
+   MongoBson *bson;
+   GError *error = NULL;
+   gsize length;
+   guint i;
+
+   for (i = 0; i < G_N_ELEMENTS(tests); i++) {
+      query = get_json(tests[i].query);
+      bson = get_json(tests[i].document);
+      matcher = mongo_bson_matcher_new(query, &error);
+      g_assert_no_error(error);
+      g_assert(matcher);
+      if (mongo_bson_matcher_match(matcher, bson) != tests[i].matches) {
+         g_error("%s should%s match %s", tests[i].query,
+                 tests[i].matches ? "" : " not", tests[i].document);
+      }
+      data = mongo_bson_get_data(bson, &length);
+      g_assert(mongo_bson_matcher_match_data(matcher, data, length) ==
+               tests[i].matches);
+      g_assert(!mongo_bson_matcher_match_data(matcher, data, length - 1));
+      mongo_bson_matcher_unref(matcher);
+      mongo_bson_unref(query);
+      mongo_bson_unref(bson);
+   }
+}
+
+static void
+invalid_tests (void)
+{
+   static const gchar *queries[] = {
+      "{\"$where\": \"true\"}",
+      "{\"a\": {\"$foo\": 1}}",
+      "{\"a\": {\"$in\": 1}}",
+      "{\"$or\": []}",
+      "{\"$or\": {\"a\": 1}}",
+      "{\"$and\": [1]}",
+      "{\"a\": {\"$regex\": \"(\"}}",
+      "{\"a\": {\"$regex\": \"a\", \"$options\": \"q\"}}",
+      "{\"a\": {\"$options\": \"i\"}}",
+   };
+   MongoBsonMatcher *matcher;
+   MongoBson *query;
+   GError *error = NULL;
+   guint i;
+
+   for (i = 0; i < G_N_ELEMENTS(queries); i++) {
+      query = get_json(queries[i]);
+      matcher = mongo_bson_matcher_new(query, &error);
+      g_assert_error(error, MONGO_BSON_MATCHER_ERROR,
+                     MONGO_BSON_MATCHER_ERROR_INVALID_QUERY);
+      g_assert(!matcher);
+      g_clear_error(&error);
+      mongo_bson_unref(query);
+   }
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_test_init(&argc, &argv, NULL);
+   g_test_add_func("/MongoBsonMatcher/match", match_tests);
+   g_test_add_func("/MongoBsonMatcher/invalid", invalid_tests);
+   return g_test_run();
+}
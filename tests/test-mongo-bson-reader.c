@@ -0,0 +1,210 @@
+#include <mongo-glib/mongo-glib.h>
+#include <string.h>
+
+#define N_FILES 16
+
+static GByteArray *
+get_all_bson (void)
+{
+   GByteArray *bytes;
+   gchar *filename;
+   gchar *name;
+   gchar *buffer;
+   GError *error = NULL;
+   gsize length;
+   guint i;
+
+   bytes = g_byte_array_new();
+
+   for (i = 1; i <= N_FILES; i++) {
+      name = g_strdup_printf("test%u.bson", i);
+      filename = g_build_filename("tests", "bson", name, NULL);
+      if (!g_file_get_contents(filename, &buffer, &length, &error)) {
+         g_assert_no_error(error);
+         g_assert(FALSE);
+      }
+      g_byte_array_append(bytes, (guint8 *)buffer, length);
+      g_free(buffer);
+      g_free(filename);
+      g_free(name);
+   }
+
+   return bytes;
+}
+
+static MongoBsonReader *
+get_reader (GByteArray *bytes,
+            gsize       length)
+{
+   MongoBsonReader *reader;
+   GInputStream *stream;
+
+   stream = g_memory_input_stream_new_from_data(bytes->data, length, NULL);
+   reader = mongo_bson_reader_new(stream);
+   g_object_unref(stream);
+
+   return reader;
+}
+
+static void
+next_tests (void)
+{
+   MongoBsonReader *reader;
+   MongoBson *copy;
+   GByteArray *bytes;
+   const guint8 *copy_data;
+   const guint8 *data;
+   GError *error = NULL;
+   gsize offset = 0;
+   gsize copy_length;
+   gsize length;
+   guint count = 0;
+
+   bytes = get_all_bson();
+   reader = get_reader(bytes, bytes->len);
+
+   while ((data = mongo_bson_reader_next(reader, &length, NULL, &error))) {
+      g_assert_cmpint(offset + length, <=, bytes->len);
+      g_assert(!memcmp(data, bytes->data + offset, length));
+      offset += length;
+      count++;
+
+      if (count == 5) {
+         copy = mongo_bson_new_from_data(data, length);
+         copy_data = mongo_bson_get_data(copy, &copy_length);
+         g_assert(copy_data != data);
+         g_assert_cmpint(copy_length, ==, length);
+         g_assert(!memcmp(copy_data, data, length));
+         mongo_bson_append_int(copy, "extra", 1);
+         g_assert(!memcmp(data, bytes->data + offset - length, length));
+         mongo_bson_unref(copy);
+      }
+   }
+
+   g_assert_no_error(error);
+   g_assert_cmpint(count, ==, N_FILES);
+   g_assert_cmpint(offset, ==, bytes->len);
+   g_assert(!mongo_bson_reader_next(reader, &length, NULL, &error));
+   g_assert_no_error(error);
+   g_assert_cmpint(length, ==, 0);
+
+   g_object_unref(reader);
+   g_byte_array_free(bytes, TRUE);
+}
+
+static void
+truncated_tests (void)
+{
+   MongoBsonReader *reader;
+   GByteArray *bytes;
+   GError *error = NULL;
+   guint count = 0;
+   gsize length;
+
+   bytes = get_all_bson();
+   reader = get_reader(bytes, bytes->len - 1);
+
+   while (mongo_bson_reader_next(reader, &length, NULL, &error)) {
+      count++;
+   }
+
+   g_assert_error(error, MONGO_BSON_READER_ERROR,
+                  MONGO_BSON_READER_ERROR_TRUNCATED);
+   g_assert_cmpint(count, ==, N_FILES - 1);
+   g_clear_error(&error);
+
+   g_object_unref(reader);
+   g_byte_array_free(bytes, TRUE);
+}
+
+static void
+max_document_size_tests (void)
+{
+   MongoBsonReader *reader;
+   GByteArray *bytes;
+   GError *error = NULL;
+   gsize length;
+
+   bytes = get_all_bson();
+   reader = get_reader(bytes, bytes->len);
+
+   mongo_bson_reader_set_max_document_size(reader, 5);
+   g_assert_cmpint(mongo_bson_reader_get_max_document_size(reader), ==, 5);
+   g_assert(!mongo_bson_reader_next(reader, &length, NULL, &error));
+   g_assert_error(error, MONGO_BSON_READER_ERROR,
+                  MONGO_BSON_READER_ERROR_INVALID_DOCUMENT);
+   g_clear_error(&error);
+
+   g_object_unref(reader);
+   g_byte_array_free(bytes, TRUE);
+}
+
+static GMainLoop *gMainLoop;
+static guint gAsyncCount;
+
+static void
+next_async_cb (GObject      *object,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+   MongoBsonReader *reader = (MongoBsonReader *)object;
+   GByteArray *bytes = user_data;
+   const guint8 *data;
+   GError *error = NULL;
+   gsize length;
+
+   data = mongo_bson_reader_next_finish(reader, result, &length, &error);
+   g_assert_no_error(error);
+
+   if (!data) {
+      g_assert_cmpint(gAsyncCount, ==, N_FILES);
+      g_main_loop_quit(gMainLoop);
+      return;
+   }
+
+   g_assert_cmpint(length, <=, bytes->len);
+   g_assert(!memcmp(data, bytes->data, length));
+   g_byte_array_remove_range(bytes, 0, length);
+   gAsyncCount++;
+
+   mongo_bson_reader_next_async(reader, NULL, next_async_cb, bytes);
+}
+
+static void
+next_async_tests (void)
+{
+   MongoBsonReader *reader;
+   GByteArray *bytes;
+   GByteArray *expected;
+
+   bytes = get_all_bson();
+   reader = get_reader(bytes, bytes->len);
+   expected = g_byte_array_new();
+   g_byte_array_append(expected, bytes->data, bytes->len);
+
+   gAsyncCount = 0;
+   gMainLoop = g_main_loop_new(NULL, FALSE);
+   mongo_bson_reader_next_async(reader, NULL, next_async_cb, expected);
+   g_main_loop_run(gMainLoop);
+   g_main_loop_unref(gMainLoop);
+   gMainLoop = NULL;
+
+   g_assert_cmpint(expected->len, ==, 0);
+
+   g_object_unref(reader);
+   g_byte_array_free(expected, TRUE);
+   g_byte_array_free(bytes, TRUE);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_test_init(&argc, &argv, NULL);
+   g_type_init();
+   g_test_add_func("/MongoBsonReader/next", next_tests);
+   g_test_add_func("/MongoBsonReader/next_async", next_async_tests);
+   g_test_add_func("/MongoBsonReader/truncated", truncated_tests);
+   g_test_add_func("/MongoBsonReader/max_document_size", max_document_size_tests);
+   return g_test_run();
+}
@@ -0,0 +1,231 @@
+#include <mongo-glib/mongo-glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#define N_DOCUMENTS 2000
+
+static GMainLoop *gMainLoop;
+
+static GByteArray *
+get_input (void)
+{
+   GByteArray *bytes;
+   const guint8 *data;
+   MongoBson *bson;
+   gchar *str;
+   gsize length;
+   guint i;
+
+   bytes = g_byte_array_new();
+
+   for (i = 0; i < N_DOCUMENTS; i++) {
+      bson = mongo_bson_new();
+      if (i % 5) {
+         mongo_bson_append_int(bson, "k", (i * 7919) % 97);
+      } else {
+         mongo_bson_append_double(bson, "k", ((i * 7919) % 97) + 0.5);
+      }
+      str = g_strdup_printf("document %u", i);
+      mongo_bson_append_string(bson, "s", str);
+      mongo_bson_append_int(bson, "i", i);
+      data = mongo_bson_get_data(bson, &length);
+      g_byte_array_append(bytes, data, length);
+      mongo_bson_unref(bson);
+      g_free(str);
+   }
+
+   return bytes;
+}
+
+static MongoBsonSorter *
+get_sorter (const gchar *json)
+{
+   MongoBsonSorter *sorter;
+   MongoSortSpec *spec;
+   MongoBson *bson;
+   GError *error = NULL;
+
+   bson = mongo_bson_new_from_json(json, -1, &error);
+   g_assert_no_error(error);
+   spec = mongo_sort_spec_new(bson, &error);
+   g_assert_no_error(error);
+   sorter = mongo_bson_sorter_new(spec);
+   mongo_sort_spec_unref(spec);
+   mongo_bson_unref(bson);
+
+   return sorter;
+}
+
+static void
+assert_sorted (MongoBsonSorter     *sorter,
+               GMemoryOutputStream *output)
+{
+   MongoBsonReader *reader;
+   GInputStream *stream;
+   MongoSortSpec *spec;
+   MongoBsonIter iter;
+   MongoBson *bson;
+   MongoBson *prev = NULL;
+   const guint8 *data;
+   GError *error = NULL;
+   gsize length;
+   gint prev_i = -1;
+   gint cmp;
+   gint i;
+   guint count = 0;
+
+   spec = mongo_bson_sorter_get_spec(sorter);
+   stream = g_memory_input_stream_new_from_data(
+      g_memory_output_stream_get_data(output),
+      g_memory_output_stream_get_data_size(output),
+      NULL);
+   reader = mongo_bson_reader_new(stream);
+
+   while ((data = mongo_bson_reader_next(reader, &length, NULL, &error))) {
+      bson = mongo_bson_new_from_data(data, length);
+      mongo_bson_iter_init(&iter, bson);
+      g_assert(mongo_bson_iter_find(&iter, "i"));
+      i = mongo_bson_iter_get_value_int(&iter);
+      if (prev) {
+         cmp = mongo_sort_spec_compare(spec, prev, bson);
+         g_assert_cmpint(cmp, <=, 0);
+         if (!cmp) {
+            g_assert_cmpint(prev_i, <, i);
+         }
+         mongo_bson_unref(prev);
+      }
+      prev = bson;
+      prev_i = i;
+      count++;
+   }
+
+   g_assert_no_error(error);
+   g_assert_cmpint(count, ==, N_DOCUMENTS);
+
+   mongo_bson_unref(prev);
+   g_object_unref(reader);
+   g_object_unref(stream);
+}
+
+static void
+assert_empty_dir (const gchar *path)
+{
+   GError *error = NULL;
+   GDir *dir;
+
+   dir = g_dir_open(path, 0, &error);
+   g_assert_no_error(error);
+   g_assert(!g_dir_read_name(dir));
+   g_dir_close(dir);
+}
+
+static void
+sort_tests (const gchar *json,
+            guint64      memory_limit,
+            guint        fan_in)
+{
+   MongoBsonSorter *sorter;
+   GOutputStream *output;
+   GInputStream *input;
+   GByteArray *bytes;
+   GError *error = NULL;
+   gchar *temp_dir;
+
+   temp_dir = g_dir_make_tmp("test-mongo-bson-sorter-XXXXXX", &error);
+   g_assert_no_error(error);
+
+   bytes = get_input();
+   input = g_memory_input_stream_new_from_data(bytes->data, bytes->len, NULL);
+   output = g_memory_output_stream_new(NULL, 0, g_realloc, g_free);
+
+   sorter = get_sorter(json);
+   mongo_bson_sorter_set_temp_dir(sorter, temp_dir);
+   if (memory_limit) {
+      mongo_bson_sorter_set_memory_limit(sorter, memory_limit);
+   }
+   if (fan_in) {
+      mongo_bson_sorter_set_fan_in(sorter, fan_in);
+   }
+
+   g_assert(mongo_bson_sorter_sort(sorter, input, output, NULL, &error));
+   g_assert_no_error(error);
+   g_assert_cmpint(g_memory_output_stream_get_data_size(
+                      G_MEMORY_OUTPUT_STREAM(output)), ==, bytes->len);
+   assert_sorted(sorter, G_MEMORY_OUTPUT_STREAM(output));
+   assert_empty_dir(temp_dir);
+
+   g_object_unref(sorter);
+   g_object_unref(output);
+   g_object_unref(input);
+   g_byte_array_free(bytes, TRUE);
+   g_rmdir(temp_dir);
+   g_free(temp_dir);
+}
+
+static void
+in_memory_tests (void)
+{
+   sort_tests("{\"k\": 1}", 0, 0);
+   sort_tests("{\"k\": -1, \"s\": 1}", 0, 0);
+}
+
+static void
+external_tests (void)
+{
+   sort_tests("{\"k\": 1}", 4096, 0);
+   sort_tests("{\"k\": -1}", 4096, 3);
+   sort_tests("{\"s\": 1}", 1, 16);
+}
+
+static void
+sort_async_cb (GObject      *object,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+   GError *error = NULL;
+
+   g_assert(mongo_bson_sorter_sort_finish(MONGO_BSON_SORTER(object),
+                                          result, &error));
+   g_assert_no_error(error);
+   assert_sorted(MONGO_BSON_SORTER(object), user_data);
+   g_main_loop_quit(gMainLoop);
+}
+
+static void
+sort_async_tests (void)
+{
+   MongoBsonSorter *sorter;
+   GOutputStream *output;
+   GInputStream *input;
+   GByteArray *bytes;
+
+   bytes = get_input();
+   input = g_memory_input_stream_new_from_data(bytes->data, bytes->len, NULL);
+   output = g_memory_output_stream_new(NULL, 0, g_realloc, g_free);
+
+   sorter = get_sorter("{\"k\": 1, \"i\": -1}");
+   mongo_bson_sorter_set_memory_limit(sorter, 16384);
+
+   gMainLoop = g_main_loop_new(NULL, FALSE);
+   mongo_bson_sorter_sort_async(sorter, input, output, NULL,
+                                sort_async_cb, output);
+   g_main_loop_run(gMainLoop);
+   g_main_loop_unref(gMainLoop);
+
+   g_object_unref(sorter);
+   g_object_unref(output);
+   g_object_unref(input);
+   g_byte_array_free(bytes, TRUE);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_type_init();
+   g_test_init(&argc, &argv, NULL);
+   g_test_add_func("/MongoBsonSorter/in_memory", in_memory_tests);
+   g_test_add_func("/MongoBsonSorter/external", external_tests);
+   g_test_add_func("/MongoBsonSorter/sort_async", sort_async_tests);
+   return g_test_run();
+}
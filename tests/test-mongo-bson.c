@@ -402,12 +402,1119 @@ iter_tests (void)
    mongo_bson_unref(bson);
 }
 
+static void
+iter_multiple_tests (void)
+{
+   MongoBson *bson;
+   MongoBson *subdoc;
+   MongoBsonIter iter;
+   const gchar *regex = NULL;
+   const gchar *options = NULL;
+
+   bson = mongo_bson_new();
+   subdoc = mongo_bson_new();
+   mongo_bson_append_int(subdoc, "int", 1);
+   mongo_bson_append_bson(bson, "document", subdoc);
+   mongo_bson_append_regex(bson, "regex", "1234", "i");
+   mongo_bson_append_string(bson, "string", "some string");
+   mongo_bson_append_int(bson, "int", 2);
+   mongo_bson_unref(subdoc);
+
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpstr("document", ==, mongo_bson_iter_get_key(&iter));
+   subdoc = mongo_bson_iter_get_value_bson(&iter);
+   g_assert(subdoc);
+   mongo_bson_unref(subdoc);
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpstr("regex", ==, mongo_bson_iter_get_key(&iter));
+   mongo_bson_iter_get_value_regex(&iter, &regex, &options);
+   g_assert_cmpstr(regex, ==, "1234");
+   g_assert_cmpstr(options, ==, "i");
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpstr("string", ==, mongo_bson_iter_get_key(&iter));
+   g_assert_cmpstr("some string", ==, mongo_bson_iter_get_value_string(&iter, NULL));
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpstr("int", ==, mongo_bson_iter_get_key(&iter));
+   g_assert_cmpint(2, ==, mongo_bson_iter_get_value_int(&iter));
+   g_assert(!mongo_bson_iter_next(&iter));
+
+   mongo_bson_unref(bson);
+}
+
+static void
+raw_iter_tests (void)
+{
+   MongoBson *bson;
+   MongoBsonRawIter iter;
+   MongoBsonRawIter iter2;
+   const guint8 *data;
+   gsize length;
+   gint i;
+
+   bson = get_bson("test2.bson");
+   mongo_bson_raw_iter_init(&iter, bson);
+   g_assert(mongo_bson_raw_iter_next(&iter));
+   g_assert_cmpint(MONGO_BSON_INT64, ==, mongo_bson_raw_iter_get_value_type(&iter));
+   g_assert_cmpstr("int64", ==, mongo_bson_raw_iter_get_key(&iter));
+   g_assert_cmpint(1L, ==, mongo_bson_raw_iter_get_value_int64(&iter));
+   g_assert_cmpint(0, ==, mongo_bson_raw_iter_get_value_int(&iter));
+   g_assert(!mongo_bson_raw_iter_next(&iter));
+   mongo_bson_unref(bson);
+
+   bson = get_bson("test6.bson");
+   mongo_bson_raw_iter_init(&iter, bson);
+   g_assert(mongo_bson_raw_iter_find(&iter, "array[int]"));
+   g_assert_cmpint(MONGO_BSON_ARRAY, ==, mongo_bson_raw_iter_get_value_type(&iter));
+   g_assert(mongo_bson_raw_iter_recurse(&iter, &iter2));
+   for (i = 1; i <= 6; i++) {
+      g_assert(mongo_bson_raw_iter_next(&iter2));
+      g_assert_cmpint(i, ==, mongo_bson_raw_iter_get_value_int(&iter2));
+   }
+   g_assert(!mongo_bson_raw_iter_next(&iter2));
+   g_assert(!mongo_bson_raw_iter_next(&iter));
+   mongo_bson_unref(bson);
+
+   bson = get_bson("test12.bson");
+   data = mongo_bson_get_data(bson, &length);
+   g_assert(!mongo_bson_raw_iter_init_from_data(&iter, data, length - 1));
+   g_assert(mongo_bson_raw_iter_init_from_data(&iter, data, length));
+   g_assert(mongo_bson_raw_iter_next(&iter));
+   g_assert_cmpstr("BSON", ==, mongo_bson_raw_iter_get_key(&iter));
+   g_assert(mongo_bson_raw_iter_recurse(&iter, &iter2));
+   g_assert(mongo_bson_raw_iter_next(&iter2));
+   g_assert_cmpstr("awesome", ==, mongo_bson_raw_iter_get_value_string(&iter2, &length));
+   g_assert_cmpint(length, ==, 7);
+   g_assert(mongo_bson_raw_iter_next(&iter2));
+   g_assert_cmpfloat(5.05, ==, mongo_bson_raw_iter_get_value_double(&iter2));
+   g_assert(mongo_bson_raw_iter_next(&iter2));
+   g_assert_cmpint(1986, ==, mongo_bson_raw_iter_get_value_int(&iter2));
+   g_assert(!mongo_bson_raw_iter_next(&iter2));
+   g_assert(!mongo_bson_raw_iter_next(&iter));
+   mongo_bson_unref(bson);
+}
+
+static void
+append_child_tests (void)
+{
+   MongoBson *bson;
+
+   bson = mongo_bson_new();
+   mongo_bson_append_array_begin(bson, "array[int]");
+   mongo_bson_append_int(bson, "0", 1);
+   mongo_bson_append_int(bson, "1", 2);
+   mongo_bson_append_int(bson, "2", 3);
+   mongo_bson_append_int(bson, "3", 4);
+   mongo_bson_append_int(bson, "4", 5);
+   mongo_bson_append_int(bson, "5", 6);
+   mongo_bson_append_array_end(bson);
+   assert_bson(bson, "test6.bson");
+   mongo_bson_unref(bson);
+
+   bson = mongo_bson_new();
+   mongo_bson_append_bson_begin(bson, "document");
+   mongo_bson_append_int(bson, "int", 1);
+   mongo_bson_append_bson_end(bson);
+   assert_bson(bson, "test8.bson");
+   mongo_bson_unref(bson);
+
+   bson = mongo_bson_new();
+   mongo_bson_append_array_begin(bson, "BSON");
+   mongo_bson_append_string(bson, "0", "awesome");
+   mongo_bson_append_double(bson, "1", 5.05);
+   mongo_bson_append_int(bson, "2", 1986);
+   mongo_bson_append_array_end(bson);
+   assert_bson(bson, "test12.bson");
+   mongo_bson_unref(bson);
+}
+
+static MongoBson *
+new_number (gint    type,
+            gdouble value)
+{
+   MongoBson *bson;
+
+   bson = mongo_bson_new();
+   switch (type) {
+   case MONGO_BSON_INT32:
+      mongo_bson_append_int(bson, "a", (gint32)value);
+      break;
+   case MONGO_BSON_INT64:
+      mongo_bson_append_int64(bson, "a", (gint64)value);
+      break;
+   default:
+      mongo_bson_append_double(bson, "a", value);
+      break;
+   }
+
+   return bson;
+}
+
+static void
+compare_tests (void)
+{
+   MongoBsonRawIter iter1;
+   MongoBsonRawIter iter2;
+   MongoBson *ordered[8];
+   MongoBson *a;
+   MongoBson *b;
+   MongoBson *c;
+   guint i;
+   guint j;
+
+   a = new_number(MONGO_BSON_INT32, 1);
+   b = new_number(MONGO_BSON_INT64, 1);
+   c = new_number(MONGO_BSON_DOUBLE, 1.0);
+   g_assert_cmpint(mongo_bson_compare(a, b), ==, 0);
+   g_assert_cmpint(mongo_bson_compare(b, c), ==, 0);
+   g_assert_cmpint(mongo_bson_compare(c, a), ==, 0);
+   g_assert(!mongo_bson_equal(a, b));
+
+   mongo_bson_raw_iter_init(&iter1, a);
+   mongo_bson_raw_iter_init(&iter2, c);
+   g_assert(mongo_bson_raw_iter_next(&iter1));
+   g_assert(mongo_bson_raw_iter_next(&iter2));
+   g_assert_cmpint(mongo_bson_raw_iter_compare_value(&iter1, &iter2), ==, 0);
+   g_assert(mongo_bson_raw_iter_hash_value(&iter1) ==
+            mongo_bson_raw_iter_hash_value(&iter2));
+   mongo_bson_unref(a);
+   mongo_bson_unref(b);
+   mongo_bson_unref(c);
+
+   a = mongo_bson_new();
+   mongo_bson_append_int64(a, "a", G_GINT64_CONSTANT(9007199254740993));
+   b = new_number(MONGO_BSON_DOUBLE, 9007199254740992.0);
+   c = new_number(MONGO_BSON_DOUBLE, 1.5);
+   g_assert_cmpint(mongo_bson_compare(a, b), >, 0);
+   g_assert_cmpint(mongo_bson_compare(b, a), <, 0);
+   mongo_bson_unref(a);
+   a = new_number(MONGO_BSON_INT32, 1);
+   g_assert_cmpint(mongo_bson_compare(a, c), <, 0);
+   g_assert_cmpint(mongo_bson_compare(c, a), >, 0);
+   mongo_bson_unref(a);
+   mongo_bson_unref(b);
+   mongo_bson_unref(c);
+
+   /*
+    * Each document sorts before the next one.
+    */
+   for (i = 0; i < G_N_ELEMENTS(ordered); i++) {
+      ordered[i] = mongo_bson_new();
+   }
+   mongo_bson_append_null(ordered[1], "a");
+   mongo_bson_append_int(ordered[2], "a", -5);
+   mongo_bson_append_double(ordered[3], "a", 100.5);
+   mongo_bson_append_string(ordered[4], "a", "abc");
+   mongo_bson_append_string(ordered[5], "a", "abcd");
+   mongo_bson_append_string(ordered[6], "a", "abd");
+   mongo_bson_append_boolean(ordered[7], "a", FALSE);
+
+   for (i = 0; i < G_N_ELEMENTS(ordered); i++) {
+      for (j = 0; j < G_N_ELEMENTS(ordered); j++) {
+         if (i < j) {
+            g_assert_cmpint(mongo_bson_compare(ordered[i], ordered[j]), <, 0);
+         } else if (i > j) {
+            g_assert_cmpint(mongo_bson_compare(ordered[i], ordered[j]), >, 0);
+         } else {
+            g_assert_cmpint(mongo_bson_compare(ordered[i], ordered[j]), ==, 0);
+         }
+      }
+   }
+
+   for (i = 0; i < G_N_ELEMENTS(ordered); i++) {
+      mongo_bson_unref(ordered[i]);
+   }
+
+   a = get_bson("test6.bson");
+   b = get_bson("test12.bson");
+   g_assert_cmpint(mongo_bson_compare(a, a), ==, 0);
+   g_assert_cmpint(mongo_bson_compare(a, b), >, 0);
+   mongo_bson_unref(a);
+   mongo_bson_unref(b);
+}
+
+static void
+hash_tests (void)
+{
+   GHashTable *hash;
+   MongoBson *bson;
+   gchar *name;
+   guint i;
+
+   hash = g_hash_table_new_full(mongo_bson_hash, mongo_bson_equal,
+                                (GDestroyNotify)mongo_bson_unref, NULL);
+
+   for (i = 1; i <= 16; i++) {
+      name = g_strdup_printf("test%u.bson", i);
+      bson = get_bson(name);
+      g_hash_table_insert(hash, bson, GINT_TO_POINTER(i));
+      g_free(name);
+   }
+
+   for (i = 1; i <= 16; i++) {
+      name = g_strdup_printf("test%u.bson", i);
+      bson = get_bson(name);
+      g_assert_cmpint(GPOINTER_TO_INT(g_hash_table_lookup(hash, bson)), ==, i);
+      g_assert(mongo_bson_hash64(bson) != 0);
+      mongo_bson_unref(bson);
+      g_free(name);
+   }
+
+   g_hash_table_unref(hash);
+}
+
+static void
+assert_json (MongoBson   *bson,
+             const gchar *expected)
+{
+   MongoBson *expected_bson;
+   GError *error = NULL;
+
+   expected_bson = mongo_bson_new_from_json(expected, -1, &error);
+   g_assert_no_error(error);
+   g_assert(mongo_bson_equal(bson, expected_bson));
+   mongo_bson_unref(expected_bson);
+}
+
+static void
+project_tests (void)
+{
+   static const gchar *empty[] = { NULL };
+   static const gchar *top[] = { "b", "d", "missing", NULL };
+   static const gchar *nested[] = { "c.y", "e.x", "a.x", NULL };
+   static const gchar *whole[] = { "c", "c.y", NULL };
+   MongoBson *projected;
+   MongoBson *bson;
+   GError *error = NULL;
+
+   bson = mongo_bson_new_from_json(
+      "{\"a\": 1, \"b\": \"two\", \"c\": {\"x\": 1, \"y\": 2, \"z\": 3}, "
+      "\"d\": true, \"e\": [10, {\"x\": 1, \"y\": 2}, [{\"x\": 3}], {\"y\": 4}]}",
+      -1, &error);
+   g_assert_no_error(error);
+
+   projected = mongo_bson_include_fields(bson, empty);
+   assert_json(projected, "{}");
+   mongo_bson_unref(projected);
+
+   projected = mongo_bson_exclude_fields(bson, empty);
+   g_assert(mongo_bson_equal(projected, bson));
+   mongo_bson_unref(projected);
+
+   projected = mongo_bson_include_fields(bson, top);
+   assert_json(projected, "{\"b\": \"two\", \"d\": true}");
+   mongo_bson_unref(projected);
+
+   projected = mongo_bson_exclude_fields(bson, top);
+   assert_json(projected, "{\"a\": 1, \"c\": {\"x\": 1, \"y\": 2, \"z\": 3}, "
+                          "\"e\": [10, {\"x\": 1, \"y\": 2}, [{\"x\": 3}], "
+                          "{\"y\": 4}]}");
+   mongo_bson_unref(projected);
+
+   projected = mongo_bson_include_fields(bson, nested);
+   assert_json(projected, "{\"c\": {\"y\": 2}, "
+                          "\"e\": [{\"x\": 1}, [{\"x\": 3}], {}]}");
+   mongo_bson_unref(projected);
+
+   projected = mongo_bson_exclude_fields(bson, nested);
+   assert_json(projected, "{\"a\": 1, \"b\": \"two\", \"c\": {\"x\": 1, \"z\": 3}, "
+                          "\"d\": true, "
+                          "\"e\": [10, {\"y\": 2}, [{}], {\"y\": 4}]}");
+   mongo_bson_unref(projected);
+
+   projected = mongo_bson_include_fields(bson, whole);
+   assert_json(projected, "{\"c\": {\"x\": 1, \"y\": 2, \"z\": 3}}");
+   mongo_bson_unref(projected);
+
+   mongo_bson_unref(bson);
+}
+
+static void
+set_value_tests (void)
+{
+   MongoObjectId oid;
+   MongoBsonIter iter;
+   MongoBson *bson;
+   GError *error = NULL;
+   GTimeVal tv;
+   const guint8 *data;
+   gsize length;
+   guint8 *copy;
+
+   bson = mongo_bson_new_from_json(
+      "{\"i\": 1, \"l\": {\"$numberLong\": \"2\"}, \"d\": 3.5, "
+      "\"b\": false, \"t\": {\"$date\": {\"$numberLong\": \"0\"}}, "
+      "\"o\": {\"$oid\": \"000000000000000000000000\"}}", -1, &error);
+   g_assert_no_error(error);
+
+   /*
+    * Use static data to check that the iterator follows the copy.
+    */
+   data = mongo_bson_get_data(bson, &length);
+   copy = g_memdup(data, length);
+   mongo_bson_unref(bson);
+   bson = mongo_bson_new_from_static_data(copy, length, g_free);
+
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_find(&iter, "i"));
+   g_assert(!mongo_bson_iter_set_value_double(&iter, bson, 1.0));
+   g_assert(mongo_bson_iter_set_value_int(&iter, bson, -7));
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert(mongo_bson_iter_set_value_int64(&iter, bson, G_MAXINT64));
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert(mongo_bson_iter_set_value_double(&iter, bson, 0.25));
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert(mongo_bson_iter_set_value_boolean(&iter, bson, TRUE));
+   g_assert(mongo_bson_iter_next(&iter));
+   tv.tv_sec = 1000;
+   tv.tv_usec = 0;
+   g_assert(mongo_bson_iter_set_value_timeval(&iter, bson, &tv));
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert(mongo_object_id_init_from_string(&oid,
+                                             "5087a3ef4f6a2e0a6c000000"));
+   g_assert(mongo_bson_iter_set_value_object_id(&iter, bson, &oid));
+   g_assert(!mongo_bson_iter_next(&iter));
+
+   assert_json(bson,
+               "{\"i\": -7, "
+               "\"l\": {\"$numberLong\": \"9223372036854775807\"}, "
+               "\"d\": 0.25, \"b\": true, "
+               "\"t\": {\"$date\": {\"$numberLong\": \"1000000\"}}, "
+               "\"o\": {\"$oid\": \"5087a3ef4f6a2e0a6c000000\"}}");
+
+   mongo_bson_unref(bson);
+}
+
+static void
+replace_value_tests (void)
+{
+   MongoBsonIter value;
+   MongoBsonIter child;
+   MongoBsonIter iter;
+   MongoBson *values;
+   MongoBson *bson;
+   GError *error = NULL;
+
+   bson = mongo_bson_new_from_json(
+      "{\"a\": 1, \"b\": {\"c\": \"short\", \"d\": [1, 2]}, \"e\": 5}",
+      -1, &error);
+   g_assert_no_error(error);
+   values = mongo_bson_new_from_json(
+      "{\"long\": \"a much longer string\", \"null\": null}", -1, &error);
+   g_assert_no_error(error);
+
+   /*
+    * Grow a nested value, then keep iterating the child.
+    */
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_find(&iter, "b"));
+   g_assert(mongo_bson_iter_recurse(&iter, &child));
+   g_assert(mongo_bson_iter_find(&child, "c"));
+   mongo_bson_iter_init(&value, values);
+   g_assert(mongo_bson_iter_find(&value, "long"));
+   g_assert(mongo_bson_iter_replace_value(&child, bson, &value));
+   g_assert_cmpstr(mongo_bson_iter_get_value_string(&child, NULL), ==,
+                   "a much longer string");
+   g_assert(mongo_bson_iter_next(&child));
+   g_assert_cmpstr(mongo_bson_iter_get_key(&child), ==, "d");
+   g_assert(!mongo_bson_iter_next(&child));
+   assert_json(bson,
+               "{\"a\": 1, \"b\": {\"c\": \"a much longer string\", "
+               "\"d\": [1, 2]}, \"e\": 5}");
+
+   /*
+    * Shrink a value, changing its type.
+    */
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_find(&iter, "b"));
+   g_assert(mongo_bson_iter_find(&value, "null"));
+   g_assert(mongo_bson_iter_replace_value(&iter, bson, &value));
+   g_assert_cmpint(mongo_bson_iter_get_value_type(&iter), ==,
+                   MONGO_BSON_NULL);
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpint(mongo_bson_iter_get_value_int(&iter), ==, 5);
+   assert_json(bson, "{\"a\": 1, \"b\": null, \"e\": 5}");
+
+   /*
+    * Replace with a value from the same document.
+    */
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_find(&iter, "a"));
+   mongo_bson_iter_init(&value, bson);
+   g_assert(mongo_bson_iter_find(&value, "e"));
+   g_assert(mongo_bson_iter_replace_value(&iter, bson, &value));
+   assert_json(bson, "{\"a\": 5, \"b\": null, \"e\": 5}");
+
+   mongo_bson_unref(values);
+   mongo_bson_unref(bson);
+}
+
+static void
+assert_diff (const gchar *old_json,
+             const gchar *new_json,
+             const gchar *expected)
+{
+   MongoBson *old_bson;
+   MongoBson *new_bson;
+   MongoBson *diff;
+   GError *error = NULL;
+
+   old_bson = mongo_bson_new_from_json(old_json, -1, &error);
+   g_assert_no_error(error);
+   new_bson = mongo_bson_new_from_json(new_json, -1, &error);
+   g_assert_no_error(error);
+
+   diff = mongo_bson_diff(old_bson, new_bson);
+   if (expected) {
+      assert_json(diff, expected);
+      mongo_bson_unref(diff);
+   } else {
+      g_assert(!diff);
+   }
+
+   mongo_bson_unref(new_bson);
+   mongo_bson_unref(old_bson);
+}
+
+static void
+diff_tests (void)
+{
+   assert_diff("{\"a\": 1, \"b\": {\"c\": [1, 2]}}",
+               "{\"a\": 1, \"b\": {\"c\": [1, 2]}}",
+               "{}");
+   assert_diff("{\"a\": 1, \"b\": \"x\", \"c\": true}",
+               "{\"c\": false, \"a\": 2, \"d\": null}",
+               "{\"$set\": {\"c\": false, \"a\": 2, \"d\": null}, "
+               "\"$unset\": {\"b\": 1}}");
+   assert_diff("{\"a\": 1}", "{\"a\": 1.0}",
+               "{\"$set\": {\"a\": 1.0}}");
+   assert_diff("{\"profile\": {\"name\": \"someone with a long name\", "
+               "\"address\": {\"city\": \"Portland\", \"zip\": \"97201\"}, "
+               "\"tags\": [\"a\", \"b\"]}}",
+               "{\"profile\": {\"name\": \"someone with a long name\", "
+               "\"address\": {\"city\": \"Portland\", \"zip\": \"97202\"}, "
+               "\"tags\": [\"a\", \"b\", \"c\"]}}",
+               "{\"$set\": {\"profile.address.zip\": \"97202\", "
+               "\"profile.tags.2\": \"c\"}}");
+   assert_diff("{\"list\": [\"first\", \"second\", \"third\"]}",
+               "{\"list\": [\"first\", \"second\"]}",
+               "{\"$set\": {\"list\": [\"first\", \"second\"]}}");
+   assert_diff("{\"a\": {\"x\": 1, \"y\": 2}}",
+               "{\"a\": {}}",
+               "{\"$set\": {\"a\": {}}}");
+   assert_diff("{\"a\": {\"long field name\": 1, \"y\": 2}}",
+               "{\"a\": {\"long field name\": 1}}",
+               "{\"$unset\": {\"a.y\": 1}}");
+   assert_diff("{\"a\": {\"x\": 1}}", "{\"a\": [1]}",
+               "{\"$set\": {\"a\": [1]}}");
+
+   /*
+    * Fields that can not be named in a path. Nested ones set their parent,
+    * top-level ones require replacing the document.
+    */
+   assert_diff("{\"a.b\": 1, \"c\": 1}", "{\"a.b\": 1, \"c\": 2}",
+               "{\"$set\": {\"c\": 2}}");
+   assert_diff("{\"a.b\": 1}", "{\"a.b\": 2}", NULL);
+   assert_diff("{\"a\": 1, \"$b\": 1}", "{\"a\": 1}", NULL);
+   assert_diff("{\"a\": {\"b.c\": 1}}", "{\"a\": {\"b.c\": 2}}",
+               "{\"$set\": {\"a\": {\"b.c\": 2}}}");
+}
+
+static void
+typed_array_tests (void)
+{
+   MongoBsonIter iter;
+   MongoBson *bson;
+   GError *error = NULL;
+   gdouble *doubles;
+   gint64 int64s[4];
+   gint32 *ints;
+   gchar key[16];
+   guint n;
+   guint i;
+
+   /*
+    * Long enough to cross several key widths.
+    */
+   bson = mongo_bson_new();
+   mongo_bson_append_array_begin(bson, "ints");
+   for (i = 0; i < 1234; i++) {
+      g_snprintf(key, sizeof key, "%u", i);
+      mongo_bson_append_int(bson, key, (gint)i * 3 - 7);
+   }
+   mongo_bson_append_array_end(bson);
+   mongo_bson_append_array_begin(bson, "doubles");
+   for (i = 0; i < 103; i++) {
+      g_snprintf(key, sizeof key, "%u", i);
+      if (i == 50) {
+         mongo_bson_append_int64(bson, key, 50);
+      } else {
+         mongo_bson_append_double(bson, key, i / 4.0);
+      }
+   }
+   mongo_bson_append_array_end(bson);
+   mongo_bson_append_int(bson, "scalar", 1);
+
+   ints = g_new0(gint32, 1234);
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_find(&iter, "ints"));
+   g_assert(mongo_bson_iter_get_value_int_array(&iter, ints, 1234, &n));
+   g_assert_cmpint(n, ==, 1234);
+   for (i = 0; i < 1234; i++) {
+      g_assert_cmpint(ints[i], ==, (gint)i * 3 - 7);
+   }
+
+   /*
+    * A short buffer reports the length of the array.
+    */
+   g_assert(!mongo_bson_iter_get_value_int64_array(&iter, int64s, 4, &n));
+   g_assert_cmpint(n, ==, 1234);
+   g_assert_cmpint(int64s[3], ==, 2);
+   g_assert(!mongo_bson_iter_get_value_int_array(&iter, NULL, 0, &n));
+   g_assert_cmpint(n, ==, 1234);
+   g_free(ints);
+
+   doubles = g_new0(gdouble, 103);
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert(mongo_bson_iter_get_value_double_array(&iter, doubles, 103, &n));
+   g_assert_cmpint(n, ==, 103);
+   for (i = 0; i < 103; i++) {
+      g_assert_cmpfloat(doubles[i], ==, (i == 50) ? 50.0 : i / 4.0);
+   }
+
+   /*
+    * Doubles do not narrow to integers.
+    */
+   g_assert(!mongo_bson_iter_get_value_int64_array(&iter, int64s, 4, &n));
+   g_assert_cmpint(n, ==, 0);
+
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert(!mongo_bson_iter_get_value_int_array(&iter, NULL, 0, &n));
+   g_assert_cmpint(n, ==, 0);
+   mongo_bson_unref(bson);
+   g_free(doubles);
+
+   bson = mongo_bson_new_from_json("{\"empty\": [], "
+                                   "\"mixed\": [1, 2, \"three\"]}",
+                                   -1, &error);
+   g_assert_no_error(error);
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert(mongo_bson_iter_get_value_int64_array(&iter, NULL, 0, &n));
+   g_assert_cmpint(n, ==, 0);
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert(!mongo_bson_iter_get_value_int64_array(&iter, int64s, 4, &n));
+   g_assert_cmpint(n, ==, 2);
+   g_assert_cmpint(int64s[0], ==, 1);
+   g_assert_cmpint(int64s[1], ==, 2);
+   mongo_bson_unref(bson);
+
+   /*
+    * Keys other than the array index are decoded element by element.
+    */
+   bson = mongo_bson_new();
+   mongo_bson_append_array_begin(bson, "odd");
+   mongo_bson_append_int64(bson, "0", 10);
+   mongo_bson_append_int64(bson, "x", 11);
+   mongo_bson_append_int64(bson, "2", 12);
+   mongo_bson_append_array_end(bson);
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert(mongo_bson_iter_get_value_int64_array(&iter, int64s, 4, &n));
+   g_assert_cmpint(n, ==, 3);
+   g_assert_cmpint(int64s[0], ==, 10);
+   g_assert_cmpint(int64s[1], ==, 11);
+   g_assert_cmpint(int64s[2], ==, 12);
+   mongo_bson_unref(bson);
+
+   /*
+    * 64-bit integers only widen to doubles while they are exact.
+    */
+   bson = mongo_bson_new();
+   mongo_bson_append_array_begin(bson, "wide");
+   mongo_bson_append_int64(bson, "0", G_GINT64_CONSTANT(1) << 53);
+   mongo_bson_append_int64(bson, "1", -(G_GINT64_CONSTANT(1) << 62));
+   mongo_bson_append_int64(bson, "2", (G_GINT64_CONSTANT(1) << 53) + 1);
+   mongo_bson_append_int64(bson, "3", G_MAXINT64);
+   mongo_bson_append_array_end(bson);
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_next(&iter));
+   doubles = g_new0(gdouble, 4);
+   g_assert(!mongo_bson_iter_get_value_double_array(&iter, doubles, 4, &n));
+   g_assert_cmpint(n, ==, 2);
+   g_assert_cmpfloat(doubles[0], ==, 9007199254740992.0);
+   g_assert_cmpfloat(doubles[1], ==, -4611686018427387904.0);
+   g_free(doubles);
+   mongo_bson_unref(bson);
+}
+
+static void
+append_typed_array_tests (void)
+{
+   static const guint counts[] = { 0, 1, 10, 999, 1000, 10001 };
+   static const gchar *strings[] = { "zero", "", NULL, "dr\xc3\xa9" };
+   MongoBsonIter iter;
+   MongoBson *expected;
+   MongoBson *bson;
+   gdouble *doubles;
+   gint64 *int64s;
+   gint32 *ints;
+   gchar key[16];
+   guint n;
+   guint i;
+   guint j;
+
+   for (i = 0; i < G_N_ELEMENTS(counts); i++) {
+      n = counts[i];
+      ints = g_new(gint32, n);
+      int64s = g_new(gint64, n);
+      doubles = g_new(gdouble, n);
+
+      expected = mongo_bson_new();
+      mongo_bson_append_int(expected, "before", 1);
+      mongo_bson_append_array_begin(expected, "ints");
+      for (j = 0; j < n; j++) {
+         ints[j] = (gint32)j - 500;
+         g_snprintf(key, sizeof key, "%u", j);
+         mongo_bson_append_int(expected, key, ints[j]);
+      }
+      mongo_bson_append_array_end(expected);
+      mongo_bson_append_array_begin(expected, "int64s");
+      for (j = 0; j < n; j++) {
+         int64s[j] = G_GINT64_CONSTANT(1) << (j % 63);
+         g_snprintf(key, sizeof key, "%u", j);
+         mongo_bson_append_int64(expected, key, int64s[j]);
+      }
+      mongo_bson_append_array_end(expected);
+      mongo_bson_append_bson_begin(expected, "child");
+      mongo_bson_append_array_begin(expected, "doubles");
+      for (j = 0; j < n; j++) {
+         doubles[j] = j / 8.0;
+         g_snprintf(key, sizeof key, "%u", j);
+         mongo_bson_append_double(expected, key, doubles[j]);
+      }
+      mongo_bson_append_array_end(expected);
+      mongo_bson_append_bson_end(expected);
+      mongo_bson_append_int(expected, "after", 2);
+
+      bson = mongo_bson_new();
+      mongo_bson_append_int(bson, "before", 1);
+      mongo_bson_append_int_array(bson, "ints", ints, n);
+      mongo_bson_append_int64_array(bson, "int64s", int64s, n);
+      mongo_bson_append_bson_begin(bson, "child");
+      mongo_bson_append_double_array(bson, "doubles", doubles, n);
+      mongo_bson_append_bson_end(bson);
+      mongo_bson_append_int(bson, "after", 2);
+
+      g_assert(mongo_bson_equal(bson, expected));
+
+      mongo_bson_unref(expected);
+      mongo_bson_unref(bson);
+      g_free(ints);
+      g_free(int64s);
+      g_free(doubles);
+   }
+
+   bson = mongo_bson_new();
+   mongo_bson_append_string_array(bson, "strings", strings,
+                                  G_N_ELEMENTS(strings));
+   expected = mongo_bson_new();
+   mongo_bson_append_array_begin(expected, "strings");
+   mongo_bson_append_string(expected, "0", "zero");
+   mongo_bson_append_string(expected, "1", "");
+   mongo_bson_append_string(expected, "2", "");
+   mongo_bson_append_string(expected, "3", "dr\xc3\xa9");
+   mongo_bson_append_array_end(expected);
+   g_assert(mongo_bson_equal(bson, expected));
+
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_find(&iter, "strings"));
+   g_assert_cmpint(mongo_bson_iter_get_value_type(&iter), ==,
+                   MONGO_BSON_ARRAY);
+   mongo_bson_unref(expected);
+   mongo_bson_unref(bson);
+}
+
+static void
+binary_tests (void)
+{
+   static const guint8 payload[] = { 0x08, 0x96, 0x01, 0x00, 0xff };
+   MongoBsonBinarySubtype subtype = 0;
+   MongoBsonRawIter raw;
+   MongoBsonIter iter;
+   GInputStream *stream;
+   const guint8 *value;
+   const guint8 *data;
+   MongoBson *child;
+   MongoBson *other;
+   MongoBson *bson;
+   GError *error = NULL;
+   guint8 *copy;
+   gsize data_len;
+   gsize length;
+
+   bson = mongo_bson_new();
+   mongo_bson_append_binary(bson, "proto", MONGO_BSON_BINARY_USER,
+                            payload, sizeof payload);
+   mongo_bson_append_binary(bson, "empty", MONGO_BSON_BINARY_GENERIC,
+                            NULL, 0);
+
+   /*
+    * Values point into the document rather than being copied.
+    */
+   data = mongo_bson_get_data(bson, &data_len);
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpint(mongo_bson_iter_get_value_type(&iter), ==,
+                   MONGO_BSON_BINARY);
+   value = mongo_bson_iter_get_value_binary(&iter, &subtype, &length);
+   g_assert_cmpint(subtype, ==, MONGO_BSON_BINARY_USER);
+   g_assert_cmpint(length, ==, sizeof payload);
+   g_assert(value > data && (value + length) < (data + data_len));
+   g_assert(!memcmp(value, payload, length));
+   g_assert(mongo_bson_iter_next(&iter));
+   mongo_bson_iter_get_value_binary(&iter, &subtype, &length);
+   g_assert_cmpint(subtype, ==, MONGO_BSON_BINARY_GENERIC);
+   g_assert_cmpint(length, ==, 0);
+   g_assert(!mongo_bson_iter_next(&iter));
+
+   mongo_bson_raw_iter_init(&raw, bson);
+   g_assert(mongo_bson_raw_iter_next(&raw));
+   value = mongo_bson_raw_iter_get_value_binary(&raw, &subtype, &length);
+   g_assert_cmpint(subtype, ==, MONGO_BSON_BINARY_USER);
+   g_assert_cmpint(length, ==, sizeof payload);
+   g_assert(!memcmp(value, payload, length));
+
+   /*
+    * Streaming from inside an open child produces the same document.
+    */
+   other = mongo_bson_new();
+   mongo_bson_append_bson_begin(other, "child");
+   stream = g_memory_input_stream_new_from_data(payload, sizeof payload, NULL);
+   g_assert(mongo_bson_append_binary_from_stream(other, "proto",
+                                                 MONGO_BSON_BINARY_USER,
+                                                 stream, sizeof payload,
+                                                 NULL, &error));
+   g_assert_no_error(error);
+   mongo_bson_append_binary(other, "empty", MONGO_BSON_BINARY_GENERIC,
+                            NULL, 0);
+   mongo_bson_append_bson_end(other);
+   mongo_bson_iter_init(&iter, other);
+   g_assert(mongo_bson_iter_next(&iter));
+   child = mongo_bson_iter_get_value_bson(&iter);
+   g_assert(mongo_bson_equal(child, bson));
+   g_assert_cmpint(mongo_bson_hash(child), ==, mongo_bson_hash(bson));
+   mongo_bson_unref(child);
+   g_object_unref(stream);
+
+   /*
+    * A stream that ends early leaves the document unchanged.
+    */
+   data = mongo_bson_get_data(bson, &data_len);
+   copy = g_memdup(data, data_len);
+   stream = g_memory_input_stream_new_from_data(payload, sizeof payload, NULL);
+   g_assert(!mongo_bson_append_binary_from_stream(bson, "short",
+                                                  MONGO_BSON_BINARY_GENERIC,
+                                                  stream, 64, NULL, &error));
+   g_assert_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT);
+   g_clear_error(&error);
+   data = mongo_bson_get_data(bson, &length);
+   g_assert_cmpint(length, ==, data_len);
+   g_assert(!memcmp(data, copy, length));
+   g_object_unref(stream);
+   g_free(copy);
+
+   mongo_bson_unref(other);
+   mongo_bson_unref(bson);
+}
+
+static guint8 *
+flatten_vectors (GOutputVector *vectors,
+                 guint          n_vectors,
+                 gsize         *length)
+{
+   guint8 *data;
+   gsize offset = 0;
+   guint i;
+
+   *length = 0;
+   for (i = 0; i < n_vectors; i++) {
+      *length += vectors[i].size;
+   }
+
+   data = g_malloc(*length);
+   for (i = 0; i < n_vectors; i++) {
+      memcpy(data + offset, vectors[i].buffer, vectors[i].size);
+      offset += vectors[i].size;
+   }
+
+   return data;
+}
+
+static void
+external_tests (void)
+{
+   GOutputVector *vectors;
+   MongoBsonIter iter;
+   const guint8 *data;
+   MongoBson *expected;
+   MongoBson *bson;
+   GBytes *large;
+   GBytes *small;
+   GBytes *text;
+   guint8 *flat;
+   gchar *str;
+   gsize expected_len;
+   gsize length;
+   guint n_vectors;
+
+   flat = g_malloc(65536);
+   for (length = 0; length < 65536; length++) {
+      flat[length] = length * 7;
+   }
+   large = g_bytes_new_take(flat, 65536);
+   small = g_bytes_new_static("abc", 3);
+   str = g_strnfill(10000, 'x');
+   text = g_bytes_new_take(str, 10000);
+
+   expected = mongo_bson_new();
+   mongo_bson_append_int(expected, "n", 1);
+   mongo_bson_append_binary(expected, "large", MONGO_BSON_BINARY_GENERIC,
+                            g_bytes_get_data(large, NULL), 65536);
+   mongo_bson_append_array_begin(expected, "list");
+   mongo_bson_append_string(expected, "0", str);
+   mongo_bson_append_binary(expected, "1", MONGO_BSON_BINARY_USER,
+                            (const guint8 *)"abc", 3);
+   mongo_bson_append_array_end(expected);
+   mongo_bson_append_int(expected, "m", 2);
+
+   bson = mongo_bson_new();
+   mongo_bson_append_int(bson, "n", 1);
+   mongo_bson_append_binary_bytes(bson, "large", MONGO_BSON_BINARY_GENERIC,
+                                  large);
+   mongo_bson_append_array_begin(bson, "list");
+   mongo_bson_append_string_bytes(bson, "0", text);
+   mongo_bson_append_binary_bytes(bson, "1", MONGO_BSON_BINARY_USER, small);
+   mongo_bson_append_array_end(bson);
+   mongo_bson_append_int(bson, "m", 2);
+
+   /*
+    * Large values are their own segments, small ones are inline.
+    */
+   vectors = mongo_bson_get_vectors(bson, &n_vectors);
+   g_assert_cmpint(n_vectors, ==, 5);
+   g_assert(vectors[1].buffer == g_bytes_get_data(large, NULL));
+   g_assert(vectors[3].buffer == str);
+   flat = flatten_vectors(vectors, n_vectors, &length);
+   data = mongo_bson_get_data(expected, &expected_len);
+   g_assert_cmpint(length, ==, expected_len);
+   g_assert(!memcmp(flat, data, length));
+   g_free(vectors);
+   g_free(flat);
+
+   /*
+    * Reading the document leaves the segments alone.
+    */
+   vectors = mongo_bson_get_vectors(bson, &n_vectors);
+   g_assert(mongo_bson_equal(bson, expected));
+   data = mongo_bson_get_data(bson, &length);
+   g_assert(data == mongo_bson_get_data(bson, &length));
+   g_assert_cmpint(length, ==, expected_len);
+   g_free(vectors);
+   vectors = mongo_bson_get_vectors(bson, &n_vectors);
+   g_assert_cmpint(n_vectors, ==, 5);
+   g_assert(vectors[1].buffer == g_bytes_get_data(large, NULL));
+   g_free(vectors);
+
+   /*
+    * Modifying a value in place copies the values into its buffer.
+    */
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_find(&iter, "m"));
+   g_assert(mongo_bson_iter_set_value_int(&iter, bson, 3));
+   vectors = mongo_bson_get_vectors(bson, &n_vectors);
+   g_assert_cmpint(n_vectors, ==, 1);
+   g_assert_cmpint(vectors[0].size, ==, expected_len);
+   g_free(vectors);
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_find(&iter, "m"));
+   g_assert_cmpint(mongo_bson_iter_get_value_int(&iter), ==, 3);
+   mongo_bson_unref(bson);
+
+   /*
+    * Reading while a child is open keeps the child consistent.
+    */
+   bson = mongo_bson_new();
+   mongo_bson_append_int(bson, "n", 1);
+   mongo_bson_append_binary_bytes(bson, "large", MONGO_BSON_BINARY_GENERIC,
+                                  large);
+   mongo_bson_append_array_begin(bson, "list");
+   mongo_bson_append_string_bytes(bson, "0", text);
+   mongo_bson_get_data(bson, &length);
+   mongo_bson_append_binary_bytes(bson, "1", MONGO_BSON_BINARY_USER, small);
+   mongo_bson_append_array_end(bson);
+   mongo_bson_append_int(bson, "m", 2);
+   g_assert(mongo_bson_equal(bson, expected));
+   mongo_bson_unref(bson);
+
+   mongo_bson_unref(expected);
+   g_bytes_unref(large);
+   g_bytes_unref(small);
+   g_bytes_unref(text);
+}
+
+static void
+server_types_tests (void)
+{
+   MongoDecimal128 decimal;
+   MongoDecimal128 value;
+   MongoBsonRawIter raw;
+   MongoBsonIter iter2;
+   MongoBsonIter iter;
+   MongoObjectId oid;
+   MongoObjectId oid2;
+   const gchar *collection;
+   const gchar *str;
+   MongoBson *scope;
+   MongoBson *other;
+   MongoBson *bson;
+   guint32 timestamp;
+   guint32 increment;
+   gsize length;
+
+   mongo_object_id_init_from_string(&oid, "4e9e9a2c27c1a8a3ac000001");
+   mongo_decimal128_init_from_string(&decimal, "-12.50");
+   scope = mongo_bson_new();
+   mongo_bson_append_int(scope, "x", 1);
+
+   bson = mongo_bson_new();
+   mongo_bson_append_timestamp(bson, "ts", 1300000000, 7);
+   mongo_bson_append_decimal128(bson, "dec", &decimal);
+   mongo_bson_append_min_key(bson, "min");
+   mongo_bson_append_max_key(bson, "max");
+   mongo_bson_append_javascript(bson, "js", "return 1;");
+   mongo_bson_append_javascript_with_scope(bson, "jss", "return x;", scope);
+   mongo_bson_append_symbol(bson, "sym", "abc");
+   mongo_bson_append_dbpointer(bson, "ptr", "db.coll", &oid);
+   mongo_bson_append_int(bson, "last", 1);
+
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpint(mongo_bson_iter_get_value_type(&iter), ==,
+                   MONGO_BSON_TIMESTAMP);
+   mongo_bson_iter_get_value_timestamp(&iter, &timestamp, &increment);
+   g_assert_cmpint(timestamp, ==, 1300000000);
+   g_assert_cmpint(increment, ==, 7);
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpint(mongo_bson_iter_get_value_type(&iter), ==,
+                   MONGO_BSON_DECIMAL128);
+   mongo_bson_iter_get_value_decimal128(&iter, &value);
+   g_assert(!memcmp(&value, &decimal, sizeof value));
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpint(mongo_bson_iter_get_value_type(&iter), ==,
+                   MONGO_BSON_MIN_KEY);
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpint(mongo_bson_iter_get_value_type(&iter), ==,
+                   MONGO_BSON_MAX_KEY);
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpint(mongo_bson_iter_get_value_type(&iter), ==,
+                   MONGO_BSON_JAVASCRIPT);
+   str = mongo_bson_iter_get_value_javascript(&iter, &length);
+   g_assert_cmpstr(str, ==, "return 1;");
+   g_assert_cmpint(length, ==, 10);
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpint(mongo_bson_iter_get_value_type(&iter), ==,
+                   MONGO_BSON_JAVASCRIPT_WITH_SCOPE);
+   g_assert_cmpstr(mongo_bson_iter_get_value_javascript(&iter, NULL), ==,
+                   "return x;");
+   other = mongo_bson_iter_get_value_javascript_scope(&iter);
+   g_assert(mongo_bson_equal(other, scope));
+   mongo_bson_unref(other);
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpint(mongo_bson_iter_get_value_type(&iter), ==,
+                   MONGO_BSON_SYMBOL);
+   g_assert_cmpstr(mongo_bson_iter_get_value_symbol(&iter, NULL), ==, "abc");
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpint(mongo_bson_iter_get_value_type(&iter), ==,
+                   MONGO_BSON_DBPOINTER);
+   mongo_bson_iter_get_value_dbpointer(&iter, &collection, &oid2);
+   g_assert_cmpstr(collection, ==, "db.coll");
+   g_assert(mongo_object_id_equal(&oid, &oid2));
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpstr(mongo_bson_iter_get_key(&iter), ==, "last");
+   g_assert(!mongo_bson_iter_next(&iter));
+
+   /*
+    * The raw getter orders timestamps by seconds, then increment.
+    */
+   mongo_bson_raw_iter_init(&raw, bson);
+   g_assert(mongo_bson_raw_iter_next(&raw));
+   g_assert_cmpuint(mongo_bson_raw_iter_get_value_timestamp(&raw, NULL, NULL),
+                    ==, (G_GUINT64_CONSTANT(1300000000) << 32) | 7);
+   g_assert(mongo_bson_raw_iter_next(&raw));
+   mongo_bson_raw_iter_get_value_decimal128(&raw, &value);
+   g_assert(!memcmp(&value, &decimal, sizeof value));
+
+   /*
+    * Decimals compare and hash with the other numbers.
+    */
+   other = mongo_bson_new();
+   mongo_bson_append_timestamp(other, "ts", 1300000000, 7);
+   mongo_bson_append_double(other, "dec", -12.5);
+   mongo_bson_append_min_key(other, "min");
+   mongo_bson_append_max_key(other, "max");
+   mongo_bson_append_javascript(other, "js", "return 1;");
+   mongo_bson_append_javascript_with_scope(other, "jss", "return x;", scope);
+   mongo_bson_append_symbol(other, "sym", "abc");
+   mongo_bson_append_dbpointer(other, "ptr", "db.coll", &oid);
+   mongo_bson_append_int(other, "last", 1);
+   g_assert_cmpint(mongo_bson_compare(bson, other), ==, 0);
+   g_assert(!mongo_bson_equal(bson, other));
+   mongo_bson_unref(other);
+
+   other = mongo_bson_new();
+   mongo_bson_append_timestamp(other, "ts", 1300000000, 8);
+   g_assert_cmpint(mongo_bson_compare(bson, other), <, 0);
+   mongo_bson_unref(other);
+
+   mongo_bson_unref(scope);
+   mongo_bson_unref(bson);
+
+   mongo_decimal128_init_from_string(&decimal, "2.0");
+   bson = mongo_bson_new();
+   mongo_bson_append_decimal128(bson, "a", &decimal);
+   mongo_bson_append_int(bson, "b", 2);
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_next(&iter));
+   mongo_bson_iter_init(&iter2, bson);
+   g_assert(mongo_bson_iter_find(&iter2, "b"));
+   g_assert_cmpint(mongo_bson_iter_compare_value(&iter, &iter2), ==, 0);
+   g_assert_cmpuint(mongo_bson_iter_hash_value(&iter), ==,
+                    mongo_bson_iter_hash_value(&iter2));
+   mongo_bson_unref(bson);
+}
+
 gint
 main (gint   argc,
       gchar *argv[])
 {
    g_test_init(&argc, &argv, NULL);
    g_test_add_func("/MongoBson/append_tests", append_tests);
+   g_test_add_func("/MongoBson/append_child_tests", append_child_tests);
    g_test_add_func("/MongoBson/iter_tests", iter_tests);
+   g_test_add_func("/MongoBson/iter_multiple_tests", iter_multiple_tests);
+   g_test_add_func("/MongoBson/raw_iter_tests", raw_iter_tests);
+   g_test_add_func("/MongoBson/compare_tests", compare_tests);
+   g_test_add_func("/MongoBson/hash_tests", hash_tests);
+   g_test_add_func("/MongoBson/project_tests", project_tests);
+   g_test_add_func("/MongoBson/set_value_tests", set_value_tests);
+   g_test_add_func("/MongoBson/replace_value_tests", replace_value_tests);
+   g_test_add_func("/MongoBson/diff_tests", diff_tests);
+   g_test_add_func("/MongoBson/typed_array_tests", typed_array_tests);
+   g_test_add_func("/MongoBson/append_typed_array_tests",
+                   append_typed_array_tests);
+   g_test_add_func("/MongoBson/binary_tests", binary_tests);
+   g_test_add_func("/MongoBson/external_tests", external_tests);
+   g_test_add_func("/MongoBson/server_types_tests", server_types_tests);
    return g_test_run();
 }
@@ -0,0 +1,507 @@
+#include <mongo-glib/mongo-glib.h>
+#include <string.h>
+
+#include "mock-server.h"
+
+#define N_THREADS 8
+#define N_QUERIES 25
+
+static MongoClient *
+connect_client (MockServer *server)
+{
+   MongoClient *client;
+   GError *error = NULL;
+
+   client = g_object_new(MONGO_TYPE_CLIENT,
+                         "host", "127.0.0.1",
+                         "port", server->port,
+                         NULL);
+   g_assert(mongo_client_connect(client, NULL, &error));
+   g_assert_no_error(error);
+
+   return client;
+}
+
+static gint
+get_n (MongoBson *bson)
+{
+   MongoBsonIter iter;
+
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_find(&iter, "n"));
+   return mongo_bson_iter_get_value_int(&iter);
+}
+
+static GByteArray *
+threads_handler (MockServer   *server,
+                 guint         index,
+                 guint32       op,
+                 const guint8 *body,
+                 gsize         length)
+{
+   const gchar *json[1];
+   GByteArray *reply;
+   MongoBson *query;
+   guint32 flags;
+   gint32 limit;
+   gchar *str;
+
+   if (!index) {
+      return mock_ismaster(op, body);
+   }
+
+   g_assert_cmpint(op, ==, MONGO_OPERATION_QUERY);
+   query = mock_parse_query(body, length, &flags, &limit);
+   g_assert_cmpint(limit, ==, -1);
+   str = g_strdup_printf("{\"n\": %d}", get_n(query));
+   mongo_bson_unref(query);
+
+   json[0] = str;
+   reply = mock_reply(MONGO_REPLY_NONE, 0, json, 1);
+   g_free(str);
+
+   server->done = (index == (N_THREADS * N_QUERIES));
+
+   return reply;
+}
+
+static gpointer
+threads_worker (gpointer data)
+{
+   MongoClient *client = data;
+   MongoReply *reply;
+   MongoBson *query;
+   MongoBson *doc;
+   GError *error = NULL;
+   gint n;
+   gint i;
+
+   for (i = 0; i < N_QUERIES; i++) {
+      n = g_random_int_range(0, G_MAXINT32);
+      query = mongo_bson_new();
+      mongo_bson_append_int(query, "n", n);
+
+      /*
+       * Each thread must get the reply to its own message back.
+       */
+      if ((i % 2)) {
+         doc = mongo_client_send(client, "local.oplog.rs", query,
+                                 MONGO_OPERATION_QUERY, TRUE, NULL, &error);
+         g_assert_no_error(error);
+         g_assert(doc);
+         g_assert_cmpint(get_n(doc), ==, n);
+         mongo_bson_unref(doc);
+      } else {
+         reply = mongo_client_query(client, "local.oplog.rs",
+                                    MONGO_QUERY_NONE, 0, -1, query, NULL,
+                                    NULL, &error);
+         g_assert_no_error(error);
+         g_assert(reply);
+         g_assert_cmpint(reply->n_documents, ==, 1);
+         g_assert_cmpint(get_n(reply->documents[0]), ==, n);
+         mongo_reply_unref(reply);
+      }
+
+      mongo_bson_unref(query);
+   }
+
+   return NULL;
+}
+
+static void
+test_mongo_client_sync_threads (void)
+{
+   MongoClient *client;
+   MockServer server;
+   GThread *threads[N_THREADS];
+   guint i;
+
+   mock_server_start(&server, threads_handler);
+   client = connect_client(&server);
+
+   for (i = 0; i < N_THREADS; i++) {
+      threads[i] = g_thread_new("worker", threads_worker, client);
+   }
+   for (i = 0; i < N_THREADS; i++) {
+      g_thread_join(threads[i]);
+   }
+
+   mock_server_stop(&server);
+   g_object_unref(client);
+}
+
+static GByteArray *
+cursor_handler (MockServer   *server,
+                guint         index,
+                guint32       op,
+                const guint8 *body,
+                gsize         length)
+{
+   static const gchar *first[] = { "{\"n\": 1}", "{\"n\": 2}" };
+   static const gchar *second[] = { "{\"n\": 3}" };
+   MongoBson *query;
+   guint32 flags;
+   gint32 limit;
+
+   switch (index) {
+   case 0:
+      return mock_ismaster(op, body);
+   case 1:
+      g_assert_cmpint(op, ==, MONGO_OPERATION_QUERY);
+      query = mock_parse_query(body, length, &flags, &limit);
+      g_assert_cmpint(flags, ==, MONGO_QUERY_NONE);
+      g_assert_cmpint(limit, ==, 2);
+      mongo_bson_unref(query);
+      return mock_reply(MONGO_REPLY_NONE, 7, first, G_N_ELEMENTS(first));
+   case 2:
+      g_assert_cmpint(op, ==, MONGO_OPERATION_GET_MORE);
+      g_assert_cmpint(mock_parse_get_more(body, &limit), ==, 7);
+      g_assert_cmpint(limit, ==, 2);
+      server->done = TRUE;
+      return mock_reply(MONGO_REPLY_NONE, 0, second, G_N_ELEMENTS(second));
+   default:
+      g_assert_not_reached();
+      return NULL;
+   }
+}
+
+static void
+test_mongo_client_sync_cursor (void)
+{
+   MongoClient *client;
+   MongoCursor *cursor;
+   MockServer server;
+   MongoReply *reply;
+   MongoBson *query;
+   GError *error = NULL;
+
+   mock_server_start(&server, cursor_handler);
+   client = connect_client(&server);
+
+   query = mongo_bson_new();
+   cursor = mongo_cursor_new(client, "local.oplog.rs", query, NULL,
+                             MONGO_QUERY_NONE);
+   mongo_cursor_set_batch_size(cursor, 2);
+   mongo_bson_unref(query);
+
+   reply = mongo_cursor_next_batch(cursor, NULL, &error);
+   g_assert_no_error(error);
+   g_assert(reply);
+   g_assert_cmpint(reply->n_documents, ==, 2);
+   g_assert_cmpint(get_n(reply->documents[1]), ==, 2);
+   mongo_reply_unref(reply);
+
+   reply = mongo_cursor_next_batch(cursor, NULL, &error);
+   g_assert_no_error(error);
+   g_assert(reply);
+   g_assert_cmpint(reply->n_documents, ==, 1);
+   g_assert_cmpint(get_n(reply->documents[0]), ==, 3);
+   mongo_reply_unref(reply);
+
+   /*
+    * The cursor is exhausted, nothing more is sent.
+    */
+   g_assert(!mongo_cursor_next_batch(cursor, NULL, &error));
+   g_assert_no_error(error);
+
+   mock_server_stop(&server);
+   g_object_unref(cursor);
+   g_object_unref(client);
+}
+
+static GByteArray *
+cancel_handler (MockServer   *server,
+                guint         index,
+                guint32       op,
+                const guint8 *body,
+                gsize         length)
+{
+   static const gchar *first[] = {
+      "{\"ts\": {\"$timestamp\": {\"t\": 3, \"i\": 1}}}",
+   };
+   MongoBson *query;
+   guint64 cursor_id;
+   guint32 flags;
+   gint32 limit;
+
+   switch (index) {
+   case 0:
+      return mock_ismaster(op, body);
+   case 1:
+      g_assert_cmpint(op, ==, MONGO_OPERATION_QUERY);
+      query = mock_parse_query(body, length, &flags, &limit);
+      g_assert_cmpint(flags, ==, (MONGO_QUERY_TAILABLE_CURSOR |
+                                  MONGO_QUERY_AWAIT_DATA));
+      mongo_bson_unref(query);
+      return mock_reply(MONGO_REPLY_AWAIT_CAPABLE, 5,
+                        first, G_N_ELEMENTS(first));
+   case 2:
+      g_assert_cmpint(op, ==, MONGO_OPERATION_KILL_CURSORS);
+      memcpy(&cursor_id, body + 8, sizeof cursor_id);
+      g_assert_cmpint(cursor_id, ==, 5);
+      server->done = TRUE;
+      return NULL;
+   default:
+      g_assert_not_reached();
+      return NULL;
+   }
+}
+
+static void
+test_mongo_client_sync_cancel (void)
+{
+   GCancellable *cancellable;
+   MongoClient *client;
+   MongoCursor *cursor;
+   MockServer server;
+   MongoReply *reply;
+   MongoBson *query;
+   GError *error = NULL;
+
+   mock_server_start(&server, cancel_handler);
+   client = connect_client(&server);
+
+   query = mongo_bson_new();
+   cursor = mongo_cursor_new(client, "local.oplog.rs", query, NULL,
+                             (MONGO_QUERY_TAILABLE_CURSOR |
+                              MONGO_QUERY_AWAIT_DATA));
+   mongo_bson_unref(query);
+
+   cancellable = g_cancellable_new();
+   reply = mongo_cursor_next_batch(cursor, cancellable, &error);
+   g_assert_no_error(error);
+   g_assert_cmpint(reply->n_documents, ==, 1);
+   g_assert_cmphex(mongo_cursor_get_resume_from(cursor), ==,
+                   (G_GUINT64_CONSTANT(3) << 32) | 1);
+   mongo_reply_unref(reply);
+
+   /*
+    * The server cursor is killed before returning.
+    */
+   g_cancellable_cancel(cancellable);
+   g_assert(!mongo_cursor_next_batch(cursor, cancellable, &error));
+   g_assert_error(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+   g_clear_error(&error);
+
+   mock_server_stop(&server);
+   g_object_unref(cancellable);
+   g_object_unref(cursor);
+   g_object_unref(client);
+}
+
+static GByteArray *
+cancel_pending_handler (MockServer   *server,
+                        guint         index,
+                        guint32       op,
+                        const guint8 *body,
+                        gsize         length)
+{
+   static const gchar *first[] = { "{\"n\": 1}" };
+   MongoBson *query;
+   guint64 cursor_id;
+   guint32 flags;
+   gint32 limit;
+
+   switch (index) {
+   case 0:
+      return mock_ismaster(op, body);
+   case 1:
+      g_assert_cmpint(op, ==, MONGO_OPERATION_QUERY);
+      query = mock_parse_query(body, length, &flags, &limit);
+      mongo_bson_unref(query);
+      return mock_reply(MONGO_REPLY_NONE, 9, first, G_N_ELEMENTS(first));
+   case 2:
+      /*
+       * Never reply to the getMore.
+       */
+      g_assert_cmpint(op, ==, MONGO_OPERATION_GET_MORE);
+      g_assert_cmpint(mock_parse_get_more(body, &limit), ==, 9);
+      return NULL;
+   case 3:
+      g_assert_cmpint(op, ==, MONGO_OPERATION_KILL_CURSORS);
+      memcpy(&cursor_id, body + 8, sizeof cursor_id);
+      g_assert_cmpint(cursor_id, ==, 9);
+      server->done = TRUE;
+      return NULL;
+   default:
+      g_assert_not_reached();
+      return NULL;
+   }
+}
+
+static gpointer
+cancel_pending_worker (gpointer data)
+{
+   g_usleep(G_USEC_PER_SEC / 10);
+   g_cancellable_cancel(data);
+   return NULL;
+}
+
+static void
+test_mongo_client_sync_cancel_pending (void)
+{
+   GCancellable *cancellable;
+   MongoClient *client;
+   MongoCursor *cursor;
+   MockServer server;
+   MongoReply *reply;
+   MongoBson *query;
+   GThread *thread;
+   GError *error = NULL;
+
+   mock_server_start(&server, cancel_pending_handler);
+   client = connect_client(&server);
+
+   query = mongo_bson_new();
+   cursor = mongo_cursor_new(client, "local.oplog.rs", query, NULL,
+                             MONGO_QUERY_NONE);
+   mongo_bson_unref(query);
+
+   cancellable = g_cancellable_new();
+   reply = mongo_cursor_next_batch(cursor, cancellable, &error);
+   g_assert_no_error(error);
+   g_assert_cmpint(reply->n_documents, ==, 1);
+   mongo_reply_unref(reply);
+
+   /*
+    * The getMore is waiting on a reply that never comes, cancelling it
+    * from another thread fails the request and kills the server cursor.
+    */
+   thread = g_thread_new("cancel", cancel_pending_worker, cancellable);
+   g_assert(!mongo_cursor_next_batch(cursor, cancellable, &error));
+   g_assert_error(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+   g_clear_error(&error);
+   g_thread_join(thread);
+
+   mock_server_stop(&server);
+   g_object_unref(cancellable);
+   g_object_unref(cursor);
+   g_object_unref(client);
+}
+
+#define LARGE_SIZE (8 * 1024 * 1024)
+
+static GByteArray *
+large_handler (MockServer   *server,
+               guint         index,
+               guint32       op,
+               const guint8 *body,
+               gsize         length)
+{
+   static const gchar *json[] = { "{\"ok\": 1}" };
+   MongoBsonBinarySubtype subtype;
+   MongoBsonIter iter;
+   const guint8 *data;
+   MongoBson *query;
+   guint32 flags;
+   gint32 limit;
+   gsize size;
+   gsize i;
+
+   if (!index) {
+      return mock_ismaster(op, body);
+   }
+
+   g_assert_cmpint(op, ==, MONGO_OPERATION_QUERY);
+   query = mock_parse_query(body, length, &flags, &limit);
+   mongo_bson_iter_init(&iter, query);
+   g_assert(mongo_bson_iter_find(&iter, "data"));
+   data = mongo_bson_iter_get_value_binary(&iter, &subtype, &size);
+   g_assert_cmpint(size, ==, LARGE_SIZE);
+   for (i = 0; i < size; i++) {
+      if (data[i] != (guint8)(i * 7)) {
+         g_assert_not_reached();
+      }
+   }
+   g_assert(mongo_bson_iter_next(&iter));
+   g_assert_cmpint(mongo_bson_iter_get_value_int(&iter), ==, 1);
+   mongo_bson_unref(query);
+
+   server->done = TRUE;
+
+   return mock_reply(MONGO_REPLY_NONE, 0, json, G_N_ELEMENTS(json));
+}
+
+static void
+test_mongo_client_sync_large (void)
+{
+   MongoClient *client;
+   MockServer server;
+   MongoBson *query;
+   MongoBson *doc;
+   GError *error = NULL;
+   GBytes *bytes;
+   guint8 *data;
+   gsize i;
+
+   mock_server_start(&server, large_handler);
+   client = connect_client(&server);
+
+   /*
+    * The value is written from its own segment and does not fit in the
+    * socket buffer, so the write is resumed when the socket drains.
+    */
+   data = g_malloc(LARGE_SIZE);
+   for (i = 0; i < LARGE_SIZE; i++) {
+      data[i] = i * 7;
+   }
+   bytes = g_bytes_new_take(data, LARGE_SIZE);
+   query = mongo_bson_new();
+   mongo_bson_append_binary_bytes(query, "data", MONGO_BSON_BINARY_GENERIC,
+                                  bytes);
+   mongo_bson_append_int(query, "n", 1);
+
+   doc = mongo_client_send(client, "local.oplog.rs", query,
+                           MONGO_OPERATION_QUERY, TRUE, NULL, &error);
+   g_assert_no_error(error);
+   g_assert(doc);
+   mongo_bson_unref(doc);
+
+   mock_server_stop(&server);
+   mongo_bson_unref(query);
+   g_bytes_unref(bytes);
+   g_object_unref(client);
+}
+
+static void
+test_mongo_client_sync_not_connected (void)
+{
+   MongoClient *client;
+   MongoReply *reply;
+   MongoBson *query;
+   GError *error = NULL;
+
+   client = g_object_new(MONGO_TYPE_CLIENT, NULL);
+   query = mongo_bson_new();
+   reply = mongo_client_query(client, "local.oplog.rs", MONGO_QUERY_NONE,
+                              0, -1, query, NULL, NULL, &error);
+   g_assert(!reply);
+   g_assert_error(error, MONGO_CLIENT_ERROR,
+                  MONGO_CLIENT_ERROR_NOT_CONNECTED);
+   g_clear_error(&error);
+   mongo_bson_unref(query);
+   g_object_unref(client);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_type_init();
+   g_test_init(&argc, &argv, NULL);
+
+   g_test_add_func("/MongoClient/sync/threads",
+                   test_mongo_client_sync_threads);
+   g_test_add_func("/MongoClient/sync/cursor",
+                   test_mongo_client_sync_cursor);
+   g_test_add_func("/MongoClient/sync/cancel",
+                   test_mongo_client_sync_cancel);
+   g_test_add_func("/MongoClient/sync/cancel_pending",
+                   test_mongo_client_sync_cancel_pending);
+   g_test_add_func("/MongoClient/sync/large",
+                   test_mongo_client_sync_large);
+   g_test_add_func("/MongoClient/sync/not_connected",
+                   test_mongo_client_sync_not_connected);
+
+   return g_test_run();
+}
@@ -0,0 +1,480 @@
+#include <mongo-glib/mongo-glib.h>
+#include <string.h>
+
+#include "mock-server.h"
+
+static GMainLoop *gMainLoop;
+
+static void
+assert_bson_json (MongoBson   *bson,
+                  const gchar *json)
+{
+   MongoBson *expected;
+   GError *error = NULL;
+
+   expected = mongo_bson_new_from_json(json, -1, &error);
+   g_assert_no_error(error);
+   g_assert(mongo_bson_equal(bson, expected));
+   mongo_bson_unref(expected);
+}
+
+static void
+connect_cb (GObject      *object,
+            GAsyncResult *result,
+            gpointer      user_data)
+{
+   GError *error = NULL;
+
+   g_assert(mongo_client_connect_finish(MONGO_CLIENT(object), result, &error));
+   g_assert_no_error(error);
+   g_main_loop_quit(gMainLoop);
+}
+
+static MongoClient *
+connect_client (MockServer *server)
+{
+   MongoClient *client;
+
+   client = g_object_new(MONGO_TYPE_CLIENT,
+                         "host", "127.0.0.1",
+                         "port", server->port,
+                         NULL);
+   mongo_client_connect_async(client, NULL, connect_cb, NULL);
+   g_main_loop_run(gMainLoop);
+
+   return client;
+}
+
+static void
+run_cb (GObject      *object,
+        GAsyncResult *result,
+        gpointer      user_data)
+{
+   GError **error = user_data;
+   gboolean ret;
+
+   ret = mongo_cursor_run_finish(MONGO_CURSOR(object), result, error);
+   g_assert(ret == !*error);
+   g_main_loop_quit(gMainLoop);
+}
+
+static GByteArray *
+tailable_handler (MockServer   *server,
+                  guint         index,
+                  guint32       op,
+                  const guint8 *body,
+                  gsize         length)
+{
+   static const gchar *first[] = {
+      "{\"ts\": {\"$timestamp\": {\"t\": 1, \"i\": 1}}, \"op\": \"i\"}",
+      "{\"ts\": {\"$timestamp\": {\"t\": 1, \"i\": 2}}, \"op\": \"u\"}",
+   };
+   static const gchar *second[] = {
+      "{\"ts\": {\"$timestamp\": {\"t\": 2, \"i\": 1}}, \"op\": \"d\"}",
+   };
+   static const gchar *resumed[] = {
+      "{\"ts\": {\"$timestamp\": {\"t\": 3, \"i\": 1}}, \"op\": \"i\"}",
+   };
+   MongoBson *query;
+   guint64 cursor_id;
+   guint32 flags;
+   guint32 n_cursors;
+   gint32 limit;
+
+   switch (index) {
+   case 0:
+      return mock_ismaster(op, body);
+   case 1:
+      g_assert_cmpint(op, ==, MONGO_OPERATION_QUERY);
+      query = mock_parse_query(body, length, &flags, &limit);
+      g_assert_cmpint(flags, ==, (MONGO_QUERY_TAILABLE_CURSOR |
+                                  MONGO_QUERY_AWAIT_DATA |
+                                  MONGO_QUERY_OPLOG_REPLAY));
+      g_assert_cmpint(limit, ==, 100);
+      assert_bson_json(query, "{\"ns\": \"test.things\", "
+                       "\"ts\": {\"$gte\": {\"$timestamp\": "
+                       "{\"t\": 0, \"i\": 0}}}}");
+      mongo_bson_unref(query);
+      return mock_reply(MONGO_REPLY_AWAIT_CAPABLE, 42,
+                        first, G_N_ELEMENTS(first));
+   case 2:
+      /*
+       * An empty batch after the server waited for data.
+       */
+      g_assert_cmpint(op, ==, MONGO_OPERATION_GET_MORE);
+      g_assert_cmpint(mock_parse_get_more(body, &limit), ==, 42);
+      g_assert_cmpint(limit, ==, 100);
+      return mock_reply(MONGO_REPLY_AWAIT_CAPABLE, 42, NULL, 0);
+   case 3:
+      g_assert_cmpint(op, ==, MONGO_OPERATION_GET_MORE);
+      g_assert_cmpint(mock_parse_get_more(body, &limit), ==, 42);
+      return mock_reply(MONGO_REPLY_AWAIT_CAPABLE, 42,
+                        second, G_N_ELEMENTS(second));
+   case 4:
+      g_assert_cmpint(op, ==, MONGO_OPERATION_GET_MORE);
+      return mock_reply(MONGO_REPLY_CURSOR_NOT_FOUND, 0, NULL, 0);
+   case 5:
+      /*
+       * The cursor died, so the query resumes after the last timestamp.
+       */
+      g_assert_cmpint(op, ==, MONGO_OPERATION_QUERY);
+      query = mock_parse_query(body, length, &flags, &limit);
+      assert_bson_json(query, "{\"ns\": \"test.things\", "
+                       "\"ts\": {\"$gt\": {\"$timestamp\": "
+                       "{\"t\": 2, \"i\": 1}}}}");
+      mongo_bson_unref(query);
+      return mock_reply(MONGO_REPLY_AWAIT_CAPABLE, 43,
+                        resumed, G_N_ELEMENTS(resumed));
+   case 6:
+      g_assert_cmpint(op, ==, MONGO_OPERATION_KILL_CURSORS);
+      memcpy(&n_cursors, body + 4, sizeof n_cursors);
+      memcpy(&cursor_id, body + 8, sizeof cursor_id);
+      g_assert_cmpint(n_cursors, ==, 1);
+      g_assert_cmpint(cursor_id, ==, 43);
+      server->done = TRUE;
+      return NULL;
+   default:
+      g_assert_not_reached();
+      return NULL;
+   }
+}
+
+static void
+tailable_batch_cb (MongoCursor *cursor,
+                   MongoReply  *reply,
+                   gpointer     user_data)
+{
+   GCancellable *cancellable = user_data;
+   guint *n_batches;
+
+   n_batches = g_object_get_data(G_OBJECT(cursor), "n-batches");
+   g_assert_cmpint(reply->n_documents, >, 0);
+
+   switch ((*n_batches)++) {
+   case 0:
+      g_assert_cmpint(reply->n_documents, ==, 2);
+      g_assert_cmphex(mongo_cursor_get_resume_from(cursor), ==,
+                      (G_GUINT64_CONSTANT(1) << 32) | 2);
+      break;
+   case 1:
+      g_assert_cmpint(reply->n_documents, ==, 1);
+      break;
+   case 2:
+      g_assert_cmpint(reply->n_documents, ==, 1);
+      g_cancellable_cancel(cancellable);
+      break;
+   default:
+      g_assert_not_reached();
+   }
+}
+
+static void
+test_mongo_cursor_tailable (void)
+{
+   GCancellable *cancellable;
+   MongoCursor *cursor;
+   MongoClient *client;
+   MockServer server;
+   MongoBson *query;
+   GError *error = NULL;
+   guint n_batches = 0;
+
+   mock_server_start(&server, tailable_handler);
+   client = connect_client(&server);
+
+   query = mongo_bson_new_from_json("{\"ns\": \"test.things\", "
+                                    "\"ts\": {\"$gte\": {\"$timestamp\": "
+                                    "{\"t\": 0, \"i\": 0}}}}", -1, &error);
+   g_assert_no_error(error);
+   cursor = mongo_cursor_new(client, "local.oplog.rs", query, NULL,
+                             (MONGO_QUERY_TAILABLE_CURSOR |
+                              MONGO_QUERY_AWAIT_DATA |
+                              MONGO_QUERY_OPLOG_REPLAY));
+   mongo_cursor_set_batch_size(cursor, 100);
+   cancellable = g_cancellable_new();
+   g_object_set_data(G_OBJECT(cursor), "n-batches", &n_batches);
+   g_signal_connect(cursor, "batch", G_CALLBACK(tailable_batch_cb),
+                    cancellable);
+
+   mongo_cursor_run_async(cursor, cancellable, run_cb, &error);
+   g_main_loop_run(gMainLoop);
+   g_assert_error(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+   g_clear_error(&error);
+
+   g_assert_cmpint(n_batches, ==, 3);
+   g_assert_cmphex(mongo_cursor_get_resume_from(cursor), ==,
+                   (G_GUINT64_CONSTANT(3) << 32) | 1);
+
+   mock_server_stop(&server);
+   mongo_bson_unref(query);
+   g_object_unref(cancellable);
+   g_object_unref(cursor);
+   g_object_unref(client);
+}
+
+static GByteArray *
+exhaust_handler (MockServer   *server,
+                 guint         index,
+                 guint32       op,
+                 const guint8 *body,
+                 gsize         length)
+{
+   static const gchar *first[] = { "{\"_id\": 1}", "{\"_id\": 2}" };
+   static const gchar *second[] = { "{\"_id\": 3}" };
+   MongoBson *query;
+   guint32 flags;
+   gint32 limit;
+
+   switch (index) {
+   case 0:
+      return mock_ismaster(op, body);
+   case 1:
+      g_assert_cmpint(op, ==, MONGO_OPERATION_QUERY);
+      query = mock_parse_query(body, length, &flags, &limit);
+      g_assert_cmpint(flags, ==, MONGO_QUERY_NONE);
+      g_assert_cmpint(limit, ==, 2);
+      mongo_bson_unref(query);
+      return mock_reply(MONGO_REPLY_NONE, 7, first, G_N_ELEMENTS(first));
+   case 2:
+      g_assert_cmpint(op, ==, MONGO_OPERATION_GET_MORE);
+      g_assert_cmpint(mock_parse_get_more(body, &limit), ==, 7);
+      g_assert_cmpint(limit, ==, 2);
+      server->done = TRUE;
+      return mock_reply(MONGO_REPLY_NONE, 0, second, G_N_ELEMENTS(second));
+   default:
+      g_assert_not_reached();
+      return NULL;
+   }
+}
+
+static void
+count_batch_cb (MongoCursor *cursor,
+                MongoReply  *reply,
+                gpointer     user_data)
+{
+   guint *n_documents = user_data;
+
+   *n_documents += reply->n_documents;
+}
+
+static void
+test_mongo_cursor_exhaust (void)
+{
+   MongoCursor *cursor;
+   MongoClient *client;
+   MockServer server;
+   MongoBson *query;
+   GError *error = NULL;
+   guint n_documents = 0;
+
+   mock_server_start(&server, exhaust_handler);
+   client = connect_client(&server);
+
+   query = mongo_bson_new();
+   cursor = mongo_cursor_new(client, "local.oplog.rs", query, NULL,
+                             MONGO_QUERY_NONE);
+   mongo_cursor_set_batch_size(cursor, 2);
+   g_signal_connect(cursor, "batch", G_CALLBACK(count_batch_cb),
+                    &n_documents);
+
+   mongo_cursor_run_async(cursor, NULL, run_cb, &error);
+   g_main_loop_run(gMainLoop);
+   g_assert_no_error(error);
+   g_assert_cmpint(n_documents, ==, 3);
+
+   mock_server_stop(&server);
+   mongo_bson_unref(query);
+   g_object_unref(cursor);
+   g_object_unref(client);
+}
+
+static GByteArray *
+failure_handler (MockServer   *server,
+                 guint         index,
+                 guint32       op,
+                 const guint8 *body,
+                 gsize         length)
+{
+   static const gchar *failure[] = { "{\"$err\": \"bad query\", \"code\": 2}" };
+
+   switch (index) {
+   case 0:
+      return mock_ismaster(op, body);
+   case 1:
+      g_assert_cmpint(op, ==, MONGO_OPERATION_QUERY);
+      server->done = TRUE;
+      return mock_reply(MONGO_REPLY_QUERY_FAILURE, 0, failure, 1);
+   default:
+      g_assert_not_reached();
+      return NULL;
+   }
+}
+
+static void
+test_mongo_cursor_failure (void)
+{
+   MongoCursor *cursor;
+   MongoClient *client;
+   MockServer server;
+   MongoBson *query;
+   GError *error = NULL;
+   guint n_documents = 0;
+
+   mock_server_start(&server, failure_handler);
+   client = connect_client(&server);
+
+   query = mongo_bson_new();
+   cursor = mongo_cursor_new(client, "local.oplog.rs", query, NULL,
+                             MONGO_QUERY_TAILABLE_CURSOR);
+   g_signal_connect(cursor, "batch", G_CALLBACK(count_batch_cb),
+                    &n_documents);
+
+   mongo_cursor_run_async(cursor, NULL, run_cb, &error);
+   g_main_loop_run(gMainLoop);
+   g_assert_error(error, MONGO_CLIENT_ERROR,
+                  MONGO_CLIENT_ERROR_QUERY_FAILURE);
+   g_assert_cmpstr(error->message, ==, "bad query");
+   g_clear_error(&error);
+   g_assert_cmpint(n_documents, ==, 0);
+
+   mock_server_stop(&server);
+   mongo_bson_unref(query);
+   g_object_unref(cursor);
+   g_object_unref(client);
+}
+
+static GByteArray *
+context_handler (MockServer   *server,
+                 guint         index,
+                 guint32       op,
+                 const guint8 *body,
+                 gsize         length)
+{
+   static const gchar *docs[] = {
+      "{\"ts\": {\"$timestamp\": {\"t\": 1, \"i\": 1}}}",
+   };
+
+   switch (index) {
+   case 0:
+      return mock_ismaster(op, body);
+   case 1:
+      /*
+       * Nothing matched, so the query is sent again after a while.
+       */
+      g_assert_cmpint(op, ==, MONGO_OPERATION_QUERY);
+      return mock_reply(MONGO_REPLY_NONE, 0, NULL, 0);
+   case 2:
+      g_assert_cmpint(op, ==, MONGO_OPERATION_QUERY);
+      server->done = TRUE;
+      return mock_reply(MONGO_REPLY_NONE, 0, docs, G_N_ELEMENTS(docs));
+   default:
+      g_assert_not_reached();
+      return NULL;
+   }
+}
+
+static void
+cancel_batch_cb (MongoCursor *cursor,
+                 MongoReply  *reply,
+                 gpointer     user_data)
+{
+   g_cancellable_cancel(user_data);
+}
+
+static void
+test_mongo_cursor_context (void)
+{
+   GCancellable *cancellable;
+   GMainContext *context;
+   MongoCursor *cursor;
+   MongoClient *client;
+   MockServer server;
+   MongoBson *query;
+   GMainLoop *loop;
+   GError *error = NULL;
+
+   /*
+    * Nothing runs the global context, so the retry has to wait on the
+    * context the cursor was started from.
+    */
+   context = g_main_context_new();
+   g_main_context_push_thread_default(context);
+   loop = gMainLoop;
+   gMainLoop = g_main_loop_new(context, FALSE);
+
+   mock_server_start(&server, context_handler);
+   client = connect_client(&server);
+
+   query = mongo_bson_new();
+   cursor = mongo_cursor_new(client, "local.oplog.rs", query, NULL,
+                             MONGO_QUERY_TAILABLE_CURSOR);
+   cancellable = g_cancellable_new();
+   g_signal_connect(cursor, "batch", G_CALLBACK(cancel_batch_cb),
+                    cancellable);
+
+   mongo_cursor_run_async(cursor, cancellable, run_cb, &error);
+   g_main_loop_run(gMainLoop);
+   g_assert_error(error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+   g_clear_error(&error);
+
+   mock_server_stop(&server);
+   mongo_bson_unref(query);
+   g_object_unref(cancellable);
+   g_object_unref(cursor);
+   g_object_unref(client);
+
+   g_main_loop_unref(gMainLoop);
+   gMainLoop = loop;
+   g_main_context_pop_thread_default(context);
+   g_main_context_unref(context);
+}
+
+static void
+test_mongo_reply_new_from_data (void)
+{
+   static const gchar *docs[] = { "{\"a\": 1}", "{\"b\": \"two\"}" };
+   MongoReply *reply;
+   GByteArray *data;
+
+   data = mock_reply(MONGO_REPLY_AWAIT_CAPABLE, G_GUINT64_CONSTANT(1) << 40,
+                     docs, G_N_ELEMENTS(docs));
+
+   reply = mongo_reply_new_from_data(data->data, data->len);
+   g_assert(reply);
+   g_assert_cmpint(reply->flags, ==, MONGO_REPLY_AWAIT_CAPABLE);
+   g_assert_cmphex(reply->cursor_id, ==, G_GUINT64_CONSTANT(1) << 40);
+   g_assert_cmpint(reply->n_documents, ==, 2);
+   assert_bson_json(reply->documents[1], docs[1]);
+   mongo_reply_unref(reply);
+
+   /*
+    * Truncated, trailing garbage and too many documents.
+    */
+   g_assert(!mongo_reply_new_from_data(data->data, data->len - 1));
+   g_assert(!mongo_reply_new_from_data(data->data, 19));
+   g_byte_array_append(data, (guint8 *)"", 1);
+   g_assert(!mongo_reply_new_from_data(data->data, data->len));
+   data->data[16] = 3;
+   g_assert(!mongo_reply_new_from_data(data->data, data->len - 1));
+
+   g_byte_array_free(data, TRUE);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_type_init();
+   g_test_init(&argc, &argv, NULL);
+
+   gMainLoop = g_main_loop_new(NULL, FALSE);
+
+   g_test_add_func("/MongoReply/new_from_data",
+                   test_mongo_reply_new_from_data);
+   g_test_add_func("/MongoCursor/tailable", test_mongo_cursor_tailable);
+   g_test_add_func("/MongoCursor/exhaust", test_mongo_cursor_exhaust);
+   g_test_add_func("/MongoCursor/failure", test_mongo_cursor_failure);
+   g_test_add_func("/MongoCursor/context", test_mongo_cursor_context);
+
+   return g_test_run();
+}
@@ -0,0 +1,97 @@
+#include <math.h>
+
+#include <mongo-glib/mongo-glib.h>
+
+static void
+assert_round_trip (const gchar *string,
+                   guint64      high,
+                   guint64      low)
+{
+   MongoDecimal128 decimal;
+   gchar str[43];
+
+   g_assert(mongo_decimal128_init_from_string(&decimal, string));
+   g_assert_cmphex(decimal.high, ==, high);
+   g_assert_cmphex(decimal.low, ==, low);
+   mongo_decimal128_to_string_r(&decimal, str);
+   g_assert_cmpstr(str, ==, string);
+}
+
+static void
+test_mongo_decimal128_string (void)
+{
+   MongoDecimal128 decimal;
+   gchar str[43];
+
+   assert_round_trip("1", G_GUINT64_CONSTANT(0x3040000000000000), 1);
+   assert_round_trip("-1", G_GUINT64_CONSTANT(0xB040000000000000), 1);
+   assert_round_trip("0.1", G_GUINT64_CONSTANT(0x303E000000000000), 1);
+   assert_round_trip("-0.0", G_GUINT64_CONSTANT(0xB03E000000000000), 0);
+   assert_round_trip("1.00", G_GUINT64_CONSTANT(0x303C000000000000), 100);
+   assert_round_trip("0.001234", G_GUINT64_CONSTANT(0x3034000000000000),
+                     1234);
+   assert_round_trip("1.234E-7", G_GUINT64_CONSTANT(0x302C000000000000),
+                     1234);
+   assert_round_trip("1E+3", G_GUINT64_CONSTANT(0x3046000000000000), 1);
+   assert_round_trip("1E-6176", 0, 1);
+   assert_round_trip("9.999999999999999999999999999999999E+6144",
+                     G_GUINT64_CONSTANT(0x5FFFED09BEAD87C0),
+                     G_GUINT64_CONSTANT(0x378D8E63FFFFFFFF));
+   assert_round_trip("Infinity", G_GUINT64_CONSTANT(0x7800000000000000), 0);
+   assert_round_trip("-Infinity", G_GUINT64_CONSTANT(0xF800000000000000), 0);
+   assert_round_trip("NaN", G_GUINT64_CONSTANT(0x7C00000000000000), 0);
+
+   /*
+    * Other spellings are accepted and written in canonical form.
+    */
+   g_assert(mongo_decimal128_init_from_string(&decimal, "+12.5e2"));
+   mongo_decimal128_to_string_r(&decimal, str);
+   g_assert_cmpstr(str, ==, "1.25E+3");
+   g_assert(mongo_decimal128_init_from_string(&decimal, "inf"));
+   mongo_decimal128_to_string_r(&decimal, str);
+   g_assert_cmpstr(str, ==, "Infinity");
+
+   g_assert(!mongo_decimal128_init_from_string(&decimal, ""));
+   g_assert(!mongo_decimal128_init_from_string(&decimal, "1e"));
+   g_assert(!mongo_decimal128_init_from_string(&decimal, "1.2.3"));
+   g_assert(!mongo_decimal128_init_from_string(&decimal, "abc"));
+   g_assert(!mongo_decimal128_init_from_string(&decimal, "1E+7000"));
+   g_assert(!mongo_decimal128_init_from_string(
+         &decimal, "12345678901234567890123456789012345"));
+   g_assert(!mongo_decimal128_new_from_string("0x10"));
+}
+
+static void
+test_mongo_decimal128_to_double (void)
+{
+   MongoDecimal128 *decimal;
+   gchar *str;
+
+   decimal = mongo_decimal128_new_from_string("-1.5");
+   g_assert(decimal);
+   g_assert_cmpfloat(mongo_decimal128_to_double(decimal), ==, -1.5);
+   str = mongo_decimal128_to_string(decimal);
+   g_assert_cmpstr(str, ==, "-1.5");
+   g_free(str);
+   mongo_decimal128_free(decimal);
+
+   decimal = mongo_decimal128_new_from_string("NaN");
+   g_assert(isnan(mongo_decimal128_to_double(decimal)));
+   mongo_decimal128_free(decimal);
+
+   decimal = mongo_decimal128_new_from_string("-Infinity");
+   g_assert(isinf(mongo_decimal128_to_double(decimal)));
+   g_assert_cmpfloat(mongo_decimal128_to_double(decimal), <, 0.0);
+   mongo_decimal128_free(decimal);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_test_init(&argc, &argv, NULL);
+   g_test_add_func("/MongoDecimal128/string", test_mongo_decimal128_string);
+   g_test_add_func("/MongoDecimal128/to_double",
+                   test_mongo_decimal128_to_double);
+   return g_test_run();
+}
@@ -0,0 +1,156 @@
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <mongo-glib/mongo-glib.h>
+
+static guint32
+get_counter (const MongoObjectId *object_id)
+{
+   return (object_id->data[9] << 16) |
+          (object_id->data[10] << 8) |
+          object_id->data[11];
+}
+
+static void
+test_mongo_object_id_new (void)
+{
+   MongoObjectId *id1;
+   MongoObjectId *id2;
+   GTimeVal tv;
+   guint32 timestamp;
+
+   g_get_current_time(&tv);
+
+   id1 = mongo_object_id_new();
+   id2 = mongo_object_id_new();
+
+   memcpy(&timestamp, id1->data, sizeof timestamp);
+   timestamp = GUINT32_FROM_BE(timestamp);
+   g_assert_cmpint(ABS((glong)timestamp - tv.tv_sec), <=, 1);
+
+   /* Machine and process identifiers are shared. */
+   g_assert(!memcmp(&id1->data[4], &id2->data[4], 5));
+   g_assert_cmpint((get_counter(id1) + 1) & 0xFFFFFF, ==, get_counter(id2));
+
+   mongo_object_id_free(id1);
+   mongo_object_id_free(id2);
+}
+
+static void
+test_mongo_object_id_init_array (void)
+{
+   MongoObjectId ids[64];
+   guint i;
+
+   mongo_object_id_init_array(ids, G_N_ELEMENTS(ids));
+
+   for (i = 1; i < G_N_ELEMENTS(ids); i++) {
+      g_assert(!memcmp(ids[0].data, ids[i].data, 9));
+      g_assert_cmpint((get_counter(&ids[i - 1]) + 1) & 0xFFFFFF, ==,
+                      get_counter(&ids[i]));
+   }
+}
+
+static void
+test_mongo_object_id_string (void)
+{
+   MongoObjectId *id;
+   MongoObjectId id2;
+   gchar str[25];
+   gchar *dup;
+
+   id = mongo_object_id_new_from_string("4EA2BEFE000000010000ffff");
+   g_assert(id);
+   mongo_object_id_to_string_r(id, str);
+   g_assert_cmpstr(str, ==, "4ea2befe000000010000ffff");
+   dup = mongo_object_id_to_string(id);
+   g_assert_cmpstr(dup, ==, str);
+   g_free(dup);
+
+   g_assert(mongo_object_id_init_from_string(&id2, str));
+   g_assert(mongo_object_id_equal(id, &id2));
+   g_assert_cmpint(mongo_object_id_hash(id), ==, mongo_object_id_hash(&id2));
+   g_assert_cmpint(mongo_object_id_compare(id, &id2), ==, 0);
+
+   g_assert(!mongo_object_id_new_from_string(""));
+   g_assert(!mongo_object_id_new_from_string("4ea2befe00000001"));
+   g_assert(!mongo_object_id_new_from_string("4ea2befe000000010000fff"));
+   g_assert(!mongo_object_id_new_from_string("4ea2befe000000010000ffff0"));
+   g_assert(!mongo_object_id_new_from_string("4ea2befe000000010000fffg"));
+
+   mongo_object_id_free(id);
+}
+
+static void
+test_mongo_object_id_compare (void)
+{
+   MongoObjectId *id1;
+   MongoObjectId *id2;
+   GHashTable *hash;
+   GTimeVal tv;
+
+   id1 = mongo_object_id_new_from_string("4ea2befe000000010000ffff");
+   id2 = mongo_object_id_new_from_string("4ea2beff000000010000fffe");
+   g_assert_cmpint(mongo_object_id_compare(id1, id2), <, 0);
+   g_assert_cmpint(mongo_object_id_compare(id2, id1), >, 0);
+   g_assert(!mongo_object_id_equal(id1, id2));
+
+   mongo_object_id_get_timeval(id1, &tv);
+   g_assert_cmpint(tv.tv_sec, ==, 0x4ea2befe);
+
+   hash = g_hash_table_new(mongo_object_id_hash, mongo_object_id_equal);
+   g_hash_table_insert(hash, id1, id1);
+   g_assert(g_hash_table_lookup(hash, id1) == id1);
+   g_assert(!g_hash_table_lookup(hash, id2));
+   g_hash_table_unref(hash);
+
+   mongo_object_id_free(id1);
+   mongo_object_id_free(id2);
+}
+
+static void
+test_mongo_object_id_fork (void)
+{
+   MongoObjectId parent;
+   MongoObjectId child;
+   guint16 pid;
+   gint fds[2];
+   gint status;
+   pid_t child_pid;
+
+   mongo_object_id_init(&parent);
+   g_assert(!pipe(fds));
+
+   if (!(child_pid = fork())) {
+      mongo_object_id_init(&child);
+      _exit(write(fds[1], &child, sizeof child) != sizeof child);
+   }
+
+   g_assert_cmpint(child_pid, >, 0);
+   g_assert_cmpint(read(fds[0], &child, sizeof child), ==, sizeof child);
+   g_assert_cmpint(waitpid(child_pid, &status, 0), ==, child_pid);
+   g_assert(WIFEXITED(status) && !WEXITSTATUS(status));
+   close(fds[0]);
+   close(fds[1]);
+
+   /*
+    * The child has the machine identifier but its own process identifier.
+    */
+   g_assert(!memcmp(&parent.data[4], &child.data[4], 3));
+   memcpy(&pid, &child.data[7], sizeof pid);
+   g_assert_cmpint(GUINT16_FROM_BE(pid), ==, (guint16)child_pid);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_test_init(&argc, &argv, NULL);
+   g_test_add_func("/MongoObjectId/new", test_mongo_object_id_new);
+   g_test_add_func("/MongoObjectId/init_array", test_mongo_object_id_init_array);
+   g_test_add_func("/MongoObjectId/string", test_mongo_object_id_string);
+   g_test_add_func("/MongoObjectId/compare", test_mongo_object_id_compare);
+   g_test_add_func("/MongoObjectId/fork", test_mongo_object_id_fork);
+   return g_test_run();
+}
@@ -0,0 +1,339 @@
+#include <glib/gstdio.h>
+#include <mongo-glib/mongo-glib.h>
+#include <string.h>
+
+#include "mock-server.h"
+
+#define TIMESTAMP(t, i) ((G_GUINT64_CONSTANT(t) << 32) | (i))
+
+static GMainLoop *gMainLoop;
+static guint64    gLastApplied;
+
+static void
+connect_cb (GObject      *object,
+            GAsyncResult *result,
+            gpointer      user_data)
+{
+   GError *error = NULL;
+
+   g_assert(mongo_client_connect_finish(MONGO_CLIENT(object), result, &error));
+   g_assert_no_error(error);
+   g_main_loop_quit(gMainLoop);
+}
+
+static MongoClient *
+connect_client (MockServer *server)
+{
+   MongoClient *client;
+
+   client = g_object_new(MONGO_TYPE_CLIENT,
+                         "host", "127.0.0.1",
+                         "port", server->port,
+                         NULL);
+   mongo_client_connect_async(client, NULL, connect_cb, NULL);
+   g_main_loop_run(gMainLoop);
+
+   return client;
+}
+
+static void
+run_cb (GObject      *object,
+        GAsyncResult *result,
+        gpointer      user_data)
+{
+   GError **error = user_data;
+
+   g_assert(!mongo_oplog_reader_run_finish(MONGO_OPLOG_READER(object),
+                                           result, error));
+   g_main_loop_quit(gMainLoop);
+}
+
+static gchar *
+create_checkpoint_file (const guint8 *data,
+                        gsize         length)
+{
+   GError *error = NULL;
+   gchar *filename;
+   gint fd;
+
+   fd = g_file_open_tmp("test-mongo-oplog-reader-XXXXXX", &filename, &error);
+   g_assert_no_error(error);
+   g_close(fd, NULL);
+   g_file_set_contents(filename, (const gchar *)data, length, &error);
+   g_assert_no_error(error);
+
+   return filename;
+}
+
+static guint64
+get_timestamp (MongoBson *bson)
+{
+   MongoBsonIter iter;
+   guint32 timestamp;
+   guint32 increment;
+
+   mongo_bson_iter_init(&iter, bson);
+   g_assert(mongo_bson_iter_find(&iter, "ts"));
+   mongo_bson_iter_get_value_timestamp(&iter, &timestamp, &increment);
+
+   return ((guint64)timestamp << 32) | increment;
+}
+
+static GByteArray *
+batches_handler (MockServer   *server,
+                 guint         index,
+                 guint32       op,
+                 const guint8 *body,
+                 gsize         length)
+{
+   static const gchar *first[] = {
+      "{\"ts\": {\"$timestamp\": {\"t\": 6, \"i\": 1}}, \"ns\": \"test.things\"}",
+      "{\"ts\": {\"$timestamp\": {\"t\": 6, \"i\": 2}}, \"ns\": \"test.things\"}",
+      "{\"ts\": {\"$timestamp\": {\"t\": 6, \"i\": 3}}, \"ns\": \"test.things\"}",
+      "{\"ts\": {\"$timestamp\": {\"t\": 6, \"i\": 4}}, \"ns\": \"test.things\"}",
+      "{\"ts\": {\"$timestamp\": {\"t\": 6, \"i\": 5}}, \"ns\": \"test.things\"}",
+   };
+   static const gchar *second[] = {
+      "{\"ts\": {\"$timestamp\": {\"t\": 7, \"i\": 1}}, \"ns\": \"test.things\"}",
+   };
+   MongoBson *expected;
+   MongoBson *query;
+   GError *error = NULL;
+   guint64 cursor_id;
+   guint32 flags;
+   gint32 limit;
+
+   switch (index) {
+   case 0:
+      return mock_ismaster(op, body);
+   case 1:
+      g_assert_cmpint(op, ==, MONGO_OPERATION_QUERY);
+      query = mock_parse_query(body, length, &flags, &limit);
+      g_assert_cmpint(flags, ==, (MONGO_QUERY_TAILABLE_CURSOR |
+                                  MONGO_QUERY_AWAIT_DATA |
+                                  MONGO_QUERY_OPLOG_REPLAY));
+      expected = mongo_bson_new_from_json("{\"ns\": \"test.things\", "
+                                          "\"ts\": {\"$gt\": {\"$timestamp\": "
+                                          "{\"t\": 5, \"i\": 0}}}}",
+                                          -1, &error);
+      g_assert_no_error(error);
+      g_assert(mongo_bson_equal(query, expected));
+      mongo_bson_unref(expected);
+      mongo_bson_unref(query);
+      return mock_reply(MONGO_REPLY_AWAIT_CAPABLE, 9,
+                        first, G_N_ELEMENTS(first));
+   case 2:
+      /*
+       * Hold the reply longer than the batch delay, so the last entry of
+       * the first reply is applied on its own.
+       */
+      g_assert_cmpint(op, ==, MONGO_OPERATION_GET_MORE);
+      g_assert_cmpint(mock_parse_get_more(body, &limit), ==, 9);
+      g_usleep(300 * 1000);
+      return mock_reply(MONGO_REPLY_AWAIT_CAPABLE, 9,
+                        second, G_N_ELEMENTS(second));
+   case 3:
+      g_assert_cmpint(op, ==, MONGO_OPERATION_GET_MORE);
+      g_usleep(300 * 1000);
+      return mock_reply(MONGO_REPLY_AWAIT_CAPABLE, 9, NULL, 0);
+   case 4:
+      g_assert_cmpint(op, ==, MONGO_OPERATION_KILL_CURSORS);
+      memcpy(&cursor_id, body + 8, sizeof cursor_id);
+      g_assert_cmpint(cursor_id, ==, 9);
+      server->done = TRUE;
+      return NULL;
+   default:
+      g_assert_not_reached();
+      return NULL;
+   }
+}
+
+static gboolean
+batches_apply (MongoOplogReader  *reader,
+               MongoBson        **entries,
+               guint              n_entries,
+               gpointer           user_data,
+               GError           **error)
+{
+   GArray *sizes = user_data;
+   guint64 ts;
+   guint i;
+
+   g_array_append_val(sizes, n_entries);
+
+   for (i = 0; i < n_entries; i++) {
+      ts = get_timestamp(entries[i]);
+      g_assert_cmphex(ts, >, gLastApplied);
+      gLastApplied = ts;
+      if (ts == TIMESTAMP(7, 1)) {
+         g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Index offline");
+         return FALSE;
+      }
+   }
+
+   /*
+    * The checkpoint only covers batches that were applied.
+    */
+   g_assert_cmphex(mongo_oplog_reader_get_checkpoint(reader), <,
+                   get_timestamp(entries[0]));
+
+   return TRUE;
+}
+
+/*
+ * With @data set, the reader runs on a thread-default context that is not
+ * the global one, which the batch delay has to be timed on.
+ */
+static void
+test_mongo_oplog_reader_batches (gconstpointer data)
+{
+   static const guint expected_sizes[] = { 2, 2, 1, 1 };
+   MongoOplogReader *reader;
+   GMainContext *context = NULL;
+   MongoClient *client;
+   MockServer server;
+   const guint8 *checkpoint;
+   MongoBson *bson;
+   GMainLoop *loop = NULL;
+   GArray *sizes;
+   GError *error = NULL;
+   gchar *filename;
+   gchar *contents;
+   gsize length;
+   guint i;
+
+   if (data) {
+      context = g_main_context_new();
+      g_main_context_push_thread_default(context);
+      loop = gMainLoop;
+      gMainLoop = g_main_loop_new(context, FALSE);
+   }
+
+   gLastApplied = 0;
+   bson = mongo_bson_new();
+   mongo_bson_append_timestamp(bson, "ts", 5, 0);
+   checkpoint = mongo_bson_get_data(bson, &length);
+   filename = create_checkpoint_file(checkpoint, length);
+   mongo_bson_unref(bson);
+
+   mock_server_start(&server, batches_handler);
+   client = connect_client(&server);
+
+   bson = mongo_bson_new_from_json("{\"ns\": \"test.things\"}", -1, &error);
+   g_assert_no_error(error);
+   sizes = g_array_new(FALSE, FALSE, sizeof(guint));
+   reader = mongo_oplog_reader_new(client);
+   mongo_oplog_reader_set_query(reader, bson);
+   mongo_oplog_reader_set_checkpoint_file(reader, filename);
+   mongo_oplog_reader_set_max_batch_size(reader, 2);
+   mongo_oplog_reader_set_max_batch_delay(reader, 50);
+   mongo_oplog_reader_set_apply_func(reader, batches_apply, sizes, NULL);
+   mongo_bson_unref(bson);
+
+   mongo_oplog_reader_run_async(reader, NULL, run_cb, &error);
+   g_main_loop_run(gMainLoop);
+   g_assert_error(error, G_IO_ERROR, G_IO_ERROR_FAILED);
+   g_clear_error(&error);
+
+   g_assert_cmpint(sizes->len, ==, G_N_ELEMENTS(expected_sizes));
+   for (i = 0; i < sizes->len; i++) {
+      g_assert_cmpint(g_array_index(sizes, guint, i), ==, expected_sizes[i]);
+   }
+
+   /*
+    * The failed batch is not part of the checkpoint.
+    */
+   g_assert_cmphex(mongo_oplog_reader_get_checkpoint(reader), ==,
+                   TIMESTAMP(6, 5));
+   g_assert(g_file_get_contents(filename, &contents, &length, &error));
+   g_assert_no_error(error);
+   bson = mongo_bson_new_from_data((const guint8 *)contents, length);
+   g_assert_cmphex(get_timestamp(bson), ==, TIMESTAMP(6, 5));
+   mongo_bson_unref(bson);
+   g_free(contents);
+
+   mock_server_stop(&server);
+   g_object_unref(reader);
+   g_object_unref(client);
+   g_array_free(sizes, TRUE);
+   g_unlink(filename);
+   g_free(filename);
+
+   if (context) {
+      g_main_loop_unref(gMainLoop);
+      gMainLoop = loop;
+      g_main_context_pop_thread_default(context);
+      g_main_context_unref(context);
+   }
+}
+
+static GByteArray *
+connect_handler (MockServer   *server,
+                 guint         index,
+                 guint32       op,
+                 const guint8 *body,
+                 gsize         length)
+{
+   server->done = TRUE;
+   return mock_ismaster(op, body);
+}
+
+static gboolean
+unreached_apply (MongoOplogReader  *reader,
+                 MongoBson        **entries,
+                 guint              n_entries,
+                 gpointer           user_data,
+                 GError           **error)
+{
+   g_assert_not_reached();
+   return FALSE;
+}
+
+static void
+test_mongo_oplog_reader_invalid_checkpoint (void)
+{
+   MongoOplogReader *reader;
+   MongoClient *client;
+   MockServer server;
+   GError *error = NULL;
+   gchar *filename;
+
+   filename = create_checkpoint_file((const guint8 *)"garbage", 7);
+
+   mock_server_start(&server, connect_handler);
+   client = connect_client(&server);
+
+   reader = mongo_oplog_reader_new(client);
+   mongo_oplog_reader_set_checkpoint_file(reader, filename);
+   mongo_oplog_reader_set_apply_func(reader, unreached_apply, NULL, NULL);
+   mongo_oplog_reader_run_async(reader, NULL, run_cb, &error);
+   g_main_loop_run(gMainLoop);
+   g_assert_error(error, MONGO_OPLOG_READER_ERROR,
+                  MONGO_OPLOG_READER_ERROR_INVALID_CHECKPOINT);
+   g_clear_error(&error);
+
+   mock_server_stop(&server);
+   g_object_unref(reader);
+   g_object_unref(client);
+   g_unlink(filename);
+   g_free(filename);
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_type_init();
+   g_test_init(&argc, &argv, NULL);
+
+   gMainLoop = g_main_loop_new(NULL, FALSE);
+
+   g_test_add_data_func("/MongoOplogReader/batches", NULL,
+                        test_mongo_oplog_reader_batches);
+   g_test_add_data_func("/MongoOplogReader/batches_context", "context",
+                        test_mongo_oplog_reader_batches);
+   g_test_add_func("/MongoOplogReader/invalid_checkpoint",
+                   test_mongo_oplog_reader_invalid_checkpoint);
+
+   return g_test_run();
+}
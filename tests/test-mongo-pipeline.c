@@ -0,0 +1,296 @@
+#include <mongo-glib/mongo-glib.h>
+#include <string.h>
+
+static const gchar *gDocuments[] = {
+   "{\"_id\": 1, \"kind\": \"a\", \"n\": 3, \"x\": 1.5, \"tags\": {\"c\": \"red\"}}",
+   "{\"_id\": 2, \"kind\": \"b\", \"n\": 1, \"x\": 2.5}",
+   "{\"_id\": 3, \"kind\": \"a\", \"n\": 4, \"tags\": {\"c\": \"blue\"}}",
+   "{\"_id\": 4, \"n\": 2, \"x\": 1}",
+   "{\"_id\": 5, \"kind\": \"b\", \"n\": 5, \"x\": null}",
+   "{\"_id\": 6, \"kind\": \"a\", \"n\": 1.0, \"tags\": {\"c\": \"red\"}}",
+};
+
+static MongoPipeline *
+create_pipeline (const gchar *stages)
+{
+   MongoPipeline *pipeline;
+   MongoBson *bson;
+   GError *error = NULL;
+
+   bson = mongo_bson_new_from_json(stages, -1, &error);
+   g_assert_no_error(error);
+   pipeline = mongo_pipeline_new(bson, &error);
+   g_assert_no_error(error);
+   g_assert(pipeline);
+   mongo_bson_unref(bson);
+
+   return pipeline;
+}
+
+static void
+assert_results (MongoPipeline *pipeline,
+                const gchar   *expected[],
+                guint          n_expected)
+{
+   MongoBson *expected_bson;
+   MongoBson *bson;
+   GError *error = NULL;
+   gchar *json;
+   guint i;
+
+   for (i = 0; i < n_expected; i++) {
+      bson = mongo_pipeline_pop(pipeline);
+      g_assert(bson);
+      expected_bson = mongo_bson_new_from_json(expected[i], -1, &error);
+      g_assert_no_error(error);
+      if (!mongo_bson_equal(bson, expected_bson)) {
+         json = mongo_bson_to_json(bson, MONGO_BSON_JSON_CANONICAL);
+         g_error("Expected %s, got %s", expected[i], json);
+      }
+      mongo_bson_unref(expected_bson);
+      mongo_bson_unref(bson);
+   }
+
+   g_assert(!mongo_pipeline_pop(pipeline));
+}
+
+static void
+run_pipeline (const gchar *stages,
+              const gchar *expected[],
+              guint        n_expected)
+{
+   MongoPipeline *pipeline;
+   MongoBson *bson;
+   GError *error = NULL;
+   guint i;
+
+   pipeline = create_pipeline(stages);
+
+   for (i = 0; i < G_N_ELEMENTS(gDocuments); i++) {
+      bson = mongo_bson_new_from_json(gDocuments[i], -1, &error);
+      g_assert_no_error(error);
+      mongo_pipeline_push(pipeline, bson);
+      mongo_bson_unref(bson);
+   }
+
+   mongo_pipeline_finish(pipeline);
+   assert_results(pipeline, expected, n_expected);
+   mongo_pipeline_unref(pipeline);
+}
+
+static void
+match_project_tests (void)
+{
+   static const gchar *expected[] = {
+      "{\"_id\": 1, \"n\": 3}",
+      "{\"_id\": 3, \"n\": 4}",
+      "{\"_id\": 6, \"n\": 1.0}",
+   };
+   static const gchar *excluded[] = {
+      "{\"kind\": \"b\"}",
+      "{\"kind\": \"b\"}",
+   };
+
+   run_pipeline("{\"0\": {\"$match\": {\"kind\": \"a\"}}, "
+                "\"1\": {\"$project\": {\"n\": 1}}}",
+                expected, G_N_ELEMENTS(expected));
+   run_pipeline("{\"0\": {\"$match\": {\"kind\": \"b\"}}, "
+                "\"1\": {\"$project\": {\"_id\": 0, \"n\": 0, \"x\": 0}}}",
+                excluded, G_N_ELEMENTS(excluded));
+}
+
+static void
+group_tests (void)
+{
+   static const gchar *expected[] = {
+      "{\"_id\": \"a\", \"total\": 8.0, \"count\": 3, \"avg\": 1.5, "
+      "\"lo\": 1.5, \"hi\": 1.5}",
+      "{\"_id\": \"b\", \"total\": 6, \"count\": 2, \"avg\": 2.5, "
+      "\"lo\": 2.5, \"hi\": 2.5}",
+      "{\"_id\": null, \"total\": 2, \"count\": 1, \"avg\": 1.0, "
+      "\"lo\": 1, \"hi\": 1}",
+   };
+   static const gchar *compound[] = {
+      "{\"_id\": {\"k\": \"a\", \"c\": \"red\"}, \"n\": 2}",
+      "{\"_id\": {\"k\": \"b\"}, \"n\": 2}",
+      "{\"_id\": {\"k\": \"a\", \"c\": \"blue\"}, \"n\": 1}",
+      "{\"_id\": {}, \"n\": 1}",
+   };
+   static const gchar *numeric[] = {
+      "{\"_id\": 3, \"ids\": 1}",
+      "{\"_id\": 1, \"ids\": 8}",
+      "{\"_id\": 4, \"ids\": 3}",
+      "{\"_id\": 2, \"ids\": 4}",
+      "{\"_id\": 5, \"ids\": 5}",
+   };
+
+   run_pipeline("{\"0\": {\"$group\": {\"_id\": \"$kind\", "
+                "\"total\": {\"$sum\": \"$n\"}, \"count\": {\"$count\": {}}, "
+                "\"avg\": {\"$avg\": \"$x\"}, \"lo\": {\"$min\": \"$x\"}, "
+                "\"hi\": {\"$max\": \"$x\"}}}}",
+                expected, G_N_ELEMENTS(expected));
+   run_pipeline("{\"0\": {\"$group\": {\"_id\": {\"k\": \"$kind\", "
+                "\"c\": \"$tags.c\"}, \"n\": {\"$sum\": 1}}}}",
+                compound, G_N_ELEMENTS(compound));
+
+   /*
+    * 1 and 1.0 belong to the same group.
+    */
+   run_pipeline("{\"0\": {\"$group\": {\"_id\": \"$n\", "
+                "\"ids\": {\"$sum\": \"$_id\"}}}}",
+                numeric, G_N_ELEMENTS(numeric));
+}
+
+static void
+sort_limit_tests (void)
+{
+   static const gchar *expected[] = {
+      "{\"_id\": 5}",
+      "{\"_id\": 3}",
+   };
+   static const gchar *skipped[] = {
+      "{\"_id\": 6}",
+      "{\"_id\": 4}",
+      "{\"_id\": 1}",
+   };
+   static const gchar *grouped[] = {
+      "{\"_id\": \"b\", \"n\": 6}",
+   };
+
+   run_pipeline("{\"0\": {\"$sort\": {\"n\": -1}}, \"1\": {\"$limit\": 2}, "
+                "\"2\": {\"$project\": {\"_id\": 1}}}",
+                expected, G_N_ELEMENTS(expected));
+
+   /*
+    * Equal keys keep their input order, so 2 is skipped rather than 6.
+    */
+   run_pipeline("{\"0\": {\"$sort\": {\"n\": 1}}, \"1\": {\"$skip\": 1}, "
+                "\"2\": {\"$limit\": 3}, \"3\": {\"$project\": {\"_id\": 1}}, "
+                "\"4\": {\"$sort\": {\"_id\": -1}}}",
+                skipped, G_N_ELEMENTS(skipped));
+   run_pipeline("{\"0\": {\"$group\": {\"_id\": \"$kind\", "
+                "\"n\": {\"$sum\": \"$n\"}}}, \"1\": {\"$sort\": {\"n\": 1}}, "
+                "\"2\": {\"$skip\": 1}, \"3\": {\"$limit\": 1}}",
+                grouped, G_N_ELEMENTS(grouped));
+}
+
+static void
+limit_exhausted_tests (void)
+{
+   static const gchar *expected[] = {
+      "{\"_id\": 2, \"kind\": \"b\", \"n\": 1, \"x\": 2.5}",
+   };
+   MongoPipeline *pipeline;
+   MongoBson *bson;
+   GError *error = NULL;
+
+   pipeline = create_pipeline("{\"0\": {\"$skip\": 1}, \"1\": {\"$limit\": 1}}");
+
+   bson = mongo_bson_new_from_json(gDocuments[0], -1, &error);
+   g_assert_no_error(error);
+   g_assert(mongo_pipeline_push(pipeline, bson));
+   mongo_bson_unref(bson);
+
+   bson = mongo_bson_new_from_json(gDocuments[1], -1, &error);
+   g_assert_no_error(error);
+   g_assert(!mongo_pipeline_push(pipeline, bson));
+   mongo_bson_unref(bson);
+
+   mongo_pipeline_finish(pipeline);
+   assert_results(pipeline, expected, G_N_ELEMENTS(expected));
+   mongo_pipeline_unref(pipeline);
+}
+
+static void
+run_tests (void)
+{
+   static const gchar *expected[] = {
+      "{\"_id\": \"a\", \"n\": 3}",
+      "{\"_id\": \"b\", \"n\": 2}",
+      "{\"_id\": null, \"n\": 1}",
+   };
+   MongoBsonReader *reader;
+   MongoPipeline *pipeline;
+   GInputStream *stream;
+   GByteArray *bytes;
+   MongoBson *bson;
+   GError *error = NULL;
+   const guint8 *data;
+   gsize length;
+   guint i;
+
+   bytes = g_byte_array_new();
+   for (i = 0; i < G_N_ELEMENTS(gDocuments); i++) {
+      bson = mongo_bson_new_from_json(gDocuments[i], -1, &error);
+      g_assert_no_error(error);
+      data = mongo_bson_get_data(bson, &length);
+      g_byte_array_append(bytes, data, length);
+      mongo_bson_unref(bson);
+   }
+
+   stream = g_memory_input_stream_new_from_data(bytes->data, bytes->len, NULL);
+   reader = mongo_bson_reader_new(stream);
+   pipeline = create_pipeline("{\"0\": {\"$group\": {\"_id\": \"$kind\", "
+                              "\"n\": {\"$count\": {}}}}}");
+
+   g_assert(mongo_pipeline_run(pipeline, reader, NULL, &error));
+   g_assert_no_error(error);
+   assert_results(pipeline, expected, G_N_ELEMENTS(expected));
+
+   mongo_pipeline_unref(pipeline);
+   g_object_unref(reader);
+   g_object_unref(stream);
+   g_byte_array_free(bytes, TRUE);
+}
+
+static void
+invalid_tests (void)
+{
+   static const gchar *invalid[] = {
+      "{\"0\": {\"$out\": \"collection\"}}",
+      "{\"0\": 1}",
+      "{\"0\": {\"$match\": {}, \"$limit\": 1}}",
+      "{\"0\": {\"$limit\": 0}}",
+      "{\"0\": {\"$limit\": 1e300}}",
+      "{\"0\": {\"$limit\": -1e300}}",
+      "{\"0\": {\"$limit\": 1.5}}",
+      "{\"0\": {\"$skip\": -1}}",
+      "{\"0\": {\"$project\": {\"a\": 1, \"b\": 0}}}",
+      "{\"0\": {\"$project\": {\"a\": \"$b\"}}}",
+      "{\"0\": {\"$group\": {\"n\": {\"$sum\": 1}}}}",
+      "{\"0\": {\"$group\": {\"_id\": null, \"n\": {\"$push\": \"$a\"}}}}",
+      "{\"0\": {\"$group\": {\"_id\": null, \"n\": {\"$sum\": {\"a\": 1}}}}}",
+      "{\"0\": {\"$group\": {\"_id\": \"$\"}}}",
+      "{\"0\": {\"$group\": {\"_id\": {\"a\": \"$a\", \"b\": {}}}}}",
+      "{\"0\": {\"$match\": {\"a\": 1}}, \"1\": {\"$sort\": {\"a\": \"up\"}}}",
+   };
+   MongoPipeline *pipeline;
+   MongoBson *bson;
+   GError *error = NULL;
+   guint i;
+
+   for (i = 0; i < G_N_ELEMENTS(invalid); i++) {
+      bson = mongo_bson_new_from_json(invalid[i], -1, &error);
+      g_assert_no_error(error);
+      pipeline = mongo_pipeline_new(bson, &error);
+      g_assert(!pipeline);
+      g_assert(error);
+      g_clear_error(&error);
+      mongo_bson_unref(bson);
+   }
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_type_init();
+   g_test_init(&argc, &argv, NULL);
+   g_test_add_func("/MongoPipeline/match_project", match_project_tests);
+   g_test_add_func("/MongoPipeline/group", group_tests);
+   g_test_add_func("/MongoPipeline/sort_limit", sort_limit_tests);
+   g_test_add_func("/MongoPipeline/limit_exhausted", limit_exhausted_tests);
+   g_test_add_func("/MongoPipeline/run", run_tests);
+   g_test_add_func("/MongoPipeline/invalid", invalid_tests);
+   return g_test_run();
+}
@@ -0,0 +1,270 @@
+#include <mongo-glib/mongo-glib.h>
+#include <string.h>
+
+static gint
+compare_keys (GByteArray *a,
+              GByteArray *b)
+{
+   gint ret;
+
+   if (!(ret = memcmp(a->data, b->data, MIN(a->len, b->len)))) {
+      ret = (a->len > b->len) - (a->len < b->len);
+   }
+
+   return (ret > 0) - (ret < 0);
+}
+
+static gint
+sign (gint value)
+{
+   return (value > 0) - (value < 0);
+}
+
+static GPtrArray *
+get_values (void)
+{
+   MongoDecimal128 decimal;
+   GPtrArray *values;
+   MongoObjectId oid;
+   MongoBson *bson;
+   MongoBson *child;
+   GTimeVal tv = { 0 };
+
+   values = g_ptr_array_new_with_free_func((GDestroyNotify)mongo_bson_unref);
+
+#define ADD(_stmt) \
+   bson = mongo_bson_new(); \
+   _stmt; \
+   g_ptr_array_add(values, bson)
+
+   ADD(mongo_bson_append_min_key(bson, "v"));
+   ADD(mongo_bson_append_undefined(bson, "v"));
+   ADD(mongo_bson_append_null(bson, "v"));
+   ADD((void)0); /* Missing */
+   ADD(mongo_bson_append_double(bson, "v", 0.0 / 0.0));
+   ADD(mongo_bson_append_double(bson, "v", -1.0 / 0.0));
+   ADD(mongo_bson_append_int64(bson, "v", G_MININT64));
+   ADD(mongo_bson_append_int(bson, "v", -3));
+   ADD(mongo_bson_append_double(bson, "v", -2.5));
+   ADD(mongo_bson_append_double(bson, "v", -0.0));
+   ADD(mongo_bson_append_int(bson, "v", 0));
+   ADD(mongo_bson_append_double(bson, "v", 0.5));
+   mongo_decimal128_init_from_string(&decimal, "0.75");
+   ADD(mongo_bson_append_decimal128(bson, "v", &decimal));
+   ADD(mongo_bson_append_int64(bson, "v", 1));
+   mongo_decimal128_init_from_string(&decimal, "1.000");
+   ADD(mongo_bson_append_decimal128(bson, "v", &decimal));
+   ADD(mongo_bson_append_double(bson, "v", 1.0));
+   ADD(mongo_bson_append_double(bson, "v", 9007199254740992.0));
+   ADD(mongo_bson_append_int64(bson, "v", G_GINT64_CONSTANT(9007199254740993)));
+   ADD(mongo_bson_append_int64(bson, "v", G_MAXINT64));
+   ADD(mongo_bson_append_double(bson, "v", 9223372036854775808.0));
+   ADD(mongo_bson_append_double(bson, "v", 1.0 / 0.0));
+   ADD(mongo_bson_append_string(bson, "v", ""));
+   ADD(mongo_bson_append_string(bson, "v", "a"));
+   ADD(mongo_bson_append_symbol(bson, "v", "a"));
+   ADD(mongo_bson_append_string(bson, "v", "a\x01"));
+   ADD(mongo_bson_append_string(bson, "v", "ab"));
+   ADD(mongo_bson_append_string(bson, "v", "b"));
+
+   child = mongo_bson_new();
+   ADD(mongo_bson_append_bson(bson, "v", child));
+   mongo_bson_append_int(child, "a", 1);
+   ADD(mongo_bson_append_bson(bson, "v", child));
+   mongo_bson_append_string(child, "b", "x");
+   ADD(mongo_bson_append_bson(bson, "v", child));
+   mongo_bson_unref(child);
+   child = mongo_bson_new();
+   mongo_bson_append_double(child, "a", 1.5);
+   ADD(mongo_bson_append_bson(bson, "v", child));
+   mongo_bson_unref(child);
+
+   ADD(mongo_bson_append_array_begin(bson, "v");
+       mongo_bson_append_int(bson, "0", 2);
+       mongo_bson_append_array_end(bson));
+
+   /*
+    * Binary values sort by length, then subtype, then contents.
+    */
+   ADD(mongo_bson_append_binary(bson, "v", MONGO_BSON_BINARY_GENERIC,
+                                NULL, 0));
+   ADD(mongo_bson_append_binary(bson, "v", MONGO_BSON_BINARY_USER,
+                                (const guint8 *)"z", 1));
+   ADD(mongo_bson_append_binary(bson, "v", MONGO_BSON_BINARY_GENERIC,
+                                (const guint8 *)"ab", 2));
+   ADD(mongo_bson_append_binary(bson, "v", MONGO_BSON_BINARY_GENERIC,
+                                (const guint8 *)"b\0", 2));
+   ADD(mongo_bson_append_binary(bson, "v", MONGO_BSON_BINARY_MD5,
+                                (const guint8 *)"aa", 2));
+
+   mongo_object_id_init_from_string(&oid, "000000000000000000000001");
+   ADD(mongo_bson_append_object_id(bson, "v", &oid));
+   mongo_object_id_init_from_string(&oid, "ff0000000000000000000000");
+   ADD(mongo_bson_append_object_id(bson, "v", &oid));
+   ADD(mongo_bson_append_boolean(bson, "v", FALSE));
+   ADD(mongo_bson_append_boolean(bson, "v", TRUE));
+   tv.tv_sec = -10;
+   ADD(mongo_bson_append_timeval(bson, "v", &tv));
+   tv.tv_sec = 10;
+   ADD(mongo_bson_append_timeval(bson, "v", &tv));
+   ADD(mongo_bson_append_timestamp(bson, "v", 1, 2));
+   ADD(mongo_bson_append_timestamp(bson, "v", 2, 1));
+   ADD(mongo_bson_append_regex(bson, "v", "a", "i"));
+   ADD(mongo_bson_append_regex(bson, "v", "a", "m"));
+   ADD(mongo_bson_append_regex(bson, "v", "ab", ""));
+   ADD(mongo_bson_append_dbpointer(bson, "v", "db.a", &oid));
+   ADD(mongo_bson_append_dbpointer(bson, "v", "db.b", &oid));
+   ADD(mongo_bson_append_javascript(bson, "v", "f()"));
+   child = mongo_bson_new();
+   ADD(mongo_bson_append_javascript_with_scope(bson, "v", "f()", child));
+   mongo_bson_append_int(child, "x", 1);
+   ADD(mongo_bson_append_javascript_with_scope(bson, "v", "f()", child));
+   ADD(mongo_bson_append_javascript_with_scope(bson, "v", "g()", child));
+   mongo_bson_unref(child);
+   ADD(mongo_bson_append_max_key(bson, "v"));
+
+#undef ADD
+
+   return values;
+}
+
+static void
+check_order (const gchar *json,
+             GPtrArray   *values)
+{
+   MongoSortSpec *spec;
+   GByteArray *key1;
+   GByteArray *key2;
+   MongoBson *bson;
+   GError *error = NULL;
+   guint i;
+   guint j;
+
+   bson = mongo_bson_new_from_json(json, -1, &error);
+   g_assert_no_error(error);
+   spec = mongo_sort_spec_new(bson, &error);
+   g_assert_no_error(error);
+   g_assert(spec);
+   mongo_bson_unref(bson);
+
+   key1 = g_byte_array_new();
+   key2 = g_byte_array_new();
+
+   for (i = 0; i < values->len; i++) {
+      g_byte_array_set_size(key1, 0);
+      mongo_sort_spec_encode(spec, g_ptr_array_index(values, i), key1);
+      for (j = 0; j < values->len; j++) {
+         g_byte_array_set_size(key2, 0);
+         mongo_sort_spec_encode(spec, g_ptr_array_index(values, j), key2);
+         g_assert_cmpint(compare_keys(key1, key2), ==,
+                         sign(mongo_sort_spec_compare(spec,
+                              g_ptr_array_index(values, i),
+                              g_ptr_array_index(values, j))));
+      }
+   }
+
+   g_byte_array_unref(key1);
+   g_byte_array_unref(key2);
+   mongo_sort_spec_unref(spec);
+}
+
+static void
+encode_tests (void)
+{
+   MongoSortSpec *spec;
+   GPtrArray *values;
+   MongoBson *bson;
+   GError *error = NULL;
+   guint i;
+
+   values = get_values();
+   check_order("{\"v\": 1}", values);
+   check_order("{\"v\": -1}", values);
+
+   /*
+    * The values are listed in ascending order, except where they are
+    * equal.
+    */
+   bson = mongo_bson_new_from_json("{\"v\": 1}", -1, &error);
+   spec = mongo_sort_spec_new(bson, &error);
+   g_assert_no_error(error);
+   for (i = 1; i < values->len; i++) {
+      g_assert_cmpint(mongo_sort_spec_compare(spec,
+                                              g_ptr_array_index(values, i - 1),
+                                              g_ptr_array_index(values, i)),
+                      <=, 0);
+   }
+   mongo_sort_spec_unref(spec);
+   mongo_bson_unref(bson);
+
+   g_ptr_array_unref(values);
+}
+
+static void
+compound_tests (void)
+{
+   GPtrArray *values;
+   GError *error = NULL;
+   const gchar *docs[] = {
+      "{\"a\": 1, \"b\": {\"c\": \"x\"}}",
+      "{\"a\": 1, \"b\": {\"c\": \"y\"}}",
+      "{\"a\": 1.0, \"b\": {\"c\": \"x\\u0001\"}}",
+      "{\"a\": 2, \"b\": {\"c\": 5}}",
+      "{\"a\": 2, \"b\": 5}",
+      "{\"a\": 2}",
+      "{\"b\": {\"c\": [1, 2]}}",
+      "{\"a\": \"s\", \"b\": {\"c\": null}}",
+   };
+   guint i;
+
+   values = g_ptr_array_new_with_free_func((GDestroyNotify)mongo_bson_unref);
+   for (i = 0; i < G_N_ELEMENTS(docs); i++) {
+      g_ptr_array_add(values, mongo_bson_new_from_json(docs[i], -1, &error));
+      g_assert_no_error(error);
+   }
+
+   check_order("{\"a\": 1, \"b.c\": -1}", values);
+   check_order("{\"b.c\": 1, \"a\": -1}", values);
+   check_order("{\"b.c.1\": 1}", values);
+   check_order("{\"missing\": 1, \"a\": 1}", values);
+
+   g_ptr_array_unref(values);
+}
+
+static void
+invalid_tests (void)
+{
+   const gchar *specs[] = {
+      "{}",
+      "{\"a\": 0}",
+      "{\"a\": \"asc\"}",
+      "{\"a\": 1, \"b..c\": 1}",
+      "{\".a\": 1}",
+   };
+   MongoSortSpec *spec;
+   MongoBson *bson;
+   GError *error = NULL;
+   guint i;
+
+   for (i = 0; i < G_N_ELEMENTS(specs); i++) {
+      bson = mongo_bson_new_from_json(specs[i], -1, &error);
+      g_assert_no_error(error);
+      spec = mongo_sort_spec_new(bson, &error);
+      g_assert_error(error, MONGO_SORT_SPEC_ERROR,
+                     MONGO_SORT_SPEC_ERROR_INVALID_SPEC);
+      g_assert(!spec);
+      g_clear_error(&error);
+      mongo_bson_unref(bson);
+   }
+}
+
+gint
+main (gint   argc,
+      gchar *argv[])
+{
+   g_test_init(&argc, &argv, NULL);
+   g_test_add_func("/MongoSortSpec/encode", encode_tests);
+   g_test_add_func("/MongoSortSpec/compound", compound_tests);
+   g_test_add_func("/MongoSortSpec/invalid", invalid_tests);
+   return g_test_run();
+}